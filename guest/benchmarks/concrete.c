@@ -0,0 +1,40 @@
+/**
+ * Concrete workload: no symbolic data, measures the speed of
+ * concrete execution with the S2E instrumentation in place.
+ */
+
+#include <stdio.h>
+#include <s2e.h>
+
+#define SIEVE_SIZE 100000
+#define ROUNDS 200
+
+static char sieve[SIEVE_SIZE];
+
+static unsigned count_primes(void)
+{
+  unsigned i, j, count = 0;
+
+  memset(sieve, 1, sizeof(sieve));
+  for (i = 2; i < SIEVE_SIZE; ++i) {
+    if (!sieve[i])
+      continue;
+    ++count;
+    for (j = i * 2; j < SIEVE_SIZE; j += i)
+      sieve[j] = 0;
+  }
+  return count;
+}
+
+int main(void)
+{
+  unsigned round, total = 0;
+
+  for (round = 0; round < ROUNDS; ++round) {
+    total += count_primes();
+  }
+
+  printf("%u\n", total);
+  s2e_kill_state(0, "concrete benchmark completed");
+  return 0;
+}
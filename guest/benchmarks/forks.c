@@ -0,0 +1,27 @@
+/**
+ * Fork-heavy branching: every bit of a symbolic value is tested,
+ * which yields 2^BITS paths.
+ */
+
+#include <stdio.h>
+#include <s2e.h>
+
+#define BITS 10
+
+int main(void)
+{
+  unsigned value = 0, i, path = 0;
+
+  s2e_enable_forking();
+  s2e_make_symbolic(&value, sizeof(value), "value");
+
+  for (i = 0; i < BITS; ++i) {
+    if (value & (1 << i))
+      path = path * 3 + 1;
+    else
+      path = path * 3 + 2;
+  }
+
+  s2e_kill_state(path & 0xff, "forks benchmark completed");
+  return 0;
+}
@@ -0,0 +1,174 @@
+#!/usr/bin/env python
+#
+# Runs the S2E benchmark workloads and reports their performance
+# counters in JSON, one line per workload.
+#
+# The snapshot must be taken in the guest while it waits in
+#   ./s2eget bench.sh && sh ./bench.sh
+# Each workload gets its own bench.sh and configuration file, the guest
+# binaries (bench-*) are downloaded from the guest build folder.
+#
+
+import argparse
+import ast
+import json
+import os
+import subprocess
+import sys
+import time
+
+BASE_PLUGINS = ['BaseInstructions', 'HostFiles']
+
+TRACER_PLUGINS = ['ExecutionTracer', 'TestCaseGenerator', 'StateSwitchTracer', 'MemoryTracer']
+
+# name: (guest binary, extra plugins, extra klee arguments)
+WORKLOADS = {
+    'concrete': ('bench-concrete', [], []),
+    'strparse': ('bench-strparse', [], []),
+    'forks': ('bench-forks', [], []),
+    'switches': ('bench-switches', [], ['--use-random-path=true']),
+    'tracer': ('bench-forks', TRACER_PLUGINS, []),
+}
+
+ORDER = ['concrete', 'strparse', 'forks', 'switches', 'tracer']
+
+
+def lua_string(s):
+    return '"%s"' % s.replace('\\', '\\\\').replace('"', '\\"')
+
+
+def lua_list(items):
+    return '{' + ', '.join(lua_string(i) for i in items) + '}'
+
+
+def write_config(path, workdir, bindir, plugins, klee_args):
+    with open(path, 'w') as f:
+        f.write('s2e = {\n    kleeArgs = %s\n}\n\n' % lua_list(klee_args))
+        f.write('plugins = %s\n\n' % lua_list(BASE_PLUGINS + plugins))
+        f.write('pluginsConfig = {}\n')
+        f.write('pluginsConfig.HostFiles = {\n    baseDirs = %s\n}\n' %
+                lua_list([workdir, bindir]))
+        if 'MemoryTracer' in plugins:
+            f.write('pluginsConfig.MemoryTracer = {\n    monitorMemory = true\n}\n')
+
+
+def write_script(path, binary):
+    with open(path, 'w') as f:
+        f.write('./s2eget %s && chmod +x ./%s && ./%s\n' % (binary, binary, binary))
+
+
+def read_stats(path):
+    """Returns the header and the last line of run.stats as a dictionary"""
+    header = None
+    last = None
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            if header is None:
+                header = ast.literal_eval(line)
+            else:
+                last = line
+
+    if header is None or last is None:
+        return None
+
+    return dict(zip(header, ast.literal_eval(last)))
+
+
+def compute_metrics(stats):
+    wall = float(stats.get('WallTime', 0)) or 1e-9
+    switches = stats.get('StateSwitches', 0)
+
+    return {
+        'wall_time_s': wall,
+        'instructions_per_s': stats.get('CpuInstructions', 0) / wall,
+        'forks_per_s': stats.get('Forks', 0) / wall,
+        'state_switch_us': (float(stats.get('StateSwitchTime', 0)) * 1e6 / switches) if switches else 0,
+        'solver_queries_per_s': stats.get('NumQueries', 0) / wall,
+        'peak_rss_bytes': stats.get('PeakResidentMemory', 0),
+    }
+
+
+def run_workload(args, name):
+    binary, plugins, klee_args = WORKLOADS[name]
+
+    workdir = os.path.abspath(os.path.join(args.outdir, name))
+    if not os.path.isdir(workdir):
+        os.makedirs(workdir)
+
+    config = os.path.join(workdir, 'config.lua')
+    write_config(config, workdir, os.path.abspath(args.bindir), plugins, klee_args)
+    write_script(os.path.join(workdir, 'bench.sh'), binary)
+
+    s2eout = os.path.join(workdir, 's2e-out')
+    cmd = [args.qemu, args.image,
+           '-s2e-config-file', config,
+           '-s2e-output-dir', s2eout,
+           '-loadvm', args.snapshot,
+           '-nographic'] + args.qemu_args
+
+    with open(os.path.join(workdir, 'qemu.log'), 'w') as log:
+        proc = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT)
+        start = time.time()
+        while proc.poll() is None:
+            if args.timeout and time.time() - start > args.timeout:
+                proc.kill()
+                proc.wait()
+                break
+            time.sleep(0.5)
+
+    result = {'workload': name, 'status': proc.returncode}
+
+    stats = None
+    statsFile = os.path.join(s2eout, 'run.stats')
+    if os.path.exists(statsFile):
+        stats = read_stats(statsFile)
+
+    if stats is None:
+        result['error'] = 'no statistics in %s' % statsFile
+    else:
+        result.update(compute_metrics(stats))
+
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Runs the S2E benchmark workloads')
+    parser.add_argument('--qemu', required=True, help='S2E-enabled qemu-system binary')
+    parser.add_argument('--image', required=True, help='Disk image with the benchmark snapshot')
+    parser.add_argument('--snapshot', default='bench', help='Name of the snapshot')
+    parser.add_argument('--bindir', required=True, help='Guest build folder with the bench-* binaries')
+    parser.add_argument('--outdir', default='bench-results', help='Where to store the runs')
+    parser.add_argument('--timeout', type=int, default=600, help='Seconds before a run is killed')
+    parser.add_argument('--workloads', default=','.join(ORDER),
+                        help='Comma-separated list among ' + ', '.join(ORDER))
+    parser.add_argument('qemu_args', nargs='*', help='Extra arguments for qemu, after --')
+    args = parser.parse_args()
+
+    names = [n for n in args.workloads.split(',') if n]
+    for n in names:
+        if n not in WORKLOADS:
+            sys.stderr.write('Unknown workload %s\n' % n)
+            return 1
+
+    if not os.path.isdir(args.outdir):
+        os.makedirs(args.outdir)
+
+    failed = False
+    with open(os.path.join(args.outdir, 'results.json'), 'w') as out:
+        for n in names:
+            result = run_workload(args, n)
+            failed |= 'error' in result
+            line = json.dumps(result, sort_keys=True)
+            out.write(line + '\n')
+            out.flush()
+            print(line)
+            sys.stdout.flush()
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,53 @@
+/**
+ * Symbolic string parsing: a key=value parser over a symbolic buffer.
+ * Stresses the solver with byte-level comparisons.
+ */
+
+#include <stdio.h>
+#include <s2e.h>
+
+#define INPUT_SIZE 12
+
+static int parse_number(const char *s, int *value)
+{
+  int v = 0, digits = 0;
+
+  while (*s >= '0' && *s <= '9') {
+    v = v * 10 + (*s - '0');
+    ++s;
+    ++digits;
+  }
+  *value = v;
+  return digits > 0 && *s == 0;
+}
+
+static int parse(char *input)
+{
+  char *eq = strchr(input, '=');
+  int value;
+
+  if (!eq)
+    return -1;
+  *eq = 0;
+
+  if (strcmp(input, "size") && strcmp(input, "id"))
+    return -2;
+
+  if (!parse_number(eq + 1, &value))
+    return -3;
+
+  return value > 1000 ? 1 : 0;
+}
+
+int main(void)
+{
+  char input[INPUT_SIZE + 1];
+
+  memset(input, 0, sizeof(input));
+  s2e_enable_forking();
+  s2e_make_symbolic(input, INPUT_SIZE, "input");
+  input[INPUT_SIZE] = 0;
+
+  s2e_kill_state(parse(input), "strparse benchmark completed");
+  return 0;
+}
@@ -0,0 +1,31 @@
+/**
+ * State switch stress: a few states take turns,
+ * each one yields to the next one many times.
+ */
+
+#include <stdio.h>
+#include <s2e.h>
+
+#define BITS 4
+#define YIELDS 500
+
+int main(void)
+{
+  unsigned value = 0, i;
+
+  s2e_enable_forking();
+  s2e_make_symbolic(&value, sizeof(value), "value");
+
+  for (i = 0; i < BITS; ++i) {
+    if (value & (1 << i))
+      s2e_message("1");
+  }
+  s2e_disable_forking();
+
+  for (i = 0; i < YIELDS; ++i) {
+    s2e_yield();
+  }
+
+  s2e_kill_state(0, "switches benchmark completed");
+  return 0;
+}
@@ -429,6 +429,49 @@ static inline int s2e_read(int fd, char *buf, int count)
     return res;
 }
 
+/** CooperativeSearcher plugin */
+/** Set the scheduling priority of the current state. The state keeps
+    running, the priority is used at the next scheduling decision. */
+static inline void s2e_coop_set_priority(int priority)
+{
+    __asm__ __volatile__(
+        "stmfd sp!,{r0}\n\t"
+        "MOV r0, %[priority]\n\t"
+        S2E_INSTRUCTION_COMPLEX(AB, 02)
+        ".ALIGN\n\t"
+        "ldmfd sp!,{r0}\n\t"
+        : /* no output operand*/
+        : [priority] "r" (priority)
+        : "r0"
+    );
+}
+
+/** Set the scheduling priority of the state with the given id. */
+static inline void s2e_coop_set_state_priority(unsigned id, int priority)
+{
+    __asm__ __volatile__(
+        "stmfd sp!,{r0, r1}\n\t"
+        "MOV r0, %[id]\n\t"
+        "MOV r1, %[priority]\n\t"
+        S2E_INSTRUCTION_COMPLEX(AB, 03)
+        ".ALIGN\n\t"
+        "ldmfd sp!,{r0, r1}\n\t"
+        : /* no output operand*/
+        : [id] "r" (id), [priority] "r" (priority)
+        : "r0", "r1"
+    );
+}
+
+/** Run the state of highest priority, if it is higher than the one
+    of the current state. */
+static inline void s2e_coop_schedule_highest(void)
+{
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_COMPLEX(AB, 04)
+        ".ALIGN\n"
+    );
+}
+
 /** CodeSelector plugin */
 /** Enable forking in the current process (entire address space or user mode only). */
 static inline void s2e_codeselector_enable_address_space(unsigned user_mode_only)
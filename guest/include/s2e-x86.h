@@ -467,6 +467,35 @@ static inline void s2e_rawmon_loadmodule2(const char *name,
     );
 }
 
+/** CooperativeSearcher plugin */
+/** Set the scheduling priority of the current state. The state keeps
+    running, the priority is used at the next scheduling decision. */
+static inline void s2e_coop_set_priority(int priority)
+{
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_COMPLEX(AB, 02)
+        : : "a" (priority)
+    );
+}
+
+/** Set the scheduling priority of the state with the given id. */
+static inline void s2e_coop_set_state_priority(unsigned id, int priority)
+{
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_COMPLEX(AB, 03)
+        : : "a" (id), "c" (priority)
+    );
+}
+
+/** Run the state of highest priority, if it is higher than the one
+    of the current state. */
+static inline void s2e_coop_schedule_highest(void)
+{
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_COMPLEX(AB, 04)
+    );
+}
+
 /** CodeSelector plugin */
 /** Enable forking in the current process (entire address space or user mode only). */
 static inline void s2e_codeselector_enable_address_space(unsigned user_mode_only)
@@ -37,9 +37,15 @@
 
 #define _GNU_SOURCE
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <s2e.h>
 
@@ -117,6 +123,487 @@ static const char* __base_name(const char* path) {
 }
 
 
+// ***********************************************
+// Symbolic files and stdin
+// ***********************************************
+
+// Symbolic files are served from a buffer in the address space of the
+// program. The program reads the buffer with plain memory copies, so
+// symbolic data never goes through the kernel. Each page of the buffer
+// is made symbolic the first time it is read.
+
+#define SYMFILE_PAGE_SIZE 0x1000
+#define SYMFILE_MAX_FILES 16
+#define SYMFILE_MAX_FDS   1024
+
+typedef struct _symfile_t
+{
+    const char *path;          // Canonical path, NULL for stdin
+    char name[256];            // Path with slashes replaced by underscores
+    char *data;
+    size_t size;
+    unsigned nb_pages;
+    unsigned char *page_ready; // Nonzero when the page is already symbolic
+} symfile_t;
+
+typedef struct _symfd_t
+{
+    symfile_t *file;
+    off_t offset;
+} symfd_t;
+
+static symfile_t s_symfiles[SYMFILE_MAX_FILES];
+static unsigned s_symfiles_count;
+static symfd_t s_symfds[SYMFILE_MAX_FDS];
+static int s_symfile_concolic;
+
+static void *__real_symbol(const char *name)
+{
+    void *sym = dlsym(RTLD_NEXT, name);
+    if (!sym) {
+        fprintf(stderr, "init_env: could not find %s\n", name);
+        exit(1);
+    }
+    return sym;
+}
+
+// Types of the intercepted functions
+typedef int (*T_open)(const char *, int, ...);
+typedef int (*T_openat)(int, const char *, int, ...);
+typedef ssize_t (*T_read)(int, void *, size_t);
+typedef off_t (*T_lseek)(int, off_t, int);
+typedef off64_t (*T_lseek64)(int, off64_t, int);
+typedef void *(*T_mmap)(void *, size_t, int, int, int, off_t);
+typedef void *(*T_mmap64)(void *, size_t, int, int, int, off64_t);
+typedef int (*T_close)(int);
+typedef ssize_t (*T_copy_file_range)(int, loff_t *, int, loff_t *, size_t, unsigned int);
+typedef FILE *(*T_fopen)(const char *, const char *);
+
+#define REAL(type, name) \
+    static type real_##name = NULL; \
+    if (!real_##name) { \
+        real_##name = (type) __real_symbol(#name); \
+    }
+
+static symfile_t *__symfile_new(const char *path, const char *name, size_t size)
+{
+    symfile_t *file;
+    unsigned i;
+
+    if (s_symfiles_count == SYMFILE_MAX_FILES) {
+        __emit_error("too many symbolic files for s2e_init_env");
+    }
+
+    file = &s_symfiles[s_symfiles_count++];
+    file->path = path;
+
+    // Same naming scheme as s2ecmd symbfile, so that test case
+    // generators can reconstruct the concrete files
+    strncpy(file->name, name, sizeof(file->name) - 1);
+    file->name[sizeof(file->name) - 1] = 0;
+    for (i = 0; file->name[i]; ++i) {
+        if (file->name[i] == '/') {
+            file->name[i] = '_';
+        }
+    }
+
+    file->size = size;
+    file->data = calloc(1, size + 1);
+    file->nb_pages = (size + SYMFILE_PAGE_SIZE - 1) / SYMFILE_PAGE_SIZE;
+    file->page_ready = calloc(1, file->nb_pages + 1);
+    if (!file->data || !file->page_ready) {
+        __emit_error("not enough memory for symbolic file");
+    }
+
+    return file;
+}
+
+// Uses the current contents of the file as concrete values
+static void __symfile_add(const char *path)
+{
+    char resolved[PATH_MAX];
+    symfile_t *file;
+    size_t done = 0;
+    off_t size;
+    int fd;
+
+    if (!realpath(path, resolved) || (fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "--sym-file: could not open %s\n", path);
+        exit(1);
+    }
+
+    size = lseek(fd, 0, SEEK_END);
+    if (size < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "--sym-file: could not determine the size of %s\n", path);
+        exit(1);
+    }
+
+    file = __symfile_new(strdup(resolved), resolved, size);
+    while (done < (size_t) size) {
+        ssize_t count = read(fd, file->data + done, size - done);
+        if (count <= 0) {
+            fprintf(stderr, "--sym-file: could not read %s\n", path);
+            exit(1);
+        }
+        done += count;
+    }
+
+    close(fd);
+    myprintf("Symbolic file %s (%u bytes)\n", file->path, (unsigned) file->size);
+}
+
+static void __symfile_make_ready(symfile_t *file, size_t offset, size_t count)
+{
+    unsigned page, first, last;
+
+    if (!count || offset >= file->size) {
+        return;
+    }
+
+    if (count > file->size - offset) {
+        count = file->size - offset;
+    }
+
+    first = offset / SYMFILE_PAGE_SIZE;
+    last = (offset + count - 1) / SYMFILE_PAGE_SIZE;
+    for (page = first; page <= last; ++page) {
+        char varname[512];
+        size_t start, length;
+
+        if (file->page_ready[page]) {
+            continue;
+        }
+
+        start = page * SYMFILE_PAGE_SIZE;
+        length = file->size - start;
+        if (length > SYMFILE_PAGE_SIZE) {
+            length = SYMFILE_PAGE_SIZE;
+        }
+
+        snprintf(varname, sizeof(varname), "__symfile___%s___%u_%u_symfile__",
+                 file->name, page, file->nb_pages);
+
+        #ifndef DEBUG_NATIVE
+        if (s_symfile_concolic) {
+            s2e_make_concolic(file->data + start, length, varname);
+        } else {
+            s2e_make_symbolic(file->data + start, length, varname);
+        }
+        #endif
+
+        file->page_ready[page] = 1;
+    }
+}
+
+static symfile_t *__symfile_lookup(const char *path)
+{
+    char resolved[PATH_MAX];
+    unsigned i;
+
+    if (!s_symfiles_count || !realpath(path, resolved)) {
+        return NULL;
+    }
+
+    for (i = 0; i < s_symfiles_count; ++i) {
+        if (s_symfiles[i].path && !strcmp(s_symfiles[i].path, resolved)) {
+            return &s_symfiles[i];
+        }
+    }
+    return NULL;
+}
+
+static symfd_t *__symfile_get_fd(int fd)
+{
+    if (fd < 0 || fd >= SYMFILE_MAX_FDS || !s_symfds[fd].file) {
+        return NULL;
+    }
+    return &s_symfds[fd];
+}
+
+static ssize_t __symfile_read(symfd_t *fd, void *buf, size_t count)
+{
+    symfile_t *file = fd->file;
+
+    if ((size_t) fd->offset >= file->size) {
+        return 0;
+    }
+
+    if (count > file->size - fd->offset) {
+        count = file->size - fd->offset;
+    }
+
+    __symfile_make_ready(file, fd->offset, count);
+    memcpy(buf, file->data + fd->offset, count);
+    fd->offset += count;
+    return count;
+}
+
+static off_t __symfile_seek(symfd_t *fd, off_t offset, int whence)
+{
+    off_t base;
+
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = fd->offset; break;
+        case SEEK_END: base = fd->file->size; break;
+        default: errno = EINVAL; return -1;
+    }
+
+    if (base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fd->offset = base + offset;
+    return fd->offset;
+}
+
+// Maps a private copy of the file. Only the pages in the
+// mapped range are made symbolic.
+static void *__symfile_mmap(symfd_t *fd, void *addr, size_t length, int prot,
+                            int flags, off_t offset)
+{
+    REAL(T_mmap, mmap);
+    symfile_t *file = fd->file;
+    void *ret;
+
+    flags = (flags & ~MAP_SHARED) | MAP_PRIVATE | MAP_ANONYMOUS;
+    ret = real_mmap(addr, length, prot | PROT_WRITE, flags, -1, 0);
+    if (ret == MAP_FAILED) {
+        return ret;
+    }
+
+    if (offset >= 0 && (size_t) offset < file->size) {
+        size_t count = file->size - offset;
+        if (count > length) {
+            count = length;
+        }
+        __symfile_make_ready(file, offset, count);
+        memcpy(ret, file->data + offset, count);
+    }
+
+    if (!(prot & PROT_WRITE)) {
+        mprotect(ret, length, prot);
+    }
+
+    return ret;
+}
+
+static ssize_t __symfile_cookie_read(void *cookie, char *buf, size_t size)
+{
+    return __symfile_read((symfd_t *) cookie, buf, size);
+}
+
+static int __symfile_cookie_seek(void *cookie, off64_t *offset, int whence)
+{
+    off_t ret = __symfile_seek((symfd_t *) cookie, *offset, whence);
+    if (ret < 0) {
+        return -1;
+    }
+    *offset = ret;
+    return 0;
+}
+
+static int __symfile_cookie_close(void *cookie)
+{
+    symfd_t *fd = (symfd_t *) cookie;
+    if (fd < s_symfds || fd >= s_symfds + SYMFILE_MAX_FDS) {
+        free(fd);
+    }
+    return 0;
+}
+
+static FILE *__symfile_fopen(symfd_t *fd)
+{
+    cookie_io_functions_t funcs = {
+        .read = __symfile_cookie_read,
+        .write = NULL,
+        .seek = __symfile_cookie_seek,
+        .close = __symfile_cookie_close
+    };
+    return fopencookie(fd, "r", funcs);
+}
+
+static void __symfile_set_stdin(size_t size)
+{
+    s_symfds[0].file = __symfile_new(NULL, "stdin", size);
+    s_symfds[0].offset = 0;
+    stdin = __symfile_fopen(&s_symfds[0]);
+    myprintf("Symbolic stdin (%u bytes)\n", (unsigned) size);
+}
+
+// Symbolic files are read-only, other open modes go to the real file
+static int __symfile_open(const char *path, int flags, int fd)
+{
+    symfile_t *file;
+
+    if (fd < 0 || fd >= SYMFILE_MAX_FDS || (flags & O_ACCMODE) != O_RDONLY) {
+        return fd;
+    }
+
+    s_symfds[fd].file = NULL;
+    if ((file = __symfile_lookup(path))) {
+        s_symfds[fd].file = file;
+        s_symfds[fd].offset = 0;
+    }
+    return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+    REAL(T_open, open);
+    mode_t mode = 0;
+
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+
+    return __symfile_open(path, flags, real_open(path, flags, mode));
+}
+
+int open64(const char *path, int flags, ...)
+{
+    REAL(T_open, open64);
+    mode_t mode = 0;
+
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+
+    return __symfile_open(path, flags, real_open64(path, flags, mode));
+}
+
+// Relative paths are only resolved against the current directory
+int openat(int dirfd, const char *path, int flags, ...)
+{
+    REAL(T_openat, openat);
+    mode_t mode = 0;
+    int fd;
+
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+
+    fd = real_openat(dirfd, path, flags, mode);
+    if (dirfd != AT_FDCWD && path[0] != '/') {
+        if (fd >= 0 && fd < SYMFILE_MAX_FDS) {
+            s_symfds[fd].file = NULL;
+        }
+        return fd;
+    }
+    return __symfile_open(path, flags, fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    REAL(T_read, read);
+    symfd_t *sfd = __symfile_get_fd(fd);
+    if (sfd) {
+        return __symfile_read(sfd, buf, count);
+    }
+    return real_read(fd, buf, count);
+}
+
+off_t lseek(int fd, off_t offset, int whence)
+{
+    REAL(T_lseek, lseek);
+    symfd_t *sfd = __symfile_get_fd(fd);
+    if (sfd) {
+        return __symfile_seek(sfd, offset, whence);
+    }
+    return real_lseek(fd, offset, whence);
+}
+
+off64_t lseek64(int fd, off64_t offset, int whence)
+{
+    REAL(T_lseek64, lseek64);
+    symfd_t *sfd = __symfile_get_fd(fd);
+    if (sfd) {
+        return __symfile_seek(sfd, offset, whence);
+    }
+    return real_lseek64(fd, offset, whence);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    REAL(T_mmap, mmap);
+    symfd_t *sfd = __symfile_get_fd(fd);
+    if (sfd) {
+        return __symfile_mmap(sfd, addr, length, prot, flags, offset);
+    }
+    return real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+    REAL(T_mmap64, mmap64);
+    symfd_t *sfd = __symfile_get_fd(fd);
+    if (sfd) {
+        return __symfile_mmap(sfd, addr, length, prot, flags, offset);
+    }
+    return real_mmap64(addr, length, prot, flags, fd, offset);
+}
+
+// Make callers fall back to read() so that the data stays in user space
+ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+                        size_t len, unsigned int flags)
+{
+    REAL(T_copy_file_range, copy_file_range);
+    if (__symfile_get_fd(fd_in)) {
+        errno = EXDEV;
+        return -1;
+    }
+    return real_copy_file_range(fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+int close(int fd)
+{
+    REAL(T_close, close);
+    if (__symfile_get_fd(fd)) {
+        s_symfds[fd].file = NULL;
+    }
+    return real_close(fd);
+}
+
+// stdio does not go through the functions above, so streams
+// on symbolic files are served from the model directly
+FILE *fopen(const char *path, const char *mode)
+{
+    REAL(T_fopen, fopen);
+    symfile_t *file;
+
+    if (mode[0] == 'r' && !strchr(mode, '+') && (file = __symfile_lookup(path))) {
+        symfd_t *fd = calloc(1, sizeof(*fd));
+        if (!fd) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        fd->file = file;
+        return __symfile_fopen(fd);
+    }
+
+    return real_fopen(path, mode);
+}
+
+FILE *fopen64(const char *path, const char *mode)
+{
+    REAL(T_fopen, fopen64);
+    if (__symfile_lookup(path)) {
+        return fopen(path, mode);
+    }
+    return real_fopen64(path, mode);
+}
+
+
 //Describes an executable portion of the address space
 typedef struct _procmap_entry_t
 {
@@ -248,7 +735,11 @@ static void __s2e_init_env(int *argcPtr, char ***argvPtr)
                      "   -concolic                 - Augment existing concrete arguments with symbolic values\n"
                      "   -sym-arg <N>              - Replace by a symbolic argument of length N\n"
                      "   -sym-args <MIN> <MAX> <N> - Replace by at least MIN arguments and at most\n"
-                     "                               MAX arguments, each with maximum length N\n\n");
+                     "                               MAX arguments, each with maximum length N\n"
+                     "   -sym-file <PATH>          - Make the contents of the file at PATH symbolic\n"
+                     "   -sym-stdin <N>            - Replace stdin by N symbolic bytes\n"
+                     "   -priority <N>             - Set the CooperativeSearcher priority of the\n"
+                     "                               current state and of the states it forks\n\n");
     }
 
     #ifndef DEBUG_NATIVE
@@ -291,6 +782,31 @@ static void __s2e_init_env(int *argcPtr, char ***argvPtr)
                           1024);
             }
         }
+        else if (__streq(argv[k], "--sym-file") || __streq(argv[k], "-sym-file")) {
+            const char *msg = "--sym-file expects a file name <path>";
+            if (++k == argc)
+                __emit_error(msg);
+
+            __symfile_add(argv[k++]);
+        }
+        else if (__streq(argv[k], "--sym-stdin") || __streq(argv[k], "-sym-stdin")) {
+            const char *msg = "--sym-stdin expects an integer argument <size>";
+            if (++k == argc)
+                __emit_error(msg);
+
+            __symfile_set_stdin(__str_to_int(argv[k++], msg));
+        }
+        else if (__streq(argv[k], "--priority") || __streq(argv[k], "-priority")) {
+            const char *msg = "--priority expects an integer argument <priority>";
+            if (++k == argc)
+                __emit_error(msg);
+
+            #ifndef DEBUG_NATIVE
+            s2e_coop_set_priority(__str_to_int(argv[k++], msg));
+            #else
+            k++;
+            #endif
+        }
         else if (__streq(argv[k], "--select-process") || __streq(argv[k], "-select-process")) {
             k++;
             myprintf("Forks will be restricted to the current address space\n");
@@ -317,6 +833,8 @@ static void __s2e_init_env(int *argcPtr, char ***argvPtr)
         }
     }
 
+    s_symfile_concolic = concolic_mode;
+
     final_argv = (char**) malloc((new_argc+1) * sizeof(*final_argv));
     memcpy(final_argv, new_argv, new_argc * sizeof(*final_argv));
     final_argv[new_argc] = 0;
@@ -225,6 +225,11 @@ static void handler_fork(const char **args)
     }
 }
 
+static void handler_priority(const char **args)
+{
+    s2e_coop_set_priority(atoi(args[0]));
+}
+
 #define COMMAND(c, args, desc) { #c, handler_##c, args, desc }
 
 static cmd_t s_commands[] = {
@@ -235,6 +240,7 @@ static cmd_t s_commands[] = {
     COMMAND(symbfile, 1, "Makes the specified file concolic. The file should be stored in a ramdisk."),
     COMMAND(exemplify, 0, "Read from stdin and write an example to stdout"),
     COMMAND(fork, 1, "Enable/disable forking"),
+    COMMAND(priority, 1, "Set the CooperativeSearcher priority of the current state"),
     { NULL, NULL, 0, NULL }
 };
 
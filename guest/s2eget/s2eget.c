@@ -48,8 +48,32 @@
 #include "s2e.h"
 
 
+/* Must not exceed the maxReadSize setting of HostFiles */
+#define TRANSFER_CHUNK_SIZE (1024 * 1024)
+#define PAGE_SIZE_ 0x1000
+
 const char *g_target_dir = NULL;
-const char *g_file = NULL;
+const char *g_batch_file = NULL;
+const char **g_files = NULL;
+unsigned g_file_count = 0;
+
+static char *g_buffer = NULL;
+
+/**
+ * The transfer buffer is page-aligned and touched once, so that
+ * s2e_read does not fault on each of its pages on every call.
+ */
+static void allocate_buffer(void)
+{
+    char *buf = malloc(TRANSFER_CHUNK_SIZE + PAGE_SIZE_);
+    if (!buf) {
+        fprintf(stderr, "Could not allocate transfer buffer\n");
+        exit(1);
+    }
+
+    g_buffer = (char*) (((unsigned long) buf + PAGE_SIZE_ - 1) & ~(unsigned long) (PAGE_SIZE_ - 1));
+    memset(g_buffer, 0, TRANSFER_CHUNK_SIZE);
+}
 
 /* file is a path relative to the HostFile's base directory */
 static int copy_file(const char *directory, const char *guest_file)
@@ -95,10 +119,9 @@ static int copy_file(const char *directory, const char *guest_file)
     }
 
     int fsize = 0;
-    char buf[1024 * 64] = { 0 };
 
     while(1) {
-        int ret = s2e_read(s2e_fd, buf, sizeof(buf));
+        int ret = s2e_read(s2e_fd, g_buffer, TRANSFER_CHUNK_SIZE);
         if(ret == -1) {
             fprintf(stderr, "s2e_read failed\n");
             exit(1);
@@ -106,7 +129,7 @@ static int copy_file(const char *directory, const char *guest_file)
             break;
         }
 
-        int ret1 = write(fd, buf, ret);
+        int ret1 = write(fd, g_buffer, ret);
         if(ret1 != ret) {
             fprintf(stderr, "can not write to file\n");
             exit(1);
@@ -125,6 +148,41 @@ static int copy_file(const char *directory, const char *guest_file)
     return 0;
 }
 
+static void add_file(const char *file)
+{
+    g_files = realloc(g_files, (g_file_count + 1) * sizeof(*g_files));
+    if (!g_files) {
+        fprintf(stderr, "Could not allocate memory for file list\n");
+        exit(1);
+    }
+    g_files[g_file_count++] = file;
+}
+
+/* The batch file lists one guest file name per line */
+static int read_batch_file(const char *batch_file)
+{
+    FILE *fp = fopen(batch_file, "r");
+    if (!fp) {
+        fprintf(stderr, "Could not open %s (%s)\n", batch_file, strerror(errno));
+        return -1;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = 0;
+        }
+
+        if (len > 0) {
+            add_file(strdup(line));
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
 static int parse_arguments(int argc, const char **argv)
 {
     unsigned i = 1;
@@ -133,8 +191,12 @@ static int parse_arguments(int argc, const char **argv)
             if (++i >= argc) { return -1; }
             g_target_dir = argv[i++];
             continue;
+        } else if (!strcmp(argv[i], "--batch")) {
+            if (++i >= argc) { return -1; }
+            g_batch_file = argv[i++];
+            continue;
         } else {
-            g_file = argv[i++];
+            add_file(argv[i++]);
         }
     }
 
@@ -151,7 +213,11 @@ static int validate_arguments(void)
         }
     }
 
-    if (!g_file) {
+    if (g_batch_file && read_batch_file(g_batch_file) < 0) {
+        return -1;
+    }
+
+    if (!g_file_count) {
         return -1;
     }
 
@@ -160,10 +226,11 @@ static int validate_arguments(void)
 
 static void print_usage(const char *prog_name)
 {
-    fprintf(stderr, "Usage: %s [options] file_name\n\n", prog_name);
+    fprintf(stderr, "Usage: %s [options] file_name [file_name...]\n\n", prog_name);
 
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  --target-dir : where to place the downloaded file [default: working directory]\n");
+    fprintf(stderr, "  --target-dir : where to place the downloaded files [default: working directory]\n");
+    fprintf(stderr, "  --batch      : file that lists the files to download, one per line\n");
 }
 
 int main(int argc, const char** argv)
@@ -183,7 +250,12 @@ int main(int argc, const char** argv)
     while(s2e_version() == 0) /* nothing */;
     printf("... S2E mode detected\n");
 
-    copy_file(g_target_dir, g_file);
+    allocate_buffer();
+
+    unsigned i;
+    for (i = 0; i < g_file_count; ++i) {
+        copy_file(g_target_dir, g_files[i]);
+    }
 
     return 0;
 }
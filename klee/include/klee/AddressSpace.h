@@ -14,6 +14,7 @@
 
 #include "klee/Expr.h"
 #include "klee/Internal/ADT/ImmutableMap.h"
+#include "klee/Internal/ADT/ImmutableRadixTree.h"
 
 #include "klee/BitfieldSimplifier.h"
 
@@ -35,14 +36,24 @@ namespace klee {
   };
   
   typedef ImmutableMap<const MemoryObject*, ObjectHolder, MemoryObjectLT> MemoryMap;
+
+  /// Index of the fixed-size objects, by address divided by their size.
+  /// Host addresses are at most 48 bits wide.
+  typedef ImmutableRadixTree<ObjectPair, 48> FixedObjectMap;
   
   class AddressSpace {
   private:
     /// Epoch counter used to control ownership of objects.
     mutable unsigned cowKey;
 
+    /// Size of the objects indexed in fixedObjects, as a power of two,
+    /// 0 if there is no such index. Shared by all address spaces.
+    static unsigned fixedObjectBits;
+
     /// Unsupported, use copy constructor
     AddressSpace &operator=(const AddressSpace&); 
+
+    bool isFixedObject(const MemoryObject *mo) const;
     
   public:
     /// The MemoryObject -> ObjectState map that constitutes the
@@ -54,6 +65,12 @@ namespace klee {
     /// \invariant forall o in objects, o->copyOnWriteOwner <= cowKey
     MemoryMap objects;
 
+    /// Second index of the objects whose size is 2^fixedObjectBits and
+    /// which are aligned on their size, e.g., the guest RAM objects.
+    /// It holds the same bindings as objects, which keeps the
+    /// references, and turns their lookups into a few array indexings.
+    FixedObjectMap fixedObjects;
+
     /// ExecutionState that owns this AddressSpace
     ExecutionState *state;
 
@@ -70,9 +87,14 @@ namespace klee {
   public:
     AddressSpace(ExecutionState* _state) : cowKey(1), state(_state) {}
     AddressSpace(const AddressSpace &b) :
-            cowKey(++b.cowKey), objects(b.objects), state(NULL) { }
+            cowKey(++b.cowKey), objects(b.objects),
+            fixedObjects(b.fixedObjects), state(NULL) { }
     ~AddressSpace() {}
 
+    /// Sets the size of the objects that get a second index, must be
+    /// called before any object is bound.
+    static void setFixedObjectBits(unsigned bits);
+
     /// Resolve address to an ObjectPair in result.
     /// \return true iff an object was found.
     bool resolveOne(const ref<ConstantExpr> &address, 
@@ -106,6 +128,21 @@ namespace klee {
                  unsigned maxResolutions=0,
                  double timeout=0.);
 
+    /// Resolve a symbolic address to the consecutive fixed-size objects
+    /// that an access of the given size may touch. The address is first
+    /// bounded by range propagation, and by a few solver queries around
+    /// an example value if that is not enough.
+    ///
+    /// \return true iff every object in the range is bound, there are at
+    /// most maxObjects of them and none of them is shared-concrete. The
+    /// objects are then in rl, by increasing address.
+    bool resolveFixedRange(ExecutionState &state,
+                           TimingSolver *solver,
+                           ref<Expr> address,
+                           unsigned bytes,
+                           unsigned maxObjects,
+                           ResolutionList &rl);
+
     /***/
 
     /// Add a binding to the address space.
@@ -134,6 +171,21 @@ namespace klee {
 
     bool isOwnedByUs(const ObjectState *os) const;
 
+    /// Hash of the contents of an object of this address space. The
+    /// objects that it does not own can never change, their hash is
+    /// computed once and cached.
+    uint64_t getObjectHash(const ObjectState *os) const;
+
+    /// Give up the ownership of an object of this address space, which
+    /// can then be shared with other address spaces. The next write to
+    /// it from any address space copies it.
+    void disownObject(const MemoryObject *mo, const ObjectState *os);
+
+    /// Replace the binding of a MemoryObject by an object with the same
+    /// contents that no address space owns, e.g., the copy of another
+    /// state. The previous object is released.
+    void shareObject(const MemoryObject *mo, const ObjectState *os);
+
     /// Copy the concrete values of all managed ObjectStates into the
     /// actual system memory location they were allocated at.
     void copyOutConcretes();
@@ -55,8 +55,17 @@ protected:
     /// XXX: this cache will probably grow too large with time
     ExprHashMap<BitsInfo> m_bitsInfoCache;
 
+    /// Results of simplify() keyed by the expression it was given,
+    /// along with the known zero bits of the result
+    typedef std::pair<ref<Expr>, uint64_t> SimplifiedExpr;
+    ExprHashMap<SimplifiedExpr> m_simplifiedCache;
+
     ref<Expr> replaceWithConstant(ref<Expr> e, uint64_t value);
 
+    /// Rewrite the flag tests left over by the x86 lazy flags helpers
+    /// once the unused flag bits have been simplified away
+    ref<Expr> rewriteFlags(ref<Expr> e);
+
     ExprBitsInfo doSimplifyBits(ref<Expr> e, uint64_t ignoredBits);
 
 public:
@@ -11,6 +11,8 @@
 #define KLEE_CONSTRAINTS_H
 
 #include "klee/Expr.h"
+#include "klee/Internal/ADT/ImmutableMap.h"
+#include "klee/Internal/ADT/ImmutableSet.h"
 #include <llvm/Support/raw_ostream.h>
 
 // FIXME: Currently we use ConstraintManager for two things: to pass
@@ -20,6 +22,7 @@
 namespace klee {
 
 class ExprVisitor;
+class ConstraintPartition;
   
 class ConstraintManager {
 public:
@@ -27,14 +30,16 @@ public:
   typedef constraints_ty::iterator iterator;
   typedef constraints_ty::const_iterator const_iterator;
 
-  ConstraintManager() {}
+  ConstraintManager() : partition(0), indexed(false) {}
 
   // create from constraints with no optimization
   explicit
   ConstraintManager(const std::vector< ref<Expr> > &_constraints) :
-    constraints(_constraints) {}
+    constraints(_constraints), partition(0), indexed(false) {}
 
-  ConstraintManager(const ConstraintManager &cs) : constraints(cs.constraints) {}
+  ConstraintManager(const ConstraintManager &cs);
+  ConstraintManager &operator=(const ConstraintManager &cs);
+  ~ConstraintManager();
 
   typedef std::vector< ref<Expr> >::const_iterator constraint_iterator;
 
@@ -45,6 +50,17 @@ public:
   ref<Expr> simplifyExpr(ref<Expr> e) const;
 
   void addConstraint(ref<Expr> e);
+
+  /// Append to result the constraints that transitively share symbolic
+  /// bytes with e, in the order they were added. The grouping is built
+  /// on the first call, then maintained by addConstraint and shared
+  /// between copies until one of them is modified.
+  void getRelatedConstraints(ref<Expr> e,
+                             std::vector< ref<Expr> > &result) const;
+
+  /// Return true if no constraint reads a symbolic byte that e reads,
+  /// in which case every assignment of those bytes is feasible.
+  bool isIndependent(ref<Expr> e) const;
   
   bool empty() const {
     return constraints.empty();
@@ -76,8 +92,41 @@ public:
 private:
   std::vector< ref<Expr> > constraints;
 
+  // union-find of the constraints by the bytes they read, built lazily
+  mutable ConstraintPartition *partition;
+
+  void releasePartition() const;
+  void buildPartition() const;
+
+  struct ExprPtrLess {
+    bool operator()(const ref<Expr> &a, const ref<Expr> &b) const {
+      return a.get() < b.get();
+    }
+  };
+
+  // a byte of an array read at a constant index, or the whole
+  // array (index ~0u) for the reads at a symbolic index
+  typedef std::pair<const Array*, unsigned> variable_ty;
+  typedef ImmutableSet< ref<Expr>, ExprPtrLess > exprs_ty;
+  typedef ImmutableMap< variable_ty, exprs_ty > variables_ty;
+  typedef ImmutableMap< ref<Expr>, ref<Expr> > equalities_ty;
+
+  // the constraints that read each variable, and the substitutions
+  // applied by simplifyExpr. Built lazily, then maintained as the
+  // constraints change. Copies share them until one is modified.
+  mutable bool indexed;
+  mutable variables_ty variables;
+  mutable equalities_ty equalities;
+
+  static variable_ty getVariable(const ReadExpr *re);
+  void buildIndex() const;
+  void indexConstraint(ref<Expr> e) const;
+  void unindexConstraint(ref<Expr> e) const;
+  void pushConstraint(ref<Expr> e);
+
+  // rewrites the constraints that may contain src,
   // returns true iff the constraints were modified
-  bool rewriteConstraints(ExprVisitor &visitor);
+  bool rewriteConstraints(ExprVisitor &visitor, ref<Expr> src);
 
   void addConstraintInternal(ref<Expr> e);
 };
@@ -85,6 +85,8 @@ public:
   stack_ty stack;
   ConstraintManager constraints;
   mutable double queryCost;
+  /// Number of queries of the state that timed out in the solver
+  mutable unsigned queryTimeouts;
   double weight;
   AddressSpace addressSpace;
   TreeOStream pathOS, symPathOS;
@@ -112,13 +114,17 @@ public:
 
   unsigned incomingBBIndex;
 
+  /// Slot of the state in the StateSet that holds it
+  unsigned stateSetIndex;
+
   std::string getFnAlias(std::string fn);
   void addFnAlias(std::string old_fn, std::string new_fn);
   void removeFnAlias(std::string fn);
   
 private:
   ExecutionState() : fakeState(false), underConstrained(0),
-                     addressSpace(this), ptreeNode(0) {}
+                     addressSpace(this), ptreeNode(0),
+                     stateSetIndex((unsigned) -1) {}
 
 protected:
   virtual ExecutionState* clone();
@@ -149,6 +155,11 @@ public:
 
   virtual bool merge(const ExecutionState &b);
 
+  /// Charge the state with a solver query that took usec microseconds.
+  virtual void addQueryCost(uint64_t usec) const {
+    queryCost += usec / 1000000.;
+  }
+
   bool isSpeculative() const {
       return speculative;
   }
@@ -16,6 +16,7 @@
 #define KLEE_EXECUTOR_H
 
 #include "klee/ExecutionState.h"
+#include "klee/StateSet.h"
 #include "klee/Interpreter.h"
 #include "klee/Internal/Module/Cell.h"
 #include "klee/Internal/Module/KInstruction.h"
@@ -105,7 +106,7 @@ protected:
   ExternalDispatcher *externalDispatcher;
   TimingSolver *solver;
   MemoryManager *memory;
-  std::set<ExecutionState*> states;
+  StateSet states;
   StatsTracker *statsTracker;
   TreeStreamWriter *pathWriter, *symPathWriter;
   SpecialFunctionHandler *specialFunctionHandler;
@@ -151,6 +152,10 @@ protected:
   /// instead of being called directly.
   std::set<llvm::Function*> overridenInternalFunctions;
 
+  /// The set of functions whose LLVM body can be skipped in favor of the
+  /// native version when mayCallNatively() agrees at the call site.
+  std::set<llvm::Function*> nativeCallableFunctions;
+
   /// When non-null the bindings that will be used for calls to
   /// klee_make_symbolic in order replay.
   const struct KTest *replayOut;
@@ -271,6 +276,11 @@ protected:
                    llvm::Function *f,
                    std::vector< ref<Expr> > &arguments);
 
+  /// Decide whether a call to a function of nativeCallableFunctions can go
+  /// to the native version instead of being interpreted.
+  virtual bool mayCallNatively(ExecutionState &state, llvm::Function *f,
+                               const std::vector< ref<Expr> > &arguments);
+
   // do address resolution / object binding / out of bounds checking
   // and perform the operation
   void executeMemoryOperation(ExecutionState &state,
@@ -279,6 +289,12 @@ protected:
                               ref<Expr> value /* undef if read */,
                               KInstruction *target /* undef if write */);
 
+  /// Read from a set of consecutive objects, returned by
+  /// AddressSpace::resolveFixedRange, as a single expression.
+  ref<Expr> readConsecutiveObjects(const ResolutionList &rl,
+                                   ref<Expr> address,
+                                   Expr::Width type);
+
   void executeMakeSymbolic(ExecutionState &state, const MemoryObject *mo);
 
   /// Create a new state where each input condition has been added as
@@ -345,6 +361,10 @@ protected:
   /// bindModuleConstants - Initialize the module constant table.
   void bindModuleConstants();
 
+  /// getKFunction - Return the KFunction of f, preparing it first if
+  /// its preparation was deferred (--lazy-function-preparation).
+  KFunction *getKFunction(llvm::Function *f);
+
   /// bindInstructionConstants - Initialize any necessary per instruction
   /// constant values.
   void bindInstructionConstants(KInstruction *KI);
@@ -379,6 +399,9 @@ protected:
   void addSpecialFunctionHandler(llvm::Function* function,
                                  FunctionHandler handler);
 
+  /// Check whether calls to the function are caught by a special handler
+  bool hasSpecialFunctionHandler(const llvm::Function* function) const;
+
   ref<Expr> simplifyExpr(const ExecutionState &state, ref<Expr> e);
 
   static unsigned getMaxMemory();
@@ -518,7 +541,7 @@ public:
   virtual bool copyInConcretes(ExecutionState &state);
 
   size_t getStatesCount() const { return states.size(); }
-  const std::set<ExecutionState*> &getStates() {
+  const StateSet &getStates() {
     return states;
   }
 
@@ -533,6 +556,10 @@ public:
   Solver *getSolver() const;
   void initializeSolver();
 
+  /// Compute a feasible value of e in the given state through the timing
+  /// solver, which answers without a query when it can.
+  bool getValue(ExecutionState &state, ref<Expr> e, ref<ConstantExpr> &result);
+
   Expr::Width getWidthForLLVMType(llvm::Type *type) const;
 
   void printStack(ExecutionState &state, KInstruction *target, std::stringstream &msg);
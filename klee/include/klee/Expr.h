@@ -34,6 +34,19 @@ class ObjectState;
 
 template<class T> class ref;
 
+/// Pluggable storage for expression and update nodes.
+/// Nodes are heap-allocated when no allocator is installed.
+class ExprAllocator {
+public:
+  virtual ~ExprAllocator() {}
+
+  /// Returns 0 if the allocator cannot serve a block of this size.
+  virtual void *allocate(size_t size) = 0;
+
+  /// Returns false if the block was not allocated by this allocator.
+  virtual bool deallocate(void *ptr) = 0;
+};
+
 
 /// Class representing symbolic expressions.
 /**
@@ -170,9 +183,23 @@ public:
 protected:  
   unsigned hashValue;
   
+private:
+  static ExprAllocator *allocator;
+
 public:
   Expr() : refCount(0) { Expr::count++; }
-  virtual ~Expr() { Expr::count--; } 
+  virtual ~Expr();
+
+  /// Installs the allocator used for new expression and update nodes.
+  /// Nodes created before remain on the heap and are freed there.
+  static void setAllocator(ExprAllocator *a) { allocator = a; }
+  static ExprAllocator *getAllocator() { return allocator; }
+
+  static void *allocate(size_t size);
+  static void deallocate(void *ptr);
+
+  static void *operator new(size_t size) { return allocate(size); }
+  static void operator delete(void *ptr) { deallocate(ptr); }
 
   virtual Kind getKind() const = 0;
   virtual Width getWidth() const = 0;
@@ -191,6 +218,11 @@ public:
   /// (Re)computes the hash of the current expression.
   /// Returns the hash value. 
   virtual unsigned computeHash();
+
+  /// Returns the live node structurally equal to the freshly hashed
+  /// expression e if hash-consing is enabled (-hash-cons-exprs), or e
+  /// itself. Equal expressions then share one node and compare by pointer.
+  static ref<Expr> hashCons(const ref<Expr> &e);
   
   /// Returns 0 iff b is structuraly equivalent to *this
   int compare(const Expr &b) const;
@@ -382,7 +414,7 @@ public:
   static ref<ConstantExpr> alloc(const llvm::APInt &v) {
     ref<ConstantExpr> r(new ConstantExpr(v));
     r->computeHash();
-    return r;
+    return cast<ConstantExpr>(hashCons(r));
   }
 
   static ref<ConstantExpr> alloc(uint64_t v, Width w) {
@@ -523,7 +555,7 @@ public:
   static ref<Expr> alloc(const ref<Expr> &src) {
     ref<Expr> r(new NotOptimizedExpr(src));
     r->computeHash();
-    return r;
+    return hashCons(r);
   }
   
   static ref<Expr> create(ref<Expr> src);
@@ -548,6 +580,11 @@ public:
 
 
 /// Class representing a byte update of an array.
+/// Generation of the live STP validity checker. The STP expressions cached
+/// in arrays and update nodes belong to the checker of their generation,
+/// those of an older generation are stale and must not be used or freed.
+extern unsigned stpGeneration;
+
 class UpdateNode {
   friend class UpdateList;
   friend class STPBuilder; // for setting STPArray
@@ -557,6 +594,8 @@ class UpdateNode {
   mutable void *stpArray;
   // cache instead of recalc
   unsigned hashValue;
+  // validity checker that built stpArray, see stpGeneration
+  mutable unsigned stpArrayGeneration;
 
 public:
   const UpdateNode *next;
@@ -571,13 +610,16 @@ public:
              const ref<Expr> &_index, 
              const ref<Expr> &_value);
 
+  static void *operator new(size_t size) { return Expr::allocate(size); }
+  static void operator delete(void *ptr) { Expr::deallocate(ptr); }
+
   unsigned getSize() const { return size; }
 
   int compare(const UpdateNode &b) const;  
   unsigned hash() const { return hashValue; }
 
 private:
-  UpdateNode() : refCount(0), stpArray(0) {}
+  UpdateNode() : refCount(0), stpArray(0), stpArrayGeneration(0) {}
   ~UpdateNode();
 
   unsigned computeHash();
@@ -596,6 +638,7 @@ public:
 
   // FIXME: This does not belong here.
   mutable void *stpInitialArray;
+  mutable unsigned stpInitialArrayGeneration;
 
 public:
   /// Array - Construct a new array object.
@@ -610,7 +653,7 @@ public:
         const ref<ConstantExpr> *constantValuesEnd = 0)
     : name(_name), size(_size), 
       constantValues(constantValuesBegin, constantValuesEnd), 
-      stpInitialArray(0) {
+      stpInitialArray(0), stpInitialArrayGeneration(0) {
     assert((isSymbolicArray() || constantValues.size() == size) &&
            "Invalid size for constant array!");
 #ifdef NDEBUG
@@ -669,7 +712,7 @@ public:
   static ref<Expr> alloc(const UpdateList &updates, const ref<Expr> &index) {
     ref<Expr> r(new ReadExpr(updates, index));
     r->computeHash();
-    return r;
+    return hashCons(r);
   }
   
   static ref<Expr> create(const UpdateList &updates, ref<Expr> i);
@@ -714,7 +757,7 @@ public:
                          const ref<Expr> &f) {
     ref<Expr> r(new SelectExpr(c, t, f));
     r->computeHash();
-    return r;
+    return hashCons(r);
   }
   
   static ref<Expr> create(ref<Expr> c, ref<Expr> t, ref<Expr> f);
@@ -771,7 +814,7 @@ public:
   static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) {
     ref<Expr> c(new ConcatExpr(l, r));
     c->computeHash();
-    return c;
+    return hashCons(c);
   }
   
   static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r);
@@ -830,7 +873,7 @@ public:
   static ref<Expr> alloc(const ref<Expr> &e, unsigned o, Width w) {
     ref<Expr> r(new ExtractExpr(e, o, w));
     r->computeHash();
-    return r;
+    return hashCons(r);
   }
   
   /// Creates an ExtractExpr with the given bit offset and width
@@ -881,7 +924,7 @@ public:
   static ref<Expr> alloc(const ref<Expr> &e) {
     ref<Expr> r(new NotExpr(e));
     r->computeHash();
-    return r;
+    return hashCons(r);
   }
   
   static ref<Expr> create(const ref<Expr> &e);
@@ -958,7 +1001,7 @@ public:                                                          \
     static ref<Expr> alloc(const ref<Expr> &e, Width w) {        \
       ref<Expr> r(new _class_kind ## Expr(e, w));                \
       r->computeHash();                                          \
-      return r;                                                  \
+      return hashCons(r);                                        \
     }                                                            \
     static ref<Expr> create(const ref<Expr> &e, Width w);        \
     Kind getKind() const { return _class_kind; }                 \
@@ -990,7 +1033,7 @@ public:                                                              \
     static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) { \
       ref<Expr> res(new _class_kind ## Expr (l, r));                 \
       res->computeHash();                                            \
-      return res;                                                    \
+      return hashCons(res);                                          \
     }                                                                \
     static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r); \
     Width getWidth() const { return left->getWidth(); }              \
@@ -1034,7 +1077,7 @@ public:                                                              \
     static ref<Expr> alloc(const ref<Expr> &l, const ref<Expr> &r) { \
       ref<Expr> res(new _class_kind ## Expr (l, r));                 \
       res->computeHash();                                            \
-      return res;                                                    \
+      return hashCons(res);                                          \
     }                                                                \
     static ref<Expr> create(const ref<Expr> &l, const ref<Expr> &r); \
     Kind getKind() const { return _class_kind; }                     \
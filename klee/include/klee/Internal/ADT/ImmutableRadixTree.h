@@ -0,0 +1,199 @@
+//===-- ImmutableRadixTree.h ------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __UTIL_IMMUTABLERADIXTREE_H__
+#define __UTIL_IMMUTABLERADIXTREE_H__
+
+#include <cassert>
+#include <cstddef>
+#include <stdint.h>
+
+namespace klee {
+  /// Persistent map from integer keys of at most KeyBits bits to values.
+  ///
+  /// The tree has a fixed depth, each level consumes LevelBits of the
+  /// key, so a lookup is a fixed number of array indexings instead of a
+  /// chain of comparisons. Updates copy the nodes on the path to the
+  /// key and share all the others with the previous version of the tree.
+  template<class V, unsigned KeyBits, unsigned LevelBits = 4>
+  class ImmutableRadixTree {
+  public:
+    typedef uint64_t key_type;
+    typedef V value_type;
+
+    static const unsigned FanOut = 1 << LevelBits;
+    static const unsigned Levels = (KeyBits + LevelBits - 1) / LevelBits;
+
+  private:
+    struct Node {
+      unsigned references;
+      /// Bit i is set when slot i is not empty
+      uint64_t used;
+      Node() : references(1), used(0) {}
+    };
+
+    struct Inner : Node {
+      Node *children[FanOut];
+      Inner() { for (unsigned i = 0; i < FanOut; ++i) children[i] = 0; }
+    };
+
+    struct Leaf : Node {
+      value_type values[FanOut];
+    };
+
+    Node *root;
+    size_t count;
+
+    ImmutableRadixTree(Node *_root, size_t _count) : root(_root), count(_count) {}
+
+    static unsigned slot(key_type key, unsigned level) {
+      return (key >> ((Levels - 1 - level) * LevelBits)) & (FanOut - 1);
+    }
+
+    static Node *incref(Node *n) {
+      if (n) ++n->references;
+      return n;
+    }
+
+    static void decref(Node *n, unsigned level) {
+      if (!n || --n->references)
+        return;
+      if (level == Levels - 1) {
+        delete static_cast<Leaf*>(n);
+      } else {
+        Inner *in = static_cast<Inner*>(n);
+        for (unsigned i = 0; i < FanOut; ++i)
+          decref(in->children[i], level + 1);
+        delete in;
+      }
+    }
+
+    /// Copy of n at the given level, or a new empty node if n is null
+    static Node *copy(const Node *n, unsigned level) {
+      if (level == Levels - 1) {
+        Leaf *l = n ? new Leaf(*static_cast<const Leaf*>(n)) : new Leaf();
+        l->references = 1;
+        return l;
+      }
+
+      Inner *in = n ? new Inner(*static_cast<const Inner*>(n)) : new Inner();
+      in->references = 1;
+      for (unsigned i = 0; i < FanOut; ++i)
+        incref(in->children[i]);
+      return in;
+    }
+
+    static Node *replace(const Node *n, unsigned level, key_type key,
+                         const value_type &value, bool &added) {
+      unsigned s = slot(key, level);
+      Node *res = copy(n, level);
+      uint64_t bit = (uint64_t) 1 << s;
+
+      if (level == Levels - 1) {
+        added = !(res->used & bit);
+        static_cast<Leaf*>(res)->values[s] = value;
+      } else {
+        Inner *in = static_cast<Inner*>(res);
+        Node *child = replace(in->children[s], level + 1, key, value, added);
+        decref(in->children[s], level + 1);
+        in->children[s] = child;
+      }
+
+      res->used |= bit;
+      return res;
+    }
+
+    /// Returns n itself (with a new reference) if the key is not
+    /// in it, and null if the resulting node is empty.
+    static Node *remove(Node *n, unsigned level, key_type key, bool &removed) {
+      unsigned s = slot(key, level);
+      uint64_t bit = (uint64_t) 1 << s;
+
+      if (!n || !(n->used & bit)) {
+        removed = false;
+        return incref(n);
+      }
+
+      if (level == Levels - 1) {
+        removed = true;
+        if (n->used == bit)
+          return 0;
+        Leaf *l = static_cast<Leaf*>(copy(n, level));
+        l->values[s] = value_type();
+        l->used &= ~bit;
+        return l;
+      }
+
+      Inner *in = static_cast<Inner*>(n);
+      Node *child = remove(in->children[s], level + 1, key, removed);
+      if (!removed) {
+        decref(child, level + 1);
+        return incref(n);
+      }
+
+      if (!child && n->used == bit)
+        return 0;
+
+      Inner *res = static_cast<Inner*>(copy(n, level));
+      decref(res->children[s], level + 1);
+      res->children[s] = child;
+      if (!child)
+        res->used &= ~bit;
+      return res;
+    }
+
+  public:
+    ImmutableRadixTree() : root(0), count(0) {}
+    ImmutableRadixTree(const ImmutableRadixTree &s) :
+      root(incref(s.root)), count(s.count) {}
+    ~ImmutableRadixTree() { decref(root, 0); }
+
+    ImmutableRadixTree &operator=(const ImmutableRadixTree &s) {
+      Node *n = incref(s.root);
+      decref(root, 0);
+      root = n;
+      count = s.count;
+      return *this;
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    const value_type *lookup(key_type key) const {
+      assert((KeyBits >= 64 || !(key >> KeyBits)) && "key out of range");
+      const Node *n = root;
+      for (unsigned level = 0; n && level < Levels - 1; ++level)
+        n = static_cast<const Inner*>(n)->children[slot(key, level)];
+
+      if (!n)
+        return 0;
+
+      unsigned s = slot(key, Levels - 1);
+      if (!(n->used & ((uint64_t) 1 << s)))
+        return 0;
+      return &static_cast<const Leaf*>(n)->values[s];
+    }
+
+    ImmutableRadixTree replace(key_type key, const value_type &value) const {
+      assert((KeyBits >= 64 || !(key >> KeyBits)) && "key out of range");
+      bool added;
+      Node *n = replace(root, 0, key, value, added);
+      return ImmutableRadixTree(n, count + (added ? 1 : 0));
+    }
+
+    ImmutableRadixTree remove(key_type key) const {
+      assert((KeyBits >= 64 || !(key >> KeyBits)) && "key out of range");
+      bool removed;
+      Node *n = remove(root, 0, key, removed);
+      return ImmutableRadixTree(n, count - (removed ? 1 : 0));
+    }
+  };
+}
+
+#endif
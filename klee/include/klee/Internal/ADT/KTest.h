@@ -55,6 +55,30 @@ extern "C" {
 
   void  kTest_free(KTest *);
 
+  /* Test case streams are append-only files holding many tests. Each
+     record starts with KTEST_STREAM_MAGIC, the size of the serialized
+     test and a 64-bit key (e.g., a hash of the inputs), followed by the
+     test in .ktest format. Appending a record is a single write, so
+     several processes may append to the same stream concurrently. */
+
+  typedef struct KTestStream KTestStream;
+
+  /* return true iff file at path starts with a stream record */
+  int   kTest_isKTestStream(const char *path);
+
+  /* returns 1 on success, 0 on (unspecified) error */
+  int   kTest_appendToStream(KTest *, unsigned long long key, const char *path);
+
+  /* maps the stream at path, returns NULL on (unspecified) error */
+  KTestStream* kTestStream_open(const char *path);
+
+  /* returns the next test or NULL at the end (or on a truncated record).
+     The object bytes point into the mapped stream without copying, the
+     returned test is valid until the next call and must not be freed. */
+  KTest* kTestStream_next(KTestStream *, unsigned long long *key);
+
+  void  kTestStream_close(KTestStream *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,7 @@
 #define __UTIL_MAPOFSETS_H__
 
 #include <cassert>
+#include <stdint.h>
 #include <vector>
 #include <set>
 #include <map>
@@ -24,6 +25,15 @@
 
 namespace klee {
 
+  /// Bloom signature of a set element. Each node keeps the union of the
+  /// signatures below it, which lets superset searches skip subtrees
+  /// that cannot hold the remaining elements. Specialize it for a key
+  /// type to enable the pruning; the default only prunes at leaves.
+  template<class K>
+  struct MapOfSetsSignature {
+    static uint64_t get(const K &) { return ~0ULL; }
+  };
+
   /** This implements the UBTree data structure (see Hoffmann and
       Koehler, "A New Method to Index and Query Sets", IJCAI 1999) */
   template<class K, class V>
@@ -74,12 +84,17 @@ namespace klee {
     V *findSuperset(Node *n, 
                     typename std::set<K>::iterator begin, 
                     typename std::set<K>::iterator end,
+                    const uint64_t *signature,
                     const Predicate &p);
     template<class Predicate>
     V *findSubset(Node *n, 
                   typename std::set<K>::iterator begin, 
                   typename std::set<K>::iterator end,
                   const Predicate &p);
+
+    // signature of each suffix of the set, the last entry is 0
+    static void getSignatures(const std::set<K> &set,
+                              std::vector<uint64_t> &result);
   };
 
   /***/
@@ -96,10 +111,12 @@ namespace klee {
 
   private:
     bool isEndOfSet;
+    // union of the signatures of the elements below this node
+    uint64_t signature;
     std::map<K, Node> children;
     
   public:
-    Node() : isEndOfSet(false) {}
+    Node() : isEndOfSet(false), signature(0) {}
   };
   
   template<class K, class V>
@@ -184,12 +201,29 @@ namespace klee {
   template<class K, class V>
   MapOfSets<K,V>::MapOfSets() {}  
 
+  template<class K, class V>
+  void MapOfSets<K,V>::getSignatures(const std::set<K> &set,
+                                     std::vector<uint64_t> &result) {
+    result.resize(set.size() + 1);
+    unsigned i = set.size();
+    result[i] = 0;
+    for (typename std::set<K>::const_reverse_iterator it = set.rbegin(),
+           ie = set.rend(); it != ie; ++it, --i)
+      result[i - 1] = result[i] | MapOfSetsSignature<K>::get(*it);
+  }
+
   template<class K, class V>
   void MapOfSets<K,V>::insert(const std::set<K> &set, const V &value) {
+    std::vector<uint64_t> signatures;
+    getSignatures(set, signatures);
+
     Node *n = &root;
+    unsigned i = 0;
     for (typename std::set<K>::const_iterator it = set.begin(), ie = set.end();
-         it != ie; ++it)
+         it != ie; ++it, ++i) {
+      n->signature |= signatures[i];
       n = &n->children.insert(std::make_pair(*it, Node())).first->second;
+    }
     n->isEndOfSet = true;
     n->value = value;
   }
@@ -335,26 +369,32 @@ namespace klee {
   V *MapOfSets<K,V>::findSuperset(Node *n, 
                                   typename std::set<K>::iterator begin, 
                                   typename std::set<K>::iterator end,
+                                  const uint64_t *signature,
                                   const Predicate &p) {   
+    // Some remaining element is nowhere below this node.
+    if (*signature & ~n->signature)
+      return 0;
+
     if (begin==end) {
       if (n->isEndOfSet && p(n->value))
         return &n->value;
       for (typename Node::children_ty::iterator it = n->children.begin(),
              ie = n->children.end(); it != ie; ++it) {
-        V *res = findSuperset(&it->second, begin, end, p);
+        V *res = findSuperset(&it->second, begin, end, signature, p);
         if (res) return res;
       }
     } else {
-      typename Node::children_ty::iterator kbegin = n->children.begin();
+      // Sets are stored in order, so only the children before *begin can
+      // still lead to it.
       typename Node::children_ty::iterator kmid = 
         n->children.lower_bound(*begin);
-      for (typename Node::children_ty::iterator it = n->children.begin(),
-             ie = n->children.end(); it != ie; ++it) {
-        V *res = findSuperset(&it->second, begin, end, p);
+      for (typename Node::children_ty::iterator it = n->children.begin();
+           it != kmid; ++it) {
+        V *res = findSuperset(&it->second, begin, end, signature, p);
         if (res) return res;
       }
       if (kmid!=n->children.end() && *begin==kmid->first) {
-        V *res = findSuperset(&kmid->second, ++begin, end, p);
+        V *res = findSuperset(&kmid->second, ++begin, end, signature + 1, p);
         if (res) return res;
       }
     }
@@ -364,7 +404,9 @@ namespace klee {
   template<class K, class V>
   template<class Predicate>
   V *MapOfSets<K,V>::findSuperset(const std::set<K> &set, const Predicate &p) {    
-    return findSuperset(&root, set.begin(), set.end(), p);
+    std::vector<uint64_t> signatures;
+    getSignatures(set, signatures);
+    return findSuperset(&root, set.begin(), set.end(), &signatures[0], p);
   }
 
   template<class K, class V>
@@ -376,6 +418,7 @@ namespace klee {
   template<class K, class V>
   void MapOfSets<K,V>::clear() {
     root.isEndOfSet = false;
+    root.signature = 0;
     root.value = V();
     root.children.clear();
   }
@@ -51,6 +51,8 @@ namespace klee {
     std::string dummyString;
     InstructionInfo dummyInfo;
     std::map<const llvm::Instruction*, InstructionInfo> infos;
+    /// The functions whose instructions are in the table
+    std::set<const llvm::Function*> functions;
     std::set<const std::string *, ltstr> internedStrings;
 
   private:
@@ -65,6 +67,13 @@ namespace klee {
     unsigned getMaxID() const;
     const InstructionInfo &getInfo(const llvm::Instruction*) const;
     const InstructionInfo &getFunctionInfo(const llvm::Function*) const;
+
+    /// Functions added to the module after the table was built, such as
+    /// translated blocks, have no entries and use the dummy info.
+    bool hasFunction(const llvm::Function *f) const {
+      return functions.count(f);
+    }
+    const InstructionInfo &getDummyInfo() const { return dummyInfo; }
   };
 
 }
@@ -33,7 +33,7 @@ namespace klee {
     /// Value numbers for each operand. -1 is an invalid value,
     /// otherwise negative numbers are indices (negated and offset by
     /// 2) into the module constant table and positive numbers are
-    /// register indices.
+    /// register indices. The array belongs to the owner function.
     int *operands;
     /// Destination register index.
     unsigned dest;
@@ -47,14 +47,19 @@ namespace klee {
     unsigned numInstructions;
     KInstruction **instructions;
 
+    /// The operands of all the instructions, laid out contiguously
+    int *operands;
+
     std::map<llvm::BasicBlock*, unsigned> basicBlockEntry;
-    llvm::DenseMap<const llvm::Instruction*, KInstruction *> instrMap;
 
     /// Whether instructions in this function should count as
     /// "coverable" for statistics and search heuristics.
     bool trackCoverage;
 
   private:
+    /// Built on the first lookup, most translated blocks never need it
+    llvm::DenseMap<const llvm::Instruction*, KInstruction *> instrMap;
+
     KFunction(const KFunction&);
     KFunction &operator=(const KFunction&);
 
@@ -63,6 +68,9 @@ namespace klee {
     ~KFunction();
 
     unsigned getArgRegister(unsigned index) { return index; }
+
+    /// Return the KInstruction of an instruction of this function
+    KInstruction *getKInstruction(const llvm::Instruction *inst);
   };
 
 
@@ -122,15 +130,44 @@ namespace klee {
     /// Return an id for the given constant, creating a new one if necessary.
     unsigned getConstantID(llvm::Constant *c, KInstruction* ki);
 
+    /// Passes run on functions added with updateModuleWithFunction
+    enum FunctionPasses {
+      /// The function was already optimized and lowered
+      NoPasses,
+      /// Only the lowering that the interpreter requires
+      LoweringPasses,
+      AllPasses
+    };
+
     /// Update shadow structures for newly added function
-    KFunction* updateModuleWithFunction(llvm::Function *f);
+    KFunction* updateModuleWithFunction(llvm::Function *f,
+                                        FunctionPasses passes = AllPasses);
 
     /// Remove function from KModule and call removeFromParend on it
     void removeFunction(llvm::Function *f, bool keepDeclaration = false);
 
+    /// Return true if f comes from a library and was not prepared yet
+    /// (see --lazy-function-preparation)
+    bool isDeferredFunction(llvm::Function *f) const {
+      return deferredFunctions.count(f);
+    }
+
+    /// Run the passes that were skipped by prepare() on a deferred
+    /// function and build its shadow structures
+    KFunction* prepareDeferredFunction(llvm::Function *f);
+
   private:
     llvm::SmallSet<KConstant*,10> usedKConstants;
 
+    // Library functions that prepare() left untouched
+    std::set<llvm::Function*> deferredFunctions;
+
+    // ModuleOptions::CustomPasses, for the deferred functions
+    llvm::FunctionPassManager *customPasses;
+
+    // Passes that maintain the invariants of the interpreter
+    void runLoweringPasses(const Interpreter::ModuleOptions &opts);
+
   };
 } // End klee namespace
 
@@ -0,0 +1,92 @@
+//===-- PerfCounters.h ------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_PERFCOUNTERS_H
+#define KLEE_PERFCOUNTERS_H
+
+#include <stdint.h>
+
+namespace klee {
+  /// PerfCounters - Hardware performance counters of the calling thread,
+  /// attributed to the region of the executor that was running. Counters
+  /// are only read when the region changes, so regions must be coarse
+  /// grained (a solver query, a state switch, ...).
+  class PerfCounters {
+  public:
+    enum Region {
+      /// Everything that is not in another region
+      Concrete = 0,
+      Symbolic,
+      Solver,
+      StateSwitch,
+      RegionCount
+    };
+
+    enum Counter {
+      Cycles = 0,
+      Instructions,
+      CacheMisses,
+      BranchMisses,
+      CounterCount
+    };
+
+  private:
+    static int groupFd;
+    static int fds[CounterCount];
+    static Region current;
+    static uint64_t last[CounterCount];
+    static uint64_t values[RegionCount][CounterCount];
+
+    static Region enterSlow(Region r);
+
+  public:
+    /// open - Start counting for the calling thread. Counters that the
+    /// host does not support stay at zero. Returns false if none is
+    /// available (for instance, without perf_event support).
+    static bool open();
+    static void close();
+
+    static bool isEnabled() { return groupFd >= 0; }
+
+    /// enter - Attribute the events since the last change to the current
+    /// region and make r the current one. Returns the previous region.
+    /// The region is tracked even without counters, for samplers.
+    static Region enter(Region r) {
+      if (isEnabled())
+        return enterSlow(r);
+      Region previous = current;
+      current = r;
+      return previous;
+    }
+
+    /// update - Attribute the pending events to the current region.
+    static void update() { enter(current); }
+
+    static Region getCurrent() { return current; }
+
+    static uint64_t get(Region r, Counter c) { return values[r][c]; }
+
+    static const char *getRegionName(Region r);
+    static const char *getCounterName(Counter c);
+  };
+
+  /// PerfCounterRegion - Attributes the events to a region for the
+  /// lifetime of the object.
+  class PerfCounterRegion {
+    PerfCounters::Region previous;
+
+  public:
+    PerfCounterRegion(PerfCounters::Region r)
+      : previous(PerfCounters::enter(r)) {}
+    ~PerfCounterRegion() { PerfCounters::enter(previous); }
+  };
+}
+
+#endif
+
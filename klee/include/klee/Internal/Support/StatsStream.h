@@ -0,0 +1,123 @@
+//===-- StatsStream.h -------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_STATSSTREAM_H
+#define KLEE_STATSSTREAM_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class raw_ostream;
+}
+
+namespace klee {
+
+  /// StatsRecord - Payload of a record of the binary statistics stream,
+  /// in host byte order.
+  class StatsRecord {
+    std::string data;
+
+  public:
+    void addInt32(uint32_t value) {
+      data.append((const char*) &value, sizeof(value));
+    }
+    void addInt64(uint64_t value) {
+      data.append((const char*) &value, sizeof(value));
+    }
+    void addDouble(double value) {
+      data.append((const char*) &value, sizeof(value));
+    }
+    /// Strings are prefixed by their 16 bits length
+    void addString(const std::string &value);
+
+    bool empty() const { return data.empty(); }
+    const std::string &getData() const { return data; }
+  };
+
+  /// StatsRow - The columns of one line of run.stats. Counters only grow
+  /// during a run, which lets the readers merge the streams of forked
+  /// processes by subtracting the first row of each stream. Gauges are
+  /// summed as they are.
+  class StatsRow {
+  public:
+    enum Kind { Counter = 0, Gauge = 1 };
+
+  private:
+    struct Column {
+      std::string name;
+      Kind kind;
+      bool real;
+      uint64_t value;
+      double realValue;
+    };
+
+    std::vector<Column> columns;
+
+    void add(const std::string &name, Kind kind, bool real,
+             uint64_t value, double realValue);
+
+  public:
+    void addCounter(const std::string &name, uint64_t value) {
+      add(name, Counter, false, value, 0);
+    }
+    void addGauge(const std::string &name, uint64_t value) {
+      add(name, Gauge, false, value, 0);
+    }
+    /// Times in seconds, they are counters
+    void addTime(const std::string &name, double value) {
+      add(name, Counter, true, 0, value);
+    }
+
+    /// Write the text run.stats header, e.g. ('Instructions','NumStates',)
+    void writeTextHeader(llvm::raw_ostream &os) const;
+    /// Write the text run.stats line, e.g. (1000,3)
+    void writeTextLine(llvm::raw_ostream &os) const;
+
+    void getColumns(StatsRecord &record) const;
+    void getValues(StatsRecord &record) const;
+  };
+
+  /// StatsStreamWriter - Append-only binary replacement of run.stats and
+  /// run.istats. The stream starts with an 8 bytes magic, then holds
+  /// records made of a 32 bits type, a 32 bits payload size and the
+  /// payload. Nothing is ever rewritten, the instruction statistics are
+  /// written as the changes since the previous write.
+  class StatsStreamWriter {
+    llvm::raw_ostream *os;
+
+  public:
+    enum RecordType {
+      /// Process id, start wall time and the name of the module
+      Info = 1,
+      /// Kind, type and name of each column of the rows
+      Columns = 2,
+      /// One value of 8 bytes per column
+      Row = 3,
+      /// Names of the instruction statistics
+      IStatsEvents = 4,
+      /// Instruction id, line, assembly line, function and source file of
+      /// the instructions that appear in the next records
+      IStatsLocations = 5,
+      /// Elapsed time, then instruction id, event and signed 64 bits
+      /// change of the value of the event for that instruction
+      IStatsDeltas = 6
+    };
+
+    /// The stream takes ownership of os
+    StatsStreamWriter(llvm::raw_ostream *os);
+    ~StatsStreamWriter();
+
+    void write(RecordType type, const StatsRecord &record);
+    void flush();
+  };
+}
+
+#endif
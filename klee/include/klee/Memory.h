@@ -29,6 +29,19 @@ class BitArray;
 class MemoryManager;
 class Solver;
 
+/// Pluggable storage for the concrete stores and byte masks of object
+/// states. The storage is heap-allocated when no allocator is installed.
+class ObjectStateAllocator {
+public:
+  virtual ~ObjectStateAllocator() {}
+
+  /// Returns 0 if the allocator cannot serve a block of this size.
+  virtual void *allocate(size_t size) = 0;
+
+  /// Returns false if the block was not allocated by this allocator.
+  virtual bool deallocate(void *ptr) = 0;
+};
+
 class MemoryObject {
   friend class STPBuilder;
 
@@ -158,6 +171,10 @@ private:
   // (yes, we do need to access if really fast)
   BitArray *concreteMask;
 
+  // Number of bytes cleared in concreteMask, makes isAllConcrete O(1)
+  // XXX(s2e) must follow concreteMask, the code generated by QEMU reads it
+  unsigned symbolicCount;
+
   friend class AddressSpace;
   unsigned copyOnWriteOwner; // exclusively for AddressSpace
 
@@ -173,11 +190,35 @@ private:
   // mutable because may need flushed during read of const
   mutable BitArray *flushMask;
 
-  ref<Expr> *knownSymbolics;
+  /// The symbolic values of the bytes, by chunks of a cache line of bytes.
+  /// Copies of the object share the chunks, a chunk is duplicated on the
+  /// first write to it by one of the copies.
+  struct SymbolicChunk {
+    enum { Bits = 6, Size = 1 << Bits };
+    unsigned refCount;
+    ref<Expr> values[Size];
+
+    SymbolicChunk() : refCount(1) {}
+  };
+
+  SymbolicChunk **knownSymbolics;
 
   // mutable because we may need flush during read of const
   mutable UpdateList updates;
 
+  // length of updates after the last compaction
+  mutable unsigned compactedUpdates;
+
+  // concreteStore is owned by the caller of setExternalConcreteStore
+  bool externalStore;
+
+  // hash of the whole contents, only used once no address space owns
+  // the object anymore, since it can then no longer change
+  mutable uint64_t cachedHash;
+  mutable bool hasCachedHash;
+
+  static ObjectStateAllocator *allocator;
+
 public:
   unsigned size;
 
@@ -196,10 +237,25 @@ public:
   ObjectState(const ObjectState &os);
   ~ObjectState();
 
+  /// Installs the allocator used for the storage of new object states.
+  /// The storage of existing states remains on the heap and is freed there.
+  static void setAllocator(ObjectStateAllocator *a) { allocator = a; }
+  static ObjectStateAllocator *getAllocator() { return allocator; }
+
   inline const MemoryObject *getObject() const { return object; }
 
+  /// Number of address spaces and other holders that share this object
+  unsigned getRefCount() const { return refCount; }
+
+  bool hasExternalConcreteStore() const { return externalStore; }
+
   void setReadOnly(bool ro) { readOnly = ro; }
 
+  /// Use memory owned by the caller as the concrete store, without copying
+  /// it. The object must be all concrete. Copies of the object get their own
+  /// storage.
+  void setExternalConcreteStore(uint8_t *store);
+
   // make contents all concrete and zero
   void initializeToZero();
   // make contents all concrete and random
@@ -231,22 +287,35 @@ public:
 
   bool isAllConcrete() const;
 
+  /// Approximate number of bytes of memory used by this object state.
+  /// Symbolic chunks shared with copies of the object are divided among
+  /// the copies. Expressions and update nodes are not counted.
+  uint64_t getMemoryUsage() const;
+
   inline bool isConcrete(unsigned offset, Expr::Width width) const {
-    if (!concreteMask)
+    if (!symbolicCount)
         return true;
 
-    unsigned size = Expr::getMinBytesForWidth(width);
-    for(unsigned i = 0; i < size; ++i) {
-      if(!isByteConcrete(offset + i))
-        return false;
-    }
-    return true;
+    return concreteMask->isAllOnes(offset, Expr::getMinBytesForWidth(width));
   }
 
+  /// Hash of the bytes in [offset, offset + len). Symbolic bytes
+  /// contribute the hash of their expression. Shared concrete objects
+  /// are hashed from their own store, not from the shared memory.
+  uint64_t computeHash(unsigned offset, unsigned len) const;
+
   const uint8_t *getConcreteStore(bool allowSymbolic = false) const;
   uint8_t *getConcreteStore(bool allowSymolic = false);
 
 private:
+  static void *allocate(size_t size);
+  static void deallocate(void *ptr);
+
+  // The array and its bits are allocated as a single block
+  static BitArray *createBitArray(unsigned size, bool value);
+  static BitArray *createBitArray(const BitArray &b, unsigned size);
+  static void destroyBitArray(BitArray *b);
+
   const UpdateList &getUpdates() const;
 
   void makeConcrete();
@@ -259,9 +328,16 @@ private:
 
   void fastRangeCheckOffset(ref<Expr> offset, unsigned *base_r, 
                             unsigned *size_r) const;
+  const Array *getConstantTable(unsigned base, unsigned len) const;
+  const Array *getTableForRead(ref<Expr> offset, unsigned len,
+                               unsigned *base_r) const;
   void flushRangeForRead(unsigned rangeBase, unsigned rangeSize) const;
   void flushRangeForWrite(unsigned rangeBase, unsigned rangeSize);
 
+  /// Drop the updates hidden by a newer write to the same concrete index
+  /// once the list has grown enough since the last time.
+  void compactUpdates() const;
+
   inline bool isByteConcrete(unsigned offset) const {
     return !concreteMask || concreteMask->get(offset);
   }
@@ -271,12 +347,28 @@ private:
   }
 
   inline bool isByteKnownSymbolic(unsigned offset) const {
-      return knownSymbolics && knownSymbolics[offset].get();
+      if (!knownSymbolics)
+        return false;
+      const SymbolicChunk *chunk = knownSymbolics[offset >> SymbolicChunk::Bits];
+      return chunk && chunk->values[offset & (SymbolicChunk::Size - 1)].get();
+  }
+
+  inline const ref<Expr> &getKnownSymbolic(unsigned offset) const {
+      return knownSymbolics[offset >> SymbolicChunk::Bits]
+               ->values[offset & (SymbolicChunk::Size - 1)];
   }
 
+  unsigned getSymbolicChunkCount() const {
+      return (size + SymbolicChunk::Size - 1) >> SymbolicChunk::Bits;
+  }
+
+  void releaseKnownSymbolics();
+
   inline void markByteConcrete(unsigned offset) {
-      if (concreteMask)
+      if (symbolicCount && !concreteMask->get(offset)) {
         concreteMask->set(offset);
+        --symbolicCount;
+      }
   }
 
   void markByteSymbolic(unsigned offset);
@@ -34,23 +34,32 @@ namespace klee {
                                  const data_type &rightData);
     void remove(Node *n);
 
+    /// Number of allocated nodes, collapsed nodes are not counted
+    static uint64_t getNodeCount();
+
     void dump(llvm::raw_ostream &os);
 
     void activate(Node *n);
     void deactivate(Node *n);
   };
 
+  /// Nodes are allocated from chunks that are recycled through a free
+  /// list, millions of forks would otherwise fragment the heap. Interior
+  /// nodes that are left with a single child are spliced out, so the tree
+  /// only holds the branching points of the states that are still alive.
   class PTreeNode {
     friend class PTree;
   public:
     PTreeNode *parent, *left, *right;
     ExecutionState *data;
-    ref<Expr> condition;
     bool active;
 
   private:
     PTreeNode(PTreeNode *_parent, ExecutionState *_data);
     ~PTreeNode();
+
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
   };
 }
 
@@ -15,6 +15,7 @@
 #include <vector>
 
 namespace klee {
+  class Assignment;
   class ConstraintManager;
   class Expr;
   class SolverImpl;
@@ -24,18 +25,24 @@ namespace klee {
     const ConstraintManager &constraints;
     ref<Expr> expr;
 
-    Query(const ConstraintManager& _constraints, ref<Expr> _expr)
-      : constraints(_constraints), expr(_expr) {
+    /// seed - An optional assignment believed to be close to a solution,
+    /// typically the concolic values of the state issuing the query. Solvers
+    /// may use it as a starting point and are free to ignore it.
+    const Assignment *seed;
+
+    Query(const ConstraintManager& _constraints, ref<Expr> _expr,
+          const Assignment *_seed = 0)
+      : constraints(_constraints), expr(_expr), seed(_seed) {
     }
 
     /// withExpr - Return a copy of the query with the given expression.
     Query withExpr(ref<Expr> _expr) const {
-      return Query(constraints, _expr);
+      return Query(constraints, _expr, seed);
     }
 
     /// withFalse - Return a copy of the query with a false expression.
     Query withFalse() const {
-      return Query(constraints, ConstantExpr::alloc(0, Expr::Bool));
+      return Query(constraints, ConstantExpr::alloc(0, Expr::Bool), seed);
     }
 
     /// negateExpr - Return a copy of the query with the expression negated.
@@ -110,6 +117,23 @@ namespace klee {
     /// \return True on success.
     bool mayBeFalse(const Query&, bool &result);
 
+    /// mayBeTrue - Determine for each of a set of conditions whether there is
+    /// a valid assignment for the given constraints in which it is true. The
+    /// expression of the query is ignored.
+    ///
+    /// Each query asks for an assignment satisfying any of the conditions
+    /// not yet known to be feasible and marks all those it satisfies. When
+    /// the conditions are mutually exclusive (e.g., the cases of a switch)
+    /// this takes one query per feasible condition plus one, instead of
+    /// one per condition.
+    ///
+    /// \param [out] results - On success, one entry per condition, true iff
+    /// the condition is true for some satisfying assignment.
+    ///
+    /// \return True on success.
+    bool mayBeTrue(const Query&, const std::vector< ref<Expr> > &conditions,
+                   std::vector<bool> &results);
+
     /// getValue - Compute one possible value for the given expression.
     ///
     /// \param [out] result - On success, a value for the expression in some
@@ -168,6 +192,9 @@ namespace klee {
     /// setTimeout - Set constraint solver timeout delay to the given value; 0
     /// is off.
     void setTimeout(double timeout);
+
+    /// getTimeoutCount - Return the number of queries that timed out so far.
+    unsigned getTimeoutCount() const;
   };
 
   /* *** */
@@ -187,6 +214,34 @@ namespace klee {
   /// \param s - The underlying solver to use.
   Solver *createCachingSolver(Solver *s);
 
+  /// createSharedCachingSolver - Create a solver which caches the validity
+  /// of queries in a memory mapped file. The cache is shared by all the
+  /// processes forked afterwards and persists across runs.
+  ///
+  /// \param s - The underlying solver to use.
+  /// \param path - The file backing the cache.
+  /// \param sizeBits - Log2 of the number of cache entries.
+  Solver *createSharedCachingSolver(Solver *s, const std::string &path,
+                                    unsigned sizeBits);
+
+  /// createRemoteSolver - Create a solver which sends the queries to solver
+  /// servers (see serveSolverQueries). The queries that no server accepts,
+  /// because they are all busy or unreachable, go to the local solver.
+  ///
+  /// \param local - The solver used when no server is available.
+  /// \param servers - Comma-separated list of host:port addresses.
+  Solver *createRemoteSolver(Solver *local, const std::string &servers);
+
+  /// serveSolverQueries - Answer the queries of remote solvers with the
+  /// given solver. Each connection is served by its own process. Only
+  /// returns on errors.
+  ///
+  /// \param solver - The solver that answers the queries.
+  /// \param port - The TCP port to listen on.
+  /// \param jobs - Number of queries solved at the same time, the clients
+  /// solve the others locally.
+  bool serveSolverQueries(Solver *solver, unsigned port, unsigned jobs);
+
   /// createCexCachingSolver - Create a counterexample caching solver. This is a
   /// more sophisticated cache which records counterexamples for a constraint
   /// set and uses subset/superset relations among constraints to try and
@@ -197,11 +252,27 @@ namespace klee {
 
   /// createFastCexSolver - Create a "fast counterexample solver", which tries
   /// to quickly compute a satisfying assignment for a constraint set using
-  /// value propogation and range analysis.
+  /// value propogation and range analysis. Queries carrying a seed are first
+  /// tried by a local search starting from the seed.
   ///
   /// \param s - The underlying solver to use.
   Solver *createFastCexSolver(Solver *s);
 
+  /// createKnownBitsSolver - Create a solver which decides the queries
+  /// whose expression is determined by propagating known bits and unsigned
+  /// ranges through it, such as flags computed on a few symbolic bytes.
+  ///
+  /// \param s - The underlying solver to use.
+  Solver *createKnownBitsSolver(Solver *s);
+
+  /// getConservativeRange - Bound the unsigned value of an expression of
+  /// at most 64 bits by range propagation, without any query. Symbolic
+  /// array bytes may take any value, so the bounds hold on every path.
+  ///
+  /// \return - A pair with (min, max) values, min > max if the analysis
+  /// failed.
+  std::pair<uint64_t, uint64_t> getConservativeRange(ref<Expr> e);
+
   /// createIndependentSolver - Create a solver which will eliminate any
   /// unnecessary constraints before propogating the query to the underlying
   /// solver.
@@ -213,6 +284,10 @@ namespace klee {
   /// after writing them to the given path in .pc format.
   Solver *createPCLoggingSolver(Solver *s, std::string path);
 
+  /// setPCLoggingStateId - Tag the queries logged from now on with the id
+  /// of the state that issues them (-1 if none).
+  void setPCLoggingStateId(int id);
+
   /// createDummySolver - Create a dummy solver implementation which always
   /// fails.
   Solver *createDummySolver();
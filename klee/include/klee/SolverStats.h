@@ -15,16 +15,30 @@
 namespace klee {
 namespace stats {
 
+  extern Statistic cexCacheHits;
+  extern Statistic cexCacheMisses;
   extern Statistic cexCacheTime;
+  extern Statistic incrementalQueryReusedConstraints;
+  extern Statistic independentQueries;
+  extern Statistic independentQueriesReduced;
+  extern Statistic knownBitsHits;
+  extern Statistic knownBitsMisses;
   extern Statistic queries;
   extern Statistic queriesInvalid;
   extern Statistic queriesValid;
   extern Statistic queryCacheHits;
   extern Statistic queryCacheMisses;
+  extern Statistic queryCanonicalCacheHits;
   extern Statistic queryConstructTime;
   extern Statistic queryConstructs;
   extern Statistic queryCounterexamples;
   extern Statistic queryTime;
+  extern Statistic queryTimeouts;
+  extern Statistic remoteSolverQueries;
+  extern Statistic remoteSolverFallbacks;
+  extern Statistic sharedQueryCacheHits;
+  extern Statistic sharedQueryCacheMisses;
+  extern Statistic sharedQueryCacheCollisions;
 
 }
 }
@@ -0,0 +1,85 @@
+//===-- StateSet.h ----------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_STATESET_H
+#define KLEE_STATESET_H
+
+#include "klee/ExecutionState.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace klee {
+
+/// Set of states with constant-time insertion, lookup and removal.
+///
+/// The states are kept in a vector and each state remembers its slot.
+/// Removing a state moves the last one into the freed slot, so iteration
+/// order is arbitrary, and removing states while iterating over the set
+/// is not allowed. A state can only be in one StateSet at a time, the
+/// index stored in a copied state is detected as stale.
+class StateSet {
+public:
+  typedef std::vector<ExecutionState*>::const_iterator iterator;
+  typedef iterator const_iterator;
+
+private:
+  std::vector<ExecutionState*> m_states;
+
+  bool contains(const ExecutionState *es) const {
+    return es->stateSetIndex < m_states.size() &&
+           m_states[es->stateSetIndex] == es;
+  }
+
+public:
+  /// Returns false if the state was already in the set
+  bool insert(ExecutionState *es) {
+    if (contains(es))
+      return false;
+    es->stateSetIndex = m_states.size();
+    m_states.push_back(es);
+    return true;
+  }
+
+  template<typename InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+  /// Returns the number of removed states (0 or 1), like std::set
+  size_t erase(ExecutionState *es) {
+    if (!contains(es))
+      return 0;
+
+    ExecutionState *last = m_states.back();
+    m_states[es->stateSetIndex] = last;
+    last->stateSetIndex = es->stateSetIndex;
+    m_states.pop_back();
+    es->stateSetIndex = (unsigned) -1;
+    return 1;
+  }
+
+  size_t count(const ExecutionState *es) const {
+    return contains(es) ? 1 : 0;
+  }
+
+  iterator find(const ExecutionState *es) const {
+    return contains(es) ? m_states.begin() + es->stateSetIndex : m_states.end();
+  }
+
+  iterator begin() const { return m_states.begin(); }
+  iterator end() const { return m_states.end(); }
+  size_t size() const { return m_states.size(); }
+  bool empty() const { return m_states.empty(); }
+};
+
+}
+
+#endif
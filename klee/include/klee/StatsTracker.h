@@ -14,6 +14,7 @@
 #include <llvm/Support/raw_ostream.h>
 #include <iostream>
 #include <set>
+#include <vector>
 
 namespace llvm {
   class BranchInst;
@@ -28,6 +29,8 @@ namespace klee {
   class InterpreterHandler;
   struct KInstruction;
   struct StackFrame;
+  class StatsRow;
+  class StatsStreamWriter;
 
   class StatsTracker {
   protected:
@@ -39,6 +42,15 @@ namespace klee {
 
     llvm::raw_ostream *statsFile, *istatsFile;
     double startWallTime;
+
+    /// run.kstats, replaces both files with -output-binary-stats
+    StatsStreamWriter *statsStream;
+
+    /// Values of the instruction statistics last written to the stream,
+    /// indexed by instruction id and event
+    std::vector<uint64_t> istatsSnapshot;
+    /// Instructions whose location was written to the stream
+    std::vector<bool> istatsDescribed;
     
     unsigned numBranches;
     unsigned fullBranches, partialBranches;
@@ -47,14 +59,32 @@ namespace klee {
 
     bool updateMinDistToUncovered;
 
+    /// Functions of the module when the tracker was created. Functions
+    /// added later (e.g., S2E translation blocks) have no entry in the
+    /// instruction info table, so the distances are not computed for them.
+    std::vector<llvm::Function*> trackedFunctions;
+
+    /// Instructions of the defined tracked functions, in reverse order
+    std::vector<llvm::Instruction*> trackedInstructions;
+
+    /// Set when an instruction gets covered, the distances to uncovered
+    /// instructions are only recomputed then
+    bool coverageChanged;
+
   public:
     static bool useStatistics();
 
   protected:
     void updateStateStatistics(uint64_t addend);
-    virtual void writeStatsHeader();
-    virtual void writeStatsLine();
+
+    /// Fill row with the columns of run.stats
+    virtual void getStatsRow(StatsRow &row);
+
+    void writeStatsHeader();
+    void writeStatsLine();
     virtual void writeIStats();
+    void writeIStatsEvents();
+    void writeIStatsDeltas();
 
   public:
     StatsTracker(Executor &_executor, std::string _objectFilename,
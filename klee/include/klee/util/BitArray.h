@@ -20,18 +20,39 @@ private:
   // XXX(s2e) for now we keep this first to access from C code
   // (yes, we do need to access if really fast)
   uint32_t *bits;
+
+  // false if the bits live in storage provided by the creator
+  bool ownsBits;
   
 protected:
   static uint32_t length(unsigned size) { return (size+31)/32; }
 
 public:
-  BitArray(unsigned size, bool value = false) : bits(new uint32_t[length(size)]) {
+  BitArray(unsigned size, bool value = false)
+    : bits(new uint32_t[length(size)]), ownsBits(true) {
     memset(bits, value?0xFF:0, sizeof(*bits)*length(size));
   }
-  BitArray(const BitArray &b, unsigned size) : bits(new uint32_t[length(size)]) {
+  BitArray(const BitArray &b, unsigned size)
+    : bits(new uint32_t[length(size)]), ownsBits(true) {
     memcpy(bits, b.bits, sizeof(*bits)*length(size));
   }
-  ~BitArray() { delete[] bits; }
+
+  /// Use \a storage (getStorageSize(size) bytes) for the bits. The storage
+  /// must outlive the array and is not freed by it.
+  BitArray(uint32_t *storage, unsigned size, bool value)
+    : bits(storage), ownsBits(false) {
+    memset(bits, value?0xFF:0, sizeof(*bits)*length(size));
+  }
+  BitArray(uint32_t *storage, const BitArray &b, unsigned size)
+    : bits(storage), ownsBits(false) {
+    memcpy(bits, b.bits, sizeof(*bits)*length(size));
+  }
+
+  ~BitArray() { if (ownsBits) delete[] bits; }
+
+  static size_t getStorageSize(unsigned size) {
+    return sizeof(uint32_t)*length(size);
+  }
 
   inline bool get(unsigned idx) { return (bool) ((bits[idx/32]>>(idx&0x1F))&1); }
   inline void set(unsigned idx) { bits[idx/32] |= 1<<(idx&0x1F); }
@@ -42,6 +63,8 @@ public:
     for(unsigned i = 0; i < size/32; ++i)
       if(bits[i] != 0)
         return false;
+    if(!(size&0x1F))
+      return true;
     uint32_t mask = (1 << (size&0x1F)) - 1;
     return (bits[size/32] & mask) == 0;
   }
@@ -50,9 +73,33 @@ public:
     for(unsigned i = 0; i < size/32; ++i)
       if(bits[i] != 0xffffffff)
         return false;
+    if(!(size&0x1F))
+      return true;
     uint32_t mask = (1 << (size&0x1F)) - 1;
     return (bits[size/32] & mask) == mask;
   }
+
+  // Check the range [begin, begin+count) a word at a time
+  bool isAllOnes(unsigned begin, unsigned count) {
+    unsigned end = begin + count;
+    if((begin&0x1F) + count <= 32) {
+      uint32_t mask = count == 32 ? 0xffffffff : ((1u << count) - 1);
+      return ((bits[begin/32] >> (begin&0x1F)) & mask) == mask;
+    }
+    if(begin&0x1F) {
+      uint32_t mask = ~0u << (begin&0x1F);
+      if((bits[begin/32] & mask) != mask)
+        return false;
+      begin = (begin + 31) & ~0x1F;
+    }
+    for(; begin + 32 <= end; begin += 32)
+      if(bits[begin/32] != 0xffffffff)
+        return false;
+    if(begin == end)
+      return true;
+    uint32_t mask = (1u << (end - begin)) - 1;
+    return (bits[begin/32] & mask) == mask;
+  }
 };
 
 } // End klee namespace
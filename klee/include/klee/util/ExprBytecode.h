@@ -0,0 +1,77 @@
+//===-- ExprBytecode.h ------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_UTIL_EXPRBYTECODE_H
+#define KLEE_UTIL_EXPRBYTECODE_H
+
+#include "klee/Expr.h"
+#include "klee/util/Assignment.h"
+
+#include <map>
+#include <vector>
+
+namespace klee {
+  class Array;
+
+  /// ExprBytecode - A set of boolean expressions compiled to a flat
+  /// program over the bytes of their arrays. Each instruction computes
+  /// one node of the expression DAG into its own register, so checking
+  /// the set against many assignments is a loop over a vector instead
+  /// of a tree walk that allocates a constant per node.
+  ///
+  /// Only expressions of at most 64 bits can be compiled. Evaluation
+  /// gives up when it hits a division by zero or a byte left free by
+  /// the assignment; callers then fall back to Assignment::evaluate.
+  class ExprBytecode {
+  public:
+    ExprBytecode() {}
+
+    /// add - Compile e as one more expression of the set. Returns false,
+    /// leaving the program unchanged, if e cannot be compiled.
+    bool add(ref<Expr> e);
+
+    template<typename InputIterator>
+    bool add(InputIterator begin, InputIterator end) {
+      for (; begin != end; ++begin)
+        if (!add(*begin))
+          return false;
+      return true;
+    }
+
+    /// satisfies - Evaluate the set under a. Returns false if the
+    /// program cannot give a concrete answer, otherwise sets result to
+    /// whether all the expressions are true.
+    bool satisfies(const Assignment &a, bool &result) const;
+
+    bool empty() const { return roots.empty(); }
+
+  private:
+    struct Instruction {
+      Expr::Kind opcode;
+      Expr::Width width;
+      Expr::Width srcWidth;
+      unsigned ops[3];
+      uint64_t imm;
+    };
+
+    std::vector<Instruction> code;
+    std::vector<unsigned> roots;
+    std::vector< ref<Expr> > exprs;
+    std::vector<const Array*> arrays;
+    std::map<const Array*, unsigned> arrayIds;
+    std::map<const Expr*, unsigned> registers;
+
+    bool compile(const ref<Expr> &e, unsigned &reg);
+    unsigned emit(Expr::Kind opcode, Expr::Width width, Expr::Width srcWidth,
+                  unsigned a, unsigned b, unsigned c, uint64_t imm);
+    unsigned getArrayId(const Array *array);
+  };
+}
+
+#endif
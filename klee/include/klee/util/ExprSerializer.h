@@ -0,0 +1,103 @@
+//===-- ExprSerializer.h ----------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_UTIL_EXPRSERIALIZER_H
+#define KLEE_UTIL_EXPRSERIALIZER_H
+
+#include "klee/Expr.h"
+
+#include <map>
+#include <vector>
+
+namespace klee {
+  class Array;
+
+  /// ExprWriter - Serialize expressions in a compact binary form, e.g., to
+  /// send queries to another process. Each array, update node and
+  /// expression is written once, before its first use, and later uses refer
+  /// to it by its number. Shared subexpressions and update lists therefore
+  /// take no more space than in memory.
+  ///
+  /// Integers are written in a variable length encoding, and can be mixed
+  /// with the expressions and arrays to frame them.
+  class ExprWriter {
+  public:
+    ExprWriter(std::vector<unsigned char> &_buffer) : buffer(_buffer) {}
+
+    void writeInt(uint64_t value);
+    void writeExpr(const ref<Expr> &e);
+    void writeArray(const Array *array);
+
+    /// Write the size of the data followed by the data itself
+    void writeBytes(const void *data, size_t size);
+
+  private:
+    std::vector<unsigned char> &buffer;
+    std::map<const Array*, unsigned> arrays;
+    std::map<const UpdateNode*, unsigned> updates;
+    std::map<const Expr*, unsigned> exprs;
+
+    unsigned defineArray(const Array *array);
+    unsigned defineUpdate(const UpdateNode *un);
+    unsigned defineExpr(const ref<Expr> &e);
+  };
+
+  /// ExprReader - Read back the data written by an ExprWriter, in the same
+  /// order. All the read functions return false if the data is malformed.
+  ///
+  /// The arrays are recreated and belong to the reader, which must
+  /// therefore outlive the expressions it returns. When an array table is
+  /// given, the arrays are looked up by name, size and values in the table
+  /// instead, and are added to it if missing. They then outlive the reader,
+  /// and the expressions of successive readers share them.
+  class ExprReader {
+  public:
+    typedef std::map<std::pair<std::string, unsigned>,
+                     std::vector<const Array*> > ArrayTable;
+
+    ExprReader(const unsigned char *data, size_t size,
+               ArrayTable *_arrayTable = 0)
+      : pos(data), end(data + size), arrayTable(_arrayTable) {}
+    ~ExprReader();
+
+    bool readInt(uint64_t &value);
+    bool readExpr(ref<Expr> &e);
+    bool readArray(const Array *&array);
+
+    /// Read data written by writeBytes, without copying it. The data
+    /// remains valid as long as the buffer given to the reader does.
+    bool readBytes(const unsigned char *&data, uint64_t &size);
+
+    bool atEnd() const { return pos == end; }
+
+    /// Continue with the next buffer of the same stream, e.g., the next
+    /// record of a file written with a single ExprWriter. The arrays and
+    /// expressions of the previous buffers can still be referred to.
+    void setData(const unsigned char *data, size_t size) {
+      pos = data;
+      end = data + size;
+    }
+
+  private:
+    const unsigned char *pos, *end;
+    ArrayTable *arrayTable;
+    std::vector<const Array*> arrays;
+    /// The update nodes are kept alive by lists without a root
+    std::vector<UpdateList> updates;
+    std::vector< ref<Expr> > exprs;
+
+    bool readDefinitions(unsigned &tag);
+    bool readArrayDefinition();
+    bool readUpdateDefinition();
+    bool readExprDefinition();
+    bool readId(uint64_t size, uint64_t &id);
+  };
+}
+
+#endif
@@ -12,6 +12,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #define KTEST_VERSION 3
 #define KTEST_MAGIC_SIZE 5
@@ -20,6 +26,15 @@
 // for compatibility reasons
 #define BOUT_MAGIC "BOUT\n"
 
+#define KTEST_STREAM_MAGIC_SIZE 4
+#define KTEST_STREAM_MAGIC "KTSR"
+// magic, size of the test, 64-bit key
+#define KTEST_STREAM_HEADER_SIZE 16
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 /***/
 
 static int read_uint32(FILE *f, unsigned *value_out) {
@@ -238,3 +253,267 @@ void kTest_free(KTest *bo) {
   free(bo->objects);
   free(bo);
 }
+
+
+/***/
+
+static unsigned char *put_uint32(unsigned char *p, unsigned value) {
+  p[0] = value>>24;
+  p[1] = value>>16;
+  p[2] = value>> 8;
+  p[3] = value>> 0;
+  return p + 4;
+}
+
+static unsigned char *put_string(unsigned char *p, const char *value) {
+  unsigned len = strlen(value);
+  p = put_uint32(p, len);
+  memcpy(p, value, len);
+  return p + len;
+}
+
+static unsigned get_uint32(const unsigned char *p) {
+  return (((((p[0]<<8) + p[1])<<8) + p[2])<<8) + p[3];
+}
+
+static int take_uint32(const unsigned char **p, const unsigned char *end,
+                       unsigned *value_out) {
+  if (end - *p < 4)
+    return 0;
+  *value_out = get_uint32(*p);
+  *p += 4;
+  return 1;
+}
+
+static int take_string(const unsigned char **p, const unsigned char *end,
+                       char **value_out) {
+  unsigned len;
+  if (!take_uint32(p, end, &len) || (unsigned) (end - *p) < len)
+    return 0;
+  *value_out = (char*) malloc(len+1);
+  if (!*value_out)
+    return 0;
+  memcpy(*value_out, *p, len);
+  (*value_out)[len] = 0;
+  *p += len;
+  return 1;
+}
+
+static unsigned kTest_serializedSize(KTest *bo) {
+  unsigned i, size = KTEST_MAGIC_SIZE + 4 * 5;
+  for (i=0; i<bo->numArgs; i++)
+    size += 4 + strlen(bo->args[i]);
+  for (i=0; i<bo->numObjects; i++)
+    size += 4 + strlen(bo->objects[i].name) + 4 + bo->objects[i].numBytes;
+  return size;
+}
+
+int kTest_isKTestStream(const char *path) {
+  FILE *f = fopen(path, "rb");
+  char header[KTEST_STREAM_MAGIC_SIZE];
+  int res;
+
+  if (!f)
+    return 0;
+  res = fread(header, KTEST_STREAM_MAGIC_SIZE, 1, f)==1 &&
+        !memcmp(header, KTEST_STREAM_MAGIC, KTEST_STREAM_MAGIC_SIZE);
+  fclose(f);
+
+  return res;
+}
+
+int kTest_appendToStream(KTest *bo, unsigned long long key, const char *path) {
+  unsigned size = kTest_serializedSize(bo);
+  unsigned char *buf = (unsigned char*) malloc(KTEST_STREAM_HEADER_SIZE + size);
+  unsigned char *p = buf;
+  unsigned i;
+  int fd, res;
+
+  if (!buf)
+    return 0;
+
+  memcpy(p, KTEST_STREAM_MAGIC, KTEST_STREAM_MAGIC_SIZE);
+  p += KTEST_STREAM_MAGIC_SIZE;
+  p = put_uint32(p, size);
+  p = put_uint32(p, (unsigned) (key >> 32));
+  p = put_uint32(p, (unsigned) key);
+
+  memcpy(p, KTEST_MAGIC, KTEST_MAGIC_SIZE);
+  p += KTEST_MAGIC_SIZE;
+  p = put_uint32(p, KTEST_VERSION);
+  p = put_uint32(p, bo->numArgs);
+  for (i=0; i<bo->numArgs; i++)
+    p = put_string(p, bo->args[i]);
+  p = put_uint32(p, bo->symArgvs);
+  p = put_uint32(p, bo->symArgvLen);
+  p = put_uint32(p, bo->numObjects);
+  for (i=0; i<bo->numObjects; i++) {
+    KTestObject *o = &bo->objects[i];
+    p = put_string(p, o->name);
+    p = put_uint32(p, o->numBytes);
+    memcpy(p, o->bytes, o->numBytes);
+    p += o->numBytes;
+  }
+
+  // A single append keeps the records of concurrent writers apart
+  fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_BINARY, 0644);
+  if (fd < 0) {
+    free(buf);
+    return 0;
+  }
+  res = write(fd, buf, p - buf) == p - buf;
+  res = !close(fd) && res;
+  free(buf);
+
+  return res;
+}
+
+struct KTestStream {
+  unsigned char *data;
+  size_t size;
+  size_t pos;
+  int mapped;
+
+  // The last test returned by kTestStream_next
+  KTest test;
+};
+
+static void kTestStream_clearTest(KTestStream *s) {
+  unsigned i;
+  if (s->test.args) {
+    for (i=0; i<s->test.numArgs; i++)
+      free(s->test.args[i]);
+    free(s->test.args);
+  }
+  if (s->test.objects) {
+    for (i=0; i<s->test.numObjects; i++)
+      free(s->test.objects[i].name);
+    free(s->test.objects);
+  }
+  memset(&s->test, 0, sizeof(s->test));
+}
+
+KTestStream *kTestStream_open(const char *path) {
+  KTestStream *res;
+  struct stat st;
+  int fd = open(path, O_RDONLY | O_BINARY);
+
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return 0;
+  }
+
+  res = (KTestStream*) calloc(1, sizeof(*res));
+  if (!res) {
+    close(fd);
+    return 0;
+  }
+  res->size = st.st_size;
+
+  if (res->size) {
+#ifndef _WIN32
+    void *data = mmap(0, res->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      res->data = (unsigned char*) data;
+      res->mapped = 1;
+    }
+#endif
+    if (!res->mapped) {
+      res->data = (unsigned char*) malloc(res->size);
+      if (!res->data || read(fd, res->data, res->size) != (int) res->size) {
+        close(fd);
+        free(res->data);
+        free(res);
+        return 0;
+      }
+    }
+  }
+
+  close(fd);
+  return res;
+}
+
+KTest *kTestStream_next(KTestStream *s, unsigned long long *key) {
+  const unsigned char *p, *end;
+  unsigned i, size, version;
+
+  kTestStream_clearTest(s);
+
+  if (s->size - s->pos < KTEST_STREAM_HEADER_SIZE)
+    return 0;
+
+  p = s->data + s->pos;
+  if (memcmp(p, KTEST_STREAM_MAGIC, KTEST_STREAM_MAGIC_SIZE))
+    return 0;
+  size = get_uint32(p + 4);
+  if (s->size - s->pos - KTEST_STREAM_HEADER_SIZE < size)
+    return 0;
+  if (key)
+    *key = ((unsigned long long) get_uint32(p + 8) << 32) | get_uint32(p + 12);
+
+  p += KTEST_STREAM_HEADER_SIZE;
+  end = p + size;
+
+  if (size < KTEST_MAGIC_SIZE || memcmp(p, KTEST_MAGIC, KTEST_MAGIC_SIZE))
+    return 0;
+  p += KTEST_MAGIC_SIZE;
+
+  if (!take_uint32(&p, end, &version) || version > kTest_getCurrentVersion())
+    goto error;
+  s->test.version = version;
+
+  if (!take_uint32(&p, end, &s->test.numArgs))
+    goto error;
+  s->test.args = (char**) calloc(s->test.numArgs, sizeof(*s->test.args));
+  if (!s->test.args && s->test.numArgs)
+    goto error;
+  for (i=0; i<s->test.numArgs; i++)
+    if (!take_string(&p, end, &s->test.args[i]))
+      goto error;
+
+  if (version >= 2) {
+    if (!take_uint32(&p, end, &s->test.symArgvs))
+      goto error;
+    if (!take_uint32(&p, end, &s->test.symArgvLen))
+      goto error;
+  }
+
+  if (!take_uint32(&p, end, &s->test.numObjects))
+    goto error;
+  s->test.objects = (KTestObject*) calloc(s->test.numObjects,
+                                          sizeof(*s->test.objects));
+  if (!s->test.objects && s->test.numObjects)
+    goto error;
+  for (i=0; i<s->test.numObjects; i++) {
+    KTestObject *o = &s->test.objects[i];
+    if (!take_string(&p, end, &o->name))
+      goto error;
+    if (!take_uint32(&p, end, &o->numBytes) ||
+        (unsigned) (end - p) < o->numBytes)
+      goto error;
+    // Points into the stream, the bytes are not copied
+    o->bytes = (unsigned char*) p;
+    p += o->numBytes;
+  }
+
+  s->pos += KTEST_STREAM_HEADER_SIZE + size;
+  return &s->test;
+
+ error:
+  kTestStream_clearTest(s);
+  return 0;
+}
+
+void kTestStream_close(KTestStream *s) {
+  kTestStream_clearTest(s);
+  if (s->mapped) {
+#ifndef _WIN32
+    munmap(s->data, s->size);
+#endif
+  } else {
+    free(s->data);
+  }
+  free(s);
+}
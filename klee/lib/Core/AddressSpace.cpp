@@ -15,9 +15,26 @@
 #include "klee/Expr.h"
 #include "klee/TimerStatIncrementer.h"
 #include "klee/ExecutionState.h"
+#include "klee/Solver.h"
+
+#include <algorithm>
 
 using namespace klee;
 
+unsigned AddressSpace::fixedObjectBits = 0;
+
+void AddressSpace::setFixedObjectBits(unsigned bits) {
+  assert(bits < 48);
+  fixedObjectBits = bits;
+}
+
+bool AddressSpace::isFixedObject(const MemoryObject *mo) const {
+  return fixedObjectBits &&
+         mo->size == ((uint64_t) 1 << fixedObjectBits) &&
+         !(mo->address & (mo->size - 1)) &&
+         !(mo->address >> 48);
+}
+
 ///
 
 void AddressSpace::bindObject(const MemoryObject *mo, ObjectState *os) {
@@ -29,6 +46,9 @@ void AddressSpace::bindObject(const MemoryObject *mo, ObjectState *os) {
   assert(os->copyOnWriteOwner==0 && "object already has owner");
   os->copyOnWriteOwner = cowKey;
   objects = objects.replace(std::make_pair(mo, os));
+  if (isFixedObject(mo))
+    fixedObjects = fixedObjects.replace(mo->address >> fixedObjectBits,
+                                        ObjectPair(mo, os));
 }
 
 void AddressSpace::unbindObject(const MemoryObject *mo) {
@@ -37,15 +57,28 @@ void AddressSpace::unbindObject(const MemoryObject *mo) {
   if(os) state->addressSpaceChange(mo, os, NULL);
 
   objects = objects.remove(mo);
+  if (isFixedObject(mo))
+    fixedObjects = fixedObjects.remove(mo->address >> fixedObjectBits);
 }
 
 const ObjectState *AddressSpace::findObject(const MemoryObject *mo) const {
+  if (isFixedObject(mo)) {
+    const ObjectPair *res = fixedObjects.lookup(mo->address >> fixedObjectBits);
+    return res ? res->second : 0;
+  }
+
   const MemoryMap::value_type *res = objects.lookup(mo);
   
   return res ? res->second : 0;
 }
 
 ObjectPair AddressSpace::findObject(uint64_t address) const {
+  if (fixedObjectBits && !(address >> 48) &&
+      !(address & (((uint64_t) 1 << fixedObjectBits) - 1))) {
+    if (const ObjectPair *res = fixedObjects.lookup(address >> fixedObjectBits))
+      return *res;
+  }
+
   MemoryObject hack(address);
   const MemoryMap::value_type *res = objects.lookup(&hack);
   return res ? ObjectPair(*res) : ObjectPair(NULL, NULL);
@@ -65,6 +98,9 @@ ObjectState *AddressSpace::getWriteable(const MemoryObject *mo,
     state->addressSpaceChange(mo, os, n);
 
     objects = objects.replace(std::make_pair(mo, n));
+    if (isFixedObject(mo))
+      fixedObjects = fixedObjects.replace(mo->address >> fixedObjectBits,
+                                          ObjectPair(mo, n));
     return n;    
   }
 }
@@ -74,11 +110,60 @@ bool AddressSpace::isOwnedByUs(const ObjectState *os) const
     return cowKey==os->copyOnWriteOwner;
 }
 
+uint64_t AddressSpace::getObjectHash(const ObjectState *os) const
+{
+    if (isOwnedByUs(os))
+        return os->computeHash(0, os->size);
+
+    if (!os->hasCachedHash) {
+        os->cachedHash = os->computeHash(0, os->size);
+        os->hasCachedHash = true;
+    }
+    return os->cachedHash;
+}
+
+void AddressSpace::disownObject(const MemoryObject *mo, const ObjectState *os) {
+  assert(isOwnedByUs(os));
+
+  ObjectState *n = const_cast<ObjectState*>(os);
+  n->copyOnWriteOwner = 0;
+  n->hasCachedHash = false;
+
+  // Writes to the object must now go through getWriteable
+  assert(state);
+  state->addressSpaceChange(mo, os, n);
+}
+
+void AddressSpace::shareObject(const MemoryObject *mo, const ObjectState *os) {
+  assert(os->copyOnWriteOwner == 0 && os->getObject() == mo);
+
+  const ObjectState *old = findObject(mo);
+  assert(old && old != os);
+
+  ObjectState *n = const_cast<ObjectState*>(os);
+
+  assert(state);
+  state->addressSpaceChange(mo, old, n);
+
+  objects = objects.replace(std::make_pair(mo, n));
+  if (isFixedObject(mo))
+    fixedObjects = fixedObjects.replace(mo->address >> fixedObjectBits,
+                                        ObjectPair(mo, n));
+}
+
 /// 
 
 bool AddressSpace::resolveOne(const ref<ConstantExpr> &addr, 
                               ObjectPair &result) {
   uint64_t address = addr->getZExtValue();
+
+  if (fixedObjectBits && !(address >> 48)) {
+    if (const ObjectPair *res = fixedObjects.lookup(address >> fixedObjectBits)) {
+      result = *res;
+      return true;
+    }
+  }
+
   MemoryObject hack(address);
 
   if (const MemoryMap::value_type *res = objects.lookup_previous(&hack)) {
@@ -372,6 +457,91 @@ bool AddressSpace::resolve(ExecutionState &state,
   return false;
 }
 
+bool AddressSpace::resolveFixedRange(ExecutionState &state,
+                                     TimingSolver *solver,
+                                     ref<Expr> address,
+                                     unsigned bytes,
+                                     unsigned maxObjects,
+                                     ResolutionList &rl) {
+  if (!fixedObjectBits || !maxObjects || address->getWidth() > 64)
+    return false;
+
+  unsigned bits = fixedObjectBits;
+  std::pair<uint64_t, uint64_t> range = getConservativeRange(address);
+  if (range.first > range.second)
+    return false;
+
+  uint64_t first = range.first >> bits;
+  uint64_t last = (range.second + bytes - 1) >> bits;
+
+  if (range.second + bytes - 1 < range.second || last - first >= maxObjects) {
+    // Too wide, look for the objects around an example value
+    TimerStatIncrementer timer(stats::resolveTime);
+
+    ref<ConstantExpr> cex;
+    if (!solver->getValue(state, address, cex))
+      return false;
+    uint64_t example = cex->getZExtValue() >> bits;
+
+    // Smallest key the address can start in
+    uint64_t lo = std::max(first, example >= maxObjects ? example - maxObjects : 0);
+    uint64_t hi = example;
+    bool res;
+    if (!solver->mayBeTrue(state, UltExpr::create(address,
+            ConstantExpr::create(lo << bits, address->getWidth())), res))
+      return false;
+    if (res)
+      return false;
+    while (lo < hi) {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (!solver->mayBeTrue(state, UltExpr::create(address,
+              ConstantExpr::create((mid + 1) << bits, address->getWidth())), res))
+        return false;
+      if (res)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    first = lo;
+
+    // Largest key the address can start in
+    lo = example;
+    hi = std::min(range.second >> bits, example + maxObjects);
+    if (!solver->mayBeTrue(state, UgeExpr::create(address,
+            ConstantExpr::create((hi + 1) << bits, address->getWidth())), res))
+      return false;
+    if (res)
+      return false;
+    while (lo < hi) {
+      uint64_t mid = lo + (hi - lo + 1) / 2;
+      if (!solver->mayBeTrue(state, UgeExpr::create(address,
+              ConstantExpr::create(mid << bits, address->getWidth())), res))
+        return false;
+      if (res)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+
+    // The access may spill into the next object
+    last = lo + (bytes > 1 ? 1 : 0);
+    if (last - first >= maxObjects)
+      return false;
+  }
+
+  if (last >> (48 - bits))
+    return false;
+
+  for (uint64_t key = first; key <= last; ++key) {
+    const ObjectPair *res = fixedObjects.lookup(key);
+    if (!res || res->first->isSharedConcrete)
+      return false;
+    rl.push_back(*res);
+  }
+
+  return true;
+}
+
 // These two are pretty big hack so we can sort of pass memory back
 // and forth to externals. They work by abusing the concrete cache
 // store inside of the object states, which allows them to
@@ -68,6 +68,7 @@ ExecutionState::ExecutionState(KFunction *kf)
     pc(kf->instructions),
     prevPC(pc),
     queryCost(0.), 
+    queryTimeouts(0),
     weight(1),
     addressSpace(this),
     instsSinceCovNew(0),
@@ -75,7 +76,8 @@ ExecutionState::ExecutionState(KFunction *kf)
     forkDisabled(false),
     ptreeNode(0),
     concolics(true),
-    speculative(false){
+    speculative(false),
+    stateSetIndex((unsigned) -1) {
   pushFrame(0, kf);
 }
 
@@ -84,10 +86,12 @@ ExecutionState::ExecutionState(const std::vector<ref<Expr> > &assumptions)
     underConstrained(false),
     constraints(assumptions),
     queryCost(0.),
+    queryTimeouts(0),
     addressSpace(this),
     ptreeNode(0),
     concolics(true),
-    speculative(false) {
+    speculative(false),
+    stateSetIndex((unsigned) -1) {
 }
 
 ExecutionState::~ExecutionState() {
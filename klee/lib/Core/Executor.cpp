@@ -121,6 +121,11 @@ namespace {
   MaxSymArraySize("max-sym-array-size",
                   cl::init(0));
 
+  cl::opt<unsigned>
+  MaxSymbolicReadObjects("max-symbolic-read-objects",
+                         cl::desc("Read through a symbolic pointer that spans up to this many fixed-size objects without forking (0=off)"),
+                         cl::init(0));
+
   cl::opt<bool>
   DebugValidateSolver("debug-validate-solver",
 		      cl::init(false));
@@ -138,7 +143,13 @@ namespace {
 
   cl::opt<bool>
   UseFastCexSolver("use-fast-cex-solver",
-                   cl::init(false));
+                   cl::init(true),
+                   cl::desc("Look for models by value propagation and by a local search from the concolic values"));
+
+  cl::opt<bool>
+  UseKnownBitsSolver("use-known-bits-solver",
+                     cl::init(true),
+                     cl::desc("Decide queries by known bits and range propagation"));
 
   cl::opt<bool>
   UseIndependentSolver("use-independent-solver",
@@ -158,6 +169,25 @@ namespace {
               cl::init(false),
 	      cl::desc("Use counterexample caching"));
 
+  cl::opt<std::string>
+  SharedQueryCache("shared-query-cache",
+                   cl::init(""),
+                   cl::desc("File used to share the query cache between "
+                            "processes and runs (default=disabled)"));
+
+  cl::opt<unsigned>
+  SharedQueryCacheBits("shared-query-cache-bits",
+                       cl::init(22),
+                       cl::desc("Log2 of the number of entries in the "
+                                "shared query cache"));
+
+  cl::opt<std::string>
+  RemoteSolvers("remote-solvers",
+                cl::init(""),
+                cl::desc("Comma-separated host:port list of the solver servers "
+                         "that answer the queries before the local solver "
+                         "(default=none)"));
+
   cl::opt<bool>
   UseQueryLog("use-query-log",
               cl::init(false));
@@ -302,6 +332,13 @@ Solver *constructSolverChain(STPSolver *stpSolver,
     solver = createPCLoggingSolver(solver, 
                                    stpQueryLogPath);
 
+  if (!RemoteSolvers.empty())
+    solver = createRemoteSolver(solver, RemoteSolvers);
+
+  if (!SharedQueryCache.empty())
+    solver = createSharedCachingSolver(solver, SharedQueryCache,
+                                       SharedQueryCacheBits);
+
   if (UseFastCexSolver)
     solver = createFastCexSolver(solver);
 
@@ -311,6 +348,9 @@ Solver *constructSolverChain(STPSolver *stpSolver,
   if (UseCache)
     solver = createCachingSolver(solver);
 
+  if (UseKnownBitsSolver)
+    solver = createKnownBitsSolver(solver);
+
   if (UseIndependentSolver)
     solver = createIndependentSolver(solver);
 
@@ -852,8 +892,10 @@ Executor::concolicFork(ExecutionState &current, ref<Expr> condition, bool isInte
     branchedState = current.branch();
     addedStates.insert(branchedState);
 
+    //The branched state keeps the concolic values of its parent until
+    //it is resolved: they satisfy all its constraints but the speculative
+    //condition and seed the search for its own values.
     branchedState->speculative = true;
-    branchedState->concolics.clear();
 
     //We don't know if the branched state could be valid
     //or not, so we mark it speculative and defer the
@@ -884,7 +926,8 @@ Executor::concolicFork(ExecutionState &current, ref<Expr> condition, bool isInte
 bool Executor::checkSpeculativeState(ExecutionState &state)
 {
     //Check if the speculative condition satisfies the current path constraints
-    Query query(state.constraints,state.speculativeCondition);
+    Query query(state.constraints, state.speculativeCondition,
+                state.concolics.bindings.empty() ? 0 : &state.concolics);
     bool truth;
     bool res = solver->solver->mustBeTrue(query.negateExpr(), truth);
     if (!res || truth) {
@@ -918,6 +961,7 @@ bool Executor::resolveSpeculativeState(ExecutionState &state)
     }
 
     //Add the concrete values to the current state
+    state.concolics.clear();
     for (unsigned i=0; i<symbObjects.size(); ++i) {
         state.concolics.add(symbObjects[i], concreteObjects[i]);
     }
@@ -1425,6 +1469,11 @@ void Executor::executeCall(ExecutionState &state,
       callExternalFunction(state, ki, f, arguments);
   } else
 
+  if (f && nativeCallableFunctions.count(f) &&
+      mayCallNatively(state, f, arguments)) {
+      callExternalFunction(state, ki, f, arguments);
+  } else
+
   if (f && f->isDeclaration()) {
     switch(f->getIntrinsicID()) {
     case Intrinsic::not_intrinsic:
@@ -1491,7 +1540,7 @@ void Executor::executeCall(ExecutionState &state,
     // guess. This just done to avoid having to pass KInstIterator everywhere
     // instead of the actual instruction, since we can't make a KInstIterator
     // from just an instruction (unlike LLVM).
-    KFunction *kf = kmodule->functionMap[f];
+    KFunction *kf = getKFunction(f);
     state.pushFrame(state.prevPC, kf);
     state.pc = kf->instructions;
         
@@ -1748,6 +1797,8 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
       transferToBasicBlock(si->getSuccessor(index), si->getParent(), state);
     } else {
       std::map<BasicBlock*, ref<Expr> > targets;
+      std::vector< ref<Expr> > matches;
+      std::vector<BasicBlock*> successors;
       ref<Expr> isDefault = ConstantExpr::alloc(1, Expr::Bool);
       for (SwitchInst::CaseIt i = si->case_begin(), e = si->case_end();
            i != e; ++i) {
@@ -1755,24 +1806,28 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
         ref<Expr> match = EqExpr::create(cond, value);
         isDefault = simplifyExpr(state, AndExpr::create(isDefault,
                                     Expr::createIsZero(match)));
-        bool result;
-        assert(!concolicMode && "Not tested in concolic mode");
-        bool success = solver->mayBeTrue(state, match, result);
-        assert(success && "FIXME: Unhandled solver failure");
-        (void) success;
-        if (result) {
-          std::map<BasicBlock*, ref<Expr> >::iterator it =
-            targets.insert(std::make_pair(i.getCaseSuccessor(),
-                                          ConstantExpr::alloc(0, Expr::Bool))).first;
-          it->second = OrExpr::create(match, it->second);
-        }
+        matches.push_back(match);
+        successors.push_back(i.getCaseSuccessor());
       }
-      bool res;
+      matches.push_back(isDefault);
+      successors.push_back(si->getSuccessor(0));
+
+      // The cases and the default are mutually exclusive, check them at once
+      std::vector<bool> feasible;
       assert(!concolicMode && "Not tested in concolic mode");
-      bool success = solver->mayBeTrue(state, isDefault, res);
+      bool success = solver->mayBeTrue(state, matches, feasible);
       assert(success && "FIXME: Unhandled solver failure");
       (void) success;
-      if (res)
+
+      for (unsigned i = 0; i + 1 < matches.size(); ++i) {
+        if (feasible[i]) {
+          std::map<BasicBlock*, ref<Expr> >::iterator it =
+            targets.insert(std::make_pair(successors[i],
+                                          ConstantExpr::alloc(0, Expr::Bool))).first;
+          it->second = OrExpr::create(matches[i], it->second);
+        }
+      }
+      if (feasible.back())
         targets.insert(std::make_pair(si->getSuccessor(0), isDefault));
       
       std::vector< ref<Expr> > conditions;
@@ -2584,9 +2639,8 @@ void Executor::updateStates(ExecutionState *current) {
          it = removedStates.begin(), ie = removedStates.end();
        it != ie; ++it) {
     ExecutionState *es = *it;
-    std::set<ExecutionState*>::iterator it2 = states.find(es);
-    assert(it2!=states.end());
-    states.erase(it2);
+    size_t r = states.erase(es);
+    assert(r == 1);
     std::map<ExecutionState*, std::vector<SeedInfo> >::iterator it3 = 
       seedMap.find(es);
     if (it3 != seedMap.end())
@@ -2649,6 +2703,46 @@ void Executor::bindModuleConstants() {
   }
 }
 
+KFunction *Executor::getKFunction(Function *f) {
+  std::map<Function*, KFunction*>::iterator it = kmodule->functionMap.find(f);
+  if (it != kmodule->functionMap.end())
+    return it->second;
+
+  assert(kmodule->isDeferredFunction(f) && "function has no KFunction");
+
+  unsigned cIndex = kmodule->constants.size();
+  KFunction *kf = kmodule->prepareDeferredFunction(f);
+
+  for (unsigned i=0; i<kf->numInstructions; ++i)
+    bindInstructionConstants(kf->instructions[i]);
+
+  // Lowering may have declared new functions
+  for (Module::iterator i = kmodule->module->begin(),
+         ie = kmodule->module->end(); i != ie; ++i) {
+    Function *fn = i;
+    if (globalAddresses.count(fn))
+      continue;
+
+    ref<ConstantExpr> addr(0);
+    if (fn->hasExternalWeakLinkage() &&
+        !externalDispatcher->resolveSymbol(fn->getName())) {
+      addr = Expr::createPointer(0);
+    } else {
+      addr = Expr::createPointer((uintptr_t) (void*) fn);
+      legalFunctions.insert((uint64_t) (uintptr_t) (void*) fn);
+    }
+    globalAddresses.insert(std::make_pair(fn, addr));
+  }
+
+  kmodule->constantTable.resize(kmodule->constants.size());
+  for (unsigned i=cIndex; i<kmodule->constants.size(); ++i) {
+    Cell &c = kmodule->constantTable[i];
+    c.value = evalConstant(kmodule->constants[i]);
+  }
+
+  return kf;
+}
+
 void Executor::run(ExecutionState &initialState) {
   bindModuleConstants();
 
@@ -2712,7 +2806,7 @@ void Executor::run(ExecutionState &initialState) {
 
     // XXX total hack, just because I like non uniform better but want
     // seed results to be equally weighted.
-    for (std::set<ExecutionState*>::iterator
+    for (StateSet::iterator
            it = states.begin(), ie = states.end();
          it != ie; ++it) {
       (*it)->weight = 1.;
@@ -2724,7 +2818,8 @@ void Executor::run(ExecutionState &initialState) {
 
   searcher = constructUserSearcher(*this);
 
-  searcher->update(0, states, std::set<ExecutionState*>());
+  searcher->update(0, std::set<ExecutionState*>(states.begin(), states.end()),
+                   std::set<ExecutionState*>());
 
   while (!states.empty() && !haltExecution) {
     ExecutionState &state = searcher->selectState();
@@ -2780,7 +2875,7 @@ void Executor::run(ExecutionState &initialState) {
  dump:
   if (DumpStatesOnHalt && !states.empty()) {
     llvm::errs() << "KLEE: halting execution, dumping remaining states\n";
-    for (std::set<ExecutionState*>::iterator
+    for (StateSet::iterator
            it = states.begin(), ie = states.end();
          it != ie; ++it) {
       ExecutionState &state = **it;
@@ -3441,6 +3536,20 @@ void Executor::executeMemoryOperation(ExecutionState &state,
     }
   } 
 
+  // Reads that may touch several consecutive fixed-size objects, e.g.,
+  // table lookups in guest RAM, become a single expression
+  if (!isWrite && MaxSymbolicReadObjects && !concolicMode) {
+    ResolutionList rl;
+    solver->setTimeout(stpTimeout);
+    bool resolved = state.addressSpace.resolveFixedRange(state, solver, address, bytes,
+                                                         MaxSymbolicReadObjects, rl);
+    solver->setTimeout(0);
+    if (resolved) {
+      bindLocal(target, state, readConsecutiveObjects(rl, address, type));
+      return;
+    }
+  }
+
   // we are on an error path (no resolution, multiple resolution, one
   // resolution with out of bounds)
   
@@ -3514,6 +3623,74 @@ void Executor::executeMemoryOperation(ExecutionState &state,
   }
 }
 
+ref<Expr> Executor::readConsecutiveObjects(const ResolutionList &rl,
+                                           ref<Expr> address,
+                                           Expr::Width type) {
+  const MemoryObject *first = rl.front().first;
+  unsigned bytes = Expr::getMinBytesForWidth(type);
+
+  bool concrete = true;
+  for (ResolutionList::const_iterator it = rl.begin(), ie = rl.end(); it != ie; ++it)
+    concrete = concrete && it->second->isAllConcrete();
+
+  std::vector< ref<Expr> > values(bytes);
+
+  if (concrete) {
+    // Merge the contents into a single constant array
+    std::vector< ref<ConstantExpr> > contents;
+    contents.reserve(rl.size() * first->size);
+    for (ResolutionList::const_iterator it = rl.begin(), ie = rl.end(); it != ie; ++it) {
+      for (unsigned i = 0; i < it->first->size; ++i) {
+        uint8_t v;
+        bool ok = it->second->readConcrete8(i, &v);
+        assert(ok);
+        (void) ok;
+        contents.push_back(ConstantExpr::create(v, Expr::Int8));
+      }
+    }
+
+    static unsigned id = 0;
+    const Array *array = new Array("merged" + llvm::utostr(++id), contents.size(),
+                                   &contents[0], &contents[0] + contents.size());
+    UpdateList ul(array, 0);
+    ref<Expr> offset = ZExtExpr::create(first->getOffsetExpr(address), Expr::Int32);
+    for (unsigned i = 0; i < bytes; ++i) {
+      values[i] = ReadExpr::create(ul, AddExpr::create(offset,
+                                   ConstantExpr::create(i, Expr::Int32)));
+    }
+  } else {
+    // Select each byte from the object it falls into
+    for (unsigned i = 0; i < bytes; ++i) {
+      ref<Expr> byteAddress = AddExpr::create(address,
+          ConstantExpr::create(i, address->getWidth()));
+      ref<Expr> res;
+      for (ResolutionList::const_reverse_iterator it = rl.rbegin(), ie = rl.rend();
+           it != ie; ++it) {
+        ref<Expr> offset = it->first->getOffsetExpr(byteAddress);
+        ref<Expr> byte = it->second->read(offset, Expr::Int8);
+        if (res.isNull()) {
+          res = byte;
+        } else {
+          res = SelectExpr::create(UltExpr::create(offset, it->first->getSizeExpr()),
+                                   byte, res);
+        }
+      }
+      values[i] = res;
+    }
+  }
+
+  ref<Expr> result;
+  for (unsigned i = 0; i < bytes; ++i) {
+    unsigned idx = Context::get().isLittleEndian() ? i : (bytes - i - 1);
+    result = i ? ConcatExpr::create(values[idx], result) : values[idx];
+  }
+
+  if (type == Expr::Bool)
+    result = ExtractExpr::create(result, 0, Expr::Bool);
+
+  return result;
+}
+
 void Executor::executeMakeSymbolic(ExecutionState &state, 
                                    const MemoryObject *mo) {
   // Create a new object state for the memory object (instead of a copy).
@@ -3611,7 +3788,7 @@ void Executor::runFunctionAsMain(Function *f,
   for (envc=0; envp[envc]; ++envc) ;
 
   unsigned NumPtrBytes = Context::get().getPointerWidth() / 8;
-  KFunction *kf = kmodule->functionMap[f];
+  KFunction *kf = getKFunction(f);
   assert(kf);
   Function::arg_iterator ai = f->arg_begin(), ae = f->arg_end();
   if (ai!=ae) {
@@ -3633,7 +3810,7 @@ void Executor::runFunctionAsMain(Function *f,
     }
   }
 
-  ExecutionState *state = new ExecutionState(kmodule->functionMap[f]);
+  ExecutionState *state = new ExecutionState(kf);
   
   if (pathWriter) 
     state->pathOS = pathWriter->open();
@@ -3827,11 +4004,28 @@ void Executor::addSpecialFunctionHandler(Function* function,
     specialFunctionHandler->addUHandler(function, handler);
 }
 
+bool Executor::hasSpecialFunctionHandler(const Function* function) const
+{
+    return specialFunctionHandler->isHandled(function);
+}
+
+bool Executor::mayCallNatively(ExecutionState &state, Function *f,
+                               const std::vector< ref<Expr> > &arguments)
+{
+    return false;
+}
+
 Solver *Executor::getSolver() const
 {
     return solver->solver;
 }
 
+bool Executor::getValue(ExecutionState &state, ref<Expr> e,
+                        ref<ConstantExpr> &result)
+{
+    return solver->getValue(state, e, result);
+}
+
 Expr::Width Executor::getWidthForLLVMType(llvm::Type *type) const {
   return kmodule->targetData->getTypeSizeInBits(type);
 }
@@ -24,9 +24,12 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
 #include <iostream>
 #include <cassert>
+#include <map>
 #include <sstream>
+#include <new>
 
 using namespace llvm;
 using namespace klee;
@@ -35,6 +38,16 @@ namespace {
   cl::opt<bool>
   UseConstantArrays("use-constant-arrays",
                     cl::init(true));
+
+  cl::opt<bool>
+  RangeRestrictedReads("range-restricted-reads",
+                       cl::desc("Only flush the bytes in the conservative range of a symbolic offset, and read concrete ranges from constant arrays shared by contents (default=on)"),
+                       cl::init(true));
+
+  cl::opt<unsigned>
+  CompactUpdatesAfter("compact-updates-after",
+                      cl::desc("Compact the update list of an object once it grows by this many writes (0 = never)"),
+                      cl::init(0));
 }
 
 /***/
@@ -89,15 +102,54 @@ void MemoryObject::getAllocInfo(std::string &result) const {
 
 /***/
 
+ObjectStateAllocator *ObjectState::allocator = 0;
+
+void *ObjectState::allocate(size_t size) {
+  if (allocator) {
+    if (void *ptr = allocator->allocate(size))
+      return ptr;
+  }
+  return ::operator new(size);
+}
+
+void ObjectState::deallocate(void *ptr) {
+  if (allocator && allocator->deallocate(ptr))
+    return;
+  ::operator delete(ptr);
+}
+
+BitArray *ObjectState::createBitArray(unsigned size, bool value) {
+  uint8_t *mem = (uint8_t*) allocate(sizeof(BitArray) +
+                                     BitArray::getStorageSize(size));
+  return new (mem) BitArray((uint32_t*) (mem + sizeof(BitArray)),
+                            size, value);
+}
+
+BitArray *ObjectState::createBitArray(const BitArray &b, unsigned size) {
+  uint8_t *mem = (uint8_t*) allocate(sizeof(BitArray) +
+                                     BitArray::getStorageSize(size));
+  return new (mem) BitArray((uint32_t*) (mem + sizeof(BitArray)), b, size);
+}
+
+void ObjectState::destroyBitArray(BitArray *b) {
+  b->~BitArray();
+  deallocate(b);
+}
+
 ObjectState::ObjectState(const MemoryObject *mo)
   : concreteMask(0),
+    symbolicCount(0),
     copyOnWriteOwner(0),
     refCount(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
+    concreteStore((uint8_t*) allocate(mo->size)),
     flushMask(0),
     knownSymbolics(0),
     updates(0, 0),
+    compactedUpdates(0),
+    externalStore(false),
+    cachedHash(0),
+    hasCachedHash(false),
     size(mo->size),
     readOnly(false)
      {
@@ -112,13 +164,18 @@ ObjectState::ObjectState(const MemoryObject *mo)
 
 ObjectState::ObjectState(const MemoryObject *mo, const Array *array)
   : concreteMask(0),
+    symbolicCount(0),
     copyOnWriteOwner(0),
     refCount(0),
     object(mo),
-    concreteStore(new uint8_t[mo->size]),
+    concreteStore((uint8_t*) allocate(mo->size)),
     flushMask(0),
     knownSymbolics(0),
     updates(array, 0),
+    compactedUpdates(0),
+    externalStore(false),
+    cachedHash(0),
+    hasCachedHash(false),
     size(mo->size),
     readOnly(false)
  {
@@ -126,33 +183,63 @@ ObjectState::ObjectState(const MemoryObject *mo, const Array *array)
 }
 
 ObjectState::ObjectState(const ObjectState &os) 
-  : concreteMask(os.concreteMask ? new BitArray(*os.concreteMask, os.size) : 0),
+  : concreteMask(os.concreteMask ? createBitArray(*os.concreteMask, os.size) : 0),
+    symbolicCount(os.symbolicCount),
     copyOnWriteOwner(0),
     refCount(0),
     object(os.object),
-    concreteStore(new uint8_t[os.size]),
-    flushMask(os.flushMask ? new BitArray(*os.flushMask, os.size) : 0),
+    concreteStore((uint8_t*) allocate(os.size)),
+    flushMask(os.flushMask ? createBitArray(*os.flushMask, os.size) : 0),
     knownSymbolics(0),
     updates(os.updates),
+    compactedUpdates(os.compactedUpdates),
+    externalStore(false),
+    cachedHash(0),
+    hasCachedHash(false),
     size(os.size),
     readOnly(false)
      {
   assert(!os.readOnly && "no need to copy read only object?");
 
+  // Only the chunk table is copied, the chunks are shared until written
   if (os.knownSymbolics) {
-    knownSymbolics = new ref<Expr>[size];
-    for (unsigned i=0; i<size; i++)
+    unsigned count = getSymbolicChunkCount();
+    knownSymbolics = new SymbolicChunk*[count];
+    for (unsigned i=0; i<count; i++) {
       knownSymbolics[i] = os.knownSymbolics[i];
+      if (knownSymbolics[i])
+        ++knownSymbolics[i]->refCount;
+    }
   }
 
   memcpy(concreteStore, os.concreteStore, size*sizeof(*concreteStore));
 }
 
 ObjectState::~ObjectState() {
-  if (concreteMask) delete concreteMask;
-  if (flushMask) delete flushMask;
-  if (knownSymbolics) delete[] knownSymbolics;
-  delete[] concreteStore;
+  if (concreteMask) destroyBitArray(concreteMask);
+  if (flushMask) destroyBitArray(flushMask);
+  releaseKnownSymbolics();
+  if (!externalStore) deallocate(concreteStore);
+}
+
+void ObjectState::releaseKnownSymbolics() {
+  if (!knownSymbolics)
+    return;
+
+  for (unsigned i=0, e=getSymbolicChunkCount(); i<e; i++) {
+    SymbolicChunk *chunk = knownSymbolics[i];
+    if (chunk && --chunk->refCount == 0)
+      delete chunk;
+  }
+  delete[] knownSymbolics;
+  knownSymbolics = 0;
+}
+
+void ObjectState::setExternalConcreteStore(uint8_t *store) {
+  assert(isAllConcrete() && "Cannot replace symbolic data");
+  if (!externalStore) deallocate(concreteStore);
+  concreteStore = store;
+  externalStore = true;
 }
 
 /***/
@@ -214,12 +301,12 @@ const UpdateList &ObjectState::getUpdates() const {
 }
 
 void ObjectState::makeConcrete() {
-  if (concreteMask) delete concreteMask;
-  if (flushMask) delete flushMask;
-  if (knownSymbolics) delete[] knownSymbolics;
+  if (concreteMask) destroyBitArray(concreteMask);
+  if (flushMask) destroyBitArray(flushMask);
+  releaseKnownSymbolics();
   concreteMask = 0;
+  symbolicCount = 0;
   flushMask = 0;
-  knownSymbolics = 0;
 }
 
 void ObjectState::makeSymbolic() {
@@ -255,16 +342,85 @@ isByteConcrete(i) => !isByteKnownSymbolic(i)
 !isByteFlushed(i) => (isByteConcrete(i) || isByteKnownSymbolic(i))
  */
 
+/// Bounds the bytes accessed at a symbolic offset. The caller checked that
+/// the access is in bounds, so only the in-bounds part of the range matters.
 void ObjectState::fastRangeCheckOffset(ref<Expr> offset,
                                        unsigned *base_r,
                                        unsigned *size_r) const {
   *base_r = 0;
   *size_r = size;
+
+  if (!RangeRestrictedReads)
+    return;
+
+  std::pair<uint64_t, uint64_t> range = getConservativeRange(offset);
+  if (range.first > range.second || range.first >= size)
+    return;
+
+  uint64_t last = std::min<uint64_t>(range.second, size - 1);
+  *base_r = range.first;
+  *size_r = last - range.first + 1;
+}
+
+/// Returns a constant array with the bytes [base, base + len) of the
+/// object if they are all concrete. Arrays are shared by all the objects
+/// and states with the same contents, so that the solvers see the same
+/// array in all the queries that read such a table.
+const Array *ObjectState::getConstantTable(unsigned base, unsigned len) const {
+  if (!len || (symbolicCount && !concreteMask->isAllOnes(base, len)))
+    return 0;
+
+  const uint8_t *table = concreteStore + base;
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned i = 0; i != len; ++i)
+    hash = (hash ^ table[i]) * prime;
+
+  // FIXME: Leaked, like the other constant arrays.
+  static std::map<uint64_t, std::vector<const Array*> > tables;
+  std::vector<const Array*> &candidates = tables[hash];
+  for (unsigned i = 0; i != candidates.size(); ++i) {
+    const Array *array = candidates[i];
+    if (array->size != len)
+      continue;
+
+    unsigned j = 0;
+    while (j != len && array->constantValues[j]->getZExtValue(8) == table[j])
+      ++j;
+    if (j == len)
+      return array;
+  }
+
+  std::vector< ref<ConstantExpr> > Contents(len);
+  for (unsigned i = 0; i != len; ++i)
+    Contents[i] = ConstantExpr::create(table[i], Expr::Int8);
+
+  static unsigned id = 0;
+  const Array *array = new Array("table" + llvm::utostr(++id), len,
+                                 &Contents[0], &Contents[0] + len);
+  candidates.push_back(array);
+  return array;
+}
+
+/// Reads len bytes at a symbolic offset from a constant table covering
+/// their feasible range, if that range is concrete. Returns the table and
+/// its offset in the object, or null.
+const Array *ObjectState::getTableForRead(ref<Expr> offset, unsigned len,
+                                          unsigned *base_r) const {
+  if (!RangeRestrictedReads || object->isSharedConcrete)
+    return 0;
+
+  unsigned base, rangeSize;
+  fastRangeCheckOffset(offset, &base, &rangeSize);
+  rangeSize = std::min(rangeSize + len - 1, size - base);
+
+  *base_r = base;
+  return getConstantTable(base, rangeSize);
 }
 
 void ObjectState::flushRangeForRead(unsigned rangeBase, 
                                     unsigned rangeSize) const {
-  if (!flushMask) flushMask = new BitArray(size, true);
+  if (!flushMask) flushMask = createBitArray(size, true);
  
   for (unsigned offset=rangeBase; offset<rangeBase+rangeSize; offset++) {
     if (!isByteFlushed(offset)) {
@@ -274,17 +430,19 @@ void ObjectState::flushRangeForRead(unsigned rangeBase,
       } else {
         assert(isByteKnownSymbolic(offset) && "invalid bit set in flushMask");
         updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       knownSymbolics[offset]);
+                       getKnownSymbolic(offset));
       }
 
       flushMask->unset(offset);
     }
   } 
+
+  compactUpdates();
 }
 
 void ObjectState::flushRangeForWrite(unsigned rangeBase, 
                                      unsigned rangeSize) {
-  if (!flushMask) flushMask = new BitArray(size, true);
+  if (!flushMask) flushMask = createBitArray(size, true);
 
   for (unsigned offset=rangeBase; offset<rangeBase+rangeSize; offset++) {
     if (!isByteFlushed(offset)) {
@@ -295,7 +453,7 @@ void ObjectState::flushRangeForWrite(unsigned rangeBase,
       } else {
         assert(isByteKnownSymbolic(offset) && "invalid bit set in flushMask");
         updates.extend(ConstantExpr::create(offset, Expr::Int32),
-                       knownSymbolics[offset]);
+                       getKnownSymbolic(offset));
         setKnownSymbolic(offset, 0);
       }
 
@@ -310,10 +468,97 @@ void ObjectState::flushRangeForWrite(unsigned rangeBase,
       }
     }
   } 
+
+  compactUpdates();
+}
+
+void ObjectState::compactUpdates() const {
+  // Constant arrays are created lazily by getUpdates(), which folds the
+  // concrete writes itself.
+  if (!CompactUpdatesAfter || !updates.root || !updates.head)
+    return;
+
+  unsigned total = updates.head->getSize();
+  if (total < compactedUpdates + CompactUpdatesAfter)
+    return;
+
+  // Walk from the newest write. A write at a concrete index can never be
+  // read through once a newer one exists at the same index, whatever
+  // symbolic writes lie in between.
+  std::vector<const UpdateNode*> kept;
+  BitArray written(size, false);
+  for (const UpdateNode *un = updates.head; un; un = un->next) {
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(un->index)) {
+      uint64_t index = CE->getZExtValue();
+      if (index < size) {
+        if (written.get(index))
+          continue;
+        written.set(index);
+      }
+    }
+    kept.push_back(un);
+  }
+
+  const Array *root = updates.root;
+  unsigned end = kept.size();
+
+  // Fold the oldest concrete writes into a new constant array
+  if (root->isConstantArray()) {
+    std::vector< ref<ConstantExpr> > Contents(root->constantValues);
+    unsigned folded = end;
+    for (; end != 0; --end) {
+      const UpdateNode *un = kept[end - 1];
+      ConstantExpr *Index = dyn_cast<ConstantExpr>(un->index);
+      ConstantExpr *Value = dyn_cast<ConstantExpr>(un->value);
+      if (!Index || !Value || Index->getZExtValue() >= size)
+        break;
+      Contents[Index->getZExtValue()] = Value;
+    }
+
+    if (end != folded) {
+      // FIXME: Leaked.
+      static unsigned id = 0;
+      root = new Array("compact_arr" + llvm::utostr(++id), size,
+                       &Contents[0], &Contents[0] + Contents.size());
+    }
+  }
+
+  if (end == total) {
+    compactedUpdates = total;
+    return;
+  }
+
+  UpdateList compacted(root, 0);
+  for (unsigned i = end; i != 0; --i)
+    compacted.extend(kept[i - 1]->index, kept[i - 1]->value);
+  updates = compacted;
+  compactedUpdates = end;
 }
 
 bool ObjectState::isAllConcrete() const {
-  return !concreteMask || concreteMask->isAllOnes(size);
+  return !symbolicCount;
+}
+
+uint64_t ObjectState::getMemoryUsage() const {
+  uint64_t res = sizeof(*this);
+
+  if (!externalStore)
+    res += size;
+  if (concreteMask)
+    res += sizeof(BitArray) + BitArray::getStorageSize(size);
+  if (flushMask)
+    res += sizeof(BitArray) + BitArray::getStorageSize(size);
+
+  if (knownSymbolics) {
+    unsigned count = getSymbolicChunkCount();
+    res += count * sizeof(SymbolicChunk*);
+    for (unsigned i = 0; i < count; ++i) {
+      if (knownSymbolics[i])
+        res += sizeof(SymbolicChunk) / knownSymbolics[i]->refCount;
+    }
+  }
+
+  return res;
 }
 
 
@@ -334,17 +579,52 @@ uint8_t *ObjectState::getConcreteStore(bool allowSymbolic)
     return concreteStore;
 }
 
+/// FNV-1a, one 64-bit word at a time while the bytes are concrete
+uint64_t ObjectState::computeHash(unsigned offset, unsigned len) const {
+  assert(offset + len <= size && "hash out of bounds");
+
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const uint8_t *store = concreteStore;
+  unsigned end = offset + len;
+
+  if (!symbolicCount) {
+    for (; offset + 8 <= end; offset += 8) {
+      uint64_t word;
+      memcpy(&word, &store[offset], sizeof(word));
+      hash = (hash ^ word) * prime;
+    }
+    for (; offset < end; ++offset)
+      hash = (hash ^ store[offset]) * prime;
+    return hash;
+  }
+
+  for (; offset < end; ++offset) {
+    if (isByteConcrete(offset)) {
+      hash = (hash ^ store[offset]) * prime;
+    } else {
+      //Keep symbolic bytes apart from concrete ones of the same value
+      hash = (hash ^ 0x100) * prime;
+      hash = (hash ^ read8(offset)->hash()) * prime;
+    }
+  }
+  return hash;
+}
+
 
 void ObjectState::markByteSymbolic(unsigned offset) {
   if (!concreteMask)
-    concreteMask = new BitArray(size, true);
-  concreteMask->unset(offset);
+    concreteMask = createBitArray(size, true);
+  if (concreteMask->get(offset)) {
+    concreteMask->unset(offset);
+    ++symbolicCount;
+  }
 }
 
 
 void ObjectState::markByteFlushed(unsigned offset) {
   if (!flushMask) {
-    flushMask = new BitArray(size, false);
+    flushMask = createBitArray(size, false);
   } else {
     flushMask->unset(offset);
   }
@@ -352,14 +632,28 @@ void ObjectState::markByteFlushed(unsigned offset) {
 
 inline void ObjectState::setKnownSymbolic(unsigned offset,
                                    Expr *value /* can be null */) {
-  if (knownSymbolics) {
-    knownSymbolics[offset] = value;
-  } else {
-    if (value) {
-      knownSymbolics = new ref<Expr>[size];
-      knownSymbolics[offset] = value;
-    }
+  if (!knownSymbolics) {
+    if (!value)
+      return;
+    unsigned count = getSymbolicChunkCount();
+    knownSymbolics = new SymbolicChunk*[count];
+    std::fill(knownSymbolics, knownSymbolics + count, (SymbolicChunk*) 0);
   }
+
+  SymbolicChunk *&chunk = knownSymbolics[offset >> SymbolicChunk::Bits];
+  if (!chunk) {
+    if (!value)
+      return;
+    chunk = new SymbolicChunk();
+  } else if (chunk->refCount > 1) {
+    // Shared with another copy of the object, write to our own copy
+    SymbolicChunk *copy = new SymbolicChunk(*chunk);
+    copy->refCount = 1;
+    --chunk->refCount;
+    chunk = copy;
+  }
+
+  chunk->values[offset & (SymbolicChunk::Size - 1)] = value;
 }
 
 /***/
@@ -369,7 +663,7 @@ ref<Expr> ObjectState::read8(unsigned offset) const {
     if (isByteConcrete(offset)) {
       return ConstantExpr::create(concreteStore[offset], Expr::Int8);
     } else if (isByteKnownSymbolic(offset)) {
-      return knownSymbolics[offset];
+      return getKnownSymbolic(offset);
     } else {
       assert(isByteFlushed(offset) && "unflushed byte without cache value");
     
@@ -386,6 +680,12 @@ ref<Expr> ObjectState::read8(ref<Expr> offset) const {
   assert(!object->isSharedConcrete &&
          "read at non-constant offset for shared concrete object");
   unsigned base, size;
+  if (const Array *table = getTableForRead(offset, 1, &base)) {
+    ref<Expr> index = SubExpr::create(ZExtExpr::create(offset, Expr::Int32),
+                                      ConstantExpr::create(base, Expr::Int32));
+    return ReadExpr::create(UpdateList(table, 0), index);
+  }
+
   fastRangeCheckOffset(offset, &base, &size);
   flushRangeForRead(base, size);
 
@@ -444,6 +744,7 @@ void ObjectState::write8(ref<Expr> offset, ref<Expr> value) {
   }
   
   updates.extend(ZExtExpr::create(offset, Expr::Int32), value);
+  compactUpdates();
 }
 
 /***/
@@ -463,12 +764,26 @@ ref<Expr> ObjectState::read(ref<Expr> offset, Expr::Width width) const {
   // Otherwise, follow the slow general case.
   unsigned NumBytes = width / 8;
   assert(width == NumBytes * 8 && "Invalid write size!");
+
+  // All the bytes come from the same table when their range is concrete
+  unsigned base;
+  const Array *table = 0;
+  if (!object->isSharedConcrete)
+    table = getTableForRead(offset, NumBytes, &base);
+
   ref<Expr> Res(0);
   for (unsigned i = 0; i != NumBytes; ++i) {
     unsigned idx = Context::get().isLittleEndian() ? i : (NumBytes - i - 1);
-    ref<Expr> Byte = read8(AddExpr::create(offset, 
-                                           ConstantExpr::create(idx, 
-                                                                Expr::Int32)));
+    ref<Expr> Byte;
+    if (table) {
+      ref<Expr> index = AddExpr::create(offset,
+                                        ConstantExpr::create(idx - base,
+                                                             Expr::Int32));
+      Byte = ReadExpr::create(UpdateList(table, 0), index);
+    } else {
+      Byte = read8(AddExpr::create(offset,
+                                   ConstantExpr::create(idx, Expr::Int32)));
+    }
     Res = idx ? ConcatExpr::create(Byte, Res) : Byte;
   }
 
@@ -480,9 +795,23 @@ ref<Expr> ObjectState::read(unsigned offset, Expr::Width width) const {
   if (width == Expr::Bool)
     return ExtractExpr::create(read8(offset), 0, Expr::Bool);
 
-  // Otherwise, follow the slow general case.
   unsigned NumBytes = width / 8;
   assert(width == NumBytes * 8 && "Invalid write size!");
+
+  // Fast path: concrete values that fit in 64 bits become a single
+  // constant instead of a chain of folded concats.
+  if (width <= Expr::Int64 && isConcrete(offset, width)) {
+    const uint8_t *store = object->isSharedConcrete ?
+                           (const uint8_t*) object->address : concreteStore;
+    uint64_t value = 0;
+    for (unsigned i = 0; i != NumBytes; ++i) {
+      unsigned idx = Context::get().isLittleEndian() ? i : (NumBytes - i - 1);
+      value |= (uint64_t) store[offset + idx] << (8 * i);
+    }
+    return ConstantExpr::create(value, width);
+  }
+
+  // Otherwise, follow the slow general case.
   ref<Expr> Res(0);
   for (unsigned i = 0; i != NumBytes; ++i) {
     unsigned idx = Context::get().isLittleEndian() ? i : (NumBytes - i - 1);
@@ -10,8 +10,8 @@
 #include "klee/PTree.h"
 
 #include <klee/Expr.h>
-#include <klee/util/ExprPPrinter.h>
 
+#include <sstream>
 #include <vector>
 #include <iostream>
 
@@ -51,6 +51,25 @@ void PTree::remove(Node *n) {
     }
     n = p;
   } while (n && !n->left && !n->right);
+
+  // The nodes above the remaining sibling never branch anymore
+  if (n && !n->data && (!n->left || !n->right)) {
+    Node *child = n->left ? n->left : n->right;
+    assert(n->active == child->active);
+
+    Node *p = n->parent;
+    child->parent = p;
+    if (!p) {
+      root = child;
+    } else if (p->left == n) {
+      p->left = child;
+    } else {
+      assert(p->right == n);
+      p->right = child;
+    }
+    n->left = n->right = 0;
+    delete n;
+  }
 }
 
 #if 1
@@ -88,8 +107,6 @@ void PTree::activate(Node *n) {
 
 void PTree::dump(llvm::raw_ostream &_os) {
   std::stringstream os;
-  ExprPPrinter *pp = ExprPPrinter::create(os);
-  pp->setNewline("\\l");
   os << "digraph G {\n";
   os << "\tsize=\"10,7.5\";\n";
   os << "\tratio=fill;\n";
@@ -102,13 +119,7 @@ void PTree::dump(llvm::raw_ostream &_os) {
   while (!stack.empty()) {
     PTree::Node *n = stack.back();
     stack.pop_back();
-    if (n->condition.isNull()) {
-      os << "\tn" << n << " [label=\"\"";
-    } else {
-      os << "\tn" << n << " [label=\"";
-      pp->print(n->condition);
-      os << "\",shape=diamond";
-    }
+    os << "\tn" << n << " [label=\"\"";
     if (n->data)
       os << ",fillcolor=green";
     os << "];\n";
@@ -123,7 +134,6 @@ void PTree::dump(llvm::raw_ostream &_os) {
   }
   os << "}\n";
   _os << os.str();
-  delete pp;
 }
 
 PTreeNode::PTreeNode(PTreeNode *_parent, 
@@ -132,7 +142,6 @@ PTreeNode::PTreeNode(PTreeNode *_parent,
     left(0),
     right(0),
     data(_data),
-    condition(0),
     active(true)
 {
 }
@@ -140,3 +149,41 @@ PTreeNode::PTreeNode(PTreeNode *_parent,
 PTreeNode::~PTreeNode() {
 }
 
+  /* *** */
+
+namespace {
+  // Free nodes are chained through their first word
+  const unsigned NodesPerChunk = 4096;
+  void *freeNodes = 0;
+  uint64_t nodeCount = 0;
+}
+
+void *PTreeNode::operator new(size_t size) {
+  assert(size == sizeof(PTreeNode));
+  if (!freeNodes) {
+    char *chunk = static_cast<char*>(::operator new(size * NodesPerChunk));
+    for (unsigned i = 0; i < NodesPerChunk; ++i) {
+      void *node = chunk + i * size;
+      *static_cast<void**>(node) = freeNodes;
+      freeNodes = node;
+    }
+  }
+
+  void *node = freeNodes;
+  freeNodes = *static_cast<void**>(node);
+  ++nodeCount;
+  return node;
+}
+
+void PTreeNode::operator delete(void *p) {
+  if (!p)
+    return;
+  *static_cast<void**>(p) = freeNodes;
+  freeNodes = p;
+  --nodeCount;
+}
+
+uint64_t PTree::getNodeCount() {
+  return nodeCount;
+}
+
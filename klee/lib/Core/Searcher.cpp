@@ -180,8 +180,11 @@ double WeightedRandomSearcher::getWeight(ExecutionState *es) {
     double inv = 1. / std::max((uint64_t) 1, count);
     return inv;
   }
-  case QueryCost:
-    return (es->queryCost < .1) ? 1. : 1./es->queryCost;
+  case QueryCost: {
+    // States whose queries keep timing out are unlikely to make progress
+    double cost = es->queryCost * (1 + es->queryTimeouts);
+    return (cost < .1) ? 1. : 1./cost;
+  }
   case CoveringNew:
   case MinDistToUncovered: {
     uint64_t md2u = computeMinDistToUncovered(es->pc,
@@ -159,6 +159,10 @@ void SpecialFunctionHandler::addUHandler(llvm::Function* f, FunctionHandler h)
                 f->getReturnType()->getTypeID() != llvm::Type::VoidTyID);
 }
 
+bool SpecialFunctionHandler::isHandled(const Function *f) const {
+  return handlers.count(f) || uhandlers.count(f);
+}
+
 bool SpecialFunctionHandler::handle(ExecutionState &state, 
                                     Function *f,
                                     KInstruction *target,
@@ -68,6 +68,8 @@ namespace klee {
     /// Add user handler function
     void addUHandler(llvm::Function* f, FunctionHandler handler);
 
+    bool isHandled(const llvm::Function *f) const;
+
     bool handle(ExecutionState &state, 
                 llvm::Function *f,
                 KInstruction *target,
@@ -17,6 +17,7 @@
 #include "klee/Internal/Module/KModule.h"
 #include "klee/Internal/Module/KInstruction.h"
 #include "klee/Internal/Support/ModuleUtil.h"
+#include "klee/Internal/Support/StatsStream.h"
 #include "klee/Internal/System/Time.h"
 
 #include "klee/CallPathManager.h"
@@ -43,6 +44,8 @@
 #include <iostream>
 #include <fstream>
 
+#include <unistd.h>
+
 using namespace klee;
 using namespace llvm;
 
@@ -64,6 +67,11 @@ namespace {
                cl::desc("Write instruction level statistics (in callgrind format)"),
                cl::init(false));
 
+  cl::opt<bool>
+  OutputBinaryStats("output-binary-stats",
+                    cl::desc("Append the stats and the instruction level statistics changes to run.kstats instead of writing run.stats and run.istats (default=false)"),
+                    cl::init(false));
+
   cl::opt<double>
   StatsWriteInterval("stats-write-interval",
                      cl::desc("Approximate number of seconds between stats writes (default: 1.0)"),
@@ -163,10 +171,12 @@ StatsTracker::StatsTracker(Executor &_executor, std::string _objectFilename,
     statsFile(0),
     istatsFile(0),
     startWallTime(util::getWallTime()),
+    statsStream(0),
     numBranches(0),
     fullBranches(0),
     partialBranches(0),
-    updateMinDistToUncovered(_updateMinDistToUncovered) {
+    updateMinDistToUncovered(_updateMinDistToUncovered),
+    coverageChanged(true) {
   KModule *km = executor.kmodule;
 
   sys::Path module(objectFilename);
@@ -202,13 +212,33 @@ StatsTracker::StatsTracker(Executor &_executor, std::string _objectFilename,
       }
     }
   }
+
+  if (updateMinDistToUncovered) {
+    Module *m = km->module;
+    for (Module::iterator fnIt = m->begin(), fn_ie = m->end();
+         fnIt != fn_ie; ++fnIt)
+      trackedFunctions.push_back(fnIt);
+  }
 }
 
 void StatsTracker::writeHeaders()
 {
+  if (OutputBinaryStats) {
+    statsStream = new StatsStreamWriter(
+      executor.interpreterHandler->openOutputFile("run.kstats"));
+
+    StatsRecord info;
+    info.addInt64(getpid());
+    info.addDouble(startWallTime);
+    info.addString(objectFilename);
+    statsStream->write(StatsStreamWriter::Info, info);
+  }
+
   if (OutputStats) {
-    statsFile = executor.interpreterHandler->openOutputFile("run.stats");
-    assert(statsFile && "unable to open statistics trace file");
+    if (!statsStream) {
+      statsFile = executor.interpreterHandler->openOutputFile("run.stats");
+      assert(statsFile && "unable to open statistics trace file");
+    }
     writeStatsHeader();
     writeStatsLine();
 
@@ -219,8 +249,12 @@ void StatsTracker::writeHeaders()
   }
 
   if (OutputIStats) {
-    istatsFile = executor.interpreterHandler->openOutputFile("run.istats");
-    assert(istatsFile && "unable to open istats file");
+    if (statsStream) {
+      writeIStatsEvents();
+    } else {
+      istatsFile = executor.interpreterHandler->openOutputFile("run.istats");
+      assert(istatsFile && "unable to open istats file");
+    }
 
     executor.addTimer(new WriteIStatsTimer(this), IStatsWriteInterval);
   }
@@ -231,10 +265,12 @@ StatsTracker::~StatsTracker() {
     delete statsFile;
   if (istatsFile)
     delete istatsFile;
+  if (statsStream)
+    delete statsStream;
 }
 
 void StatsTracker::done() {
-  if (statsFile)
+  if (statsFile || (statsStream && OutputStats))
     writeStatsLine();
   if (OutputIStats)
     writeIStats();
@@ -283,6 +319,7 @@ void StatsTracker::stepInstruction(ExecutionState &es) {
           es.coveredLines[&ii.file].insert(ii.line);
 	es.coveredNew = true;
         es.instsSinceCovNew = 1;
+        coverageChanged = true;
 	++stats::coveredInstructions;
 	stats::uncoveredInstructions += (uint64_t)-1;
       }
@@ -347,27 +384,42 @@ void StatsTracker::markBranchVisited(ExecutionState *visitedTrue,
   }
 }
 
+void StatsTracker::getStatsRow(StatsRow &row) {
+  row.addCounter("Instructions", stats::instructions);
+  row.addGauge("FullBranches", fullBranches);
+  row.addGauge("PartialBranches", partialBranches);
+  row.addGauge("NumBranches", numBranches);
+  row.addTime("UserTime", util::getUserTime());
+  row.addGauge("NumStates", executor.states.size());
+  row.addGauge("MemoryUsage", sys::Process::GetTotalMemoryUsage());
+  row.addCounter("NumQueries", stats::queries);
+  row.addCounter("NumQueryConstructs", stats::queryConstructs);
+  row.addGauge("NumObjects", 0); // was numObjects
+  row.addTime("WallTime", elapsed());
+  row.addCounter("CoveredInstructions", stats::coveredInstructions);
+  row.addGauge("UncoveredInstructions", stats::uncoveredInstructions);
+  row.addTime("QueryTime", stats::queryTime / 1000000.);
+  row.addTime("SolverTime", stats::solverTime / 1000000.);
+  row.addTime("CexCacheTime", stats::cexCacheTime / 1000000.);
+  row.addTime("ForkTime", stats::forkTime / 1000000.);
+  row.addTime("ResolveTime", stats::resolveTime / 1000000.);
+}
+
 void StatsTracker::writeStatsHeader() {
-  *statsFile << "('Instructions',"
-             << "'FullBranches',"
-             << "'PartialBranches',"
-             << "'NumBranches',"
-             << "'UserTime',"
-             << "'NumStates',"
-             << "'MemoryUsage',"
-             << "'NumQueries',"
-             << "'NumQueryConstructs',"
-             << "'NumObjects',"
-             << "'WallTime',"
-             << "'CoveredInstructions',"
-             << "'UncoveredInstructions',"
-             << "'QueryTime',"
-             << "'SolverTime',"
-             << "'CexCacheTime',"
-             << "'ForkTime',"
-             << "'ResolveTime',"
-             << ")\n";
-  statsFile->flush();
+  StatsRow row;
+  getStatsRow(row);
+
+  if (statsFile) {
+    row.writeTextHeader(*statsFile);
+    statsFile->flush();
+  }
+
+  if (statsStream) {
+    StatsRecord columns;
+    row.getColumns(columns);
+    statsStream->write(StatsStreamWriter::Columns, columns);
+    statsStream->flush();
+  }
 }
 
 double StatsTracker::elapsed() {
@@ -375,30 +427,24 @@ double StatsTracker::elapsed() {
 }
 
 void StatsTracker::writeStatsLine() {
-  *statsFile << "(" << stats::instructions
-             << "," << fullBranches
-             << "," << partialBranches
-             << "," << numBranches
-             << "," << util::getUserTime()
-             << "," << executor.states.size()
-             << "," << sys::Process::GetTotalMemoryUsage()
-             << "," << stats::queries
-             << "," << stats::queryConstructs
-             << "," << 0 // was numObjects
-             << "," << elapsed()
-             << "," << stats::coveredInstructions
-             << "," << stats::uncoveredInstructions
-             << "," << stats::queryTime / 1000000.
-             << "," << stats::solverTime / 1000000.
-             << "," << stats::cexCacheTime / 1000000.
-             << "," << stats::forkTime / 1000000.
-             << "," << stats::resolveTime / 1000000.
-             << ")\n";
-  statsFile->flush();
+  StatsRow row;
+  getStatsRow(row);
+
+  if (statsFile) {
+    row.writeTextLine(*statsFile);
+    statsFile->flush();
+  }
+
+  if (statsStream) {
+    StatsRecord values;
+    row.getValues(values);
+    statsStream->write(StatsStreamWriter::Row, values);
+    statsStream->flush();
+  }
 }
 
 void StatsTracker::updateStateStatistics(uint64_t addend) {
-  for (std::set<ExecutionState*>::iterator it = executor.states.begin(),
+  for (StateSet::iterator it = executor.states.begin(),
          ie = executor.states.end(); it != ie; ++it) {
     ExecutionState &state = **it;
     const InstructionInfo &ii = *state.pc->info;
@@ -408,23 +454,9 @@ void StatsTracker::updateStateStatistics(uint64_t addend) {
   }
 }
 
-void StatsTracker::writeIStats() {
-  Module *m = executor.kmodule->module;
+/// The statistics written per instruction
+static uint64_t getIStatsMask(StatisticManager &sm) {
   uint64_t istatsMask = 0;
-  llvm::raw_ostream &of = *istatsFile;
-
-  /*of.seekp(0, std::ios::end);
-  unsigned istatsSize = of.tellp();
-  of.seekp(0);*/
-
-  of << "version: 1\n";
-  of << "creator: klee\n";
-  of << "pid: " << sys::Process::GetCurrentUserId() << "\n";
-  of << "cmd: " << m->getModuleIdentifier() << "\n\n";
-  of << "\n";
-  
-  StatisticManager &sm = *theStatisticManager;
-  unsigned nStats = sm.getNumStatistics();
 
   // Max is 13, sadly
   istatsMask |= 1<<sm.getStatisticID("Queries");
@@ -441,6 +473,32 @@ void StatsTracker::writeIStats() {
   istatsMask |= 1<<sm.getStatisticID("States");
   istatsMask |= 1<<sm.getStatisticID("MinDistToUncovered");
 
+  return istatsMask;
+}
+
+void StatsTracker::writeIStats() {
+  if (statsStream) {
+    writeIStatsDeltas();
+    return;
+  }
+
+  Module *m = executor.kmodule->module;
+  llvm::raw_ostream &of = *istatsFile;
+
+  /*of.seekp(0, std::ios::end);
+  unsigned istatsSize = of.tellp();
+  of.seekp(0);*/
+
+  of << "version: 1\n";
+  of << "creator: klee\n";
+  of << "pid: " << sys::Process::GetCurrentUserId() << "\n";
+  of << "cmd: " << m->getModuleIdentifier() << "\n\n";
+  of << "\n";
+  
+  StatisticManager &sm = *theStatisticManager;
+  unsigned nStats = sm.getNumStatistics();
+  uint64_t istatsMask = getIStatsMask(sm);
+
   of << "positions: instr line\n";
 
   for (unsigned i=0; i<nStats; i++) {
@@ -550,6 +608,89 @@ void StatsTracker::writeIStats() {
   of.flush();
 }
 
+void StatsTracker::writeIStatsEvents() {
+  StatisticManager &sm = *theStatisticManager;
+  uint64_t istatsMask = getIStatsMask(sm);
+
+  StatsRecord events;
+  for (unsigned i=0; i<sm.getNumStatistics(); i++)
+    if (istatsMask & (1<<i))
+      events.addString(sm.getStatistic(i).getName());
+  statsStream->write(StatsStreamWriter::IStatsEvents, events);
+  statsStream->flush();
+}
+
+/// Append the instruction statistics that changed since the last call.
+/// Unlike writeIStats(), nothing is formatted and the cost of a write
+/// only depends on the number of instructions that executed in between.
+/// The call site summaries of run.istats are not part of the stream.
+void StatsTracker::writeIStatsDeltas() {
+  Module *m = executor.kmodule->module;
+  StatisticManager &sm = *theStatisticManager;
+  unsigned nStats = sm.getNumStatistics();
+  uint64_t istatsMask = getIStatsMask(sm);
+
+  std::vector<unsigned> events;
+  for (unsigned i=0; i<nStats; i++)
+    if (istatsMask & (1<<i))
+      events.push_back(i);
+
+  if (istatsMask & (1<<stats::states.getID()))
+    updateStateStatistics(1);
+
+  StatsRecord locations, deltas;
+  deltas.addDouble(elapsed());
+
+  for (Module::iterator fnIt = m->begin(), fn_ie = m->end();
+       fnIt != fn_ie; ++fnIt) {
+    if (fnIt->isDeclaration())
+      continue;
+
+    for (Function::iterator bbIt = fnIt->begin(), bb_ie = fnIt->end();
+         bbIt != bb_ie; ++bbIt) {
+      for (BasicBlock::iterator it = bbIt->begin(), ie = bbIt->end();
+           it != ie; ++it) {
+        const InstructionInfo &ii = executor.kmodule->infos->getInfo(&*it);
+        unsigned index = ii.id;
+
+        if (index >= istatsDescribed.size()) {
+          istatsDescribed.resize(index + 1, false);
+          istatsSnapshot.resize((index + 1) * events.size(), 0);
+        }
+
+        for (unsigned e=0; e<events.size(); e++) {
+          uint64_t value = sm.getIndexedValue(sm.getStatistic(events[e]), index);
+          uint64_t &last = istatsSnapshot[index * events.size() + e];
+          if (value == last)
+            continue;
+
+          if (!istatsDescribed[index]) {
+            locations.addInt32(index);
+            locations.addInt32(ii.line);
+            locations.addInt32(ii.assemblyLine);
+            locations.addString(fnIt->getName().str());
+            locations.addString(ii.file);
+            istatsDescribed[index] = true;
+          }
+
+          deltas.addInt32(index);
+          deltas.addInt32(e);
+          deltas.addInt64(value - last);
+          last = value;
+        }
+      }
+    }
+  }
+
+  if (istatsMask & (1<<stats::states.getID()))
+    updateStateStatistics((uint64_t)-1);
+
+  if (!locations.empty())
+    statsStream->write(StatsStreamWriter::IStatsLocations, locations);
+  statsStream->write(StatsStreamWriter::IStatsDeltas, deltas);
+  statsStream->flush();
+}
+
 ///
 
 typedef std::map<Instruction*, std::vector<Function*> > calltargets_ty;
@@ -596,7 +737,6 @@ uint64_t klee::computeMinDistToUncovered(const KInstruction *ki,
 
 void StatsTracker::computeReachableUncovered() {
   KModule *km = executor.kmodule;
-  Module *m = km->module;
   static bool init = true;
   const InstructionInfoTable &infos = *km->infos;
   StatisticManager &sm = *theStatisticManager;
@@ -604,12 +744,21 @@ void StatsTracker::computeReachableUncovered() {
   if (init) {
     init = false;
 
+    // Only the tracked functions can be indirect call targets
+    std::set<Function*> tracked(trackedFunctions.begin(),
+                                trackedFunctions.end());
+    std::vector<Function*> escaping;
+    for (std::set<Function*>::iterator it = km->escapingFunctions.begin(),
+           ie = km->escapingFunctions.end(); it != ie; ++it)
+      if (tracked.count(*it))
+        escaping.push_back(*it);
+
     // Compute call targets. It would be nice to use alias information
     // instead of assuming all indirect calls hit all escaping
     // functions, eh?
-    for (Module::iterator fnIt = m->begin(), fn_ie = m->end(); 
-         fnIt != fn_ie; ++fnIt) {
-      for (Function::iterator bbIt = fnIt->begin(), bb_ie = fnIt->end(); 
+    for (std::vector<Function*>::iterator fnIt = trackedFunctions.begin(),
+           fn_ie = trackedFunctions.end(); fnIt != fn_ie; ++fnIt) {
+      for (Function::iterator bbIt = (*fnIt)->begin(), bb_ie = (*fnIt)->end(); 
            bbIt != bb_ie; ++bbIt) {
         for (BasicBlock::iterator it = bbIt->begin(), ie = bbIt->end(); 
              it != ie; ++it) {
@@ -622,9 +771,7 @@ void StatsTracker::computeReachableUncovered() {
             } else if (Function *target = getDirectCallTarget(it)) {
               callTargets[it].push_back(target);
             } else {
-              callTargets[it] = 
-                std::vector<Function*>(km->escapingFunctions.begin(),
-                                       km->escapingFunctions.end());
+              callTargets[it] = escaping;
             }
           }
         }
@@ -640,21 +787,22 @@ void StatsTracker::computeReachableUncovered() {
 
     // Initialize minDistToReturn to shortest paths through
     // functions. 0 is unreachable.
-    std::vector<Instruction *> instructions;
-    for (Module::iterator fnIt = m->begin(), fn_ie = m->end(); 
-         fnIt != fn_ie; ++fnIt) {
-      if (fnIt->isDeclaration()) {
-        if (fnIt->doesNotReturn()) {
-          functionShortestPath[fnIt] = 0;
+    std::vector<Instruction *> &instructions = trackedInstructions;
+    for (std::vector<Function*>::iterator fnIt = trackedFunctions.begin(),
+           fn_ie = trackedFunctions.end(); fnIt != fn_ie; ++fnIt) {
+      Function *fn = *fnIt;
+      if (fn->isDeclaration()) {
+        if (fn->doesNotReturn()) {
+          functionShortestPath[fn] = 0;
         } else {
-          functionShortestPath[fnIt] = 1; // whatever
+          functionShortestPath[fn] = 1; // whatever
         }
       } else {
-        functionShortestPath[fnIt] = 0;
+        functionShortestPath[fn] = 0;
       }
 
       // Not sure if I should bother to preorder here. XXX I should.
-      for (Function::iterator bbIt = fnIt->begin(), bb_ie = fnIt->end(); 
+      for (Function::iterator bbIt = fn->begin(), bb_ie = fn->end(); 
            bbIt != bb_ie; ++bbIt) {
         for (BasicBlock::iterator it = bbIt->begin(), ie = bbIt->end(); 
              it != ie; ++it) {
@@ -721,86 +869,82 @@ void StatsTracker::computeReachableUncovered() {
     } while (changed);
   }
 
-  // compute minDistToUncovered, 0 is unreachable
-  std::vector<Instruction *> instructions;
-  for (Module::iterator fnIt = m->begin(), fn_ie = m->end(); 
-       fnIt != fn_ie; ++fnIt) {
-    // Not sure if I should bother to preorder here.
-    for (Function::iterator bbIt = fnIt->begin(), bb_ie = fnIt->end(); 
-         bbIt != bb_ie; ++bbIt) {
-      for (BasicBlock::iterator it = bbIt->begin(), ie = bbIt->end(); 
-           it != ie; ++it) {
-        unsigned id = infos.getInfo(it).id;
-        instructions.push_back(&*it);
-        sm.setIndexedValue(stats::minDistToUncovered, 
-                           id, 
-                           sm.getIndexedValue(stats::uncoveredInstructions, id));
-      }
-    }
-  }
-  
-  std::reverse(instructions.begin(), instructions.end());
-  
-  // I'm so lazy it's not even worklisted.
-  bool changed;
-  do {
-    changed = false;
+  // compute minDistToUncovered, 0 is unreachable. The distances only
+  // depend on the covered instructions, skip the fixpoint if none got
+  // covered since the last time.
+  if (coverageChanged) {
+    coverageChanged = false;
+
+    std::vector<Instruction *> &instructions = trackedInstructions;
     for (std::vector<Instruction*>::iterator it = instructions.begin(),
            ie = instructions.end(); it != ie; ++it) {
-      Instruction *inst = *it;
-      uint64_t best, cur = best = sm.getIndexedValue(stats::minDistToUncovered, 
-                                                     infos.getInfo(inst).id);
-      unsigned bestThrough = 0;
+      unsigned id = infos.getInfo(*it).id;
+      sm.setIndexedValue(stats::minDistToUncovered, 
+                         id, 
+                         sm.getIndexedValue(stats::uncoveredInstructions, id));
+    }
+  
+    // I'm so lazy it's not even worklisted.
+    bool changed;
+    do {
+      changed = false;
+      for (std::vector<Instruction*>::iterator it = instructions.begin(),
+             ie = instructions.end(); it != ie; ++it) {
+        Instruction *inst = *it;
+        uint64_t best, cur = best = sm.getIndexedValue(stats::minDistToUncovered, 
+                                                       infos.getInfo(inst).id);
+        unsigned bestThrough = 0;
       
-      if (isa<CallInst>(inst) || isa<InvokeInst>(inst)) {
-        std::vector<Function*> &targets = callTargets[inst];
-        for (std::vector<Function*>::iterator fnIt = targets.begin(),
-               ie = targets.end(); fnIt != ie; ++fnIt) {
-          uint64_t dist = functionShortestPath[*fnIt];
-          if (dist) {
-            dist = 1+dist; // count instruction itself
-            if (bestThrough==0 || dist<bestThrough)
-              bestThrough = dist;
-          }
+        if (isa<CallInst>(inst) || isa<InvokeInst>(inst)) {
+          std::vector<Function*> &targets = callTargets[inst];
+          for (std::vector<Function*>::iterator fnIt = targets.begin(),
+                 ie = targets.end(); fnIt != ie; ++fnIt) {
+            uint64_t dist = functionShortestPath[*fnIt];
+            if (dist) {
+              dist = 1+dist; // count instruction itself
+              if (bestThrough==0 || dist<bestThrough)
+                bestThrough = dist;
+            }
 
-          if (!(*fnIt)->isDeclaration()) {
-            uint64_t calleeDist = sm.getIndexedValue(stats::minDistToUncovered,
-                                                     infos.getFunctionInfo(*fnIt).id);
-            if (calleeDist) {
-              calleeDist = 1+calleeDist; // count instruction itself
-              if (best==0 || calleeDist<best)
-                best = calleeDist;
+            if (!(*fnIt)->isDeclaration()) {
+              uint64_t calleeDist = sm.getIndexedValue(stats::minDistToUncovered,
+                                                       infos.getFunctionInfo(*fnIt).id);
+              if (calleeDist) {
+                calleeDist = 1+calleeDist; // count instruction itself
+                if (best==0 || calleeDist<best)
+                  best = calleeDist;
+              }
             }
           }
+        } else {
+          bestThrough = 1;
         }
-      } else {
-        bestThrough = 1;
-      }
       
-      if (bestThrough) {
-        std::vector<Instruction*> succs = getSuccs(inst);
-        for (std::vector<Instruction*>::iterator it2 = succs.begin(),
-               ie = succs.end(); it2 != ie; ++it2) {
-          uint64_t dist = sm.getIndexedValue(stats::minDistToUncovered,
-                                             infos.getInfo(*it2).id);
-          if (dist) {
-            uint64_t val = bestThrough + dist;
-            if (best==0 || val<best)
-              best = val;
+        if (bestThrough) {
+          std::vector<Instruction*> succs = getSuccs(inst);
+          for (std::vector<Instruction*>::iterator it2 = succs.begin(),
+                 ie = succs.end(); it2 != ie; ++it2) {
+            uint64_t dist = sm.getIndexedValue(stats::minDistToUncovered,
+                                               infos.getInfo(*it2).id);
+            if (dist) {
+              uint64_t val = bestThrough + dist;
+              if (best==0 || val<best)
+                best = val;
+            }
           }
         }
-      }
 
-      if (best != cur) {
-        sm.setIndexedValue(stats::minDistToUncovered, 
-                           infos.getInfo(inst).id, 
-                           best);
-        changed = true;
+        if (best != cur) {
+          sm.setIndexedValue(stats::minDistToUncovered, 
+                             infos.getInfo(inst).id, 
+                             best);
+          changed = true;
+        }
       }
-    }
-  } while (changed);
+    } while (changed);
+  }
 
-  for (std::set<ExecutionState*>::iterator it = executor.states.begin(),
+  for (StateSet::iterator it = executor.states.begin(),
          ie = executor.states.end(); it != ie; ++it) {
     ExecutionState *es = *it;
     uint64_t currentFrameMinDist = 0;
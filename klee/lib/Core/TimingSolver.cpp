@@ -15,14 +15,46 @@
 #include "klee/Statistics.h"
 
 #include "klee/CoreStats.h"
+#include "klee/Internal/Support/PerfCounters.h"
+#include "klee/util/Assignment.h"
 
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Process.h"
 
 using namespace klee;
 using namespace llvm;
 
+namespace {
+  cl::opt<bool>
+  FastIndependentValues("fast-independent-values",
+                        cl::desc("Concretize expressions that share no symbolic bytes with the path constraints without calling the solver (default=on)"),
+                        cl::init(true));
+}
+
 /***/
 
+/// The concolic values of a state satisfy its path constraints and make a
+/// good starting point for the solvers that search for a model.
+static const Assignment *getSeed(const ExecutionState &state) {
+  return state.concolics.bindings.empty() ? 0 : &state.concolics;
+}
+
+/// Charges the state with the solver timeouts of its queries, so that the
+/// searchers can demote the states that keep producing unsolvable queries.
+class QueryTimeoutCounter {
+  const ExecutionState &state;
+  STPSolver *solver;
+  unsigned count;
+
+public:
+  QueryTimeoutCounter(const ExecutionState &_state, STPSolver *_solver)
+    : state(_state), solver(_solver), count(_solver->getTimeoutCount()) {}
+
+  ~QueryTimeoutCounter() {
+    state.queryTimeouts += solver->getTimeoutCount() - count;
+  }
+};
+
 bool TimingSolver::evaluate(const ExecutionState& state, ref<Expr> expr,
                             Solver::Validity &result) {
 
@@ -32,18 +64,21 @@ bool TimingSolver::evaluate(const ExecutionState& state, ref<Expr> expr,
     return true;
   }
 
+  PerfCounterRegion perfRegion(PerfCounters::Solver);
+  QueryTimeoutCounter timeoutCounter(state, stpSolver);
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
   if (simplifyExprs)
     expr = state.constraints.simplifyExpr(expr);
 
-  bool success = solver->evaluate(Query(state.constraints, expr), result);
+  Query query(state.constraints, expr, getSeed(state));
+  bool success = solver->evaluate(query, result);
 
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
   stats::solverTime += delta.usec();
-  state.queryCost += delta.usec()/1000000.;
+  state.addQueryCost(delta.seconds() * 1000000 + delta.usec());
 
   return success;
 }
@@ -56,18 +91,21 @@ bool TimingSolver::mustBeTrue(const ExecutionState& state, ref<Expr> expr,
     return true;
   }
 
+  PerfCounterRegion perfRegion(PerfCounters::Solver);
+  QueryTimeoutCounter timeoutCounter(state, stpSolver);
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
   if (simplifyExprs)
     expr = state.constraints.simplifyExpr(expr);
 
-  bool success = solver->mustBeTrue(Query(state.constraints, expr), result);
+  Query query(state.constraints, expr, getSeed(state));
+  bool success = solver->mustBeTrue(query, result);
 
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
   stats::solverTime += delta.usec();
-  state.queryCost += delta.usec()/1000000.;
+  state.addQueryCost(delta.seconds() * 1000000 + delta.usec());
 
   return success;
 }
@@ -95,6 +133,33 @@ bool TimingSolver::mayBeFalse(const ExecutionState& state, ref<Expr> expr,
   return true;
 }
 
+bool TimingSolver::mayBeTrue(const ExecutionState& state,
+                             const std::vector< ref<Expr> > &conditions,
+                             std::vector<bool> &results) {
+  PerfCounterRegion perfRegion(PerfCounters::Solver);
+  QueryTimeoutCounter timeoutCounter(state, stpSolver);
+  sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
+  sys::Process::GetTimeUsage(now,user,sys);
+
+  std::vector< ref<Expr> > exprs(conditions);
+  if (simplifyExprs) {
+    for (unsigned i = 0; i != exprs.size(); ++i)
+      exprs[i] = state.constraints.simplifyExpr(exprs[i]);
+  }
+
+  bool success = solver->mayBeTrue(Query(state.constraints,
+                                         ConstantExpr::alloc(0, Expr::Bool),
+                                         getSeed(state)),
+                                   exprs, results);
+
+  sys::Process::GetTimeUsage(delta,user,sys);
+  delta -= now;
+  stats::solverTime += delta.usec();
+  state.addQueryCost(delta.seconds() * 1000000 + delta.usec());
+
+  return success;
+}
+
 bool TimingSolver::getValue(const ExecutionState& state, ref<Expr> expr, 
                             ref<ConstantExpr> &result) {
 
@@ -103,19 +168,34 @@ bool TimingSolver::getValue(const ExecutionState& state, ref<Expr> expr,
     result = CE;
     return true;
   }
-  
-  sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
-  sys::Process::GetTimeUsage(now,user,sys);
 
   if (simplifyExprs)
     expr = state.constraints.simplifyExpr(expr);
 
-  bool success = solver->getValue(Query(state.constraints, expr), result);
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(expr)) {
+    result = CE;
+    return true;
+  }
+
+  // The bytes read by expr are unconstrained, so any value they take is
+  // feasible. Set them all to zero.
+  if (FastIndependentValues && state.constraints.isIndependent(expr)) {
+    result = cast<ConstantExpr>(Assignment().evaluate(expr));
+    return true;
+  }
+
+  PerfCounterRegion perfRegion(PerfCounters::Solver);
+  QueryTimeoutCounter timeoutCounter(state, stpSolver);
+  sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
+  sys::Process::GetTimeUsage(now,user,sys);
+
+  Query query(state.constraints, expr, getSeed(state));
+  bool success = solver->getValue(query, result);
 
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
   stats::solverTime += delta.usec();
-  state.queryCost += delta.usec()/1000000.;
+  state.addQueryCost(delta.seconds() * 1000000 + delta.usec());
 
   return success;
 }
@@ -129,22 +209,25 @@ TimingSolver::getInitialValues(const ExecutionState& state,
   if (objects.empty())
     return true;
 
+  PerfCounterRegion perfRegion(PerfCounters::Solver);
+  QueryTimeoutCounter timeoutCounter(state, stpSolver);
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
   bool success = solver->getInitialValues(Query(state.constraints,
-                                                ConstantExpr::alloc(0, Expr::Bool)), 
+                                                ConstantExpr::alloc(0, Expr::Bool),
+                                                getSeed(state)),
                                           objects, result);
   
   sys::Process::GetTimeUsage(delta,user,sys);
   delta -= now;
   stats::solverTime += delta.usec();
-  state.queryCost += delta.usec()/1000000.;
+  state.addQueryCost(delta.seconds() * 1000000 + delta.usec());
   
   return success;
 }
 
 std::pair< ref<Expr>, ref<Expr> >
 TimingSolver::getRange(const ExecutionState& state, ref<Expr> expr) {
-  return solver->getRange(Query(state.constraints, expr));
+  return solver->getRange(Query(state.constraints, expr, getSeed(state)));
 }
@@ -55,6 +55,12 @@ namespace klee {
 
     bool mayBeFalse(const ExecutionState&, ref<Expr>, bool &result);
 
+    /// mayBeTrue - Feasibility of several (preferably mutually exclusive)
+    /// conditions, see Solver::mayBeTrue.
+    bool mayBeTrue(const ExecutionState&,
+                   const std::vector< ref<Expr> > &conditions,
+                   std::vector<bool> &results);
+
     bool getValue(const ExecutionState &, ref<Expr> expr, 
                   ref<ConstantExpr> &result);
 
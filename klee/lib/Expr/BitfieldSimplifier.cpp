@@ -56,6 +56,16 @@ namespace {
     cl::opt<bool>
     PrintSimplifier("print-expr-simplifier",
                 cl::init(false));
+
+    cl::opt<unsigned>
+    SimplifierCacheSize("expr-simplifier-cache-size",
+                cl::desc("Flush the simplifier caches when they hold more than this many expressions (0 = unbounded)"),
+                cl::init(0));
+
+    cl::opt<bool>
+    SimplifierFlagRules("expr-simplifier-flag-rules",
+                cl::desc("Rewrite x86 flag tests into comparisons of the flag conditions"),
+                cl::init(false));
 }
 
 ref<Expr> BitfieldSimplifier::replaceWithConstant(ref<Expr> e, uint64_t value)
@@ -75,6 +85,64 @@ ref<Expr> BitfieldSimplifier::replaceWithConstant(ref<Expr> e, uint64_t value)
     return ConstantExpr::create(value & ~zeroMask(e->getWidth()), e->getWidth());
 }
 
+ref<Expr> BitfieldSimplifier::rewriteFlags(ref<Expr> e)
+{
+    /* The lazy flags helpers build eflags as an or of shifted condition
+       bits. After the bits that a test does not look at are removed, the
+       test is left as extract((zext(c) << k), k) or ((zext(c) << k) == 0),
+       which we turn back into c or !c. */
+    switch(e->getKind()) {
+    case Expr::Extract: {
+        ExtractExpr *ee = cast<ExtractExpr>(e);
+        ref<Expr> src = ee->expr;
+
+        if(ZExtExpr *ze = dyn_cast<ZExtExpr>(src)) {
+            // extract(zext(x)) that only covers bits of x
+            if(ee->offset + ee->width <= ze->src->getWidth())
+                return rewriteFlags(ExtractExpr::create(ze->src,
+                                                ee->offset, ee->width));
+        } else if(src->getKind() == Expr::Shl) {
+            // extract(x << c) above the shifted-in zeros
+            ConstantExpr *c = dyn_cast<ConstantExpr>(src->getKid(1));
+            if(c && c->getZExtValue() <= ee->offset)
+                return rewriteFlags(ExtractExpr::create(src->getKid(0),
+                                ee->offset - c->getZExtValue(), ee->width));
+        }
+        break;
+    }
+
+    case Expr::Eq: {
+        EqExpr *eq = cast<EqExpr>(e);
+        ConstantExpr *c = dyn_cast<ConstantExpr>(eq->left);
+        if(!c || !c->isZero())
+            break;
+
+        ref<Expr> r = eq->right;
+        Expr::Width width = r->getWidth();
+
+        if(r->getKind() == Expr::Or) {
+            // (a | b) == 0  =>  a == 0 && b == 0
+            return AndExpr::create(
+                    rewriteFlags(Expr::createIsZero(r->getKid(0))),
+                    rewriteFlags(Expr::createIsZero(r->getKid(1))));
+        } else if(r->getKind() == Expr::Shl) {
+            // (x << c) == 0  =>  extract(x, 0, width - c) == 0
+            ConstantExpr *sh = dyn_cast<ConstantExpr>(r->getKid(1));
+            if(sh && sh->getZExtValue() < width)
+                return rewriteFlags(Expr::createIsZero(rewriteFlags(
+                        ExtractExpr::create(r->getKid(0), 0,
+                                            width - sh->getZExtValue()))));
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return e;
+}
+
 BitfieldSimplifier::ExprBitsInfo BitfieldSimplifier::doSimplifyBits(
                                     ref<Expr> e, uint64_t ignoredBits)
 {
@@ -348,7 +416,37 @@ BitfieldSimplifier::ExprBitsInfo BitfieldSimplifier::doSimplifyBits(
 
             } else if(bits[i].ignoredBits & ~oldIgnoredBits[i]) {
                 /* We have new information about ignoredBits */
-                kids[i] = doSimplifyBits(kids[i], bits[i].ignoredBits).first;
+                ExprBitsInfo r = doSimplifyBits(kids[i], bits[i].ignoredBits);
+                if(SimplifierFlagRules && r.first != kids[i]) {
+                    /* Known bits of the new kid itself, r.second only
+                       holds outside of the ignored bits */
+                    r = doSimplifyBits(r.first, 0);
+                    bits[i].knownOneBits = r.second.knownOneBits;
+                    bits[i].knownZeroBits = r.second.knownZeroBits;
+                }
+                kids[i] = r.first;
+            }
+        }
+
+        /* Once the other kid is simplified, a constant mask may keep all
+           the bits it can set, as in eflags & 0x40 where only ZF is left */
+        if(SimplifierFlagRules && (e->getKind() == Expr::And ||
+                                   e->getKind() == Expr::Or)) {
+            uint64_t mask = ~zeroMask(e->getWidth()) & ~ignoredBits;
+            for(unsigned i = 0; i < 2; ++i) {
+                ConstantExpr *c = dyn_cast<ConstantExpr>(kids[i]);
+                if(!c || isa<ConstantExpr>(kids[1-i]))
+                    continue;
+
+                uint64_t value = c->getZExtValue();
+                if(e->getKind() == Expr::And &&
+                        (~bits[1-i].knownZeroBits & mask & ~value) == 0) {
+                    kids[i] = ConstantExpr::create(~zeroMask(e->getWidth()),
+                                                   e->getWidth());
+                } else if(e->getKind() == Expr::Or &&
+                        (value & mask & ~bits[1-i].knownOneBits) == 0) {
+                    kids[i] = ConstantExpr::create(0, e->getWidth());
+                }
             }
         }
 
@@ -360,8 +458,17 @@ BitfieldSimplifier::ExprBitsInfo BitfieldSimplifier::doSimplifyBits(
                 break;
             }
         }
+
+        // The rewrites keep the value of e, so rbits still holds
+        if(SimplifierFlagRules)
+            e = rewriteFlags(e);
     }
 
+    /* e may now differ from the original expression in the ignored bits,
+       what we know about them only held for the original */
+    rbits.knownOneBits &= ~ignoredBits;
+    rbits.knownZeroBits &= ~ignoredBits | zeroMask(e->getWidth());
+
     /* Cache knownBits information, but only for complex expressions */
     if(e->getNumKids() > 1)
         m_bitsInfoCache.insert(std::make_pair(e, rbits));
@@ -379,14 +486,27 @@ ref<Expr> BitfieldSimplifier::simplify(ref<Expr> e, uint64_t *knownZeroBits)
         return e;
     }
 
-    ExprBitsInfo ret = doSimplifyBits(e, 0);
+    /* doSimplifyBits caches its results under the simplified
+       expressions, so look up the original one first */
+    ExprHashMap<SimplifiedExpr>::iterator it = m_simplifiedCache.find(e);
+    if (it == m_simplifiedCache.end()) {
+        if (SimplifierCacheSize && m_bitsInfoCache.size() +
+                m_simplifiedCache.size() > SimplifierCacheSize) {
+            m_bitsInfoCache.clear();
+            m_simplifiedCache.clear();
+        }
+
+        ExprBitsInfo ret = doSimplifyBits(e, 0);
+        it = m_simplifiedCache.insert(std::make_pair(e,
+                SimplifiedExpr(ret.first, ret.second.knownZeroBits))).first;
+    }
 
     if (PrintSimplifier && !cste && klee_message_stream)
-        *klee_message_stream << "AFTER  SIMPL: " << ret.first << '\n';
+        *klee_message_stream << "AFTER  SIMPL: " << it->second.first << '\n';
 
     if (knownZeroBits) {
-        *knownZeroBits = ret.second.knownZeroBits;
+        *knownZeroBits = it->second.second;
     }
 
-    return ret.first;
+    return it->second.first;
 }
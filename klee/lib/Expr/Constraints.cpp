@@ -10,13 +10,230 @@
 #include "klee/Constraints.h"
 
 #include "klee/util/ExprPPrinter.h"
+#include "klee/util/ExprUtil.h"
 #include "klee/util/ExprVisitor.h"
 
 #include <iostream>
 #include <map>
+#include <set>
 
 using namespace klee;
 
+namespace klee {
+
+/// Union-find of the constraints of a ConstraintManager. Nodes stand
+/// for the bytes of the arrays read by the constraints, plus one node
+/// per array that is reused for all its bytes once the array is read
+/// at a symbolic index. Two constraints are in the same group iff the
+/// independence closure of IndependentSolver would relate them.
+class ConstraintPartition {
+public:
+  static const unsigned NoNode = ~0u;
+
+  unsigned refCount;
+
+  /// Node of each constraint, NoNode if it reads no symbolic bytes
+  std::vector<unsigned> constraintNodes;
+
+  ConstraintPartition() : refCount(1) {}
+  ConstraintPartition(const ConstraintPartition &p) :
+    refCount(1), constraintNodes(p.constraintNodes),
+    parent(p.parent), bytes(p.bytes), arrays(p.arrays) {}
+
+  unsigned find(unsigned n) {
+    while (parent[n] != n) {
+      parent[n] = parent[parent[n]];
+      n = parent[n];
+    }
+    return n;
+  }
+
+  void add(ref<Expr> e);
+  void getRoots(ref<Expr> e, std::set<unsigned> &roots);
+
+private:
+  struct ArrayInfo {
+    unsigned node;
+    bool whole;
+    std::vector<unsigned> byteNodes; // only kept while !whole
+  };
+
+  typedef std::map<std::pair<const Array*, unsigned>, unsigned> bytes_ty;
+  typedef std::map<const Array*, ArrayInfo> arrays_ty;
+
+  std::vector<unsigned> parent;
+  bytes_ty bytes;
+  arrays_ty arrays;
+
+  unsigned newNode() {
+    parent.push_back(parent.size());
+    return parent.size() - 1;
+  }
+
+  void unite(unsigned a, unsigned b) {
+    a = find(a);
+    b = find(b);
+    if (a != b)
+      parent[b] = a;
+  }
+
+  ArrayInfo &getArray(const Array *array) {
+    arrays_ty::iterator it = arrays.find(array);
+    if (it != arrays.end())
+      return it->second;
+
+    ArrayInfo &ai = arrays[array];
+    ai.node = newNode();
+    ai.whole = false;
+    return ai;
+  }
+};
+
+}
+
+void ConstraintPartition::add(ref<Expr> e) {
+  std::vector< ref<ReadExpr> > reads;
+  findReads(e, /* visitUpdates= */ true, reads);
+
+  unsigned node = NoNode;
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    ReadExpr *re = reads[i].get();
+    const Array *array = re->updates.root;
+
+    // Reads of a constant array don't alias.
+    if (array->isConstantArray() && !re->updates.head)
+      continue;
+
+    ArrayInfo &ai = getArray(array);
+    unsigned n;
+    if (ai.whole) {
+      n = ai.node;
+    } else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index)) {
+      std::pair<const Array*, unsigned> key(array, CE->getZExtValue(32));
+      bytes_ty::iterator it = bytes.find(key);
+      if (it != bytes.end()) {
+        n = it->second;
+      } else {
+        n = newNode();
+        bytes.insert(std::make_pair(key, n));
+        ai.byteNodes.push_back(n);
+      }
+    } else {
+      // Symbolic index: the array now behaves as a single element
+      ai.whole = true;
+      for (unsigned j = 0; j != ai.byteNodes.size(); ++j)
+        unite(ai.node, ai.byteNodes[j]);
+      ai.byteNodes.clear();
+      n = ai.node;
+    }
+
+    if (node == NoNode)
+      node = n;
+    else
+      unite(node, n);
+  }
+
+  constraintNodes.push_back(node);
+}
+
+void ConstraintPartition::getRoots(ref<Expr> e, std::set<unsigned> &roots) {
+  std::vector< ref<ReadExpr> > reads;
+  findReads(e, /* visitUpdates= */ true, reads);
+
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    ReadExpr *re = reads[i].get();
+    const Array *array = re->updates.root;
+
+    if (array->isConstantArray() && !re->updates.head)
+      continue;
+
+    arrays_ty::iterator it = arrays.find(array);
+    if (it == arrays.end())
+      continue;
+
+    const ArrayInfo &ai = it->second;
+    if (ai.whole) {
+      roots.insert(find(ai.node));
+    } else if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index)) {
+      bytes_ty::iterator it2 =
+        bytes.find(std::make_pair(array, (unsigned) CE->getZExtValue(32)));
+      if (it2 != bytes.end())
+        roots.insert(find(it2->second));
+    } else {
+      for (unsigned j = 0; j != ai.byteNodes.size(); ++j)
+        roots.insert(find(ai.byteNodes[j]));
+    }
+  }
+}
+
+ConstraintManager::ConstraintManager(const ConstraintManager &cs) :
+  constraints(cs.constraints), partition(cs.partition), indexed(cs.indexed),
+  variables(cs.variables), equalities(cs.equalities) {
+  if (partition)
+    ++partition->refCount;
+}
+
+ConstraintManager &ConstraintManager::operator=(const ConstraintManager &cs) {
+  if (cs.partition)
+    ++cs.partition->refCount;
+  releasePartition();
+  constraints = cs.constraints;
+  partition = cs.partition;
+  indexed = cs.indexed;
+  variables = cs.variables;
+  equalities = cs.equalities;
+  return *this;
+}
+
+ConstraintManager::~ConstraintManager() {
+  releasePartition();
+}
+
+void ConstraintManager::releasePartition() const {
+  if (partition && --partition->refCount == 0)
+    delete partition;
+  partition = 0;
+}
+
+void ConstraintManager::buildPartition() const {
+  if (!partition) {
+    partition = new ConstraintPartition();
+    for (constraints_ty::const_iterator it = constraints.begin(),
+           ie = constraints.end(); it != ie; ++it)
+      partition->add(*it);
+  }
+
+  assert(partition->constraintNodes.size() == constraints.size());
+}
+
+bool ConstraintManager::isIndependent(ref<Expr> e) const {
+  if (constraints.empty())
+    return true;
+
+  buildPartition();
+
+  std::set<unsigned> roots;
+  partition->getRoots(e, roots);
+  return roots.empty();
+}
+
+void ConstraintManager::getRelatedConstraints(ref<Expr> e,
+                                std::vector< ref<Expr> > &result) const {
+  buildPartition();
+
+  std::set<unsigned> roots;
+  partition->getRoots(e, roots);
+  if (roots.empty())
+    return;
+
+  for (unsigned i = 0; i != constraints.size(); ++i) {
+    unsigned node = partition->constraintNodes[i];
+    if (node != ConstraintPartition::NoNode &&
+        roots.count(partition->find(node)))
+      result.push_back(constraints[i]);
+  }
+}
+
 class ExprReplaceVisitor : public ExprVisitor {
 private:
   ref<Expr> src, dst;
@@ -43,17 +260,18 @@ public:
 
 class ExprReplaceVisitor2 : public ExprVisitor {
 private:
-  const std::map< ref<Expr>, ref<Expr> > &replacements;
+  typedef ImmutableMap< ref<Expr>, ref<Expr> > replacements_ty;
+  const replacements_ty &replacements;
 
 public:
-  ExprReplaceVisitor2(const std::map< ref<Expr>, ref<Expr> > &_replacements) 
+  ExprReplaceVisitor2(const replacements_ty &_replacements)
     : ExprVisitor(true),
       replacements(_replacements) {}
 
   Action visitExprPost(const Expr &e) {
-    std::map< ref<Expr>, ref<Expr> >::const_iterator it =
-      replacements.find(ref<Expr>(const_cast<Expr*>(&e)));
-    if (it!=replacements.end()) {
+    const replacements_ty::value_type *it =
+      replacements.lookup(ref<Expr>(const_cast<Expr*>(&e)));
+    if (it) {
       return Action::changeTo(it->second);
     } else {
       return Action::doChildren();
@@ -61,25 +279,132 @@ public:
   }
 };
 
-bool ConstraintManager::rewriteConstraints(ExprVisitor &visitor) {
-  ConstraintManager::constraints_ty old;
-  bool changed = false;
+ConstraintManager::variable_ty
+ConstraintManager::getVariable(const ReadExpr *re) {
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index))
+    return variable_ty(re->updates.root, CE->getZExtValue(32));
+  return variable_ty(re->updates.root, ~0u);
+}
+
+void ConstraintManager::indexConstraint(ref<Expr> e) const {
+  std::vector< ref<ReadExpr> > reads;
+  findReads(e, /* visitUpdates= */ true, reads);
+
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    variable_ty v = getVariable(reads[i].get());
+    const variables_ty::value_type *entry = variables.lookup(v);
+    exprs_ty exprs = entry ? entry->second : exprs_ty();
+    variables = variables.replace(std::make_pair(v, exprs.insert(e)));
+  }
+
+  const EqExpr *ee = dyn_cast<EqExpr>(e);
+  if (ee && isa<ConstantExpr>(ee->left))
+    equalities = equalities.insert(std::make_pair(ee->right, ee->left));
+  else
+    equalities = equalities.insert(std::make_pair(e,
+                                     ConstantExpr::alloc(1, Expr::Bool)));
+}
+
+void ConstraintManager::unindexConstraint(ref<Expr> e) const {
+  std::vector< ref<ReadExpr> > reads;
+  findReads(e, /* visitUpdates= */ true, reads);
+
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    variable_ty v = getVariable(reads[i].get());
+    const variables_ty::value_type *entry = variables.lookup(v);
+    if (!entry)
+      continue;
+
+    exprs_ty exprs = entry->second.remove(e);
+    if (exprs.empty())
+      variables = variables.remove(v);
+    else
+      variables = variables.replace(std::make_pair(v, exprs));
+  }
+
+  const EqExpr *ee = dyn_cast<EqExpr>(e);
+  if (ee && isa<ConstantExpr>(ee->left))
+    equalities = equalities.remove(ee->right);
+  else
+    equalities = equalities.remove(e);
+}
+
+void ConstraintManager::buildIndex() const {
+  if (indexed)
+    return;
+
+  variables = variables_ty();
+  equalities = equalities_ty();
+  for (constraints_ty::const_iterator it = constraints.begin(),
+         ie = constraints.end(); it != ie; ++it)
+    indexConstraint(*it);
+  indexed = true;
+}
+
+void ConstraintManager::pushConstraint(ref<Expr> e) {
+  constraints.push_back(e);
+  if (indexed)
+    indexConstraint(e);
+}
+
+bool ConstraintManager::rewriteConstraints(ExprVisitor &visitor,
+                                           ref<Expr> src) {
+  buildIndex();
+
+  // A constraint that contains src reads all the variables of src,
+  // look at the constraints of the least shared one.
+  std::vector< ref<ReadExpr> > reads;
+  findReads(src, /* visitUpdates= */ true, reads);
+
+  exprs_ty candidates;
+  if (reads.empty()) {
+    for (constraints_ty::const_iterator it = constraints.begin(),
+           ie = constraints.end(); it != ie; ++it)
+      candidates = candidates.insert(*it);
+  }
+
+  for (unsigned i = 0; i != reads.size(); ++i) {
+    const variables_ty::value_type *entry =
+      variables.lookup(getVariable(reads[i].get()));
+    if (!entry)
+      return false;
+    if (i == 0 || entry->second.size() < candidates.size())
+      candidates = entry->second;
+  }
+
+  std::map<Expr*, ref<Expr> > rewritten;
+  for (exprs_ty::iterator it = candidates.begin(), ie = candidates.end();
+       it != ie; ++it) {
+    ref<Expr> e = visitor.visit(*it);
+    if (e != *it)
+      rewritten.insert(std::make_pair((*it).get(), e));
+  }
+
+  if (rewritten.empty())
+    return false;
+
+  // the partition indexes constraints by position, rebuild it lazily
+  releasePartition();
 
+  constraints_ty old;
+  constraints_ty added;
   constraints.swap(old);
-  for (ConstraintManager::constraints_ty::iterator 
-         it = old.begin(), ie = old.end(); it != ie; ++it) {
-    ref<Expr> &ce = *it;
-    ref<Expr> e = visitor.visit(ce);
-
-    if (e!=ce) {
-      addConstraintInternal(e); // enable further reductions
-      changed = true;
+  for (constraints_ty::iterator it = old.begin(), ie = old.end();
+       it != ie; ++it) {
+    std::map<Expr*, ref<Expr> >::iterator rit = rewritten.find((*it).get());
+    if (rit == rewritten.end()) {
+      constraints.push_back(*it);
     } else {
-      constraints.push_back(ce);
+      unindexConstraint(*it);
+      added.push_back(rit->second);
     }
   }
 
-  return changed;
+  for (constraints_ty::iterator it = added.begin(), ie = added.end();
+       it != ie; ++it)
+    addConstraintInternal(*it); // enable further reductions
+
+  return true;
 }
 
 void ConstraintManager::simplifyForValidConstraint(ref<Expr> e) {
@@ -90,23 +415,9 @@ ref<Expr> ConstraintManager::simplifyExpr(ref<Expr> e) const {
   if (isa<ConstantExpr>(e))
     return e;
 
-  std::map< ref<Expr>, ref<Expr> > equalities;
-  
-  for (ConstraintManager::constraints_ty::const_iterator 
-         it = constraints.begin(), ie = constraints.end(); it != ie; ++it) {
-    if (const EqExpr *ee = dyn_cast<EqExpr>(*it)) {
-      if (isa<ConstantExpr>(ee->left)) {
-        equalities.insert(std::make_pair(ee->right,
-                                         ee->left));
-      } else {
-        equalities.insert(std::make_pair(*it,
-                                         ConstantExpr::alloc(1, Expr::Bool)));
-      }
-    } else {
-      equalities.insert(std::make_pair(*it,
-                                       ConstantExpr::alloc(1, Expr::Bool)));
-    }
-  }
+  buildIndex();
+  if (equalities.empty())
+    return e;
 
   return ExprReplaceVisitor2(equalities).visit(e);
 }
@@ -138,19 +449,31 @@ void ConstraintManager::addConstraintInternal(ref<Expr> e) {
     BinaryExpr *be = cast<BinaryExpr>(e);
     if (isa<ConstantExpr>(be->left)) {
       ExprReplaceVisitor visitor(be->right, be->left);
-      rewriteConstraints(visitor);
+      rewriteConstraints(visitor, be->right);
     }
-    constraints.push_back(e);
+    pushConstraint(e);
     break;
   }
     
   default:
-    constraints.push_back(e);
+    pushConstraint(e);
     break;
   }
 }
 
 void ConstraintManager::addConstraint(ref<Expr> e) {
   e = simplifyExpr(e);
+
+  unsigned first = constraints.size();
   addConstraintInternal(e);
+
+  if (partition) {
+    if (partition->refCount > 1) {
+      // copy on write
+      --partition->refCount;
+      partition = new ConstraintPartition(*partition);
+    }
+    for (unsigned i = first; i < constraints.size(); ++i)
+      partition->add(constraints[i]);
+  }
 }
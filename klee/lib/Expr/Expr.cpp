@@ -20,6 +20,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <tr1/unordered_map>
 
 using namespace klee;
 using namespace llvm;
@@ -29,11 +30,73 @@ namespace {
   ConstArrayOpt("const-array-opt",
      cl::init(true),
 	 cl::desc("Enable various optimizations involving all-constant arrays."));
+
+  cl::opt<bool>
+  HashConsExprs("hash-cons-exprs",
+     cl::init(false),
+     cl::desc("Share one node between structurally equal expressions."));
+
+  /// Live hash-consed nodes by hash value. The table does not hold
+  /// references, nodes remove themselves when they are destroyed.
+  /// Never freed, expressions may outlive static destructors.
+  typedef std::tr1::unordered_multimap<unsigned, Expr*> HashConsTable;
+  HashConsTable *hashConsTable = 0;
 }
 
 /***/
 
 unsigned Expr::count = 0;
+ExprAllocator *Expr::allocator = 0;
+
+void *Expr::allocate(size_t size) {
+  if (allocator) {
+    if (void *ptr = allocator->allocate(size))
+      return ptr;
+  }
+  return ::operator new(size);
+}
+
+void Expr::deallocate(void *ptr) {
+  if (allocator && allocator->deallocate(ptr))
+    return;
+  ::operator delete(ptr);
+}
+
+Expr::~Expr() {
+  Expr::count--;
+
+  if (!hashConsTable)
+    return;
+
+  // The derived part is already destroyed, only compare pointers
+  std::pair<HashConsTable::iterator, HashConsTable::iterator> range =
+    hashConsTable->equal_range(hashValue);
+  for (HashConsTable::iterator it = range.first; it != range.second; ++it) {
+    if (it->second == this) {
+      hashConsTable->erase(it);
+      return;
+    }
+  }
+}
+
+ref<Expr> Expr::hashCons(const ref<Expr> &e) {
+  if (!HashConsExprs)
+    return e;
+
+  if (!hashConsTable)
+    hashConsTable = new HashConsTable();
+
+  unsigned hash = e->hash();
+  std::pair<HashConsTable::iterator, HashConsTable::iterator> range =
+    hashConsTable->equal_range(hash);
+  for (HashConsTable::iterator it = range.first; it != range.second; ++it) {
+    if (it->second->compare(*e) == 0)
+      return it->second;
+  }
+
+  hashConsTable->insert(std::make_pair(hash, e.get()));
+  return e;
+}
 
 ref<Expr> Expr::createTempRead(const Array *array, Expr::Width w) {
   UpdateList ul(array, 0);
@@ -462,7 +525,7 @@ extern "C" void vc_DeleteExpr(void*);
 
 Array::~Array() {
   // FIXME: This shouldn't be necessary.
-  if (stpInitialArray) {
+  if (stpInitialArray && stpInitialArrayGeneration == stpGeneration) {
     ::vc_DeleteExpr(stpInitialArray);
     stpInitialArray = 0;
   }
@@ -0,0 +1,256 @@
+//===-- ExprBytecode.cpp --------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/util/ExprBytecode.h"
+
+using namespace klee;
+
+static inline uint64_t truncateTo(uint64_t v, Expr::Width w) {
+  return w >= 64 ? v : v & ((1ULL << w) - 1);
+}
+
+static inline int64_t signExtend(uint64_t v, Expr::Width w) {
+  return w >= 64 ? (int64_t) v : ((int64_t) (v << (64 - w))) >> (64 - w);
+}
+
+unsigned ExprBytecode::emit(Expr::Kind opcode, Expr::Width width,
+                            Expr::Width srcWidth,
+                            unsigned a, unsigned b, unsigned c,
+                            uint64_t imm) {
+  Instruction i;
+  i.opcode = opcode;
+  i.width = width;
+  i.srcWidth = srcWidth;
+  i.ops[0] = a;
+  i.ops[1] = b;
+  i.ops[2] = c;
+  i.imm = imm;
+  code.push_back(i);
+  return code.size() - 1;
+}
+
+unsigned ExprBytecode::getArrayId(const Array *array) {
+  std::map<const Array*, unsigned>::iterator it = arrayIds.find(array);
+  if (it != arrayIds.end())
+    return it->second;
+
+  arrays.push_back(array);
+  arrayIds.insert(std::make_pair(array, arrays.size() - 1));
+  return arrays.size() - 1;
+}
+
+bool ExprBytecode::compile(const ref<Expr> &e, unsigned &reg) {
+  std::map<const Expr*, unsigned>::iterator it = registers.find(e.get());
+  if (it != registers.end()) {
+    reg = it->second;
+    return true;
+  }
+
+  Expr::Width width = e->getWidth();
+  if (width > 64)
+    return false;
+
+  switch (e->getKind()) {
+  case Expr::Constant:
+    reg = emit(Expr::Constant, width, width, 0, 0, 0,
+               cast<ConstantExpr>(e)->getZExtValue());
+    break;
+
+  case Expr::NotOptimized:
+    if (!compile(e->getKid(0), reg))
+      return false;
+    break;
+
+  case Expr::Read: {
+    const ReadExpr *re = cast<ReadExpr>(e);
+    unsigned index;
+    if (!compile(re->index, index))
+      return false;
+
+    // Initial value, then the updates from the oldest to the newest
+    unsigned id = getArrayId(re->updates.root);
+    reg = emit(Expr::Read, Expr::Int8, re->index->getWidth(),
+               index, 0, 0, id);
+
+    std::vector<const UpdateNode*> updates;
+    for (const UpdateNode *un = re->updates.head; un; un = un->next)
+      updates.push_back(un);
+
+    for (unsigned i = updates.size(); i != 0; --i) {
+      const UpdateNode *un = updates[i - 1];
+      unsigned ui, uv;
+      if (!compile(un->index, ui) || !compile(un->value, uv))
+        return false;
+      unsigned eq = emit(Expr::Eq, Expr::Bool, un->index->getWidth(),
+                         ui, index, 0, 0);
+      reg = emit(Expr::Select, Expr::Int8, Expr::Int8, eq, uv, reg, 0);
+    }
+    break;
+  }
+
+  case Expr::Extract: {
+    const ExtractExpr *ee = cast<ExtractExpr>(e);
+    unsigned src;
+    if (!compile(ee->expr, src))
+      return false;
+    reg = emit(Expr::Extract, width, ee->expr->getWidth(),
+               src, 0, 0, ee->offset);
+    break;
+  }
+
+  default: {
+    unsigned ops[3] = { 0, 0, 0 };
+    unsigned numKids = e->getNumKids();
+    assert(numKids <= 3);
+    for (unsigned i = 0; i != numKids; ++i)
+      if (!compile(e->getKid(i), ops[i]))
+        return false;
+
+    // Concat needs the width of its right kid, the others the width of
+    // their (first) operand.
+    Expr::Width srcWidth = e->getKind() == Expr::Concat ?
+      e->getKid(1)->getWidth() : e->getKid(0)->getWidth();
+    reg = emit(e->getKind(), width, srcWidth, ops[0], ops[1], ops[2], 0);
+    break;
+  }
+  }
+
+  registers.insert(std::make_pair(e.get(), reg));
+  return true;
+}
+
+bool ExprBytecode::add(ref<Expr> e) {
+  unsigned codeSize = code.size();
+  unsigned reg;
+
+  if (!compile(e, reg)) {
+    code.resize(codeSize);
+    for (std::map<const Expr*, unsigned>::iterator it = registers.begin();
+         it != registers.end();) {
+      if (it->second >= codeSize)
+        registers.erase(it++);
+      else
+        ++it;
+    }
+    return false;
+  }
+
+  roots.push_back(reg);
+  exprs.push_back(e);
+  return true;
+}
+
+bool ExprBytecode::satisfies(const Assignment &a, bool &result) const {
+  // Resolve the bindings once rather than on every read
+  std::vector<const std::vector<unsigned char>*> bytes(arrays.size());
+  for (unsigned i = 0; i != arrays.size(); ++i) {
+    Assignment::bindings_ty::const_iterator it = a.bindings.find(arrays[i]);
+    bytes[i] = it != a.bindings.end() ? &it->second : 0;
+  }
+
+  std::vector<uint64_t> regs(code.size());
+  for (unsigned pc = 0; pc != code.size(); ++pc) {
+    const Instruction &i = code[pc];
+    uint64_t l = regs[i.ops[0]], r = regs[i.ops[1]];
+    uint64_t v;
+
+    switch (i.opcode) {
+    case Expr::Constant: v = i.imm; break;
+
+    case Expr::Read: {
+      const Array *array = arrays[i.imm];
+      if (array->isConstantArray() && l < array->size) {
+        v = array->constantValues[l]->getZExtValue(8);
+      } else if (bytes[i.imm] && l < bytes[i.imm]->size()) {
+        v = (*bytes[i.imm])[l];
+      } else if (a.allowFreeValues) {
+        return false;
+      } else {
+        v = 0;
+      }
+      break;
+    }
+
+    case Expr::Select: v = l ? r : regs[i.ops[2]]; break;
+    case Expr::Concat: v = (l << i.srcWidth) | r; break;
+    case Expr::Extract: v = l >> i.imm; break;
+    case Expr::ZExt: v = l; break;
+    case Expr::SExt: v = signExtend(l, i.srcWidth); break;
+
+    case Expr::Add: v = l + r; break;
+    case Expr::Sub: v = l - r; break;
+    case Expr::Mul: v = l * r; break;
+    case Expr::UDiv:
+      if (!r) return false;
+      v = l / r;
+      break;
+    case Expr::SDiv:
+      if (!r) return false;
+      if (signExtend(r, i.srcWidth) == -1)
+        v = -l;
+      else
+        v = signExtend(l, i.srcWidth) / signExtend(r, i.srcWidth);
+      break;
+    case Expr::URem:
+      if (!r) return false;
+      v = l % r;
+      break;
+    case Expr::SRem:
+      if (!r) return false;
+      if (signExtend(r, i.srcWidth) == -1)
+        v = 0;
+      else
+        v = signExtend(l, i.srcWidth) % signExtend(r, i.srcWidth);
+      break;
+
+    case Expr::Not: v = ~l; break;
+    case Expr::And: v = l & r; break;
+    case Expr::Or: v = l | r; break;
+    case Expr::Xor: v = l ^ r; break;
+    case Expr::Shl: v = r >= i.srcWidth ? 0 : l << r; break;
+    case Expr::LShr: v = r >= i.srcWidth ? 0 : l >> r; break;
+    case Expr::AShr:
+      if (r >= i.srcWidth)
+        v = signExtend(l, i.srcWidth) < 0 ? ~0ULL : 0;
+      else
+        v = signExtend(l, i.srcWidth) >> r;
+      break;
+
+    case Expr::Eq: v = l == r; break;
+    case Expr::Ne: v = l != r; break;
+    case Expr::Ult: v = l < r; break;
+    case Expr::Ule: v = l <= r; break;
+    case Expr::Ugt: v = l > r; break;
+    case Expr::Uge: v = l >= r; break;
+    case Expr::Slt:
+      v = signExtend(l, i.srcWidth) < signExtend(r, i.srcWidth); break;
+    case Expr::Sle:
+      v = signExtend(l, i.srcWidth) <= signExtend(r, i.srcWidth); break;
+    case Expr::Sgt:
+      v = signExtend(l, i.srcWidth) > signExtend(r, i.srcWidth); break;
+    case Expr::Sge:
+      v = signExtend(l, i.srcWidth) >= signExtend(r, i.srcWidth); break;
+
+    default:
+      assert(0 && "invalid bytecode instruction");
+      return false;
+    }
+
+    regs[pc] = truncateTo(v, i.width);
+  }
+
+  result = true;
+  for (unsigned i = 0; i != roots.size(); ++i) {
+    if (!regs[roots[i]]) {
+      result = false;
+      break;
+    }
+  }
+  return true;
+}
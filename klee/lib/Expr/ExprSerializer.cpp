@@ -0,0 +1,367 @@
+//===-- ExprSerializer.cpp ------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/util/ExprSerializer.h"
+
+#include "llvm/ADT/APInt.h"
+
+using namespace klee;
+
+namespace {
+  /// Record tags. Definitions come first, a reference tag ends the
+  /// records of a write call.
+  enum Tag {
+    DefineArray,
+    DefineUpdate,
+    DefineExpr,
+    RefExpr,
+    RefArray
+  };
+}
+
+/***/
+
+void ExprWriter::writeInt(uint64_t value) {
+  do {
+    unsigned char byte = value & 0x7f;
+    value >>= 7;
+    if (value)
+      byte |= 0x80;
+    buffer.push_back(byte);
+  } while (value);
+}
+
+void ExprWriter::writeBytes(const void *data, size_t size) {
+  writeInt(size);
+  const unsigned char *bytes = (const unsigned char*) data;
+  buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+void ExprWriter::writeExpr(const ref<Expr> &e) {
+  unsigned id = defineExpr(e);
+  writeInt(RefExpr);
+  writeInt(id);
+}
+
+void ExprWriter::writeArray(const Array *array) {
+  unsigned id = defineArray(array);
+  writeInt(RefArray);
+  writeInt(id);
+}
+
+unsigned ExprWriter::defineArray(const Array *array) {
+  std::map<const Array*, unsigned>::iterator it = arrays.find(array);
+  if (it != arrays.end())
+    return it->second;
+
+  // Constant values come first, they are plain constants
+  std::vector<unsigned> values;
+  for (unsigned i = 0, e = array->constantValues.size(); i != e; ++i)
+    values.push_back(defineExpr(array->constantValues[i]));
+
+  writeInt(DefineArray);
+  writeInt(array->name.size());
+  buffer.insert(buffer.end(), array->name.begin(), array->name.end());
+  writeInt(array->size);
+  writeInt(values.size());
+  for (unsigned i = 0, e = values.size(); i != e; ++i)
+    writeInt(values[i]);
+
+  unsigned id = arrays.size();
+  arrays.insert(std::make_pair(array, id));
+  return id;
+}
+
+unsigned ExprWriter::defineUpdate(const UpdateNode *un) {
+  // Update lists can be long, define the missing nodes iteratively
+  // from the oldest one
+  std::vector<const UpdateNode*> pending;
+  for (const UpdateNode *n = un; n && !updates.count(n); n = n->next)
+    pending.push_back(n);
+
+  for (unsigned i = pending.size(); i > 0; --i) {
+    const UpdateNode *n = pending[i - 1];
+    unsigned index = defineExpr(n->index);
+    unsigned value = defineExpr(n->value);
+
+    writeInt(DefineUpdate);
+    writeInt(n->next ? updates[n->next] + 1 : 0);
+    writeInt(index);
+    writeInt(value);
+
+    unsigned id = updates.size();
+    updates.insert(std::make_pair(n, id));
+  }
+
+  return updates[un];
+}
+
+unsigned ExprWriter::defineExpr(const ref<Expr> &e) {
+  std::map<const Expr*, unsigned>::iterator it = exprs.find(e.get());
+  if (it != exprs.end())
+    return it->second;
+
+  std::vector<uint64_t> fields;
+
+  if (ConstantExpr *ce = dyn_cast<ConstantExpr>(e)) {
+    const llvm::APInt &v = ce->getAPValue();
+    fields.push_back(v.getNumWords());
+    for (unsigned i = 0, n = v.getNumWords(); i != n; ++i)
+      fields.push_back(v.getRawData()[i]);
+  } else if (ReadExpr *re = dyn_cast<ReadExpr>(e)) {
+    fields.push_back(defineArray(re->updates.root));
+    fields.push_back(re->updates.head ? defineUpdate(re->updates.head) + 1 : 0);
+    fields.push_back(defineExpr(re->index));
+  } else {
+    if (ExtractExpr *ee = dyn_cast<ExtractExpr>(e))
+      fields.push_back(ee->offset);
+    fields.push_back(e->getNumKids());
+    for (unsigned i = 0, n = e->getNumKids(); i != n; ++i)
+      fields.push_back(defineExpr(e->getKid(i)));
+  }
+
+  writeInt(DefineExpr);
+  writeInt(e->getKind());
+  writeInt(e->getWidth());
+  for (unsigned i = 0, n = fields.size(); i != n; ++i)
+    writeInt(fields[i]);
+
+  unsigned id = exprs.size();
+  exprs.insert(std::make_pair(e.get(), id));
+  return id;
+}
+
+/***/
+
+ExprReader::~ExprReader() {
+  // The expressions and update lists may refer to the arrays
+  exprs.clear();
+  updates.clear();
+  if (!arrayTable)
+    for (unsigned i = 0, e = arrays.size(); i != e; ++i)
+      delete arrays[i];
+}
+
+bool ExprReader::readInt(uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (pos == end)
+      return false;
+    unsigned char byte = *pos++;
+    value |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool ExprReader::readBytes(const unsigned char *&data, uint64_t &size) {
+  if (!readInt(size) || size > (uint64_t) (end - pos))
+    return false;
+  data = pos;
+  pos += size;
+  return true;
+}
+
+bool ExprReader::readId(uint64_t size, uint64_t &id) {
+  return readInt(id) && id < size;
+}
+
+bool ExprReader::readExpr(ref<Expr> &e) {
+  unsigned tag;
+  uint64_t id;
+  if (!readDefinitions(tag) || tag != RefExpr || !readId(exprs.size(), id))
+    return false;
+  e = exprs[id];
+  return true;
+}
+
+bool ExprReader::readArray(const Array *&array) {
+  unsigned tag;
+  uint64_t id;
+  if (!readDefinitions(tag) || tag != RefArray || !readId(arrays.size(), id))
+    return false;
+  array = arrays[id];
+  return true;
+}
+
+bool ExprReader::readDefinitions(unsigned &tag) {
+  for (;;) {
+    uint64_t value;
+    if (!readInt(value))
+      return false;
+
+    switch (value) {
+    case DefineArray:
+      if (!readArrayDefinition())
+        return false;
+      break;
+    case DefineUpdate:
+      if (!readUpdateDefinition())
+        return false;
+      break;
+    case DefineExpr:
+      if (!readExprDefinition())
+        return false;
+      break;
+    case RefExpr:
+    case RefArray:
+      tag = value;
+      return true;
+    default:
+      return false;
+    }
+  }
+}
+
+bool ExprReader::readArrayDefinition() {
+  uint64_t length, size, numValues;
+  if (!readInt(length) || length > (uint64_t) (end - pos))
+    return false;
+  std::string name((const char*) pos, length);
+  pos += length;
+
+  if (!readInt(size) || !readInt(numValues))
+    return false;
+  if (numValues && numValues != size)
+    return false;
+
+  std::vector< ref<ConstantExpr> > values;
+  for (uint64_t i = 0; i < numValues; ++i) {
+    uint64_t id;
+    if (!readId(exprs.size(), id) || !isa<ConstantExpr>(exprs[id]))
+      return false;
+    values.push_back(cast<ConstantExpr>(exprs[id]));
+  }
+
+  std::vector<const Array*> *known = 0;
+  if (arrayTable) {
+    known = &(*arrayTable)[std::make_pair(name, (unsigned) size)];
+    for (unsigned i = 0, e = known->size(); i != e; ++i) {
+      const Array *array = (*known)[i];
+      bool same = array->constantValues.size() == values.size();
+      for (unsigned j = 0; same && j < values.size(); ++j)
+        same = array->constantValues[j] == values[j];
+      if (same) {
+        arrays.push_back(array);
+        return true;
+      }
+    }
+  }
+
+  const Array *array;
+  if (values.empty())
+    array = new Array(name, size);
+  else
+    array = new Array(name, size, &values[0], &values[0] + values.size());
+
+  arrays.push_back(array);
+  if (known)
+    known->push_back(array);
+  return true;
+}
+
+bool ExprReader::readUpdateDefinition() {
+  uint64_t next, index, value;
+  if (!readId(updates.size() + 1, next) ||
+      !readId(exprs.size(), index) || !readId(exprs.size(), value))
+    return false;
+  if (exprs[value]->getWidth() != Expr::Int8)
+    return false;
+
+  const UpdateNode *nextNode = next ? updates[next - 1].head : 0;
+  updates.push_back(UpdateList(0, new UpdateNode(nextNode, exprs[index],
+                                                 exprs[value])));
+  return true;
+}
+
+bool ExprReader::readExprDefinition() {
+  uint64_t kind, width;
+  if (!readInt(kind) || !readInt(width) ||
+      kind > Expr::LastKind || kind == Expr::NotOptimized + 1 ||
+      !width || width > (1u << 16))
+    return false;
+
+  if (kind == Expr::Constant) {
+    uint64_t numWords;
+    if (!readInt(numWords) || numWords != (width + 63) / 64)
+      return false;
+    std::vector<uint64_t> words(numWords);
+    for (uint64_t i = 0; i < numWords; ++i)
+      if (!readInt(words[i]))
+        return false;
+    exprs.push_back(ConstantExpr::alloc(llvm::APInt(width, numWords,
+                                                    &words[0])));
+    return true;
+  }
+
+  if (kind == Expr::Read) {
+    uint64_t array, head, index;
+    if (!readId(arrays.size(), array) || !readId(updates.size() + 1, head) ||
+        !readId(exprs.size(), index))
+      return false;
+    UpdateList ul(arrays[array], head ? updates[head - 1].head : 0);
+    exprs.push_back(ReadExpr::create(ul, exprs[index]));
+    return true;
+  }
+
+  uint64_t offset = 0, numKids;
+  if (kind == Expr::Extract && !readInt(offset))
+    return false;
+  if (!readInt(numKids) || numKids > 3)
+    return false;
+
+  std::vector<Expr::CreateArg> args;
+  for (uint64_t i = 0; i < numKids; ++i) {
+    uint64_t id;
+    if (!readId(exprs.size(), id))
+      return false;
+    args.push_back(Expr::CreateArg(exprs[id]));
+  }
+
+  switch (kind) {
+  case Expr::Extract:
+    if (numKids != 1 || offset + width > args[0].expr->getWidth())
+      return false;
+    exprs.push_back(ExtractExpr::create(args[0].expr, offset, width));
+    return true;
+  case Expr::Not:
+    if (numKids != 1)
+      return false;
+    exprs.push_back(NotExpr::create(args[0].expr));
+    return true;
+  case Expr::ZExt:
+  case Expr::SExt:
+    if (numKids != 1)
+      return false;
+    args.push_back(Expr::CreateArg(width));
+    break;
+  case Expr::NotOptimized:
+    if (numKids != 1)
+      return false;
+    break;
+  case Expr::Select:
+    if (numKids != 3 || args[0].expr->getWidth() != Expr::Bool ||
+        args[1].expr->getWidth() != args[2].expr->getWidth())
+      return false;
+    break;
+  case Expr::Concat:
+    if (numKids != 2)
+      return false;
+    break;
+  default:
+    // Binary operations need operands of the same width
+    if (numKids != 2 || args[0].expr->getWidth() != args[1].expr->getWidth())
+      return false;
+    break;
+  }
+
+  exprs.push_back(Expr::createFromKind((Expr::Kind) kind, args));
+  return true;
+}
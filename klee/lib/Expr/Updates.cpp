@@ -13,6 +13,8 @@
 
 using namespace klee;
 
+unsigned klee::stpGeneration = 0;
+
 ///
 
 UpdateNode::UpdateNode(const UpdateNode *_next, 
@@ -20,6 +22,7 @@ UpdateNode::UpdateNode(const UpdateNode *_next,
                        const ref<Expr> &_value) 
   : refCount(0),
     stpArray(0),
+    stpArrayGeneration(0),
     next(_next),
     index(_index),
     value(_value) {
@@ -37,7 +40,7 @@ extern "C" void vc_DeleteExpr(void*);
 
 UpdateNode::~UpdateNode() {
   // XXX gross
-  if (stpArray)
+  if (stpArray && stpArrayGeneration == stpGeneration)
     ::vc_DeleteExpr(stpArray);
 }
 
@@ -130,6 +130,7 @@ InstructionInfoTable::InstructionInfoTable(Module *m)
 
   for (Module::iterator fnIt = m->begin(), fn_ie = m->end(); 
        fnIt != fn_ie; ++fnIt) {
+    functions.insert(fnIt);
     const std::string *initialFile = &dummyString;
     unsigned initialLine = 0;
 
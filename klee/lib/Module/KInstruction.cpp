@@ -15,5 +15,4 @@ using namespace klee;
 /***/
 
 KInstruction::~KInstruction() {
-  delete[] operands;
 }
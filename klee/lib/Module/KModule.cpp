@@ -85,6 +85,12 @@ namespace {
   cl::opt<bool>
   DebugPrintEscapingFunctions("debug-print-escaping-functions", 
                               cl::desc("Print functions whose address is taken."));
+
+  cl::opt<bool>
+  LazyFunctionPreparation("lazy-function-preparation",
+                          cl::desc("Lower the functions of the linked libraries "
+                                   "the first time they are interpreted instead of at startup"),
+                          cl::init(false));
 }
 
 namespace llvm {
@@ -148,7 +154,8 @@ KModule::KModule(Module *_module)
     dbgStopPointFn(0),
     kleeMergeFn(0),
     infos(0),
-    p(new KModulePrivate(_module, targetData)) {
+    p(new KModulePrivate(_module, targetData)),
+    customPasses(0) {
 }
 
 KModule::~KModule() {
@@ -275,6 +282,43 @@ static const char *index(const char *str, char c) {
 }
 #endif
 
+void KModule::runLoweringPasses(const Interpreter::ModuleOptions &opts) {
+  // Run the passes that maintain invariants we expect during
+  // interpretation. We run the intrinsic cleaner just in case we
+  // linked in something with intrinsics but any external calls are
+  // going to be unresolved. We really need to handle the intrinsics
+  // directly I think?
+
+#if 0
+  PassManager pm3;
+  pm3.add(createCFGSimplificationPass());
+  switch(SwitchType) {
+  case eSwitchTypeInternal: break;
+  case eSwitchTypeSimple: pm3.add(new LowerSwitchPass()); break;
+  case eSwitchTypeLLVM:  pm3.add(createLowerSwitchPass()); break;
+  default: klee_error("invalid --switch-type");
+  }
+  pm3.add(new IntrinsicCleanerPass(*targetData));
+  //pm3.add(new PhiCleanerPass());
+#endif
+  p->pm3.run(*module);
+
+  if (opts.CustomPasses) {
+      Module::iterator it;
+      for(it = module->begin(); it != module->end(); ++it) {
+          opts.CustomPasses->run(*it);
+      }
+  }
+
+  //The PhiCleaner is important to be the last, because the rest of KLEE
+  //makes assumptions about how PHI nodes are placed.
+#if 0
+  PassManager pm4;
+  pm4.add(new PhiCleanerPass());
+#endif
+  p->pm4.run(*module);
+}
+
 void KModule::prepare(const Interpreter::ModuleOptions &opts,
                       InterpreterHandler *ih) {
   if (!MergeAtExit.empty()) {
@@ -365,6 +409,19 @@ void KModule::prepare(const Interpreter::ModuleOptions &opts,
 
   // FIXME: Missing force import for various math functions.
 
+  // With lazy preparation, the functions of the libraries are lowered
+  // when they are first interpreted. The rest of the module goes through
+  // the same passes as usual, but before the libraries are linked in.
+  std::set<Function*> preparedFunctions;
+  if (LazyFunctionPreparation) {
+    runLoweringPasses(opts);
+    for (Module::iterator it = module->begin(), ie = module->end();
+         it != ie; ++it) {
+      if (!it->isDeclaration())
+        preparedFunctions.insert(it);
+    }
+  }
+
   // FIXME: Find a way that we can test programs without requiring
   // this to be linked in, it makes low level debugging much more
   // annoying.
@@ -377,50 +434,28 @@ void KModule::prepare(const Interpreter::ModuleOptions &opts,
   // and optimization (since global optimization can rewrite lists).
   injectStaticConstructorsAndDestructors(module);
 
-  // Finally, run the passes that maintain invariants we expect during
-  // interpretation. We run the intrinsic cleaner just in case we
-  // linked in something with intrinsics but any external calls are
-  // going to be unresolved. We really need to handle the intrinsics
-  // directly I think?
-
-#if 0
-  PassManager pm3;
-  pm3.add(createCFGSimplificationPass());
-  switch(SwitchType) {
-  case eSwitchTypeInternal: break;
-  case eSwitchTypeSimple: pm3.add(new LowerSwitchPass()); break;
-  case eSwitchTypeLLVM:  pm3.add(createLowerSwitchPass()); break;
-  default: klee_error("invalid --switch-type");
-  }
-  pm3.add(new IntrinsicCleanerPass(*targetData));
-  //pm3.add(new PhiCleanerPass());
-#endif
-  p->pm3.run(*module);
-
-  if (opts.CustomPasses) {
-      Module::iterator it;
-      for(it = module->begin(); it != module->end(); ++it) {
-          opts.CustomPasses->run(*it);
-      }
+  if (LazyFunctionPreparation) {
+    customPasses = opts.CustomPasses;
+    for (Module::iterator it = module->begin(), ie = module->end();
+         it != ie; ++it) {
+      if (!it->isDeclaration() && !preparedFunctions.count(it))
+        deferredFunctions.insert(it);
+    }
+  } else {
+    runLoweringPasses(opts);
   }
 
-  //The PhiCleaner is important to be the last, because the rest of KLEE
-  //makes assumptions about how PHI nodes are placed.
-#if 0
-  PassManager pm4;
-  pm4.add(new PhiCleanerPass());
-#endif
-  p->pm4.run(*module);
-
   // For cleanliness see if we can discard any of the functions we
-  // forced to import.
-  Function *f;
-  f = module->getFunction("memcpy");
-  if (f && f->use_empty()) f->eraseFromParent();
-  f = module->getFunction("memmove");
-  if (f && f->use_empty()) f->eraseFromParent();
-  f = module->getFunction("memset");
-  if (f && f->use_empty()) f->eraseFromParent();
+  // forced to import. Deferred functions may still need them.
+  if (deferredFunctions.empty()) {
+    Function *f;
+    f = module->getFunction("memcpy");
+    if (f && f->use_empty()) f->eraseFromParent();
+    f = module->getFunction("memmove");
+    if (f && f->use_empty()) f->eraseFromParent();
+    f = module->getFunction("memset");
+    if (f && f->use_empty()) f->eraseFromParent();
+  }
 
 
   // Write out the .ll assembly file. We truncate long lines to work
@@ -514,7 +549,7 @@ void KModule::prepare(const Interpreter::ModuleOptions &opts,
   
   for (Module::iterator it = module->begin(), ie = module->end();
        it != ie; ++it) {
-    if (it->isDeclaration())
+    if (it->isDeclaration() || deferredFunctions.count(it))
       continue;
 
     KFunction *kf = new KFunction(it, this);
@@ -547,7 +582,8 @@ void KModule::prepare(const Interpreter::ModuleOptions &opts,
   }
 }
 
-KFunction* KModule::updateModuleWithFunction(llvm::Function *f)
+KFunction* KModule::updateModuleWithFunction(llvm::Function *f,
+                                             FunctionPasses passes)
 {
     assert(functionMap.find(f) == functionMap.end());
 
@@ -556,17 +592,28 @@ KFunction* KModule::updateModuleWithFunction(llvm::Function *f)
     //IntrinsicCleanerPass ip(*targetData, false);
     //ip.runOnFunction(*f);
 
-    p->fpmOptimize.run(*f);
+    if (passes == AllPasses) {
+        p->fpmOptimize.run(*f);
+    }
 
-    p->fpm3.run(*f);
-    p->fpm4.run(*f);
+    if (passes != NoPasses) {
+        p->fpm3.run(*f);
+        p->fpm4.run(*f);
+    }
 
     KFunction *kf = new KFunction(f, this);
 
-    /* TODO: update InstructionInfoTable here */
-    for (unsigned i=0; i<kf->numInstructions; ++i) {
-      KInstruction *ki = kf->instructions[i];
-      ki->info = &infos->getInfo(ki->inst);
+    /* The table only knows the functions that existed when it was built,
+       the others (e.g., translated blocks) do not need a lookup per
+       instruction. TODO: update InstructionInfoTable here */
+    if (infos->hasFunction(f)) {
+      for (unsigned i=0; i<kf->numInstructions; ++i) {
+        KInstruction *ki = kf->instructions[i];
+        ki->info = &infos->getInfo(ki->inst);
+      }
+    } else {
+      for (unsigned i=0; i<kf->numInstructions; ++i)
+        kf->instructions[i]->info = &infos->getDummyInfo();
     }
 
     functions.push_back(kf);
@@ -579,6 +626,22 @@ KFunction* KModule::updateModuleWithFunction(llvm::Function *f)
 }
 
 
+KFunction* KModule::prepareDeferredFunction(llvm::Function *f)
+{
+    std::set<Function*>::iterator it = deferredFunctions.find(f);
+    assert(it != deferredFunctions.end());
+    deferredFunctions.erase(it);
+
+    // Same passes as runLoweringPasses(), in the same order
+    p->fpm3.run(*f);
+    if (customPasses) {
+        customPasses->run(*f);
+    }
+    p->fpm4.run(*f);
+
+    return updateModuleWithFunction(f, NoPasses);
+}
+
 void KModule::removeFunction(llvm::Function *f, bool keepDeclaration)
 {
     std::map<llvm::Function*, KFunction*>::iterator it = functionMap.find(f);
@@ -627,8 +690,10 @@ KConstant::KConstant(llvm::Constant* _ct, unsigned _id, KInstruction* _ki) {
 
 /***/
 
+typedef llvm::DenseMap<Instruction*, unsigned> RegisterMap;
+
 static int getOperandNum(Value *v,
-                         std::map<Instruction*, unsigned> &registerMap,
+                         RegisterMap &registerMap,
                          KModule *km,
                          KInstruction *ki) {
   if (Instruction *inst = dyn_cast<Instruction>(v)) {
@@ -645,6 +710,12 @@ static int getOperandNum(Value *v,
   }
 }
 
+static unsigned getNumOperands(Instruction *inst) {
+  if (isa<CallInst>(inst) || isa<InvokeInst>(inst))
+    return CallSite(inst).arg_size() + 1;
+  return inst->getNumOperands();
+}
+
 
 KFunction::KFunction(llvm::Function *_function,
                      KModule *km) 
@@ -652,28 +723,30 @@ KFunction::KFunction(llvm::Function *_function,
     numArgs(function->arg_size()),
     numInstructions(0),
     trackCoverage(true) {
+  RegisterMap registerMap;
+  unsigned numOperands = 0;
+
+  // The first arg_size() registers are reserved for formals.
+  unsigned rnum = numArgs;
   for (llvm::Function::iterator bbit = function->begin(), 
          bbie = function->end(); bbit != bbie; ++bbit) {
     BasicBlock *bb = bbit;
     basicBlockEntry[bb] = numInstructions;
     numInstructions += bb->size();
-  }
-
-  instructions = new KInstruction*[numInstructions];
-
-  std::map<Instruction*, unsigned> registerMap;
 
-  // The first arg_size() registers are reserved for formals.
-  unsigned rnum = numArgs;
-  for (llvm::Function::iterator bbit = function->begin(), 
-         bbie = function->end(); bbit != bbie; ++bbit) {
-    for (llvm::BasicBlock::iterator it = bbit->begin(), ie = bbit->end();
-         it != ie; ++it)
+    for (llvm::BasicBlock::iterator it = bb->begin(), ie = bb->end();
+         it != ie; ++it) {
       registerMap[it] = rnum++;
+      numOperands += getNumOperands(it);
+    }
   }
   numRegisters = rnum;
-  
+
+  instructions = new KInstruction*[numInstructions];
+  operands = new int[numOperands];
+
   unsigned i = 0;
+  int *nextOperands = operands;
   for (llvm::Function::iterator bbit = function->begin(), 
          bbie = function->end(); bbit != bbie; ++bbit) {
     for (llvm::BasicBlock::iterator it = bbit->begin(), ie = bbit->end();
@@ -697,11 +770,12 @@ KFunction::KFunction(llvm::Function *_function,
 
       ki->inst = it;
       ki->dest = registerMap[it];
+      ki->operands = nextOperands;
+      nextOperands += getNumOperands(it);
 
       if (isa<CallInst>(it) || isa<InvokeInst>(it)) {
         CallSite cs(it);
         unsigned numArgs = cs.arg_size();
-        ki->operands = new int[numArgs+1];
         ki->operands[0] = getOperandNum(cs.getCalledValue(), registerMap, km, ki);
         for (unsigned j=0; j<numArgs; j++) {
             Value *v = cs.getArgument(j);
@@ -710,30 +784,15 @@ KFunction::KFunction(llvm::Function *_function,
       } else {
 
           unsigned numOperands = it->getNumOperands();
-          ki->operands = new int[numOperands];
-
           for (unsigned j=0; j<numOperands; j++) {
             Value *v = it->getOperand(j);
-
-            if (Instruction *inst = dyn_cast<Instruction>(v)) {
-              ki->operands[j] = registerMap[inst];
-            } else if (Argument *a = dyn_cast<Argument>(v)) {
-              ki->operands[j] = a->getArgNo();
-            } else if (isa<BasicBlock>(v) || isa<InlineAsm>(v) ||
-                       isa<MDNode>(v)) {
-              ki->operands[j] = -1;
-            } else {
-              assert(isa<Constant>(v));
-              Constant *c = cast<Constant>(v);
-              ki->operands[j] = -(km->getConstantID(c, ki) + 2);
-            }
+            ki->operands[j] = getOperandNum(v, registerMap, km, ki);
           }
 
       }
 
       ki->owner = this;
       instructions[i++] = ki;
-      instrMap.insert(std::make_pair(it, ki));
     }
   }
 }
@@ -742,4 +801,16 @@ KFunction::~KFunction() {
   for (unsigned i=0; i<numInstructions; ++i)
     delete instructions[i];
   delete[] instructions;
+  delete[] operands;
+}
+
+KInstruction *KFunction::getKInstruction(const llvm::Instruction *inst) {
+  if (instrMap.empty()) {
+    for (unsigned i=0; i<numInstructions; ++i)
+      instrMap.insert(std::make_pair(instructions[i]->inst, instructions[i]));
+  }
+
+  llvm::DenseMap<const llvm::Instruction*, KInstruction *>::iterator it =
+    instrMap.find(inst);
+  return it != instrMap.end() ? it->second : NULL;
 }
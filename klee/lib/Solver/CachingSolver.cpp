@@ -17,9 +17,21 @@
 
 #include "klee/SolverStats.h"
 
+#include "QueryHasher.h"
+
+#include "llvm/Support/CommandLine.h"
+
 #include <tr1/unordered_map>
 
 using namespace klee;
+using namespace llvm;
+
+namespace {
+  cl::opt<bool>
+  CanonicalQueryCache("canonical-query-cache",
+                      cl::desc("Also look up the queries that miss the cache by a hash that ignores the names of the arrays (default=on)"),
+                      cl::init(true));
+}
 
 class CachingSolver : public SolverImpl {
 private:
@@ -62,9 +74,15 @@ private:
   typedef std::tr1::unordered_map<CacheEntry, 
                                   IncompleteSolver::PartialValidity, 
                                   CacheEntryHash> cache_map;
+
+  /// Results by canonical key, see QueryHasher
+  typedef std::tr1::unordered_map<uint64_t,
+                                  IncompleteSolver::PartialValidity> canonical_cache_map;
   
   Solver *solver;
   cache_map cache;
+  canonical_cache_map canonicalCache;
+  QueryHasher hasher;
 
 public:
   CachingSolver(Solver *s) : solver(s) {}
@@ -117,6 +135,20 @@ bool CachingSolver::cacheLookup(const Query& query,
               it->second);
     return true;
   }
+
+  if (!CanonicalQueryCache)
+    return false;
+
+  // The same query may have been asked on other arrays
+  uint64_t key = hasher.getCanonicalKey(query, negationUsed);
+  canonical_cache_map::iterator cit = canonicalCache.find(key);
+  if (cit != canonicalCache.end()) {
+    ++stats::queryCanonicalCacheHits;
+    result = (negationUsed ?
+              IncompleteSolver::negatePartialValidity(cit->second) :
+              cit->second);
+    return true;
+  }
   
   return false;
 }
@@ -132,6 +164,14 @@ void CachingSolver::cacheInsert(const Query& query,
     (negationUsed ? IncompleteSolver::negatePartialValidity(result) : result);
   
   cache.insert(std::make_pair(ce, cachedResult));
+
+  // A canonical hit may be refined by the query that got it
+  if (CanonicalQueryCache) {
+    uint64_t key = hasher.getCanonicalKey(query, negationUsed);
+    canonicalCache[key] = (negationUsed ?
+                           IncompleteSolver::negatePartialValidity(result) :
+                           result);
+  }
 }
 
 bool CachingSolver::computeValidity(const Query& query,
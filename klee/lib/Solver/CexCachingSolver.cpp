@@ -14,6 +14,7 @@
 #include "klee/SolverImpl.h"
 #include "klee/TimerStatIncrementer.h"
 #include "klee/util/Assignment.h"
+#include "klee/util/ExprBytecode.h"
 #include "klee/util/ExprUtil.h"
 #include "klee/util/ExprVisitor.h"
 #include "klee/Internal/ADT/MapOfSets.h"
@@ -37,12 +38,31 @@ namespace {
   cl::opt<bool>
   CexCacheExperimental("cex-cache-exp", cl::init(false));
 
+  cl::opt<unsigned>
+  CexCacheMaxEntries("cex-cache-max-entries",
+                     cl::desc("flush the counterexample cache when it holds more than this many constraint sets (0 = unbounded)"),
+                     cl::init(0));
+
+  cl::opt<bool>
+  CexCacheCompileExprs("cex-cache-compile-exprs",
+                       cl::desc("compile the query to bytecode before checking it against cached assignments"),
+                       cl::init(false));
+
 }
 
 ///
 
 typedef std::set< ref<Expr> > KeyType;
 
+namespace klee {
+  template<>
+  struct MapOfSetsSignature< ref<Expr> > {
+    static uint64_t get(const ref<Expr> &e) {
+      return 1ULL << (e->hash() % 64);
+    }
+  };
+}
+
 struct AssignmentLessThan {
   bool operator()(const Assignment *a, const Assignment *b) {
     return a->bindings < b->bindings;
@@ -56,9 +76,12 @@ class CexCachingSolver : public SolverImpl {
   Solver *solver;
   
   MapOfSets<ref<Expr>, Assignment*> cache;
+  unsigned cacheEntries;
   // memo table
   assignmentsTable_ty assignmentsTable;
 
+  void flushCache();
+
   bool searchForAssignment(KeyType &key, 
                            Assignment *&result);
   
@@ -72,7 +95,7 @@ class CexCachingSolver : public SolverImpl {
   bool getAssignment(const Query& query, Assignment *&result);
   
 public:
-  CexCachingSolver(Solver *_solver) : solver(_solver) {}
+  CexCachingSolver(Solver *_solver) : solver(_solver), cacheEntries(0) {}
   ~CexCachingSolver();
   
   bool computeTruth(const Query&, bool &isValid);
@@ -94,13 +117,25 @@ struct NonNullAssignment {
   bool operator()(Assignment *a) const { return a!=0; }
 };
 
+/// satisfies - Check a against the key, through the compiled program
+/// when there is one that can decide.
+static bool satisfies(Assignment *a, KeyType &key,
+                      const ExprBytecode *program) {
+  bool result;
+  if (program && program->satisfies(*a, result))
+    return result;
+  return a->satisfies(key.begin(), key.end());
+}
+
 struct NullOrSatisfyingAssignment {
   KeyType &key;
+  const ExprBytecode *program;
   
-  NullOrSatisfyingAssignment(KeyType &_key) : key(_key) {}
+  NullOrSatisfyingAssignment(KeyType &_key, const ExprBytecode *_program)
+    : key(_key), program(_program) {}
 
   bool operator()(Assignment *a) const { 
-    return !a || a->satisfies(key.begin(), key.end()); 
+    return !a || satisfies(a, key, program);
   }
 };
 
@@ -118,6 +153,11 @@ bool CexCachingSolver::searchForAssignment(KeyType &key, Assignment *&result) {
     return true;
   }
 
+  // The key is about to be checked against several assignments
+  ExprBytecode compiled, *program = 0;
+  if (CexCacheCompileExprs && compiled.add(key.begin(), key.end()))
+    program = &compiled;
+
   if (CexCacheTryAll) {
     // Look for a satisfying assignment for a superset, which is trivially an
     // assignment for any subset.
@@ -138,7 +178,7 @@ bool CexCachingSolver::searchForAssignment(KeyType &key, Assignment *&result) {
     for (assignmentsTable_ty::iterator it = assignmentsTable.begin(), 
            ie = assignmentsTable.end(); it != ie; ++it) {
       Assignment *a = *it;
-      if (a->satisfies(key.begin(), key.end())) {
+      if (satisfies(a, key, program)) {
         result = a;
         return true;
       }
@@ -156,7 +196,7 @@ bool CexCachingSolver::searchForAssignment(KeyType &key, Assignment *&result) {
     // satisfiable subsets to see if they solve the current query and return
     // them if so. This is cheap and frequently succeeds.
     if (!lookup) 
-      lookup = cache.findSubset(key, NullOrSatisfyingAssignment(key));
+      lookup = cache.findSubset(key, NullOrSatisfyingAssignment(key, program));
 
     // If either lookup succeeded, then we have a cached solution.
     if (lookup) {
@@ -195,8 +235,15 @@ bool CexCachingSolver::lookupAssignment(const Query &query,
 
 bool CexCachingSolver::getAssignment(const Query& query, Assignment *&result) {
   KeyType key;
-  if (lookupAssignment(query, key, result))
+  if (lookupAssignment(query, key, result)) {
+    ++stats::cexCacheHits;
     return true;
+  }
+
+  ++stats::cexCacheMisses;
+
+  if (CexCacheMaxEntries && cacheEntries >= CexCacheMaxEntries)
+    flushCache();
 
   std::vector<const Array*> objects;
   findSymbolicObjects(key.begin(), key.end(), objects);
@@ -228,18 +275,28 @@ bool CexCachingSolver::getAssignment(const Query& query, Assignment *&result) {
   
   result = binding;
   cache.insert(key, binding);
+  ++cacheEntries;
 
   return true;
 }
 
-///
-
-CexCachingSolver::~CexCachingSolver() {
+/// flushCache - Drop all cached constraint sets and assignments. The
+/// entries are not ordered by age, so bounding the cache is done by
+/// starting over once it is full.
+void CexCachingSolver::flushCache() {
   cache.clear();
-  delete solver;
+  cacheEntries = 0;
   for (assignmentsTable_ty::iterator it = assignmentsTable.begin(), 
          ie = assignmentsTable.end(); it != ie; ++it)
     delete *it;
+  assignmentsTable.clear();
+}
+
+///
+
+CexCachingSolver::~CexCachingSolver() {
+  flushCache();
+  delete solver;
 }
 
 bool CexCachingSolver::computeValidity(const Query& query,
@@ -12,19 +12,38 @@
 #include "klee/Constraints.h"
 #include "klee/Expr.h"
 #include "klee/IncompleteSolver.h"
+#include "klee/util/Assignment.h"
 #include "klee/util/ExprEvaluator.h"
 #include "klee/util/ExprRangeEvaluator.h"
+#include "klee/util/ExprUtil.h"
 #include "klee/util/ExprVisitor.h"
 // FIXME: Use APInt.
 #include "klee/Internal/Support/IntEvaluation.h"
 
+#include "llvm/Support/CommandLine.h"
+
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <cassert>
 #include <map>
+#include <set>
 #include <vector>
 
 using namespace klee;
+using namespace llvm;
+
+namespace {
+  cl::opt<unsigned>
+  FastCexMaxSteps("fast-cex-max-steps",
+                  cl::desc("Number of byte changes the local search may make from the seed of a query (default=64)"),
+                  cl::init(64));
+
+  cl::opt<unsigned>
+  FastCexMaxBytes("fast-cex-max-bytes",
+                  cl::desc("Number of bytes the local search tries to change at each step (default=64)"),
+                  cl::init(64));
+}
 
 /***/
 
@@ -965,6 +984,350 @@ public:
 
 /* *** */
 
+/// SeedSearch - Look for a model of a set of expressions by a local search
+/// starting from the seed of a query. Each step changes the byte that most
+/// reduces the number of unsatisfied expressions, ties being broken by how
+/// far the unsatisfied comparisons are from holding. The search only ever
+/// proves satisfiability, it gives up when no change makes progress.
+class SeedSearch {
+  typedef std::pair<const Array*, unsigned> byte_ty;
+
+  struct Target {
+    ref<Expr> expr;
+    bool value;
+    /// The bytes read at a constant index
+    std::vector<byte_ty> bytes;
+    /// The arrays read at a symbolic index
+    std::vector<const Array*> arrays;
+    /// Byte values taken from the constants of the expression
+    std::vector<unsigned char> constants;
+    uint64_t distance;
+  };
+
+  struct Cost {
+    unsigned unsatisfied;
+    uint64_t distance;
+
+    Cost() : unsatisfied(0), distance(0) {}
+
+    bool operator<(const Cost &b) const {
+      if (unsatisfied != b.unsatisfied)
+        return unsatisfied < b.unsatisfied;
+      return distance < b.distance;
+    }
+  };
+
+  const Assignment *seed;
+  Assignment assignment;
+  std::vector<Target> targets;
+  std::map<byte_ty, std::vector<unsigned> > byteReaders;
+  std::map<const Array*, std::vector<unsigned> > arrayReaders;
+  Cost cost;
+
+  static uint64_t saturatingAdd(uint64_t a, uint64_t b) {
+    return a + b < a ? ~0ULL : a + b;
+  }
+
+  static uint64_t plusOne(uint64_t a) {
+    return saturatingAdd(a, 1);
+  }
+
+  /// Return 0 if e evaluates to value under the current assignment, or how
+  /// far it is from doing so otherwise.
+  static uint64_t getDistance(AssignmentEvaluator &ev, ref<Expr> e,
+                              bool value) {
+    switch (e->getKind()) {
+    case Expr::Not:
+      return getDistance(ev, e->getKid(0), !value);
+
+    case Expr::And:
+    case Expr::Or: {
+      if (e->getWidth() != Expr::Bool)
+        break;
+      uint64_t l = getDistance(ev, e->getKid(0), value);
+      uint64_t r = getDistance(ev, e->getKid(1), value);
+      // Both kids must agree with an And that holds or an Or that fails
+      if ((e->getKind() == Expr::And) == value)
+        return saturatingAdd(l, r);
+      return std::min(l, r);
+    }
+
+    case Expr::Eq:
+    case Expr::Ult:
+    case Expr::Ule:
+    case Expr::Slt:
+    case Expr::Sle: {
+      ref<Expr> left = e->getKid(0), right = e->getKid(1);
+      if (left->getWidth() == Expr::Bool && e->getKind() == Expr::Eq) {
+        if (ConstantExpr *CE = dyn_cast<ConstantExpr>(left))
+          return getDistance(ev, right, CE->isTrue() == value);
+      }
+      if (left->getWidth() > 64)
+        break;
+
+      ConstantExpr *l = dyn_cast<ConstantExpr>(ev.visit(left));
+      ConstantExpr *r = dyn_cast<ConstantExpr>(ev.visit(right));
+      if (!l || !r)
+        break;
+
+      uint64_t a = l->getZExtValue(), b = r->getZExtValue();
+      if (e->getKind() == Expr::Slt || e->getKind() == Expr::Sle) {
+        // Flipping the sign bit maps the signed order to the unsigned one
+        uint64_t sign = 1ULL << (left->getWidth() - 1);
+        a ^= sign;
+        b ^= sign;
+      }
+
+      switch (e->getKind()) {
+      case Expr::Eq:
+        if (value)
+          return a > b ? a - b : b - a;
+        return a == b ? 1 : 0;
+      case Expr::Ult:
+        if (value)
+          return a < b ? 0 : plusOne(a - b);
+        return a >= b ? 0 : b - a;
+      default:
+        if (value)
+          return a <= b ? 0 : a - b;
+        return a > b ? 0 : plusOne(b - a);
+      }
+    }
+
+    default:
+      break;
+    }
+
+    ConstantExpr *CE = dyn_cast<ConstantExpr>(ev.visit(e));
+    return CE && CE->isTrue() == value ? 0 : 1;
+  }
+
+  static void collectConstants(ref<Expr> e, std::set<Expr*> &visited,
+                               std::set<unsigned char> &result) {
+    if (!visited.insert(e.get()).second)
+      return;
+
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(e)) {
+      if (CE->getWidth() <= 64) {
+        uint64_t v = CE->getZExtValue();
+        for (unsigned i = 0; i < CE->getWidth(); i += 8)
+          result.insert((unsigned char) (v >> i));
+      }
+      return;
+    }
+
+    for (unsigned i = 0; i < e->getNumKids(); ++i)
+      collectConstants(e->getKid(i), visited, result);
+  }
+
+  void bindArray(const Array *array) {
+    if (assignment.bindings.count(array))
+      return;
+
+    std::vector<unsigned char> values(array->size, 0);
+    if (seed) {
+      Assignment::bindings_ty::const_iterator it = seed->bindings.find(array);
+      if (it != seed->bindings.end()) {
+        for (unsigned i = 0; i < array->size && i < it->second.size(); ++i)
+          values[i] = it->second[i];
+      }
+    }
+    assignment.bindings.insert(std::make_pair(array, values));
+  }
+
+  void addTarget(ref<Expr> e, bool value) {
+    unsigned index = targets.size();
+    targets.push_back(Target());
+    Target &t = targets.back();
+    t.expr = e;
+    t.value = value;
+
+    std::vector< ref<ReadExpr> > reads;
+    findReads(e, true, reads);
+    std::set<byte_ty> bytes;
+    std::set<const Array*> arrays;
+    for (unsigned i = 0; i < reads.size(); ++i) {
+      const Array *array = reads[i]->updates.root;
+      if (array->isConstantArray())
+        continue;
+
+      bindArray(array);
+      if (ConstantExpr *CE = dyn_cast<ConstantExpr>(reads[i]->index)) {
+        uint64_t offset = CE->getZExtValue();
+        if (offset < array->size)
+          bytes.insert(byte_ty(array, offset));
+      } else {
+        arrays.insert(array);
+      }
+    }
+
+    t.bytes.assign(bytes.begin(), bytes.end());
+    t.arrays.assign(arrays.begin(), arrays.end());
+    for (unsigned i = 0; i < t.bytes.size(); ++i)
+      byteReaders[t.bytes[i]].push_back(index);
+    for (unsigned i = 0; i < t.arrays.size(); ++i)
+      arrayReaders[t.arrays[i]].push_back(index);
+
+    std::set<Expr*> visited;
+    std::set<unsigned char> constants;
+    collectConstants(e, visited, constants);
+    t.constants.assign(constants.begin(), constants.end());
+  }
+
+  uint64_t evaluate(const Target &t) {
+    AssignmentEvaluator ev(assignment);
+    return getDistance(ev, t.expr, t.value);
+  }
+
+  void getReaders(const byte_ty &byte, std::vector<unsigned> &result) {
+    result.clear();
+    std::map<byte_ty, std::vector<unsigned> >::iterator bit =
+      byteReaders.find(byte);
+    if (bit != byteReaders.end())
+      result = bit->second;
+    std::map<const Array*, std::vector<unsigned> >::iterator ait =
+      arrayReaders.find(byte.first);
+    if (ait != arrayReaders.end())
+      result.insert(result.end(), ait->second.begin(), ait->second.end());
+  }
+
+  /// Set byte to value and return the resulting cost. The distances of the
+  /// targets are updated only if commit is set.
+  Cost tryValue(const byte_ty &byte, unsigned char value,
+                const std::vector<unsigned> &readers, bool commit) {
+    unsigned char &slot = assignment.bindings[byte.first][byte.second];
+    unsigned char old = slot;
+    slot = value;
+
+    Cost c = cost;
+    for (unsigned i = 0; i < readers.size(); ++i) {
+      Target &t = targets[readers[i]];
+      uint64_t d = evaluate(t);
+      c.unsatisfied += (d != 0) - (t.distance != 0);
+      // Saturated sums are only approximate, the model is checked anyway
+      c.distance = saturatingAdd(c.distance - t.distance, d);
+      if (commit)
+        t.distance = d;
+    }
+
+    if (!commit)
+      slot = old;
+    return c;
+  }
+
+  void getCandidates(std::vector<byte_ty> &bytes,
+                     std::vector<unsigned char> &values) {
+    std::set<byte_ty> seenBytes;
+    std::set<unsigned char> seenValues;
+    for (unsigned i = 0; i < targets.size(); ++i) {
+      const Target &t = targets[i];
+      if (!t.distance)
+        continue;
+
+      for (unsigned j = 0; j < t.bytes.size(); ++j)
+        if (seenBytes.insert(t.bytes[j]).second)
+          bytes.push_back(t.bytes[j]);
+      for (unsigned j = 0; j < t.arrays.size(); ++j)
+        for (unsigned k = 0; k < t.arrays[j]->size; ++k)
+          if (seenBytes.insert(byte_ty(t.arrays[j], k)).second)
+            bytes.push_back(byte_ty(t.arrays[j], k));
+      for (unsigned j = 0; j < t.constants.size(); ++j)
+        seenValues.insert(t.constants[j]);
+    }
+
+    if (bytes.size() > FastCexMaxBytes)
+      bytes.resize(FastCexMaxBytes);
+    values.assign(seenValues.begin(), seenValues.end());
+  }
+
+public:
+  SeedSearch(const Query &query, bool checkExpr)
+    : seed(query.seed), assignment(false) {
+    for (ConstraintManager::const_iterator it = query.constraints.begin(),
+           ie = query.constraints.end(); it != ie; ++it)
+      addTarget(*it, true);
+    if (checkExpr)
+      addTarget(query.expr, false);
+  }
+
+  bool solve() {
+    for (unsigned i = 0; i < targets.size(); ++i) {
+      targets[i].distance = evaluate(targets[i]);
+      if (targets[i].distance)
+        ++cost.unsatisfied;
+      cost.distance = saturatingAdd(cost.distance, targets[i].distance);
+    }
+
+    std::vector<unsigned> readers;
+    for (unsigned step = 0; cost.unsatisfied && step < FastCexMaxSteps;
+         ++step) {
+      std::vector<byte_ty> bytes;
+      std::vector<unsigned char> constants;
+      getCandidates(bytes, constants);
+
+      Cost best = cost;
+      byte_ty bestByte;
+      unsigned char bestValue = 0;
+      for (unsigned i = 0; i < bytes.size(); ++i) {
+        unsigned char v = assignment.bindings[bytes[i].first][bytes[i].second];
+        std::vector<unsigned char> values(constants);
+        for (unsigned bit = 0; bit < 8; ++bit)
+          values.push_back(v ^ (1 << bit));
+        values.push_back(v + 1);
+        values.push_back(v - 1);
+        values.push_back(0);
+        values.push_back(0xff);
+
+        getReaders(bytes[i], readers);
+        for (unsigned j = 0; j < values.size(); ++j) {
+          if (values[j] == v)
+            continue;
+          Cost c = tryValue(bytes[i], values[j], readers, false);
+          if (c < best) {
+            best = c;
+            bestByte = bytes[i];
+            bestValue = values[j];
+          }
+        }
+      }
+
+      if (!(best < cost))
+        return false;
+
+      getReaders(bestByte, readers);
+      cost = tryValue(bestByte, bestValue, readers, true);
+    }
+
+    if (cost.unsatisfied)
+      return false;
+
+    // The distances are only a guide, check the model for real
+    for (unsigned i = 0; i < targets.size(); ++i) {
+      ref<Expr> v = assignment.evaluate(targets[i].expr);
+      ConstantExpr *CE = dyn_cast<ConstantExpr>(v);
+      if (!CE || CE->isTrue() != targets[i].value)
+        return false;
+    }
+    return true;
+  }
+
+  ref<Expr> evaluate(ref<Expr> e) const {
+    return assignment.evaluate(e);
+  }
+
+  /// Return the values of the objects in the model. The objects that no
+  /// expression reads keep the values of the seed.
+  void getValues(const std::vector<const Array*> &objects,
+                 std::vector< std::vector<unsigned char> > &values) {
+    for (unsigned i = 0; i != objects.size(); ++i) {
+      bindArray(objects[i]);
+      values.push_back(assignment.bindings[objects[i]]);
+    }
+  }
+};
+
+/* *** */
+
 
 class FastCexSolver : public IncompleteSolver {
 public:
@@ -1049,6 +1412,9 @@ static bool propogateValues(const Query& query, CexData &cd,
 
 IncompleteSolver::PartialValidity 
 FastCexSolver::computeTruth(const Query& query) {
+  if (query.seed && SeedSearch(query, true).solve())
+    return IncompleteSolver::MayBeFalse;
+
   CexData cd;
 
   bool isValid;
@@ -1061,6 +1427,17 @@ FastCexSolver::computeTruth(const Query& query) {
 }
 
 bool FastCexSolver::computeValue(const Query& query, ref<Expr> &result) {
+  if (query.seed) {
+    SeedSearch search(query, false);
+    if (search.solve()) {
+      ref<Expr> value = search.evaluate(query.expr);
+      if (isa<ConstantExpr>(value)) {
+        result = value;
+        return true;
+      }
+    }
+  }
+
   CexData cd;
 
   bool isValid;
@@ -1093,6 +1470,15 @@ FastCexSolver::computeInitialValues(const Query& query,
                                     std::vector< std::vector<unsigned char> >
                                       &values,
                                     bool &hasSolution) {
+  if (query.seed) {
+    SeedSearch search(query, true);
+    if (search.solve()) {
+      search.getValues(objects, values);
+      hasSolution = true;
+      return true;
+    }
+  }
+
   CexData cd;
 
   bool isValid;
@@ -1136,3 +1522,14 @@ FastCexSolver::computeInitialValues(const Query& query,
 Solver *klee::createFastCexSolver(Solver *s) {
   return new Solver(new StagedSolverImpl(new FastCexSolver(), s));
 }
+
+std::pair<uint64_t, uint64_t> klee::getConservativeRange(ref<Expr> e) {
+  if (e->getWidth() > 64)
+    return std::make_pair(1, 0);
+
+  std::map<const Array*, CexObjectData*> objects;
+  ValueRange range = CexRangeEvaluator(objects).evaluate(e);
+  if (range.isEmpty())
+    return std::make_pair(1, 0);
+  return std::make_pair(range.min(), range.max());
+}
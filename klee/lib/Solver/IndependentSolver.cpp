@@ -12,9 +12,12 @@
 #include "klee/Expr.h"
 #include "klee/Constraints.h"
 #include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
 
 #include "klee/util/ExprUtil.h"
 
+#include "llvm/Support/CommandLine.h"
+
 #include <map>
 #include <vector>
 #include <ostream>
@@ -23,6 +26,13 @@
 using namespace klee;
 using namespace llvm;
 
+namespace {
+  cl::opt<bool>
+  IncrementalIndependence("incremental-independence",
+                          cl::desc("Use the constraint partition kept by the constraint manager instead of recomputing the independence closure on each query"),
+                          cl::init(false));
+}
+
 template<class T>
 class DenseSet {
   typedef std::set<T> set_ty;
@@ -265,6 +275,18 @@ IndependentElementSet getIndependentConstraints(const Query& query,
   return eltsClosure;
 }
 
+static void getRequiredConstraints(const Query& query,
+                                   std::vector< ref<Expr> > &result) {
+  if (IncrementalIndependence)
+    query.constraints.getRelatedConstraints(query.expr, result);
+  else
+    getIndependentConstraints(query, result);
+
+  ++stats::independentQueries;
+  if (result.size() < query.constraints.size())
+    ++stats::independentQueriesReduced;
+}
+
 class IndependentSolver : public SolverImpl {
 private:
   Solver *solver;
@@ -289,28 +311,26 @@ public:
 bool IndependentSolver::computeValidity(const Query& query,
                                         Solver::Validity &result) {
   std::vector< ref<Expr> > required;
-  IndependentElementSet eltsClosure =
-    getIndependentConstraints(query, required);
+  getRequiredConstraints(query, required);
   ConstraintManager tmp(required);
-  return solver->impl->computeValidity(Query(tmp, query.expr), 
+  return solver->impl->computeValidity(Query(tmp, query.expr, query.seed),
                                        result);
 }
 
 bool IndependentSolver::computeTruth(const Query& query, bool &isValid) {
   std::vector< ref<Expr> > required;
-  IndependentElementSet eltsClosure = 
-    getIndependentConstraints(query, required);
+  getRequiredConstraints(query, required);
   ConstraintManager tmp(required);
-  return solver->impl->computeTruth(Query(tmp, query.expr), 
+  return solver->impl->computeTruth(Query(tmp, query.expr, query.seed),
                                     isValid);
 }
 
 bool IndependentSolver::computeValue(const Query& query, ref<Expr> &result) {
   std::vector< ref<Expr> > required;
-  IndependentElementSet eltsClosure = 
-    getIndependentConstraints(query, required);
+  getRequiredConstraints(query, required);
   ConstraintManager tmp(required);
-  return solver->impl->computeValue(Query(tmp, query.expr), result);
+  return solver->impl->computeValue(Query(tmp, query.expr, query.seed),
+                                    result);
 }
 
 Solver *klee::createIndependentSolver(Solver *s) {
@@ -0,0 +1,676 @@
+//===-- KnownBitsSolver.cpp -----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/IncompleteSolver.h"
+#include "klee/SolverStats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+using namespace klee;
+
+/***/
+
+namespace {
+
+static uint64_t widthMask(unsigned width) {
+  return width >= 64 ? ~0ULL : (1ULL << width) - 1;
+}
+
+static unsigned countTrailingOnes(uint64_t v) {
+  unsigned n = 0;
+  while (n < 64 && (v & (1ULL << n)))
+    ++n;
+  return n;
+}
+
+/// Abstract value of an expression of at most 64 bits: the bits known
+/// to be zero or one, and an unsigned range. Wider expressions are
+/// not tracked and always unknown.
+struct KnownBits {
+  Expr::Width width;
+  uint64_t zeros, ones;
+  uint64_t min, max;
+
+  bool isTracked() const { return width <= 64; }
+
+  bool isEmpty() const {
+    return isTracked() && ((zeros & ones) || min > max);
+  }
+
+  bool isConstant() const {
+    return isTracked() && (zeros | ones) == widthMask(width);
+  }
+
+  uint64_t getConstant() const {
+    assert(isConstant());
+    return ones;
+  }
+
+  bool signKnown() const {
+    return (zeros | ones) & (1ULL << (width - 1));
+  }
+
+  bool signBit() const {
+    return ones & (1ULL << (width - 1));
+  }
+
+  static KnownBits top(Expr::Width w) {
+    KnownBits kb;
+    kb.width = w;
+    kb.zeros = kb.ones = 0;
+    kb.min = 0;
+    kb.max = widthMask(w);
+    return kb;
+  }
+
+  static KnownBits constant(uint64_t v, Expr::Width w) {
+    KnownBits kb;
+    kb.width = w;
+    kb.ones = kb.min = kb.max = v & widthMask(w);
+    kb.zeros = ~v & widthMask(w);
+    return kb;
+  }
+
+  static KnownBits fromBits(uint64_t zeros, uint64_t ones, Expr::Width w) {
+    KnownBits kb = top(w);
+    kb.zeros = zeros & widthMask(w);
+    kb.ones = ones & widthMask(w);
+    kb.normalize();
+    return kb;
+  }
+
+  static KnownBits fromRange(uint64_t min, uint64_t max, Expr::Width w) {
+    KnownBits kb = top(w);
+    kb.min = min;
+    kb.max = max;
+    kb.normalize();
+    return kb;
+  }
+
+  /// Make the bits and the range agree with each other
+  void normalize() {
+    if (!isTracked())
+      return;
+
+    uint64_t mask = widthMask(width);
+    if (min < ones)
+      min = ones;
+    if (max > (mask & ~zeros))
+      max = mask & ~zeros;
+    if (min > max)
+      return;
+
+    // The bits above the highest bit in which min and max differ
+    // are the same for all the values of the range
+    uint64_t diff = min ^ max;
+    uint64_t prefix = mask;
+    while (diff) {
+      prefix <<= 1;
+      diff >>= 1;
+    }
+    prefix &= mask;
+    zeros |= prefix & ~min;
+    ones |= prefix & min;
+  }
+
+  /// Values in both this and kb
+  void meet(const KnownBits &kb) {
+    zeros |= kb.zeros;
+    ones |= kb.ones;
+    if (kb.min > min)
+      min = kb.min;
+    if (kb.max < max)
+      max = kb.max;
+    normalize();
+  }
+
+  /// Values in either this or kb
+  void join(const KnownBits &kb) {
+    zeros &= kb.zeros;
+    ones &= kb.ones;
+    if (kb.min < min)
+      min = kb.min;
+    if (kb.max > max)
+      max = kb.max;
+    normalize();
+  }
+};
+
+/// Propagates known bits and ranges through expressions. The bytes of
+/// the symbolic arrays are unknown, unless the constraints restrict them.
+class KnownBitsEvaluator {
+  typedef std::pair<const Array*, unsigned> byte_ty;
+  std::map<byte_ty, KnownBits> facts;
+  std::map<const Expr*, KnownBits> cache;
+
+  static bool getByte(const Expr *e, byte_ty &byte) {
+    const ReadExpr *re = dyn_cast<ReadExpr>(e);
+    if (!re || re->getWidth() != Expr::Int8 || re->updates.head ||
+        re->updates.root->isConstantArray())
+      return false;
+
+    const ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index);
+    if (!CE)
+      return false;
+
+    byte = byte_ty(re->updates.root, CE->getZExtValue(32));
+    return true;
+  }
+
+  bool addFact(const byte_ty &byte, const KnownBits &kb) {
+    std::map<byte_ty, KnownBits>::iterator it = facts.find(byte);
+    if (it == facts.end())
+      it = facts.insert(std::make_pair(byte, KnownBits::top(Expr::Int8))).first;
+    it->second.meet(kb);
+    return !it->second.isEmpty();
+  }
+
+  /// Bound the byte read by e if it is compared with a constant.
+  /// lessThan is true for e < c (or e <= c if orEqual), false for c < e.
+  bool addBound(ref<Expr> e, ref<Expr> c, bool lessThan, bool orEqual) {
+    byte_ty byte;
+    const ConstantExpr *CE = dyn_cast<ConstantExpr>(c);
+    if (!CE || !getByte(e.get(), byte))
+      return true;
+
+    uint64_t v = CE->getZExtValue();
+    if (lessThan) {
+      if (!orEqual && v == 0)
+        return false;
+      return addFact(byte, KnownBits::fromRange(0, orEqual ? v : v - 1,
+                                                Expr::Int8));
+    }
+
+    if (!orEqual && v == 0xff)
+      return false;
+    return addFact(byte, KnownBits::fromRange(orEqual ? v : v + 1, 0xff,
+                                              Expr::Int8));
+  }
+
+public:
+  /// Restrict the array bytes with the constraint e, known to have the
+  /// given value. Returns false if the constraints are contradictory.
+  bool addConstraint(ref<Expr> e, bool value) {
+    switch (e->getKind()) {
+    case Expr::And:
+      if (value) {
+        BinaryExpr *be = cast<BinaryExpr>(e);
+        return addConstraint(be->left, true) && addConstraint(be->right, true);
+      }
+      return true;
+
+    case Expr::Or:
+      if (!value) {
+        BinaryExpr *be = cast<BinaryExpr>(e);
+        return addConstraint(be->left, false) && addConstraint(be->right, false);
+      }
+      return true;
+
+    case Expr::Eq: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      const ConstantExpr *CE = dyn_cast<ConstantExpr>(be->left);
+      if (!CE)
+        return true;
+
+      if (CE->getWidth() == Expr::Bool)
+        return addConstraint(be->right, CE->isTrue() == value);
+
+      byte_ty byte;
+      if (!getByte(be->right.get(), byte))
+        return true;
+
+      uint64_t v = CE->getZExtValue();
+      if (value)
+        return addFact(byte, KnownBits::constant(v, Expr::Int8));
+
+      // Only the ends of the range can exclude a value
+      KnownBits &kb = facts.insert(std::make_pair(byte,
+                                     KnownBits::top(Expr::Int8))).first->second;
+      if (kb.min == v && kb.min < kb.max)
+        ++kb.min;
+      else if (kb.max == v && kb.min < kb.max)
+        --kb.max;
+      else if (kb.min == v)
+        return false;
+      kb.normalize();
+      return !kb.isEmpty();
+    }
+
+    case Expr::Ult: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      if (value)
+        return addBound(be->left, be->right, true, false) &&
+               addBound(be->right, be->left, false, false);
+      return addBound(be->left, be->right, false, true) &&
+             addBound(be->right, be->left, true, true);
+    }
+
+    case Expr::Ule: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      if (value)
+        return addBound(be->left, be->right, true, true) &&
+               addBound(be->right, be->left, false, true);
+      return addBound(be->left, be->right, false, false) &&
+             addBound(be->right, be->left, true, false);
+    }
+
+    default:
+      return true;
+    }
+  }
+
+  KnownBits evaluate(ref<Expr> e) {
+    std::map<const Expr*, KnownBits>::iterator it = cache.find(e.get());
+    if (it != cache.end())
+      return it->second;
+
+    KnownBits kb = evaluateActual(e);
+    cache.insert(std::make_pair(e.get(), kb));
+    return kb;
+  }
+
+private:
+  static KnownBits boolean(bool mustBeTrue, bool mustBeFalse) {
+    if (mustBeTrue)
+      return KnownBits::constant(1, Expr::Bool);
+    if (mustBeFalse)
+      return KnownBits::constant(0, Expr::Bool);
+    return KnownBits::top(Expr::Bool);
+  }
+
+  static KnownBits compareUnsigned(const KnownBits &a, const KnownBits &b,
+                                   bool orEqual) {
+    if (orEqual)
+      return boolean(a.max <= b.min, a.min > b.max);
+    return boolean(a.max < b.min, a.min >= b.max);
+  }
+
+  static KnownBits compareSigned(const KnownBits &a, const KnownBits &b,
+                                 bool orEqual) {
+    if (!a.signKnown() || !b.signKnown())
+      return KnownBits::top(Expr::Bool);
+
+    // A negative value is less than any non-negative one, the
+    // unsigned order holds between values of the same sign
+    if (a.signBit() != b.signBit())
+      return boolean(a.signBit(), b.signBit());
+    return compareUnsigned(a, b, orEqual);
+  }
+
+  static KnownBits equal(const KnownBits &a, const KnownBits &b) {
+    if (a.isConstant() && b.isConstant())
+      return boolean(a.getConstant() == b.getConstant(),
+                     a.getConstant() != b.getConstant());
+    bool differ = (a.ones & b.zeros) || (a.zeros & b.ones) ||
+                  a.max < b.min || b.max < a.min;
+    return boolean(false, differ);
+  }
+
+  static KnownBits negate(const KnownBits &kb) {
+    KnownBits res = kb;
+    uint64_t mask = widthMask(kb.width);
+    res.zeros = kb.ones;
+    res.ones = kb.zeros;
+    res.min = mask - kb.max;
+    res.max = mask - kb.min;
+    return res;
+  }
+
+  /// Bits of a + b (or a - b) up to the first unknown bit of either
+  static uint64_t knownLowBits(const KnownBits &a, const KnownBits &b) {
+    return widthMask(std::min(countTrailingOnes(a.zeros | a.ones),
+                              countTrailingOnes(b.zeros | b.ones)));
+  }
+
+  KnownBits evaluateActual(ref<Expr> e) {
+    Expr::Width width = e->getWidth();
+    if (width > 64)
+      return KnownBits::top(width);
+
+    uint64_t mask = widthMask(width);
+
+    switch (e->getKind()) {
+    case Expr::Constant:
+      return KnownBits::constant(cast<ConstantExpr>(e)->getZExtValue(), width);
+
+    case Expr::NotOptimized:
+      return evaluate(cast<NotOptimizedExpr>(e)->src);
+
+    case Expr::Read: {
+      ReadExpr *re = cast<ReadExpr>(e);
+      const Array *array = re->updates.root;
+      const ConstantExpr *CE = dyn_cast<ConstantExpr>(re->index);
+      if (!CE || re->updates.head)
+        return KnownBits::top(width);
+
+      uint64_t index = CE->getZExtValue();
+      if (array->isConstantArray())
+        return index < array->size ?
+          KnownBits::constant(array->constantValues[index]->getZExtValue(),
+                              width) :
+          KnownBits::top(width);
+
+      std::map<byte_ty, KnownBits>::iterator it =
+        facts.find(byte_ty(array, index));
+      return it != facts.end() ? it->second : KnownBits::top(width);
+    }
+
+    case Expr::Select: {
+      SelectExpr *se = cast<SelectExpr>(e);
+      KnownBits cond = evaluate(se->cond);
+      if (cond.isConstant())
+        return evaluate(cond.getConstant() ? se->trueExpr : se->falseExpr);
+
+      KnownBits kb = evaluate(se->trueExpr);
+      kb.join(evaluate(se->falseExpr));
+      return kb;
+    }
+
+    case Expr::Concat: {
+      ConcatExpr *ce = cast<ConcatExpr>(e);
+      KnownBits l = evaluate(ce->getLeft()), r = evaluate(ce->getRight());
+      unsigned shift = r.width;
+      KnownBits kb = KnownBits::top(width);
+      kb.zeros = (l.zeros << shift) | r.zeros;
+      kb.ones = (l.ones << shift) | r.ones;
+      kb.min = (l.min << shift) | r.min;
+      kb.max = (l.max << shift) | r.max;
+      kb.normalize();
+      return kb;
+    }
+
+    case Expr::Extract: {
+      ExtractExpr *ee = cast<ExtractExpr>(e);
+      KnownBits kb = evaluate(ee->expr);
+      if (!kb.isTracked())
+        return KnownBits::top(width);
+      KnownBits res = KnownBits::fromBits(kb.zeros >> ee->offset,
+                                          kb.ones >> ee->offset, width);
+      if (ee->offset == 0 && kb.max <= mask)
+        res.meet(KnownBits::fromRange(kb.min, kb.max, width));
+      return res;
+    }
+
+    case Expr::ZExt: {
+      KnownBits kb = evaluate(cast<CastExpr>(e)->src);
+      if (!kb.isTracked())
+        return KnownBits::top(width);
+      kb.zeros |= mask & ~widthMask(kb.width);
+      kb.width = width;
+      return kb;
+    }
+
+    case Expr::SExt: {
+      KnownBits kb = evaluate(cast<CastExpr>(e)->src);
+      if (!kb.isTracked())
+        return KnownBits::top(width);
+      uint64_t upper = mask & ~widthMask(kb.width);
+      uint64_t zeros = kb.zeros, ones = kb.ones;
+      if (kb.signKnown()) {
+        if (kb.signBit())
+          ones |= upper;
+        else
+          zeros |= upper;
+      }
+      return KnownBits::fromBits(zeros, ones, width);
+    }
+
+    case Expr::Add:
+    case Expr::Sub: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      KnownBits a = evaluate(be->left), b = evaluate(be->right);
+      if (!a.isTracked() || !b.isTracked())
+        return KnownBits::top(width);
+
+      KnownBits kb = KnownBits::top(width);
+      uint64_t low = knownLowBits(a, b);
+      uint64_t value;
+      if (e->getKind() == Expr::Add) {
+        value = a.ones + b.ones;
+        if (a.max <= mask - b.max) {
+          kb.min = a.min + b.min;
+          kb.max = a.max + b.max;
+        }
+      } else {
+        value = a.ones - b.ones;
+        if (a.min >= b.max) {
+          kb.min = a.min - b.max;
+          kb.max = a.max - b.min;
+        }
+      }
+      kb.zeros = ~value & low;
+      kb.ones = value & low;
+      kb.normalize();
+      return kb;
+    }
+
+    case Expr::Mul: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      KnownBits a = evaluate(be->left), b = evaluate(be->right);
+      if (!a.isTracked() || !b.isTracked())
+        return KnownBits::top(width);
+
+      KnownBits kb = KnownBits::top(width);
+      uint64_t low = knownLowBits(a, b);
+      uint64_t value = a.ones * b.ones;
+      kb.zeros = (~value & low) |
+        widthMask(countTrailingOnes(a.zeros) + countTrailingOnes(b.zeros));
+      kb.ones = value & low;
+      if (b.max == 0 || a.max <= mask / b.max) {
+        kb.min = a.min * b.min;
+        kb.max = a.max * b.max;
+      }
+      kb.zeros &= mask;
+      kb.normalize();
+      return kb;
+    }
+
+    case Expr::UDiv: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      KnownBits a = evaluate(be->left), b = evaluate(be->right);
+      if (!a.isTracked() || !b.isTracked() || b.min == 0)
+        return KnownBits::top(width);
+      return KnownBits::fromRange(a.min / b.max, a.max / b.min, width);
+    }
+
+    case Expr::URem: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      KnownBits a = evaluate(be->left), b = evaluate(be->right);
+      if (!a.isTracked() || !b.isTracked() || b.min == 0)
+        return KnownBits::top(width);
+      if (a.max < b.min)
+        return a;
+      return KnownBits::fromRange(0, std::min(a.max, b.max - 1), width);
+    }
+
+    case Expr::Not: {
+      KnownBits kb = evaluate(cast<NotExpr>(e)->expr);
+      if (!kb.isTracked())
+        return KnownBits::top(width);
+      return negate(kb);
+    }
+
+    case Expr::And:
+    case Expr::Or:
+    case Expr::Xor: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      KnownBits a = evaluate(be->left), b = evaluate(be->right);
+      if (!a.isTracked() || !b.isTracked())
+        return KnownBits::top(width);
+
+      KnownBits kb = KnownBits::top(width);
+      if (e->getKind() == Expr::And) {
+        kb.zeros = a.zeros | b.zeros;
+        kb.ones = a.ones & b.ones;
+        kb.max = std::min(a.max, b.max);
+      } else if (e->getKind() == Expr::Or) {
+        kb.zeros = a.zeros & b.zeros;
+        kb.ones = a.ones | b.ones;
+        kb.min = std::max(a.min, b.min);
+      } else {
+        uint64_t known = (a.zeros | a.ones) & (b.zeros | b.ones);
+        kb.ones = ((a.ones & b.zeros) | (a.zeros & b.ones)) & known;
+        kb.zeros = known & ~kb.ones;
+      }
+      kb.normalize();
+      return kb;
+    }
+
+    case Expr::Shl:
+    case Expr::LShr:
+    case Expr::AShr: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      KnownBits a = evaluate(be->left), b = evaluate(be->right);
+      if (!a.isTracked() || !b.isConstant() || b.getConstant() >= width)
+        return KnownBits::top(width);
+
+      unsigned shift = b.getConstant();
+      if (e->getKind() == Expr::Shl) {
+        KnownBits kb = KnownBits::fromBits((a.zeros << shift) | widthMask(shift),
+                                           a.ones << shift, width);
+        if (a.max <= (mask >> shift)) {
+          kb.meet(KnownBits::fromRange(a.min << shift, a.max << shift, width));
+        }
+        return kb;
+      }
+
+      uint64_t upper = mask & ~(mask >> shift);
+      uint64_t zeros = a.zeros >> shift, ones = a.ones >> shift;
+      if (e->getKind() == Expr::LShr || (a.signKnown() && !a.signBit())) {
+        KnownBits kb = KnownBits::fromBits(zeros | upper, ones, width);
+        kb.meet(KnownBits::fromRange(a.min >> shift, a.max >> shift, width));
+        return kb;
+      }
+      if (a.signKnown())
+        ones |= upper;
+      return KnownBits::fromBits(zeros, ones, width);
+    }
+
+    case Expr::Eq:
+    case Expr::Ne: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      KnownBits a = evaluate(be->left), b = evaluate(be->right);
+      if (!a.isTracked() || !b.isTracked())
+        return KnownBits::top(width);
+      KnownBits kb = equal(a, b);
+      return e->getKind() == Expr::Eq ? kb : negate(kb);
+    }
+
+    case Expr::Ult:
+    case Expr::Ule:
+    case Expr::Ugt:
+    case Expr::Uge:
+    case Expr::Slt:
+    case Expr::Sle:
+    case Expr::Sgt:
+    case Expr::Sge: {
+      BinaryExpr *be = cast<BinaryExpr>(e);
+      KnownBits a = evaluate(be->left), b = evaluate(be->right);
+      if (!a.isTracked() || !b.isTracked())
+        return KnownBits::top(width);
+
+      switch (e->getKind()) {
+      case Expr::Ult: return compareUnsigned(a, b, false);
+      case Expr::Ule: return compareUnsigned(a, b, true);
+      case Expr::Ugt: return compareUnsigned(b, a, false);
+      case Expr::Uge: return compareUnsigned(b, a, true);
+      case Expr::Slt: return compareSigned(a, b, false);
+      case Expr::Sle: return compareSigned(a, b, true);
+      case Expr::Sgt: return compareSigned(b, a, false);
+      default:        return compareSigned(b, a, true);
+      }
+    }
+
+    default:
+      return KnownBits::top(width);
+    }
+  }
+};
+
+}
+
+/***/
+
+/// KnownBitsSolver - Decides the queries whose expression is determined
+/// by the bits and ranges of its operands, such as the flags computed on a
+/// few symbolic bytes. The constraints only restrict the bytes that they
+/// compare with constants. The other queries go to the next solver.
+class KnownBitsSolver : public IncompleteSolver {
+  /// Evaluate the query expression, returns false if it is not constant
+  bool evaluate(const Query &query, uint64_t &value);
+
+public:
+  KnownBitsSolver() {}
+
+  IncompleteSolver::PartialValidity computeValidity(const Query&);
+  IncompleteSolver::PartialValidity computeTruth(const Query&);
+  bool computeValue(const Query&, ref<Expr> &result);
+  bool computeInitialValues(const Query&,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    return false;
+  }
+};
+
+bool KnownBitsSolver::evaluate(const Query &query, uint64_t &value) {
+  KnownBitsEvaluator evaluator;
+
+  for (ConstraintManager::const_iterator it = query.constraints.begin(),
+         ie = query.constraints.end(); it != ie; ++it) {
+    if (!evaluator.addConstraint(*it, true)) {
+      ++stats::knownBitsMisses;
+      return false;
+    }
+  }
+
+  KnownBits kb = evaluator.evaluate(query.expr);
+  if (!kb.isConstant()) {
+    ++stats::knownBitsMisses;
+    return false;
+  }
+
+  ++stats::knownBitsHits;
+  value = kb.getConstant();
+  return true;
+}
+
+IncompleteSolver::PartialValidity
+KnownBitsSolver::computeValidity(const Query& query) {
+  uint64_t value;
+  if (!evaluate(query, value))
+    return IncompleteSolver::None;
+  return value ? IncompleteSolver::MustBeTrue : IncompleteSolver::MustBeFalse;
+}
+
+IncompleteSolver::PartialValidity
+KnownBitsSolver::computeTruth(const Query& query) {
+  uint64_t value;
+  if (!evaluate(query, value))
+    return IncompleteSolver::None;
+  return value ? IncompleteSolver::MustBeTrue : IncompleteSolver::MayBeFalse;
+}
+
+bool KnownBitsSolver::computeValue(const Query& query, ref<Expr> &result) {
+  uint64_t value;
+  if (!evaluate(query, value))
+    return false;
+  result = ConstantExpr::create(value, query.expr->getWidth());
+  return true;
+}
+
+Solver *klee::createKnownBitsSolver(Solver *s) {
+  return new Solver(new StagedSolverImpl(new KnownBitsSolver(), s));
+}
@@ -29,11 +29,18 @@ using namespace klee::util;
 
 llvm::raw_ostream *g_solverLog = NULL;
 
+static int g_solverLogStateId = -1;
+
+void klee::setPCLoggingStateId(int id) {
+  g_solverLogStateId = id;
+}
+
 class PCLoggingSolver : public SolverImpl {
   Solver *solver;
   std::ofstream os;
   ExprPPrinter *printer;
   unsigned queryCount;
+  double creationTime;
   double startTime;
 
   void startQuery(const Query& query, const char *typeName,
@@ -45,7 +52,9 @@ class PCLoggingSolver : public SolverImpl {
     uint64_t instructions = S ? S->getValue() : 0;
     os << "# Query " << queryCount++ << " -- "
        << "Type: " << typeName << ", "
-       << "Instructions: " << instructions << "\n";
+       << "Instructions: " << instructions << ", "
+       << "State: " << g_solverLogStateId << ", "
+       << "Time: " << (getWallTime() - creationTime) << "\n";
     llvm::raw_os_ostream ros(os);
     printer->printQuery(ros, query.constraints, query.expr,
                         evalExprsBegin, evalExprsEnd,
@@ -66,7 +75,8 @@ public:
   : solver(_solver),
     os(path.c_str(), std::ios::trunc),
     printer(ExprPPrinter::create(os)),
-    queryCount(0) {
+    queryCount(0),
+    creationTime(getWallTime()) {
       g_solverLog = new llvm::raw_os_ostream(os);
   }                                                      
   ~PCLoggingSolver() {
@@ -0,0 +1,144 @@
+//===-- QueryHasher.cpp ---------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "QueryHasher.h"
+
+#include "klee/Constraints.h"
+#include "klee/Solver.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace klee;
+
+static uint64_t mix(uint64_t h, uint64_t v) {
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  return h * 1099511628211ULL;
+}
+
+static bool isCommutative(Expr::Kind k) {
+  switch (k) {
+  case Expr::Add:
+  case Expr::Mul:
+  case Expr::And:
+  case Expr::Or:
+  case Expr::Xor:
+  case Expr::Eq:
+  case Expr::Ne:
+    return true;
+  default:
+    return false;
+  }
+}
+
+uint64_t QueryHasher::hashArray(const Array *array) {
+  uint64_t res = 14695981039346656037ULL;
+
+  if (array->isSymbolicArray()) {
+    std::pair<ArrayIds::iterator, bool> ins =
+      arrayIds.insert(std::make_pair(array, (unsigned) arrayIds.size()));
+    res = mix(res, ins.first->second);
+  }
+
+  res = mix(res, array->size);
+  for (unsigned i = 0, e = array->constantValues.size(); i != e; ++i)
+    res = mix(res, hash(array->constantValues[i]));
+  return res;
+}
+
+uint64_t QueryHasher::hashUpdates(const UpdateList &ul) {
+  uint64_t res = hashArray(ul.root);
+
+  // Walk the list once to find the first cached node
+  std::vector<const UpdateNode*> pending;
+  const UpdateNode *un = ul.head;
+  uint64_t tail = 0;
+  for (; un; un = un->next) {
+    UpdateHashes::iterator it = updateHashes.find(un);
+    if (it != updateHashes.end()) {
+      tail = it->second;
+      break;
+    }
+    pending.push_back(un);
+  }
+
+  for (unsigned i = pending.size(); i > 0; --i) {
+    const UpdateNode *n = pending[i - 1];
+    tail = mix(mix(tail, hash(n->index)), hash(n->value));
+    updateHashes[n] = tail;
+  }
+
+  return mix(res, tail);
+}
+
+uint64_t QueryHasher::hash(const ref<Expr> &e) {
+  ExprHashes::iterator it = exprHashes.find(e.get());
+  if (it != exprHashes.end())
+    return it->second;
+
+  uint64_t res = mix(e->getKind(), e->getWidth());
+
+  if (ConstantExpr *ce = dyn_cast<ConstantExpr>(e)) {
+    const llvm::APInt &v = ce->getAPValue();
+    for (unsigned i = 0, e = v.getNumWords(); i != e; ++i)
+      res = mix(res, v.getRawData()[i]);
+  } else if (isCommutative(e->getKind())) {
+    // The kids are still visited in order, so that the arrays are
+    // numbered the same way in equivalent queries
+    uint64_t l = hash(e->getKid(0)), r = hash(e->getKid(1));
+    res = mix(mix(res, std::min(l, r)), std::max(l, r));
+  } else {
+    if (ReadExpr *re = dyn_cast<ReadExpr>(e))
+      res = mix(res, hashUpdates(re->updates));
+    else if (ExtractExpr *ee = dyn_cast<ExtractExpr>(e))
+      res = mix(res, ee->offset);
+
+    for (unsigned i = 0, n = e->getNumKids(); i != n; ++i)
+      res = mix(res, hash(e->getKid(i)));
+  }
+
+  exprHashes[e.get()] = res;
+  return res;
+}
+
+uint64_t QueryHasher::hashConstraints(const ConstraintManager &constraints) {
+  uint64_t res = 0;
+  for (ConstraintManager::constraint_iterator it = constraints.begin(),
+         ie = constraints.end(); it != ie; ++it)
+    res = mix(res, hash(*it));
+  return res;
+}
+
+uint64_t QueryHasher::hash(const ConstraintManager &constraints,
+                           const ref<Expr> &e) {
+  return mix(hashConstraints(constraints), hash(e));
+}
+
+uint64_t QueryHasher::getCanonicalKey(const Query &query,
+                                      bool &negationUsed) {
+  // The arrays are numbered from the constraints, which both polarities
+  // share, so that the hashes of the query and its negation agree on
+  // them. The negation must stay alive while its address is memoized.
+  ref<Expr> negatedQuery = Expr::createIsZero(query.expr);
+  uint64_t constraintsKey = hashConstraints(query.constraints);
+  uint64_t key = hash(query.expr);
+  uint64_t negatedKey = hash(negatedQuery);
+
+  negationUsed = negatedKey < key;
+  uint64_t res = mix(constraintsKey, negationUsed ? negatedKey : key);
+
+  clear();
+  return res;
+}
+
+void QueryHasher::clear() {
+  exprHashes.clear();
+  updateHashes.clear();
+  arrayIds.clear();
+}
@@ -0,0 +1,59 @@
+//===-- QueryHasher.h -------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __UTIL_QUERYHASHER_H__
+#define __UTIL_QUERYHASHER_H__
+
+#include "klee/Expr.h"
+
+#include <tr1/unordered_map>
+#include <stdint.h>
+
+namespace klee {
+  class ConstraintManager;
+  struct Query;
+
+  /// QueryHasher - Computes a 64-bit structural hash of expressions. Unlike
+  /// Expr::hash(), the result is wide enough to be used as a key without
+  /// keeping the expression around. Shared subexpressions are hashed only
+  /// once.
+  ///
+  /// The hash does not depend on the names of the symbolic arrays, which
+  /// are numbered in order of first appearance, nor on the order of the
+  /// operands of commutative operations. Queries that differ only by the
+  /// names of their arrays, e.g., the same check made by several states on
+  /// their own copy of an input, get the same hash.
+  class QueryHasher {
+    typedef std::tr1::unordered_map<const Expr*, uint64_t> ExprHashes;
+    typedef std::tr1::unordered_map<const UpdateNode*, uint64_t> UpdateHashes;
+    typedef std::tr1::unordered_map<const Array*, unsigned> ArrayIds;
+
+    ExprHashes exprHashes;
+    UpdateHashes updateHashes;
+    ArrayIds arrayIds;
+
+    uint64_t hashArray(const Array *array);
+    uint64_t hashUpdates(const UpdateList &ul);
+    uint64_t hashConstraints(const ConstraintManager &constraints);
+
+  public:
+    uint64_t hash(const ref<Expr> &e);
+    uint64_t hash(const ConstraintManager &constraints, const ref<Expr> &e);
+
+    /// Hash of the query or of its negation, whichever is the smallest.
+    /// negationUsed is set to true if the negation was hashed. The memo
+    /// tables are cleared afterwards, as the expressions may be freed
+    /// once the query is answered.
+    uint64_t getCanonicalKey(const Query &query, bool &negationUsed);
+
+    void clear();
+  };
+}
+
+#endif
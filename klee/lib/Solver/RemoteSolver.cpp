@@ -0,0 +1,600 @@
+//===-- RemoteSolver.cpp - Solver queries answered by other hosts ---------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The remote solver sends the queries to solver servers, e.g., kleaver
+// -serve running on dedicated hosts, and falls back to the local solver
+// when no server can take them.
+//
+// Messages are a 32-bit little endian length followed by the data written
+// with an ExprWriter. Each process keeps its own connection to every
+// server, and a server answers each connection in its own process, so the
+// queries of all the S2E processes are solved in parallel.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/SolverImpl.h"
+#include "klee/SolverStats.h"
+#include "klee/Internal/System/Time.h"
+#include "klee/util/ExprSerializer.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using namespace klee;
+using namespace llvm;
+
+namespace {
+  cl::opt<double>
+  RemoteSolverRetry("remote-solver-retry",
+                    cl::desc("Seconds before connecting again to a solver server that failed (default=10)"),
+                    cl::init(10));
+
+  enum Operation {
+    OpTruth,
+    OpValidity,
+    OpValue,
+    OpInitialValues
+  };
+
+  enum Status {
+    StatusOk,
+    StatusFailed,
+    StatusBusy
+  };
+
+  const uint32_t maxMessageSize = 1u << 30;
+}
+
+static bool writeAll(int fd, const unsigned char *data, size_t size) {
+  while (size) {
+    ssize_t res = send(fd, data, size, MSG_NOSIGNAL);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    data += res;
+    size -= res;
+  }
+  return true;
+}
+
+static bool readAll(int fd, unsigned char *data, size_t size) {
+  while (size) {
+    ssize_t res = read(fd, data, size);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    data += res;
+    size -= res;
+  }
+  return true;
+}
+
+static bool sendMessage(int fd, const std::vector<unsigned char> &msg) {
+  unsigned char header[4];
+  for (unsigned i = 0; i < 4; ++i)
+    header[i] = (msg.size() >> (8 * i)) & 0xff;
+  return writeAll(fd, header, 4) &&
+         (msg.empty() || writeAll(fd, &msg[0], msg.size()));
+}
+
+static bool receiveMessage(int fd, std::vector<unsigned char> &msg) {
+  unsigned char header[4];
+  if (!readAll(fd, header, 4))
+    return false;
+
+  uint32_t size = 0;
+  for (unsigned i = 0; i < 4; ++i)
+    size |= (uint32_t) header[i] << (8 * i);
+  if (size > maxMessageSize)
+    return false;
+
+  msg.resize(size);
+  return !size || readAll(fd, &msg[0], size);
+}
+
+static void writeQuery(ExprWriter &writer, const Query &query) {
+  writer.writeInt(query.constraints.size());
+  for (ConstraintManager::const_iterator it = query.constraints.begin(),
+         ie = query.constraints.end(); it != ie; ++it)
+    writer.writeExpr(*it);
+  writer.writeExpr(query.expr);
+}
+
+static bool readQuery(ExprReader &reader, std::vector< ref<Expr> > &constraints,
+                      ref<Expr> &expr) {
+  uint64_t count;
+  if (!reader.readInt(count))
+    return false;
+  for (uint64_t i = 0; i < count; ++i) {
+    ref<Expr> e;
+    if (!reader.readExpr(e))
+      return false;
+    constraints.push_back(e);
+  }
+  return reader.readExpr(expr);
+}
+
+/***/
+
+class RemoteSolver : public SolverImpl {
+  struct Server {
+    std::string host;
+    std::string port;
+    int fd;
+    /// The process that opened the connection, a forked child must
+    /// not share it
+    pid_t pid;
+    /// Time after which the server may be tried again
+    double retryTime;
+
+    Server() : fd(-1), pid(0), retryTime(0) {}
+  };
+
+  enum CallResult {
+    Answered,
+    Failed,
+    Unavailable
+  };
+
+  Solver *local;
+  std::vector<Server> servers;
+  unsigned nextServer;
+
+  bool connect(Server &server);
+  void disconnect(Server &server);
+  CallResult call(const std::vector<unsigned char> &request,
+                  std::vector<unsigned char> &response);
+
+public:
+  RemoteSolver(Solver *_local, const std::string &addresses);
+  ~RemoteSolver();
+
+  bool computeTruth(const Query&, bool &isValid);
+  bool computeValidity(const Query&, Solver::Validity &result);
+  bool computeValue(const Query&, ref<Expr> &result);
+  bool computeInitialValues(const Query&,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution);
+};
+
+RemoteSolver::RemoteSolver(Solver *_local, const std::string &addresses)
+  : local(_local), nextServer(0) {
+  std::stringstream ss(addresses);
+  std::string address;
+  while (std::getline(ss, address, ',')) {
+    if (address.empty())
+      continue;
+
+    Server server;
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+      llvm::errs() << "KLEE: WARNING: ignoring solver server " << address
+                   << " without a port\n";
+      continue;
+    }
+    server.host = address.substr(0, colon);
+    server.port = address.substr(colon + 1);
+    servers.push_back(server);
+  }
+}
+
+RemoteSolver::~RemoteSolver() {
+  for (unsigned i = 0; i < servers.size(); ++i)
+    disconnect(servers[i]);
+  delete local;
+}
+
+bool RemoteSolver::connect(Server &server) {
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo(server.host.c_str(), server.port.c_str(), &hints, &res))
+    return false;
+
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (fd < 0)
+    return false;
+
+  // Queries are small and latency bound
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  server.fd = fd;
+  server.pid = getpid();
+  return true;
+}
+
+void RemoteSolver::disconnect(Server &server) {
+  // The connection of the parent is closed without being shut down
+  if (server.fd >= 0) {
+    if (server.pid == getpid())
+      shutdown(server.fd, SHUT_RDWR);
+    close(server.fd);
+  }
+  server.fd = -1;
+}
+
+/// Sends the request to the servers in turn, starting after the last
+/// one that answered, until one accepts it.
+RemoteSolver::CallResult
+RemoteSolver::call(const std::vector<unsigned char> &request,
+                   std::vector<unsigned char> &response) {
+  for (unsigned i = 0; i < servers.size(); ++i) {
+    unsigned index = (nextServer + i) % servers.size();
+    Server &server = servers[index];
+
+    if (server.fd >= 0 && server.pid != getpid())
+      disconnect(server);
+
+    if (server.fd < 0) {
+      double now = util::getWallTime();
+      if (now < server.retryTime)
+        continue;
+      if (!connect(server)) {
+        server.retryTime = now + RemoteSolverRetry;
+        continue;
+      }
+    }
+
+    if (!sendMessage(server.fd, request) ||
+        !receiveMessage(server.fd, response) || response.empty()) {
+      disconnect(server);
+      server.retryTime = util::getWallTime() + RemoteSolverRetry;
+      continue;
+    }
+
+    // The status is a single byte, before the answer
+    if (response[0] == StatusBusy)
+      continue;
+
+    ++stats::remoteSolverQueries;
+    nextServer = index + 1;
+    return response[0] == StatusOk ? Answered : Failed;
+  }
+
+  ++stats::remoteSolverFallbacks;
+  return Unavailable;
+}
+
+bool RemoteSolver::computeTruth(const Query &query, bool &isValid) {
+  std::vector<unsigned char> request, response;
+  ExprWriter writer(request);
+  writer.writeInt(OpTruth);
+  writeQuery(writer, query);
+
+  switch (call(request, response)) {
+  case Unavailable:
+    return local->impl->computeTruth(query, isValid);
+  case Failed:
+    return false;
+  case Answered:
+    break;
+  }
+
+  ExprReader reader(&response[1], response.size() - 1);
+  uint64_t value;
+  if (!reader.readInt(value))
+    return false;
+  isValid = value;
+  return true;
+}
+
+bool RemoteSolver::computeValidity(const Query &query,
+                                   Solver::Validity &result) {
+  std::vector<unsigned char> request, response;
+  ExprWriter writer(request);
+  writer.writeInt(OpValidity);
+  writeQuery(writer, query);
+
+  switch (call(request, response)) {
+  case Unavailable:
+    return local->impl->computeValidity(query, result);
+  case Failed:
+    return false;
+  case Answered:
+    break;
+  }
+
+  ExprReader reader(&response[1], response.size() - 1);
+  uint64_t value;
+  if (!reader.readInt(value) || value > 2)
+    return false;
+  result = (Solver::Validity) ((int) value - 1);
+  return true;
+}
+
+bool RemoteSolver::computeValue(const Query &query, ref<Expr> &result) {
+  std::vector<unsigned char> request, response;
+  ExprWriter writer(request);
+  writer.writeInt(OpValue);
+  writeQuery(writer, query);
+
+  switch (call(request, response)) {
+  case Unavailable:
+    return local->impl->computeValue(query, result);
+  case Failed:
+    return false;
+  case Answered:
+    break;
+  }
+
+  // The value is a constant, it does not refer to the arrays of the reader
+  ExprReader reader(&response[1], response.size() - 1);
+  ref<Expr> value;
+  if (!reader.readExpr(value) || !isa<ConstantExpr>(value))
+    return false;
+  result = value;
+  return true;
+}
+
+bool
+RemoteSolver::computeInitialValues(const Query &query,
+                                   const std::vector<const Array*> &objects,
+                                   std::vector< std::vector<unsigned char> >
+                                     &values,
+                                   bool &hasSolution) {
+  std::vector<unsigned char> request, response;
+  ExprWriter writer(request);
+  writer.writeInt(OpInitialValues);
+  writeQuery(writer, query);
+  writer.writeInt(objects.size());
+  for (unsigned i = 0; i < objects.size(); ++i)
+    writer.writeArray(objects[i]);
+
+  switch (call(request, response)) {
+  case Unavailable:
+    return local->impl->computeInitialValues(query, objects, values,
+                                             hasSolution);
+  case Failed:
+    return false;
+  case Answered:
+    break;
+  }
+
+  ExprReader reader(&response[1], response.size() - 1);
+  uint64_t value;
+  if (!reader.readInt(value))
+    return false;
+  hasSolution = value;
+  if (!hasSolution)
+    return true;
+
+  values.clear();
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    std::vector<unsigned char> bytes(objects[i]->size);
+    for (unsigned j = 0; j < bytes.size(); ++j) {
+      if (!reader.readInt(value))
+        return false;
+      bytes[j] = value;
+    }
+    values.push_back(bytes);
+  }
+  return true;
+}
+
+/***/
+
+/// Answers one request of a client. Returns false if the request is
+/// malformed.
+static bool answerRequest(Solver *solver, ExprReader::ArrayTable &arrays,
+                          const std::vector<unsigned char> &request,
+                          std::vector<unsigned char> &response,
+                          volatile unsigned *busy, unsigned jobs) {
+  if (request.empty())
+    return false;
+
+  // The solver chain keeps expressions of earlier queries, e.g., in its
+  // caches, so the arrays must stay alive
+  ExprReader reader(&request[0], request.size(), &arrays);
+  uint64_t op;
+  std::vector< ref<Expr> > constraints;
+  ref<Expr> expr;
+  if (!reader.readInt(op) || !readQuery(reader, constraints, expr))
+    return false;
+
+  // Only the value queries are on expressions that are not boolean
+  if (op != OpValue && expr->getWidth() != Expr::Bool)
+    return false;
+  for (unsigned i = 0; i < constraints.size(); ++i)
+    if (constraints[i]->getWidth() != Expr::Bool)
+      return false;
+
+  std::vector<const Array*> objects;
+  if (op == OpInitialValues) {
+    uint64_t count;
+    if (!reader.readInt(count))
+      return false;
+    for (uint64_t i = 0; i < count; ++i) {
+      const Array *array;
+      if (!reader.readArray(array))
+        return false;
+      objects.push_back(array);
+    }
+  } else if (op > OpInitialValues) {
+    return false;
+  }
+
+  if (!reader.atEnd())
+    return false;
+
+  // Let the client solve the query if all the workers are busy
+  response.clear();
+  if (__sync_add_and_fetch(busy, 1) > jobs) {
+    __sync_sub_and_fetch(busy, 1);
+    response.push_back(StatusBusy);
+    return true;
+  }
+
+  ConstraintManager cm(constraints);
+  Query query(cm, expr);
+  std::vector<unsigned char> answer;
+  ExprWriter writer(answer);
+  bool success = false;
+
+  switch (op) {
+  case OpTruth: {
+    bool isValid;
+    if ((success = solver->mustBeTrue(query, isValid)))
+      writer.writeInt(isValid);
+    break;
+  }
+  case OpValidity: {
+    Solver::Validity validity;
+    if ((success = solver->evaluate(query, validity)))
+      writer.writeInt((int) validity + 1);
+    break;
+  }
+  case OpValue: {
+    // The client asks for a value of the expression, not its truth
+    ref<ConstantExpr> value;
+    if ((success = solver->getValue(query, value)))
+      writer.writeExpr(value);
+    break;
+  }
+  case OpInitialValues: {
+    std::vector< std::vector<unsigned char> > values;
+    bool hasSolution;
+    if ((success = solver->impl->computeInitialValues(query, objects, values,
+                                                      hasSolution))) {
+      writer.writeInt(hasSolution);
+      for (unsigned i = 0; hasSolution && i < values.size(); ++i)
+        for (unsigned j = 0; j < values[i].size(); ++j)
+          writer.writeInt(values[i][j]);
+    }
+    break;
+  }
+  }
+
+  __sync_sub_and_fetch(busy, 1);
+
+  response.push_back(success ? StatusOk : StatusFailed);
+  if (success)
+    response.insert(response.end(), answer.begin(), answer.end());
+  return true;
+}
+
+static void serveConnection(Solver *solver, int fd, volatile unsigned *busy,
+                            unsigned jobs) {
+  ExprReader::ArrayTable arrays;
+  std::vector<unsigned char> request, response;
+  while (receiveMessage(fd, request)) {
+    if (!answerRequest(solver, arrays, request, response, busy, jobs)) {
+      llvm::errs() << "KLEE: WARNING: malformed solver request\n";
+      break;
+    }
+    if (!sendMessage(fd, response))
+      break;
+  }
+  close(fd);
+}
+
+bool klee::serveSolverQueries(Solver *solver, unsigned port, unsigned jobs) {
+  int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  if (fd < 0) {
+    llvm::errs() << "KLEE: ERROR: could not create socket: "
+                 << strerror(errno) << "\n";
+    return false;
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in6 addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(fd, 64) < 0) {
+    llvm::errs() << "KLEE: ERROR: could not listen on port " << port << ": "
+                 << strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+
+  // Number of queries being solved by all the connection processes
+  volatile unsigned *busy = (volatile unsigned*)
+    mmap(NULL, sizeof(unsigned), PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (busy == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  *busy = 0;
+
+  // The connection processes are reaped automatically
+  signal(SIGCHLD, SIG_IGN);
+
+  for (;;) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      llvm::errs() << "KLEE: ERROR: accept failed: " << strerror(errno) << "\n";
+      break;
+    }
+
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      // A forked STP waits for its own process
+      signal(SIGCHLD, SIG_DFL);
+      close(fd);
+      serveConnection(solver, client, busy, jobs);
+      _exit(0);
+    }
+
+    if (pid < 0)
+      llvm::errs() << "KLEE: WARNING: could not fork: " << strerror(errno) << "\n";
+    close(client);
+  }
+
+  munmap((void*) busy, sizeof(unsigned));
+  close(fd);
+  return false;
+}
+
+Solver *klee::createRemoteSolver(Solver *local, const std::string &servers) {
+  return new Solver(new RemoteSolver(local, servers));
+}
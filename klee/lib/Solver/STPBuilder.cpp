@@ -46,6 +46,11 @@ namespace {
   UseConstructHash("use-construct-hash", 
                    llvm::cl::desc("Use hash-consing during STP query construction."),
                    llvm::cl::init(true));
+
+  llvm::cl::opt<unsigned>
+  STPArrayCacheSize("stp-array-cache-size",
+                    llvm::cl::desc("Number of update lists whose STP array is shared with equal lists (0=off)"),
+                    llvm::cl::init(4096));
 }
 
 ///
@@ -53,7 +58,7 @@ namespace {
 /***/
 
 STPBuilder::STPBuilder(::VC _vc, bool _optimizeDivides) 
-  : vc(_vc), optimizeDivides(_optimizeDivides)
+  : vc(_vc), generation(++stpGeneration), optimizeDivides(_optimizeDivides)
 {
   tempVars[0] = buildVar("__tmpInt8", 8);
   tempVars[1] = buildVar("__tmpInt16", 16);
@@ -62,6 +67,11 @@ STPBuilder::STPBuilder(::VC _vc, bool _optimizeDivides)
 }
 
 STPBuilder::~STPBuilder() {
+  // The lists may free their arrays while the validity checker exists,
+  // the remaining ones become stale once it is destroyed.
+  arrayCache.clear();
+  if (generation == stpGeneration)
+    ++stpGeneration;
 }
 
 ///
@@ -385,9 +395,11 @@ ExprHandle STPBuilder::constructSDivByConstant(ExprHandle expr_n, unsigned width
 }
 
 ::VCExpr STPBuilder::getInitialArray(const Array *root) {
-  if (root->stpInitialArray) {
+  if (root->stpInitialArray && root->stpInitialArrayGeneration == generation) {
     return root->stpInitialArray;
   } else {
+    // A stale array belongs to a destroyed validity checker
+    root->stpInitialArrayGeneration = generation;
     // STP uniques arrays by name, so we make sure the name is unique by
     // including the address.
     char buf[256];
@@ -416,20 +428,67 @@ ExprHandle STPBuilder::getInitialRead(const Array *root, unsigned index) {
   return vc_readExpr(vc, getInitialArray(root), bvConst32(32, index));
 }
 
+::VCExpr STPBuilder::lookupArray(const Array *root, const UpdateNode *un) {
+  std::pair<ArrayCache::iterator, ArrayCache::iterator> range =
+    arrayCache.equal_range(un->hash());
+  for (ArrayCache::iterator it = range.first; it != range.second; ++it) {
+    const UpdateList &ul = it->second;
+    if (ul.root != root || ul.getSize() != un->getSize())
+      continue;
+
+    const UpdateNode *a = un, *b = ul.head;
+    while (a && a != b && a->hash() == b->hash() && !a->compare(*b)) {
+      a = a->next;
+      b = b->next;
+    }
+
+    if (a == b)
+      return ul.head->stpArray;
+  }
+
+  return 0;
+}
+
+void STPBuilder::rememberArray(const Array *root, const UpdateNode *un) {
+  if (!STPArrayCacheSize)
+    return;
+  if (arrayCache.size() >= STPArrayCacheSize)
+    arrayCache.clear();
+  arrayCache.insert(std::make_pair(un->hash(), UpdateList(root, un)));
+}
+
 ::VCExpr STPBuilder::getArrayForUpdate(const Array *root, 
                                        const UpdateNode *un) {
-  if (!un) {
-    return getInitialArray(root);
-  } else {
-    // FIXME: This really needs to be non-recursive.
-    if (!un->stpArray)
-      un->stpArray = vc_writeExpr(vc,
-                                  getArrayForUpdate(root, un->next),
-                                  construct(un->index, 0),
-                                  construct(un->value, 0));
+  // Find the longest prefix of the list whose array is already built,
+  // then encode the writes above it, oldest first.
+  std::vector<const UpdateNode*> pending;
+  ::VCExpr array = 0;
+  for (; un; un = un->next) {
+    if (un->stpArray && un->stpArrayGeneration == generation) {
+      array = un->stpArray;
+      break;
+    }
+    if (STPArrayCacheSize && (array = lookupArray(root, un)))
+      break;
+    pending.push_back(un);
+  }
 
-    return un->stpArray;
+  if (!array)
+    array = getInitialArray(root);
+
+  for (unsigned i = pending.size(); i != 0; --i) {
+    const UpdateNode *n = pending[i - 1];
+    n->stpArray = vc_writeExpr(vc, array,
+                               construct(n->index, 0),
+                               construct(n->value, 0));
+    n->stpArrayGeneration = generation;
+    array = n->stpArray;
   }
+
+  if (!pending.empty())
+    rememberArray(root, pending.front());
+
+  return array;
 }
 
 /** if *width_out!=1 then result is a bitvector,
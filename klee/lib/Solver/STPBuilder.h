@@ -66,6 +66,17 @@ class STPBuilder {
   ExprHandle tempVars[4];
   ExprHashMap< std::pair<ExprHandle, unsigned> > constructed;
 
+  /// Value of stpGeneration for the expressions built for vc
+  unsigned generation;
+
+  /// Update lists whose array was built, by hash of their head. Equal
+  /// lists made of different nodes, e.g., the same object flushed in
+  /// two states, reuse the array of the first one instead of encoding
+  /// all the writes again. The lists are kept alive, which keeps their
+  /// array valid.
+  typedef std::multimap<unsigned, UpdateList> ArrayCache;
+  ArrayCache arrayCache;
+
   /// optimizeDivides - Rewrite division and reminders by constants
   /// into multiplies and shifts. STP should probably handle this for
   /// use.
@@ -101,6 +112,8 @@ private:
 
   ::VCExpr getInitialArray(const Array *os);
   ::VCExpr getArrayForUpdate(const Array *root, const UpdateNode *un);
+  ::VCExpr lookupArray(const Array *root, const UpdateNode *un);
+  void rememberArray(const Array *root, const UpdateNode *un);
 
   ExprHandle constructActual(ref<Expr> e, int *width_out);
   ExprHandle construct(ref<Expr> e, int *width_out);
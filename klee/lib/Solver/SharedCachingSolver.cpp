@@ -0,0 +1,322 @@
+//===-- SharedCachingSolver.cpp - Cross-process query cache ---------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A query cache stored in a memory mapped file. The mapping is shared, so
+// that all the processes forked after the solver was created, as well as
+// later runs that use the same file, see the results computed by the others.
+//
+// Each entry is a single 64-bit word holding the canonical hash of the
+// query (see QueryHasher) and its partial validity. Entries are updated with compare and swap,
+// which avoids the need for a lock between processes.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Solver.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/IncompleteSolver.h"
+#include "klee/SolverImpl.h"
+
+#include "klee/SolverStats.h"
+
+#include "QueryHasher.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <cassert>
+#include <cstring>
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace klee;
+
+class SharedCachingSolver : public SolverImpl {
+private:
+  struct Header {
+    uint64_t magic;
+    uint64_t capacityBits;
+  };
+
+  static const uint64_t MAGIC = 0x4b4c4545514341ULL; // "KLEEQCA"
+  static const unsigned MAX_PROBES = 16;
+
+  /// Low bits of an entry hold the encoded result, the rest the key.
+  static const uint64_t RESULT_MASK = 7;
+
+  Solver *solver;
+  QueryHasher hasher;
+
+  Header *header;
+  volatile uint64_t *entries;
+  uint64_t mask;
+  size_t mappedSize;
+
+  static uint64_t encode(IncompleteSolver::PartialValidity pv);
+  static IncompleteSolver::PartialValidity decode(uint64_t code);
+
+  uint64_t computeKey(const Query& query, bool &negationUsed);
+  bool cacheLookup(const Query& query,
+                   IncompleteSolver::PartialValidity &result);
+  void cacheInsert(const Query& query,
+                   IncompleteSolver::PartialValidity result);
+
+public:
+  SharedCachingSolver(Solver *s, const std::string &path, unsigned sizeBits);
+  ~SharedCachingSolver();
+
+  bool computeValidity(const Query&, Solver::Validity &result);
+  bool computeTruth(const Query&, bool &isValid);
+  bool computeValue(const Query& query, ref<Expr> &result) {
+    return solver->impl->computeValue(query, result);
+  }
+  bool computeInitialValues(const Query& query,
+                            const std::vector<const Array*> &objects,
+                            std::vector< std::vector<unsigned char> > &values,
+                            bool &hasSolution) {
+    return solver->impl->computeInitialValues(query, objects, values,
+                                              hasSolution);
+  }
+};
+
+SharedCachingSolver::SharedCachingSolver(Solver *s, const std::string &path,
+                                         unsigned sizeBits)
+  : solver(s), header(0), entries(0), mask(0), mappedSize(0) {
+  size_t capacity = 1ULL << sizeBits;
+  size_t size = sizeof(Header) + capacity * sizeof(uint64_t);
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    llvm::errs() << "KLEE: WARNING: could not open shared query cache "
+                 << path << "\n";
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 ||
+      ((size_t) st.st_size < size && ftruncate(fd, size) < 0)) {
+    llvm::errs() << "KLEE: WARNING: could not resize shared query cache "
+                 << path << "\n";
+    close(fd);
+    return;
+  }
+
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED) {
+    llvm::errs() << "KLEE: WARNING: could not map shared query cache "
+                 << path << "\n";
+    return;
+  }
+
+  header = (Header*) mem;
+  entries = (volatile uint64_t*) (header + 1);
+  mappedSize = size;
+
+  // A cache built with a different size cannot be reused, as the
+  // position of the entries depends on the capacity.
+  if (header->magic != MAGIC || header->capacityBits != sizeBits) {
+    memset((void*) entries, 0, capacity * sizeof(uint64_t));
+    header->capacityBits = sizeBits;
+    __sync_synchronize();
+    header->magic = MAGIC;
+  }
+
+  mask = capacity - 1;
+}
+
+SharedCachingSolver::~SharedCachingSolver() {
+  if (header)
+    munmap(header, mappedSize);
+  delete solver;
+}
+
+uint64_t SharedCachingSolver::encode(IncompleteSolver::PartialValidity pv) {
+  switch (pv) {
+  case IncompleteSolver::MustBeTrue:  return 1;
+  case IncompleteSolver::MustBeFalse: return 2;
+  case IncompleteSolver::TrueOrFalse: return 3;
+  case IncompleteSolver::MayBeTrue:   return 4;
+  case IncompleteSolver::MayBeFalse:  return 5;
+  default: assert(0 && "cannot cache unknown validity");
+  }
+  return 0;
+}
+
+IncompleteSolver::PartialValidity SharedCachingSolver::decode(uint64_t code) {
+  switch (code) {
+  case 1: return IncompleteSolver::MustBeTrue;
+  case 2: return IncompleteSolver::MustBeFalse;
+  case 3: return IncompleteSolver::TrueOrFalse;
+  case 4: return IncompleteSolver::MayBeTrue;
+  case 5: return IncompleteSolver::MayBeFalse;
+  default: return IncompleteSolver::None;
+  }
+}
+
+/// Hashes the canonical version of the query. The key does not depend on
+/// the names of the arrays, which differ between states and runs.
+uint64_t SharedCachingSolver::computeKey(const Query& query,
+                                         bool &negationUsed) {
+  return hasher.getCanonicalKey(query, negationUsed) & ~RESULT_MASK;
+}
+
+bool SharedCachingSolver::cacheLookup(const Query& query,
+                                      IncompleteSolver::PartialValidity &result) {
+  if (!entries)
+    return false;
+
+  bool negationUsed;
+  uint64_t key = computeKey(query, negationUsed);
+
+  for (unsigned i = 0; i < MAX_PROBES; ++i) {
+    uint64_t entry = entries[((key >> 3) + i) & mask];
+    if (!entry)
+      return false;
+
+    if ((entry & ~RESULT_MASK) == key) {
+      IncompleteSolver::PartialValidity pv = decode(entry & RESULT_MASK);
+      if (pv == IncompleteSolver::None)
+        return false;
+      result = negationUsed ? IncompleteSolver::negatePartialValidity(pv) : pv;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void SharedCachingSolver::cacheInsert(const Query& query,
+                                      IncompleteSolver::PartialValidity result) {
+  if (!entries)
+    return;
+
+  bool negationUsed;
+  uint64_t key = computeKey(query, negationUsed);
+  if (negationUsed)
+    result = IncompleteSolver::negatePartialValidity(result);
+
+  uint64_t newEntry = key | encode(result);
+
+  for (unsigned i = 0; i < MAX_PROBES; ++i) {
+    volatile uint64_t *slot = &entries[((key >> 3) + i) & mask];
+    uint64_t entry = *slot;
+
+    // Another process may claim the slot concurrently, retry it
+    while (!entry || (entry & ~RESULT_MASK) == key) {
+      if (__sync_bool_compare_and_swap(slot, entry, newEntry))
+        return;
+      entry = *slot;
+    }
+  }
+
+  ++stats::sharedQueryCacheCollisions;
+}
+
+bool SharedCachingSolver::computeValidity(const Query& query,
+                                          Solver::Validity &result) {
+  IncompleteSolver::PartialValidity cachedResult;
+  bool tmp, cacheHit = cacheLookup(query, cachedResult);
+
+  if (cacheHit) {
+    ++stats::sharedQueryCacheHits;
+
+    switch(cachedResult) {
+    case IncompleteSolver::MustBeTrue:
+      result = Solver::True;
+      return true;
+    case IncompleteSolver::MustBeFalse:
+      result = Solver::False;
+      return true;
+    case IncompleteSolver::TrueOrFalse:
+      result = Solver::Unknown;
+      return true;
+    case IncompleteSolver::MayBeTrue: {
+      if (!solver->impl->computeTruth(query, tmp))
+        return false;
+      cachedResult = tmp ? IncompleteSolver::MustBeTrue :
+                           IncompleteSolver::TrueOrFalse;
+      cacheInsert(query, cachedResult);
+      result = tmp ? Solver::True : Solver::Unknown;
+      return true;
+    }
+    case IncompleteSolver::MayBeFalse: {
+      if (!solver->impl->computeTruth(query.negateExpr(), tmp))
+        return false;
+      cachedResult = tmp ? IncompleteSolver::MustBeFalse :
+                           IncompleteSolver::TrueOrFalse;
+      cacheInsert(query, cachedResult);
+      result = tmp ? Solver::False : Solver::Unknown;
+      return true;
+    }
+    default: assert(0 && "unreachable");
+    }
+  }
+
+  ++stats::sharedQueryCacheMisses;
+
+  if (!solver->impl->computeValidity(query, result))
+    return false;
+
+  switch (result) {
+  case Solver::True:
+    cachedResult = IncompleteSolver::MustBeTrue; break;
+  case Solver::False:
+    cachedResult = IncompleteSolver::MustBeFalse; break;
+  default:
+    cachedResult = IncompleteSolver::TrueOrFalse; break;
+  }
+
+  cacheInsert(query, cachedResult);
+  return true;
+}
+
+bool SharedCachingSolver::computeTruth(const Query& query,
+                                       bool &isValid) {
+  IncompleteSolver::PartialValidity cachedResult;
+  bool cacheHit = cacheLookup(query, cachedResult);
+
+  // a cached result of MayBeTrue forces us to check whether
+  // a False assignment exists.
+  if (cacheHit && cachedResult != IncompleteSolver::MayBeTrue) {
+    ++stats::sharedQueryCacheHits;
+    isValid = (cachedResult == IncompleteSolver::MustBeTrue);
+    return true;
+  }
+
+  ++stats::sharedQueryCacheMisses;
+
+  if (!solver->impl->computeTruth(query, isValid))
+    return false;
+
+  if (isValid) {
+    cachedResult = IncompleteSolver::MustBeTrue;
+  } else if (cacheHit) {
+    assert(cachedResult == IncompleteSolver::MayBeTrue);
+    cachedResult = IncompleteSolver::TrueOrFalse;
+  } else {
+    cachedResult = IncompleteSolver::MayBeFalse;
+  }
+
+  cacheInsert(query, cachedResult);
+  return true;
+}
+
+///
+
+Solver *klee::createSharedCachingSolver(Solver *_solver,
+                                        const std::string &path,
+                                        unsigned sizeBits) {
+  return new Solver(new SharedCachingSolver(_solver, path, sizeBits));
+}
@@ -13,6 +13,7 @@
 
 #include "klee/SolverStats.h"
 #include "STPBuilder.h"
+#include "TimeoutPredictor.h"
 
 #include "klee/Constraints.h"
 #include "klee/Expr.h"
@@ -46,6 +47,25 @@ namespace {
   llvm::cl::opt<bool>
   ReinstantiateSolver("reinstantiate-solver",
                       llvm::cl::init(false));
+
+  llvm::cl::opt<bool>
+  UseSTPPortfolio("use-stp-portfolio",
+                  llvm::cl::desc("Run each query in parallel with all the SAT "
+                                 "backends of STP and keep the first answer"),
+                  llvm::cl::init(false));
+
+  llvm::cl::opt<bool>
+  UseIncrementalSTP("use-incremental-stp",
+                    llvm::cl::desc("Keep the constraints shared with the previous "
+                                   "query asserted in the STP context"),
+                    llvm::cl::init(false));
+
+  llvm::cl::opt<bool>
+  UseAdaptiveSTPTimeout("adaptive-stp-timeout",
+                        llvm::cl::desc("Adapt the timeout of each query to the "
+                                       "solving times of the previous queries "
+                                       "of the same shape"),
+                        llvm::cl::init(false));
 }
 
 /***/
@@ -123,6 +143,68 @@ bool Solver::mayBeFalse(const Query& query, bool &result) {
   return true;
 }
 
+bool Solver::mayBeTrue(const Query& query,
+                       const std::vector< ref<Expr> > &conditions,
+                       std::vector<bool> &results) {
+  results.assign(conditions.size(), false);
+
+  std::vector<unsigned> pending;
+  for (unsigned i = 0; i != conditions.size(); ++i) {
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(conditions[i]))
+      results[i] = CE->isTrue();
+    else
+      pending.push_back(i);
+  }
+
+  if (pending.empty())
+    return true;
+
+  std::vector<const Array*> objects;
+  std::vector< ref<Expr> > exprs(query.constraints.begin(),
+                                 query.constraints.end());
+  for (unsigned i = 0; i != pending.size(); ++i)
+    exprs.push_back(conditions[pending[i]]);
+  findSymbolicObjects(exprs.begin(), exprs.end(), objects);
+
+  while (pending.size() > 1) {
+    ref<Expr> any = ConstantExpr::alloc(0, Expr::Bool);
+    for (unsigned i = 0; i != pending.size(); ++i)
+      any = OrExpr::create(conditions[pending[i]], any);
+
+    // A counterexample to !any satisfies at least one pending condition
+    std::vector< std::vector<unsigned char> > values;
+    bool hasSolution;
+    if (!impl->computeInitialValues(query.withExpr(Expr::createIsZero(any)),
+                                    objects, values, hasSolution))
+      return false;
+    if (!hasSolution)
+      return true;
+
+    Assignment a(objects, values);
+    std::vector<unsigned> remaining;
+    for (unsigned i = 0; i != pending.size(); ++i) {
+      if (a.evaluate(conditions[pending[i]])->isTrue())
+        results[pending[i]] = true;
+      else
+        remaining.push_back(pending[i]);
+    }
+
+    // The assignment should satisfy one of them, don't loop if it doesn't
+    if (remaining.size() == pending.size())
+      break;
+    pending.swap(remaining);
+  }
+
+  for (unsigned i = 0; i != pending.size(); ++i) {
+    bool result;
+    if (!mayBeTrue(query.withExpr(conditions[pending[i]]), result))
+      return false;
+    results[pending[i]] = result;
+  }
+
+  return true;
+}
+
 bool Solver::getValue(const Query& query, ref<ConstantExpr> &result) {
   // Maintain invariants implementation expect.
   if (ConstantExpr *CE = dyn_cast<ConstantExpr>(query.expr)) {
@@ -509,8 +591,16 @@ private:
   STPBuilder *builder;
   double timeout;
   bool useForkedSTP;
+  TimeoutPredictor timeoutPredictor;
+  unsigned timeoutCount;
+
+  /// Constraints currently asserted in the validity checker, one context
+  /// level per constraint. Only used in incremental mode.
+  std::vector< ref<Expr> > assertedConstraints;
 
   void reinstantiate();
+  void assertConstraints(const ConstraintManager &constraints);
+  void resetAssertedConstraints();
 
 public:
   STPSolverImpl(STPSolver *_solver, bool _useForkedSTP);
@@ -518,6 +608,7 @@ public:
 
   char *getConstraintLog(const Query&);
   void setTimeout(double _timeout) { timeout = _timeout; }
+  unsigned getTimeoutCount() const { return timeoutCount; }
 
   bool computeTruth(const Query&, bool &isValid);
   bool computeValue(const Query&, ref<Expr> &result);
@@ -528,9 +619,32 @@ public:
 };
 
 static unsigned char *shared_memory_ptr;
-static const unsigned shared_memory_size = 1<<20;
+static unsigned shared_memory_size = 1<<20;
 static int shared_memory_id;
 
+#ifndef __MINGW32__
+/// Returns a segment of at least the given size shared with the forked
+/// solvers. The segment grows by powers of two, so queries with large
+/// counterexamples only pay for the remapping once.
+static unsigned char *getSharedMemory(unsigned size) {
+  if (shared_memory_ptr && size <= shared_memory_size)
+    return shared_memory_ptr;
+
+  if (shared_memory_ptr)
+    shmdt(shared_memory_ptr);
+
+  while (shared_memory_size < size)
+    shared_memory_size *= 2;
+
+  shared_memory_id = shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
+  assert(shared_memory_id>=0 && "shmget failed");
+  shared_memory_ptr = (unsigned char*) shmat(shared_memory_id, NULL, 0);
+  assert(shared_memory_ptr!=(void*)-1 && "shmat failed");
+  shmctl(shared_memory_id, IPC_RMID, NULL);
+  return shared_memory_ptr;
+}
+#endif
+
 static void stp_error_handler(const char* err_msg) {
   fprintf(stderr, "error: STP Error: %s\n", err_msg);
   exit(-1);
@@ -541,7 +655,8 @@ STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP)
     vc(vc_createValidityChecker()),
     builder(new STPBuilder(vc)),
     timeout(0.0),
-    useForkedSTP(_useForkedSTP)
+    useForkedSTP(_useForkedSTP),
+    timeoutCount(0)
 {
   assert(vc && "unable to create validity checker");
   assert(builder && "unable to create STPBuilder");
@@ -552,20 +667,17 @@ STPSolverImpl::STPSolverImpl(STPSolver *_solver, bool _useForkedSTP)
 
   vc_registerErrorHandler(::stp_error_handler);
 
-  if (useForkedSTP) {
+  if (useForkedSTP || UseSTPPortfolio) {
 #ifdef __MINGW32__
     assert(false && "Cannot use forked stp solver on Windows");
 #else
-    shared_memory_id = shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
-    assert(shared_memory_id>=0 && "shmget failed");
-    shared_memory_ptr = (unsigned char*) shmat(shared_memory_id, NULL, 0);
-    assert(shared_memory_ptr!=(void*)-1 && "shmat failed");
-    shmctl(shared_memory_id, IPC_RMID, NULL);
+    getSharedMemory(shared_memory_size);
 #endif
   }
 }
 
 STPSolverImpl::~STPSolverImpl() {
+  resetAssertedConstraints();
   delete builder;
 
   vc_Destroy(vc);
@@ -576,6 +688,7 @@ void STPSolverImpl::reinstantiate()
     //XXX: This seems to cause crashes.
     //Will have to find other ways of preventing slowdown
     if (ReinstantiateSolver) {
+        resetAssertedConstraints();
         delete builder;
         vc_Destroy(vc);
         vc = vc_createValidityChecker();
@@ -589,6 +702,52 @@ void STPSolverImpl::reinstantiate()
     }
 }
 
+/// Brings the validity checker into a state where exactly the given
+/// constraints are asserted. In incremental mode, the levels matching
+/// the longest common prefix with the previous query are kept, so that
+/// consecutive queries from the same path only assert the new branch
+/// conditions.
+void STPSolverImpl::assertConstraints(const ConstraintManager &constraints)
+{
+  if (!UseIncrementalSTP) {
+    vc_push(vc);
+    for (ConstraintManager::const_iterator it = constraints.begin(),
+           ie = constraints.end(); it != ie; ++it)
+      vc_assertFormula(vc, builder->construct(*it));
+    return;
+  }
+
+  ConstraintManager::const_iterator it = constraints.begin(),
+    ie = constraints.end();
+  unsigned common = 0;
+  while (common < assertedConstraints.size() && it != ie &&
+         assertedConstraints[common] == *it) {
+    ++common;
+    ++it;
+  }
+
+  stats::incrementalQueryReusedConstraints += common;
+
+  while (assertedConstraints.size() > common) {
+    vc_pop(vc);
+    assertedConstraints.pop_back();
+  }
+
+  for (; it != ie; ++it) {
+    vc_push(vc);
+    vc_assertFormula(vc, builder->construct(*it));
+    assertedConstraints.push_back(*it);
+  }
+}
+
+void STPSolverImpl::resetAssertedConstraints()
+{
+  while (!assertedConstraints.empty()) {
+    vc_pop(vc);
+    assertedConstraints.pop_back();
+  }
+}
+
 /***/
 
 STPSolver::STPSolver(bool useForkedSTP)
@@ -604,9 +763,14 @@ void STPSolver::setTimeout(double timeout) {
   static_cast<STPSolverImpl*>(impl)->setTimeout(timeout);
 }
 
+unsigned STPSolver::getTimeoutCount() const {
+  return static_cast<STPSolverImpl*>(impl)->getTimeoutCount();
+}
+
 /***/
 
 char *STPSolverImpl::getConstraintLog(const Query &query) {
+  resetAssertedConstraints();
   vc_push(vc);
   for (std::vector< ref<Expr> >::const_iterator it = query.constraints.begin(),
          ie = query.constraints.end(); it != ie; ++it)
@@ -717,18 +881,18 @@ static bool runAndGetCexForked(::VC vc,
                                std::vector< std::vector<unsigned char> >
                                  &values,
                                bool &hasSolution,
-                               double timeout) {
+                               double timeout,
+                               bool &timedOut) {
 #ifdef __MINGW32__
   assert(false && "Cannot run runAndGetCexForked on Windows");
   return false;
 #else
 
-  unsigned char *pos = shared_memory_ptr;
   unsigned sum = 0;
   for (std::vector<const Array*>::const_iterator
          it = objects.begin(), ie = objects.end(); it != ie; ++it)
     sum += (*it)->size;
-  assert(sum<shared_memory_size && "not enough shared memory for counterexample");
+  unsigned char *pos = getSharedMemory(sum);
 
   fflush(stdout);
   fflush(stderr);
@@ -795,6 +959,7 @@ static bool runAndGetCexForked(::VC vc,
       hasSolution = false;
     } else if (exitcode==52) {
       fprintf(stderr, "error: STP timed out");
+      timedOut = true;
       return false;
     } else {
       fprintf(stderr, "error: STP did not return a recognized code (%d)\n", exitcode);
@@ -817,6 +982,150 @@ static bool runAndGetCexForked(::VC vc,
   }
 #endif
 }
+#ifdef HAVE_EXT_STP
+/// SAT backends tried in parallel by the portfolio mode. Each one runs in
+/// its own forked process, because STP cannot be used from several threads.
+static const unsigned portfolioSize = 3;
+static const ifaceflag_t portfolioSolvers[portfolioSize] = { MS, SMS, CMS2 };
+
+static bool runAndGetCexPortfolio(::VC vc,
+                                  STPBuilder *builder,
+                                  ::VCExpr q,
+                                  const std::vector<const Array*> &objects,
+                                  std::vector< std::vector<unsigned char> >
+                                    &values,
+                                  bool &hasSolution,
+                                  double timeout,
+                                  bool &timedOut) {
+#ifdef __MINGW32__
+  assert(false && "Cannot run runAndGetCexPortfolio on Windows");
+  return false;
+#else
+
+  unsigned sum = 0;
+  for (std::vector<const Array*>::const_iterator
+         it = objects.begin(), ie = objects.end(); it != ie; ++it)
+    sum += (*it)->size;
+
+  // Each solver writes its counterexample into its own slot
+  unsigned slotSize = sum;
+  getSharedMemory(slotSize * portfolioSize);
+
+  fflush(stdout);
+  fflush(stderr);
+
+  sigset_t sig_mask, sig_mask_old;
+  sigfillset(&sig_mask);
+  sigemptyset(&sig_mask_old);
+  sigprocmask(SIG_SETMASK, &sig_mask, &sig_mask_old);
+
+  pid_t pids[portfolioSize];
+  unsigned running = 0;
+
+  for (unsigned i = 0; i < portfolioSize; ++i) {
+    pids[i] = fork();
+    if (pids[i] == -1) {
+      fprintf(stderr, "error: fork failed (for STP portfolio)\n");
+      continue;
+    }
+
+    if (pids[i] == 0) {
+      sigprocmask(SIG_SETMASK, &sig_mask_old, NULL);
+      if (timeout) {
+        ::alarm(0); /* Turn off alarm so we can safely set signal handler */
+        ::signal(SIGALRM, stpTimeoutHandler);
+        ::alarm(std::max(1, (int)timeout));
+      }
+      vc_setInterfaceFlags(vc, portfolioSolvers[i], 0);
+      unsigned res = vc_query(vc, q);
+      if (!res) {
+        unsigned char *pos = shared_memory_ptr + i * slotSize;
+        for (std::vector<const Array*>::const_iterator
+               it = objects.begin(), ie = objects.end(); it != ie; ++it) {
+          const Array *array = *it;
+          for (unsigned offset = 0; offset < array->size; offset++) {
+            ExprHandle counter =
+              vc_getCounterExample(vc, builder->getInitialRead(array, offset));
+            *pos++ = getBVUnsigned(counter);
+          }
+        }
+      }
+      _exit(res);
+    }
+
+    ++running;
+  }
+
+  // Wait for the first solver that returns a valid answer.
+  // Polling avoids reaping children that do not belong to the portfolio.
+  int winner = -1;
+  while (running > 0 && winner < 0) {
+    bool reaped = false;
+    for (unsigned i = 0; i < portfolioSize && winner < 0; ++i) {
+      if (pids[i] <= 0)
+        continue;
+
+      int status;
+      pid_t res = waitpid(pids[i], &status, WNOHANG);
+      if (res == 0 || (res < 0 && errno == EINTR))
+        continue;
+
+      pids[i] = -1;
+      --running;
+      reaped = true;
+
+      if (res < 0 || WIFSIGNALED(status) || !WIFEXITED(status))
+        continue;
+
+      int exitcode = WEXITSTATUS(status);
+      if (exitcode == 0 || exitcode == 1) {
+        hasSolution = exitcode == 0;
+        winner = i;
+      } else if (exitcode == 52) {
+        timedOut = true;
+      }
+    }
+
+    if (!reaped && winner < 0)
+      usleep(100);
+  }
+
+  // Cancel the solvers that are still running
+  for (unsigned i = 0; i < portfolioSize; ++i) {
+    if (pids[i] <= 0)
+      continue;
+
+    kill(pids[i], SIGKILL);
+    int status;
+    while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR)
+      ;
+  }
+
+  sigprocmask(SIG_SETMASK, &sig_mask_old, NULL);
+
+  if (winner < 0) {
+    fprintf(stderr, "error: no STP portfolio solver returned successfully\n");
+    return false;
+  }
+
+  if (hasSolution) {
+    unsigned char *pos = shared_memory_ptr + winner * slotSize;
+    values = std::vector< std::vector<unsigned char> >(objects.size());
+    unsigned i=0;
+    for (std::vector<const Array*>::const_iterator
+           it = objects.begin(), ie = objects.end(); it != ie; ++it) {
+      const Array *array = *it;
+      std::vector<unsigned char> &data = values[i++];
+      data.insert(data.begin(), pos, pos + array->size);
+      pos += array->size;
+    }
+  }
+
+  return true;
+#endif
+}
+#endif
+
 static bool __stp_printstate = true;
 extern llvm::raw_ostream *g_solverLog;
 
@@ -831,11 +1140,7 @@ STPSolverImpl::computeInitialValues(const Query &query,
 
   reinstantiate();
 
-  vc_push(vc);
-
-  for (ConstraintManager::const_iterator it = query.constraints.begin(),
-         ie = query.constraints.end(); it != ie; ++it)
-    vc_assertFormula(vc, builder->construct(*it));
+  assertConstraints(query.constraints);
 
   ++stats::queries;
   ++stats::queryCounterexamples;
@@ -855,10 +1160,27 @@ STPSolverImpl::computeInitialValues(const Query &query,
     //fprintf(stderr, "note: STP query: %.*s\n", (unsigned) len, buf);
   }
 
-  bool success;
+  // Only the forked solvers enforce the timeout
+  double queryTimeout = timeout;
+  TimeoutPredictor::Features features;
+  bool adaptTimeout = UseAdaptiveSTPTimeout && timeout &&
+                      (useForkedSTP || UseSTPPortfolio);
+  if (adaptTimeout) {
+    TimeoutPredictor::getFeatures(query, features);
+    queryTimeout = timeoutPredictor.getTimeout(features, timeout);
+  }
+
+  WallTimer queryTimer;
+  bool success, timedOut = false;
+#ifdef HAVE_EXT_STP
+  if (UseSTPPortfolio) {
+    success = runAndGetCexPortfolio(vc, builder, stp_e, objects, values,
+                                    hasSolution, queryTimeout, timedOut);
+  } else
+#endif
   if (useForkedSTP) {
     success = runAndGetCexForked(vc, builder, stp_e, objects, values,
-                                 hasSolution, timeout);
+                                 hasSolution, queryTimeout, timedOut);
   } else {
     try {
         runAndGetCex(vc, builder, stp_e, objects, values, hasSolution);
@@ -880,7 +1202,17 @@ STPSolverImpl::computeInitialValues(const Query &query,
       ++stats::queriesValid;
   }
 
-  vc_pop(vc);
+  if (timedOut) {
+    ++timeoutCount;
+    ++stats::queryTimeouts;
+  }
+
+  if (adaptTimeout && (success || timedOut))
+    timeoutPredictor.record(features, queryTimer.check() / 1000000.,
+                            timedOut);
+
+  if (!UseIncrementalSTP)
+    vc_pop(vc);
 
 
   return success;
@@ -11,13 +11,27 @@
 
 using namespace klee;
 
+Statistic stats::cexCacheHits("CexCacheHits", "CChits");
+Statistic stats::cexCacheMisses("CexCacheMisses", "CCmisses");
 Statistic stats::cexCacheTime("CexCacheTime", "CCtime");
+Statistic stats::incrementalQueryReusedConstraints("IncrementalQueryReusedConstraints", "IQreused");
+Statistic stats::independentQueries("IndependentQueries", "IndQ");
+Statistic stats::independentQueriesReduced("IndependentQueriesReduced", "IndQreduced");
+Statistic stats::knownBitsHits("KnownBitsHits", "KBhits");
+Statistic stats::knownBitsMisses("KnownBitsMisses", "KBmisses");
 Statistic stats::queries("Queries", "Q");
 Statistic stats::queriesInvalid("QueriesInvalid", "Qiv");
 Statistic stats::queriesValid("QueriesValid", "Qv");
 Statistic stats::queryCacheHits("QueryCacheHits", "QChits") ;
 Statistic stats::queryCacheMisses("QueryCacheMisses", "QCmisses");
+Statistic stats::queryCanonicalCacheHits("QueryCanonicalCacheHits", "QCChits");
 Statistic stats::queryConstructTime("QueryConstructTime", "QBtime") ;
 Statistic stats::queryConstructs("QueriesConstructs", "QB");
 Statistic stats::queryCounterexamples("QueriesCEX", "Qcex");
 Statistic stats::queryTime("QueryTime", "Qtime");
+Statistic stats::queryTimeouts("QueryTimeouts", "Qto");
+Statistic stats::remoteSolverQueries("RemoteSolverQueries", "RSQ");
+Statistic stats::remoteSolverFallbacks("RemoteSolverFallbacks", "RSQlocal");
+Statistic stats::sharedQueryCacheHits("SharedQueryCacheHits", "SQChits");
+Statistic stats::sharedQueryCacheMisses("SharedQueryCacheMisses", "SQCmisses");
+Statistic stats::sharedQueryCacheCollisions("SharedQueryCacheCollisions", "SQCcoll");
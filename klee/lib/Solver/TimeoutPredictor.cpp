@@ -0,0 +1,140 @@
+//===-- TimeoutPredictor.cpp ----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "TimeoutPredictor.h"
+
+#include "klee/Constraints.h"
+#include "klee/Expr.h"
+#include "klee/Solver.h"
+
+#include "llvm/Support/CommandLine.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+using namespace klee;
+using namespace llvm;
+
+namespace {
+  cl::opt<unsigned>
+  AdaptiveTimeoutSamples("adaptive-stp-timeout-samples",
+                         cl::desc("Number of queries of a shape to observe before adapting their timeout (default=3)"),
+                         cl::init(3));
+
+  cl::opt<double>
+  AdaptiveTimeoutMargin("adaptive-stp-timeout-margin",
+                        cl::desc("Timeout of a query as a multiple of the longest solving time of its shape (default=4)"),
+                        cl::init(4.0));
+
+  cl::opt<double>
+  AdaptiveTimeoutMaxScale("adaptive-stp-timeout-max-scale",
+                          cl::desc("Largest timeout as a multiple of the configured one (default=2)"),
+                          cl::init(2.0));
+}
+
+/// The alarm used by the forked solver has a granularity of one second
+static const double minTimeout = 1.0;
+
+static unsigned getMagnitude(unsigned x) {
+  unsigned res = 0;
+  while (x >>= 1)
+    ++res;
+  return res;
+}
+
+static void visit(const ref<Expr> &e, std::set<const Expr*> &visited,
+                  std::set<const Array*> &arrays,
+                  TimeoutPredictor::Features &features) {
+  if (isa<ConstantExpr>(e) || !visited.insert(e.get()).second)
+    return;
+
+  ++features.nodes;
+
+  switch (e->getKind()) {
+  case Expr::Read: {
+    const ReadExpr *re = cast<ReadExpr>(e);
+    if (re->updates.root->isSymbolicArray())
+      arrays.insert(re->updates.root);
+    break;
+  }
+
+  case Expr::Mul:
+  case Expr::UDiv:
+  case Expr::SDiv:
+  case Expr::URem:
+  case Expr::SRem:
+    if (!isa<ConstantExpr>(e->getKid(0)) && !isa<ConstantExpr>(e->getKid(1)))
+      features.nonLinear = true;
+    break;
+
+  default:
+    break;
+  }
+
+  for (unsigned i = 0; i < e->getNumKids(); ++i)
+    visit(e->getKid(i), visited, arrays, features);
+}
+
+void TimeoutPredictor::getFeatures(const Query &query, Features &features) {
+  std::set<const Expr*> visited;
+  std::set<const Array*> arrays;
+
+  features = Features();
+  for (ConstraintManager::const_iterator it = query.constraints.begin(),
+         ie = query.constraints.end(); it != ie; ++it) {
+    ++features.constraints;
+    visit(*it, visited, arrays, features);
+  }
+  visit(query.expr, visited, arrays, features);
+  features.arrays = arrays.size();
+}
+
+uint64_t TimeoutPredictor::getShape(const Features &features) {
+  return (uint64_t) getMagnitude(features.nodes) |
+         (uint64_t) getMagnitude(features.constraints) << 8 |
+         (uint64_t) getMagnitude(features.arrays) << 16 |
+         (uint64_t) features.nonLinear << 24;
+}
+
+double TimeoutPredictor::getTimeout(const Features &features,
+                                    double timeout) const {
+  std::map<uint64_t, History>::const_iterator it =
+    history.find(getShape(features));
+  if (it == history.end())
+    return timeout;
+
+  const History &h = it->second;
+  if (h.solved + h.timedOut < AdaptiveTimeoutSamples)
+    return timeout;
+
+  // Queries of this shape never completed, give up on them sooner and
+  // sooner instead of paying the full timeout every time
+  if (!h.solved) {
+    double res = timeout / (1 << std::min(h.timedOut, 4u));
+    return std::max(minTimeout, res);
+  }
+
+  // Leave a margin over the slowest query that completed. A shape whose
+  // queries complete close to the limit may get more than the configured
+  // timeout.
+  double res = std::max(minTimeout, AdaptiveTimeoutMargin * h.maxTime);
+  return std::min(res, timeout * AdaptiveTimeoutMaxScale);
+}
+
+void TimeoutPredictor::record(const Features &features, double time,
+                              bool timedOut) {
+  History &h = history[getShape(features)];
+  if (timedOut) {
+    ++h.timedOut;
+  } else {
+    ++h.solved;
+    h.maxTime = std::max(h.maxTime, time);
+  }
+}
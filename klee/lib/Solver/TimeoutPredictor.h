@@ -0,0 +1,62 @@
+//===-- TimeoutPredictor.h --------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __UTIL_TIMEOUTPREDICTOR_H__
+#define __UTIL_TIMEOUTPREDICTOR_H__
+
+#include <map>
+#include <stdint.h>
+
+namespace klee {
+  struct Query;
+
+  /// TimeoutPredictor - Choose the timeout of a query from the solving times
+  /// of the queries of the same shape seen earlier in the run. The shape is
+  /// made of the orders of magnitude of the number of constraints, arrays
+  /// and expression nodes, and of the presence of non-linear arithmetic.
+  class TimeoutPredictor {
+  public:
+    struct Features {
+      unsigned constraints;
+      unsigned arrays;
+      unsigned nodes;
+      bool nonLinear;
+
+      Features() : constraints(0), arrays(0), nodes(0), nonLinear(false) {}
+    };
+
+  private:
+    struct History {
+      unsigned solved;
+      unsigned timedOut;
+      /// The longest time taken by a query that did not time out
+      double maxTime;
+
+      History() : solved(0), timedOut(0), maxTime(0) {}
+    };
+
+    std::map<uint64_t, History> history;
+
+    static uint64_t getShape(const Features &features);
+
+  public:
+    /// Compute the features of the query, in one pass over the constraints
+    /// and the query expression.
+    static void getFeatures(const Query &query, Features &features);
+
+    /// Return the timeout in seconds to use for a query with the given
+    /// features, the configured timeout being timeout.
+    double getTimeout(const Features &features, double timeout) const;
+
+    /// Record the outcome of a query.
+    void record(const Features &features, double time, bool timedOut);
+  };
+}
+
+#endif
@@ -0,0 +1,123 @@
+//===-- PerfCounters.cpp --------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Internal/Support/PerfCounters.h"
+
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace klee;
+
+int PerfCounters::groupFd = -1;
+int PerfCounters::fds[CounterCount] = { -1, -1, -1, -1 };
+PerfCounters::Region PerfCounters::current = PerfCounters::Concrete;
+uint64_t PerfCounters::last[CounterCount];
+uint64_t PerfCounters::values[RegionCount][CounterCount];
+
+#ifdef __linux__
+static int openCounter(uint64_t config, int groupFd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = groupFd < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+
+  return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+#endif
+
+bool PerfCounters::open() {
+  close();
+
+#ifdef __linux__
+  static const uint64_t configs[CounterCount] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+  };
+
+  // The first counter that opens leads the group, so that all of them
+  // are read with a single system call.
+  for (unsigned i = 0; i < CounterCount; ++i) {
+    fds[i] = openCounter(configs[i], groupFd);
+    if (groupFd < 0)
+      groupFd = fds[i];
+  }
+
+  if (groupFd < 0)
+    return false;
+
+  ioctl(groupFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(groupFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+  // Start from zero, events before open() are not attributed
+  memset(last, 0, sizeof(last));
+  return true;
+#else
+  return false;
+#endif
+}
+
+void PerfCounters::close() {
+#ifdef __linux__
+  for (unsigned i = 0; i < CounterCount; ++i) {
+    if (fds[i] >= 0)
+      ::close(fds[i]);
+    fds[i] = -1;
+  }
+#endif
+  groupFd = -1;
+}
+
+PerfCounters::Region PerfCounters::enterSlow(Region r) {
+#ifdef __linux__
+  // nr, followed by the value of each member in opening order
+  uint64_t buffer[1 + CounterCount];
+  ssize_t size = read(groupFd, buffer, sizeof(buffer));
+  if (size >= (ssize_t) sizeof(uint64_t)) {
+    unsigned member = 0;
+    for (unsigned i = 0; i < CounterCount; ++i) {
+      if (fds[i] < 0 || member >= buffer[0])
+        continue;
+      uint64_t value = buffer[1 + member++];
+      values[current][i] += value - last[i];
+      last[i] = value;
+    }
+  }
+#endif
+
+  Region previous = current;
+  current = r;
+  return previous;
+}
+
+const char *PerfCounters::getRegionName(Region r) {
+  static const char *names[RegionCount] = {
+    "Concrete", "Symbolic", "Solver", "StateSwitch"
+  };
+  return names[r];
+}
+
+const char *PerfCounters::getCounterName(Counter c) {
+  static const char *names[CounterCount] = {
+    "Cycles", "Instructions", "CacheMisses", "BranchMisses"
+  };
+  return names[c];
+}
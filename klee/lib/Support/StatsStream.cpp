@@ -0,0 +1,96 @@
+//===-- StatsStream.cpp ---------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Internal/Support/StatsStream.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <cassert>
+
+using namespace klee;
+
+static const char statsStreamMagic[8] = {'K', 'S', 'T', 'A', 'T', 'S', '0', '1'};
+
+void StatsRecord::addString(const std::string &value) {
+  uint16_t size = value.size() < 0xffff ? value.size() : 0xffff;
+  data.append((const char*) &size, sizeof(size));
+  data.append(value.data(), size);
+}
+
+///
+
+void StatsRow::add(const std::string &name, Kind kind, bool real,
+                   uint64_t value, double realValue) {
+  Column c;
+  c.name = name;
+  c.kind = kind;
+  c.real = real;
+  c.value = value;
+  c.realValue = realValue;
+  columns.push_back(c);
+}
+
+void StatsRow::writeTextHeader(llvm::raw_ostream &os) const {
+  os << "(";
+  for (unsigned i = 0; i < columns.size(); ++i)
+    os << "'" << columns[i].name << "',";
+  os << ")\n";
+}
+
+void StatsRow::writeTextLine(llvm::raw_ostream &os) const {
+  os << "(";
+  for (unsigned i = 0; i < columns.size(); ++i) {
+    if (i)
+      os << ",";
+    if (columns[i].real)
+      os << columns[i].realValue;
+    else
+      os << columns[i].value;
+  }
+  os << ")\n";
+}
+
+void StatsRow::getColumns(StatsRecord &record) const {
+  record.addInt32(columns.size());
+  for (unsigned i = 0; i < columns.size(); ++i) {
+    record.addInt32(columns[i].kind | (columns[i].real << 8));
+    record.addString(columns[i].name);
+  }
+}
+
+void StatsRow::getValues(StatsRecord &record) const {
+  for (unsigned i = 0; i < columns.size(); ++i) {
+    if (columns[i].real)
+      record.addDouble(columns[i].realValue);
+    else
+      record.addInt64(columns[i].value);
+  }
+}
+
+///
+
+StatsStreamWriter::StatsStreamWriter(llvm::raw_ostream *_os) : os(_os) {
+  assert(os && "unable to open statistics stream");
+  os->write(statsStreamMagic, sizeof(statsStreamMagic));
+}
+
+StatsStreamWriter::~StatsStreamWriter() {
+  os->flush();
+  delete os;
+}
+
+void StatsStreamWriter::write(RecordType type, const StatsRecord &record) {
+  uint32_t header[2] = { type, (uint32_t) record.getData().size() };
+  os->write((const char*) header, sizeof(header));
+  os->write(record.getData().data(), record.getData().size());
+}
+
+void StatsStreamWriter::flush() {
+  os->flush();
+}
@@ -7,7 +7,10 @@
 #include "klee/Expr.h"
 #include "klee/ExprBuilder.h"
 #include "klee/Solver.h"
+#include "klee/SolverStats.h"
 #include "klee/Statistics.h"
+#include "klee/Internal/ADT/KTest.h"
+#include "klee/Internal/System/Time.h"
 #include "klee/util/ExprPPrinter.h"
 #include "klee/util/ExprVisitor.h"
 
@@ -20,6 +23,13 @@
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/system_error.h"
 
+#include <algorithm>
+#include <sstream>
+
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 using namespace llvm;
 using namespace klee;
 using namespace klee::expr;
@@ -32,7 +42,10 @@ namespace {
   enum ToolActions {
     PrintTokens,
     PrintAST,
-    Evaluate
+    Evaluate,
+    Benchmark,
+    NegateBranches,
+    Serve
   };
 
   static llvm::cl::opt<ToolActions> 
@@ -45,6 +58,12 @@ namespace {
                         "Print parsed AST nodes from the input file."),
              clEnumValN(Evaluate, "evaluate",
                         "Print parsed AST nodes from the input file."),
+             clEnumValN(Benchmark, "bench",
+                        "Replay the queries through solver chains and report latencies."),
+             clEnumValN(NegateBranches, "negate-branches",
+                        "Write the inputs that negate each constraint of the queries, after the previous ones."),
+             clEnumValN(Serve, "serve",
+                        "Answer the queries of the -remote-solvers of KLEE and S2E."),
              clEnumValEnd));
 
   enum BuilderKinds {
@@ -77,6 +96,52 @@ namespace {
   cl::opt<bool>
   UseSTPQueryPCLog("use-stp-query-pc-log",
                    cl::init(false));
+
+  cl::list<std::string>
+  BenchChains("bench-chain",
+              cl::desc("Solver chain to benchmark, as a comma-separated list of "
+                       "layers from the outermost one (independent, cache, "
+                       "cexcache, fastcex, knownbits). Can be repeated "
+                       "(default=independent,cache,cexcache)"),
+              cl::ZeroOrMore);
+
+  cl::opt<unsigned>
+  BenchJobs("bench-jobs",
+            cl::desc("Number of processes that replay the queries of each chain"),
+            cl::init(1));
+
+  cl::opt<std::string>
+  NegateOutputDir("negate-output-dir",
+                  cl::desc("Folder where -negate-branches writes the .ktest files (default=.)"),
+                  cl::init("."));
+
+  cl::opt<unsigned>
+  NegateJobs("negate-jobs",
+             cl::desc("Number of processes that solve the negated constraints"),
+             cl::init(1));
+
+  cl::opt<unsigned>
+  ServePort("serve-port",
+            cl::desc("TCP port on which -serve listens (default=9999)"),
+            cl::init(9999));
+
+  cl::opt<unsigned>
+  ServeJobs("serve-jobs",
+            cl::desc("Number of queries that -serve solves at the same time, "
+                     "0 for the number of cores (default=0)"),
+            cl::init(0));
+
+  cl::opt<std::string>
+  ServeChain("serve-chain",
+             cl::desc("Solver chain of -serve, as in -bench-chain "
+                      "(default=independent,cache,cexcache)"),
+             cl::init("independent,cache,cexcache"));
+
+  cl::opt<double>
+  ServeTimeout("serve-timeout",
+               cl::desc("Timeout of the queries answered by -serve in seconds, "
+                        "0 for none (default=0)"),
+               cl::init(0));
 }
 
 static std::string escapedString(const char *start, unsigned length) {
@@ -263,12 +328,474 @@ static bool EvaluateInputAST(const char *Filename,
   return success;
 }
 
+/// Fields of the summary that a benchmark worker sends back
+enum BenchCounter {
+  BenchFailures,
+  BenchQueryCacheHits,
+  BenchQueryCacheMisses,
+  BenchCexCacheHits,
+  BenchCexCacheMisses,
+  BenchIndependentQueries,
+  BenchIndependentQueriesReduced,
+  BenchSTPQueries,
+  BenchLatencies,
+  BenchCounterCount
+};
+
+static bool ParseSolverChain(const std::string &Chain,
+                             std::vector<std::string> &Layers) {
+  std::stringstream ss(Chain);
+  std::string Layer;
+  while (std::getline(ss, Layer, ',')) {
+    if (Layer.empty())
+      continue;
+    if (Layer != "independent" && Layer != "cache" &&
+        Layer != "cexcache" && Layer != "fastcex" && Layer != "knownbits") {
+      std::cerr << "error: unknown solver layer " << Layer << "\n";
+      return false;
+    }
+    Layers.push_back(Layer);
+  }
+  return true;
+}
+
+static Solver *BuildSolverChain(const std::vector<std::string> &Layers,
+                                Solver *S) {
+  // Layers are listed from the outermost one
+  for (std::vector<std::string>::const_reverse_iterator it = Layers.rbegin(),
+         ie = Layers.rend(); it != ie; ++it) {
+    if (*it == "independent")
+      S = createIndependentSolver(S);
+    else if (*it == "cache")
+      S = createCachingSolver(S);
+    else if (*it == "cexcache")
+      S = createCexCachingSolver(S);
+    else if (*it == "fastcex")
+      S = createFastCexSolver(S);
+    else if (*it == "knownbits")
+      S = createKnownBitsSolver(S);
+  }
+  return S;
+}
+
+static bool RunQueryCommand(Solver *S, QueryCommand *QC) {
+  ConstraintManager Constraints(QC->Constraints);
+
+  if (QC->Values.empty() && QC->Objects.empty()) {
+    bool result;
+    return S->mustBeTrue(Query(Constraints, QC->Query), result);
+  }
+
+  if (!QC->Values.empty()) {
+    ref<ConstantExpr> result;
+    return S->getValue(Query(Constraints, QC->Values[0]), result);
+  }
+
+  std::vector< std::vector<unsigned char> > result;
+  return S->getInitialValues(Query(Constraints, QC->Query), QC->Objects,
+                             result);
+}
+
+static bool WriteAll(int fd, const void *buf, size_t size) {
+  const char *p = (const char*) buf;
+  while (size) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool ReadAll(int fd, void *buf, size_t size) {
+  char *p = (char*) buf;
+  while (size) {
+    ssize_t n = read(fd, p, size);
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+/// Replays every Jobs-th query starting at First and sends the
+/// counters and latencies on fd. Runs in a forked process.
+static void RunBenchmarkWorker(const std::vector<std::string> &Layers,
+                               const std::vector<QueryCommand*> &Queries,
+                               unsigned First, unsigned Jobs, int fd) {
+  Solver *S = BuildSolverChain(Layers, UseDummySolver ? createDummySolver() :
+                                                        new STPSolver(false));
+
+  uint64_t Counters[BenchCounterCount] = {0};
+  std::vector<double> Latencies;
+
+  for (unsigned i = First; i < Queries.size(); i += Jobs) {
+    double Start = util::getWallTime();
+    if (!RunQueryCommand(S, Queries[i]))
+      ++Counters[BenchFailures];
+    Latencies.push_back(util::getWallTime() - Start);
+  }
+
+  Counters[BenchQueryCacheHits] = stats::queryCacheHits;
+  Counters[BenchQueryCacheMisses] = stats::queryCacheMisses;
+  Counters[BenchCexCacheHits] = stats::cexCacheHits;
+  Counters[BenchCexCacheMisses] = stats::cexCacheMisses;
+  Counters[BenchIndependentQueries] = stats::independentQueries;
+  Counters[BenchIndependentQueriesReduced] = stats::independentQueriesReduced;
+  Counters[BenchSTPQueries] = stats::queries;
+  Counters[BenchLatencies] = Latencies.size();
+
+  bool ok = WriteAll(fd, Counters, sizeof(Counters));
+  if (ok && !Latencies.empty())
+    ok = WriteAll(fd, &Latencies[0], Latencies.size() * sizeof(double));
+
+  delete S;
+  _exit(ok ? 0 : 1);
+}
+
+static void PrintRate(const char *Name, uint64_t Hits, uint64_t Total) {
+  std::cout << "  " << Name << " = ";
+  if (Total)
+    std::cout << (100.0 * Hits / Total) << "% ";
+  else
+    std::cout << "n/a ";
+  std::cout << "(" << Hits << "/" << Total << ")\n";
+}
+
+static double Percentile(const std::vector<double> &Sorted, double P) {
+  if (Sorted.empty())
+    return 0;
+  size_t i = (size_t) (P * Sorted.size());
+  return Sorted[std::min(i, Sorted.size() - 1)];
+}
+
+static bool BenchmarkChain(const std::string &Chain,
+                           const std::vector<QueryCommand*> &Queries) {
+  std::vector<std::string> Layers;
+  if (!ParseSolverChain(Chain, Layers))
+    return false;
+
+  unsigned Jobs = BenchJobs ? BenchJobs : 1;
+  std::vector<int> Fds;
+  std::vector<pid_t> Pids;
+
+  // STP keeps global state, each chain gets fresh processes
+  std::cout.flush();
+  double Start = util::getWallTime();
+  for (unsigned j = 0; j < Jobs; ++j) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+      std::cerr << "error: could not create pipe\n";
+      return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "error: could not fork benchmark worker\n";
+      return false;
+    }
+
+    if (pid == 0) {
+      close(fds[0]);
+      RunBenchmarkWorker(Layers, Queries, j, Jobs, fds[1]);
+    }
+
+    close(fds[1]);
+    Fds.push_back(fds[0]);
+    Pids.push_back(pid);
+  }
+
+  bool success = true;
+  uint64_t Totals[BenchCounterCount] = {0};
+  std::vector<double> Latencies;
+
+  for (unsigned j = 0; j < Jobs; ++j) {
+    uint64_t Counters[BenchCounterCount];
+    if (!ReadAll(Fds[j], Counters, sizeof(Counters))) {
+      std::cerr << "error: benchmark worker " << j << " failed\n";
+      success = false;
+    } else {
+      size_t Offset = Latencies.size();
+      Latencies.resize(Offset + Counters[BenchLatencies]);
+      if (Counters[BenchLatencies] &&
+          !ReadAll(Fds[j], &Latencies[Offset],
+                   Counters[BenchLatencies] * sizeof(double))) {
+        std::cerr << "error: benchmark worker " << j << " failed\n";
+        Latencies.resize(Offset);
+        success = false;
+      } else {
+        for (unsigned i = 0; i < BenchCounterCount; ++i)
+          Totals[i] += Counters[i];
+      }
+    }
+    close(Fds[j]);
+    waitpid(Pids[j], NULL, 0);
+  }
+  double Elapsed = util::getWallTime() - Start;
+
+  std::sort(Latencies.begin(), Latencies.end());
+
+  uint64_t QueryCacheLookups =
+    Totals[BenchQueryCacheHits] + Totals[BenchQueryCacheMisses];
+  uint64_t CexCacheLookups =
+    Totals[BenchCexCacheHits] + Totals[BenchCexCacheMisses];
+
+  std::cout << "Chain " << Chain << " (" << Jobs << " jobs):\n"
+            << "  queries = " << Latencies.size()
+            << ", failures = " << Totals[BenchFailures] << "\n"
+            << "  wall time = " << Elapsed << "s\n"
+            << "  p50 latency = " << Percentile(Latencies, 0.50) << "s\n"
+            << "  p99 latency = " << Percentile(Latencies, 0.99) << "s\n";
+  PrintRate("CachingSolver hits", Totals[BenchQueryCacheHits],
+            QueryCacheLookups);
+  PrintRate("CexCachingSolver hits", Totals[BenchCexCacheHits],
+            CexCacheLookups);
+  PrintRate("IndependentSolver reduced queries",
+            Totals[BenchIndependentQueriesReduced],
+            Totals[BenchIndependentQueries]);
+  std::cout << "  STP queries = " << Totals[BenchSTPQueries] << "\n";
+
+  return success;
+}
+
+static bool BenchmarkInputAST(const char *Filename,
+                              const MemoryBuffer *MB,
+                              ExprBuilder *Builder) {
+  std::vector<Decl*> Decls;
+  Parser *P = Parser::Create(Filename, MB, Builder);
+  P->SetMaxErrors(20);
+  while (Decl *D = P->ParseTopLevelDecl()) {
+    Decls.push_back(D);
+  }
+
+  bool success = true;
+  if (unsigned N = P->GetNumErrors()) {
+    std::cerr << Filename << ": parse failure: "
+               << N << " errors.\n";
+    success = false;
+  }
+
+  std::vector<QueryCommand*> Queries;
+  for (std::vector<Decl*>::iterator it = Decls.begin(),
+         ie = Decls.end(); it != ie; ++it) {
+    if (QueryCommand *QC = dyn_cast<QueryCommand>(*it))
+      Queries.push_back(QC);
+  }
+
+  if (success) {
+    std::vector<std::string> Chains(BenchChains.begin(), BenchChains.end());
+    if (Chains.empty())
+      Chains.push_back("independent,cache,cexcache");
+
+    for (unsigned i = 0; i < Chains.size(); ++i)
+      success &= BenchmarkChain(Chains[i], Queries);
+  }
+
+  for (std::vector<Decl*>::iterator it = Decls.begin(),
+         ie = Decls.end(); it != ie; ++it)
+    delete *it;
+  delete P;
+
+  return success;
+}
+
+static bool WriteNegatedInput(const QueryCommand *QC, unsigned QueryIndex,
+                              unsigned Branch,
+                              const std::vector< std::vector<unsigned char> > &Values) {
+  std::vector<KTestObject> Objects(Values.size());
+  for (unsigned i = 0; i < Values.size(); ++i) {
+    Objects[i].name = const_cast<char*>(QC->Objects[i]->name.c_str());
+    Objects[i].numBytes = Values[i].size();
+    Objects[i].bytes = const_cast<unsigned char*>(Values[i].empty() ? 0 : &Values[i][0]);
+  }
+
+  KTest Test;
+  Test.version = kTest_getCurrentVersion();
+  Test.numArgs = 0;
+  Test.args = 0;
+  Test.symArgvs = 0;
+  Test.symArgvLen = 0;
+  Test.numObjects = Objects.size();
+  Test.objects = Objects.empty() ? 0 : &Objects[0];
+
+  std::stringstream Path;
+  Path << NegateOutputDir << "/query" << QueryIndex << "-branch" << Branch << ".ktest";
+  return kTest_toFile(&Test, Path.str().c_str());
+}
+
+/// Solves every Jobs-th constraint starting at First and sends the number
+/// of written inputs and of failures on fd. Runs in a forked process.
+static void RunNegateWorker(const std::vector<QueryCommand*> &Queries,
+                            unsigned First, unsigned Jobs, int fd) {
+  Solver *S = UseDummySolver ? createDummySolver() : new STPSolver(false);
+  S = createCachingSolver(S);
+
+  uint64_t Counters[2] = {0};
+  unsigned Index = 0;
+  for (unsigned q = 0; q < Queries.size(); ++q) {
+    const QueryCommand *QC = Queries[q];
+    const std::vector< ref<Expr> > &Constraints = QC->Constraints;
+
+    for (unsigned i = 0; i < Constraints.size(); ++i, ++Index) {
+      if (Index % Jobs != First)
+        continue;
+
+      // The inputs for which the constraint is false on this path prefix
+      std::vector< ref<Expr> > Prefix(Constraints.begin(), Constraints.begin() + i);
+      std::vector< std::vector<unsigned char> > Values;
+      if (!S->getInitialValues(Query(ConstraintManager(Prefix), Constraints[i]),
+                               QC->Objects, Values))
+        continue;
+
+      if (WriteNegatedInput(QC, q, i, Values))
+        ++Counters[0];
+      else
+        ++Counters[1];
+    }
+  }
+
+  bool ok = WriteAll(fd, Counters, sizeof(Counters));
+  delete S;
+  _exit(ok ? 0 : 1);
+}
+
+/// Takes the path constraints logged by S2E in --concolic-trace-only
+/// mode, and writes one test case for each branch that can go the other
+/// way. The test cases can seed the next runs.
+static bool NegateInputAST(const char *Filename,
+                           const MemoryBuffer *MB,
+                           ExprBuilder *Builder) {
+  std::vector<Decl*> Decls;
+  Parser *P = Parser::Create(Filename, MB, Builder);
+  P->SetMaxErrors(20);
+  while (Decl *D = P->ParseTopLevelDecl()) {
+    Decls.push_back(D);
+  }
+
+  bool success = true;
+  if (unsigned N = P->GetNumErrors()) {
+    std::cerr << Filename << ": parse failure: "
+               << N << " errors.\n";
+    success = false;
+  }
+
+  std::vector<QueryCommand*> Queries;
+  for (std::vector<Decl*>::iterator it = Decls.begin(),
+         ie = Decls.end(); it != ie; ++it) {
+    if (QueryCommand *QC = dyn_cast<QueryCommand>(*it))
+      if (!QC->Objects.empty())
+        Queries.push_back(QC);
+  }
+
+  unsigned Jobs = NegateJobs ? NegateJobs : 1;
+  std::vector<int> Fds;
+  std::vector<pid_t> Pids;
+
+  for (unsigned i = 0; success && i < Jobs; ++i) {
+    int Pipe[2];
+    if (pipe(Pipe) < 0) {
+      perror("pipe");
+      success = false;
+      break;
+    }
+
+    pid_t Pid = fork();
+    if (Pid < 0) {
+      perror("fork");
+      close(Pipe[0]);
+      close(Pipe[1]);
+      success = false;
+      break;
+    }
+
+    if (Pid == 0) {
+      close(Pipe[0]);
+      RunNegateWorker(Queries, i, Jobs, Pipe[1]);
+    }
+
+    close(Pipe[1]);
+    Fds.push_back(Pipe[0]);
+    Pids.push_back(Pid);
+  }
+
+  uint64_t Written = 0, Failed = 0;
+  for (unsigned i = 0; i < Fds.size(); ++i) {
+    uint64_t Counters[2];
+    if (ReadAll(Fds[i], Counters, sizeof(Counters))) {
+      Written += Counters[0];
+      Failed += Counters[1];
+    } else {
+      std::cerr << "error: negation worker " << i << " failed\n";
+      success = false;
+    }
+    close(Fds[i]);
+
+    int Status;
+    while (waitpid(Pids[i], &Status, 0) < 0 && errno == EINTR)
+      ;
+  }
+
+  std::cout << "Wrote " << Written << " inputs from " << Queries.size()
+            << " paths to " << NegateOutputDir << "\n";
+  if (Failed) {
+    std::cerr << "error: could not write " << Failed << " inputs\n";
+    success = false;
+  }
+
+  for (std::vector<Decl*>::iterator it = Decls.begin(),
+         ie = Decls.end(); it != ie; ++it)
+    delete *it;
+  delete P;
+
+  return success;
+}
+
+/// Answers the queries of remote solvers until an error occurs
+static bool ServeQueries() {
+  std::vector<std::string> Layers;
+  if (!ParseSolverChain(ServeChain, Layers))
+    return false;
+
+  // Timeouts need a forked STP
+  Solver *S;
+  if (UseDummySolver) {
+    S = createDummySolver();
+  } else {
+    STPSolver *STP = new STPSolver(ServeTimeout > 0);
+    if (ServeTimeout > 0)
+      STP->setTimeout(ServeTimeout);
+    S = STP;
+  }
+  S = BuildSolverChain(Layers, S);
+
+  unsigned Jobs = ServeJobs;
+  if (!Jobs) {
+    long Cores = sysconf(_SC_NPROCESSORS_ONLN);
+    Jobs = Cores > 0 ? Cores : 1;
+  }
+
+  std::cerr << "kleaver: serving queries on port " << ServePort
+            << " with " << Jobs << " jobs\n";
+  bool success = serveSolverQueries(S, ServePort, Jobs);
+  delete S;
+  return success;
+}
+
 int main(int argc, char **argv) {
   bool success = true;
 
   llvm::sys::PrintStackTraceOnErrorSignal();
   llvm::cl::ParseCommandLineOptions(argc, argv);
 
+  // The server does not read any input
+  if (ToolAction == Serve) {
+    success = ServeQueries();
+    llvm::llvm_shutdown();
+    return success ? 0 : 1;
+  }
+
   llvm::error_code ErrorStr;
   llvm::OwningPtr<MemoryBuffer>MB;
   if ((ErrorStr = MemoryBuffer::getFileOrSTDIN(InputFile, MB))) {
@@ -304,6 +831,14 @@ int main(int argc, char **argv) {
     success = EvaluateInputAST(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
                                MB.get(), Builder);
     break;
+  case Benchmark:
+    success = BenchmarkInputAST(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
+                                MB.get(), Builder);
+    break;
+  case NegateBranches:
+    success = NegateInputAST(InputFile=="-" ? "<stdin>" : InputFile.c_str(),
+                             MB.get(), Builder);
+    break;
   default:
     std::cerr << argv[0] << ": error: Unknown program action!\n";
   }
@@ -0,0 +1,110 @@
+//===-- ExprBytecodeTest.cpp ----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Expr.h"
+#include "klee/util/Assignment.h"
+#include "klee/util/ExprBytecode.h"
+
+using namespace klee;
+
+namespace {
+
+ref<Expr> getConstant(uint64_t value, Expr::Width width) {
+  return ConstantExpr::create(value & (((uint64_t) -1LL) >> (64 - width)),
+                              width);
+}
+
+// Check the bytecode against the tree evaluator for all values of the
+// first two bytes of the array.
+void checkAgainstEvaluator(const Array *array, ref<Expr> e) {
+  ExprBytecode program;
+  ASSERT_TRUE(program.add(e));
+
+  std::vector<const Array*> objects(1, array);
+  for (unsigned b0 = 0; b0 < 256; b0 += 7) {
+    for (unsigned b1 = 0; b1 < 256; b1 += 5) {
+      std::vector< std::vector<unsigned char> >
+        values(1, std::vector<unsigned char>(array->size, 0));
+      values[0][0] = b0;
+      values[0][1] = b1;
+      Assignment a(objects, values);
+
+      bool result;
+      ASSERT_TRUE(program.satisfies(a, result));
+      EXPECT_EQ(a.evaluate(e)->isTrue(), result);
+    }
+  }
+}
+
+TEST(ExprBytecodeTest, Arithmetic) {
+  Array *array = new Array("arr", 4);
+  ref<Expr> b0 = ReadExpr::create(UpdateList(array, 0), getConstant(0, 32));
+  ref<Expr> b1 = ReadExpr::create(UpdateList(array, 0), getConstant(1, 32));
+  ref<Expr> w = ConcatExpr::create(b1, b0);
+  ref<Expr> s = SExtExpr::create(b0, 32);
+
+  checkAgainstEvaluator(array,
+    UltExpr::create(AddExpr::create(w, getConstant(1000, 16)),
+                    MulExpr::create(ZExtExpr::create(b1, 16),
+                                    getConstant(3, 16))));
+  checkAgainstEvaluator(array,
+    SltExpr::create(s, SubExpr::create(getConstant(0, 32),
+                                       ZExtExpr::create(b1, 32))));
+  checkAgainstEvaluator(array,
+    EqExpr::create(ExtractExpr::create(w, 4, 8),
+                   XorExpr::create(b0, b1)));
+  checkAgainstEvaluator(array,
+    EqExpr::create(AShrExpr::create(s, ZExtExpr::create(b1, 32)),
+                   LShrExpr::create(s, getConstant(3, 32))));
+  checkAgainstEvaluator(array,
+    SleExpr::create(SRemExpr::create(b0, getConstant(0xfd, 8)),
+                    SDivExpr::create(b1, getConstant(7, 8))));
+}
+
+TEST(ExprBytecodeTest, Updates) {
+  Array *array = new Array("arr", 4);
+  UpdateList ul(array, 0);
+  ref<Expr> b0 = ReadExpr::create(ul, getConstant(0, 32));
+  ul.extend(getConstant(2, 32), getConstant(42, 8));
+  ul.extend(ZExtExpr::create(b0, 32), getConstant(7, 8));
+
+  ref<Expr> r = ReadExpr::create(ul, getConstant(2, 32));
+  checkAgainstEvaluator(array, EqExpr::create(r, getConstant(42, 8)));
+
+  ref<Expr> rs = ReadExpr::create(ul, ZExtExpr::create(
+      ReadExpr::create(UpdateList(array, 0), getConstant(1, 32)), 32));
+  checkAgainstEvaluator(array, UltExpr::create(rs, getConstant(8, 8)));
+}
+
+TEST(ExprBytecodeTest, Unsupported) {
+  Array *array = new Array("arr", 4);
+  ref<Expr> b0 = ReadExpr::create(UpdateList(array, 0), getConstant(0, 32));
+  ref<Expr> b1 = ReadExpr::create(UpdateList(array, 0), getConstant(1, 32));
+
+  // Wider than 64 bits
+  ExprBytecode program;
+  EXPECT_FALSE(program.add(UltExpr::create(ZExtExpr::create(b0, 128),
+                                           ZExtExpr::create(b1, 128))));
+  EXPECT_TRUE(program.empty());
+
+  // Division by zero is left to the tree evaluator
+  EXPECT_TRUE(program.add(EqExpr::create(UDivExpr::create(getConstant(1, 8),
+                                                          b0),
+                                         getConstant(0, 8))));
+  std::vector<const Array*> objects(1, array);
+  std::vector< std::vector<unsigned char> >
+    values(1, std::vector<unsigned char>(4, 0));
+  Assignment a(objects, values);
+  bool result;
+  EXPECT_FALSE(program.satisfies(a, result));
+}
+
+}
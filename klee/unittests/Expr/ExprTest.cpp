@@ -10,7 +10,9 @@
 #include <iostream>
 #include "gtest/gtest.h"
 
+#include "klee/Constraints.h"
 #include "klee/Expr.h"
+#include "klee/util/ExprSerializer.h"
 
 using namespace klee;
 
@@ -110,4 +112,213 @@ TEST(ExprTest, ExtractConcat) {
   EXPECT_EQ(Expr::Extract, concat2->getKid(1)->getKind());
 }
 
+class CountingAllocator : public ExprAllocator {
+public:
+  std::set<void*> live;
+  unsigned allocations;
+
+  CountingAllocator() : allocations(0) {}
+
+  void *allocate(size_t size) {
+    void *ptr = ::operator new(size);
+    live.insert(ptr);
+    ++allocations;
+    return ptr;
+  }
+
+  bool deallocate(void *ptr) {
+    if (!live.erase(ptr))
+      return false;
+    ::operator delete(ptr);
+    return true;
+  }
+};
+
+TEST(ExprTest, CustomAllocator) {
+  Array *array = new Array("arr4", 256);
+  ref<Expr> before = Expr::createTempRead(array, 32);
+
+  CountingAllocator allocator;
+  Expr::setAllocator(&allocator);
+  {
+    ref<Expr> read = Expr::createTempRead(array, 32);
+    ref<Expr> add = AddExpr::create(read, before);
+    EXPECT_LT(0U, allocator.allocations);
+    EXPECT_FALSE(allocator.live.empty());
+  }
+
+  // Nodes allocated before are still freed on the heap
+  before = 0;
+  EXPECT_TRUE(allocator.live.empty());
+
+  Expr::setAllocator(0);
+}
+
+TEST(ExprTest, RelatedConstraints) {
+  Array *a = new Array("a", 16);
+  Array *b = new Array("b", 16);
+  ref<Expr> a0 = ReadExpr::create(UpdateList(a, 0), getConstant(0, 32));
+  ref<Expr> a1 = ReadExpr::create(UpdateList(a, 0), getConstant(1, 32));
+  ref<Expr> b0 = ReadExpr::create(UpdateList(b, 0), getConstant(0, 32));
+  ref<Expr> c10 = getConstant(10, 8);
+
+  ConstraintManager cm;
+  cm.addConstraint(UltExpr::create(a0, c10));
+  cm.addConstraint(UltExpr::create(a1, c10));
+  cm.addConstraint(UltExpr::create(b0, c10));
+
+  std::vector< ref<Expr> > related;
+  cm.getRelatedConstraints(EqExpr::create(a1, c10), related);
+  ASSERT_EQ(1U, related.size());
+  EXPECT_EQ(UltExpr::create(a1, c10), related[0]);
+
+  // A copy shares the partition until it gets a new constraint
+  ConstraintManager copy(cm);
+  copy.addConstraint(UltExpr::create(a0, b0));
+
+  related.clear();
+  copy.getRelatedConstraints(EqExpr::create(b0, c10), related);
+  EXPECT_EQ(3U, related.size());
+
+  related.clear();
+  cm.getRelatedConstraints(EqExpr::create(b0, c10), related);
+  EXPECT_EQ(1U, related.size());
+
+  // A symbolic index relates every byte of the array
+  ref<Expr> ai = ReadExpr::create(UpdateList(a, 0), ZExtExpr::create(b0, 32));
+  related.clear();
+  cm.getRelatedConstraints(EqExpr::create(ai, c10), related);
+  EXPECT_EQ(3U, related.size());
+}
+
+TEST(ExprTest, EqualitySubstitution) {
+  Array *a = new Array("a", 16);
+  Array *b = new Array("b", 16);
+  ref<Expr> a0 = ReadExpr::create(UpdateList(a, 0), getConstant(0, 32));
+  ref<Expr> a1 = ReadExpr::create(UpdateList(a, 0), getConstant(1, 32));
+  ref<Expr> b0 = ReadExpr::create(UpdateList(b, 0), getConstant(0, 32));
+  ref<Expr> c5 = getConstant(5, 8);
+  ref<Expr> c10 = getConstant(10, 8);
+
+  ConstraintManager cm;
+  cm.addConstraint(UltExpr::create(AddExpr::create(a0, b0), c10));
+  cm.addConstraint(UltExpr::create(a1, c10));
+
+  // A copy keeps its constraints when the original learns an equality
+  ConstraintManager copy(cm);
+  cm.addConstraint(EqExpr::create(c5, b0));
+
+  ASSERT_EQ(3U, cm.size());
+  std::vector< ref<Expr> > constraints(cm.begin(), cm.end());
+  EXPECT_EQ(UltExpr::create(a1, c10), constraints[0]);
+  EXPECT_EQ(UltExpr::create(AddExpr::create(a0, c5), c10), constraints[1]);
+  EXPECT_EQ(EqExpr::create(c5, b0), constraints[2]);
+
+  EXPECT_EQ(AddExpr::create(a1, c5), cm.simplifyExpr(AddExpr::create(a1, b0)));
+
+  ASSERT_EQ(2U, copy.size());
+  EXPECT_EQ(UltExpr::create(AddExpr::create(a0, b0), c10), *copy.begin());
+  EXPECT_EQ(AddExpr::create(a1, b0), copy.simplifyExpr(AddExpr::create(a1, b0)));
+}
+
+TEST(ExprTest, IndependentExpr) {
+  Array *a = new Array("a", 16);
+  Array *b = new Array("b", 16);
+  ref<Expr> a0 = ReadExpr::create(UpdateList(a, 0), getConstant(0, 32));
+  ref<Expr> a1 = ReadExpr::create(UpdateList(a, 0), getConstant(1, 32));
+  ref<Expr> b0 = ReadExpr::create(UpdateList(b, 0), getConstant(0, 32));
+  ref<Expr> c10 = getConstant(10, 8);
+
+  ConstraintManager cm;
+  EXPECT_TRUE(cm.isIndependent(a0));
+
+  cm.addConstraint(UltExpr::create(a0, c10));
+  EXPECT_FALSE(cm.isIndependent(AddExpr::create(a0, c10)));
+  EXPECT_TRUE(cm.isIndependent(AddExpr::create(a1, b0)));
+
+  ref<Expr> ai = ReadExpr::create(UpdateList(a, 0), ZExtExpr::create(b0, 32));
+  EXPECT_FALSE(cm.isIndependent(ai));
+}
+
+TEST(ExprTest, Serialization) {
+  Array *a = new Array("a", 16);
+  ref<Expr> x = ReadExpr::create(UpdateList(a, 0), getConstant(0, 32));
+
+  // Update list with a symbolic value, read at a symbolic index
+  UpdateList ul(a, 0);
+  ul.extend(getConstant(1, 32), x);
+  ul.extend(getConstant(2, 32), getConstant(7, 8));
+  ref<Expr> y = ReadExpr::create(ul, ZExtExpr::create(x, 32));
+
+  ref<Expr> sum = AddExpr::create(x, MulExpr::create(x, y));
+  ref<Expr> cond = UltExpr::create(ExtractExpr::create(sum, 1, 4),
+                                   getConstant(3, 4));
+
+  std::vector<unsigned char> buffer;
+  ExprWriter writer(buffer);
+  writer.writeExpr(cond);
+  writer.writeInt(1234567);
+  writer.writeExpr(y);
+  writer.writeArray(a);
+
+  ExprReader reader(&buffer[0], buffer.size());
+  ref<Expr> cond2, y2;
+  const Array *a2;
+  uint64_t value;
+  ASSERT_TRUE(reader.readExpr(cond2));
+  ASSERT_TRUE(reader.readInt(value));
+  ASSERT_TRUE(reader.readExpr(y2));
+  ASSERT_TRUE(reader.readArray(a2));
+  EXPECT_TRUE(reader.atEnd());
+
+  EXPECT_EQ(1234567u, value);
+  EXPECT_EQ("a", a2->name);
+  EXPECT_EQ(16u, a2->size);
+  EXPECT_EQ(cond->getKind(), cond2->getKind());
+
+  // Shared subexpressions are read back once
+  ReadExpr *re = dyn_cast<ReadExpr>(y2);
+  ASSERT_TRUE(re);
+  EXPECT_EQ(a2, re->updates.root);
+  EXPECT_EQ(2u, re->updates.getSize());
+  EXPECT_EQ(re->updates.head->next->value.get(), re->index->getKid(0).get());
+
+  // Truncated data is rejected
+  ExprReader truncated(&buffer[0], buffer.size() / 2);
+  EXPECT_FALSE(truncated.readExpr(cond2));
+}
+
+TEST(ExprTest, SerializationStream) {
+  Array *a = new Array("a", 4);
+  ref<Expr> x = ReadExpr::create(UpdateList(a, 0), getConstant(0, 32));
+  ref<Expr> pair = ConcatExpr::create(x, x);
+
+  // Two records of the same writer, the second one refers to x
+  std::vector<unsigned char> buffer;
+  ExprWriter writer(buffer);
+  writer.writeExpr(x);
+  const unsigned char bytes[] = {1, 2, 3};
+  writer.writeBytes(bytes, sizeof(bytes));
+
+  std::vector<unsigned char> first(buffer);
+  buffer.clear();
+  writer.writeExpr(pair);
+  std::vector<unsigned char> second(buffer);
+
+  ExprReader reader(&first[0], first.size());
+  ref<Expr> x2, pair2;
+  const unsigned char *data;
+  uint64_t size;
+  ASSERT_TRUE(reader.readExpr(x2));
+  ASSERT_TRUE(reader.readBytes(data, size));
+  EXPECT_TRUE(reader.atEnd());
+  ASSERT_EQ(3u, size);
+  EXPECT_EQ(3, data[2]);
+
+  reader.setData(&second[0], second.size());
+  ASSERT_TRUE(reader.readExpr(pair2));
+  EXPECT_TRUE(reader.atEnd());
+  EXPECT_EQ(x2.get(), pair2->getKid(0).get());
+}
+
 }
@@ -13,6 +13,8 @@
 #include "klee/Constraints.h"
 #include "klee/Expr.h"
 #include "klee/Solver.h"
+#include "klee/SolverImpl.h"
+#include "klee/util/Assignment.h"
 #include "llvm/ADT/StringExtras.h"
 
 using namespace klee;
@@ -163,4 +165,130 @@ TEST(SolverTest, Evaluation) {
   delete solver;
 }
 
+TEST(SolverTest, KnownBits) {
+  // The dummy solver fails every query, so anything answered here was
+  // decided by the known bits layer alone.
+  Solver *solver = createKnownBitsSolver(createDummySolver());
+
+  Array *array = new Array("kb0", 4);
+  ref<Expr> r0 = ReadExpr::create(UpdateList(array, 0), getConstant(0, 32));
+  ref<Expr> r1 = ReadExpr::create(UpdateList(array, 0), getConstant(1, 32));
+
+  ConstraintManager constraints;
+  constraints.addConstraint(UltExpr::create(r0, getConstant(0x10, 8)));
+  constraints.addConstraint(UltExpr::create(r1, getConstant(4, 8)));
+
+  bool res;
+  ref<Expr> masked = EqExpr::create(AndExpr::create(r0, getConstant(0x30, 8)),
+                                    getConstant(0, 8));
+  EXPECT_TRUE(solver->mustBeTrue(Query(constraints, masked), res));
+  EXPECT_TRUE(res);
+
+  ref<Expr> bounded = UltExpr::create(r1, getConstant(8, 8));
+  EXPECT_TRUE(solver->mustBeTrue(Query(constraints, bounded), res));
+  EXPECT_TRUE(res);
+
+  ref<Expr> outside = UltExpr::create(getConstant(4, 8), r1);
+  EXPECT_TRUE(solver->mayBeTrue(Query(constraints, outside), res));
+  EXPECT_FALSE(res);
+
+  delete solver;
+}
+
+TEST(SolverTest, FastCexSeed) {
+  // Negate a branch of a concolic path: the seed satisfies the path
+  // constraints and the local search has to find a model of the other side
+  // without the underlying solver.
+  Solver *solver = createFastCexSolver(createDummySolver());
+
+  Array *array = new Array("seed0", 4);
+  ref<Expr> word = ReadExpr::create(UpdateList(array, 0), getConstant(0, 32));
+  for (unsigned i = 1; i < 4; ++i)
+    word = ConcatExpr::create(ReadExpr::create(UpdateList(array, 0),
+                                               getConstant(i, 32)), word);
+
+  std::vector<unsigned char> values(4, 0);
+  Assignment seed;
+  seed.add(array, values);
+
+  ConstraintManager constraints;
+  constraints.addConstraint(UltExpr::create(word, getConstant(0x10000000, 32)));
+
+  ref<Expr> branch = EqExpr::create(word, getConstant(0x01020304, 32));
+  Query query(constraints, Expr::createIsZero(branch), &seed);
+
+  bool res;
+  EXPECT_TRUE(solver->mayBeFalse(query, res));
+  EXPECT_TRUE(res);
+
+  std::vector<const Array*> objects(1, array);
+  std::vector< std::vector<unsigned char> > result;
+  EXPECT_TRUE(solver->getInitialValues(Query(constraints, branch, &seed)
+                                         .negateExpr(), objects, result));
+  ASSERT_EQ(1u, result.size());
+  EXPECT_EQ(0x04, result[0][0]);
+  EXPECT_EQ(0x01, result[0][3]);
+
+  delete solver;
+}
+
+/// Proves every query and counts how many reached it
+class CountingSolverImpl : public SolverImpl {
+public:
+  unsigned &count;
+
+  CountingSolverImpl(unsigned &_count) : count(_count) {}
+
+  bool computeTruth(const Query&, bool &isValid) {
+    ++count;
+    isValid = true;
+    return true;
+  }
+  bool computeValue(const Query&, ref<Expr> &) { return false; }
+  bool computeInitialValues(const Query&, const std::vector<const Array*> &,
+                            std::vector< std::vector<unsigned char> > &,
+                            bool &) {
+    return false;
+  }
+};
+
+TEST(SolverTest, CanonicalCache) {
+  // Two states check the same condition on their own copy of an input
+  unsigned count = 0;
+  Solver *solver = createCachingSolver(
+    new Solver(new CountingSolverImpl(count)));
+
+  Array *a = new Array("input_1", 2);
+  Array *b = new Array("input_2", 2);
+  ref<Expr> a0 = ReadExpr::create(UpdateList(a, 0), getConstant(0, 32));
+  ref<Expr> a1 = ReadExpr::create(UpdateList(a, 0), getConstant(1, 32));
+  ref<Expr> b0 = ReadExpr::create(UpdateList(b, 0), getConstant(0, 32));
+  ref<Expr> b1 = ReadExpr::create(UpdateList(b, 0), getConstant(1, 32));
+
+  ConstraintManager ca, cb;
+  ca.addConstraint(UltExpr::create(a0, getConstant(0x10, 8)));
+  cb.addConstraint(UltExpr::create(b0, getConstant(0x10, 8)));
+
+  bool res;
+  EXPECT_TRUE(solver->mustBeTrue(
+    Query(ca, UltExpr::create(AddExpr::create(a0, a1), getConstant(0x20, 8))),
+    res));
+  EXPECT_TRUE(res);
+  EXPECT_EQ(1u, count);
+
+  // Other array and operands of the addition swapped
+  EXPECT_TRUE(solver->mustBeTrue(
+    Query(cb, UltExpr::create(AddExpr::create(b1, b0), getConstant(0x20, 8))),
+    res));
+  EXPECT_TRUE(res);
+  EXPECT_EQ(1u, count);
+
+  EXPECT_TRUE(solver->mustBeTrue(
+    Query(cb, UltExpr::create(AddExpr::create(b1, b0), getConstant(0x30, 8))),
+    res));
+  EXPECT_EQ(2u, count);
+
+  delete solver;
+}
+
 }
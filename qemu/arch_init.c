@@ -99,6 +99,11 @@ const uint32_t arch_type = QEMU_ARCH;
 #define RAM_SAVE_FLAG_PAGE     0x08
 #define RAM_SAVE_FLAG_EOS      0x10
 #define RAM_SAVE_FLAG_CONTINUE 0x20
+#define RAM_SAVE_FLAG_RAW      0x40 /* Whole block, aligned in the stream */
+
+/* Alignment of raw blocks in the stream, they can be mapped by the
+   destination when the stream itself is aligned on this boundary */
+#define RAM_RAW_ALIGN          4096
 
 #ifdef __ALTIVEC__
 #include <altivec.h>
@@ -196,6 +201,38 @@ static int ram_save_block(QEMUFile *f)
 
 static uint64_t bytes_transferred;
 
+static void ram_put_raw_padding(QEMUFile *f)
+{
+    while (qemu_ftell(f) % RAM_RAW_ALIGN) {
+        qemu_put_byte(f, 0);
+    }
+}
+
+static void ram_skip_raw_padding(QEMUFile *f)
+{
+    while (qemu_ftell(f) % RAM_RAW_ALIGN) {
+        qemu_get_byte(f);
+    }
+}
+
+/* Saves all the blocks as is, so that the destination can map them */
+static void ram_save_raw(QEMUFile *f)
+{
+    RAMBlock *block;
+
+    QLIST_FOREACH(block, &ram_list.blocks, next) {
+        qemu_put_be64(f, RAM_SAVE_FLAG_RAW);
+        qemu_put_byte(f, strlen(block->idstr));
+        qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
+        ram_put_raw_padding(f);
+
+        qemu_put_buffer(f, memory_region_get_ram_ptr(block->mr), block->length);
+        memory_region_reset_dirty(block->mr, 0, block->length,
+                                  DIRTY_MEMORY_MIGRATION);
+        bytes_transferred += block->length;
+    }
+}
+
 static ram_addr_t ram_save_remaining(void)
 {
     RAMBlock *block;
@@ -305,6 +342,11 @@ int ram_save_live(QEMUFile *f, int stage, void *opaque)
             qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
             qemu_put_be64(f, block->length);
         }
+
+        /* Snapshots stored in a mappable image (e.g., the S2E format) */
+        if (qemu_file_can_map(f)) {
+            ram_save_raw(f);
+        }
     }
 
     bytes_transferred_last = bytes_transferred;
@@ -381,6 +423,36 @@ static inline void *host_from_stream_offset(QEMUFile *f,
     return NULL;
 }
 
+/* Maps the block from the stream, or reads it if that is not possible */
+static int ram_load_raw(QEMUFile *f, RAMBlock *block)
+{
+    uint8_t *host = memory_region_get_ram_ptr(block->mr);
+    int64_t pos;
+
+    ram_skip_raw_padding(f);
+    pos = qemu_ftell(f);
+
+    if (!qemu_file_map(f, host, pos, block->length)) {
+        qemu_fseek(f, pos + block->length, SEEK_SET);
+#ifdef CONFIG_S2E
+        s2e_map_ram_concrete(g_s2e, g_s2e_state, (uintptr_t)host, block->length);
+#endif
+        return 0;
+    }
+
+    for (ram_addr_t offset = 0; offset < block->length; offset += TARGET_PAGE_SIZE) {
+#ifdef CONFIG_S2E
+        uint8_t buffer[TARGET_PAGE_SIZE];
+        qemu_get_buffer(f, buffer, TARGET_PAGE_SIZE);
+        s2e_write_ram_concrete(g_s2e, g_s2e_state, (uintptr_t)host + offset, buffer, TARGET_PAGE_SIZE);
+#else
+        qemu_get_buffer(f, host + offset, TARGET_PAGE_SIZE);
+#endif
+    }
+
+    return qemu_file_get_error(f);
+}
+
 int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
     ram_addr_t addr;
@@ -432,7 +504,30 @@ int ram_load(QEMUFile *f, void *opaque, int version_id)
             }
         }
 
-        if (flags & RAM_SAVE_FLAG_COMPRESS) {
+        if (flags & RAM_SAVE_FLAG_RAW) {
+            RAMBlock *block;
+            char id[256];
+            uint8_t len;
+
+            len = qemu_get_byte(f);
+            qemu_get_buffer(f, (uint8_t *)id, len);
+            id[len] = 0;
+
+            QLIST_FOREACH(block, &ram_list.blocks, next) {
+                if (!strncmp(id, block->idstr, sizeof(id)))
+                    break;
+            }
+
+            if (!block) {
+                fprintf(stderr, "Can't find block %s!\n", id);
+                return -EINVAL;
+            }
+
+            error = ram_load_raw(f, block);
+            if (error) {
+                return error;
+            }
+        } else if (flags & RAM_SAVE_FLAG_COMPRESS) {
             void *host;
             uint8_t ch;
 
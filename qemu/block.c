@@ -2627,6 +2627,33 @@ int bdrv_load_vmstate(BlockDriverState *bs, uint8_t *buf,
     return -ENOTSUP;
 }
 
+int bdrv_can_map_vmstate(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv)
+        return 0;
+    if (drv->bdrv_save_vmstate)
+        return drv->bdrv_map_vmstate != NULL;
+    if (bs->file)
+        return bdrv_can_map_vmstate(bs->file);
+    return 0;
+}
+
+int bdrv_map_vmstate(BlockDriverState *bs, void *host,
+                     int64_t pos, int64_t size)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv)
+        return -ENOMEDIUM;
+    if (drv->bdrv_map_vmstate)
+        return drv->bdrv_map_vmstate(bs, host, pos, size);
+    if (drv->bdrv_load_vmstate)
+        return -ENOTSUP;
+    if (bs->file)
+        return bdrv_map_vmstate(bs->file, host, pos, size);
+    return -ENOTSUP;
+}
+
 void bdrv_debug_event(BlockDriverState *bs, BlkDebugEvent event)
 {
     BlockDriver *drv = bs->drv;
@@ -320,6 +320,10 @@ int bdrv_save_vmstate(BlockDriverState *bs, const uint8_t *buf,
 int bdrv_load_vmstate(BlockDriverState *bs, uint8_t *buf,
                       int64_t pos, int size);
 
+int bdrv_can_map_vmstate(BlockDriverState *bs);
+int bdrv_map_vmstate(BlockDriverState *bs, void *host,
+                     int64_t pos, int64_t size);
+
 int bdrv_img_create(const char *filename, const char *fmt,
                     const char *base_filename, const char *base_fmt,
                     char *options, uint64_t img_size, int flags);
@@ -52,12 +52,27 @@
  *  "my_image.raw.s2e.ready" in the same folder as "my_image.raw.s2e".
  *
  *  If the base image is modified, all snapshots become invalid.
+ *
+ *  The VM state is stored page-aligned in the snapshot file and is mapped
+ *  rather than read when the snapshot is resumed. RAM blocks saved in raw
+ *  form (see arch_init.c) are mapped copy-on-write directly as guest RAM,
+ *  so that all the instances started from the same snapshot share the
+ *  unmodified pages through the page cache.
+ *
+ *  The base image itself is mapped read-only when it is opened. Reads are
+ *  served from the mapping instead of going through the block layer, so
+ *  all the instances on the host use the same page cache pages and do not
+ *  pay a system call for each read.
  */
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 #include "qemu-common.h"
 #include "block_int.h"
@@ -73,6 +88,9 @@ static const unsigned int S2EB_L2_SIZE = 65536;
 static const unsigned int S2EB_SECTOR_SIZE = BDRV_SECTOR_SIZE;
 static const unsigned int S2EB_L2_SECTORS = S2EB_L2_SIZE / S2EB_SECTOR_SIZE;
 
+/* Alignment of the VM state in the snapshot file, to allow mapping it */
+static const unsigned int S2EB_VMSTATE_ALIGN = 4096;
+
 typedef uint64_t bitmap_entry_t;
 static const unsigned int S2EB_BITS_PER_ENTRY = sizeof(bitmap_entry_t) * 8;
 
@@ -93,6 +111,14 @@ typedef struct BDRVS2EState {
     /* Temporary vm state */
     uint8_t *snapshot_vmstate;
     size_t snapshot_vmstate_size;
+
+    /* Set when snapshot_vmstate is mapped from the snapshot file */
+    FILE *snapshot_fp;
+    uint64_t snapshot_vmstate_offset;
+
+    /* Read-only mapping of the base image, NULL if it could not be mapped */
+    uint8_t *base_image;
+    uint64_t base_image_size;
 } BDRVS2EState;
 
 typedef struct S2ESnapshotHeader {
@@ -123,6 +149,8 @@ static void s2e_blk_init(BlockDriverState *bs)
 
     s->snapshot_vmstate_size = 0;
     s->snapshot_vmstate = NULL;
+    s->snapshot_fp = NULL;
+    s->snapshot_vmstate_offset = 0;
 
     /* Initialize the copy-on-write page table */
     uint64_t length = bdrv_getlength(bs) & BDRV_SECTOR_MASK;
@@ -132,9 +160,51 @@ static void s2e_blk_init(BlockDriverState *bs)
     s->sector_count = length / S2EB_SECTOR_SIZE;
 }
 
+static void s2e_map_base_image(BlockDriverState *bs)
+{
+    BDRVS2EState *s = bs->opaque;
+
+    s->base_image = NULL;
+    s->base_image_size = 0;
+
+#ifndef _WIN32
+    int64_t length = bdrv_getlength(bs->file);
+    if (length <= 0 || (uint64_t) length != (size_t) length) {
+        return;
+    }
+
+    int fd = open(bs->filename, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    /* The base image is never written, a shared mapping is safe */
+    void *base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return;
+    }
+
+    s->base_image = base;
+    s->base_image_size = length;
+#endif
+}
+
+static void s2e_unmap_base_image(BDRVS2EState *s)
+{
+#ifndef _WIN32
+    if (s->base_image) {
+        munmap(s->base_image, s->base_image_size);
+    }
+#endif
+    s->base_image = NULL;
+    s->base_image_size = 0;
+}
+
 static int s2e_open(BlockDriverState *bs, int flags)
 {
     s2e_blk_init(bs);
+    s2e_map_base_image(bs);
     return 0;
 }
 
@@ -229,17 +299,19 @@ static int s2e_read_dirty_klee(BlockDriverState *bs, uint8_t *buffer, uint64_t s
     int found_dirty = false;
 
     while (nb_sectors) {
+        /* A negative count skips the sectors that are not in the store */
         int read_count = __hook_bdrv_read(bs, sector_num, buffer, nb_sectors);
         if (read_count > 0) {
             found_dirty = true;
-            sector_num += read_count;
-            nb_sectors -= read_count;
-            buffer += S2EB_SECTOR_SIZE * read_count;
+        } else if (read_count < 0) {
+            read_count = -read_count;
         } else {
-            ++sector_num;
-            --nb_sectors;
-            buffer += S2EB_SECTOR_SIZE;
+            read_count = 1;
         }
+
+        sector_num += read_count;
+        nb_sectors -= read_count;
+        buffer += S2EB_SECTOR_SIZE * read_count;
     }
 
     return found_dirty;
@@ -253,11 +325,18 @@ static int coroutine_fn s2e_co_readv(BlockDriverState *bs, int64_t sector_num,
 
     assert(nb_sectors > 0 && "Something wrong happened in the block layer");
 
+    uint64_t offset = sector_num * BDRV_SECTOR_SIZE;
+    uint64_t size = nb_sectors * BDRV_SECTOR_SIZE;
+
     /* Read the whole backing store speculatively */
-    int ret = bdrv_co_readv(bs->file, sector_num, nb_sectors, qiov);
-    assert(!ret);
-    if (ret < 0) {
-        return ret;
+    if (s->base_image && offset + size <= s->base_image_size) {
+        qemu_iovec_from_buffer(qiov, s->base_image + offset, size);
+    } else {
+        int ret = bdrv_co_readv(bs->file, sector_num, nb_sectors, qiov);
+        assert(!ret);
+        if (ret < 0) {
+            return ret;
+        }
     }
 
     unsigned alloc_bytes = qiov->size;
@@ -328,6 +407,22 @@ static int coroutine_fn s2e_co_writev(BlockDriverState *bs, int64_t sector_num,
     return 0;
 }
 
+static void s2e_release_vmstate(BDRVS2EState *s)
+{
+    if (s->snapshot_fp) {
+#ifndef _WIN32
+        munmap(s->snapshot_vmstate, s->snapshot_vmstate_size);
+#endif
+        fclose(s->snapshot_fp);
+        s->snapshot_fp = NULL;
+    } else if (s->snapshot_vmstate) {
+        g_free(s->snapshot_vmstate);
+    }
+
+    s->snapshot_vmstate = NULL;
+    s->snapshot_vmstate_size = 0;
+}
+
 static void s2e_close(BlockDriverState *bs)
 {
     BDRVS2EState *s = bs->opaque;
@@ -341,15 +436,19 @@ static void s2e_close(BlockDriverState *bs)
         g_free(s->l1);
     }
 
-    if (s->snapshot_vmstate) {
-        g_free(s->snapshot_vmstate);
-    }
+    s2e_release_vmstate(s);
 
     s->dirty_count = 0;
     s->l1 = NULL;
     s->l1_entries = 0;
 }
 
+static void s2e_bdrv_close(BlockDriverState *bs)
+{
+    s2e_close(bs);
+    s2e_unmap_base_image(bs->opaque);
+}
+
 static int coroutine_fn s2e_co_flush(BlockDriverState *bs)
 {
     //Nothing to flush
@@ -494,6 +593,8 @@ static int s2e_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
     }
 
     header.vmstate_start = header.sectors_start + s->dirty_count;
+    header.vmstate_start = QEMU_ALIGN_UP(header.vmstate_start,
+                                         S2EB_VMSTATE_ALIGN / S2EB_SECTOR_SIZE);
     header.vmstate_size = s->snapshot_vmstate_size;
 
     if (fwrite(&header, sizeof(header), 1, fp) != 1) {
@@ -559,15 +660,36 @@ static int s2e_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
         goto fail3;
     }
 
-    if (fwrite(s->snapshot_vmstate, s->snapshot_vmstate_size, 1, fp) != 1) {
+    /* Zero pages are left as holes, the raw RAM blocks contain many of them */
+    for (size_t pos = 0; pos < s->snapshot_vmstate_size; pos += S2EB_VMSTATE_ALIGN) {
+        size_t size = s->snapshot_vmstate_size - pos;
+        if (size > S2EB_VMSTATE_ALIGN) {
+            size = S2EB_VMSTATE_ALIGN;
+        }
+
+        if (size == S2EB_VMSTATE_ALIGN && buffer_is_zero(s->snapshot_vmstate + pos, size)) {
+            if (fseek(fp, size, SEEK_CUR) < 0) {
+                ret = -1;
+                goto fail3;
+            }
+            continue;
+        }
+
+        if (fwrite(s->snapshot_vmstate + pos, size, 1, fp) != 1) {
+            ret = -1;
+            goto fail3;
+        }
+    }
+
+    /* Materialize a trailing hole */
+    fflush(fp);
+    if (ftruncate(fileno(fp), header.vmstate_start * S2EB_SECTOR_SIZE +
+                              s->snapshot_vmstate_size) < 0) {
         ret = -1;
         goto fail3;
     }
 
-
-    free(s->snapshot_vmstate);
-    s->snapshot_vmstate = NULL;
-    s->snapshot_vmstate_size = 0;
+    s2e_release_vmstate(s);
 
     fail3: g_free(sector_data);
            g_free(sector_map);
@@ -645,16 +767,35 @@ static int s2e_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
         }
     }
 
-    /* Read the VM data */
-    uint8_t *vm_state = g_malloc(header.vmstate_size);
-    if (fseek(fp, header.vmstate_start * S2EB_SECTOR_SIZE, 0) < 0) {
-        ret = -1;
-        goto fail3;
+    /* Map the VM data, pages are read when the VM state is loaded */
+    uint64_t vmstate_offset = header.vmstate_start * S2EB_SECTOR_SIZE;
+    uint8_t *vm_state = NULL;
+    int mapped = 0;
+
+#ifndef _WIN32
+    if (header.vmstate_size && (vmstate_offset % getpagesize()) == 0) {
+        vm_state = mmap(NULL, header.vmstate_size, PROT_READ, MAP_PRIVATE,
+                        fileno(fp), vmstate_offset);
+        if (vm_state == MAP_FAILED) {
+            vm_state = NULL;
+        } else {
+            mapped = 1;
+        }
     }
+#endif
 
-    if (fread(vm_state, header.vmstate_size, 1, fp) != 1) {
-        ret = -1;
-        goto fail3;
+    if (!mapped) {
+        /* Snapshots created by older versions are not aligned */
+        vm_state = g_malloc(header.vmstate_size);
+        if (fseek(fp, vmstate_offset, 0) < 0) {
+            ret = -1;
+            goto fail3;
+        }
+
+        if (fread(vm_state, header.vmstate_size, 1, fp) != 1) {
+            ret = -1;
+            goto fail3;
+        }
     }
 
     /* Discard whatever state we had before */
@@ -673,6 +814,12 @@ static int s2e_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
 
     s->snapshot_vmstate = vm_state;
     s->snapshot_vmstate_size = header.vmstate_size;
+    if (mapped) {
+        /* Keep the file open for s2e_map_vmstate */
+        s->snapshot_fp = fp;
+        s->snapshot_vmstate_offset = vmstate_offset;
+        fp = NULL;
+    }
 
     goto fail2; /* Don't free vm_state */
 
@@ -680,7 +827,10 @@ static int s2e_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
     fail2: g_free(sector_map);
            g_free(sector_data);
 
-    fail1: return ret;
+    fail1: if (fp) {
+               fclose(fp);
+           }
+           return ret;
 }
 
 static int s2e_snapshot_delete(BlockDriverState *bs, const char *snapshot_id)
@@ -774,6 +924,11 @@ static int s2e_save_vmstate(BlockDriverState *bs, const uint8_t *buf,
 {
     BDRVS2EState *s = bs->opaque;
 
+    /* The state of the snapshot that was resumed is not needed anymore */
+    if (s->snapshot_fp) {
+        s2e_release_vmstate(s);
+    }
+
     /* Accumulate the data into the temporary buffer */
     if (pos + size > s->snapshot_vmstate_size) {
         s->snapshot_vmstate = realloc(s->snapshot_vmstate, pos + size);
@@ -799,6 +954,34 @@ static int s2e_load_vmstate(BlockDriverState *bs, uint8_t *buf,
     return size;
 }
 
+static int s2e_map_vmstate(BlockDriverState *bs, void *host,
+                           int64_t pos, int64_t size)
+{
+    BDRVS2EState *s = bs->opaque;
+
+#ifndef _WIN32
+    uint64_t offset = s->snapshot_vmstate_offset + pos;
+    long page_size = getpagesize();
+
+    if (!s->snapshot_fp || pos + size > s->snapshot_vmstate_size) {
+        return -EINVAL;
+    }
+
+    if ((offset % page_size) || ((uintptr_t) host % page_size) || (size % page_size)) {
+        return -EINVAL;
+    }
+
+    void *ret = mmap(host, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                     fileno(s->snapshot_fp), offset);
+    if (ret == MAP_FAILED) {
+        return -errno;
+    }
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
 static BlockDriver bdrv_s2e = {
     .format_name        = "s2e",
 
@@ -806,7 +989,7 @@ static BlockDriver bdrv_s2e = {
     .instance_size      = sizeof(BDRVS2EState),
 
     .bdrv_open          = s2e_open,
-    .bdrv_close         = s2e_close,
+    .bdrv_close         = s2e_bdrv_close,
 
     .bdrv_co_readv          = s2e_co_readv,
     .bdrv_co_writev         = s2e_co_writev,
@@ -831,6 +1014,7 @@ static BlockDriver bdrv_s2e = {
 
     .bdrv_save_vmstate    = s2e_save_vmstate,
     .bdrv_load_vmstate    = s2e_load_vmstate,
+    .bdrv_map_vmstate     = s2e_map_vmstate,
 
     .bdrv_ioctl         = s2e_ioctl,
     .bdrv_aio_ioctl     = s2e_aio_ioctl,
@@ -184,6 +184,9 @@ struct BlockDriver {
                              int64_t pos, int size);
     int (*bdrv_load_vmstate)(BlockDriverState *bs, uint8_t *buf,
                              int64_t pos, int size);
+    /* Map part of the saved vm state at host, copy-on-write */
+    int (*bdrv_map_vmstate)(BlockDriverState *bs, void *host,
+                            int64_t pos, int64_t size);
 
     int (*bdrv_change_backing_file)(BlockDriverState *bs,
         const char *backing_file, const char *backing_fmt);
@@ -289,6 +289,10 @@ extern unsigned long reserved_va;
 
 #else /* CONFIG_S2E */
 
+/* Offset of ObjectState::symbolicCount, which follows concreteMask.
+   Generated code reads it to check that the whole object is concrete. */
+#define S2E_OBJECT_STATE_SYMBOLIC_COUNT_OFFSET sizeof(void*)
+
 static inline int _s2e_check_concrete(void *objectState,
                                       target_ulong offset, int size)
 {
@@ -99,7 +99,11 @@ typedef uint64_t target_ulong __attribute__((aligned(TARGET_LONG_ALIGNMENT)));
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
 #if !defined(CONFIG_USER_ONLY)
+#if defined(CONFIG_S2E)
+#define CPU_TLB_BITS S2E_TLB_BITS
+#else
 #define CPU_TLB_BITS 8
+#endif
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
@@ -135,6 +139,7 @@ extern int CPUTLBEntry_wrong_size[sizeof(CPUTLBEntry) == (1 << CPU_TLB_ENTRY_BIT
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
     _CPU_COMMON_S2E_TLB_TABLE                                           \
     target_phys_addr_t iotlb[NB_MMU_MODES][CPU_TLB_SIZE];               \
+    _CPU_COMMON_VICTIM_TLB                                              \
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;
 
@@ -145,6 +150,23 @@ extern int CPUTLBEntry_wrong_size[sizeof(CPUTLBEntry) == (1 << CPU_TLB_ENTRY_BIT
 #endif
 
 
+#if defined(CONFIG_S2E) && !defined(CONFIG_USER_ONLY)
+
+/* The entries evicted from the direct-mapped TLB go to a small
+   fully-associative victim TLB, which tlb_fill looks up before
+   walking the page tables */
+#define CPU_VTLB_SIZE 8
+
+#define _CPU_COMMON_VICTIM_TLB \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    target_phys_addr_t iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];            \
+    unsigned vtlb_index;
+
+#else
+#define _CPU_COMMON_VICTIM_TLB
+#endif
+
+
 #if defined(CONFIG_S2E) && defined(S2E_ENABLE_S2E_TLB)
 
 typedef struct S2ETLBEntry {
@@ -155,8 +177,12 @@ typedef struct S2ETLBEntry {
 #define CPU_S2E_TLB_BITS (CPU_TLB_BITS + TARGET_PAGE_BITS - S2E_RAM_OBJECT_BITS)
 #define CPU_S2E_TLB_SIZE (1 << CPU_S2E_TLB_BITS)
 
+/* Each page of the victim TLB also has one S2E entry per object */
+#define CPU_S2E_VTLB_SIZE (CPU_VTLB_SIZE << (TARGET_PAGE_BITS - S2E_RAM_OBJECT_BITS))
+
 #define _CPU_COMMON_S2E_TLB_TABLE \
-    S2ETLBEntry s2e_tlb_table[NB_MMU_MODES][CPU_S2E_TLB_SIZE];
+    S2ETLBEntry s2e_tlb_table[NB_MMU_MODES][CPU_S2E_TLB_SIZE];          \
+    S2ETLBEntry s2e_tlb_v_table[NB_MMU_MODES][CPU_S2E_VTLB_SIZE];
 
 #else
 #define _CPU_COMMON_S2E_TLB_TABLE
@@ -602,7 +602,11 @@ int cpu_exec(CPUArchState *env)
                    spans two pages, we cannot safely do a direct
                    jump. */
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
+#ifdef CONFIG_S2E
+                    s2e_tb_add_jump((TranslationBlock *)(next_tb & ~3), next_tb & 3, tb);
+#else
                     tb_add_jump((TranslationBlock *)(next_tb & ~3), next_tb & 3, tb);
+#endif
                 }
                 spin_unlock(&tb_lock);
 
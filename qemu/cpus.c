@@ -168,6 +168,30 @@ void cpu_enable_scaling(int scale)
     timers_state.clock_scale_enable = 1;
 }
 
+/**
+ * Moves the VM clock forward by delta nanoseconds, e.g., to skip
+ * the time during which the guest is idle.
+ */
+void cpu_skip_clock(int64_t delta)
+{
+    assert(delta >= 0);
+    timers_state.cpu_clock_offset += delta;
+    if (timers_state.clock_scale_enable) {
+        timers_state.cpu_clock_prev += delta;
+        timers_state.cpu_clock_prev_scaled += delta;
+    }
+}
+
+/**
+ * Moves the scaled VM clock forward by delta nanoseconds, regardless of
+ * the real time. S2E uses it to count the guest time in instructions.
+ */
+void cpu_advance_scaled_clock(int64_t delta)
+{
+    assert(timers_state.clock_scale_enable && delta >= 0);
+    timers_state.cpu_clock_prev_scaled += delta;
+}
+
 /* enable cpu_get_ticks() */
 void cpu_enable_ticks(void)
 {
@@ -754,6 +778,18 @@ static void qemu_tcg_wait_io_event(void)
         /* Start accounting real time to the virtual clock if the CPUs
           are idle.  */
         qemu_clock_warp(vm_clock);
+#ifdef CONFIG_S2E
+        /* Nothing can wake up the CPU before the next timer expires,
+           let the I/O thread run it right away */
+        if (!use_icount && s2e_skip_idle_time() &&
+            qemu_clock_has_timers(vm_clock)) {
+            int64_t deadline = qemu_clock_deadline(vm_clock);
+            if (deadline > 0) {
+                cpu_skip_clock(deadline);
+                qemu_notify_event();
+            }
+        }
+#endif
         qemu_cond_wait(tcg_halt_cond, &qemu_global_mutex);
     }
 
@@ -37,6 +37,8 @@ typedef struct TimersState {
 } TimersState;
 
 void cpu_enable_scaling(int scale);
+void cpu_skip_clock(int64_t delta);
+void cpu_advance_scaled_clock(int64_t delta);
 
 extern TimersState timers_state;
 
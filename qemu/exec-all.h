@@ -125,6 +125,10 @@ void tlb_flush(CPUArchState *env, int flush_global);
 void tlb_set_page(CPUArchState *env, target_ulong vaddr,
                   target_phys_addr_t paddr, int prot,
                   int mmu_idx, target_ulong size);
+#if defined(CONFIG_S2E)
+int tlb_victim_hit(CPUArchState *env, target_ulong addr, int is_write,
+                   int mmu_idx);
+#endif
 #endif
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
@@ -225,11 +229,16 @@ struct TranslationBlock {
 #ifdef CONFIG_S2E
     uint64_t reg_rmask; /* Registers that TB reads (before overwritting) */
     uint64_t reg_wmask; /* Registers that TB writes */
+    uint64_t reg_kmask; /* Registers that TB overwrites before it reads them or can exit */
     uint64_t helper_accesses_mem; /* True if contains helpers that access mem */
 
     enum ETranslationBlockType s2e_tb_type;
     struct S2ETranslationBlock* s2e_tb;
     struct TranslationBlock* s2e_tb_next[2];
+    /* Bit n is set when jump n goes to its exit stub while the block stays
+       in the jump list of s2e_tb_next[n], because the successor touches
+       symbolic registers */
+    uint8_t s2e_tb_detached;
     uint64_t pcOfLastInstr; /* XXX: hack for call instructions */
     uint32_t instruction_set;
 #endif
@@ -44,24 +44,24 @@ int cpu_physical_memory_set_dirty_tracking(int enable);
 #define VGA_DIRTY_FLAG       0x01
 #define CODE_DIRTY_FLAG      0x02
 #define MIGRATION_DIRTY_FLAG 0x08
+#ifdef CONFIG_S2E
+/* Cleared by S2E plugins that want to know when the guest writes a page */
+#define S2E_WATCH_DIRTY_FLAG 0x10
+
+/* S2E registers phys_dirty as a shared-concrete object: the array always
+   holds the dirty mask of the active state, S2E saves and restores it on
+   state switches. The functions below can therefore access it directly. */
+#endif
 
 /* read dirty bit (return 0 or 1) */
 static inline int cpu_physical_memory_is_dirty(ram_addr_t addr)
 {
-#ifdef CONFIG_S2E
-    return s2e_read_dirty_mask((uint64_t)&ram_list.phys_dirty[addr >> TARGET_PAGE_BITS]) == 0xff;
-#else
     return ram_list.phys_dirty[addr >> TARGET_PAGE_BITS] == 0xff;
-#endif
 }
 
 static inline int cpu_physical_memory_get_dirty_flags(ram_addr_t addr)
 {
-#ifdef CONFIG_S2E
-    return s2e_read_dirty_mask((uint64_t)&ram_list.phys_dirty[addr >> TARGET_PAGE_BITS]);
-#else
     return ram_list.phys_dirty[addr >> TARGET_PAGE_BITS];
-#endif
 }
 
 static inline int cpu_physical_memory_get_dirty(ram_addr_t start,
@@ -76,40 +76,21 @@ static inline int cpu_physical_memory_get_dirty(ram_addr_t start,
     start &= TARGET_PAGE_MASK;
     p = ram_list.phys_dirty + (start >> TARGET_PAGE_BITS);
 
-#ifdef CONFIG_S2E
-    for (addr = start; addr < end; addr += TARGET_PAGE_SIZE) {
-        int flags = s2e_read_dirty_mask((uint64_t)p);
-        ret |= flags & dirty_flags;
-        ++p;
-    }
-#else
     for (addr = start; addr < end; addr += TARGET_PAGE_SIZE) {
         ret |= *p++ & dirty_flags;
     }
-#endif
     return ret;
 }
 
 static inline void cpu_physical_memory_set_dirty(ram_addr_t addr)
 {
-#ifdef CONFIG_S2E
-    s2e_write_dirty_mask((uint64_t)&ram_list.phys_dirty[addr >> TARGET_PAGE_BITS], 0xff);
-#else
     ram_list.phys_dirty[addr >> TARGET_PAGE_BITS] = 0xff;
-#endif
 }
 
 static inline int cpu_physical_memory_set_dirty_flags(ram_addr_t addr,
                                                       int dirty_flags)
 {
-#ifdef CONFIG_S2E
-    int flags = s2e_read_dirty_mask((uint64_t)&ram_list.phys_dirty[addr >> TARGET_PAGE_BITS]);
-    flags |= dirty_flags;
-    s2e_write_dirty_mask((uint64_t)&ram_list.phys_dirty[addr >> TARGET_PAGE_BITS], flags);
-    return flags;
-#else
     return ram_list.phys_dirty[addr >> TARGET_PAGE_BITS] |= dirty_flags;
-#endif
 }
 
 static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
@@ -123,18 +104,9 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
     start &= TARGET_PAGE_MASK;
     p = ram_list.phys_dirty + (start >> TARGET_PAGE_BITS);
 
-#ifdef CONFIG_S2E
-    for (addr = start; addr < end; addr += TARGET_PAGE_SIZE) {
-        int flags = s2e_read_dirty_mask((uint64_t)p);
-        flags |= dirty_flags;
-        s2e_write_dirty_mask((uint64_t)p, flags);
-        ++p;
-    }
-#else
     for (addr = start; addr < end; addr += TARGET_PAGE_SIZE) {
         *p++ |= dirty_flags;
     }
-#endif
 }
 
 static inline void cpu_physical_memory_mask_dirty_range(ram_addr_t start,
@@ -150,18 +122,9 @@ static inline void cpu_physical_memory_mask_dirty_range(ram_addr_t start,
     mask = ~dirty_flags;
     p = ram_list.phys_dirty + (start >> TARGET_PAGE_BITS);
 
-#ifdef CONFIG_S2E
-    for (addr = start; addr < end; addr += TARGET_PAGE_SIZE) {
-        int flags = s2e_read_dirty_mask((uint64_t)p);
-        flags &= mask;
-        s2e_write_dirty_mask((uint64_t)p, flags);
-        ++p;
-    }
-#else
     for (addr = start; addr < end; addr += TARGET_PAGE_SIZE) {
         *p++ &= mask;
     }
-#endif
 }
 
 void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
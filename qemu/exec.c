@@ -984,6 +984,7 @@ static inline void tb_reset_jump(TranslationBlock *tb, int n)
 
 #ifdef CONFIG_S2E
     tb->s2e_tb_next[n] = NULL;
+    tb->s2e_tb_detached &= ~(1 << n);
 #endif
 #ifdef CONFIG_LLVM
     tb->llvm_tb_next[n] = NULL;
@@ -1433,6 +1434,9 @@ void tb_link_page(TranslationBlock *tb,
     tb->jmp_first = (TranslationBlock *)((long)tb | 2);
     tb->jmp_next[0] = NULL;
     tb->jmp_next[1] = NULL;
+#ifdef CONFIG_S2E
+    tb->s2e_tb_detached = 0;
+#endif
 
     /* init original jump addresses */
     if (tb->tb_next_offset[0] != 0xffff)
@@ -2066,13 +2070,18 @@ void tlb_flush(CPUArchState *env, int flush_global)
         }
     }
 
-#if defined(CONFIG_S2E) && defined(S2E_ENABLE_S2E_TLB)
-    for(i = 0; i < CPU_S2E_TLB_SIZE; i++) {
+#if defined(CONFIG_S2E)
+    for(i = 0; i < CPU_VTLB_SIZE; i++) {
         int mmu_idx;
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-            env->s2e_tlb_table[mmu_idx][i].objectState = 0;
+            env->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
         }
     }
+#endif
+
+#if defined(CONFIG_S2E) && defined(S2E_ENABLE_S2E_TLB)
+    /* The S2E TLB entries are unreachable until tlb_set_page refills
+       them, the cache only has to forget them */
     s2e_flush_tlb_cache();
 #endif
 
@@ -2139,6 +2148,30 @@ void tlb_flush_page(CPUArchState *env, target_ulong addr)
             }
 #endif
         }
+
+#if defined(CONFIG_S2E)
+        {
+            int vidx;
+            for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+                tlb_entry = &env->tlb_v_table[mmu_idx][vidx];
+                if (addr == (tlb_entry->addr_read &
+                             (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+                    addr == (tlb_entry->addr_write &
+                             (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+                    addr == (tlb_entry->addr_code &
+                             (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+                    *tlb_entry = s_cputlb_empty_entry;
+#if defined(S2E_ENABLE_S2E_TLB)
+                    int i1 = vidx * (CPU_S2E_VTLB_SIZE / CPU_VTLB_SIZE), j;
+                    for(j = 0; j < CPU_S2E_VTLB_SIZE/CPU_VTLB_SIZE; ++j, ++i1) {
+                        s2e_flush_tlb_cache_victim_page(env->s2e_tlb_v_table[mmu_idx][i1].objectState, mmu_idx, i1);
+                        env->s2e_tlb_v_table[mmu_idx][i1].objectState = 0;
+                    }
+#endif
+                }
+            }
+        }
+#endif
     }
 
     tlb_flush_jmp_cache(env, addr);
@@ -2210,6 +2243,11 @@ void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
             for(i = 0; i < CPU_TLB_SIZE; i++)
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
+#if defined(CONFIG_S2E)
+            for(i = 0; i < CPU_VTLB_SIZE; i++)
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+#endif
         }
     }
 }
@@ -2244,6 +2282,10 @@ void cpu_tlb_update_dirty(CPUArchState *env)
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         for(i = 0; i < CPU_TLB_SIZE; i++)
             tlb_update_dirty(&env->tlb_table[mmu_idx][i]);
+#if defined(CONFIG_S2E)
+        for(i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_update_dirty(&env->tlb_v_table[mmu_idx][i]);
+#endif
     }
 }
 
@@ -2262,8 +2304,16 @@ static inline void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
 
     vaddr &= TARGET_PAGE_MASK;
     i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++)
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+#if defined(CONFIG_S2E)
+        {
+            int vidx;
+            for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx)
+                tlb_set_dirty1(&env->tlb_v_table[mmu_idx][vidx], vaddr);
+        }
+#endif
+    }
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
@@ -2319,6 +2369,32 @@ uintptr_t s2e_get_host_address(target_phys_addr_t paddr)
             + section_addr(section, paddr);
 }
 
+/* Clears the watch flag of the RAM page that contains host_address.
+   The next write to the page through the softmmu or DMA sets it again. */
+int s2e_watch_page_writes(uintptr_t host_address)
+{
+    ram_addr_t ram_addr;
+    if (qemu_ram_addr_from_host((void*) host_address, &ram_addr)) {
+        return -1;
+    }
+
+    ram_addr &= TARGET_PAGE_MASK;
+    cpu_physical_memory_reset_dirty(ram_addr, ram_addr + TARGET_PAGE_SIZE,
+                                    S2E_WATCH_DIRTY_FLAG);
+    return 0;
+}
+
+/* Returns nonzero if the page was written since s2e_watch_page_writes */
+int s2e_is_page_written(uintptr_t host_address)
+{
+    ram_addr_t ram_addr;
+    if (qemu_ram_addr_from_host((void*) host_address, &ram_addr)) {
+        return 1;
+    }
+
+    return (cpu_physical_memory_get_dirty_flags(ram_addr) & S2E_WATCH_DIRTY_FLAG) != 0;
+}
+
 #endif
 
 /* Add a new TLB entry. At most one entry for a given virtual address
@@ -2393,8 +2469,21 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     }
 
     index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te = &env->tlb_table[mmu_idx][index];
+
+#if defined(CONFIG_S2E)
+    /* Keep the translation that is being replaced in the victim TLB */
+    if (te->addr_read != -1 || te->addr_write != -1 || te->addr_code != -1) {
+        unsigned vidx = env->vtlb_index++ % CPU_VTLB_SIZE;
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+#if defined(S2E_ENABLE_S2E_TLB)
+        s2e_swap_tlb_entries(g_s2e_state, env, mmu_idx, index, vidx);
+#endif
+    }
+#endif
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -2403,7 +2492,8 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
     }
 
 #ifdef CONFIG_S2E
-    if (s2e_is_mmio_symbolic(paddr, 1LL << TARGET_PAGE_BITS)) {
+    if (s2e_mmio_may_be_symbolic(paddr, 1LL << TARGET_PAGE_BITS) &&
+        s2e_is_mmio_symbolic(paddr, 1LL << TARGET_PAGE_BITS)) {
         //We hijack qemu's dirty page management to redirect
         //all accesses to MMIO memory through our handlers.
         //Note: Such ranges can be less than one page long, so we have to
@@ -2444,6 +2534,42 @@ void tlb_set_page(CPUArchState *env, target_ulong vaddr,
 
 }
 
+#if defined(CONFIG_S2E)
+/* Looks up addr in the victim TLB before tlb_fill walks the page tables.
+   On a hit, the victim entry is swapped with the one of the direct-mapped
+   TLB and 1 is returned. */
+int tlb_victim_hit(CPUArchState *env, target_ulong addr, int is_write,
+                   int mmu_idx)
+{
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int vidx;
+
+    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+        CPUTLBEntry *ve = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong tlb_addr = is_write == 0 ? ve->addr_read :
+                                is_write == 1 ? ve->addr_write : ve->addr_code;
+
+        /* Entries with flags go through tlb_fill to get them right */
+        if (tlb_addr == page) {
+            CPUTLBEntry tmp = env->tlb_table[mmu_idx][index];
+            target_phys_addr_t tmpiotlb = env->iotlb[mmu_idx][index];
+
+            env->tlb_table[mmu_idx][index] = *ve;
+            *ve = tmp;
+            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = tmpiotlb;
+#if defined(S2E_ENABLE_S2E_TLB)
+            s2e_swap_tlb_entries(g_s2e_state, env, mmu_idx, index, vidx);
+#endif
+            return 1;
+        }
+    }
+
+    return 0;
+}
+#endif
+
 #else
 
 void tlb_flush(CPUArchState *env, int flush_global)
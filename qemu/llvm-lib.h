@@ -47,6 +47,9 @@ void uint32_to_string(uint32_t n, char *str);
 void trace_port(char *buf, const char *prefix, uint32_t port, uint32_t pc);
 
 void tcg_llvm_make_symbolic(void *addr, unsigned nbytes, const char *name);
+void tcg_llvm_make_symbolic_io(void *addr, unsigned nbytes, const char *name,
+                               uint64_t ioaddr, int isMmio);
+void tcg_llvm_trace_mmio_write(uint64_t physaddr, uint64_t value, unsigned bits);
 void tcg_llvm_get_value(void *addr, unsigned nbytes, bool addConstraint);
 
 //Helpers to avoid relying on sprintf that does not work properly
@@ -247,4 +247,7 @@ static inline void qemu_get_sbe64s(QEMUFile *f, int64_t *pv)
 int64_t qemu_ftell(QEMUFile *f);
 int64_t qemu_fseek(QEMUFile *f, int64_t pos, int whence);
 
+int qemu_file_can_map(QEMUFile *f);
+int qemu_file_map(QEMUFile *f, void *host, int64_t pos, int64_t size);
+
 #endif
@@ -34,6 +34,8 @@ DEF("s2e-output-dir", HAS_ARG, QEMU_OPTION_s2e_output_dir,
     "s2e-output-dir    dir       Path to S2E output directory\n", QEMU_ARCH_ALL)
 DEF("s2e-max-processes", HAS_ARG, QEMU_OPTION_s2e_max_processes,
     "s2e-max-processes num       Maximum number of processes to fork\n", QEMU_ARCH_ALL)
+DEF("s2e-server", HAS_ARG, QEMU_OPTION_s2e_server,
+    "s2e-server        socket    Fork a process for each job request received on the socket\n", QEMU_ARCH_ALL)
 #else
 DEF("fake-pci-name", HAS_ARG, QEMU_OPTION_fake_pci_name,
     "fake-pci-name name        Name of the fake PCI device (used in snapshots)\n", QEMU_ARCH_ALL)
@@ -77,6 +79,12 @@ DEF("fake-pci-cap-msi", HAS_ARG, QEMU_OPTION_fake_pci_cap_msi,
 DEF("fake-pci-cap-pcie", HAS_ARG, QEMU_OPTION_fake_pci_cap_pcie,
     "fake-pci-cap-pcie\n", QEMU_ARCH_ALL)
 
+DEF("kvm-snapshot-at", HAS_ARG, QEMU_OPTION_kvm_snapshot_at,
+    "kvm-snapshot-at addr   Save a snapshot and exit when the guest executes addr (KVM only)\n", QEMU_ARCH_I386)
+
+DEF("kvm-snapshot-name", HAS_ARG, QEMU_OPTION_kvm_snapshot_name,
+    "kvm-snapshot-name tag  Name of the snapshot saved by -kvm-snapshot-at (default: s2e)\n", QEMU_ARCH_I386)
+
 #endif
 
 
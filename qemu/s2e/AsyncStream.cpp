@@ -0,0 +1,186 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "AsyncStream.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace s2e {
+
+static void writeAll(int fd, const char *ptr, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = ::write(fd, ptr, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            //Logs are best effort
+            return;
+        }
+        ptr += written;
+        size -= written;
+    }
+}
+
+raw_async_fd_ostream::raw_async_fd_ostream(const char *fileName, bool append,
+                                           std::string &error, size_t maxQueued)
+    : m_pos(0), m_maxQueued(maxQueued), m_writing(false), m_stop(false),
+      m_running(false)
+{
+    int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+    m_fd = ::open(fileName, flags, 0664);
+    if (m_fd < 0) {
+        error = "could not open the file";
+        return;
+    }
+
+    qemu_mutex_init(&m_mutex);
+    qemu_cond_init(&m_queueCond);
+    qemu_cond_init(&m_drainedCond);
+    start();
+}
+
+raw_async_fd_ostream::~raw_async_fd_ostream()
+{
+    if (m_fd < 0) {
+        return;
+    }
+
+    stop();
+    ::close(m_fd);
+
+    qemu_cond_destroy(&m_drainedCond);
+    qemu_cond_destroy(&m_queueCond);
+    qemu_mutex_destroy(&m_mutex);
+}
+
+void raw_async_fd_ostream::start()
+{
+    if (m_fd < 0 || m_running) {
+        return;
+    }
+
+    m_stop = false;
+    m_running = true;
+    qemu_thread_create(&m_thread, writerThread, this, QEMU_THREAD_JOINABLE);
+}
+
+void raw_async_fd_ostream::stop()
+{
+    if (!m_running) {
+        return;
+    }
+
+    flush();
+
+    qemu_mutex_lock(&m_mutex);
+    m_stop = true;
+    qemu_cond_signal(&m_queueCond);
+    qemu_mutex_unlock(&m_mutex);
+
+    qemu_thread_join(&m_thread);
+    m_running = false;
+}
+
+void raw_async_fd_ostream::sync()
+{
+    flush();
+
+    qemu_mutex_lock(&m_mutex);
+    while (m_running && (!m_queue.empty() || m_writing)) {
+        qemu_cond_wait(&m_drainedCond, &m_mutex);
+    }
+    qemu_mutex_unlock(&m_mutex);
+}
+
+void raw_async_fd_ostream::write_impl(const char *ptr, size_t size)
+{
+    m_pos += size;
+
+    if (!m_running) {
+        if (m_fd >= 0) {
+            writeAll(m_fd, ptr, size);
+        }
+        return;
+    }
+
+    qemu_mutex_lock(&m_mutex);
+    while (!m_queue.empty() && m_queue.size() + size > m_maxQueued) {
+        qemu_cond_wait(&m_drainedCond, &m_mutex);
+    }
+    m_queue.append(ptr, size);
+    qemu_cond_signal(&m_queueCond);
+    qemu_mutex_unlock(&m_mutex);
+}
+
+void *raw_async_fd_ostream::writerThread(void *opaque)
+{
+    static_cast<raw_async_fd_ostream*>(opaque)->writeLoop();
+    return NULL;
+}
+
+void raw_async_fd_ostream::writeLoop()
+{
+    std::string data;
+
+    qemu_mutex_lock(&m_mutex);
+    while (true) {
+        while (m_queue.empty() && !m_stop) {
+            qemu_cond_wait(&m_queueCond, &m_mutex);
+        }
+
+        if (m_queue.empty()) {
+            break;
+        }
+
+        //Write without the lock, the producers keep queueing meanwhile
+        data.swap(m_queue);
+        m_writing = true;
+        qemu_mutex_unlock(&m_mutex);
+
+        writeAll(m_fd, data.data(), data.size());
+        data.clear();
+
+        qemu_mutex_lock(&m_mutex);
+        m_writing = false;
+        qemu_cond_broadcast(&m_drainedCond);
+    }
+    qemu_mutex_unlock(&m_mutex);
+}
+
+}
@@ -0,0 +1,97 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef _S2E_ASYNC_STREAM_H_
+
+#define _S2E_ASYNC_STREAM_H_
+
+#include <llvm/Support/raw_ostream.h>
+#include <string>
+
+extern "C" {
+#include <qemu-thread.h>
+}
+
+namespace s2e {
+
+/**
+ *  File stream whose writes are queued and done by a writer thread.
+ *  The callers still format the text, only the file I/O leaves their
+ *  thread. Writers block when the queue is full.
+ *
+ *  The writer thread does not survive a fork, stop() must be called
+ *  before forking and start() again afterwards.
+ */
+class raw_async_fd_ostream : public llvm::raw_ostream {
+    int m_fd;
+    uint64_t m_pos;
+
+    std::string m_queue;
+    size_t m_maxQueued;
+    bool m_writing;
+    bool m_stop;
+    bool m_running;
+
+    QemuMutex m_mutex;
+    QemuCond m_queueCond;
+    QemuCond m_drainedCond;
+    QemuThread m_thread;
+
+    virtual void write_impl(const char *ptr, size_t size);
+
+    virtual uint64_t current_pos() const {
+        return m_pos;
+    }
+
+    void writeLoop();
+    static void *writerThread(void *opaque);
+
+public:
+    raw_async_fd_ostream(const char *fileName, bool append, std::string &error,
+                         size_t maxQueued = 1 << 24);
+    virtual ~raw_async_fd_ostream();
+
+    void start();
+
+    /** Writes out the queue and terminates the writer thread */
+    void stop();
+
+    /** Waits until the writer thread has written everything queued so far */
+    void sync();
+};
+
+}
+
+#endif
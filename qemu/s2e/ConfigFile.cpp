@@ -243,14 +243,117 @@ bool ConfigFile::getLuaValue(_key_list* res, const _key_list& def, int index) {
     return true;
 }
 
+static bool isLuaKeyword(const std::string &s)
+{
+    static const char *keywords[] = {
+        "and", "break", "do", "else", "elseif", "end", "false", "for",
+        "function", "if", "in", "local", "nil", "not", "or", "repeat",
+        "return", "then", "true", "until", "while", NULL
+    };
+
+    for (const char **k = keywords; *k; ++k) {
+        if (s == *k) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Looks up keys of the form a.b[2].c directly in the tables.
+   Returns false with the stack unchanged for any other expression,
+   or when some table along the path has a metatable, whose handlers
+   may fail outside of a protected call. */
+bool ConfigFile::pushPath(const std::string &name)
+{
+    lua_State *L = m_luaState;
+    int top = lua_gettop(L);
+    size_t pos = 0;
+    bool first = true;
+
+    while (pos < name.size()) {
+        std::string field;
+        long index = 0;
+        bool isIndex = false;
+
+        if (!first && name[pos] == '[') {
+            size_t end = name.find(']', pos);
+            if (end == std::string::npos || end == pos + 1) {
+                break;
+            }
+            for (size_t i = pos + 1; i < end; ++i) {
+                if (!isdigit(name[i])) {
+                    lua_settop(L, top);
+                    return false;
+                }
+            }
+            index = strtol(name.c_str() + pos + 1, NULL, 10);
+            isIndex = true;
+            pos = end + 1;
+        } else {
+            if (!first) {
+                if (name[pos] != '.') {
+                    break;
+                }
+                ++pos;
+            }
+            size_t end = pos;
+            while (end < name.size() && (isalnum(name[end]) || name[end] == '_')) {
+                ++end;
+            }
+            field = name.substr(pos, end - pos);
+            if (field.empty() || isdigit(field[0]) || isLuaKeyword(field)) {
+                break;
+            }
+            pos = end;
+        }
+
+        if (first) {
+            lua_getfield(L, LUA_GLOBALSINDEX, field.c_str());
+            first = false;
+            continue;
+        }
+
+        if (!lua_istable(L, -1) || lua_getmetatable(L, -1)) {
+            break;
+        }
+
+        if (isIndex) {
+            lua_rawgeti(L, -1, index);
+        } else {
+            lua_pushstring(L, field.c_str());
+            lua_rawget(L, -2);
+        }
+        lua_remove(L, -2);
+    }
+
+    if (pos != name.size() || first) {
+        lua_settop(L, top);
+        return false;
+    }
+
+    return true;
+}
+
+/* Pushes the value of the expression, or an error message on failure */
+bool ConfigFile::pushValue(const std::string &name)
+{
+    //Compiling a chunk for each lookup dominates the loading of large
+    //configurations, most keys are plain paths
+    if (pushPath(name)) {
+        return true;
+    }
+
+    string expr = "return " + name;
+    return !(luaL_loadstring(m_luaState, expr.c_str()) ||
+             lua_pcall(m_luaState, 0, 1, 0));
+}
+
 template<typename T> inline
 T ConfigFile::getValueT(const std::string& name, const T& def, bool *ok)
 {
 	assert(name.size() != 0);    
-    string expr = "return " + name;
   
-    if(luaL_loadstring(m_luaState, expr.c_str()) ||
-                    lua_pcall(m_luaState, 0, 1, 0)) {
+    if(!pushValue(name)) {
         luaWarning("Can not get configuration value '%s':\n    %s\n",
                     name.c_str(), lua_tostring(m_luaState, -1));
         lua_pop(m_luaState, 1);
@@ -322,11 +425,11 @@ ConfigFile::string_list ConfigFile::getListKeys(const std::string& name, bool *o
 bool ConfigFile::hasKey(const std::string& name)
 {
 	assert(name.size() != 0);
-    string expr = "return " + name;
 
-    if(luaL_loadstring(m_luaState, expr.c_str()) ||
-                    lua_pcall(m_luaState, 0, 1, 0))
+    if(!pushValue(name)) {
+        lua_pop(m_luaState, 1);
         return false;
+    }
 
     bool ok = !lua_isnil(m_luaState, -1);
     lua_pop(m_luaState, 1);
@@ -344,6 +447,18 @@ void ConfigFile::invokeLuaCommand(const char *cmd)
     }
 }
 
+bool ConfigFile::loadFile(const std::string &fileName)
+{
+    if (luaL_loadfile(m_luaState, fileName.c_str()) ||
+                lua_pcall(m_luaState, 0, 0, 0)) {
+        luaWarning("Can not run %s:\n    %s\n", fileName.c_str(),
+                   lua_tostring(m_luaState, -1));
+        lua_pop(m_luaState, 1);
+        return false;
+    }
+    return true;
+}
+
 bool ConfigFile::isFunctionDefined(const std::string &name) const
 {
     bool ret = true;
@@ -283,6 +283,10 @@ public:
   S2ELUAExecutionState(lua_State *L);
   S2ELUAExecutionState(S2EExecutionState *s);
   ~S2ELUAExecutionState();
+
+  //Lets plugins reuse one wrapper across invocations
+  void setState(S2EExecutionState *s) { m_state = s; }
+
   int writeRegister(lua_State *L);
   int writeRegisterSymb(lua_State *L);
   int readRegister(lua_State *L);
@@ -325,6 +329,9 @@ private:
     template<typename T>
     T getValueT(const std::string& expr, const T& def, bool *ok);
 
+    bool pushPath(const std::string &name);
+    bool pushValue(const std::string &name);
+
     int RegisterS2EApi();
 
 public:
@@ -372,6 +379,9 @@ public:
 
     void invokeLuaCommand(const char *cmd);
 
+    /* Runs a Lua file on top of the current configuration */
+    bool loadFile(const std::string &fileName);
+
     //void invokeAnnotation(const std::string &annotation, S2EExecutionState *param);
 
     lua_State* getState() const {
@@ -0,0 +1,269 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "config-host.h"
+#include "Coordinator.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#ifndef CONFIG_WIN32
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace s2e {
+
+S2ECoordinator *S2ECoordinator::create(const std::string &address)
+{
+#ifdef CONFIG_WIN32
+    return NULL;
+#else
+    if (address.compare(0, 4, "tcp:") && address.compare(0, 5, "unix:")) {
+        return NULL;
+    }
+
+    return new SocketCoordinator(address);
+#endif
+}
+
+#ifndef CONFIG_WIN32
+
+SocketCoordinator::SocketCoordinator(const std::string &address)
+{
+    m_address = address;
+    m_socket = -1;
+
+    //All the instances forked from the same root process
+    //share the same group. They already exchange commands through
+    //the shared memory, the coordinator only relays them to other groups.
+    char hostName[256];
+    if (gethostname(hostName, sizeof(hostName)) < 0) {
+        strcpy(hostName, "unknown");
+    }
+    hostName[sizeof(hostName) - 1] = 0;
+
+    std::stringstream ss;
+    ss << hostName << ":" << getpid();
+    m_group = ss.str();
+}
+
+SocketCoordinator::~SocketCoordinator()
+{
+    if (m_socket >= 0) {
+        close(m_socket);
+    }
+}
+
+bool SocketCoordinator::connect()
+{
+    assert(m_socket < 0);
+
+    if (!m_address.compare(0, 5, "unix:")) {
+        std::string path = m_address.substr(5);
+        struct sockaddr_un addr;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+
+        m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_socket < 0) {
+            return false;
+        }
+
+        if (::connect(m_socket, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+            close(m_socket);
+            m_socket = -1;
+            return false;
+        }
+        return true;
+    }
+
+    //tcp:host:port
+    std::string hostPort = m_address.substr(4);
+    size_t colon = hostPort.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+
+    std::string host = hostPort.substr(0, colon);
+    std::string port = hostPort.substr(colon + 1);
+
+    struct addrinfo hints, *result, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result)) {
+        return false;
+    }
+
+    for (rp = result; rp != NULL; rp = rp->ai_next) {
+        m_socket = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (m_socket < 0) {
+            continue;
+        }
+
+        if (::connect(m_socket, rp->ai_addr, rp->ai_addrlen) == 0) {
+            break;
+        }
+
+        close(m_socket);
+        m_socket = -1;
+    }
+
+    freeaddrinfo(result);
+    return m_socket >= 0;
+}
+
+bool SocketCoordinator::reconnect()
+{
+    //The socket is shared with the parent after a fork,
+    //the child must not use it anymore.
+    if (m_socket >= 0) {
+        close(m_socket);
+        m_socket = -1;
+    }
+    return connect();
+}
+
+bool SocketCoordinator::sendRequest(const std::string &request, std::string &reply)
+{
+    if (m_socket < 0 && !connect()) {
+        return false;
+    }
+
+    std::string line = request + "\n";
+    const char *buffer = line.c_str();
+    size_t remaining = line.size();
+    while (remaining > 0) {
+        ssize_t written = write(m_socket, buffer, remaining);
+        if (written <= 0) {
+            return false;
+        }
+        buffer += written;
+        remaining -= written;
+    }
+
+    reply.clear();
+    char c;
+    while (true) {
+        ssize_t ret = read(m_socket, &c, 1);
+        if (ret <= 0) {
+            return false;
+        }
+        if (c == '\n') {
+            break;
+        }
+        reply += c;
+    }
+
+    return true;
+}
+
+uint64_t SocketCoordinator::requestInteger(const std::string &request)
+{
+    std::string reply;
+    if (!sendRequest(request, reply)) {
+        fprintf(stderr, "S2E: lost connection to coordinator %s\n", m_address.c_str());
+        exit(-1);
+    }
+    return strtoull(reply.c_str(), NULL, 0);
+}
+
+bool SocketCoordinator::registerInstance(unsigned pid)
+{
+    std::stringstream ss;
+    ss << "REGISTER " << m_group << " " << pid;
+
+    std::string reply;
+    return sendRequest(ss.str(), reply) && reply == "OK";
+}
+
+void SocketCoordinator::unregisterInstance()
+{
+    std::string reply;
+    sendRequest("UNREGISTER", reply);
+}
+
+unsigned SocketCoordinator::getInstanceCount()
+{
+    return requestInteger("INSTANCES");
+}
+
+unsigned SocketCoordinator::fetchAndIncrementStateId()
+{
+    return requestInteger("NEXT_STATE_ID");
+}
+
+unsigned SocketCoordinator::fetchNextStateId()
+{
+    return requestInteger("PEEK_STATE_ID");
+}
+
+unsigned SocketCoordinator::fetchAndIncrementFileId()
+{
+    return requestInteger("NEXT_FILE_ID");
+}
+
+void SocketCoordinator::broadcastCommand(const std::string &command)
+{
+    std::string reply;
+    sendRequest("BROADCAST " + command, reply);
+}
+
+bool SocketCoordinator::pollCommand(std::string &command)
+{
+    std::string reply;
+    if (!sendRequest("POLL", reply) || reply == "NONE") {
+        return false;
+    }
+    command = reply;
+    return true;
+}
+
+#endif
+
+}
@@ -0,0 +1,119 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_COORDINATOR_H
+#define S2E_COORDINATOR_H
+
+#include <inttypes.h>
+#include <string>
+
+namespace s2e {
+
+/**
+ *  Coordination backend shared by all the S2E instances of a run.
+ *  The default backend is the S2EShared memory block, which only works
+ *  for processes forked on the same host. Other backends allow a single
+ *  logical run to span several hosts.
+ */
+class S2ECoordinator
+{
+public:
+    virtual ~S2ECoordinator() {}
+
+    /** Must be called by forked children before using the coordinator */
+    virtual bool reconnect() = 0;
+
+    /** Must be called by each new process (including forked children) */
+    virtual bool registerInstance(unsigned pid) = 0;
+    virtual void unregisterInstance() = 0;
+
+    /** Number of instances currently running in the whole cluster */
+    virtual unsigned getInstanceCount() = 0;
+
+    virtual unsigned fetchAndIncrementStateId() = 0;
+    virtual unsigned fetchNextStateId() = 0;
+    virtual unsigned fetchAndIncrementFileId() = 0;
+
+    /** Send a command to the instances running on other hosts */
+    virtual void broadcastCommand(const std::string &command) = 0;
+
+    /** Returns false if there are no pending commands */
+    virtual bool pollCommand(std::string &command) = 0;
+
+    /**
+     *  Creates a coordinator for the given address, which has the form
+     *  tcp:host:port or unix:/path/to/socket.
+     *  Returns NULL if the address is invalid.
+     */
+    static S2ECoordinator *create(const std::string &address);
+};
+
+/**
+ *  Talks to the s2ecoordinator server using a line-based protocol.
+ *  Each process has its own connection: forked children must call
+ *  reconnect() before using the object.
+ */
+class SocketCoordinator : public S2ECoordinator
+{
+private:
+    std::string m_address;
+    std::string m_group;
+    int m_socket;
+
+    bool connect();
+    bool sendRequest(const std::string &request, std::string &reply);
+    uint64_t requestInteger(const std::string &request);
+
+public:
+    SocketCoordinator(const std::string &address);
+    virtual ~SocketCoordinator();
+
+    virtual bool reconnect();
+
+    virtual bool registerInstance(unsigned pid);
+    virtual void unregisterInstance();
+    virtual unsigned getInstanceCount();
+
+    virtual unsigned fetchAndIncrementStateId();
+    virtual unsigned fetchNextStateId();
+    virtual unsigned fetchAndIncrementFileId();
+
+    virtual void broadcastCommand(const std::string &command);
+    virtual bool pollCommand(std::string &command);
+};
+
+}
+
+#endif
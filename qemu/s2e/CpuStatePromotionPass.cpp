@@ -0,0 +1,224 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <llvm/Function.h>
+#include <llvm/Instructions.h>
+#include <llvm/IntrinsicInst.h>
+#include <llvm/Operator.h>
+
+#include "CpuStatePromotionPass.h"
+
+#include <map>
+
+using namespace llvm;
+
+char CpuStatePromotionPass::ID = 0;
+RegisterPass<CpuStatePromotionPass>
+  X("cpustatepromotion", "Forwards CPU state fields within basic blocks",
+  false /* Only looks at CFG */,
+  false /* Analysis Pass */);
+
+namespace {
+
+/* Field of the CPU state accessed by a load or a store */
+struct Field {
+    int64_t offset;
+    unsigned size;
+};
+
+/* Latest known value of a field and the last store that wrote it,
+   if nothing read it since */
+struct FieldState {
+    unsigned size;
+    Value *value;
+    StoreInst *pendingStore;
+};
+
+typedef std::map<int64_t, FieldState> FieldStates;
+
+/**
+ * Decomposes inttoptr(add(...add(base, c1)..., cn)), which is how
+ * the translator computes the address of the CPU state fields.
+ */
+bool getField(Value *ptr, Type *type, Value **base, Field *field)
+{
+    if (!type->isIntegerTy() || type->getPrimitiveSizeInBits() % 8) {
+        return false;
+    }
+
+    Operator *op = dyn_cast<Operator>(ptr->stripPointerCasts());
+    if (!op || op->getOpcode() != Instruction::IntToPtr) {
+        return false;
+    }
+
+    Value *v = op->getOperand(0);
+    int64_t offset = 0;
+    while (BinaryOperator *add = dyn_cast<BinaryOperator>(v)) {
+        if (add->getOpcode() != Instruction::Add) {
+            break;
+        }
+
+        ConstantInt *cste = dyn_cast<ConstantInt>(add->getOperand(1));
+        if (!cste) {
+            break;
+        }
+
+        offset += cste->getSExtValue();
+        v = add->getOperand(0);
+    }
+
+    if (isa<Constant>(v)) {
+        return false;
+    }
+
+    *base = v;
+    field->offset = offset;
+    field->size = type->getPrimitiveSizeInBits() / 8;
+    return true;
+}
+
+/* Forgets the fields that partially overlap the given one */
+void dropOverlapping(FieldStates &states, const Field &field)
+{
+    FieldStates::iterator it = states.begin();
+    while (it != states.end()) {
+        int64_t start = it->first;
+        int64_t end = start + it->second.size;
+        bool same = start == field.offset && it->second.size == field.size;
+        if (!same && start < field.offset + (int64_t) field.size && field.offset < end) {
+            states.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/* Pending stores may be read from now on */
+void keepStores(FieldStates &states)
+{
+    for (FieldStates::iterator it = states.begin(); it != states.end(); ++it) {
+        it->second.pendingStore = NULL;
+    }
+}
+
+}
+
+bool CpuStatePromotionPass::runOnBasicBlock(BasicBlock &BB)
+{
+    bool modified = false;
+
+    /* Only the fields of the first base pointer are tracked, accesses
+       through other pointers may alias them */
+    Value *envBase = NULL;
+    FieldStates states;
+
+    for (BasicBlock::iterator it = BB.begin(); it != BB.end(); ) {
+        Instruction *inst = it++;
+
+        if (LoadInst *load = dyn_cast<LoadInst>(inst)) {
+            Value *base;
+            Field field;
+            if (load->isVolatile() ||
+                !getField(load->getPointerOperand(), load->getType(), &base, &field) ||
+                (envBase && base != envBase)) {
+                keepStores(states);
+                continue;
+            }
+            envBase = base;
+
+            FieldStates::iterator sit = states.find(field.offset);
+            if (sit != states.end() && sit->second.size == field.size &&
+                sit->second.value->getType() == load->getType()) {
+                load->replaceAllUsesWith(sit->second.value);
+                load->eraseFromParent();
+                modified = true;
+                continue;
+            }
+
+            dropOverlapping(states, field);
+            keepStores(states);
+            FieldState &state = states[field.offset];
+            state.size = field.size;
+            state.value = load;
+            state.pendingStore = NULL;
+
+        } else if (StoreInst *store = dyn_cast<StoreInst>(inst)) {
+            Value *base;
+            Field field;
+            Value *value = store->getValueOperand();
+            if (store->isVolatile() ||
+                !getField(store->getPointerOperand(), value->getType(), &base, &field) ||
+                (envBase && base != envBase)) {
+                states.clear();
+                continue;
+            }
+            envBase = base;
+
+            FieldStates::iterator sit = states.find(field.offset);
+            if (sit != states.end() && sit->second.size == field.size &&
+                sit->second.pendingStore) {
+                /* Overwritten before anything could read it */
+                sit->second.pendingStore->eraseFromParent();
+                modified = true;
+            }
+
+            dropOverlapping(states, field);
+            FieldState &state = states[field.offset];
+            state.size = field.size;
+            state.value = value;
+            state.pendingStore = store;
+
+        } else if (IntrinsicInst *intrinsic = dyn_cast<IntrinsicInst>(inst)) {
+            if (!intrinsic->doesNotAccessMemory()) {
+                states.clear();
+            }
+
+        } else if (inst->mayReadOrWriteMemory()) {
+            /* Helper calls read and write the CPU state */
+            states.clear();
+        }
+    }
+
+    return modified;
+}
+
+bool CpuStatePromotionPass::runOnFunction(Function &F)
+{
+    bool modified = false;
+    for (Function::iterator it = F.begin(); it != F.end(); ++it) {
+        modified |= runOnBasicBlock(*it);
+    }
+    return modified;
+}
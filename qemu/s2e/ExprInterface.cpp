@@ -30,7 +30,6 @@
  */
 
 #include <klee/Expr.h>
-#include <llvm/ADT/SmallVector.h>
 #include <inttypes.h>
 #include "Utils.h"
 #include "ExprInterface.h"
@@ -50,147 +49,121 @@
  * the data flow with symbolic-aware operations in order to avoid
  * the messy manual part.
  *
- * The interface encapsulates klee expressions in an opaque object
- * that the C code can pass around. ExprManager keeps track of all these
- * objects in order to avoid memory leaks.
+ * The interface encapsulates klee expressions in boxes that the C code
+ * can pass around. The boxes live in a fixed-size S2EExprMgr on the
+ * stack of the caller. Constant values stay in the box, only symbolic
+ * values hold a reference to a klee expression, which s2e_expr_clear
+ * releases.
  */
 
 
 using namespace klee;
 
-struct ExprBox {
-    bool constant;
-    uint64_t value;
-    klee::ref<Expr> expr;
-
-    ExprBox() {
-        constant = false;
-    }
-};
-
-class ExprManager {
-    llvm::SmallVector<ExprBox*, 4> expressions;
-
-public:
-
-    ~ExprManager() {
-        foreach2(it, expressions.begin(), expressions.end()) {
-            delete *it;
-        }
-    }
-
-    inline void add(ExprBox *box) {
-        expressions.push_back(box);
+static void setExpr(S2EExprBox *box, const ref<Expr> &expr)
+{
+    ConstantExpr *cste = dyn_cast<ConstantExpr>(expr);
+    if (cste) {
+        box->constant = 1;
+        box->value = cste->getZExtValue();
+        return;
     }
 
-    ExprBox *create() {
-        ExprBox *ret = new ExprBox();
-        expressions.push_back(ret);
-        return ret;
-    }
-};
+    //The reference is dropped by s2e_expr_clear
+    box->constant = 0;
+    box->expr = expr.get();
+    ++expr->refCount;
+}
 
-void* s2e_expr_mgr()
+static inline ref<Expr> getExpr(const S2EExprBox *box)
 {
-    return new ExprManager;
+    return ref<Expr>(static_cast<Expr*>(box->expr));
 }
 
-void s2e_expr_clear(void *_mgr) {
-    ExprManager *mgr = static_cast<ExprManager*>(_mgr);
-    delete mgr;
+void s2e_expr_clear(S2EExprMgr *mgr)
+{
+    for (unsigned i = 0; i < mgr->count; ++i) {
+        S2EExprBox *box = &mgr->boxes[i];
+        if (!box->constant && box->expr) {
+            Expr *expr = static_cast<Expr*>(box->expr);
+            if (--expr->refCount == 0) {
+                delete expr;
+            }
+        }
+    }
+    mgr->count = 0;
 }
 
-void s2e_expr_set(void *expr, uint64_t constant)
+void s2e_expr_set(S2EExprBox *box, uint64_t constant)
 {
-    ExprBox *box = static_cast<ExprBox*>(expr);
+    //The reference, if any, is still released by s2e_expr_clear
     box->value = constant;
-    box->constant = true;
+    box->constant = 1;
 }
 
-void *s2e_expr_and(void *_mgr, void *_lhs, uint64_t constant)
+S2EExprBox *s2e_expr_and_symbolic(S2EExprMgr *mgr, S2EExprBox *box, uint64_t constant)
 {
-    ExprManager *mgr = static_cast<ExprManager*>(_mgr);
-    ExprBox *box = static_cast<ExprBox*>(_lhs);
-    ExprBox *retbox = mgr->create();
-
-    if (box->constant) {
-        retbox->value = box->value & constant;
-        retbox->constant = true;
-    } else {
-        ConstantExpr *cste = dyn_cast<ConstantExpr>(box->expr);
-        if (cste) {
-            retbox->value = cste->getZExtValue() & constant;
-            retbox->constant = true;
-        } else {
-            retbox->expr = AndExpr::create(box->expr, ConstantExpr::create(constant, box->expr->getWidth()));
-            retbox->constant = false;
-        }
-    }
+    S2EExprBox *retbox = s2e_expr_create(mgr);
+    ref<Expr> expr = getExpr(box);
+    setExpr(retbox, AndExpr::create(expr, ConstantExpr::create(constant, expr->getWidth())));
     return retbox;
 }
 
-uint64_t s2e_expr_to_constant(void *_expr)
+uint64_t s2e_expr_to_constant_symbolic(S2EExprBox *box)
 {
-    ExprBox *box = static_cast<ExprBox*>(_expr);
-    if (box->constant) {
-        return box->value;
-    } else {
-        ref<Expr> expr = g_s2e->getExecutor()->toConstant(*g_s2e_state, box->expr, "klee_expr_to_constant");
-        ConstantExpr *cste = dyn_cast<ConstantExpr>(expr);
-        return cste->getZExtValue();
-    }
+    ref<Expr> expr = g_s2e->getExecutor()->toConstant(*g_s2e_state, getExpr(box), "klee_expr_to_constant");
+    ConstantExpr *cste = dyn_cast<ConstantExpr>(expr);
+    return cste->getZExtValue();
 }
 
-void s2e_expr_write_cpu(void *expr, unsigned offset, unsigned size)
+void s2e_expr_write_cpu(S2EExprBox *box, unsigned offset, unsigned size)
 {
-    ExprBox *box = static_cast<ExprBox*>(expr);
     if (box->constant) {
         g_s2e_state->writeCpuRegister(offset, ConstantExpr::create(box->value, size*8));
     } else {
-        unsigned exprSizeInBytes = box->expr->getWidth() / 8;
+        ref<Expr> expr = getExpr(box);
+        unsigned exprSizeInBytes = expr->getWidth() / 8;
         if (exprSizeInBytes == size) {
-            g_s2e_state->writeCpuRegisterSymbolic(offset, box->expr);
+            g_s2e_state->writeCpuRegisterSymbolic(offset, expr);
         } else if (exprSizeInBytes > size) {
-            g_s2e_state->writeCpuRegisterSymbolic(offset, ExtractExpr::create(box->expr, 0, size * 8));
+            g_s2e_state->writeCpuRegisterSymbolic(offset, ExtractExpr::create(expr, 0, size * 8));
         } else {
-            g_s2e_state->writeCpuRegisterSymbolic(offset, ZExtExpr::create(box->expr, size * 8));
+            g_s2e_state->writeCpuRegisterSymbolic(offset, ZExtExpr::create(expr, size * 8));
         }
     }
 }
 
-void *s2e_expr_read_cpu(void *_mgr, unsigned offset, unsigned size)
+S2EExprBox *s2e_expr_read_cpu(S2EExprMgr *mgr, unsigned offset, unsigned size)
 {
-    ExprManager *mgr = static_cast<ExprManager*>(_mgr);
-    ExprBox *retbox = mgr->create();
-
-    retbox->expr = g_s2e_state->readCpuRegister(offset, size * 8);
-    ConstantExpr *constant = dyn_cast<ConstantExpr>(retbox->expr);
-    if (constant) {
-        retbox->constant = true;
-        retbox->value = constant->getZExtValue();
+    S2EExprBox *retbox = s2e_expr_create(mgr);
+
+    uint64_t value = 0;
+    if (size <= sizeof(value) &&
+        g_s2e_state->readCpuRegisterConcrete(offset, &value, size)) {
+        retbox->value = value;
+        return retbox;
     }
 
+    setExpr(retbox, g_s2e_state->readCpuRegister(offset, size * 8));
     return retbox;
 }
 
-void *s2e_expr_read_mem_l(void *_mgr, uint64_t virtual_address)
+S2EExprBox *s2e_expr_read_mem_l(S2EExprMgr *mgr, uint64_t virtual_address)
 {
-    ExprManager *mgr = static_cast<ExprManager*>(_mgr);
-    ExprBox *retbox = mgr->create();
+    S2EExprBox *retbox = s2e_expr_create(mgr);
 
-    //XXX: This may be slow... fast path for concrete values required.
-    retbox->expr = g_s2e_state->readMemory(virtual_address, Expr::Int32);
+    uint32_t value;
+    if (g_s2e_state->readMemoryConcrete(virtual_address, &value, sizeof(value))) {
+        retbox->value = value;
+        return retbox;
+    }
+
+    ref<Expr> expr = g_s2e_state->readMemory(virtual_address, Expr::Int32);
 
     //XXX: What do we do if the result is NULL?
     //For now we call this function from iret-type of handlers where
     //some checks must have been done before accessing the memory
-    assert(!retbox->expr.isNull() && "Failed memory access");
-
-    ConstantExpr *constant = dyn_cast<ConstantExpr>(retbox->expr);
-    if (constant) {
-        retbox->constant = true;
-        retbox->value = constant->getZExtValue();
-    }
+    assert(!expr.isNull() && "Failed memory access");
 
+    setExpr(retbox, expr);
     return retbox;
 }
@@ -33,18 +33,75 @@
 
 #define S2E_EXPR_INTERFACE_H
 
+#include <stdint.h>
+#include <assert.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void* s2e_expr_mgr();
-void s2e_expr_clear(void *_mgr);
-void *s2e_expr_and(void *_mgr, void *_lhs, uint64_t constant);
-uint64_t s2e_expr_to_constant(void *expr);
-void s2e_expr_set(void *expr, uint64_t constant);
-void s2e_expr_write_cpu(void *expr, unsigned offset, unsigned size);
-void *s2e_expr_read_cpu(void *_mgr, unsigned offset, unsigned size);
-void *s2e_expr_read_mem_l(void *_mgr, uint64_t virtual_address);
+/* Maximum number of values that a helper manipulates at once */
+#define S2E_EXPR_MAX_BOXES 8
+
+typedef struct S2EExprBox {
+    int constant;
+    uint64_t value;
+    /* klee::Expr referenced by the manager, only set for symbolic values */
+    void *expr;
+} S2EExprBox;
+
+/* Scratchpad allocated on the stack of the helper. Constant values are
+   handled inline and never create KLEE expressions. */
+typedef struct S2EExprMgr {
+    unsigned count;
+    S2EExprBox boxes[S2E_EXPR_MAX_BOXES];
+} S2EExprMgr;
+
+static inline void s2e_expr_mgr_init(S2EExprMgr *mgr)
+{
+    mgr->count = 0;
+}
+
+static inline S2EExprBox *s2e_expr_create(S2EExprMgr *mgr)
+{
+    S2EExprBox *box;
+    assert(mgr->count < S2E_EXPR_MAX_BOXES && "Too many expressions");
+    box = &mgr->boxes[mgr->count++];
+    box->constant = 1;
+    box->value = 0;
+    box->expr = 0;
+    return box;
+}
+
+/* Releases the symbolic values of the manager */
+void s2e_expr_clear(S2EExprMgr *mgr);
+
+void s2e_expr_set(S2EExprBox *expr, uint64_t constant);
+S2EExprBox *s2e_expr_and_symbolic(S2EExprMgr *mgr, S2EExprBox *lhs, uint64_t constant);
+uint64_t s2e_expr_to_constant_symbolic(S2EExprBox *expr);
+void s2e_expr_write_cpu(S2EExprBox *expr, unsigned offset, unsigned size);
+S2EExprBox *s2e_expr_read_cpu(S2EExprMgr *mgr, unsigned offset, unsigned size);
+S2EExprBox *s2e_expr_read_mem_l(S2EExprMgr *mgr, uint64_t virtual_address);
+
+static inline S2EExprBox *s2e_expr_and(S2EExprMgr *mgr, S2EExprBox *lhs, uint64_t constant)
+{
+    S2EExprBox *box;
+    if (!lhs->constant) {
+        return s2e_expr_and_symbolic(mgr, lhs, constant);
+    }
+
+    box = s2e_expr_create(mgr);
+    box->value = lhs->value & constant;
+    return box;
+}
+
+static inline uint64_t s2e_expr_to_constant(S2EExprBox *expr)
+{
+    if (expr->constant) {
+        return expr->value;
+    }
+    return s2e_expr_to_constant_symbolic(expr);
+}
 
 #ifdef __cplusplus
 }
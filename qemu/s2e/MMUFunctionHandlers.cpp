@@ -50,6 +50,14 @@ extern CPUArchState *env;
 #include <s2e/s2e_qemu.h>
 
 #include <llvm/Module.h>
+#include <llvm/Instructions.h>
+#include <llvm/Constants.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Support/CallSite.h>
+#include <llvm/Support/DynamicLibrary.h>
+
+#include <set>
+#include <vector>
 
 using namespace klee;
 
@@ -88,6 +96,12 @@ static void io_write_chk(S2EExecutionState *state,
 
     env->mem_io_vaddr = addr;
     env->mem_io_pc = (uintptr_t)retaddr;
+
+    CorePlugin *core = g_s2e->getCorePlugin();
+    if (core->isMmioSymbolic(physaddr, width / 8)) {
+        core->notifySymbolicHardwareWrite(state, true, physaddr, width / 8, val);
+    }
+
 #ifdef TARGET_WORDS_BIGENDIAN
     #error This is not implemented yet.
 #else
@@ -147,7 +161,8 @@ static ref<Expr> io_read_chk(S2EExecutionState *state,
     if (s2e_ismemfunc(mr, 0)) {
         uintptr_t pa = (uintptr_t) qemu_get_ram_ptr(naddr);
         if (isSymb) {
-            return state->createSymbolicValue(ss.str(), width);
+            return g_s2e->getCorePlugin()->createSymbolicHardwareValue(state, true, naddr,
+                                                                       width / 8, ss.str());
         }
         return state->readMemory(pa, width, S2EExecutionState::HostAddress);
     }
@@ -258,13 +273,13 @@ ref<ConstantExpr> S2EExecutor::handleForkAndConcretizeNative(Executor* executor,
     if (constantAddress.isNull()) {
         //Find the LLVM instruction that computes the address
         const llvm::Instruction *addrInst = dyn_cast<llvm::Instruction>(target->inst->getOperand(0));
-        assert(target->owner->instrMap.count(addrInst));
+        KInstruction *kinst = target->owner->getKInstruction(addrInst);
+        assert(kinst);
 
         std::vector<ref<Expr> > forkArgs;
         forkArgs.push_back(symbAddress);
         forkArgs.push_back(ref<Expr>(NULL));
         forkArgs.push_back(ref<Expr>(NULL));
-        KInstruction *kinst = (*target->owner->instrMap.find(addrInst)).second;
         S2EExecutor::handleForkAndConcretize(executor, state, kinst, forkArgs);
 
         constantAddress = dyn_cast<ConstantExpr>(s2eExecutor->getDestCell(*state, kinst).value);
@@ -328,15 +343,17 @@ ref<Expr> S2EExecutor::handle_ldst_mmu(Executor* executor,
             if (!isWrite)
                 value = io_read_chk(s2estate, ioaddr, addr, retaddr, width);
 
-            //Trace the access
-            std::vector<ref<Expr> > traceArgs;
-            traceArgs.push_back(symbAddress);
-            traceArgs.push_back(ConstantExpr::create(addr + ioaddr, Expr::Int64));
-            traceArgs.push_back(value);
-            traceArgs.push_back(ConstantExpr::create(width, Expr::Int64));
-            traceArgs.push_back(ConstantExpr::create(isWrite, Expr::Int64)); //isWrite
-            traceArgs.push_back(ConstantExpr::create(1, Expr::Int64)); //isIO
-            handlerTraceMemoryAccess(executor, state, target, traceArgs);
+            //Trace the access, building the arguments only if someone listens
+            if (g_s2e->getCorePlugin()->isDataMemoryAccessTraced()) {
+                std::vector<ref<Expr> > traceArgs;
+                traceArgs.push_back(symbAddress);
+                traceArgs.push_back(ConstantExpr::create(addr + ioaddr, Expr::Int64));
+                traceArgs.push_back(value);
+                traceArgs.push_back(ConstantExpr::create(width, Expr::Int64));
+                traceArgs.push_back(ConstantExpr::create(isWrite, Expr::Int64)); //isWrite
+                traceArgs.push_back(ConstantExpr::create(1, Expr::Int64)); //isIO
+                handlerTraceMemoryAccess(executor, state, target, traceArgs);
+            }
 
            if (isWrite)
                io_write_chk(s2estate, ioaddr, value, addr, retaddr, width);
@@ -397,15 +414,17 @@ ref<Expr> S2EExecutor::handle_ldst_mmu(Executor* executor,
                 value = s2estate->readMemory(addr + addend, width, S2EExecutionState::HostAddress);
             }
 
-            //Trace the access
-            std::vector<ref<Expr> > traceArgs;
-            traceArgs.push_back(symbAddress);
-            traceArgs.push_back(ConstantExpr::create(addr + addend, Expr::Int64));
-            traceArgs.push_back(value);
-            traceArgs.push_back(ConstantExpr::create(width, Expr::Int64));
-            traceArgs.push_back(ConstantExpr::create(isWrite, Expr::Int64)); //isWrite
-            traceArgs.push_back(ConstantExpr::create(0, Expr::Int64)); //isIO
-            handlerTraceMemoryAccess(executor, state, target, traceArgs);
+            //Trace the access, building the arguments only if someone listens
+            if (g_s2e->getCorePlugin()->isDataMemoryAccessTraced()) {
+                std::vector<ref<Expr> > traceArgs;
+                traceArgs.push_back(symbAddress);
+                traceArgs.push_back(ConstantExpr::create(addr + addend, Expr::Int64));
+                traceArgs.push_back(value);
+                traceArgs.push_back(ConstantExpr::create(width, Expr::Int64));
+                traceArgs.push_back(ConstantExpr::create(isWrite, Expr::Int64)); //isWrite
+                traceArgs.push_back(ConstantExpr::create(0, Expr::Int64)); //isIO
+                handlerTraceMemoryAccess(executor, state, target, traceArgs);
+            }
        }
     } else {
         /* the page is not in the TLB : fill it */
@@ -543,15 +562,17 @@ void S2EExecutor::handle_ldst_kernel(Executor* executor,
             value = s2estate->readMemory(physaddr, width, S2EExecutionState::HostAddress);
         }
 
-        //Trace the access
-        std::vector<ref<Expr> > traceArgs;
-        traceArgs.push_back(constantAddress);
-        traceArgs.push_back(ConstantExpr::create(physaddr, Expr::Int64));
-        traceArgs.push_back(value);
-        traceArgs.push_back(ConstantExpr::create(width, Expr::Int64));
-        traceArgs.push_back(ConstantExpr::create(isWrite, Expr::Int64)); //isWrite
-        traceArgs.push_back(ConstantExpr::create(0, Expr::Int64)); //isIO
-        handlerTraceMemoryAccess(executor, state, target, traceArgs);
+        //Trace the access, building the arguments only if someone listens
+        if (g_s2e->getCorePlugin()->isDataMemoryAccessTraced()) {
+            std::vector<ref<Expr> > traceArgs;
+            traceArgs.push_back(constantAddress);
+            traceArgs.push_back(ConstantExpr::create(physaddr, Expr::Int64));
+            traceArgs.push_back(value);
+            traceArgs.push_back(ConstantExpr::create(width, Expr::Int64));
+            traceArgs.push_back(ConstantExpr::create(isWrite, Expr::Int64)); //isWrite
+            traceArgs.push_back(ConstantExpr::create(0, Expr::Int64)); //isIO
+            handlerTraceMemoryAccess(executor, state, target, traceArgs);
+        }
 
         if (!isWrite) {
             if (zeroExtend) {
@@ -618,4 +639,111 @@ void S2EExecutor::disableConcreteLLVMHelpers()
 
 }
 
+/**
+ * Checks that the body of a helper can be replaced by its native version.
+ * The native code reads registers through the RR_cpu wrappers and shares
+ * the rest of the CPU state with KLEE, but accesses to guest memory would
+ * silently concretize symbolic data. Such accesses always go through a host
+ * address built with inttoptr (TLB addend) or through an overridden
+ * handler, so functions containing either are rejected.
+ */
+bool S2EExecutor::isNativeSafeFunction(llvm::Function *f,
+                                       std::vector<llvm::Function*> &callees)
+{
+    for (llvm::inst_iterator it = llvm::inst_begin(f), ie = llvm::inst_end(f);
+         it != ie; ++it) {
+        llvm::Instruction *inst = &*it;
+
+        if (llvm::isa<llvm::IntToPtrInst>(inst)) {
+            return false;
+        }
+
+        for (unsigned i = 0; i < inst->getNumOperands(); ++i) {
+            llvm::ConstantExpr *ce =
+                    llvm::dyn_cast<llvm::ConstantExpr>(inst->getOperand(i));
+            if (ce && ce->getOpcode() == llvm::Instruction::IntToPtr) {
+                return false;
+            }
+        }
+
+        llvm::CallSite cs(inst);
+        if (!cs.getInstruction()) {
+            continue;
+        }
+
+        llvm::Function *callee = cs.getCalledFunction();
+        if (!callee) {
+            return false;
+        }
+
+        if (callee->isIntrinsic()) {
+            continue;
+        }
+
+        if (overridenInternalFunctions.count(callee) ||
+                hasSpecialFunctionHandler(callee)) {
+            return false;
+        }
+
+        if (!callee->isDeclaration()) {
+            callees.push_back(callee);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Collects the helpers that KLEE may run natively when all their arguments
+ * and the CPU registers are concrete. Only helpers that do not reach guest
+ * memory qualify. Pointer parameters are allowed because the SSE and MMX
+ * helpers get their operands as pointers into the CPU state. The call site
+ * checks that they point into the always-concrete part (see mayCallNatively).
+ */
+void S2EExecutor::initializeConcreteHelpers()
+{
+    llvm::Module *module = kmodule->module;
+    unsigned count = 0;
+
+    for (llvm::Module::iterator fit = module->begin(), fie = module->end();
+         fit != fie; ++fit) {
+        llvm::Function *f = &*fit;
+        if (f->isDeclaration() || !f->getName().startswith("helper_")) {
+            continue;
+        }
+
+        bool ok = !f->isVarArg();
+        for (llvm::Function::arg_iterator ait = f->arg_begin();
+             ok && ait != f->arg_end(); ++ait) {
+            ok = ait->getType()->isIntegerTy() ||
+                 ait->getType()->isPointerTy();
+        }
+
+        if (!ok || !llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(
+                    f->getName())) {
+            continue;
+        }
+
+        std::set<llvm::Function*> visited;
+        std::vector<llvm::Function*> worklist;
+        worklist.push_back(f);
+
+        while (ok && !worklist.empty()) {
+            llvm::Function *cur = worklist.back();
+            worklist.pop_back();
+            if (!visited.insert(cur).second) {
+                continue;
+            }
+            ok = isNativeSafeFunction(cur, worklist);
+        }
+
+        if (ok) {
+            nativeCallableFunctions.insert(f);
+            ++count;
+        }
+    }
+
+    m_s2e->getDebugStream() << "Helpers callable natively: " << count << '\n';
+}
+
 }
@@ -13,28 +13,51 @@ template <class T, unsigned OBJSIZE_BITS, unsigned PAGESIZE_BITS, unsigned SUPER
 class MemoryCache
 {
 private:
+    //The tables are shared between the caches of forked states and
+    //are copied on the first write (copy-on-write).
     struct ThirdLevel {
+        unsigned refCount;
         T level3[1<<(PAGESIZE_BITS-OBJSIZE_BITS)];
         ThirdLevel() {
+            refCount = 1;
             for (unsigned i=0; i<(1<<(PAGESIZE_BITS-OBJSIZE_BITS)); ++i) {
                 level3[i] = T();
             }
         }
+
+        ThirdLevel(const ThirdLevel &one) {
+            refCount = 1;
+            for (unsigned i=0; i<(1<<(PAGESIZE_BITS-OBJSIZE_BITS)); ++i) {
+                level3[i] = one.level3[i];
+            }
+        }
     };
 
     struct SecondLevel {
+        unsigned refCount;
         ThirdLevel* level2[1<<(SUPERPAGESIZE_BITS-PAGESIZE_BITS)];
 
         SecondLevel() {
+            refCount = 1;
             for (unsigned i=0; i<(1<<(SUPERPAGESIZE_BITS-PAGESIZE_BITS)); ++i) {
                 level2[i] = NULL;
             }
         }
 
+        SecondLevel(const SecondLevel &one) {
+            refCount = 1;
+            for (unsigned i=0; i<(1<<(SUPERPAGESIZE_BITS-PAGESIZE_BITS)); ++i) {
+                level2[i] = one.level2[i];
+                if (level2[i]) {
+                    ++level2[i]->refCount;
+                }
+            }
+        }
+
         ~SecondLevel() {
             for (unsigned i=0; i<(1<<(SUPERPAGESIZE_BITS-PAGESIZE_BITS)); ++i) {
                 if (level2[i]) {
-                    delete level2[i];
+                    release(level2[i]);
                     level2[i] = NULL;
                 }
             }
@@ -46,6 +69,23 @@ private:
     uint64_t m_size;
     unsigned m_pagecount;
 
+    template <typename Level>
+    static inline void release(Level *level) {
+        if (--level->refCount == 0) {
+            delete level;
+        }
+    }
+
+    //Returns a table that is not shared with other caches
+    template <typename Level>
+    static inline Level *getWriteable(Level *&level) {
+        if (level->refCount > 1) {
+            --level->refCount;
+            level = new Level(*level);
+        }
+        return level;
+    }
+
     inline void resize()
     {
         uint64_t mask = (1<<SUPERPAGESIZE_BITS)-1;
@@ -69,15 +109,23 @@ public:
         resize();
     }
 
-    //XXX: Clone an empty cache for now
+    //The clone shares all the tables with the original cache
     MemoryCache(const MemoryCache &one) {
         m_hostAddrStart = one.m_hostAddrStart;
         m_size = one.m_size;
         resize();
+
+        for (unsigned i=0; i<m_pagecount; ++i) {
+            m_level1[i] = one.m_level1[i];
+            if (m_level1[i]) {
+                ++m_level1[i]->refCount;
+            }
+        }
     }
 
     ~MemoryCache() {
         flushCache();
+        delete [] m_level1;
     }
 
     inline uint64_t getSize() const {
@@ -91,7 +139,7 @@ public:
     inline void flushCache() {
         for (unsigned i=0; i<m_pagecount; ++i) {
             if (m_level1[i]) {
-                delete m_level1[i];
+                release(m_level1[i]);
                 m_level1[i] = NULL;
             }
         }
@@ -112,12 +160,16 @@ public:
         if (!(ptrLevel2 = m_level1[level1])) {
             ptrLevel2 = new SecondLevel();
             m_level1[level1] = ptrLevel2;
+        } else {
+            ptrLevel2 = getWriteable(m_level1[level1]);
         }
 
         ThirdLevel *ptrLevel3;
         if (!(ptrLevel3 = ptrLevel2->level2[level2])) {
             ptrLevel3 = new ThirdLevel();
             ptrLevel2->level2[level2] = ptrLevel3;
+        } else {
+            ptrLevel3 = getWriteable(ptrLevel2->level2[level2]);
         }
 
         assert(level3 < (1<<(PAGESIZE_BITS-OBJSIZE_BITS)));
@@ -145,6 +197,7 @@ public:
         return ptrLevel3->level3[level3];
     }
 
+    //The caller may modify the returned array, so it is unshared first
     inline T* getArray(uint64_t hostAddress)
     {
         uint64_t offset = hostAddress - m_hostAddrStart;
@@ -156,11 +209,13 @@ public:
             return NULL;
         }
 
-        ThirdLevel *ptrLevel3;
-        if (!(ptrLevel3 = ptrLevel2->level2[level2])) {
+        if (!ptrLevel2->level2[level2]) {
             return NULL;
         }
 
+        ptrLevel2 = getWriteable(m_level1[level1]);
+        ThirdLevel *ptrLevel3 = getWriteable(ptrLevel2->level2[level2]);
+
         return ptrLevel3->level3;
     }
 };
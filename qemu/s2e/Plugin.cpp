@@ -61,6 +61,16 @@ PluginState *Plugin::getPluginState(S2EExecutionState *s, PluginStateFactory f)
     return m_CachedPluginState;
 }
 
+const PluginState *Plugin::getPluginStateConst(S2EExecutionState *s, PluginStateFactory f) const
+{
+    if (m_CachedPluginS2EState == s) {
+        return m_CachedPluginState;
+    }
+
+    //Not cached, the state may still be shared and must not be written to
+    return s->getPluginStateConst(const_cast<Plugin*>(this), f);
+}
+
 PluginsFactory::PluginsFactory()
 {
     CompiledPlugin::CompiledPlugins *plugins = CompiledPlugin::getPlugins();
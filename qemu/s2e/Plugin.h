@@ -36,6 +36,7 @@
 #ifndef S2E_PLUGIN_H
 #define S2E_PLUGIN_H
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 //#include <tr1/unordered_map>
@@ -52,13 +53,19 @@ class S2EExecutionState;
 
 class Plugin : public sigc::trackable{
 private:
+    friend class S2E;
+
     S2E* m_s2e;
+
+    /** Dense index of the plugin among the active plugins,
+        assigned by S2E::initPlugins() */
+    unsigned m_pluginIndex;
 protected:
     mutable PluginState *m_CachedPluginState;
     mutable S2EExecutionState *m_CachedPluginS2EState;
 
 public:
-    Plugin(S2E* s2e) : m_s2e(s2e),m_CachedPluginState(NULL),
+    Plugin(S2E* s2e) : m_s2e(s2e), m_pluginIndex((unsigned) -1), m_CachedPluginState(NULL),
         m_CachedPluginS2EState(NULL) {}
 
     virtual ~Plugin() {}
@@ -77,8 +84,16 @@ public:
     /** Return configuration key for this plugin */
     const std::string& getConfigKey() const;
 
+    /** Return the slot of this plugin in the plugin state array
+        of the execution states */
+    unsigned getPluginIndex() const { return m_pluginIndex; }
+
     PluginState *getPluginState(S2EExecutionState *s, PluginState* (*f)(Plugin *, S2EExecutionState *)) const;
 
+    /** Read-only access, does not copy a plugin state shared with other
+        execution states */
+    const PluginState *getPluginStateConst(S2EExecutionState *s, PluginState* (*f)(Plugin *, S2EExecutionState *)) const;
+
     void refresh() {
         m_CachedPluginS2EState = NULL;
         m_CachedPluginState = NULL;
@@ -95,16 +110,39 @@ public:
     c *name = static_cast<c*>(getPluginState(execstate, &c::factory))
 
 #define DECLARE_PLUGINSTATE_CONST(c, execstate) \
-    const c *plgState = static_cast<c*>(getPluginState(execstate, &c::factory))
+    const c *plgState = static_cast<const c*>(getPluginStateConst(execstate, &c::factory))
 
 #define DECLARE_PLUGINSTATE_NCONST(c, name, execstate) \
-    const c *name = static_cast<c*>(getPluginState(execstate, &c::factory))
+    const c *name = static_cast<const c*>(getPluginStateConst(execstate, &c::factory))
 
 class PluginState
 {
+private:
+    friend class S2EExecutionState;
+
+    /** Number of additional execution states sharing this plugin state.
+        A shared state is cloned on the first access after a fork. */
+    unsigned m_sharedCount;
+
 public:
+    PluginState() : m_sharedCount(0) {}
+    PluginState(const PluginState&) : m_sharedCount(0) {}
+    PluginState& operator=(const PluginState&) { return *this; }
+
     virtual ~PluginState() {};
     virtual PluginState *clone() const = 0;
+
+    /** Approximate number of bytes used by the plugin state,
+        0 if the plugin does not report it */
+    virtual uint64_t getMemoryUsage() const { return 0; }
+
+    /** Appends the plugin state to data, for the plugins whose states
+        can be moved to another process (see StateWriter).
+        Returns false if the plugin does not support it. */
+    virtual bool serialize(std::string &data) const { return false; }
+
+    /** Restores a plugin state written by serialize() */
+    virtual bool deserialize(const std::string &data) { return false; }
 };
 
 
@@ -62,6 +62,8 @@ void Annotation::initialize()
     m_osMonitor = static_cast<OSMonitor*>(s2e()->getPlugin("Interceptor"));
 
     m_translationEventConnected = false;
+    m_onStateKillRef = LUA_NOREF;
+    m_onTimerRef = LUA_NOREF;
 
     std::vector<std::string> Sections;
     Sections = s2e()->getConfig()->getListKeys(getConfigKey());
@@ -98,14 +100,107 @@ void Annotation::initialize()
         );
     }
 
-    Lunar<LUAAnnotation>::Register(s2e()->getConfig()->getState());
+    lua_State *L = s2e()->getConfig()->getState();
+    Lunar<LUAAnnotation>::Register(L);
+
+    m_luaState = new S2ELUAExecutionState((S2EExecutionState*) NULL);
+    Lunar<S2ELUAExecutionState>::push(L, m_luaState);
+    m_luaStateRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    m_luaAnnotation = new LUAAnnotation(this, NULL);
+    Lunar<LUAAnnotation>::push(L, m_luaAnnotation);
+    m_luaAnnotationRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    m_luaWrappersBusy = false;
 }
 
 Annotation::~Annotation()
 {
+    lua_State *L = s2e()->getConfig()->getState();
+
     foreach2(it, m_entries.begin(), m_entries.end()) {
+        luaL_unref(L, LUA_REGISTRYINDEX, (*it)->luaRef);
         delete *it;
     }
+
+    luaL_unref(L, LUA_REGISTRYINDEX, m_onStateKillRef);
+    luaL_unref(L, LUA_REGISTRYINDEX, m_onTimerRef);
+    luaL_unref(L, LUA_REGISTRYINDEX, m_luaStateRef);
+    luaL_unref(L, LUA_REGISTRYINDEX, m_luaAnnotationRef);
+
+    delete m_luaState;
+    delete m_luaAnnotation;
+}
+
+/**
+ *  Returns a registry reference to the global Lua function \c name,
+ *  or LUA_NOREF if the function is not defined yet.
+ */
+int Annotation::getFunctionRef(const std::string &name)
+{
+    lua_State *L = s2e()->getConfig()->getState();
+
+    lua_getfield(L, LUA_GLOBALSINDEX, name.c_str());
+    if (!lua_isfunction(L, -1)) {
+        lua_pop(L, 1);
+        return LUA_NOREF;
+    }
+
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+namespace {
+//Releases the shared wrappers even if the annotation leaves with an exception
+struct LuaWrappersGuard {
+    bool &m_busy;
+    LuaWrappersGuard(bool &busy) : m_busy(busy) { m_busy = true; }
+    ~LuaWrappersGuard() { m_busy = false; }
+};
+}
+
+/**
+ *  Calls the Lua function with the execution state (if \c passState is set)
+ *  and the annotation object. \c annotation holds the input flags and
+ *  receives the ones set by the function.
+ *
+ *  The call goes through the persistent wrappers, which avoids allocating
+ *  two userdata per invocation. Nested calls (e.g., an annotation that
+ *  kills the state triggers onStateKill) fall back to temporaries.
+ */
+void Annotation::callLuaFunction(int ref, const std::string &name,
+                                 S2EExecutionState *state, bool passState,
+                                 LUAAnnotation &annotation)
+{
+    lua_State *L = s2e()->getConfig()->getState();
+
+    if (ref != LUA_NOREF) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    } else {
+        lua_getfield(L, LUA_GLOBALSINDEX, name.c_str());
+    }
+
+    if (m_luaWrappersBusy) {
+        S2ELUAExecutionState lua_s2e_state(state);
+        if (passState) {
+            Lunar<S2ELUAExecutionState>::push(L, &lua_s2e_state);
+        }
+        Lunar<LUAAnnotation>::push(L, &annotation);
+        lua_call(L, passState ? 2 : 1, 0);
+        return;
+    }
+
+    LuaWrappersGuard guard(m_luaWrappersBusy);
+
+    m_luaState->setState(state);
+    *m_luaAnnotation = annotation;
+
+    if (passState) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, m_luaStateRef);
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, m_luaAnnotationRef);
+    lua_call(L, passState ? 2 : 1, 0);
+
+    annotation = *m_luaAnnotation;
 }
 
 std::string Annotation::checkCoreSignal(const std::string &cfgname,
@@ -133,6 +228,7 @@ void Annotation::registerCoreSignals(const std::string &cfgname)
 {
     m_onStateKill = checkCoreSignal(cfgname, "onStateKill");
     if (m_onStateKill.length() > 0) {
+        m_onStateKillRef = getFunctionRef(m_onStateKill);
         s2e()->getCorePlugin()->onStateKill.connect(
                 sigc::mem_fun(*this, &Annotation::onStateKill)
         );
@@ -140,6 +236,7 @@ void Annotation::registerCoreSignals(const std::string &cfgname)
 
     m_onTimer = checkCoreSignal(cfgname, "onTimer");
     if (m_onTimer.length() > 0) {
+        m_onTimerRef = getFunctionRef(m_onTimer);
         s2e()->getCorePlugin()->onTimer.connect(
                 sigc::mem_fun(*this, &Annotation::onTimer)
         );
@@ -221,8 +318,13 @@ bool Annotation::initSection(const std::string &entry, const std::string &cfgnam
         e.switchInstructionToSymbolic = cfg->getBool(entry + ".switchInstructionToSymbolic", e.switchInstructionToSymbolic, &ok);
     }
 
+    e.luaRef = getFunctionRef(e.annotation);
+
     ne = new AnnotationCfgEntry(e);
-    m_entries.insert(ne);
+    if (!m_entries.insert(ne).second) {
+        luaL_unref(s2e()->getConfig()->getState(), LUA_REGISTRYINDEX, ne->luaRef);
+        delete ne;
+    }
 
     return true;
 }
@@ -230,24 +332,14 @@ bool Annotation::initSection(const std::string &entry, const std::string &cfgnam
 ///////////////////////////////////////////////////////////////////////////////////////
 void Annotation::onStateKill(S2EExecutionState* state)
 {
-    lua_State *L = s2e()->getConfig()->getState();
     LUAAnnotation luaAnnotation(this, state);
-    S2ELUAExecutionState lua_s2e_state(state);
-
-    lua_getfield(L, LUA_GLOBALSINDEX, m_onStateKill.c_str());
-    Lunar<S2ELUAExecutionState>::push(L, &lua_s2e_state);
-    Lunar<LUAAnnotation>::push(L, &luaAnnotation);
-    lua_call(L, 2, 0);
+    callLuaFunction(m_onStateKillRef, m_onStateKill, state, true, luaAnnotation);
 }
 
 void Annotation::onTimer()
 {
-    lua_State *L = s2e()->getConfig()->getState();
     LUAAnnotation luaAnnotation(this, NULL);
-
-    lua_getfield(L, LUA_GLOBALSINDEX, m_onTimer.c_str());
-    Lunar<LUAAnnotation>::push(L, &luaAnnotation);
-    lua_call(L, 1, 0);
+    callLuaFunction(m_onTimerRef, m_onTimer, NULL, false, luaAnnotation);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////
@@ -413,18 +505,12 @@ void Annotation::invokeAnnotation(
         bool isCall, bool isInstruction
     )
 {
-    lua_State *L = s2e()->getConfig()->getState();
-
-    S2ELUAExecutionState lua_s2e_state(state);
     LUAAnnotation luaAnnotation(this, state);
 
     luaAnnotation.m_isReturn = !isCall;
     luaAnnotation.m_isInstruction = isInstruction;
 
-    lua_getfield(L, LUA_GLOBALSINDEX, entry->annotation.c_str());
-    Lunar<S2ELUAExecutionState>::push(L, &lua_s2e_state);
-    Lunar<LUAAnnotation>::push(L, &luaAnnotation);
-    lua_call(L, 2, 0);
+    callLuaFunction(entry->luaRef, entry->annotation, state, true, luaAnnotation);
 
     if (luaAnnotation.m_doKill) {
         std::stringstream ss;
@@ -63,6 +63,9 @@ namespace plugins {
         bool beforeInstruction;
         bool switchInstructionToSymbolic;
 
+        //Registry reference to the Lua function, resolved at load time
+        int luaRef;
+
         AnnotationCfgEntry() {
             isCallAnnotation = true;
             address = 0;
@@ -70,6 +73,7 @@ namespace plugins {
             isActive = false;
             beforeInstruction = false;
             switchInstructionToSymbolic = false;
+            luaRef = LUA_NOREF;
         }
 
         bool operator()(const AnnotationCfgEntry *a1, const AnnotationCfgEntry *a2) const {
@@ -112,6 +116,16 @@ private:
 
     std::string m_onStateKill;
     std::string m_onTimer;
+    int m_onStateKillRef;
+    int m_onTimerRef;
+
+    //Wrappers passed to the Lua functions. They are pushed once
+    //and reused by all the invocations that do not nest.
+    S2ELUAExecutionState *m_luaState;
+    LUAAnnotation *m_luaAnnotation;
+    int m_luaStateRef;
+    int m_luaAnnotationRef;
+    bool m_luaWrappersBusy;
 
     bool initSection(const std::string &entry, const std::string &cfgname);
 
@@ -119,6 +133,11 @@ private:
                                 const std::string &name);
     void registerCoreSignals(const std::string &cfgname);
 
+    int getFunctionRef(const std::string &name);
+    void callLuaFunction(int ref, const std::string &name,
+                         S2EExecutionState *state, bool passState,
+                         LUAAnnotation &annotation);
+
     //CorePlugin signal hooks for annotations
     void onStateKill(S2EExecutionState* state);
     void onTimer();
@@ -54,11 +54,15 @@ extern "C" {
 #include <s2e/Plugins/Opcodes.h>
 
 #include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
 #include <sstream>
 
 #include <llvm/Support/TimeValue.h>
 #include <klee/Searcher.h>
 #include <klee/Solver.h>
+#include <klee/Internal/ADT/KTest.h>
 
 #include <llvm/Support/CommandLine.h>
 
@@ -74,8 +78,11 @@ S2E_DEFINE_PLUGIN(BaseInstructions, "Default set of custom instructions plugin",
 
 void BaseInstructions::initialize()
 {
-    s2e()->getCorePlugin()->onCustomInstruction.connect(
-            sigc::mem_fun(*this, &BaseInstructions::onCustomInstruction));
+    //Built-in opcodes are the ones up to 0x70 (see handleBuiltInOps)
+    for (unsigned opcode = 0; opcode <= 0x70; ++opcode) {
+        s2e()->getCorePlugin()->getCustomInstructionSignal(opcode).connect(
+                sigc::mem_fun(*this, &BaseInstructions::onCustomInstruction));
+    }
 
 }
 
@@ -109,34 +116,163 @@ void BaseInstructions::makeSymbolic(S2EExecutionState *state, bool makeConcolic)
             << " of size " << hexval(size)
             << " with name '" << nameStr << "'\n";
 
+    if (replayInput(state, address, size, nameStr)) {
+        return;
+    }
+
     std::vector<unsigned char> concreteData;
-    vector<ref<Expr> > symb;
-
-    if (makeConcolic) {
-        for (unsigned i = 0; i< size; ++i) {
-            uint8_t byte = 0;
-            if (!state->readMemoryConcrete8(address + i, &byte)) {
-                s2e()->getWarningsStream(state)
-                    << "Can not concretize/read symbolic value"
-                    << " at " << hexval(address + i) << ". System state not modified.\n";
-                return;
+
+    if (makeConcolic && !seedInput(state, size, nameStr, concreteData)) {
+        concreteData.resize(size);
+        //The bulk read fails on symbolic bytes, which are concretized
+        //one by one
+        if (size && !state->readMemoryConcrete(address, &concreteData[0], size)) {
+            for (unsigned i = 0; i < size; ++i) {
+                if (!state->readMemoryConcrete8(address + i, &concreteData[i])) {
+                    s2e()->getWarningsStream(state)
+                        << "Can not concretize/read symbolic value"
+                        << " at " << hexval(address + i) << ". System state not modified.\n";
+                    return;
+                }
             }
-            concreteData.push_back(byte);
         }
-        symb = state->createConcolicArray(nameStr, size, concreteData);
-    } else {
-        symb = state->createSymbolicArray(nameStr, size);
     }
 
+    if (!state->makeSymbolicBulk(address, size, nameStr, concreteData)) {
+        s2e()->getWarningsStream(state)
+            << "Can not insert symbolic value"
+            << " at " << hexval(address)
+            << ": can not write to memory\n";
+    }
+}
 
-    for(unsigned i = 0; i < size; ++i) {
-        if(!state->writeMemory8(address + i, symb[i])) {
+/**
+ * Reads the inputs of a test case. A file that is not a .ktest, e.g.,
+ * from a fuzzing corpus, is a single input.
+ */
+void BaseInstructions::loadInputs(S2EExecutionState *state, const std::string &file,
+                                  std::vector<std::vector<unsigned char> > &inputs)
+{
+    inputs.clear();
+
+    if (!kTest_isKTestFile(file.c_str())) {
+        std::ifstream ifs(file.c_str(), std::ios::binary);
+        if (!ifs.good()) {
             s2e()->getWarningsStream(state)
-                << "Can not insert symbolic value"
-                << " at " << hexval(address + i)
-                << ": can not write to memory\n";
+                    << "BaseInstructions: could not read " << file << '\n';
+            exit(-1);
         }
+        inputs.push_back(std::vector<unsigned char>(std::istreambuf_iterator<char>(ifs),
+                                                    std::istreambuf_iterator<char>()));
+        return;
+    }
+
+    KTest *ktest = kTest_fromFile(file.c_str());
+    if (!ktest) {
+        s2e()->getWarningsStream(state)
+                << "BaseInstructions: could not read test case " << file << '\n';
+        exit(-1);
+    }
+
+    for (unsigned i = 0; i < ktest->numObjects; ++i) {
+        const KTestObject &obj = ktest->objects[i];
+        inputs.push_back(std::vector<unsigned char>(obj.bytes, obj.bytes + obj.numBytes));
+    }
+    kTest_free(ktest);
+}
+
+/**
+ * When replayKTest names a test case, writes its next input instead of
+ * symbolic data, so that the test runs concretely. The setting is read
+ * at each call, a server job can set it in its Lua file.
+ */
+bool BaseInstructions::replayInput(S2EExecutionState *state, uint64_t address,
+                                   uint64_t size, const std::string &name)
+{
+    ConfigFile *cfg = s2e()->getConfig();
+    std::string key = getConfigKey() + ".replayKTest";
+    if (!cfg->hasKey(key)) {
+        return false;
+    }
+
+    std::string file = cfg->getString(key);
+    if (file.empty()) {
+        return false;
+    }
+
+    if (file != m_replayFile) {
+        loadInputs(state, file, m_replayInputs);
+        m_replayFile = file;
+        m_replayIndex = 0;
+    }
+
+    if (m_replayIndex >= m_replayInputs.size()) {
+        s2e()->getWarningsStream(state)
+                << "BaseInstructions: " << m_replayFile << " has no input for '"
+                << name << "', leaving the memory unchanged\n";
+        return true;
+    }
+
+    std::vector<unsigned char> &input = m_replayInputs[m_replayIndex++];
+    if (input.size() != size) {
+        s2e()->getWarningsStream(state)
+                << "BaseInstructions: input '" << name << "' has " << input.size()
+                << " bytes in " << m_replayFile << ", expected " << size << '\n';
+    }
+
+    uint64_t count = std::min<uint64_t>(size, input.size());
+    if (count && !state->writeMemoryConcrete(address, &input[0], count)) {
+        s2e()->getWarningsStream(state)
+                << "Can not write the replayed input at " << hexval(address) << '\n';
     }
+
+    return true;
+}
+
+/**
+ * When seedKTest names a test case, its next input becomes the initial
+ * value of the concolic data, instead of the content of the buffer.
+ * Concolic execution runs the seed and forks a speculative state at each
+ * branch it did not take, the solver finds the inputs of these paths.
+ */
+bool BaseInstructions::seedInput(S2EExecutionState *state, uint64_t size,
+                                 const std::string &name, std::vector<unsigned char> &data)
+{
+    ConfigFile *cfg = s2e()->getConfig();
+    std::string key = getConfigKey() + ".seedKTest";
+    if (!cfg->hasKey(key)) {
+        return false;
+    }
+
+    std::string file = cfg->getString(key);
+    if (file.empty()) {
+        return false;
+    }
+
+    if (file != m_seedFile) {
+        loadInputs(state, file, m_seedInputs);
+        m_seedFile = file;
+    }
+
+    DECLARE_PLUGINSTATE(BaseInstructionsState, state);
+    if (plgState->m_seedIndex >= m_seedInputs.size()) {
+        s2e()->getWarningsStream(state)
+                << "BaseInstructions: " << m_seedFile << " has no input for '"
+                << name << "', using the content of the buffer\n";
+        return false;
+    }
+
+    // Inputs that are too short are padded with zeros, the other
+    // ones are truncated
+    data = m_seedInputs[plgState->m_seedIndex++];
+    if (data.size() != size) {
+        s2e()->getWarningsStream(state)
+                << "BaseInstructions: seed input '" << name << "' has " << data.size()
+                << " bytes in " << m_seedFile << ", expected " << size << '\n';
+        data.resize(size, 0);
+    }
+
+    return true;
 }
 
 void BaseInstructions::isSymbolic(S2EExecutionState *state)
@@ -644,5 +780,15 @@ void BaseInstructions::onCustomInstruction(S2EExecutionState* state,
     }
 }
 
+PluginState *BaseInstructionsState::clone() const
+{
+    return new BaseInstructionsState(*this);
+}
+
+PluginState *BaseInstructionsState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new BaseInstructionsState();
+}
+
 }
 }
@@ -41,6 +41,9 @@
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/S2EExecutionState.h>
 
+#include <string>
+#include <vector>
+
 namespace s2e {
 namespace plugins {
 
@@ -48,7 +51,7 @@ class BaseInstructions : public Plugin
 {
     S2E_PLUGIN
 public:
-    BaseInstructions(S2E* s2e): Plugin(s2e) {}
+    BaseInstructions(S2E* s2e): Plugin(s2e), m_replayIndex(0) {}
 
     void initialize();
    
@@ -56,6 +59,24 @@ public:
         uint64_t opcode);
 
 private:
+    /* Concrete inputs of the test case being replayed, in the order
+       of the make_symbolic calls (see replayKTest) */
+    std::string m_replayFile;
+    std::vector<std::vector<unsigned char> > m_replayInputs;
+    unsigned m_replayIndex;
+
+    /* Inputs of the seed whose values are the initial assignment
+       of the concolic values (see seedKTest) */
+    std::string m_seedFile;
+    std::vector<std::vector<unsigned char> > m_seedInputs;
+
+    void loadInputs(S2EExecutionState *state, const std::string &file,
+                    std::vector<std::vector<unsigned char> > &inputs);
+    bool replayInput(S2EExecutionState *state, uint64_t address,
+                     uint64_t size, const std::string &name);
+    bool seedInput(S2EExecutionState *state, uint64_t size,
+                   const std::string &name, std::vector<unsigned char> &data);
+
     void onCustomInstruction(S2EExecutionState* state, 
         uint64_t opcode);
     void invokePlugin(S2EExecutionState *state);
@@ -89,6 +110,22 @@ private:
 
 };
 
+class BaseInstructionsState: public PluginState
+{
+private:
+    /* Index of the next seed input, each path consumes them in the
+       order of its own make_concolic calls */
+    unsigned m_seedIndex;
+
+public:
+    BaseInstructionsState() : m_seedIndex(0) {}
+    virtual ~BaseInstructionsState() {}
+    virtual PluginState *clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class BaseInstructions;
+};
+
 class BaseInstructionsPluginInvokerInterface {
 public:
     virtual void handleOpcodeInvocation(S2EExecutionState *state,
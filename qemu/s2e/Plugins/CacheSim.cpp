@@ -52,6 +52,7 @@ extern "C" {
 #include <stdio.h>
 
 #define CACHESIM_LOG_SIZE 4096
+#define CACHESIM_RECORD_SIZE 1024
 
 namespace s2e {
 namespace plugins {
@@ -361,7 +362,7 @@ S2E_DEFINE_PLUGIN(CacheSim, "Cache simulator", "", "ExecutionTracer");
 
 CacheSim::~CacheSim()
 {
-
+    delete [] (uint8_t*) m_recordedAccesses;
 }
 
 
@@ -391,8 +392,34 @@ void CacheSim::initialize()
     //Determines whether to address the cache physically of virtually
     m_physAddress = conf->getBool(getConfigKey() + ".physicalAddressing");
 
+    //Only record the accesses in the trace, the caches are simulated
+    //offline by cacheprof, which can replay several configurations.
+    m_recordAccesses = conf->getBool(getConfigKey() + ".recordAccesses");
+
     m_cacheStructureWrittenToLog = false;
 
+    if (m_recordAccesses) {
+        m_recordedAccesses = (ExecutionTraceCacheSimAccesses*)
+                new uint8_t[ExecutionTraceCacheSimAccesses::getSize(CACHESIM_RECORD_SIZE)];
+        m_recordedAccesses->type = CACHE_ACCESSES;
+        m_recordedAccesses->count = 0;
+
+        s2e()->getCorePlugin()->onStateFork.connect(
+                sigc::mem_fun(*this, &CacheSim::onStateFork));
+        s2e()->getCorePlugin()->onStateSwitch.connect(
+                sigc::mem_fun(*this, &CacheSim::onStateSwitch));
+        s2e()->getCorePlugin()->onStateKill.connect(
+                sigc::mem_fun(*this, &CacheSim::flushRecordedAccesses));
+
+        if (m_execDetector && m_startOnModuleLoad) {
+            m_ModuleConnection = m_execDetector->onModuleTranslateBlockStart.connect(
+                    sigc::mem_fun(*this, &CacheSim::onModuleTranslateBlockStart));
+        } else {
+            connectRecording();
+        }
+        return;
+    }
+
     ////////////////////
     //XXX: trick to force the initialization of the cache upon first memory access.
     m_d1_connection = s2e()->getCorePlugin()->onDataMemoryAccess.connect(
@@ -458,12 +485,17 @@ void CacheSim::onModuleTranslateBlockStart(
     const ModuleDescriptor &desc,
     TranslationBlock *tb, uint64_t pc)
 {
-
-    DECLARE_PLUGINSTATE(CacheSimState, state);
-
     s2e()->getDebugStream() << "Module translation CacheSim " << desc.Name << "  " <<
         pc <<'\n';
 
+    if (m_recordAccesses) {
+        connectRecording();
+        m_ModuleConnection.disconnect();
+        return;
+    }
+
+    DECLARE_PLUGINSTATE(CacheSimState, state);
+
     if(plgState->m_d1)
         s2e()->getCorePlugin()->onDataMemoryAccess.connect(
             sigc::mem_fun(*this, &CacheSim::onDataMemoryAccess));
@@ -514,6 +546,15 @@ void CacheSim::onMemoryAccess(S2EExecutionState *state,
     if(isIO) /* this is only an estimation - should look at registers! */
         return;
 
+    if (m_recordAccesses) {
+        if (profileAccess(state)) {
+            recordAccess(state, state->getPc(), address, size,
+                         (isWrite ? CACHESIM_ACCESS_WRITE : 0) |
+                         (isCode ? CACHESIM_ACCESS_CODE : 0));
+        }
+        return;
+    }
+
     DECLARE_PLUGINSTATE(CacheSimState, state);
 
     if (!profileAccess(state)) {
@@ -609,6 +650,83 @@ void CacheSim::onTranslateBlockStart(ExecutionSignal *signal,
             sigc::mem_fun(*this, &CacheSim::onExecuteBlockStart), tb, newPc));
 }
 
+void CacheSim::connectRecording()
+{
+    s2e()->getDebugStream() << "CacheSim: recording accesses for offline replay" << '\n';
+
+    s2e()->getCorePlugin()->onDataMemoryAccessBatch.connect(
+        sigc::mem_fun(*this, &CacheSim::onDataMemoryAccessBatch));
+
+    s2e()->getCorePlugin()->onTranslateBlockStart.connect(
+        sigc::mem_fun(*this, &CacheSim::onTranslateBlockStart));
+}
+
+void CacheSim::recordAccess(S2EExecutionState *state, uint64_t pc,
+                            uint64_t address, unsigned size, uint8_t flags)
+{
+    ExecutionTraceCacheSimAccess &a =
+            m_recordedAccesses->accesses[m_recordedAccesses->count++];
+    a.pc = pc;
+    a.address = address;
+    a.size = size;
+    a.flags = flags;
+
+    if (m_recordedAccesses->count == CACHESIM_RECORD_SIZE) {
+        flushRecordedAccesses(state);
+    }
+}
+
+void CacheSim::flushRecordedAccesses(S2EExecutionState *state)
+{
+    if (!m_recordedAccesses->count) {
+        return;
+    }
+
+    m_Tracer->writeData(state, m_recordedAccesses,
+                        ExecutionTraceCacheSimAccesses::getSize(m_recordedAccesses->count),
+                        TRACE_CACHESIM);
+    m_recordedAccesses->count = 0;
+}
+
+void CacheSim::onDataMemoryAccessBatch(S2EExecutionState *state,
+                                       const DataMemoryAccess *accesses,
+                                       unsigned count)
+{
+    if (profileAccess(state)) {
+        unsigned symbolicMask = m_physAddress ? DataMemoryAccess::SYMBOLIC_HOST_ADDRESS :
+                                                DataMemoryAccess::SYMBOLIC_ADDRESS;
+
+        for (unsigned i = 0; i < count; ++i) {
+            const DataMemoryAccess &a = accesses[i];
+            if (a.flags & (DataMemoryAccess::IO | symbolicMask)) {
+                continue;
+            }
+
+            recordAccess(state, a.pc, m_physAddress ? a.hostAddress : a.address, a.size,
+                         a.flags & DataMemoryAccess::WRITE ? CACHESIM_ACCESS_WRITE : 0);
+        }
+    }
+
+    //Instruction fetches of the block were recorded when it started,
+    //write them along with its data accesses.
+    flushRecordedAccesses(state);
+}
+
+//The fork item is already in the trace at this point. Accesses of the
+//forking block that were not followed by data accesses end up in the
+//path of the state that continues.
+void CacheSim::onStateFork(S2EExecutionState *state,
+                           const std::vector<S2EExecutionState*> &newStates,
+                           const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    flushRecordedAccesses(state);
+}
+
+void CacheSim::onStateSwitch(S2EExecutionState *currentState,
+                             S2EExecutionState *nextState)
+{
+    flushRecordedAccesses(currentState);
+}
 
 } // namespace plugins
 } // namespace s2e
@@ -88,8 +88,12 @@ protected:
     bool m_cacheStructureWrittenToLog;
     bool m_startOnModuleLoad;
     bool m_physAddress;
+    bool m_recordAccesses;
     sigc::connection m_ModuleConnection;
 
+    //Accesses of the current state waiting to be written to the trace
+    ExecutionTraceCacheSimAccesses *m_recordedAccesses;
+
     sigc::connection m_d1_connection;
     sigc::connection m_i1_connection;
 
@@ -118,13 +122,31 @@ protected:
     void onExecuteBlockStart(S2EExecutionState* state, uint64_t pc,
                              TranslationBlock* tb, uint64_t hostAddress);
 
+    void connectRecording();
+
+    void recordAccess(S2EExecutionState *state, uint64_t pc,
+                      uint64_t address, unsigned size, uint8_t flags);
+
+    void flushRecordedAccesses(S2EExecutionState *state);
+
+    void onDataMemoryAccessBatch(S2EExecutionState *state,
+                                 const DataMemoryAccess *accesses,
+                                 unsigned count);
+
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+
+    void onStateSwitch(S2EExecutionState *currentState,
+                       S2EExecutionState *nextState);
+
 
     void writeCacheDescriptionToLog(S2EExecutionState *state);
 
     bool profileAccess(S2EExecutionState *state) const;
     bool reportAccess(S2EExecutionState *state) const;
 public:
-    CacheSim(S2E* s2e): Plugin(s2e) {}
+    CacheSim(S2E* s2e): Plugin(s2e), m_recordedAccesses(NULL) {}
     ~CacheSim();
 
     void initialize();
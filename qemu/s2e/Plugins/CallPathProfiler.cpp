@@ -0,0 +1,206 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "CallPathProfiler.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(CallPathProfiler, "Counts calls, instructions and forks per guest call path",
+                  "CallPathProfiler", "FunctionMonitor");
+
+CallPathProfiler::~CallPathProfiler()
+{
+    dump();
+}
+
+void CallPathProfiler::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    m_functionMonitor = static_cast<FunctionMonitor*>(s2e()->getPlugin("FunctionMonitor"));
+    m_pid = cfg->getInt(getConfigKey() + ".pid", 0);
+    m_maxDepth = cfg->getInt(getConfigKey() + ".maxDepth", 32);
+    m_dumpInterval = cfg->getInt(getConfigKey() + ".dumpInterval", 60);
+    m_timerTicks = 0;
+
+    CallPath root = {0, 0, 0};
+    m_paths.push_back(root);
+    m_calls.push_back(0);
+    m_instructions.push_back(0);
+    m_forks.push_back(0);
+
+    //Call signals are per-state, they can only be registered once there is a state
+    m_tbConnection = s2e()->getCorePlugin()->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &CallPathProfiler::onTranslateBlockStart));
+
+    s2e()->getCorePlugin()->onStateFork.connect(
+            sigc::mem_fun(*this, &CallPathProfiler::onStateFork));
+
+    if (m_dumpInterval) {
+        s2e()->getCorePlugin()->onTimer.connect(
+                sigc::mem_fun(*this, &CallPathProfiler::onTimer));
+    }
+}
+
+unsigned CallPathProfiler::internPath(unsigned parent, uint64_t function)
+{
+    std::pair<unsigned, uint64_t> key(parent, function);
+    std::map<std::pair<unsigned, uint64_t>, unsigned>::iterator it = m_pathIds.find(key);
+    if (it != m_pathIds.end()) {
+        return (*it).second;
+    }
+
+    unsigned id = m_paths.size();
+    CallPath path = {parent, m_paths[parent].depth + 1, function};
+    m_paths.push_back(path);
+    m_calls.push_back(0);
+    m_instructions.push_back(0);
+    m_forks.push_back(0);
+
+    m_pathIds[key] = id;
+    return id;
+}
+
+void CallPathProfiler::onTranslateBlockStart(ExecutionSignal *signal,
+                                             S2EExecutionState *state,
+                                             TranslationBlock *tb,
+                                             uint64_t pc)
+{
+    m_functionMonitor->getCallSignal(state, 0, m_pid)->connect(
+            sigc::mem_fun(*this, &CallPathProfiler::onFunctionCall));
+
+    m_tbConnection.disconnect();
+}
+
+void CallPathProfiler::onFunctionCall(S2EExecutionState *state, FunctionMonitorState *fns)
+{
+    DECLARE_PLUGINSTATE(CallPathProfilerState, state);
+
+    unsigned parent = plgState->m_path;
+    if (m_paths[parent].depth >= m_maxDepth) {
+        return;
+    }
+
+    unsigned path = internPath(parent, state->getPc());
+    ++m_calls[path];
+    plgState->m_path = path;
+
+    FUNCMON_REGISTER_RETURN_A(state, fns, CallPathProfiler::onFunctionReturn,
+                              parent, state->getTotalInstructionCount());
+}
+
+void CallPathProfiler::onFunctionReturn(S2EExecutionState *state, unsigned parent,
+                                        uint64_t instructionCount)
+{
+    DECLARE_PLUGINSTATE(CallPathProfilerState, state);
+
+    //Forked states share the count of their parent up to the fork,
+    //so each of them adds its own inclusive count to the path.
+    m_instructions[plgState->m_path] += state->getTotalInstructionCount() - instructionCount;
+    plgState->m_path = parent;
+}
+
+void CallPathProfiler::onStateFork(S2EExecutionState *state,
+                                   const std::vector<S2EExecutionState*> &newStates,
+                                   const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    DECLARE_PLUGINSTATE(CallPathProfilerState, state);
+    m_forks[plgState->m_path] += newStates.size() - 1;
+}
+
+void CallPathProfiler::onTimer()
+{
+    if (++m_timerTicks < m_dumpInterval) {
+        return;
+    }
+    m_timerTicks = 0;
+    dump();
+}
+
+/**
+ *  Writes one line per path, the path itself is the list of function
+ *  entry points from the outermost call.
+ */
+void CallPathProfiler::dump()
+{
+    llvm::raw_ostream *os = s2e()->openOutputFile("callpaths.csv");
+
+    *os << "Id,Parent,Depth,Calls,Instructions,Forks,Path\n";
+
+    std::vector<uint64_t> functions;
+    for (unsigned id = 1; id < m_paths.size(); ++id) {
+        const CallPath &path = m_paths[id];
+
+        functions.clear();
+        for (unsigned p = id; p != 0; p = m_paths[p].parent) {
+            functions.push_back(m_paths[p].function);
+        }
+
+        *os << id << ',' << path.parent << ',' << path.depth << ','
+            << m_calls[id] << ',' << m_instructions[id] << ',' << m_forks[id] << ',';
+
+        for (unsigned i = functions.size(); i > 0; --i) {
+            *os << hexval(functions[i - 1]) << (i > 1 ? " " : "");
+        }
+        *os << '\n';
+    }
+
+    delete os;
+}
+
+PluginState *CallPathProfilerState::clone() const
+{
+    return new CallPathProfilerState(*this);
+}
+
+PluginState *CallPathProfilerState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new CallPathProfilerState();
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,133 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_PLUGINS_CALLPATHPROFILER_H
+#define S2E_PLUGINS_CALLPATHPROFILER_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/Plugins/FunctionMonitor.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <map>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Profiles the guest call paths.
+ *  Each sequence of guest function entry points is interned once into
+ *  a small integer id, shared by all the states that go through it.
+ *  The statistics of a path are kept in flat arrays indexed by this id,
+ *  so a call costs a map lookup and a few increments, and a state only
+ *  stores the id of its current path.
+ *
+ *  Calls deeper than maxDepth are not tracked, they are accounted to
+ *  the enclosing path.
+ */
+class CallPathProfiler : public Plugin
+{
+    S2E_PLUGIN
+public:
+    CallPathProfiler(S2E* s2e): Plugin(s2e) {}
+    ~CallPathProfiler();
+
+    void initialize();
+
+private:
+    struct CallPath {
+        unsigned parent;
+        unsigned depth;
+        uint64_t function;
+    };
+
+    FunctionMonitor *m_functionMonitor;
+    sigc::connection m_tbConnection;
+
+    uint64_t m_pid;
+    unsigned m_maxDepth;
+    unsigned m_dumpInterval;
+    unsigned m_timerTicks;
+
+    //Path 0 is the root, i.e., outside of any tracked call
+    std::vector<CallPath> m_paths;
+    std::map<std::pair<unsigned, uint64_t>, unsigned> m_pathIds;
+
+    //Statistics, indexed by path id
+    std::vector<uint64_t> m_calls;
+    std::vector<uint64_t> m_instructions;
+    std::vector<uint64_t> m_forks;
+
+    unsigned internPath(unsigned parent, uint64_t function);
+    void dump();
+
+    void onTranslateBlockStart(ExecutionSignal *signal,
+                               S2EExecutionState *state,
+                               TranslationBlock *tb,
+                               uint64_t pc);
+
+    void onFunctionCall(S2EExecutionState *state, FunctionMonitorState *fns);
+    void onFunctionReturn(S2EExecutionState *state, unsigned parent,
+                          uint64_t instructionCount);
+
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+
+    void onTimer();
+
+    friend class CallPathProfilerState;
+};
+
+class CallPathProfilerState: public PluginState
+{
+private:
+    unsigned m_path;
+
+public:
+    CallPathProfilerState() : m_path(0) {}
+    virtual ~CallPathProfilerState() {}
+    virtual PluginState *clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class CallPathProfiler;
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
@@ -93,7 +93,7 @@ void CodeSelector::initialize()
 
     foreach2(it, moduleList.begin(), moduleList.end()) {
         if (m_executionDetector->isModuleConfigured(*it)) {
-            m_interceptedModules.insert(*it);
+            addInterceptedModule(*it);
         }else {
             s2e()->getWarningsStream() << "CodeSelector: " <<
                     "Module " << *it << " is not configured\n";
@@ -105,7 +105,7 @@ void CodeSelector::initialize()
     m_executionDetector->onModuleTransition.connect(
         sigc::mem_fun(*this, &CodeSelector::onModuleTransition));
 
-    s2e()->getCorePlugin()->onCustomInstruction.connect(
+    s2e()->getCorePlugin()->getCustomInstructionSignal(CODE_SELECTOR_OPCODE).connect(
         sigc::mem_fun(*this, &CodeSelector::onCustomInstruction));
 }
 
@@ -120,8 +120,8 @@ void CodeSelector::onModuleTransition(
         return;
     }
 
-    const std::string *id = m_executionDetector->getModuleId(*currentModule);
-    if (m_interceptedModules.find(*id) == m_interceptedModules.end()) {
+    if (m_interceptedModuleNames.find(currentModule->Name) ==
+            m_interceptedModuleNames.end()) {
         state->disableForking();
         return;
     }
@@ -129,6 +129,20 @@ void CodeSelector::onModuleTransition(
     state->enableForking();
 }
 
+void CodeSelector::addInterceptedModule(const std::string &moduleId)
+{
+    m_interceptedModules.insert(moduleId);
+
+    ModuleExecutionCfg cfg;
+    cfg.id = moduleId;
+
+    const ConfiguredModulesById &modules = m_executionDetector->getConfiguredModulesById();
+    ConfiguredModulesById::const_iterator it = modules.find(cfg);
+    assert(it != modules.end());
+
+    m_interceptedModuleNames.insert((*it).moduleName);
+}
+
 void CodeSelector::onPageDirectoryChange(
         S2EExecutionState *state,
         uint64_t previous, uint64_t current
@@ -256,7 +270,7 @@ bool CodeSelector::opSelectModule(S2EExecutionState *state)
     }
 
     if (m_executionDetector->isModuleConfigured(strModuleId)) {
-        m_interceptedModules.insert(strModuleId);
+        addInterceptedModule(strModuleId);
     }else {
         s2e()->getWarningsStream() << "CodeSelector: " <<
                 "Module " << strModuleId << " is not configured\n";
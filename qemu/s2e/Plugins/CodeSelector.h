@@ -77,6 +77,10 @@ private:
     Modules m_interceptedModules;
     Pids m_pidsToTrack;
 
+    //Names of the intercepted modules, precomputed from their ids
+    //so that module transitions need a single lookup
+    Modules m_interceptedModuleNames;
+
     sigc::connection m_addressSpaceTracking;
     sigc::connection m_privilegeTracking;
 
@@ -106,6 +110,8 @@ private:
 
     bool opSelectModule(S2EExecutionState *state);
 
+    void addInterceptedModule(const std::string &moduleId);
+
 public:
     CodeSelector(S2E* s2e);
 
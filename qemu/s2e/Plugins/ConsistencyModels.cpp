@@ -57,6 +57,18 @@ void ConsistencyModels::initialize()
         s2e()->getWarningsStream() << "ConsistencyModels: invalid consistency " << consistency << "\n";
         exit(-1);
     }
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &ConsistencyModels::onStateKill));
+}
+
+void ConsistencyModels::onStateKill(S2EExecutionState *state)
+{
+    //The state is about to be deleted
+    if (state == m_cachedState) {
+        m_cachedState = NULL;
+        m_cachedPlgState = NULL;
+    }
 }
 
 ExecutionConsistencyModel ConsistencyModels::fromString(const std::string &model)
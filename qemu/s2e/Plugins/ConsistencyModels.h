@@ -40,7 +40,7 @@
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/S2EExecutionState.h>
 
-#include <stack>
+#include <tr1/memory>
 
 namespace s2e {
 namespace plugins {
@@ -53,12 +53,31 @@ enum ExecutionConsistencyModel {
 class ConsistencyModelsState:public PluginState
 {
 private:
+    /**
+     * The stack of models is a persistent list (top first) that is
+     * shared by all the states forked from the same parent.
+     */
+    struct ModelNode;
+    typedef std::tr1::shared_ptr<const ModelNode> ModelList;
+
+    struct ModelNode {
+        ExecutionConsistencyModel model;
+        ModelList next;
+
+        ModelNode(ExecutionConsistencyModel m, const ModelList &n): model(m), next(n) {}
+    };
+
     ExecutionConsistencyModel m_defaultModel;
-    std::stack<ExecutionConsistencyModel> m_models;
+    ModelList m_models;
+
+    //Top of the stack, or the default model when the stack is empty
+    ExecutionConsistencyModel m_current;
+
 public:
 
     ConsistencyModelsState(ExecutionConsistencyModel model) {
         m_defaultModel = model;
+        m_current = model;
     }
 
     virtual ~ConsistencyModelsState() {}
@@ -70,22 +89,21 @@ public:
     static PluginState *factory(Plugin *p, S2EExecutionState *s);
 
     ExecutionConsistencyModel get() const {
-        if (m_models.size() == 0) {
-            return m_defaultModel;
-        }
-        return m_models.top();
+        return m_current;
     }
 
     void push(ExecutionConsistencyModel model) {
-        m_models.push(model);
+        m_models = ModelList(new ModelNode(model, m_models));
+        m_current = model;
     }
 
     ExecutionConsistencyModel pop() {
-        if (m_models.size() == 0) {
+        if (!m_models) {
             return m_defaultModel;
         }
-        ExecutionConsistencyModel model = m_models.top();
-        m_models.pop();
+        ExecutionConsistencyModel model = m_models->model;
+        m_models = m_models->next;
+        m_current = m_models ? m_models->model : m_defaultModel;
         return model;
     }
 
@@ -96,7 +114,7 @@ class ConsistencyModels : public Plugin
 {
     S2E_PLUGIN
 public:
-    ConsistencyModels(S2E* s2e): Plugin(s2e) {}
+    ConsistencyModels(S2E* s2e): Plugin(s2e), m_cachedState(NULL), m_cachedPlgState(NULL) {}
 
     void initialize();
 
@@ -106,22 +124,35 @@ public:
     }
 
     void push(S2EExecutionState *state, ExecutionConsistencyModel model) {
-        DECLARE_PLUGINSTATE(ConsistencyModelsState, state);
-        plgState->push(model);
+        getState(state)->push(model);
     }
 
     ExecutionConsistencyModel pop(S2EExecutionState *state) {
-        DECLARE_PLUGINSTATE(ConsistencyModelsState, state);
-        return plgState->pop();
+        return getState(state)->pop();
     }
 
     ExecutionConsistencyModel get(S2EExecutionState *state) {
-        DECLARE_PLUGINSTATE(ConsistencyModelsState, state);
-        return plgState->get();
+        return getState(state)->get();
     }
 
 private:
     ExecutionConsistencyModel m_defaultModel;
+
+    //Plugin state of the last queried state, which is almost
+    //always the current one. Saves the plugin state map lookup.
+    S2EExecutionState *m_cachedState;
+    ConsistencyModelsState *m_cachedPlgState;
+
+    ConsistencyModelsState *getState(S2EExecutionState *state) {
+        if (state != m_cachedState) {
+            DECLARE_PLUGINSTATE(ConsistencyModelsState, state);
+            m_cachedState = state;
+            m_cachedPlgState = plgState;
+        }
+        return m_cachedPlgState;
+    }
+
+    void onStateKill(S2EExecutionState *state);
 };
 
 } // namespace plugins
@@ -36,6 +36,7 @@
 // XXX: qemu stuff should be included before anything from KLEE or LLVM !
 extern "C" {
 #include "tcg-op.h"
+#include "tcg-llvm.h"
 #include <qemu-timer.h>
 #include "qmp-commands.h"
 #include "monitor.h"
@@ -53,10 +54,26 @@ extern CPUArchState *env;
 #include <s2e/s2e_qemu.h>
 #include <s2e/s2e_config.h>
 #include <s2e/S2ESJLJ.h>
+#include <s2e/Plugins/Opcodes.h>
+
+#include <llvm/Support/CommandLine.h>
 
 
 using namespace std;
 
+namespace {
+    //Translated code calls each slot of an execution signal directly
+    //instead of emitting the signal through s2e_tcg_execution_handler.
+    //Slots must stay connected as long as the translation block exists.
+    llvm::cl::opt<bool>
+    CompiledSignalDispatch("s2e-compiled-signal-dispatch",
+                     llvm::cl::desc("Call execution signal slots directly from translated code"),
+                     llvm::cl::init(false));
+
+    //Signals with more slots are emitted as usual
+    const unsigned MaxCompiledSlots = 4;
+}
+
 namespace s2e {
     S2E_DEFINE_PLUGIN(CorePlugin, "S2E core functionality", "Core",);
 } // namespace s2e
@@ -65,6 +82,9 @@ using namespace s2e;
 
 extern "C" {
     unsigned g_s2e_enable_mmio_checks = 0;
+    unsigned g_s2e_fast_memory_access = 0;
+    uint32_t g_s2e_symbolic_ports[65536 / 32];
+    uint32_t *g_s2e_symbolic_pages[S2E_SYMBHW_L1_SIZE];
 }
 
 static void s2e_timer_cb(void *opaque)
@@ -90,6 +110,30 @@ void CorePlugin::initialize()
 
 }
 
+void CorePlugin::flushDataMemoryAccessesSlow(S2EExecutionState *state)
+{
+    //Reset first, subscribers may throw or access memory
+    unsigned count = m_dataMemoryAccessCount;
+    m_dataMemoryAccessCount = 0;
+    onDataMemoryAccessBatch.emit(state, m_dataMemoryAccesses, count);
+}
+
+void CorePlugin::dispatchCustomInstruction(S2EExecutionState *state, uint64_t arg)
+{
+    assert((m_customInstructionHandlers || !onCustomInstruction.empty()) &&
+           "You must activate a plugin that uses custom instructions.");
+
+    sigc::signal<void, S2EExecutionState*, uint64_t> &signal =
+            m_customInstructionSignals[(arg >> OPSHIFT) & 0xFF];
+    if (!signal.empty()) {
+        signal.emit(state, arg);
+    }
+
+    if (!onCustomInstruction.empty()) {
+        onCustomInstruction.emit(state, arg);
+    }
+}
+
 /******************************/
 /* Functions called from QEMU */
 
@@ -101,19 +145,36 @@ void s2e_tcg_execution_handler(void* signal, uint64_t pc)
         ExecutionSignal *s = (ExecutionSignal*)signal;
         if (g_s2e_enable_signals) {
             s->emit(g_s2e_state, pc);
+            g_s2e->getCorePlugin()->updateFastMemoryAccess();
         }
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
     }
 }
 
-void s2e_tcg_custom_instruction_handler(uint64_t arg)
+#ifdef S2E_USE_FAST_SIGNALS
+typedef void (*ExecutionSlotInvoker)(ExecutionSignal::func_t slot,
+                                     S2EExecutionState *state, uint64_t pc);
+
+void s2e_tcg_execution_slot_handler(void* slot, void* invoker, uint64_t pc)
 {
-    assert(!g_s2e->getCorePlugin()->onCustomInstruction.empty() &&
-           "You must activate a plugin that uses custom instructions.");
+    try {
+        if (g_s2e_enable_signals) {
+            ExecutionSlotInvoker f = reinterpret_cast<ExecutionSlotInvoker>(invoker);
+            f(static_cast<ExecutionSignal::func_t>(slot), g_s2e_state, pc);
+            g_s2e->getCorePlugin()->updateFastMemoryAccess();
+        }
+    } catch(s2e::CpuExitException&) {
+        s2e_longjmp(env->jmp_env, 1);
+    }
+}
+#endif
 
+void s2e_tcg_custom_instruction_handler(uint64_t arg)
+{
     try {
-        g_s2e->getCorePlugin()->onCustomInstruction.emit(g_s2e_state, arg);
+        g_s2e->getCorePlugin()->dispatchCustomInstruction(g_s2e_state, arg);
+        g_s2e->getCorePlugin()->updateFastMemoryAccess();
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
     }
@@ -132,6 +193,64 @@ void s2e_tcg_emit_custom_instruction(S2E*, uint64_t arg)
     tcg_temp_free_i64(t0);
 }
 
+#ifdef S2E_USE_FAST_SIGNALS
+/* Emit one direct helper call per connected slot of the signal.
+   Returns false without generating anything when a slot has no invoker. */
+static bool s2e_tcg_instrument_slots(ExecutionSignal* signal, uint64_t pc)
+{
+    unsigned count = 0;
+    for (unsigned i = 0; i < signal->getSlotCount(); ++i) {
+        ExecutionSignal::func_t slot = signal->getSlot(i);
+        if (!slot) {
+            continue;
+        }
+        if (!slot->getInvoker() || ++count > MaxCompiledSlots) {
+            return false;
+        }
+    }
+
+    for (unsigned i = 0; i < signal->getSlotCount(); ++i) {
+        ExecutionSignal::func_t slot = signal->getSlot(i);
+        if (!slot) {
+            continue;
+        }
+
+        TCGv_ptr t0 = tcg_temp_new_ptr();
+        TCGv_ptr t1 = tcg_temp_new_ptr();
+        TCGv_i64 t2 = tcg_temp_new_i64();
+
+        tcg_llvm_note_host_pointer((uintptr_t) slot);
+        tcg_llvm_note_host_pointer((uintptr_t) slot->getInvoker());
+
+        TCGArg args[3];
+        args[0] = GET_TCGV_PTR(t0);
+        args[1] = GET_TCGV_PTR(t1);
+        args[2] = GET_TCGV_I64(t2);
+
+#if TCG_TARGET_REG_BITS == 64
+        const int sizemask = (1 << 2) | (1 << 4) | (1 << 6);
+        tcg_gen_movi_i64(TCGV_PTR_TO_NAT(t0), (tcg_target_ulong) slot);
+        tcg_gen_movi_i64(TCGV_PTR_TO_NAT(t1), (tcg_target_ulong) slot->getInvoker());
+#else
+        const int sizemask = 1 << 6;
+        tcg_gen_movi_i32(TCGV_PTR_TO_NAT(t0), (tcg_target_ulong) slot);
+        tcg_gen_movi_i32(TCGV_PTR_TO_NAT(t1), (tcg_target_ulong) slot->getInvoker());
+#endif
+
+        tcg_gen_movi_i64(t2, pc);
+
+        tcg_gen_helperN((void*) s2e_tcg_execution_slot_handler,
+                    0, sizemask, TCG_CALL_DUMMY_ARG, 3, args);
+
+        tcg_temp_free_i64(t2);
+        tcg_temp_free_ptr(t1);
+        tcg_temp_free_ptr(t0);
+    }
+
+    return true;
+}
+#endif
+
 /* Instrument generated code to emit signal on execution */
 /* Next pc, when != -1, indicates with which value to update the program counter
    before calling the annotation. This is useful when instrumenting instructions
@@ -158,6 +277,16 @@ static void s2e_tcg_instrument_code(S2E*, ExecutionSignal* signal, uint64_t pc,
 #endif
     }
 
+#ifdef S2E_USE_FAST_SIGNALS
+    if (CompiledSignalDispatch && s2e_tcg_instrument_slots(signal, pc)) {
+        tcg_temp_free_i64(t1);
+        tcg_temp_free_ptr(t0);
+        return;
+    }
+#endif
+
+    tcg_llvm_note_host_pointer((uintptr_t) signal);
+
     // XXX: here we rely on CPUState being the first tcg global temp
     TCGArg args[2];
     args[0] = GET_TCGV_PTR(t0);
@@ -185,6 +314,9 @@ void s2e_on_translate_block_start(
         TranslationBlock *tb, uint64_t pc)
 {
     assert(state->isActive());
+    if (!s2e->getCorePlugin()->isInstrumentationEnabled()) {
+        return;
+    }
 
     ExecutionSignal *signal = static_cast<ExecutionSignal*>(
                                     tb->s2e_tb->executionSignals.back());
@@ -207,6 +339,9 @@ void s2e_on_translate_block_end(
         uint64_t insPc, int staticTarget, uint64_t targetPc)
 {
     assert(state->isActive());
+    if (!s2e->getCorePlugin()->isInstrumentationEnabled()) {
+        return;
+    }
 
     ExecutionSignal *signal = static_cast<ExecutionSignal*>(
                                     tb->s2e_tb->executionSignals.back());
@@ -231,6 +366,9 @@ void s2e_on_translate_instruction_start(
         TranslationBlock *tb, uint64_t pc)
 {
     assert(state->isActive());
+    if (!s2e->getCorePlugin()->isInstrumentationEnabled()) {
+        return;
+    }
 
     ExecutionSignal *signal = static_cast<ExecutionSignal*>(
                                     tb->s2e_tb->executionSignals.back());
@@ -252,6 +390,9 @@ void s2e_on_translate_jump_start(
         TranslationBlock *tb, uint64_t pc, int jump_type)
 {
     assert(state->isActive());
+    if (!s2e->getCorePlugin()->isInstrumentationEnabled()) {
+        return;
+    }
 
     ExecutionSignal *signal = static_cast<ExecutionSignal*>(
                                     tb->s2e_tb->executionSignals.back());
@@ -276,6 +417,9 @@ void s2e_on_translate_instruction_end(
         TranslationBlock *tb, uint64_t pc, uint64_t nextpc)
 {
     assert(state->isActive());
+    if (!s2e->getCorePlugin()->isInstrumentationEnabled()) {
+        return;
+    }
 
     ExecutionSignal *signal = static_cast<ExecutionSignal*>(
                                     tb->s2e_tb->executionSignals.back());
@@ -297,6 +441,9 @@ void s2e_on_translate_register_access(
         uint64_t readMask, uint64_t writeMask, int isMemoryAccess)
 {
     assert(g_s2e_state->isActive());
+    if (!g_s2e->getCorePlugin()->isInstrumentationEnabled()) {
+        return;
+    }
 
     ExecutionSignal *signal = static_cast<ExecutionSignal*>(
                                     tb->s2e_tb->executionSignals.back());
@@ -357,6 +504,27 @@ static void s2e_trace_memory_access_slow(
     }
 }
 
+static void s2e_record_memory_access(
+        uint64_t vaddr, uint64_t haddr, uint8_t* buf, unsigned size,
+        int isWrite, int isIO)
+{
+    DataMemoryAccess access;
+    access.pc = g_s2e_state->getPc();
+    access.address = vaddr;
+    access.hostAddress = haddr;
+    access.value = 0;
+    access.size = (size > sizeof access.value) ? sizeof (access.value) : size;
+    memcpy(&access.value, buf, access.size);
+    access.flags = (isWrite ? DataMemoryAccess::WRITE : 0) |
+                   (isIO ? DataMemoryAccess::IO : 0);
+
+    try {
+        g_s2e->getCorePlugin()->recordDataMemoryAccess(g_s2e_state, access);
+    } catch(s2e::CpuExitException&) {
+        s2e_longjmp(env->jmp_env, 1);
+    }
+}
+
 /**
  * We split the function in two parts so that the common case when
  * there is no instrumentation is as fast as possible.
@@ -365,7 +533,11 @@ void s2e_trace_memory_access(
         uint64_t vaddr, uint64_t haddr, uint8_t* buf, unsigned size,
         int isWrite, int isIO)
 {
-    if(unlikely(!g_s2e->getCorePlugin()->onDataMemoryAccess.empty())) {
+    CorePlugin *core = g_s2e->getCorePlugin();
+    if(unlikely(!core->onDataMemoryAccessBatch.empty())) {
+        s2e_record_memory_access(vaddr, haddr, buf, size, isWrite, isIO);
+    }
+    if(unlikely(!core->onDataMemoryAccess.empty())) {
         s2e_trace_memory_access_slow(vaddr, haddr, buf, size, isWrite, isIO);
     }
 }
@@ -420,34 +592,96 @@ void s2e_trace_port_access(
     }
 }
 
+void CorePlugin::markSymbolicPorts(uint16_t start, unsigned size, bool isSymbolic)
+{
+    assert(start + size <= 0x10000);
+    for (unsigned port = start; port < start + size; ++port) {
+        if (isSymbolic) {
+            g_s2e_symbolic_ports[port >> 5] |= 1 << (port & 31);
+        } else {
+            g_s2e_symbolic_ports[port >> 5] &= ~(1 << (port & 31));
+        }
+    }
+}
+
+klee::ref<klee::Expr> CorePlugin::createSymbolicHardwareValue(S2EExecutionState *state, bool isMmio,
+                                                              uint64_t address, unsigned size,
+                                                              const std::string &name)
+{
+    klee::Expr::Width width = size * 8;
+
+    if (m_symbolicHardwareReadCb) {
+        klee::ref<klee::Expr> value = m_symbolicHardwareReadCb(state, isMmio, address, size, name,
+                                                               m_symbolicHardwareOpaque);
+        if (!value.isNull()) {
+            assert(value->getWidth() == width);
+            return value;
+        }
+    }
+
+    return state->createSymbolicValue(name, width);
+}
+
+void CorePlugin::markSymbolicMmio(uint64_t physAddress, uint64_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    uint64_t page = physAddress >> S2E_SYMBHW_PAGE_BITS;
+    uint64_t last = (physAddress + size - 1) >> S2E_SYMBHW_PAGE_BITS;
+    for (; page <= last; ++page) {
+        uint64_t l1 = page >> S2E_SYMBHW_L2_BITS;
+        uint64_t l2 = page & ((1 << S2E_SYMBHW_L2_BITS) - 1);
+
+        //Pages above the map are always looked up
+        if (l1 >= S2E_SYMBHW_L1_SIZE) {
+            return;
+        }
+
+        uint32_t *&map = g_s2e_symbolic_pages[l1];
+        if (!map) {
+            map = new uint32_t[(1 << S2E_SYMBHW_L2_BITS) / 32];
+            memset(map, 0, (1 << S2E_SYMBHW_L2_BITS) / 8);
+        }
+        map[l2 >> 5] |= 1 << (l2 & 31);
+    }
+}
+
 int s2e_is_port_symbolic(struct S2E *s2e, struct S2EExecutionState* state, uint64_t port)
 {
+    if (!s2e_port_may_be_symbolic(port)) {
+        return 0;
+    }
     return s2e->getCorePlugin()->isPortSymbolic(port);
 }
 
 int s2e_is_mmio_symbolic(uint64_t address, uint64_t size)
 {
+    if (!s2e_mmio_may_be_symbolic(address, size)) {
+        return 0;
+    }
     return g_s2e->getCorePlugin()->isMmioSymbolic(address, size);
 }
 
 int s2e_is_mmio_symbolic_b(uint64_t address)
 {
-    return g_s2e->getCorePlugin()->isMmioSymbolic(address, 1);
+    return s2e_is_mmio_symbolic(address, 1);
 }
 
 int s2e_is_mmio_symbolic_w(uint64_t address)
 {
-    return g_s2e->getCorePlugin()->isMmioSymbolic(address, 2);
+    return s2e_is_mmio_symbolic(address, 2);
 }
 
 int s2e_is_mmio_symbolic_l(uint64_t address)
 {
-    return g_s2e->getCorePlugin()->isMmioSymbolic(address, 4);
+    return s2e_is_mmio_symbolic(address, 4);
 }
 
 int s2e_is_mmio_symbolic_q(uint64_t address)
 {
-    return g_s2e->getCorePlugin()->isMmioSymbolic(address, 8);
+    return s2e_is_mmio_symbolic(address, 8);
 }
 
 void s2e_on_privilege_change(unsigned previous, unsigned current)
@@ -40,6 +40,7 @@
 #include <klee/Expr.h>
 
 #include <s2e/Signals/Signals.h>
+#include <s2e/S2ECheckpoint.h>
 #include <vector>
 #include <inttypes.h>
 #include <cpu.h>
@@ -67,6 +68,32 @@ typedef sigc::signal<void, S2EExecutionState*, uint64_t /* pc */> ExecutionSigna
 typedef bool (*SYMB_PORT_CHECK)(uint16_t port, void *opaque);
 typedef bool (*SYMB_MMIO_CHECK)(uint64_t physaddress, uint64_t size, void *opaque);
 
+/** These callbacks choose the values returned by the reads of symbolic
+  * ports and MMIO, and see the writes to them. The read callback returns
+  * a null expression to get a fresh symbolic value. */
+typedef klee::ref<klee::Expr> (*SYMB_HW_READ)(S2EExecutionState *state, bool isMmio,
+                                              uint64_t address, unsigned size,
+                                              const std::string &name, void *opaque);
+typedef void (*SYMB_HW_WRITE)(S2EExecutionState *state, bool isMmio,
+                              uint64_t address, unsigned size,
+                              const klee::ref<klee::Expr> &value, void *opaque);
+
+/** A data memory access as buffered for onDataMemoryAccessBatch */
+struct DataMemoryAccess {
+    enum Flags {
+        WRITE = 1, IO = 2,
+        SYMBOLIC_ADDRESS = 4, SYMBOLIC_HOST_ADDRESS = 8, SYMBOLIC_VALUE = 16
+    };
+
+    uint64_t pc;
+    uint64_t address;
+    uint64_t hostAddress;
+    //Symbolic components are zero
+    uint64_t value;
+    uint8_t size;
+    uint8_t flags;
+};
+
 class CorePlugin : public Plugin {
     S2E_PLUGIN
 
@@ -77,6 +104,20 @@ private:
     void *m_isPortSymbolicOpaque;
     void *m_isMmioSymbolicOpaque;
 
+    SYMB_HW_READ m_symbolicHardwareReadCb;
+    SYMB_HW_WRITE m_symbolicHardwareWriteCb;
+    void *m_symbolicHardwareOpaque;
+
+    static const unsigned DataMemoryAccessBufferSize = 1024;
+    DataMemoryAccess m_dataMemoryAccesses[DataMemoryAccessBufferSize];
+    unsigned m_dataMemoryAccessCount;
+
+    bool m_instrumentationEnabled;
+
+    /** Custom instruction signals, by main opcode */
+    sigc::signal<void, S2EExecutionState*, uint64_t> m_customInstructionSignals[256];
+    bool m_customInstructionHandlers;
+
 public:
     CorePlugin(S2E* s2e): Plugin(s2e) {
         m_Timer = NULL;
@@ -84,6 +125,12 @@ public:
         m_isMmioSymbolicCb = NULL;
         m_isPortSymbolicOpaque = NULL;
         m_isMmioSymbolicOpaque = NULL;
+        m_symbolicHardwareReadCb = NULL;
+        m_symbolicHardwareWriteCb = NULL;
+        m_symbolicHardwareOpaque = NULL;
+        m_dataMemoryAccessCount = 0;
+        m_instrumentationEnabled = true;
+        m_customInstructionHandlers = false;
     }
 
     void initialize();
@@ -99,10 +146,33 @@ public:
         m_isMmioSymbolicOpaque = opaque;
     }
 
+    void setSymbolicHardwareCallbacks(SYMB_HW_READ readCb, SYMB_HW_WRITE writeCb, void *opaque) {
+        m_symbolicHardwareReadCb = readCb;
+        m_symbolicHardwareWriteCb = writeCb;
+        m_symbolicHardwareOpaque = opaque;
+    }
+
     void enableMmioCallbacks(bool enable) {
         g_s2e_enable_mmio_checks = enable;
     }
 
+    /** While disabled, the translation signals are not emitted, so
+        new translation blocks call no plugin. Flush the translation
+        block cache after changing this. */
+    void setInstrumentationEnabled(bool enable) {
+        m_instrumentationEnabled = enable;
+    }
+
+    bool isInstrumentationEnabled() const {
+        return m_instrumentationEnabled;
+    }
+
+    /** The callbacks are invoked only for the ports and physical pages
+        marked here. Ports are marked exactly. Pages stay marked once any
+        state maps symbolic MMIO there, the callback has the last word. */
+    void markSymbolicPorts(uint16_t start, unsigned size, bool isSymbolic);
+    void markSymbolicMmio(uint64_t physAddress, uint64_t size);
+
     inline bool isPortSymbolic(uint16_t port) const {
         if (m_isPortSymbolicCb) {
             return m_isPortSymbolicCb(port, m_isPortSymbolicOpaque);
@@ -117,6 +187,50 @@ public:
         return false;
     }
 
+    /** Returns the value of a read of size bytes from a symbolic port
+        or MMIO address, fresh unless the read callback provides one */
+    klee::ref<klee::Expr> createSymbolicHardwareValue(S2EExecutionState *state, bool isMmio,
+                                                      uint64_t address, unsigned size,
+                                                      const std::string &name);
+
+    /** Reports a write to a symbolic port or MMIO address */
+    inline void notifySymbolicHardwareWrite(S2EExecutionState *state, bool isMmio,
+                                            uint64_t address, unsigned size,
+                                            const klee::ref<klee::Expr> &value) {
+        if (m_symbolicHardwareWriteCb) {
+            m_symbolicHardwareWriteCb(state, isMmio, address, size, value, m_symbolicHardwareOpaque);
+        }
+    }
+
+    /** Whether data memory accesses must be reported at all */
+    inline bool isDataMemoryAccessTraced() const {
+        return !onDataMemoryAccess.empty() || !onDataMemoryAccessBatch.empty();
+    }
+
+    /** Lets the generated code skip the memory helpers when no plugin
+        traces data accesses. Called before running translation blocks
+        and after the plugin callbacks that may connect a tracer. */
+    inline void updateFastMemoryAccess() {
+        g_s2e_fast_memory_access = !isDataMemoryAccessTraced();
+    }
+
+    /** Buffers an access for onDataMemoryAccessBatch */
+    inline void recordDataMemoryAccess(S2EExecutionState *state, const DataMemoryAccess &access) {
+        m_dataMemoryAccesses[m_dataMemoryAccessCount++] = access;
+        if (m_dataMemoryAccessCount == DataMemoryAccessBufferSize) {
+            flushDataMemoryAccesses(state);
+        }
+    }
+
+    /** Emits the buffered accesses of the given state, if any */
+    inline void flushDataMemoryAccesses(S2EExecutionState *state) {
+        if (m_dataMemoryAccessCount) {
+            flushDataMemoryAccessesSlow(state);
+        }
+    }
+
+    void flushDataMemoryAccessesSlow(S2EExecutionState *state);
+
     struct QEMUTimer *getTimer() {
         return m_Timer;
     }
@@ -183,6 +297,18 @@ public:
             >
             onCustomInstruction;
 
+    /** Signal that is emitted only for the custom instructions with the
+        given main opcode (see Opcodes.h), before onCustomInstruction.
+        Plugins that own an opcode should use it, so that the other ones
+        are not called for each of their instructions. */
+    sigc::signal<void, S2EExecutionState*, uint64_t /* arg */>&
+            getCustomInstructionSignal(uint8_t opcode) {
+        m_customInstructionHandlers = true;
+        return m_customInstructionSignals[opcode];
+    }
+
+    void dispatchCustomInstruction(S2EExecutionState *state, uint64_t arg);
+
     /** Signal that is emitted on each memory access */
     /* XXX: this signal is still not emitted for code */
     sigc::signal<void, S2EExecutionState*,
@@ -192,6 +318,17 @@ public:
                  bool /* isWrite */, bool /* isIO */>
             onDataMemoryAccess;
 
+    /** Signal that is emitted with batches of data memory accesses, in
+        execution order. Accesses are buffered without building any
+        expression and handed over at the end of the execution of
+        translation blocks, before state switches and forks, and when
+        the buffer is full. Symbolic accesses are still emitted
+        through onDataMemoryAccess, their records have symbolic flags. */
+    sigc::signal<void, S2EExecutionState*,
+                 const DataMemoryAccess* /* accesses */,
+                 unsigned /* count */>
+            onDataMemoryAccessBatch;
+
     /** Signal that is emitted on each port access */
     sigc::signal<void, S2EExecutionState*,
                  klee::ref<klee::Expr> /* port */,
@@ -225,6 +362,25 @@ public:
      */
     sigc::signal<void, S2EExecutionState*> onStateKill;
 
+    /**
+     * Signal emitted when the exploration is checkpointed
+     * (see -checkpoint-interval). Plugins store their progress
+     * in the section named after them.
+     */
+    sigc::signal<void, CheckpointSections&> onCheckpointSave;
+
+    /**
+     * Signal emitted once per file of -resume-checkpoint,
+     * before the execution starts.
+     */
+    sigc::signal<void, const CheckpointSections&> onCheckpointRestore;
+
+    /**
+     * Signal emitted after each constraint solver query of a state,
+     * with the time it took in microseconds.
+     */
+    sigc::signal<void, S2EExecutionState*, uint64_t /* usec */> onSolverQuery;
+
 
     /** Signal emitted when spawning a new S2E process */
     sigc::signal<void, bool /* prefork */,
@@ -240,6 +396,15 @@ public:
     sigc::signal<void, bool /* isChild */> onProcessForkComplete;
 
 
+    /**
+     * Signal that is emitted after a device wrote guest memory
+     * with DMA. buf points to the data copied by the device.
+     */
+    sigc::signal<void, S2EExecutionState*,
+                 uint64_t /* hostAddress */,
+                 const uint8_t* /* buf */,
+                 unsigned /* size */> onDmaWrite;
+
     /** Signal that is emitted upon TLB miss */
     sigc::signal<void, S2EExecutionState*, uint64_t, bool> onTlbMiss;
 
@@ -45,6 +45,7 @@ extern "C" {
 #include <s2e/ConfigFile.h>
 #include <s2e/Utils.h>
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
@@ -56,9 +57,6 @@ S2E_DEFINE_PLUGIN(Debugger, "Debugger plugin", "",);
 
 void Debugger::initialize()
 {
-    m_dataTriggers = NULL;
-    m_dataTriggerCount = 0;
-
     //Catch all accesses to the stack
     m_monitorStack = s2e()->getConfig()->getBool(getConfigKey() + ".monitorStack");
 
@@ -71,41 +69,37 @@ void Debugger::initialize()
 
     //Manual addresses
     //XXX: Note that stack monitoring and manual addresses cannot be used together...
-    initList(getConfigKey() + ".dataTriggers", &m_dataTriggers, &m_dataTriggerCount);
-    initAddressTriggers(getConfigKey() + ".addressTriggers");
+    initList(getConfigKey() + ".dataTriggers", m_dataTriggers);
+    initAddressTriggers(getConfigKey() + ".addressTriggers", m_addressTriggers);
+
+    //Instructions whose execution is printed, they are selected at translation time
+    initAddressTriggers(getConfigKey() + ".instructionTriggers", m_instructionTriggers);
 
     if (!m_timeTrigger) {
-        s2e()->getCorePlugin()->onDataMemoryAccess.connect(
-                sigc::mem_fun(*this, &Debugger::onDataMemoryAccess));
+        enableTracing();
     }else {
         m_timerConnection = s2e()->getCorePlugin()->onTimer.connect(
                 sigc::mem_fun(*this, &Debugger::onTimer));
     }
-
-
 }
 
-void Debugger::initList(const std::string &key, uint64_t **ptr, unsigned *size)
+void Debugger::initList(const std::string &key, std::vector<uint64_t> &values)
 {
     ConfigFile::integer_list list;
 
     list = s2e()->getConfig()->getIntegerList(key);
-    *size = list.size();
 
-    if (list.size() > 0) {
-        *ptr = new uint64_t[list.size()];
-        ConfigFile::integer_list::iterator it;
-        unsigned i=0;
-
-        for (it = list.begin(); it != list.end(); ++it) {
-            s2e()->getMessagesStream() << "Adding trigger for value " << hexval(*it) << '\n';
-            (*ptr)[i] = *it;
-            ++i;
-        }
+    ConfigFile::integer_list::iterator it;
+    for (it = list.begin(); it != list.end(); ++it) {
+        s2e()->getMessagesStream() << "Adding trigger for value " << hexval(*it) << '\n';
+        values.push_back(*it);
     }
+
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
 }
 
-void Debugger::initAddressTriggers(const std::string &key)
+void Debugger::initAddressTriggers(const std::string &key, AddressRanges &ranges)
 {
     ConfigFile *cfg = s2e()->getConfig();
 
@@ -120,7 +114,7 @@ void Debugger::initAddressTriggers(const std::string &key)
         s2e()->getDebugStream() << __FUNCTION__ << ": scanning " << ss.str() << '\n';
         list = cfg->getIntegerList(ss.str(), ConfigFile::integer_list(), &ok);
         if (!ok) {
-            return;
+            break;
         }
 
         if (list.size() == 0) {
@@ -141,36 +135,58 @@ void Debugger::initAddressTriggers(const std::string &key)
             s2e()->getWarningsStream() << hexval(e) << " must be bigger than " << s << '\n';
             continue;
         }
-        m_addressTriggers.push_back(AddressRange(list[0], list[1]));
+        ranges.push_back(AddressRange(s, e));
     }while(true);
+
+    sortRanges(ranges);
 }
 
 Debugger::~Debugger(void)
 {
-    if (m_dataTriggers) {
-        delete [] m_dataTriggers;
-    }
+
 }
 
-bool Debugger::dataTriggered(uint64_t data) const
+/** Sorts the ranges by start address and merges the overlapping ones */
+void Debugger::sortRanges(AddressRanges &ranges)
 {
-    for (unsigned i=0; i<m_dataTriggerCount; ++i) {
-        if (m_dataTriggers[i] == data) {
-            return true;
+    if (ranges.empty()) {
+        return;
+    }
+
+    std::sort(ranges.begin(), ranges.end());
+
+    AddressRanges::iterator last = ranges.begin();
+    for (AddressRanges::iterator it = last + 1; it != ranges.end(); ++it) {
+        if (it->start <= last->end || last->end + 1 == it->start) {
+            last->end = std::max(last->end, it->end);
+        } else {
+            *++last = *it;
         }
     }
-    return false;
+    ranges.erase(last + 1, ranges.end());
 }
 
-bool Debugger::addressTriggered(uint64_t address) const
+bool Debugger::rangesContain(const AddressRanges &ranges, uint64_t address)
 {
-    for (unsigned i=0; i<m_addressTriggers.size(); ++i) {
-        if (m_addressTriggers[i].start <= address &&
-            m_addressTriggers[i].end >= address ) {
-            return true;
-        }
+    if (ranges.empty() || address < ranges.front().start || address > ranges.back().end) {
+        return false;
     }
-    return false;
+
+    //First range that starts after the address, the candidate is the one before it
+    AddressRanges::const_iterator it =
+            std::upper_bound(ranges.begin(), ranges.end(), AddressRange(address, address));
+    --it;
+    return address <= it->end;
+}
+
+bool Debugger::dataTriggered(uint64_t data) const
+{
+    return std::binary_search(m_dataTriggers.begin(), m_dataTriggers.end(), data);
+}
+
+bool Debugger::addressTriggered(uint64_t address) const
+{
+    return rangesContain(m_addressTriggers, address);
 }
 
 bool Debugger::decideTracing(S2EExecutionState *state, uint64_t addr, uint64_t data) const
@@ -232,16 +248,10 @@ void Debugger::onTranslateInstructionStart(
     uint64_t pc
     )
 {
-    //signal->connect(sigc::mem_fun(*this, &Debugger::onInstruction));
-
-    /*if (pc <= 0xc02144b1 && pc >= 0xc02142f8) {
+    //Only the instructions inside a trigger range pay for a callback
+    if (rangesContain(m_instructionTriggers, pc)) {
         signal->connect(sigc::mem_fun(*this, &Debugger::onInstruction));
     }
-
-    if (pc <= 0xc0204e20 && pc >= 0xc0202e20) {
-        signal->connect(sigc::mem_fun(*this, &Debugger::onInstruction));
-    }*/
-
 }
 
 void Debugger::onInstruction(S2EExecutionState *state, uint64_t pc)
@@ -260,18 +270,33 @@ void Debugger::onTimer()
     }
 
     s2e()->getMessagesStream() << "Debugger Plugin: Enabling memory tracing" << '\n';
-    s2e()->getCorePlugin()->onDataMemoryAccess.connect(
-            sigc::mem_fun(*this, &Debugger::onDataMemoryAccess));
+    enableTracing();
 
-    //s2e()->getCorePlugin()->onTranslateInstructionStart.connect(
-      //      sigc::mem_fun(*this, &Debugger::onTranslateInstructionStart));
-
-    s2e()->getCorePlugin()->onTranslateInstructionEnd.connect(
-            sigc::mem_fun(*this, &Debugger::onTranslateInstructionStart));
+    //The blocks translated so far are not instrumented
+    if (!m_instructionTriggers.empty()) {
+        tb_flush(env);
+    }
 
     m_timerConnection.disconnect();
 }
 
+/**
+ *  Memory accesses are only monitored when some trigger may match them,
+ *  i.e., when there are data or address triggers or the stack is monitored.
+ */
+void Debugger::enableTracing()
+{
+    if (m_monitorStack || !m_dataTriggers.empty() || !m_addressTriggers.empty()) {
+        s2e()->getCorePlugin()->onDataMemoryAccess.connect(
+                sigc::mem_fun(*this, &Debugger::onDataMemoryAccess));
+    }
+
+    if (!m_instructionTriggers.empty()) {
+        s2e()->getCorePlugin()->onTranslateInstructionStart.connect(
+                sigc::mem_fun(*this, &Debugger::onTranslateInstructionStart));
+    }
+}
+
 
 
 } // namespace plugins
@@ -40,6 +40,8 @@
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/S2EExecutionState.h>
 
+#include <vector>
+
 namespace s2e {
 namespace plugins {
 
@@ -64,15 +66,23 @@ public:
         }
 
         uint64_t start, end;
+
+        bool operator<(const AddressRange &r) const {
+            return start < r.start;
+        }
     };
 
+    /** Sorted, non-overlapping ranges */
+    typedef std::vector<AddressRange> AddressRanges;
+
 
 private:
 
-    uint64_t *m_dataTriggers;
-    unsigned m_dataTriggerCount;
+    /* Sorted, looked up with a binary search */
+    std::vector<uint64_t> m_dataTriggers;
 
-    std::vector<AddressRange> m_addressTriggers;
+    AddressRanges m_addressTriggers;
+    AddressRanges m_instructionTriggers;
 
     bool m_monitorStack;
     uint64_t m_catchAbove;
@@ -82,12 +92,17 @@ private:
     sigc::connection m_timerConnection;
     sigc::connection m_memoryConnection;
 
-    void initList(const std::string &key, uint64_t **ptr, unsigned *size);
-    void initAddressTriggers(const std::string &key);
+    void initList(const std::string &key, std::vector<uint64_t> &values);
+    void initAddressTriggers(const std::string &key, AddressRanges &ranges);
+
+    static void sortRanges(AddressRanges &ranges);
+    static bool rangesContain(const AddressRanges &ranges, uint64_t address);
 
     bool dataTriggered(uint64_t data) const;
     bool addressTriggered(uint64_t address) const;
 
+    void enableTracing();
+
     bool decideTracing(S2EExecutionState *state, uint64_t addr, uint64_t data) const;
 
     void onDataMemoryAccess(S2EExecutionState *state,
@@ -184,7 +184,16 @@ void EdgeKiller::onModuleTranslateBlockEnd(
     DECLARE_PLUGINSTATE(EdgeKillerState, state);
 
     //If the target instruction is a kill point, connect the killer.
-    if (plgState->isEdge(endPc)) {
+    //Each exit of the block is reported separately. When the target
+    //of an exit is known, only instrument the exits of killed edges.
+    bool kill;
+    if (staticTarget) {
+        kill = plgState->isEdge(endPc, targetPc);
+    } else {
+        kill = plgState->isEdge(endPc);
+    }
+
+    if (kill) {
         signal->connect(
             sigc::mem_fun(*this, &EdgeKiller::onEdge)
         );
@@ -250,7 +259,11 @@ bool EdgeKillerState::isEdge(uint64_t source) const
 {
     Edge pe;
     pe.source = source;
-    return m_edges.find(pe) != m_edges.end();
+    pe.dest = 0;
+
+    //Edges are sorted by source, then by destination
+    EdgeEntries::const_iterator it = m_edges.lower_bound(pe);
+    return it != m_edges.end() && (*it).source == source;
 }
 
 bool EdgeKillerState::isEdge(uint64_t source, uint64_t dest) const
@@ -258,13 +271,7 @@ bool EdgeKillerState::isEdge(uint64_t source, uint64_t dest) const
     Edge pe;
     pe.source = source;
     pe.dest = dest;
-
-    //For now we assume unique source in the list
-    EdgeEntries::const_iterator it = m_edges.find(pe);
-    if (it != m_edges.end())  {
-        return pe == *it;
-    }
-    return false;
+    return m_edges.find(pe) != m_edges.end();
 }
 
 }
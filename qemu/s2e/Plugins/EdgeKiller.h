@@ -90,7 +90,10 @@ public:
         uint64_t source;
         uint64_t dest;
         bool operator()(const Edge &p1, const Edge &p2) const {
-            return p1.source < p2.source;
+            if (p1.source != p2.source) {
+                return p1.source < p2.source;
+            }
+            return p1.dest < p2.dest;
         }
 
         bool operator==(const Edge &p1) const {
@@ -39,6 +39,7 @@
 #include <s2e/Utils.h>
 
 #include <iostream>
+#include <sstream>
 
 namespace s2e {
 namespace plugins {
@@ -49,6 +50,216 @@ S2E_DEFINE_PLUGIN(ExecutionStatisticsCollector, "Allows client plugins to store
 void ExecutionStatisticsCollector::initialize()
 {
     m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &ExecutionStatisticsCollector::flushPendingCounts));
+
+    s2e()->getCorePlugin()->onProcessFork.connect(
+            sigc::mem_fun(*this, &ExecutionStatisticsCollector::onProcessFork));
+
+    s2e()->getCorePlugin()->onCheckpointSave.connect(
+            sigc::mem_fun(*this, &ExecutionStatisticsCollector::onCheckpointSave));
+
+    s2e()->getCorePlugin()->onCheckpointRestore.connect(
+            sigc::mem_fun(*this, &ExecutionStatisticsCollector::onCheckpointRestore));
+}
+
+void ExecutionStatisticsCollector::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
+{
+    //The child must not add the counts of the parent a second time
+    if (preFork) {
+        flushPendingCounts();
+    }
+}
+
+/**
+ * The entry point counts of the process, by module name because module
+ * ids are local to each process. One line per module: the length of the
+ * name, the name, the number of entry points, then the pairs of relative
+ * pc and count.
+ */
+void ExecutionStatisticsCollector::onCheckpointSave(CheckpointSections &sections)
+{
+    std::stringstream ss;
+    const ExecutionStatistics::FunctionInvocationCountByModule &counts =
+            m_globalStats.entryPointInvocationCountByModule;
+
+    foreach2(it, m_moduleIds.begin(), m_moduleIds.end()) {
+        unsigned id = it->second;
+        if (id >= counts.size() || counts[id].empty()) {
+            continue;
+        }
+
+        ss << it->first().size() << ' ' << it->first().str() << ' ' << counts[id].size();
+        foreach2(cit, counts[id].begin(), counts[id].end()) {
+            ss << ' ' << cit->first << ' ' << cit->second;
+        }
+        ss << '\n';
+    }
+
+    sections["ExecutionStatisticsCollector"] = ss.str();
+}
+
+/**
+ * The rebuilt states count the entry points of their path again,
+ * the counts along the checkpointed paths end up slightly higher.
+ */
+void ExecutionStatisticsCollector::onCheckpointRestore(const CheckpointSections &sections)
+{
+    CheckpointSections::const_iterator it = sections.find("ExecutionStatisticsCollector");
+    if (it == sections.end()) {
+        return;
+    }
+
+    std::stringstream ss(it->second);
+    unsigned length, entries;
+
+    while (ss >> length) {
+        std::string name(length, ' ');
+        ss.get();
+        if (length) {
+            ss.read(&name[0], length);
+        }
+        if (!(ss >> entries)) {
+            s2e()->getWarningsStream() << "ExecutionStatisticsCollector: invalid checkpoint section" << '\n';
+            return;
+        }
+
+        unsigned id = getModuleId(name);
+        for (unsigned i = 0; i < entries; ++i) {
+            uint64_t relPc;
+            unsigned count;
+            if (!(ss >> relPc >> count)) {
+                s2e()->getWarningsStream() << "ExecutionStatisticsCollector: invalid checkpoint section" << '\n';
+                return;
+            }
+            m_globalStats.getEntryPointCount(id, relPc) += count;
+            m_pendingCounts.getEntryPointCount(id, relPc) += count;
+        }
+    }
+}
+
+unsigned ExecutionStatisticsCollector::getModuleId(const std::string &name)
+{
+    llvm::StringMap<unsigned>::iterator it = m_moduleIds.find(name);
+    if (it != m_moduleIds.end()) {
+        return it->second;
+    }
+
+    //FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned i = 0; i < name.size(); ++i) {
+        hash = (hash ^ (uint8_t) name[i]) * 0x100000001b3ULL;
+    }
+
+    unsigned id = m_moduleHashes.size();
+    m_moduleHashes.push_back(hash);
+    m_moduleIds[name] = id;
+    return id;
+}
+
+/**
+ * Open addressing, entries are never removed. Lookups do not take the
+ * lock: an entry is only visible once its used field is set, after the
+ * other fields were written.
+ */
+ExecutionStatisticsShared::Entry *ExecutionStatisticsCollector::findSharedEntry(
+        ExecutionStatisticsShared *shared, uint64_t moduleHash, uint64_t pc, bool insert)
+{
+    const unsigned mask = ExecutionStatisticsShared::MaxEntries - 1;
+    unsigned index = (unsigned) ((moduleHash ^ (pc * 0x9e3779b97f4a7c15ULL)) >> 32) & mask;
+
+    for (unsigned i = 0; i < ExecutionStatisticsShared::MaxEntries; ++i) {
+        ExecutionStatisticsShared::Entry *entry = &shared->entries[(index + i) & mask];
+        if (!AtomicFunctions::read(&entry->used)) {
+            if (!insert) {
+                return NULL;
+            }
+            //The caller holds the lock
+            entry->moduleHash = moduleHash;
+            entry->pc = pc;
+            entry->count = 0;
+            AtomicFunctions::add(&entry->used, 1);
+            return entry;
+        }
+
+        if (entry->moduleHash == moduleHash && entry->pc == pc) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+void ExecutionStatisticsCollector::flushPendingCounts()
+{
+    ExecutionStatistics::FunctionInvocationCountByModule &pending =
+            m_pendingCounts.entryPointInvocationCountByModule;
+
+    bool locked = false;
+    ExecutionStatisticsShared *shared = m_shared.get();
+
+    for (unsigned id = 0; id < pending.size(); ++id) {
+        foreach2(it, pending[id].begin(), pending[id].end()) {
+            ExecutionStatisticsShared::Entry *entry =
+                    findSharedEntry(shared, m_moduleHashes[id], it->first, false);
+
+            if (!entry && !m_sharedTableFull) {
+                if (!locked) {
+                    m_shared.acquire();
+                    locked = true;
+                }
+                entry = findSharedEntry(shared, m_moduleHashes[id], it->first, true);
+                if (!entry) {
+                    s2e()->getWarningsStream() << "ExecutionStatisticsCollector: shared table is full, "
+                            << "total counts only include this process from now on\n";
+                    m_sharedTableFull = true;
+                }
+            }
+
+            if (entry) {
+                AtomicFunctions::add(&entry->count, it->second);
+            }
+        }
+        pending[id].clear();
+    }
+
+    if (locked) {
+        m_shared.release();
+    }
+}
+
+unsigned ExecutionStatisticsCollector::getTotalEntryPointCallCountForModule(S2EExecutionState *state)
+{
+    uint64_t pc = state->getPc();
+    const ModuleDescriptor* desc;
+
+    if (!m_detector || !(desc = m_detector->getCurrentDescriptor(state))) {
+        return 0;
+    }
+
+    unsigned id = getModuleId(desc->Name);
+    uint64_t relPc = desc->ToNativeBase(pc);
+
+    ExecutionStatisticsShared::Entry *entry =
+            findSharedEntry(m_shared.get(), m_moduleHashes[id], relPc, false);
+
+    if (!entry) {
+        //Not flushed yet, or the shared table is full
+        return m_globalStats.getEntryPointCount(id, relPc);
+    }
+
+    unsigned pending = 0;
+    ExecutionStatistics::FunctionInvocationCountByModule &pendingCounts =
+            m_pendingCounts.entryPointInvocationCountByModule;
+    if (id < pendingCounts.size()) {
+        ExecutionStatistics::FunctionInvocationCount::iterator it = pendingCounts[id].find(relPc);
+        if (it != pendingCounts[id].end()) {
+            pending = it->second;
+        }
+    }
+
+    return AtomicFunctions::read(&entry->count) + pending;
 }
 
 } // namespace plugins
@@ -45,9 +45,32 @@
 #include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/StringMap.h>
 
+#include <cstring>
+#include <vector>
+
 namespace s2e {
 namespace plugins {
 
+//Entry point invocation counts of all S2E processes.
+//Modules are identified by the hash of their name, because module ids
+//are local to each process.
+struct ExecutionStatisticsShared {
+    static const unsigned MaxEntries = 1 << 12;
+
+    struct Entry {
+        uint64_t used; //Set once the other fields are valid
+        uint64_t moduleHash;
+        uint64_t pc;
+        uint64_t count;
+    };
+
+    Entry entries[MaxEntries];
+
+    ExecutionStatisticsShared() {
+        memset(entries, 0, sizeof(entries));
+    }
+};
+
 struct ExecutionStatistics {
     /**
      * How many times did the execution reach a state in which no
@@ -80,10 +103,18 @@ struct ExecutionStatistics {
     typedef llvm::DenseMap<uint64_t, unsigned> FunctionInvocationCount;
     FunctionInvocationCount entryPointInvocationCount;
 
-    /** Stores module names and relative program counters */
-    typedef std::map<std::string, FunctionInvocationCount> FunctionInvocationCountByModule;
+    /** Relative program counters, indexed by module id
+        (see ExecutionStatisticsCollector::getModuleId()) */
+    typedef std::vector<FunctionInvocationCount> FunctionInvocationCountByModule;
     FunctionInvocationCountByModule entryPointInvocationCountByModule;
 
+    unsigned &getEntryPointCount(unsigned moduleId, uint64_t relPc) {
+        if (moduleId >= entryPointInvocationCountByModule.size()) {
+            entryPointInvocationCountByModule.resize(moduleId + 1);
+        }
+        return entryPointInvocationCountByModule[moduleId][relPc];
+    }
+
     ExecutionStatistics() {
         emptyCallStacksCount = 0;
         libraryCallFailures = 0;
@@ -123,7 +154,7 @@ class ExecutionStatisticsCollector : public Plugin
 {
     S2E_PLUGIN
 public:
-    ExecutionStatisticsCollector(S2E* s2e): Plugin(s2e) {}
+    ExecutionStatisticsCollector(S2E* s2e): Plugin(s2e), m_sharedTableFull(false) {}
 
     void initialize();
 
@@ -172,12 +203,13 @@ public:
 
         incrementEntryPointCall(state, pc);
         if (m_detector && (desc = m_detector->getCurrentDescriptor(state))) {
-
+            unsigned id = getModuleId(desc->Name);
             uint64_t relPc = desc->ToNativeBase(pc);
-            ++m_globalStats.entryPointInvocationCountByModule[desc->Name][relPc];
+            ++m_globalStats.getEntryPointCount(id, relPc);
+            ++m_pendingCounts.getEntryPointCount(id, relPc);
 
             DECLARE_PLUGINSTATE(ExecutionStatisticsCollectorState, state);
-            ++plgState->getStatistics().entryPointInvocationCountByModule[desc->Name][relPc];
+            ++plgState->getStatistics().getEntryPointCount(id, relPc);
         }
     }
 
@@ -188,23 +220,14 @@ public:
         if (m_detector && (desc = m_detector->getCurrentDescriptor(state))) {
             uint64_t relPc = desc->ToNativeBase(pc);
             DECLARE_PLUGINSTATE(ExecutionStatisticsCollectorState, state);
-            return plgState->getStatistics().entryPointInvocationCountByModule[desc->Name][relPc];
+            return plgState->getStatistics().getEntryPointCount(getModuleId(desc->Name), relPc);
         } else {
             return 0;
         }
     }
 
-    unsigned getTotalEntryPointCallCountForModule(S2EExecutionState *state) {
-        uint64_t pc = state->getPc();
-        const ModuleDescriptor* desc;
-
-        if (m_detector && (desc = m_detector->getCurrentDescriptor(state))) {
-            uint64_t relPc = desc->ToNativeBase(pc);
-            return m_globalStats.entryPointInvocationCountByModule[desc->Name][relPc];
-        } else {
-            return 0;
-        }
-    }
+    /** Counts the invocations in all S2E processes */
+    unsigned getTotalEntryPointCallCountForModule(S2EExecutionState *state);
 
     void incrementModuleLoads(S2EExecutionState *state) {
         ++m_globalStats.moduleLoads;
@@ -212,10 +235,29 @@ public:
         ++plgState->getStatistics().moduleLoads;
     }
 
+    /** Returns a dense id for the module name */
+    unsigned getModuleId(const std::string &name);
+
 private:
     ExecutionStatistics m_globalStats;
     ModuleExecutionDetector *m_detector;
 
+    llvm::StringMap<unsigned> m_moduleIds;
+    std::vector<uint64_t> m_moduleHashes;
+
+    //Entry point counts not yet added to the shared table
+    ExecutionStatistics m_pendingCounts;
+    S2ESynchronizedObject<ExecutionStatisticsShared> m_shared;
+    bool m_sharedTableFull;
+
+    ExecutionStatisticsShared::Entry *findSharedEntry(ExecutionStatisticsShared *shared,
+                                                      uint64_t moduleHash, uint64_t pc,
+                                                      bool insert);
+    void flushPendingCounts();
+    void onProcessFork(bool preFork, bool isChild, unsigned parentProcId);
+    void onCheckpointSave(CheckpointSections &sections);
+    void onCheckpointRestore(const CheckpointSections &sections);
+
 };
 
 } // namespace plugins
@@ -33,15 +33,24 @@
  * All contributors are listed in the S2E-AUTHORS file.
  */
 
+extern "C" {
+#include <qemu-timer.h>
+}
+
 #include "ExecutionTracer.h"
 
 #include <s2e/S2E.h>
 #include <s2e/ConfigFile.h>
 #include <s2e/Utils.h>
+#include <s2e/Plugins/ModuleExecutionDetector.h>
 
 #include <llvm/Support/TimeValue.h>
 
+#include <algorithm>
 #include <iostream>
+#include <unistd.h>
+#include <string.h>
+#include <zlib.h>
 
 namespace s2e {
 namespace plugins {
@@ -50,6 +59,115 @@ S2E_DEFINE_PLUGIN(ExecutionTracer, "ExecutionTracer plugin", "",);
 
 void ExecutionTracer::initialize()
 {
+    ConfigFile *cfg = s2e()->getConfig();
+
+    //Chunks are compressed on the writer thread
+    m_compress = cfg->getBool(getConfigKey() + ".compression");
+    m_async = cfg->getBool(getConfigKey() + ".asyncWriter") || m_compress;
+    if (m_async) {
+        //Round the buffer size down to a power of two
+        uint64_t size = cfg->getInt(getConfigKey() + ".bufferSize", 16) * 1024 * 1024;
+        m_ringSize = 1;
+        while (m_ringSize * 2 <= size) {
+            m_ringSize *= 2;
+        }
+        m_ring = new uint8_t[m_ringSize];
+
+        std::string policy = cfg->getString(getConfigKey() + ".overflowPolicy", "block");
+        if (policy == "block") {
+            m_overflowPolicy = OVERFLOW_BLOCK;
+        } else if (policy == "drop") {
+            m_overflowPolicy = OVERFLOW_DROP;
+        } else if (policy == "sample") {
+            m_overflowPolicy = OVERFLOW_SAMPLE;
+        } else {
+            s2e()->getWarningsStream() << "ExecutionTracer: unknown overflowPolicy " << policy
+                                       << " (must be block, drop or sample)" << '\n';
+            exit(-1);
+        }
+
+        m_sampleRate = cfg->getInt(getConfigKey() + ".sampleRate", 10);
+        if (m_sampleRate == 0) {
+            m_sampleRate = 1;
+        }
+        m_sampleCounter = 0;
+        m_droppedItems = 0;
+
+        s2e()->getMessagesStream() << "ExecutionTracer: asynchronous writer with a "
+                                   << (m_ringSize / 1024) << "KB buffer, overflow policy "
+                                   << policy << '\n';
+    }
+
+    if (m_compress) {
+        m_compressionLevel = cfg->getInt(getConfigKey() + ".compressionLevel", 1);
+        m_chunkSize = cfg->getInt(getConfigKey() + ".chunkSize", 1024) * 1024;
+        m_chunk.reserve(m_chunkSize);
+        m_chunkHeader.itemCount = 0;
+
+        s2e()->getMessagesStream() << "ExecutionTracer: compressing the trace in "
+                                   << (m_chunkSize / 1024) << "KB chunks" << '\n';
+    }
+
+    m_compact = cfg->getBool(getConfigKey() + ".compactEncoding");
+    if (m_compact && m_compress) {
+        //Chunks hold items in the usual format
+        s2e()->getWarningsStream() << "ExecutionTracer: compactEncoding is ignored with compression" << '\n';
+        m_compact = false;
+    }
+
+    m_writeIndex = cfg->getBool(getConfigKey() + ".writeIndex");
+    m_indexChunkSize = cfg->getInt(getConfigKey() + ".indexChunkSize", 64) * 1024;
+
+    if (m_writeIndex && m_compress) {
+        //The chunk headers already index the compressed trace
+        s2e()->getWarningsStream() << "ExecutionTracer: writeIndex is ignored with compression" << '\n';
+        m_writeIndex = false;
+    }
+
+    if (m_writeIndex && m_compact) {
+        //Index entries must start on items that can be decoded on their own
+        s2e()->getWarningsStream() << "ExecutionTracer: writeIndex is ignored with compactEncoding" << '\n';
+        m_writeIndex = false;
+    }
+
+    //Tracing policies only apply to high-volume items
+    m_tbSamplingRate = cfg->getInt(getConfigKey() + ".tbSamplingRate", 1);
+    if (m_tbSamplingRate == 0) {
+        m_tbSamplingRate = 1;
+    }
+
+    m_maxTracingTime = cfg->getInt(getConfigKey() + ".maxTracingTime", 0);
+
+    m_tscTimeStamps = cfg->getBool(getConfigKey() + ".tscTimeStamps");
+    if (m_tscTimeStamps) {
+        calibrateTsc();
+        s2e()->getMessagesStream() << "ExecutionTracer: time stamps are TSC values, "
+                                   << (m_timeStampsPerSecond / 1000000) << " ticks per microsecond" << '\n';
+    }
+
+    m_startModule = cfg->getString(getConfigKey() + ".startAfterForkInModule", "");
+    if (!m_startModule.empty()) {
+        m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+        if (!m_detector) {
+            s2e()->getWarningsStream() << "ExecutionTracer: startAfterForkInModule requires ModuleExecutionDetector" << '\n';
+            exit(-1);
+        }
+        m_tracingStarted = false;
+    }
+    m_tracingStartTime = getTimeStamp();
+
+    m_flightRecorderSize = cfg->getInt(getConfigKey() + ".flightRecorderSize", 0) * 1024;
+    if (m_flightRecorderSize) {
+        m_flightRecorderTriggers = cfg->getStringList(getConfigKey() + ".flightRecorderTriggers");
+
+        s2e()->getCorePlugin()->onTestCaseGeneration.connect(
+            sigc::mem_fun(*this, &ExecutionTracer::onTestCaseGeneration)
+        );
+
+        s2e()->getMessagesStream() << "ExecutionTracer: flight recorder keeps the last "
+                                   << (m_flightRecorderSize / 1024) << "KB of each state" << '\n';
+    }
+
     createNewTraceFile(false);
 
     s2e()->getCorePlugin()->onStateFork.connect(
@@ -66,9 +184,25 @@ void ExecutionTracer::initialize()
 
 ExecutionTracer::~ExecutionTracer()
 {
+    stopWriter();
+
     if (m_LogFile) {
+        flushChunk();
         fclose(m_LogFile);
     }
+
+    if (m_IndexFile) {
+        flushIndexEntry();
+        fclose(m_IndexFile);
+    }
+
+    if (m_async && m_droppedItems) {
+        s2e()->getWarningsStream() << "ExecutionTracer: dropped " << m_droppedItems
+                                   << " trace items because the buffer was full" << '\n';
+    }
+
+    delete [] m_ring;
+    delete m_codec;
 }
 
 void ExecutionTracer::createNewTraceFile(bool append)
@@ -87,13 +221,396 @@ void ExecutionTracer::createNewTraceFile(bool append)
         exit(-1);
     }
     m_CurrentIndex = 0;
+
+    if (m_compress) {
+        m_chunk.clear();
+        m_chunkHeader.itemCount = 0;
+
+        if (!append) {
+            ExecutionTraceChunkedHeader hdr;
+            memcpy(hdr.magic, EXECTRACE_CHUNKED_MAGIC, sizeof(hdr.magic));
+            hdr.version = EXECTRACE_CHUNKED_VERSION;
+            if (fwrite(&hdr, sizeof(hdr), 1, m_LogFile) != 1) {
+                s2e()->getWarningsStream() << "Could not write the trace header" << '\n';
+                exit(-1);
+            }
+        }
+    }
+
+    if (m_compact) {
+        //Appended items continue the stream of the previous ones
+        if (!append) {
+            delete m_codec;
+            m_codec = new ExecutionTraceCompactCodec();
+
+            ExecutionTraceCompactHeader hdr;
+            memcpy(hdr.magic, EXECTRACE_COMPACT_MAGIC, sizeof(hdr.magic));
+            hdr.version = EXECTRACE_COMPACT_VERSION;
+            if (fwrite(&hdr, sizeof(hdr), 1, m_LogFile) != 1) {
+                s2e()->getWarningsStream() << "Could not write the trace header" << '\n';
+                exit(-1);
+            }
+        }
+    }
+
+    if (m_writeIndex) {
+        std::string indexName = m_fileName + ".idx";
+        m_IndexFile = fopen(indexName.c_str(), append ? "ab" : "wb");
+        if (!m_IndexFile) {
+            s2e()->getWarningsStream() << "Could not create " << indexName << '\n';
+            exit(-1);
+        }
+
+        //Offsets are relative to the beginning of the trace file
+        fseek(m_LogFile, 0, SEEK_END);
+        m_fileOffset = ftell(m_LogFile);
+        m_indexEntry.itemCount = 0;
+    }
+
+    startWriter();
+
+    //Tools need a calibration record before the first time stamp
+    if (m_tscTimeStamps) {
+        writeTscCalibration();
+    }
+}
+
+uint64_t ExecutionTracer::getTimeStamp() const
+{
+    if (m_tscTimeStamps) {
+        return cpu_get_real_ticks();
+    }
+    return llvm::sys::TimeValue::now().usec();
+}
+
+/** Measures the frequency of the time stamp counter over a few milliseconds */
+void ExecutionTracer::calibrateTsc()
+{
+    m_calibrationUsec = llvm::sys::TimeValue::now().usec();
+    m_calibrationTsc = cpu_get_real_ticks();
+
+    uint64_t usec, tsc;
+    do {
+        usleep(10000);
+        usec = llvm::sys::TimeValue::now().usec();
+        tsc = cpu_get_real_ticks();
+    } while (usec <= m_calibrationUsec);
+
+    m_timeStampsPerSecond = (tsc - m_calibrationTsc) * 1000000 / (usec - m_calibrationUsec);
+}
+
+/**
+ *  Refines the frequency over the whole run and records the current
+ *  correspondence between the counter and the wall clock.
+ */
+void ExecutionTracer::writeTscCalibration()
+{
+    ExecutionTraceTscCalibration calibration;
+
+    calibration.usec = llvm::sys::TimeValue::now().usec();
+    calibration.tsc = cpu_get_real_ticks();
+
+    uint64_t elapsed = calibration.usec - m_calibrationUsec;
+    if (elapsed >= 1000000) {
+        m_timeStampsPerSecond = (calibration.tsc - m_calibrationTsc) * 1000000 / elapsed;
+    }
+    calibration.ticksPerSecond = m_timeStampsPerSecond;
+
+    writeData(0, 0, &calibration, sizeof(calibration), TRACE_TSC_CALIBRATION);
+}
+
+void ExecutionTracer::startWriter()
+{
+    if (!m_async || m_writerRunning) {
+        return;
+    }
+
+    assert(m_ringHead == m_ringTail);
+    m_writerStop = false;
+    m_writerRunning = true;
+    qemu_thread_create(&m_writerThread, writerThread, this, QEMU_THREAD_JOINABLE);
+}
+
+/** Writes out everything that is buffered and terminates the writer */
+void ExecutionTracer::stopWriter()
+{
+    if (!m_writerRunning) {
+        return;
+    }
+
+    m_writerStop = true;
+    qemu_thread_join(&m_writerThread);
+    m_writerRunning = false;
+}
+
+/** Waits until the writer thread has written all buffered items */
+void ExecutionTracer::waitForWriter()
+{
+    while (m_writerRunning && m_ringTail != m_ringHead) {
+        usleep(100);
+    }
+}
+
+void *ExecutionTracer::writerThread(void *opaque)
+{
+    static_cast<ExecutionTracer*>(opaque)->drainRing();
+    return NULL;
+}
+
+void ExecutionTracer::drainRing()
+{
+    if (m_compress) {
+        drainRingToChunks();
+        return;
+    }
+
+    while (true) {
+        uint64_t head = m_ringHead;
+        uint64_t tail = m_ringTail;
+
+        if (head == tail) {
+            if (m_writerStop) {
+                break;
+            }
+            usleep(1000);
+            continue;
+        }
+
+        //Make sure the item bytes are read after the head index
+        __sync_synchronize();
+
+        //Write everything up to the head or the end of the buffer at once
+        uint64_t offset = tail & (m_ringSize - 1);
+        uint64_t length = std::min(head - tail, m_ringSize - offset);
+        if (fwrite(m_ring + offset, length, 1, m_LogFile) != 1) {
+            //at this point the log is corrupted.
+            assert(false);
+        }
+
+        __sync_synchronize();
+        m_ringTail = tail + length;
+    }
+}
+
+/**
+ *  Moves the buffered items to the current chunk, one by one.
+ *  Full chunks are compressed and written before the buffer space
+ *  is released, so that waitForWriter() also waits for them.
+ */
+void ExecutionTracer::drainRingToChunks()
+{
+    while (true) {
+        uint64_t head = m_ringHead;
+        uint64_t tail = m_ringTail;
+
+        if (head == tail) {
+            if (m_writerStop) {
+                break;
+            }
+            usleep(1000);
+            continue;
+        }
+
+        __sync_synchronize();
+
+        while (tail != head) {
+            ExecutionTraceItemHeader item;
+            readRing(tail, &item, sizeof(item));
+
+            unsigned itemSize = sizeof(item) + item.size;
+            unsigned position = m_chunk.size();
+            m_chunk.resize(position + itemSize);
+            readRing(tail, &m_chunk[position], itemSize);
+            addChunkItem(item);
+
+            tail += itemSize;
+
+            if (m_chunk.size() >= m_chunkSize) {
+                flushChunk();
+            }
+        }
+
+        __sync_synchronize();
+        m_ringTail = tail;
+    }
+}
+
+/** Accounts for an item whose bytes were appended to the current chunk */
+void ExecutionTracer::addChunkItem(const ExecutionTraceItemHeader &item)
+{
+    if (m_chunkHeader.itemCount == 0) {
+        m_chunkHeader.minStateId = m_chunkHeader.maxStateId = item.stateId;
+        m_chunkHeader.typeMask = 0;
+        m_chunkHeader.firstTimeStamp = item.timeStamp;
+    }
+
+    if (item.stateId < m_chunkHeader.minStateId) {
+        m_chunkHeader.minStateId = item.stateId;
+    }
+    if (item.stateId > m_chunkHeader.maxStateId) {
+        m_chunkHeader.maxStateId = item.stateId;
+    }
+    m_chunkHeader.typeMask |= 1ULL << item.type;
+    m_chunkHeader.lastTimeStamp = item.timeStamp;
+    ++m_chunkHeader.itemCount;
+}
+
+void ExecutionTracer::flushChunk()
+{
+    if (!m_compress || m_chunkHeader.itemCount == 0) {
+        return;
+    }
+
+    uLongf compressedSize = compressBound(m_chunk.size());
+    m_compressedChunk.resize(compressedSize);
+
+    if (compress2(&m_compressedChunk[0], &compressedSize,
+                  &m_chunk[0], m_chunk.size(), m_compressionLevel) != Z_OK) {
+        assert(false && "Could not compress the trace");
+    }
+
+    m_chunkHeader.size = m_chunk.size();
+    m_chunkHeader.compressedSize = compressedSize;
+
+    if (fwrite(&m_chunkHeader, sizeof(m_chunkHeader), 1, m_LogFile) != 1 ||
+        fwrite(&m_compressedChunk[0], compressedSize, 1, m_LogFile) != 1) {
+        //at this point the log is corrupted.
+        assert(false);
+    }
+
+    m_chunk.clear();
+    m_chunkHeader.itemCount = 0;
+}
+
+void ExecutionTracer::readRing(uint64_t position, void *data, unsigned size) const
+{
+    uint64_t offset = position & (m_ringSize - 1);
+    uint64_t first = std::min((uint64_t) size, m_ringSize - offset);
+    memcpy(data, m_ring + offset, first);
+    memcpy((uint8_t*) data + first, m_ring, size - first);
+}
+
+void ExecutionTracer::writeRing(uint64_t position, const void *data, unsigned size)
+{
+    uint64_t offset = position & (m_ringSize - 1);
+    uint64_t first = std::min((uint64_t) size, m_ringSize - offset);
+    memcpy(m_ring + offset, data, first);
+    memcpy(m_ring, (const uint8_t*) data + first, size - first);
+}
+
+/**
+ *  Makes sure there are size free bytes in the ring.
+ *  Returns false if the item must be dropped.
+ *  Only high-volume items may be dropped, the trace
+ *  analyzers need the other ones to rebuild the execution tree.
+ */
+bool ExecutionTracer::reserveRing(unsigned size, ExecTraceEntryType type)
+{
+    bool droppable = m_overflowPolicy != OVERFLOW_BLOCK && isHighVolume(type);
+
+    uint64_t used = m_ringHead - m_ringTail;
+
+    if (droppable && m_overflowPolicy == OVERFLOW_SAMPLE && used > m_ringSize / 2) {
+        //Keep one item out of sampleRate while the buffer is filling up
+        if (++m_sampleCounter % m_sampleRate) {
+            ++m_droppedItems;
+            return false;
+        }
+    }
+
+    while (m_ringSize - (m_ringHead - m_ringTail) < size) {
+        if (droppable) {
+            ++m_droppedItems;
+            return false;
+        }
+        usleep(100);
+    }
+
+    return true;
 }
 
 void ExecutionTracer::onTimer()
 {
+    if (m_tscTimeStamps && m_LogFile) {
+        writeTscCalibration();
+    }
+
     if (m_LogFile) {
         fflush(m_LogFile);
     }
+
+    if (m_IndexFile) {
+        fflush(m_IndexFile);
+    }
+}
+
+/**
+ *  Accounts for an item that is about to be written.
+ *  A new index entry is started when the state changes or
+ *  when the current one grows over indexChunkSize bytes.
+ */
+void ExecutionTracer::indexItem(const ExecutionTraceItemHeader &item)
+{
+    if (m_indexEntry.itemCount > 0 &&
+        (m_indexEntry.stateId != item.stateId ||
+         m_indexEntry.size >= m_indexChunkSize)) {
+        flushIndexEntry();
+    }
+
+    if (m_indexEntry.itemCount == 0) {
+        m_indexEntry.offset = m_fileOffset;
+        m_indexEntry.size = 0;
+        m_indexEntry.timeStamp = item.timeStamp;
+        m_indexEntry.typeMask = 0;
+        m_indexEntry.stateId = item.stateId;
+    }
+
+    uint64_t itemSize = sizeof(item) + item.size;
+    m_indexEntry.size += itemSize;
+    m_indexEntry.typeMask |= 1ULL << item.type;
+    ++m_indexEntry.itemCount;
+    m_fileOffset += itemSize;
+}
+
+void ExecutionTracer::flushIndexEntry()
+{
+    if (m_indexEntry.itemCount == 0) {
+        return;
+    }
+
+    if (fwrite(&m_indexEntry, sizeof(m_indexEntry), 1, m_IndexFile) != 1) {
+        s2e()->getWarningsStream() << "ExecutionTracer: could not write the trace index" << '\n';
+    }
+    m_indexEntry.itemCount = 0;
+}
+
+bool ExecutionTracer::isHighVolume(ExecTraceEntryType type)
+{
+    return type == TRACE_TB_START || type == TRACE_TB_END ||
+           type == TRACE_MEMORY || type == TRACE_PAGEFAULT ||
+           type == TRACE_TLBMISS || type == TRACE_CACHESIM;
+}
+
+/**
+ *  Decides whether a high-volume item is traced at all.
+ *  Translation blocks are sampled at their TRACE_TB_START item,
+ *  the items that follow it belong to the same block and share its fate.
+ */
+bool ExecutionTracer::tracePolicyAllows(ExecTraceEntryType type, uint64_t timeStamp)
+{
+    if (m_tbSamplingRate > 1 && type == TRACE_TB_START) {
+        m_traceCurrentTb = (m_tbCounter++ % m_tbSamplingRate) == 0;
+    }
+
+    if (!m_tracingStarted || !m_traceCurrentTb) {
+        return false;
+    }
+
+    if (m_maxTracingTime && timeStamp - m_tracingStartTime > m_maxTracingTime * m_timeStampsPerSecond) {
+        return false;
+    }
+
+    return true;
 }
 
 uint32_t ExecutionTracer::writeData(
@@ -102,14 +619,88 @@ uint32_t ExecutionTracer::writeData(
 {
     ExecutionTraceItemHeader item;
 
-    assert(m_LogFile);
-
-    item.timeStamp = llvm::sys::TimeValue::now().usec();
+    item.timeStamp = getTimeStamp();
     item.size = size;
     item.type = type;
     item.stateId = state->getID();
     item.pid = state->getPid();
 
+    if (isHighVolume(type)) {
+        if (!tracePolicyAllows(type, item.timeStamp)) {
+            return 0;
+        }
+
+        if (m_flightRecorderSize) {
+            recordFlightItem(const_cast<S2EExecutionState*>(state), item, data);
+            return 0;
+        }
+    }
+
+    return writeItem(item, data);
+}
+
+uint32_t ExecutionTracer::writeData(
+        uint32_t stateId, uint64_t pid,
+        void *data, unsigned size, ExecTraceEntryType type)
+{
+    ExecutionTraceItemHeader item;
+
+    item.timeStamp = getTimeStamp();
+    item.size = size;
+    item.type = type;
+    item.stateId = stateId;
+    item.pid = pid;
+
+    return writeItem(item, data);
+}
+
+uint32_t ExecutionTracer::writeItem(const ExecutionTraceItemHeader &item, const void *data)
+{
+    unsigned size = item.size;
+    ExecTraceEntryType type = (ExecTraceEntryType) item.type;
+
+    assert(m_LogFile);
+
+    if (m_compact) {
+        return writeCompactItem(item, data);
+    }
+
+    if (m_writerRunning && sizeof(item) + size <= m_ringSize) {
+        if (!reserveRing(sizeof(item) + size, type)) {
+            return 0;
+        }
+
+        uint64_t head = m_ringHead;
+        writeRing(head, &item, sizeof(item));
+        if (size) {
+            writeRing(head + sizeof(item), data, size);
+        }
+
+        //Publish the item only once its bytes are in the buffer
+        __sync_synchronize();
+        m_ringHead = head + sizeof(item) + size;
+
+        if (m_IndexFile) {
+            indexItem(item);
+        }
+        return ++m_CurrentIndex;
+    }
+
+    //Items that do not fit in the buffer go straight to the file
+    waitForWriter();
+
+    if (m_compress) {
+        const uint8_t *header = reinterpret_cast<const uint8_t*>(&item);
+        m_chunk.insert(m_chunk.end(), header, header + sizeof(item));
+        m_chunk.insert(m_chunk.end(), (const uint8_t*) data, (const uint8_t*) data + size);
+        addChunkItem(item);
+
+        if (m_chunk.size() >= m_chunkSize) {
+            flushChunk();
+        }
+        return ++m_CurrentIndex;
+    }
+
     if (fwrite(&item, sizeof(item), 1, m_LogFile) != 1) {
         return 0;
     }
@@ -121,21 +712,138 @@ uint32_t ExecutionTracer::writeData(
         }
     }
 
+    if (m_IndexFile) {
+        indexItem(item);
+    }
+
     return ++m_CurrentIndex;
 }
 
+/**
+ *  Encodes the item once it is sure to be written,
+ *  items refer to the previous ones of the stream.
+ */
+uint32_t ExecutionTracer::writeCompactItem(const ExecutionTraceItemHeader &item, const void *data)
+{
+    unsigned maxSize = ExecutionTraceCompactCodec::getMaxEncodedSize(item.size);
+
+    if (m_writerRunning && maxSize <= m_ringSize) {
+        if (!reserveRing(maxSize, (ExecTraceEntryType) item.type)) {
+            return 0;
+        }
+
+        m_encoded.clear();
+        m_codec->encode(item, data, m_encoded);
+
+        uint64_t head = m_ringHead;
+        writeRing(head, &m_encoded[0], m_encoded.size());
+
+        __sync_synchronize();
+        m_ringHead = head + m_encoded.size();
+        return ++m_CurrentIndex;
+    }
+
+    waitForWriter();
+
+    m_encoded.clear();
+    m_codec->encode(item, data, m_encoded);
+    if (fwrite(&m_encoded[0], m_encoded.size(), 1, m_LogFile) != 1) {
+        //at this point the log is corrupted.
+        assert(false);
+    }
+
+    return ++m_CurrentIndex;
+}
+
+/**
+ *  Keeps the item in the flight recorder of the state,
+ *  evicting the oldest ones once the recorder is full.
+ */
+void ExecutionTracer::recordFlightItem(S2EExecutionState *state,
+                                       const ExecutionTraceItemHeader &item,
+                                       const void *data)
+{
+    DECLARE_PLUGINSTATE(ExecutionTracerState, state);
+
+    plgState->m_flightItems.push_back(std::vector<uint8_t>(sizeof(item) + item.size));
+    std::vector<uint8_t> &bytes = plgState->m_flightItems.back();
+    memcpy(&bytes[0], &item, sizeof(item));
+    if (item.size) {
+        memcpy(&bytes[sizeof(item)], data, item.size);
+    }
+    plgState->m_flightSize += bytes.size();
+
+    while (plgState->m_flightSize > m_flightRecorderSize && plgState->m_flightItems.size() > 1) {
+        plgState->m_flightSize -= plgState->m_flightItems.front().size();
+        plgState->m_flightItems.pop_front();
+    }
+}
+
+void ExecutionTracer::dumpFlightRecorder(S2EExecutionState *state)
+{
+    DECLARE_PLUGINSTATE(ExecutionTracerState, state);
+
+    while (!plgState->m_flightItems.empty()) {
+        const std::vector<uint8_t> &bytes = plgState->m_flightItems.front();
+        const ExecutionTraceItemHeader *item =
+                reinterpret_cast<const ExecutionTraceItemHeader*>(&bytes[0]);
+        writeItem(*item, &bytes[0] + sizeof(*item));
+        plgState->m_flightItems.pop_front();
+    }
+    plgState->m_flightSize = 0;
+}
+
+/**
+ *  States that end with one of the flightRecorderTriggers
+ *  messages (or with any message if there are none) dump their
+ *  flight recorder. The recorders of the other states are simply
+ *  discarded with them.
+ */
+void ExecutionTracer::onTestCaseGeneration(S2EExecutionState *state, const std::string &message)
+{
+    bool triggered = m_flightRecorderTriggers.empty();
+
+    foreach2(it, m_flightRecorderTriggers.begin(), m_flightRecorderTriggers.end()) {
+        if (message.find(*it) != std::string::npos) {
+            triggered = true;
+            break;
+        }
+    }
+
+    if (triggered) {
+        dumpFlightRecorder(state);
+    }
+}
+
 void ExecutionTracer::flush()
 {
+    waitForWriter();
+    flushChunk();
+
     if (m_LogFile) {
         fflush(m_LogFile);
     }
+
+    if (m_IndexFile) {
+        flushIndexEntry();
+        fflush(m_IndexFile);
+    }
 }
 
 void ExecutionTracer::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
 {
     if (preFork) {
+        //The writer thread would not survive the fork
+        stopWriter();
+        flushChunk();
         fclose(m_LogFile);
         m_LogFile = NULL;
+
+        if (m_IndexFile) {
+            flushIndexEntry();
+            fclose(m_IndexFile);
+            m_IndexFile = NULL;
+        }
     }else {
         if (isChild) {
             createNewTraceFile(false);
@@ -152,6 +860,17 @@ void ExecutionTracer::onFork(S2EExecutionState *state,
 {
     assert(newStates.size() > 0);
 
+    if (!m_tracingStarted) {
+        const ModuleDescriptor *desc = m_detector->getCurrentDescriptor(state);
+        const std::string *id = desc ? m_detector->getModuleId(*desc) : NULL;
+        if (id && *id == m_startModule) {
+            m_tracingStarted = true;
+            m_tracingStartTime = getTimeStamp();
+            s2e()->getMessagesStream(state) << "ExecutionTracer: first fork in "
+                                            << m_startModule << ", starting to trace" << '\n';
+        }
+    }
+
     unsigned itemSize = sizeof(ExecutionTraceFork) +
                         (newStates.size()-1) * sizeof(uint32_t);
 
@@ -42,12 +42,21 @@
 #include <s2e/S2EExecutionState.h>
 
 #include <stdio.h>
+#include <deque>
+#include <vector>
+
+extern "C" {
+#include <qemu-thread.h>
+}
 
 #include "TraceEntries.h"
+#include "TraceCompactCodec.h"
 
 namespace s2e {
 namespace plugins {
 
+class ModuleExecutionDetector;
+
 //Maps a module descriptor to an id, for compression purposes
 typedef std::multimap<ModuleDescriptor, uint16_t, ModuleDescriptor::ModuleByLoadBase> ExecTracerModules;
 
@@ -64,15 +73,111 @@ class ExecutionTracer : public Plugin
     std::string m_fileName;
     FILE* m_LogFile;
     uint32_t m_CurrentIndex;
+
+    /* Sidecar index (see the writeIndex option) */
+    bool m_writeIndex;
+    uint64_t m_indexChunkSize;
+    FILE* m_IndexFile;
+    uint64_t m_fileOffset;
+    ExecutionTraceIndexEntry m_indexEntry;
     OSMonitor *m_Monitor;
     ExecTracerModules m_Modules;
 
+    /* Asynchronous writer (see the asyncWriter option) */
+    enum OverflowPolicy {
+        OVERFLOW_BLOCK, OVERFLOW_DROP, OVERFLOW_SAMPLE
+    };
+
+    bool m_async;
+    OverflowPolicy m_overflowPolicy;
+    unsigned m_sampleRate;
+    unsigned m_sampleCounter;
+    uint64_t m_droppedItems;
+
+    /* Single producer (CPU loop), single consumer (writer thread) */
+    uint8_t *m_ring;
+    uint64_t m_ringSize;
+    volatile uint64_t m_ringHead;
+    volatile uint64_t m_ringTail;
+    volatile bool m_writerStop;
+    bool m_writerRunning;
+    QemuThread m_writerThread;
+
+    /* Compressed chunks (see the compression option) */
+    bool m_compress;
+    int m_compressionLevel;
+    unsigned m_chunkSize;
+    std::vector<uint8_t> m_chunk;
+    std::vector<uint8_t> m_compressedChunk;
+    ExecutionTraceChunkHeader m_chunkHeader;
+
+    /* Compact encoding (see the compactEncoding option) */
+    bool m_compact;
+    ExecutionTraceCompactCodec *m_codec;
+    std::vector<uint8_t> m_encoded;
+
+    /* Tracing policies for high-volume items (see the tbSamplingRate option) */
+    unsigned m_tbSamplingRate;
+    uint64_t m_tbCounter;
+    bool m_traceCurrentTb;
+    uint64_t m_maxTracingTime;
+    uint64_t m_tracingStartTime;
+    bool m_tracingStarted;
+    std::string m_startModule;
+    ModuleExecutionDetector *m_detector;
+
+    /* Time stamp counter time stamps (see the tscTimeStamps option) */
+    bool m_tscTimeStamps;
+    uint64_t m_timeStampsPerSecond;
+    uint64_t m_calibrationTsc;
+    uint64_t m_calibrationUsec;
+
+    /* Flight recorder (see the flightRecorderSize option) */
+    uint64_t m_flightRecorderSize;
+    std::vector<std::string> m_flightRecorderTriggers;
+
     uint16_t getCompressedId(const ModuleDescriptor *desc);
 
+    static bool isHighVolume(ExecTraceEntryType type);
+    bool tracePolicyAllows(ExecTraceEntryType type, uint64_t timeStamp);
+    void recordFlightItem(S2EExecutionState *state, const ExecutionTraceItemHeader &item,
+                          const void *data);
+    uint32_t writeItem(const ExecutionTraceItemHeader &item, const void *data);
+    uint32_t writeCompactItem(const ExecutionTraceItemHeader &item, const void *data);
+
+    uint64_t getTimeStamp() const;
+    void calibrateTsc();
+    void writeTscCalibration();
+
     void onTimer();
     void createNewTraceFile(bool append);
+
+    void indexItem(const ExecutionTraceItemHeader &item);
+    void flushIndexEntry();
+
+    void startWriter();
+    void stopWriter();
+    void waitForWriter();
+    static void *writerThread(void *opaque);
+    void drainRing();
+
+    bool reserveRing(unsigned size, ExecTraceEntryType type);
+    void writeRing(uint64_t position, const void *data, unsigned size);
+    void readRing(uint64_t position, void *data, unsigned size) const;
+
+    void drainRingToChunks();
+    void addChunkItem(const ExecutionTraceItemHeader &item);
+    void flushChunk();
 public:
-    ExecutionTracer(S2E* s2e): Plugin(s2e) {}
+    ExecutionTracer(S2E* s2e): Plugin(s2e), m_LogFile(NULL),
+        m_writeIndex(false), m_IndexFile(NULL), m_async(false),
+        m_ring(NULL), m_ringSize(0), m_ringHead(0), m_ringTail(0),
+        m_writerStop(false), m_writerRunning(false), m_compress(false),
+        m_compact(false), m_codec(NULL),
+        m_tbSamplingRate(1), m_tbCounter(0), m_traceCurrentTb(true),
+        m_maxTracingTime(0), m_tracingStartTime(0), m_tracingStarted(true),
+        m_detector(NULL), m_tscTimeStamps(false), m_timeStampsPerSecond(1000000),
+        m_calibrationTsc(0), m_calibrationUsec(0), m_flightRecorderSize(0) {}
     ~ExecutionTracer();
     void initialize();
 
@@ -80,6 +185,18 @@ public:
             const S2EExecutionState *state,
             void *data, unsigned size, ExecTraceEntryType type);
 
+    /** Writes an item on behalf of a state that may no longer exist */
+    uint32_t writeData(
+            uint32_t stateId, uint64_t pid,
+            void *data, unsigned size, ExecTraceEntryType type);
+
+    /**
+     *  Writes the high-volume items kept by the flight recorder
+     *  of the given state to the trace and empties the recorder.
+     *  Plugins that detect a crash may call it directly.
+     */
+    void dumpFlightRecorder(S2EExecutionState *state);
+
     void flush();
 private:
 
@@ -90,24 +207,29 @@ private:
 
     void onProcessFork(bool preFork, bool isChild, unsigned parentProcId);
 
+    void onTestCaseGeneration(S2EExecutionState *state, const std::string &message);
 
 };
 
-#if 0
+/** Last high-volume items of a state, kept by the flight recorder */
 class ExecutionTracerState: public PluginState
 {
 private:
-    unsigned m_previousItemIndex;
+    std::deque<std::vector<uint8_t> > m_flightItems;
+    uint64_t m_flightSize;
 
 public:
-    ExecutionTracerState();
-    virtual ~ExecutionTracerState();
-    virtual ExecutionTracerState* clone() const;
-    static PluginState *factory();
+    ExecutionTracerState() : m_flightSize(0) {}
+    virtual ~ExecutionTracerState() {}
+    virtual ExecutionTracerState* clone() const {
+        return new ExecutionTracerState(*this);
+    }
+    static PluginState *factory(Plugin *p, S2EExecutionState *s) {
+        return new ExecutionTracerState();
+    }
 
     friend class ExecutionTracer;
 };
-#endif
 
 } // namespace plugins
 } // namespace s2e
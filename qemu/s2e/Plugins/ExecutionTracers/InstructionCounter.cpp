@@ -33,8 +33,6 @@
  * All contributors are listed in the S2E-AUTHORS file.
  */
 
-///XXX: Do not use, deprecated
-
 extern "C" {
 #include "config.h"
 #include "qemu-common.h"
@@ -44,11 +42,11 @@ extern "C" {
 #include <s2e/S2E.h>
 #include <s2e/ConfigFile.h>
 #include <s2e/Utils.h>
-
-#include <llvm/Support/TimeValue.h>
+#include <s2e/s2e_qemu.h>
 
 #include <iostream>
 #include <sstream>
+#include <string.h>
 
 
 
@@ -59,15 +57,22 @@ S2E_DEFINE_PLUGIN(InstructionCounter, "Instruction counter plugin", "Instruction
 
 void InstructionCounter::initialize()
 {
-    m_tb = NULL;
-
     m_executionTracer = static_cast<ExecutionTracer*>(s2e()->getPlugin("ExecutionTracer"));
     assert(m_executionTracer);
 
     m_executionDetector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
     assert(m_executionDetector);
 
-    //TODO: whole-system counting
+    //Count the tracked modules unless configured otherwise,
+    //trackedModules=false counts the whole system.
+    m_filter.setTrackedModules(true);
+    m_filter.configure(getConfigKey());
+
+    //How often to write the counters to the trace, in seconds
+    m_flushInterval = s2e()->getConfig()->getInt(getConfigKey() + ".flushInterval", 1);
+    m_elapsedTics = 0;
+    m_translatedBlock = NULL;
+
     startCounter();
 }
 
@@ -77,38 +82,58 @@ void InstructionCounter::initialize()
 /////////////////////////////////////////////////////////////////////////////////////
 void InstructionCounter::startCounter()
 {
-    m_executionDetector->onModuleTranslateBlockStart.connect(
+    //Not filtered, only resets the block being translated
+    s2e()->getCorePlugin()->onTranslateBlockStart.connect(
             sigc::mem_fun(*this, &InstructionCounter::onTranslateBlockStart)
             );
+
+    m_filter.onTranslateInstructionStart.connect(
+            sigc::mem_fun(*this, &InstructionCounter::onTranslateInstructionStart)
+            );
+
+    m_filter.activate();
+
+    s2e()->getCorePlugin()->onException.connect(
+            sigc::mem_fun(*this, &InstructionCounter::onException));
+
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &InstructionCounter::onTimer));
+
+    s2e()->getCorePlugin()->onStateFork.connect(
+            sigc::mem_fun(*this, &InstructionCounter::onStateFork));
+
+    s2e()->getCorePlugin()->onStateSwitch.connect(
+            sigc::mem_fun(*this, &InstructionCounter::onStateSwitch));
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &InstructionCounter::onStateKill));
 }
 
+unsigned InstructionCounter::getShard(S2EExecutionState *state, uint64_t pc)
+{
+    const ModuleDescriptor *md = m_executionDetector->getModule(state, pc, false);
+    std::string name = md ? md->Name : "";
+
+    std::map<std::string, unsigned>::iterator it = m_shardIds.find(name);
+    if (it != m_shardIds.end()) {
+        return (*it).second;
+    }
+
+    unsigned shard = m_shardNames.size();
+    m_shardNames.push_back(name);
+    m_shardIds[name] = shard;
+    return shard;
+}
 
 /////////////////////////////////////////////////////////////////////////////////////
 
-/**
- *  Instrument only the blocks where we want to count the instructions.
- */
 void InstructionCounter::onTranslateBlockStart(
         ExecutionSignal *signal,
         S2EExecutionState* state,
-        const ModuleDescriptor &module,
         TranslationBlock *tb,
         uint64_t pc)
 {
-    if (m_tb) {
-        m_tbConnection.disconnect();
-    }
-    m_tb = tb;
-
-    CorePlugin *plg = s2e()->getCorePlugin();
-    m_tbConnection = plg->onTranslateInstructionStart.connect(
-            sigc::mem_fun(*this, &InstructionCounter::onTranslateInstructionStart)
-    );
-
-    //This function will flush the number of executed instructions
-    signal->connect(
-        sigc::mem_fun(*this, &InstructionCounter::onTraceTb)
-    );
+    m_translatedBlock = NULL;
 }
 
 
@@ -118,77 +143,156 @@ void InstructionCounter::onTranslateInstructionStart(
         TranslationBlock *tb,
         uint64_t pc)
 {
-    if (tb != m_tb) {
-        //We've been suddenly interrupted by some other module
-        m_tb = NULL;
-        m_tbConnection.disconnect();
-        return;
+    if (!m_translatedBlock) {
+        //First counted instruction of the block. The count of
+        //a retranslated block is rebuilt in place, older translations
+        //of the same code keep pointing to it.
+        BlockCount &block = m_blocks[BlockKey(state->getPid(), tb->pc)];
+        block.shard = getShard(state, pc);
+        block.pcs.clear();
+        m_translatedBlock = &block;
+
+        //A single call per block instead of one per instruction
+        signal->connect(
+            sigc::bind(sigc::mem_fun(*this, &InstructionCounter::onExecuteBlock),
+                       m_translatedBlock)
+        );
     }
 
-    //Connect a function that will increment the number of executed
-    //instructions.
-    signal->connect(
-        sigc::mem_fun(*this, &InstructionCounter::onTraceInstruction)
-    );
+    m_translatedBlock->pcs.push_back(pc);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+void InstructionCounter::onExecuteBlock(S2EExecutionState* state, uint64_t pc,
+                                        const BlockCount *block)
+{
+    //Get the plugin state for the current path
+    DECLARE_PLUGINSTATE(InstructionCounterState, state);
+
+    if (block->shard >= plgState->m_counts.size()) {
+        plgState->m_counts.resize(block->shard + 1, 0);
+    }
 
+    plgState->m_counts[block->shard] += block->pcs.size();
+    plgState->m_iCount += block->pcs.size();
+    plgState->m_lastBlock = block;
 }
 
-void InstructionCounter::onModuleTranslateBlockEnd(
-        ExecutionSignal *signal,
-        S2EExecutionState* state,
-        const ModuleDescriptor &module,
-        TranslationBlock *tb,
-        uint64_t endPc,
-        bool staticTarget,
-        uint64_t targetPc)
+void InstructionCounter::onException(S2EExecutionState* state, unsigned index, uint64_t pc)
 {
-    //TRACE("%"PRIx64" StaticTarget=%d TargetPc=%"PRIx64"\n", endPc, staticTarget, targetPc);
+    DECLARE_PLUGINSTATE(InstructionCounterState, state);
+
+    const BlockCount *block = plgState->m_lastBlock;
+    plgState->m_lastBlock = NULL;
 
-    //Done translating the blocks, no need to instrument anymore.
-    m_tb = NULL;
-    m_tbConnection.disconnect();
+    //Interrupts are taken between blocks, only CPU exceptions
+    //may leave the block in the middle.
+    if (!block || index >= 0x20) {
+        return;
+    }
+
+    //The faulting instruction was counted, the ones after it did not run
+    std::vector<uint64_t>::const_iterator it;
+    for (it = block->pcs.begin(); it != block->pcs.end(); ++it) {
+        if (*it == pc) {
+            break;
+        }
+    }
+
+    if (it == block->pcs.end()) {
+        return;
+    }
+
+    uint64_t skipped = block->pcs.end() - it - 1;
+    plgState->m_counts[block->shard] -= skipped;
+    plgState->m_iCount -= skipped;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
 
-void InstructionCounter::onTraceTb(S2EExecutionState* state, uint64_t pc)
+void InstructionCounter::flush(S2EExecutionState *state)
 {
-    //Get the plugin state for the current path
     DECLARE_PLUGINSTATE(InstructionCounterState, state);
 
-    if (plgState->m_lastTbPc == pc) {
-        //Avoid repeateadly tracing tight loops.
+    if (plgState->m_iCount == plgState->m_flushedCount) {
         return;
     }
 
-    //Flush the counter
+    plgState->m_flushedCount = plgState->m_iCount;
+
     ExecutionTraceICount e;
     e.count = plgState->m_iCount;
     m_executionTracer->writeData(state, &e, sizeof(e), TRACE_ICOUNT);
+
+    unsigned count = plgState->m_counts.size();
+    unsigned size = ExecutionTraceICountShards::getSize(count);
+    uint8_t *bytes = new uint8_t[size];
+    memset(bytes, 0, size);
+
+    ExecutionTraceICountShards *shards = reinterpret_cast<ExecutionTraceICountShards*>(bytes);
+    shards->count = count;
+    for (unsigned i = 0; i < count; ++i) {
+        strncpy(shards->shards[i].module, m_shardNames[i].c_str(),
+                sizeof(shards->shards[i].module) - 1);
+        shards->shards[i].count = plgState->m_counts[i];
+    }
+
+    m_executionTracer->writeData(state, shards, size, TRACE_ICOUNT_SHARDS);
+    delete [] bytes;
 }
 
+void InstructionCounter::onTimer()
+{
+    if (++m_elapsedTics < m_flushInterval || !g_s2e_state) {
+        return;
+    }
+
+    m_elapsedTics = 0;
+    flush(g_s2e_state);
+}
 
-void InstructionCounter::onTraceInstruction(S2EExecutionState* state, uint64_t pc)
+void InstructionCounter::onStateFork(S2EExecutionState *state,
+                                     const std::vector<S2EExecutionState*> &newStates,
+                                     const std::vector<klee::ref<klee::Expr> > &newConditions)
 {
-    //Get the plugin state for the current path
-    DECLARE_PLUGINSTATE(InstructionCounterState, state);
+    //Written after the fork record: the children report the counts
+    //they inherit, so that trace readers do not count them twice.
+    for (unsigned i = 0; i < newStates.size(); ++i) {
+        if (newStates[i] != state) {
+            DECLARE_PLUGINSTATE(InstructionCounterState, newStates[i]);
+            plgState->m_flushedCount = (uint64_t) -1;
+        }
+        flush(newStates[i]);
+    }
+}
 
-    //Increment the instruction count
-    plgState->m_iCount++;
+void InstructionCounter::onStateSwitch(S2EExecutionState *currentState,
+                                       S2EExecutionState *nextState)
+{
+    if (currentState) {
+        flush(currentState);
+    }
 }
 
+void InstructionCounter::onStateKill(S2EExecutionState *state)
+{
+    flush(state);
+}
 
 /////////////////////////////////////////////////////////////////////////////////////
 InstructionCounterState::InstructionCounterState()
 {
     m_iCount = 0;
-    m_lastTbPc = 0;
+    m_flushedCount = 0;
+    m_lastBlock = NULL;
 }
 
 InstructionCounterState::InstructionCounterState(S2EExecutionState *s, Plugin *p)
 {
     m_iCount = 0;
-    m_lastTbPc = 0;
+    m_flushedCount = 0;
+    m_lastBlock = NULL;
 }
 
 InstructionCounterState::~InstructionCounterState()
@@ -208,5 +312,3 @@ PluginState *InstructionCounterState::factory(Plugin *p, S2EExecutionState *s)
 
 } // namespace plugins
 } // namespace s2e
-
-
@@ -40,39 +40,69 @@
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/S2EExecutionState.h>
 #include <fstream>
+#include <map>
 #include <set>
+#include <vector>
 
 #include <s2e/Plugins/ModuleExecutionDetector.h>
+#include <s2e/Plugins/TranslationFilter.h>
 #include "ExecutionTracer.h"
 
 namespace s2e {
 namespace plugins {
 
-
+/**
+ *  Counts the executed instructions per module (shard).
+ *  The instructions of a block are counted at translation time and
+ *  added all at once when the block runs. Exceptions raised in the
+ *  middle of a block subtract the instructions that did not run.
+ */
 class InstructionCounter : public Plugin
 {
     S2E_PLUGIN
 private:
+    //Counted instructions of a translation block
+    struct BlockCount {
+        unsigned shard;
+        std::vector<uint64_t> pcs;
+    };
+
+    //Indexed by (pid, block pc)
+    typedef std::pair<uint64_t, uint64_t> BlockKey;
+    typedef std::map<BlockKey, BlockCount> BlockCounts;
 
     ModuleExecutionDetector *m_executionDetector;
     ExecutionTracer *m_executionTracer;
 
-    TranslationBlock *m_tb;
-    sigc::connection m_tbConnection;
+    //Selects the code whose instructions are counted
+    TranslationFilter m_filter;
+
+    BlockCounts m_blocks;
+
+    //Block being translated
+    BlockCount *m_translatedBlock;
+
+    //Module name of each shard
+    std::vector<std::string> m_shardNames;
+    std::map<std::string, unsigned> m_shardIds;
+
+    unsigned m_flushInterval;
+    unsigned m_elapsedTics;
 
 public:
-    InstructionCounter(S2E* s2e): Plugin(s2e) {}
+    InstructionCounter(S2E* s2e): Plugin(s2e), m_filter(s2e) {}
 
     void initialize();
-    
+
 private:
 
     void startCounter();
+    unsigned getShard(S2EExecutionState *state, uint64_t pc);
+    void flush(S2EExecutionState *state);
 
     void onTranslateBlockStart(
             ExecutionSignal *signal,
             S2EExecutionState* state,
-            const ModuleDescriptor &module,
             TranslationBlock *tb,
             uint64_t pc);
 
@@ -82,24 +112,34 @@ private:
             TranslationBlock *tb,
             uint64_t pc);
 
-    void onModuleTranslateBlockEnd(
-            ExecutionSignal *signal,
-            S2EExecutionState* state,
-            const ModuleDescriptor &module,
-            TranslationBlock *tb,
-            uint64_t endPc,
-            bool staticTarget,
-            uint64_t targetPc);
+    void onExecuteBlock(S2EExecutionState* state, uint64_t pc,
+                        const BlockCount *block);
+
+    void onException(S2EExecutionState* state, unsigned index, uint64_t pc);
 
-    void onTraceTb(S2EExecutionState* state, uint64_t pc);
-    void onTraceInstruction(S2EExecutionState* state, uint64_t pc);
+    void onTimer();
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+    void onStateSwitch(S2EExecutionState *currentState,
+                       S2EExecutionState *nextState);
+    void onStateKill(S2EExecutionState *state);
+
+    friend class InstructionCounterState;
 };
 
 class InstructionCounterState: public PluginState
 {
 private:
+    //Instructions executed so far, per shard
+    std::vector<uint64_t> m_counts;
     uint64_t m_iCount;
-    uint64_t m_lastTbPc;
+
+    //Total at the time of the last flush
+    uint64_t m_flushedCount;
+
+    //Last block that ran, for exception correction
+    const InstructionCounter::BlockCount *m_lastBlock;
 
 public:
 
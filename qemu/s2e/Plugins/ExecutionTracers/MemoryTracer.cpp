@@ -52,6 +52,12 @@ namespace plugins {
 
 S2E_DEFINE_PLUGIN(MemoryTracer, "Memory tracer plugin", "MemoryTracer", "ExecutionTracer");
 
+//Granularity of the heatmap, independent of the guest architecture
+static const uint64_t s_heatmapPageSize = 0x1000;
+
+//Entries per heatmap item, large tables are split over several items
+static const unsigned s_heatmapItemEntries = 1024;
+
 MemoryTracer::MemoryTracer(S2E* s2e)
         : Plugin(s2e)
 {
@@ -86,6 +92,33 @@ void MemoryTracer::initialize()
     //the object state. Can be useful to debug the engine.
     m_debugObjectStates = s2e()->getConfig()->getBool(getConfigKey() + ".debugObjectStates");
 
+    //Receive the accesses in batches instead of one signal per access.
+    //Symbolic addresses and values are traced as with concolic mode off.
+    m_batchTracing = s2e()->getConfig()->getBool(getConfigKey() + ".batchTracing");
+
+    //Count the accesses of each page instead of tracing every access.
+    //The counts are written every heatmapInterval seconds, when the
+    //state forks or is switched out, and when the table gets too large.
+    m_heatmap = s2e()->getConfig()->getBool(getConfigKey() + ".heatmap");
+    m_heatmapInterval = s2e()->getConfig()->getInt(getConfigKey() + ".heatmapInterval", 1);
+    m_heatmapMaxPages = s2e()->getConfig()->getInt(getConfigKey() + ".heatmapMaxPages", 65536);
+    m_heatmapTics = 0;
+    m_heatmapState = NULL;
+
+    if (m_heatmap) {
+        s2e()->getCorePlugin()->onStateFork.connect(
+                sigc::mem_fun(*this, &MemoryTracer::onStateFork));
+        s2e()->getCorePlugin()->onStateSwitch.connect(
+                sigc::mem_fun(*this, &MemoryTracer::onStateSwitch));
+        s2e()->getCorePlugin()->onStateKill.connect(
+                sigc::mem_fun(*this, &MemoryTracer::onStateKill));
+
+        if (m_heatmapInterval) {
+            s2e()->getCorePlugin()->onTimer.connect(
+                    sigc::mem_fun(*this, &MemoryTracer::onHeatmapTimer));
+        }
+    }
+
     //Start monitoring after the specified number of seconds
     bool hasTimeTrigger = false;
     m_timeTrigger = s2e()->getConfig()->getInt(getConfigKey() + ".timeTrigger", 0, &hasTimeTrigger);
@@ -104,7 +137,7 @@ void MemoryTracer::initialize()
         m_timerConnection = s2e()->getCorePlugin()->onTimer.connect(
                 sigc::mem_fun(*this, &MemoryTracer::onTimer));
     } else if (manualMode) {
-        s2e()->getCorePlugin()->onCustomInstruction.connect(
+        s2e()->getCorePlugin()->getCustomInstructionSignal(MEMORY_TRACER_OPCODE).connect(
                 sigc::mem_fun(*this, &MemoryTracer::onCustomInstruction));
     } else {
         enableTracing();
@@ -127,6 +160,18 @@ void MemoryTracer::traceDataMemoryAccess(S2EExecutionState *state,
     }
 
     bool isAddrCste = isa<klee::ConstantExpr>(address);
+
+    if (m_heatmap) {
+        if (isAddrCste) {
+            recordHeatmapAccess(state, state->getPc(),
+                                cast<klee::ConstantExpr>(address)->getZExtValue(64), isWrite);
+        } else if (ConcolicMode) {
+            klee::ref<klee::ConstantExpr> ce = dyn_cast<klee::ConstantExpr>(state->concolics.evaluate(address));
+            recordHeatmapAccess(state, state->getPc(), ce->getZExtValue(), isWrite);
+        }
+        return;
+    }
+
     bool isValCste = isa<klee::ConstantExpr>(value);
     bool isHostAddrCste = isa<klee::ConstantExpr>(hostAddress);
 
@@ -157,7 +202,7 @@ void MemoryTracer::traceDataMemoryAccess(S2EExecutionState *state,
         e.flags |= EXECTRACE_MEM_HASHOSTADDR;
         e.flags |= EXECTRACE_MEM_OBJECTSTATE;
 
-        klee::ObjectPair op = state->addressSpace.findObject(e.hostAddress & S2E_RAM_OBJECT_MASK);
+        klee::ObjectPair op = state->findRamObject(e.hostAddress);
         e.concreteBuffer = 0;
         if (op.first && op.second) {
             e.concreteBuffer = (uint64_t) op.second->getConcreteStore();
@@ -203,16 +248,205 @@ void MemoryTracer::onDataMemoryAccess(S2EExecutionState *state,
     traceDataMemoryAccess(state, address, hostAddress, value, isWrite, isIO);
 }
 
+void MemoryTracer::onDataMemoryAccessBatch(S2EExecutionState *state,
+                                           const DataMemoryAccess *accesses,
+                                           unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        const DataMemoryAccess &a = accesses[i];
+
+        if (m_catchAbove && (m_catchAbove >= a.pc)) {
+            continue;
+        }
+        if (m_catchBelow && (m_catchBelow < a.pc)) {
+            continue;
+        }
+
+        if (m_heatmap) {
+            if (!(a.flags & DataMemoryAccess::SYMBOLIC_ADDRESS)) {
+                recordHeatmapAccess(state, a.pc, a.address, a.flags & DataMemoryAccess::WRITE);
+            }
+            continue;
+        }
+
+        ExecutionTraceMemory e;
+        e.pc = a.pc;
+        e.address = a.flags & DataMemoryAccess::SYMBOLIC_ADDRESS ? 0xdeadbeef : a.address;
+        e.value = a.flags & DataMemoryAccess::SYMBOLIC_VALUE ? 0xdeadbeef : a.value;
+        e.size = a.size;
+        e.flags = (a.flags & DataMemoryAccess::WRITE ? EXECTRACE_MEM_WRITE : 0) |
+                  (a.flags & DataMemoryAccess::IO ? EXECTRACE_MEM_IO : 0);
+
+        bool isHostAddrCste = !(a.flags & DataMemoryAccess::SYMBOLIC_HOST_ADDRESS);
+        e.hostAddress = isHostAddrCste ? a.hostAddress : 0xDEADBEEF;
+
+        if (m_traceHostAddresses) {
+            e.flags |= EXECTRACE_MEM_HASHOSTADDR;
+            e.flags |= EXECTRACE_MEM_OBJECTSTATE;
+
+            klee::ObjectPair op = state->findRamObject(e.hostAddress);
+            e.concreteBuffer = 0;
+            if (op.first && op.second) {
+                e.concreteBuffer = (uint64_t) op.second->getConcreteStore();
+                if ((a.flags & DataMemoryAccess::WRITE) && m_debugObjectStates) {
+                    assert(state->addressSpace.isOwnedByUs(op.second));
+                }
+            }
+        }
+
+        if (a.flags & DataMemoryAccess::SYMBOLIC_ADDRESS) {
+            e.flags |= EXECTRACE_MEM_SYMBADDR;
+        }
+        if (a.flags & DataMemoryAccess::SYMBOLIC_VALUE) {
+            e.flags |= EXECTRACE_MEM_SYMBVAL;
+        }
+        if (!isHostAddrCste) {
+            e.flags |= EXECTRACE_MEM_SYMBHOSTADDR;
+        }
+
+        m_tracer->writeData(state, &e, sizeof(e), TRACE_MEMORY);
+    }
+}
+
+void MemoryTracer::recordHeatmapAccess(S2EExecutionState *state, uint64_t pc,
+                                       uint64_t address, bool isWrite)
+{
+    //The table only holds the counts of one state
+    if (state != m_heatmapState) {
+        flushHeatmap();
+        m_heatmapState = state;
+    }
+
+    HeatmapKey key;
+    key.pid = state->getPid();
+    key.page = address & ~(s_heatmapPageSize - 1);
+    key.moduleBase = 0;
+
+    if (m_execDetector) {
+        const ModuleDescriptor *module = m_execDetector->getModule(state, pc);
+        if (module) {
+            key.moduleBase = module->LoadBase;
+        }
+    }
+
+    Heatmap::iterator it = m_heatmapPages.find(key);
+    if (it == m_heatmapPages.end()) {
+        if (m_heatmapPages.size() >= m_heatmapMaxPages) {
+            flushHeatmap();
+            m_heatmapState = state;
+        }
+
+        HeatmapCounts counts;
+        counts.reads = 0;
+        counts.writes = 0;
+        it = m_heatmapPages.insert(std::make_pair(key, counts)).first;
+    }
+
+    uint32_t &count = isWrite ? (*it).second.writes : (*it).second.reads;
+    if (count == (uint32_t) -1) {
+        flushHeatmap();
+        m_heatmapState = state;
+
+        HeatmapCounts counts;
+        counts.reads = !isWrite;
+        counts.writes = isWrite;
+        m_heatmapPages[key] = counts;
+        return;
+    }
+    ++count;
+}
+
+void MemoryTracer::flushHeatmap()
+{
+    if (m_heatmapPages.empty()) {
+        return;
+    }
+
+    std::vector<uint8_t> buffer(ExecutionTraceMemoryHeatmap::getSize(s_heatmapItemEntries));
+    ExecutionTraceMemoryHeatmap *e = reinterpret_cast<ExecutionTraceMemoryHeatmap*>(&buffer[0]);
+    e->pageSize = s_heatmapPageSize;
+    e->count = 0;
+
+    foreach2(it, m_heatmapPages.begin(), m_heatmapPages.end()) {
+        ExecutionTraceMemoryHeatmapEntry &entry = e->entries[e->count++];
+        entry.pid = (*it).first.pid;
+        entry.page = (*it).first.page;
+        entry.moduleBase = (*it).first.moduleBase;
+        entry.reads = (*it).second.reads;
+        entry.writes = (*it).second.writes;
+
+        if (e->count == s_heatmapItemEntries) {
+            m_tracer->writeData(m_heatmapState, e, ExecutionTraceMemoryHeatmap::getSize(e->count),
+                                TRACE_MEMORY_HEATMAP);
+            e->count = 0;
+        }
+    }
+
+    if (e->count) {
+        m_tracer->writeData(m_heatmapState, e, ExecutionTraceMemoryHeatmap::getSize(e->count),
+                            TRACE_MEMORY_HEATMAP);
+    }
+
+    m_heatmapPages.clear();
+    m_heatmapState = NULL;
+}
+
+void MemoryTracer::onHeatmapTimer()
+{
+    if (++m_heatmapTics < m_heatmapInterval) {
+        return;
+    }
+
+    m_heatmapTics = 0;
+
+    //Write the accesses that are still buffered by the batch mode first
+    if (m_batchTracing && g_s2e_state) {
+        s2e()->getCorePlugin()->flushDataMemoryAccesses(g_s2e_state);
+    }
+    flushHeatmap();
+}
+
+void MemoryTracer::onStateFork(S2EExecutionState *state,
+                               const std::vector<S2EExecutionState*> &newStates,
+                               const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    //The accesses before the fork belong to the paths of all the children
+    flushHeatmap();
+}
+
+void MemoryTracer::onStateSwitch(S2EExecutionState *currentState,
+                                 S2EExecutionState *nextState)
+{
+    flushHeatmap();
+}
+
+void MemoryTracer::onStateKill(S2EExecutionState *state)
+{
+    if (state == m_heatmapState) {
+        flushHeatmap();
+    }
+}
+
+void MemoryTracer::connectMemoryMonitor()
+{
+    if (m_batchTracing) {
+        m_memoryMonitor = s2e()->getCorePlugin()->onDataMemoryAccessBatch.connect(
+                sigc::mem_fun(*this, &MemoryTracer::onDataMemoryAccessBatch));
+    } else {
+        m_memoryMonitor = s2e()->getCorePlugin()->onDataMemoryAccess.connect(
+                sigc::mem_fun(*this, &MemoryTracer::onDataMemoryAccess));
+    }
+}
+
 void MemoryTracer::onModuleTransition(S2EExecutionState *state,
                                        const ModuleDescriptor *prevModule,
                                        const ModuleDescriptor *nextModule)
 {
     if (nextModule && !m_memoryMonitor.connected()) {
-        m_memoryMonitor =
-            s2e()->getCorePlugin()->onDataMemoryAccess.connect(
-                sigc::mem_fun(*this, &MemoryTracer::onDataMemoryAccess)
-            );
+        connectMemoryMonitor();
     } else {
+        //Trace what was buffered while in the module
+        s2e()->getCorePlugin()->flushDataMemoryAccesses(state);
         m_memoryMonitor.disconnect();
     }
 }
@@ -250,8 +484,7 @@ void MemoryTracer::enableTracing()
                             &MemoryTracer::onModuleTransition)
                     );
         } else {
-            m_memoryMonitor = s2e()->getCorePlugin()->onDataMemoryAccess.connect(
-                    sigc::mem_fun(*this, &MemoryTracer::onDataMemoryAccess));
+            connectMemoryMonitor();
         }
     }
 
@@ -272,6 +505,7 @@ void MemoryTracer::enableTracing()
 
 void MemoryTracer::disableTracing()
 {
+    s2e()->getCorePlugin()->flushDataMemoryAccesses(g_s2e_state);
     m_memoryMonitor.disconnect();
     m_pageFaultsMonitor.disconnect();
     m_tlbMissesMonitor.disconnect();
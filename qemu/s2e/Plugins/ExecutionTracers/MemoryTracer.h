@@ -39,6 +39,7 @@
 #include <s2e/Plugin.h>
 #include <s2e/Plugins/Opcodes.h>
 #include <string>
+#include <tr1/unordered_map>
 #include "ExecutionTracer.h"
 #include <s2e/Plugins/ModuleExecutionDetector.h>
 
@@ -72,6 +73,7 @@ private:
     bool m_monitorStack;
     bool m_traceHostAddresses;
     bool m_debugObjectStates;
+    bool m_batchTracing;
     uint64_t m_catchAbove;
     uint64_t m_catchBelow;
 
@@ -79,6 +81,37 @@ private:
     uint64_t m_elapsedTics;
     sigc::connection m_timerConnection;
 
+    /* Heatmap mode: per-page access counts of the current state */
+    struct HeatmapKey {
+        uint64_t pid;
+        uint64_t page;
+        uint64_t moduleBase;
+
+        bool operator==(const HeatmapKey &k) const {
+            return pid == k.pid && page == k.page && moduleBase == k.moduleBase;
+        }
+    };
+
+    struct HeatmapKeyHash {
+        size_t operator()(const HeatmapKey &k) const {
+            return (size_t) ((k.page >> 12) ^ k.pid * 0x9e3779b97f4a7c15ULL ^ k.moduleBase);
+        }
+    };
+
+    struct HeatmapCounts {
+        uint32_t reads;
+        uint32_t writes;
+    };
+
+    typedef std::tr1::unordered_map<HeatmapKey, HeatmapCounts, HeatmapKeyHash> Heatmap;
+
+    bool m_heatmap;
+    unsigned m_heatmapInterval;
+    unsigned m_heatmapMaxPages;
+    unsigned m_heatmapTics;
+    Heatmap m_heatmapPages;
+    const S2EExecutionState *m_heatmapState;
+
     sigc::connection m_memoryMonitor;
     sigc::connection m_pageFaultsMonitor;
     sigc::connection m_tlbMissesMonitor;
@@ -91,6 +124,17 @@ private:
 
     void onTimer();
 
+    void recordHeatmapAccess(S2EExecutionState *state, uint64_t pc,
+                             uint64_t address, bool isWrite);
+    void flushHeatmap();
+    void onHeatmapTimer();
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+    void onStateSwitch(S2EExecutionState *currentState,
+                       S2EExecutionState *nextState);
+    void onStateKill(S2EExecutionState *state);
+
     void enableTracing();
     void disableTracing();
     void onCustomInstruction(S2EExecutionState* state, uint64_t opcode);
@@ -101,6 +145,12 @@ private:
                                    klee::ref<klee::Expr> value,
                                    bool isWrite, bool isIO);
 
+    void onDataMemoryAccessBatch(S2EExecutionState *state,
+                                 const DataMemoryAccess *accesses,
+                                 unsigned count);
+
+    void connectMemoryMonitor();
+
     void onModuleTransition(S2EExecutionState *state,
                             const ModuleDescriptor *prevModule,
                             const ModuleDescriptor *nextModule);
@@ -0,0 +1,106 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/s2e_qemu.h>
+
+#include "MemoryUsageTracer.h"
+#include "TraceEntries.h"
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(MemoryUsageTracer, "Traces the memory used by the states", "", "ExecutionTracer");
+
+void MemoryUsageTracer::initialize()
+{
+    m_tracer = static_cast<ExecutionTracer*>(s2e()->getPlugin("ExecutionTracer"));
+
+    //In seconds, 0 only traces the forks
+    m_interval = s2e()->getConfig()->getInt(getConfigKey() + ".interval", 1);
+    m_elapsedTics = 0;
+
+    if (m_interval) {
+        s2e()->getCorePlugin()->onTimer.connect(
+                sigc::mem_fun(*this, &MemoryUsageTracer::onTimer));
+    }
+
+    if (s2e()->getConfig()->getBool(getConfigKey() + ".traceForks", true)) {
+        s2e()->getCorePlugin()->onStateFork.connect(
+                sigc::mem_fun(*this, &MemoryUsageTracer::onStateFork));
+    }
+}
+
+void MemoryUsageTracer::writeUsage(S2EExecutionState *state)
+{
+    S2EExecutionState::MemoryUsage usage;
+    state->getMemoryUsage(usage);
+
+    ExecutionTraceMemoryUsage e;
+    e.concreteBytes = usage.concreteBytes;
+    e.symbolicBytes = usage.symbolicBytes;
+    e.sharedBytes = usage.sharedBytes;
+    e.ownedObjects = usage.ownedObjects;
+    e.sharedObjects = usage.sharedObjects;
+    e.constraints = usage.constraints;
+    e.constraintNodes = usage.constraintNodes;
+    e.pluginStateBytes = usage.pluginStateBytes;
+    e.copyOnWriteBytes = state->getCopyOnWriteBytes();
+    e.stateSwitchBytes = state->getStateSwitchBytes();
+
+    m_tracer->writeData(state, &e, sizeof(e), TRACE_MEMORY_USAGE);
+}
+
+void MemoryUsageTracer::onTimer()
+{
+    if (++m_elapsedTics < m_interval || !g_s2e_state) {
+        return;
+    }
+
+    m_elapsedTics = 0;
+    writeUsage(g_s2e_state);
+}
+
+void MemoryUsageTracer::onStateFork(S2EExecutionState *state,
+                                    const std::vector<S2EExecutionState*>& newStates,
+                                    const std::vector<klee::ref<klee::Expr> >& newConditions)
+{
+    //The copy-on-write bytes are those of the path since the previous fork
+    writeUsage(state);
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,105 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/s2e_qemu.h>
+
+#include <klee/Internal/Support/PerfCounters.h>
+
+#include "PerfCounterTracer.h"
+#include "TraceEntries.h"
+
+namespace s2e {
+namespace plugins {
+
+using klee::PerfCounters;
+
+S2E_DEFINE_PLUGIN(PerfCounterTracer, "Traces hardware performance counters", "", "ExecutionTracer");
+
+void PerfCounterTracer::initialize()
+{
+    m_tracer = static_cast<ExecutionTracer*>(s2e()->getPlugin("ExecutionTracer"));
+
+    //In seconds
+    m_interval = s2e()->getConfig()->getInt(getConfigKey() + ".interval", 1);
+    m_elapsedTics = 0;
+
+    if (!PerfCounters::isEnabled()) {
+        s2e()->getWarningsStream() << "PerfCounterTracer: performance counters are disabled, "
+                                   << "run with -s2e-perf-counters" << '\n';
+        return;
+    }
+
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &PerfCounterTracer::onTimer));
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &PerfCounterTracer::onStateKill));
+}
+
+void PerfCounterTracer::writeCounters(S2EExecutionState *state)
+{
+    PerfCounters::update();
+
+    ExecutionTracePerfCounters e;
+    for (unsigned r = 0; r < EXECTRACE_PERF_REGIONS; ++r) {
+        for (unsigned c = 0; c < EXECTRACE_PERF_COUNTERS; ++c) {
+            e.values[r][c] = PerfCounters::get((PerfCounters::Region) r,
+                                               (PerfCounters::Counter) c);
+        }
+    }
+
+    m_tracer->writeData(state, &e, sizeof(e), TRACE_PERF_COUNTERS);
+}
+
+void PerfCounterTracer::onTimer()
+{
+    if (++m_elapsedTics < m_interval || !g_s2e_state) {
+        return;
+    }
+
+    m_elapsedTics = 0;
+    writeCounters(g_s2e_state);
+}
+
+void PerfCounterTracer::onStateKill(S2EExecutionState *state)
+{
+    writeCounters(state);
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,121 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <s2e/S2E.h>
+
+#include "SolverTracer.h"
+#include "TraceEntries.h"
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(SolverTracer, "Traces the constraint solver queries", "", "ExecutionTracer");
+
+void SolverTracer::initialize()
+{
+    m_tracer = static_cast<ExecutionTracer*>(s2e()->getPlugin("ExecutionTracer"));
+
+    m_state = NULL;
+    m_pc = 0;
+    m_count = 0;
+    m_usec = 0;
+
+    s2e()->getCorePlugin()->onSolverQuery.connect(
+            sigc::mem_fun(*this, &SolverTracer::onSolverQuery));
+
+    s2e()->getCorePlugin()->onStateFork.connect(
+            sigc::mem_fun(*this, &SolverTracer::onStateFork));
+
+    s2e()->getCorePlugin()->onStateSwitch.connect(
+            sigc::mem_fun(*this, &SolverTracer::onStateSwitch));
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &SolverTracer::onStateKill));
+}
+
+void SolverTracer::flush()
+{
+    if (!m_state) {
+        return;
+    }
+
+    ExecutionTraceSolverQuery e;
+    e.pc = m_pc;
+    e.count = m_count;
+    e.usec = m_usec;
+
+    m_tracer->writeData(m_state, &e, sizeof(e), TRACE_SOLVER_QUERY);
+
+    m_state = NULL;
+    m_count = 0;
+    m_usec = 0;
+}
+
+void SolverTracer::onSolverQuery(S2EExecutionState *state, uint64_t usec)
+{
+    uint64_t pc = state->getPc();
+    if (state != m_state || pc != m_pc) {
+        flush();
+        m_state = state;
+        m_pc = pc;
+    }
+
+    ++m_count;
+    m_usec += usec;
+}
+
+void SolverTracer::onStateFork(S2EExecutionState *state,
+                               const std::vector<S2EExecutionState*> &newStates,
+                               const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    //Write the cost of the fork next to it
+    flush();
+}
+
+void SolverTracer::onStateSwitch(S2EExecutionState *currentState,
+                                 S2EExecutionState *nextState)
+{
+    flush();
+}
+
+void SolverTracer::onStateKill(S2EExecutionState *state)
+{
+    if (state == m_state) {
+        flush();
+    }
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -33,15 +33,31 @@
  * All contributors are listed in the S2E-AUTHORS file.
  */
 
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
 #include <iomanip>
 #include <cctype>
+#include <cstdio>
 
 #include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
 #include <s2e/Utils.h>
 #include <s2e/S2EExecutionState.h>
 #include <s2e/S2EExecutor.h>
 #include "TestCaseGenerator.h"
 #include "ExecutionTracer.h"
+#include <s2e/Plugins/FuzzerCoverage.h>
+
+#include <klee/Internal/ADT/KTest.h>
+
+#ifndef CONFIG_WIN32
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 namespace s2e {
 namespace plugins {
@@ -53,13 +69,78 @@ TestCaseGenerator::TestCaseGenerator(S2E* s2e)
 {
     m_testIndex = 0;
     m_pathsExplored = 0;
+    m_workers = 0;
+    m_writeKTest = false;
+    m_deduplicate = false;
+    m_ktestStream = false;
+    m_skipCoveredPaths = false;
+}
+
+TestCaseGenerator::~TestCaseGenerator()
+{
+    //The tracer may already be gone, only wait for the ktest files
+    if (!m_jobs.empty()) {
+        s2e()->getWarningsStream() << "TestCaseGenerator: waiting for "
+                << m_jobs.size() << " test cases, they will not be traced" << '\n';
+    }
 
+#ifndef CONFIG_WIN32
+    foreach2(it, m_jobs.begin(), m_jobs.end()) {
+        waitpid((*it).pid, NULL, 0);
+        unlink((*it).resultFile.c_str());
+    }
+#endif
 }
 
 void TestCaseGenerator::initialize()
 {
+    ConfigFile *cfg = s2e()->getConfig();
+
+    //Solving the constraints of a killed state may take seconds.
+    //With workers, a forked child process solves them while the guest
+    //keeps running, the result is traced when the child completes.
+    m_workers = cfg->getInt(getConfigKey() + ".workers", 0);
+    m_writeKTest = cfg->getBool(getConfigKey() + ".writeKTest", false);
+
+    //Paths often end with the same inputs, especially across processes.
+    //Duplicates are detected with a hash of the concrete inputs.
+    m_deduplicate = cfg->getBool(getConfigKey() + ".deduplicate", false);
+
+    //All the processes append their ktest records to one file
+    //instead of writing one file per test case.
+    m_ktestStream = cfg->getBool(getConfigKey() + ".ktestStream", false);
+    if (m_ktestStream) {
+        m_streamFile = s2e()->getOutputDirectoryBase() + "/testcases.ktests";
+    }
+
+    //Fuzzers syncing from this directory pick up the inputs of the
+    //test cases, i.e., the concatenated values of the symbolic variables.
+    m_fuzzerQueue = cfg->getString(getConfigKey() + ".fuzzerQueue", "");
+#ifndef CONFIG_WIN32
+    if (!m_fuzzerQueue.empty()) {
+        mkdir(m_fuzzerQueue.c_str(), 0755);
+    }
+#endif
+
+    //Paths that only covered edges already in the bitmap of FuzzerCoverage,
+    //e.g., because the fuzzer got there first, are not worth solving.
+    m_skipCoveredPaths = cfg->getBool(getConfigKey() + ".skipCoveredPaths", false);
+    if (m_skipCoveredPaths && !s2e()->getPlugin("FuzzerCoverage")) {
+        s2e()->getWarningsStream() << "TestCaseGenerator: skipCoveredPaths requires FuzzerCoverage" << '\n';
+        exit(-1);
+    }
+
+#ifdef CONFIG_WIN32
+    m_workers = 0;
+#endif
+
     s2e()->getCorePlugin()->onTestCaseGeneration.connect(
             sigc::mem_fun(*this, &TestCaseGenerator::onTestCaseGeneration));
+
+    if (m_workers) {
+        s2e()->getCorePlugin()->onTimer.connect(
+                sigc::mem_fun(*this, &TestCaseGenerator::onTimer));
+    }
 }
 
 
@@ -70,6 +151,22 @@ void TestCaseGenerator::onTestCaseGeneration(S2EExecutionState *state, const std
             << " at address " << hexval(state->getPc())
             << '\n';
 
+    if (m_skipCoveredPaths) {
+        FuzzerCoverage *coverage = static_cast<FuzzerCoverage*>(s2e()->getPlugin("FuzzerCoverage"));
+        if (!coverage->hasNewCoverage(state)) {
+            s2e()->getMessagesStream() << "TestCaseGenerator: state " << state->getID()
+                    << " did not cover new edges" << '\n';
+            return;
+        }
+    }
+
+    if (m_workers) {
+        reapJobs(false);
+        if (startJob(state)) {
+            return;
+        }
+    }
+
     ConcreteInputs out;
     bool success = s2e()->getExecutor()->getSymbolicSolution(*state, out);
 
@@ -84,13 +181,293 @@ void TestCaseGenerator::onTestCaseGeneration(S2EExecutionState *state, const std
     }
 #endif
 
+    uint64_t hash = hashInputs(out);
+    if (!registerInputs(hash)) {
+        s2e()->getMessagesStream() << "TestCaseGenerator: test case of state "
+                << state->getID() << " is a duplicate" << '\n';
+        return;
+    }
+
+    if (m_writeKTest || m_ktestStream) {
+        writeKTest(out, m_testIndex++, hash);
+    }
+
+    if (!m_fuzzerQueue.empty()) {
+        writeQueueEntry(out);
+    }
+
+    writeTestCase(state->getID(), state->getPid(), out);
+}
+
+void TestCaseGenerator::onTimer()
+{
+    reapJobs(false);
+}
+
+std::string TestCaseGenerator::getKTestFilename(unsigned index)
+{
+    std::stringstream ss;
+    ss << "test" << std::setfill('0') << std::setw(6) << index << ".ktest";
+    return s2e()->getOutputFilename(ss.str());
+}
+
+uint64_t TestCaseGenerator::hashInputs(const ConcreteInputs &inputs)
+{
+    //FNV-1a over the names, sizes and values
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    foreach2(it, inputs.begin(), inputs.end()) {
+        const std::string &name = (*it).first;
+        const std::vector<unsigned char> &value = (*it).second;
+
+        for (unsigned i = 0; i <= name.size(); ++i) {
+            hash = (hash ^ (uint8_t) name.c_str()[i]) * 0x100000001b3ULL;
+        }
+        for (unsigned i = 0; i < sizeof(uint32_t); ++i) {
+            hash = (hash ^ (uint8_t) (value.size() >> (i * 8))) * 0x100000001b3ULL;
+        }
+        for (unsigned i = 0; i < value.size(); ++i) {
+            hash = (hash ^ value[i]) * 0x100000001b3ULL;
+        }
+    }
+
+    //Zero marks the free slots of the shared table
+    return hash ? hash : 1;
+}
+
+bool TestCaseGenerator::registerInputs(uint64_t hash)
+{
+    if (!m_deduplicate) {
+        return true;
+    }
+
+    TestCaseGeneratorShared *shared = m_shared.acquire();
+
+    //Open addressing, the table is never cleared
+    unsigned mask = TestCaseGeneratorShared::MaxHashes - 1;
+    unsigned slot = (unsigned) (hash ^ (hash >> 32)) & mask;
+    bool isNew = true;
+
+    while (shared->hashes[slot]) {
+        if (shared->hashes[slot] == hash) {
+            isNew = false;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (!isNew) {
+        ++shared->duplicates;
+    } else if (shared->count < TestCaseGeneratorShared::MaxHashes / 2) {
+        //Past half full, new test cases are kept without being remembered
+        shared->hashes[slot] = hash;
+        ++shared->count;
+    }
+
+    m_shared.release();
+    return isNew;
+}
+
+bool TestCaseGenerator::writeKTest(const ConcreteInputs &inputs, unsigned index, uint64_t hash)
+{
+    KTest ktest;
+    ktest.version = kTest_getCurrentVersion();
+    ktest.numArgs = 0;
+    ktest.args = NULL;
+    ktest.symArgvs = 0;
+    ktest.symArgvLen = 0;
+    ktest.numObjects = inputs.size();
+    ktest.objects = new KTestObject[inputs.size()];
+
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+        KTestObject &o = ktest.objects[i];
+        o.name = const_cast<char*>(inputs[i].first.c_str());
+        o.numBytes = inputs[i].second.size();
+        o.bytes = const_cast<unsigned char*>(o.numBytes ? &inputs[i].second[0] : NULL);
+    }
+
+    bool ok = true;
+    if (m_writeKTest) {
+        std::string fileName = getKTestFilename(index);
+        if (!kTest_toFile(&ktest, fileName.c_str())) {
+            s2e()->getWarningsStream() << "TestCaseGenerator: could not write " << fileName << '\n';
+            ok = false;
+        }
+    }
+
+    if (m_ktestStream && !kTest_appendToStream(&ktest, hash, m_streamFile.c_str())) {
+        s2e()->getWarningsStream() << "TestCaseGenerator: could not append to " << m_streamFile << '\n';
+        ok = false;
+    }
+
+    delete [] ktest.objects;
+    return ok;
+}
+
+bool TestCaseGenerator::writeQueueEntry(const ConcreteInputs &inputs)
+{
+    //AFL only syncs the files named id:NNNNNN, the numbers must be unique
+    //across the processes
+    TestCaseGeneratorShared *shared = m_shared.acquire();
+    unsigned index = shared->queued++;
+    m_shared.release();
+
+    std::stringstream ss;
+    ss << m_fuzzerQueue << "/id:" << std::setfill('0') << std::setw(6) << index
+       << ",src:s2e";
+    std::string fileName = ss.str();
+
+    FILE *fp = fopen(fileName.c_str(), "wb");
+    bool ok = fp != NULL;
+    foreach2(it, inputs.begin(), inputs.end()) {
+        const std::vector<unsigned char> &value = (*it).second;
+        if (ok && !value.empty()) {
+            ok = fwrite(&value[0], value.size(), 1, fp) == 1;
+        }
+    }
+    ok = fp && !fclose(fp) && ok;
+
+    if (!ok) {
+        s2e()->getWarningsStream() << "TestCaseGenerator: could not write " << fileName << '\n';
+    }
+    return ok;
+}
+
+bool TestCaseGenerator::startJob(S2EExecutionState *state)
+{
+#ifdef CONFIG_WIN32
+    return false;
+#else
+    //Wait for the oldest job when all the workers are busy
+    while (m_jobs.size() >= m_workers) {
+        int status;
+        Job job = m_jobs.front();
+        m_jobs.erase(m_jobs.begin());
+        waitpid(job.pid, &status, 0);
+        finishJob(job, WIFEXITED(status) ? WEXITSTATUS(status) : JOB_FAILED);
+    }
+
+    unsigned index = m_testIndex++;
+
+    std::stringstream ss;
+    ss << "testcase-" << index << ".tmp";
+
+    Job job;
+    job.stateId = state->getID();
+    job.statePid = state->getPid();
+    job.resultFile = s2e()->getOutputFilename(ss.str());
+
+    //Flush the buffered output, the child would write it again
+    s2e()->getMessagesStream().flush();
+    s2e()->getWarningsStream().flush();
+
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        --m_testIndex;
+        return false;
+    }
+
+    if (pid == 0) {
+        //The child only solves and exits without running any destructor
+        ConcreteInputs out;
+        if (!s2e()->getExecutor()->getSymbolicSolution(*state, out)) {
+            _exit(JOB_FAILED);
+        }
+
+        //The shared table is visible to the parent as well
+        uint64_t hash = hashInputs(out);
+        if (!registerInputs(hash)) {
+            _exit(JOB_DUPLICATE);
+        }
+
+        if (m_writeKTest || m_ktestStream) {
+            writeKTest(out, index, hash);
+        }
+
+        if (!m_fuzzerQueue.empty()) {
+            writeQueueEntry(out);
+        }
+
+        unsigned bufsize;
+        ExecutionTraceTestCase *tc = ExecutionTraceTestCase::serialize(&bufsize, out);
+        FILE *fp = fopen(job.resultFile.c_str(), "wb");
+        bool ok = fp && (bufsize == 0 || fwrite(tc, bufsize, 1, fp) == 1);
+        ok = fp && !fclose(fp) && ok;
+        _exit(ok ? JOB_SOLVED : JOB_FAILED);
+    }
+
+    job.pid = pid;
+    m_jobs.push_back(job);
+    return true;
+#endif
+}
+
+void TestCaseGenerator::reapJobs(bool wait)
+{
+#ifndef CONFIG_WIN32
+    Jobs::iterator it = m_jobs.begin();
+    while (it != m_jobs.end()) {
+        int status;
+        if (waitpid((*it).pid, &status, wait ? 0 : WNOHANG) != (*it).pid) {
+            ++it;
+            continue;
+        }
+
+        Job job = *it;
+        it = m_jobs.erase(it);
+        finishJob(job, WIFEXITED(status) ? WEXITSTATUS(status) : JOB_FAILED);
+    }
+#endif
+}
+
+void TestCaseGenerator::finishJob(const Job &job, int result)
+{
+    ConcreteInputs out;
+
+    if (result == JOB_DUPLICATE) {
+        s2e()->getMessagesStream() << "TestCaseGenerator: test case of state "
+                << job.stateId << " is a duplicate" << '\n';
+        return;
+    }
+
+    FILE *fp = result == JOB_SOLVED ? fopen(job.resultFile.c_str(), "rb") : NULL;
+    if (fp) {
+        std::vector<uint8_t> buffer;
+        uint8_t chunk[4096];
+        size_t read;
+        while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+            buffer.insert(buffer.end(), chunk, chunk + read);
+        }
+        fclose(fp);
+
+        if (!buffer.empty()) {
+            ExecutionTraceTestCase::deserialize(&buffer[0], buffer.size(), out);
+        }
+    }
+
+    unlink(job.resultFile.c_str());
+
+    if (!fp) {
+        s2e()->getWarningsStream() << "Could not get symbolic solutions for state "
+                << job.stateId << '\n';
+        return;
+    }
+
+    s2e()->getMessagesStream() << "TestCaseGenerator: solved test case of state "
+            << job.stateId << '\n';
+
+    writeTestCase(job.stateId, job.statePid, out);
+}
+
+void TestCaseGenerator::writeTestCase(uint32_t stateId, uint64_t statePid,
+                                      const ConcreteInputs &out)
+{
     s2e()->getMessagesStream() << '\n';
 
     ExecutionTracer *tracer = (ExecutionTracer*)s2e()->getPlugin("ExecutionTracer");
     assert(tracer);
 
     std::stringstream ss;
-    ConcreteInputs::iterator it;
+    ConcreteInputs::const_iterator it;
     for (it = out.begin(); it != out.end(); ++it) {
         const VarValuePair &vp = *it;
         ss << std::setw(20) << vp.first << ": ";
@@ -123,7 +500,7 @@ void TestCaseGenerator::onTestCaseGeneration(S2EExecutionState *state, const std
 
     unsigned bufsize;
     ExecutionTraceTestCase *tc = ExecutionTraceTestCase::serialize(&bufsize, out);
-    tracer->writeData(state, tc, bufsize, TRACE_TESTCASE);
+    tracer->writeData(stateId, statePid, tc, bufsize, TRACE_TESTCASE);
     ExecutionTraceTestCase::deallocate(tc);
 }
 
@@ -37,11 +37,35 @@
 #define S2E_PLUGINS_TCGEN_H
 
 #include <s2e/Plugin.h>
+#include <s2e/Synchronization.h>
+#include <cstring>
 #include <string>
+#include <vector>
+
+#include <sys/types.h>
 
 namespace s2e{
 namespace plugins{
 
+//Hashes of the test cases recorded by all S2E processes
+struct TestCaseGeneratorShared {
+    static const unsigned MaxHashes = 1 << 16;
+
+    unsigned count;
+    uint64_t duplicates;
+    uint64_t hashes[MaxHashes];
+
+    //Number of inputs written to the fuzzer queue
+    unsigned queued;
+
+    TestCaseGeneratorShared() {
+        count = 0;
+        duplicates = 0;
+        queued = 0;
+        memset(hashes, 0, sizeof(hashes));
+    }
+};
+
 /** Handler required for KLEE interpreter */
 class TestCaseGenerator : public Plugin
 {
@@ -54,13 +78,59 @@ private:
     unsigned m_testIndex;  // number of tests written so far
     unsigned m_pathsExplored; // number of paths explored so far
 
+    //Test case solved by a child process. The state is gone by the time
+    //the solution is available, only its identifiers are kept.
+    struct Job {
+        pid_t pid;
+        uint32_t stateId;
+        uint64_t statePid;
+        std::string resultFile;
+    };
+
+    typedef std::vector<Job> Jobs;
+
+    enum JobResult {
+        JOB_SOLVED = 0, JOB_FAILED = 1, JOB_DUPLICATE = 2
+    };
+
+    //Maximum number of solver processes, 0 to solve synchronously
+    unsigned m_workers;
+    bool m_writeKTest;
+    Jobs m_jobs;
+
+    //Drop test cases whose inputs were already recorded by any process
+    bool m_deduplicate;
+    //Append the test cases to a stream shared by all processes
+    bool m_ktestStream;
+    std::string m_streamFile;
+
+    //Directory where the inputs are written as AFL queue entries
+    std::string m_fuzzerQueue;
+    //Drop the paths that did not set new FuzzerCoverage bitmap entries
+    bool m_skipCoveredPaths;
+    S2ESynchronizedObject<TestCaseGeneratorShared> m_shared;
+
 public:
     TestCaseGenerator(S2E* s2e);
+    ~TestCaseGenerator();
 
     void initialize();
 
 private:
     void onTestCaseGeneration(S2EExecutionState *state, const std::string &message);
+    void onTimer();
+
+    bool startJob(S2EExecutionState *state);
+    void reapJobs(bool wait);
+    void finishJob(const Job &job, int result);
+
+    static uint64_t hashInputs(const ConcreteInputs &inputs);
+    bool registerInputs(uint64_t hash);
+
+    std::string getKTestFilename(unsigned index);
+    bool writeKTest(const ConcreteInputs &inputs, unsigned index, uint64_t hash);
+    bool writeQueueEntry(const ConcreteInputs &inputs);
+    void writeTestCase(uint32_t stateId, uint64_t statePid, const ConcreteInputs &inputs);
 };
 
 
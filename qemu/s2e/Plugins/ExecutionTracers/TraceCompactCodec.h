@@ -0,0 +1,367 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_TRACECOMPACTCODEC_H
+#define S2E_PLUGINS_TRACECOMPACTCODEC_H
+
+#include <stddef.h>
+#include <map>
+#include <vector>
+#include "TraceEntries.h"
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Encoding of the items of compact traces, shared by ExecutionTracer
+ *  and LogParser. Both sides see the same items in the same order
+ *  and keep the same context, so an item can refer to earlier ones.
+ *
+ *  Each item starts with its type, the state id, then the pid and the
+ *  time stamp as differences with the previous item of the same state,
+ *  and the size of the original payload. Translation blocks and memory
+ *  accesses store their program counters relative to the module that
+ *  contains them (identified by the index of its TRACE_MOD_LOAD item)
+ *  or to the previous item of the state, and their addresses and registers
+ *  as differences with the previous item. Other payloads are copied as is.
+ *  All the integers are variable-length.
+ */
+class ExecutionTraceCompactCodec
+{
+    struct StreamState {
+        uint64_t timeStamp;
+        uint64_t pid;
+        uint64_t pc;
+        uint64_t address;
+        uint64_t hostAddress;
+        uint64_t registers[8];
+        StreamState() { memset(this, 0, sizeof(*this)); }
+    };
+
+    struct Module {
+        uint64_t size;
+        uint32_t id;
+    };
+
+    //Modules of each pid, by load base
+    typedef std::map<uint64_t, Module> ModuleMap;
+    std::map<uint64_t, ModuleMap> m_modules;
+    std::map<uint32_t, uint64_t> m_moduleBases;
+    uint32_t m_moduleLoads;
+
+    std::map<uint32_t, StreamState> m_streams;
+
+    /* Variable-length integers */
+
+    static void putUInt(std::vector<uint8_t> &out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(value);
+    }
+
+    static void putDelta(std::vector<uint8_t> &out, uint64_t value, uint64_t previous) {
+        int64_t delta = value - previous;
+        putUInt(out, (delta << 1) ^ (delta >> 63));
+    }
+
+    struct Reader {
+        const uint8_t *ptr, *end;
+        bool ok;
+
+        uint64_t getUInt() {
+            uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7) {
+                if (ptr == end) {
+                    ok = false;
+                    return 0;
+                }
+                uint8_t b = *ptr++;
+                value |= (uint64_t) (b & 0x7f) << shift;
+                if (!(b & 0x80)) {
+                    return value;
+                }
+            }
+            ok = false;
+            return 0;
+        }
+
+        uint64_t getDelta(uint64_t previous) {
+            uint64_t zz = getUInt();
+            return previous + ((zz >> 1) ^ -(zz & 1));
+        }
+
+        uint8_t getByte() {
+            if (ptr == end) {
+                ok = false;
+                return 0;
+            }
+            return *ptr++;
+        }
+
+        void getBytes(void *data, unsigned size) {
+            if ((unsigned) (end - ptr) < size) {
+                ok = false;
+                return;
+            }
+            memcpy(data, ptr, size);
+            ptr += size;
+        }
+    };
+
+    const ModuleMap::value_type *findModule(uint64_t pid, uint64_t pc) const {
+        std::map<uint64_t, ModuleMap>::const_iterator it = m_modules.find(pid);
+        if (it == m_modules.end()) {
+            return NULL;
+        }
+
+        ModuleMap::const_iterator mit = it->second.upper_bound(pc);
+        if (mit == it->second.begin()) {
+            return NULL;
+        }
+        --mit;
+        return pc - mit->first < mit->second.size ? &*mit : NULL;
+    }
+
+    void addModule(const ExecutionTraceItemHeader &hdr, const void *data) {
+        uint32_t id = m_moduleLoads++;
+        if (hdr.size < sizeof(ExecutionTraceModuleLoad)) {
+            return;
+        }
+
+        ExecutionTraceModuleLoad load;
+        memcpy(&load, data, sizeof(load));
+        Module m = {load.size, id};
+        m_modules[hdr.pid][load.loadBase] = m;
+        m_moduleBases[id] = load.loadBase;
+    }
+
+    static bool isTb(const ExecutionTraceItemHeader &hdr) {
+        return (hdr.type == TRACE_TB_START || hdr.type == TRACE_TB_END) &&
+               hdr.size == sizeof(ExecutionTraceTb);
+    }
+
+    static bool isMemory(const ExecutionTraceItemHeader &hdr) {
+        return hdr.type == TRACE_MEMORY &&
+               hdr.size >= offsetof(ExecutionTraceMemory, hostAddress) &&
+               hdr.size <= sizeof(ExecutionTraceMemory);
+    }
+
+    void encodeTb(StreamState &s, uint64_t pid, const void *data, std::vector<uint8_t> &out) {
+        ExecutionTraceTb tb;
+        memcpy(&tb, data, sizeof(tb));
+
+        const ModuleMap::value_type *m = findModule(pid, tb.pc);
+        if (m) {
+            putUInt(out, m->second.id + 1);
+            putUInt(out, tb.pc - m->first);
+        } else {
+            putUInt(out, 0);
+            putDelta(out, tb.pc, s.pc);
+        }
+        putDelta(out, tb.targetPc, tb.pc);
+        putUInt(out, tb.size);
+        out.push_back(tb.tbType);
+        out.push_back(tb.symbMask);
+        for (unsigned i = 0; i < 8; ++i) {
+            putDelta(out, tb.registers[i], s.registers[i]);
+            s.registers[i] = tb.registers[i];
+        }
+        s.pc = tb.pc;
+    }
+
+    void decodeTb(StreamState &s, Reader &r, void *data) {
+        ExecutionTraceTb tb;
+
+        uint64_t module = r.getUInt();
+        if (module) {
+            uint64_t offset = r.getUInt();
+            std::map<uint32_t, uint64_t>::const_iterator it = m_moduleBases.find(module - 1);
+            if (it == m_moduleBases.end()) {
+                r.ok = false;
+                return;
+            }
+            tb.pc = it->second + offset;
+        } else {
+            tb.pc = r.getDelta(s.pc);
+        }
+        tb.targetPc = r.getDelta(tb.pc);
+        tb.size = r.getUInt();
+        tb.tbType = r.getByte();
+        tb.symbMask = r.getByte();
+        for (unsigned i = 0; i < 8; ++i) {
+            tb.registers[i] = r.getDelta(s.registers[i]);
+            s.registers[i] = tb.registers[i];
+        }
+        s.pc = tb.pc;
+
+        memcpy(data, &tb, sizeof(tb));
+    }
+
+    void encodeMemory(StreamState &s, unsigned size, const void *data, std::vector<uint8_t> &out) {
+        ExecutionTraceMemory e;
+        memset(&e, 0, sizeof(e));
+        memcpy(&e, data, size);
+
+        putDelta(out, e.pc, s.pc);
+        putDelta(out, e.address, s.address);
+        putUInt(out, e.value);
+        out.push_back(e.size);
+        out.push_back(e.flags);
+        if (size > offsetof(ExecutionTraceMemory, hostAddress)) {
+            putDelta(out, e.hostAddress, s.hostAddress);
+            s.hostAddress = e.hostAddress;
+        }
+        if (size > offsetof(ExecutionTraceMemory, concreteBuffer)) {
+            putUInt(out, e.concreteBuffer);
+        }
+        s.pc = e.pc;
+        s.address = e.address;
+    }
+
+    void decodeMemory(StreamState &s, Reader &r, unsigned size, void *data) {
+        ExecutionTraceMemory e;
+        memset(&e, 0, sizeof(e));
+
+        e.pc = r.getDelta(s.pc);
+        e.address = r.getDelta(s.address);
+        e.value = r.getUInt();
+        e.size = r.getByte();
+        e.flags = r.getByte();
+        if (size > offsetof(ExecutionTraceMemory, hostAddress)) {
+            e.hostAddress = r.getDelta(s.hostAddress);
+            s.hostAddress = e.hostAddress;
+        }
+        if (size > offsetof(ExecutionTraceMemory, concreteBuffer)) {
+            e.concreteBuffer = r.getUInt();
+        }
+        s.pc = e.pc;
+        s.address = e.address;
+
+        memcpy(data, &e, size);
+    }
+
+public:
+    ExecutionTraceCompactCodec() : m_moduleLoads(0) {}
+
+    /** Upper bound of the encoded size of an item with the given payload size */
+    static unsigned getMaxEncodedSize(unsigned size) {
+        return sizeof(ExecutionTraceItemHeader) * 2 + size * 2 + 16;
+    }
+
+    /** Appends the encoded item to out */
+    void encode(const ExecutionTraceItemHeader &hdr, const void *data, std::vector<uint8_t> &out) {
+        StreamState &s = m_streams[hdr.stateId];
+
+        out.push_back(hdr.type);
+        putUInt(out, hdr.stateId);
+        putDelta(out, hdr.pid, s.pid);
+        putDelta(out, hdr.timeStamp, s.timeStamp);
+        putUInt(out, hdr.size);
+        s.pid = hdr.pid;
+        s.timeStamp = hdr.timeStamp;
+
+        if (isTb(hdr)) {
+            encodeTb(s, hdr.pid, data, out);
+        } else if (isMemory(hdr)) {
+            encodeMemory(s, hdr.size, data, out);
+        } else {
+            const uint8_t *bytes = (const uint8_t*) data;
+            out.insert(out.end(), bytes, bytes + hdr.size);
+        }
+
+        if (hdr.type == TRACE_MOD_LOAD) {
+            addModule(hdr, data);
+        }
+    }
+
+    /**
+     *  Decodes the item at in and appends it to out in the usual format.
+     *  Returns the number of bytes consumed, 0 if the item is truncated
+     *  or refers to an unknown module.
+     */
+    unsigned decode(const uint8_t *in, uint64_t size, std::vector<uint8_t> &out) {
+        Reader r = {in, in + size, true};
+
+        ExecutionTraceItemHeader hdr;
+        hdr.type = r.getByte();
+        hdr.stateId = r.getUInt();
+
+        StreamState &s = m_streams[hdr.stateId];
+        hdr.pid = r.getDelta(s.pid);
+        hdr.timeStamp = r.getDelta(s.timeStamp);
+        hdr.size = r.getUInt();
+        if (!r.ok) {
+            return 0;
+        }
+
+        bool raw = !isTb(hdr) && !isMemory(hdr);
+        if (raw && hdr.size > (uint64_t) (r.end - r.ptr)) {
+            return 0;
+        }
+        s.pid = hdr.pid;
+        s.timeStamp = hdr.timeStamp;
+
+        unsigned position = out.size();
+        out.resize(position + sizeof(hdr) + hdr.size);
+        memcpy(&out[position], &hdr, sizeof(hdr));
+        uint8_t *data = &out[position + sizeof(hdr)];
+
+        if (raw) {
+            r.getBytes(data, hdr.size);
+        } else if (isTb(hdr)) {
+            decodeTb(s, r, data);
+        } else {
+            decodeMemory(s, r, hdr.size, data);
+        }
+
+        if (!r.ok) {
+            out.resize(position);
+            return 0;
+        }
+
+        if (hdr.type == TRACE_MOD_LOAD) {
+            addModule(hdr, data);
+        }
+
+        return r.ptr - in;
+    }
+};
+
+}
+}
+
+#endif
@@ -73,6 +73,12 @@ enum ExecTraceEntryType {
     TRACE_MEM_CHECKER,
     TRACE_EXCEPTION,
     TRACE_STATE_SWITCH,
+    TRACE_PERF_COUNTERS,
+    TRACE_ICOUNT_SHARDS,
+    TRACE_TSC_CALIBRATION,
+    TRACE_SOLVER_QUERY,
+    TRACE_MEMORY_USAGE,
+    TRACE_MEMORY_HEATMAP,
     TRACE_MAX
 };
 
@@ -127,7 +133,8 @@ struct ExecutionTraceBranchCoverage {
 enum CacheSimDescType{
     CACHE_PARAMS=0,
     CACHE_NAME,
-    CACHE_ENTRY
+    CACHE_ENTRY,
+    CACHE_ACCESSES
 };
 
 struct ExecutionTraceCacheSimParams {
@@ -175,11 +182,33 @@ struct ExecutionTraceCacheSimEntry {
     //XXX: should find a compact way of encoding caches.
 }__attribute__((packed));
 
+#define CACHESIM_ACCESS_WRITE 1
+#define CACHESIM_ACCESS_CODE  2
+
+//Raw access recorded for offline replay, before any cache is simulated
+struct ExecutionTraceCacheSimAccess {
+    uint64_t pc, address;
+    uint16_t size;
+    uint8_t flags;
+}__attribute__((packed));
+
+struct ExecutionTraceCacheSimAccesses {
+    uint8_t type;
+    uint32_t count;
+    ExecutionTraceCacheSimAccess accesses[1];
+
+    static unsigned getSize(unsigned count) {
+        return sizeof(ExecutionTraceCacheSimAccesses) +
+               (count - 1) * sizeof(ExecutionTraceCacheSimAccess);
+    }
+}__attribute__((packed));
+
 union ExecutionTraceCache {
     uint8_t type;
     ExecutionTraceCacheSimParams params;
     ExecutionTraceCacheSimName name;
     ExecutionTraceCacheSimEntry entry;
+    ExecutionTraceCacheSimAccesses accesses;
 }__attribute__((packed));
 
 struct ExecutionTraceMemChecker
@@ -336,6 +365,25 @@ struct ExecutionTraceICount
     uint64_t count;
 }__attribute__((packed));
 
+//Instructions executed so far in one module.
+//An empty name stands for code outside of any module.
+struct ExecutionTraceICountShard
+{
+    char module[32];
+    uint64_t count;
+}__attribute__((packed));
+
+struct ExecutionTraceICountShards
+{
+    uint32_t count;
+    ExecutionTraceICountShard shards[1];
+
+    static unsigned getSize(unsigned count) {
+        return sizeof(ExecutionTraceICountShards) +
+               (count - 1) * sizeof(ExecutionTraceICountShard);
+    }
+}__attribute__((packed));
+
 //XXX: Avoid hard-coded registers
 //XXX: Extend to other kinds of registers
 struct ExecutionTraceTb
@@ -397,6 +445,163 @@ struct ExecutionTraceStateSwitch {
     uint32_t newStateId;
 }__attribute__((packed));
 
+/**
+ *  Written at the start of the trace and then every second when the
+ *  item time stamps are time stamp counter values (tscTimeStamps option).
+ *  A time stamp t converts to microseconds since the epoch with
+ *  usec + (t - tsc) * 1000000 / ticksPerSecond.
+ */
+struct ExecutionTraceTscCalibration {
+    uint64_t tsc;
+    uint64_t usec;
+    uint64_t ticksPerSecond;
+}__attribute__((packed));
+
+/**
+ *  Constraint solver queries issued in a row by a state at the same
+ *  program counter, e.g., when forking or concretizing an expression.
+ */
+struct ExecutionTraceSolverQuery {
+    uint64_t pc;
+    uint32_t count;
+    //Total solving time, in microseconds
+    uint64_t usec;
+}__attribute__((packed));
+
+/**
+ *  Memory used by a state, see S2EExecutionState::getMemoryUsage().
+ *  Written by the MemoryUsageTracer plugin.
+ */
+struct ExecutionTraceMemoryUsage {
+    uint64_t concreteBytes;
+    uint64_t symbolicBytes;
+    uint64_t sharedBytes;
+    uint32_t ownedObjects;
+    uint32_t sharedObjects;
+    uint32_t constraints;
+    uint64_t constraintNodes;
+    uint64_t pluginStateBytes;
+    //Bytes copied on write since the last fork of the state
+    uint64_t copyOnWriteBytes;
+    //Bytes copied by the last switch to the state
+    uint64_t stateSwitchBytes;
+}__attribute__((packed));
+
+/**
+ *  Accesses to one page, see ExecutionTraceMemoryHeatmap.
+ *  moduleBase is the load base of the module whose code accessed
+ *  the page, 0 if the code is not in a tracked module.
+ */
+struct ExecutionTraceMemoryHeatmapEntry {
+    uint64_t pid;
+    uint64_t page;
+    uint64_t moduleBase;
+    uint32_t reads;
+    uint32_t writes;
+}__attribute__((packed));
+
+/**
+ *  Read and write counts of the pages that a state accessed since
+ *  its previous heatmap item. Written by MemoryTracer in heatmap mode
+ *  instead of one TRACE_MEMORY item per access.
+ */
+struct ExecutionTraceMemoryHeatmap {
+    uint32_t pageSize;
+    uint32_t count;
+    ExecutionTraceMemoryHeatmapEntry entries[1];
+
+    static unsigned getSize(unsigned count) {
+        return sizeof(ExecutionTraceMemoryHeatmap) +
+               (count - 1) * sizeof(ExecutionTraceMemoryHeatmapEntry);
+    }
+}__attribute__((packed));
+
+//Totals since the start, indexed like klee::PerfCounters
+#define EXECTRACE_PERF_REGIONS 4
+#define EXECTRACE_PERF_COUNTERS 4
+struct ExecutionTracePerfCounters {
+    uint64_t values[EXECTRACE_PERF_REGIONS][EXECTRACE_PERF_COUNTERS];
+}__attribute__((packed));
+
+/**
+ *  Records of the HostProfiler output file. The file starts with
+ *  a header, followed by samples of variable size.
+ */
+#define HOSTPROFILE_MAGIC "S2EHPROF"
+struct HostProfileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t frequency;  //Samples per second of CPU time
+}__attribute__((packed));
+
+struct HostProfileSample {
+    uint64_t guestPc;
+    uint32_t stateId;
+    uint8_t mode;        //klee::PerfCounters::Region
+    uint8_t frameCount;
+    //Host return addresses, innermost first
+    uint64_t frames[1];
+
+    static unsigned getSize(unsigned frameCount) {
+        return sizeof(HostProfileSample) + (frameCount - 1) * sizeof(uint64_t);
+    }
+}__attribute__((packed));
+
+/**
+ *  Entry of the ExecutionTracer.dat.idx sidecar file.
+ *  Each entry covers a contiguous run of items of the same state.
+ *  Entries start on item boundaries, so that analysis tools can
+ *  seek to them directly and parse them independently.
+ */
+struct ExecutionTraceIndexEntry {
+    uint64_t offset;     //Offset of the first item in the trace file
+    uint64_t size;       //Number of bytes covered, including headers
+    uint64_t timeStamp;  //Time stamp of the first item
+    uint64_t typeMask;   //Bit n is set if the run contains items of type n
+    uint32_t itemCount;
+    uint32_t stateId;
+}__attribute__((packed));
+
+/**
+ *  Compressed trace container (see the compression option of ExecutionTracer).
+ *  The file starts with an ExecutionTraceChunkedHeader, followed by chunks.
+ *  Each chunk is an ExecutionTraceChunkHeader followed by compressedSize
+ *  bytes of zlib data. Once inflated, a chunk holds size bytes of
+ *  complete items in the usual format. Readers can walk the chunk
+ *  headers and only inflate the chunks that match their filters.
+ */
+#define EXECTRACE_CHUNKED_MAGIC "S2ETRCZ1"
+#define EXECTRACE_CHUNKED_VERSION 1
+
+struct ExecutionTraceChunkedHeader {
+    char magic[8];
+    uint32_t version;
+}__attribute__((packed));
+
+/**
+ *  Compact trace (see the compactEncoding option of ExecutionTracer).
+ *  The file starts with an ExecutionTraceCompactHeader, followed by
+ *  items encoded by ExecutionTraceCompactCodec (TraceCompactCodec.h).
+ */
+#define EXECTRACE_COMPACT_MAGIC "S2ETRCV1"
+#define EXECTRACE_COMPACT_VERSION 1
+
+struct ExecutionTraceCompactHeader {
+    char magic[8];
+    uint32_t version;
+}__attribute__((packed));
+
+struct ExecutionTraceChunkHeader {
+    uint32_t compressedSize;
+    uint32_t size;
+    uint32_t itemCount;
+    uint32_t minStateId;
+    uint32_t maxStateId;
+    uint64_t typeMask;        //Bit n is set if the chunk contains items of type n
+    uint64_t firstTimeStamp;
+    uint64_t lastTimeStamp;
+}__attribute__((packed));
+
 union ExecutionTraceAll {
     ExecutionTraceModuleLoad moduleLoad;
     ExecutionTraceModuleUnload moduleUnload;
@@ -70,7 +70,7 @@ void TranslationBlockTracer::initialize()
     m_flushTbOnChange = s2e()->getConfig()->getBool(getConfigKey() + ".flushTbCache", true);
 
     if (manualTrigger) {
-        s2e()->getCorePlugin()->onCustomInstruction.connect(
+        s2e()->getCorePlugin()->getCustomInstructionSignal(TB_TRACER_OPCODE).connect(
                 sigc::mem_fun(*this, &TranslationBlockTracer::onCustomInstruction));
     }else {
         enableTracing();
@@ -0,0 +1,114 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include "config.h"
+#include "cpu.h"
+#include "qemu-common.h"
+extern CPUArchState *env;
+}
+
+#include "FastForward.h"
+#include <s2e/S2E.h>
+#include <s2e/S2EExecutor.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <llvm/Support/TimeValue.h>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(FastForward, "Runs concrete code without instrumentation until the first symbolic point", "",);
+
+void FastForward::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    m_maxTime = cfg->getInt(getConfigKey() + ".maxTime", 0);
+    bool stopOnCustomInstruction =
+            cfg->getBool(getConfigKey() + ".stopOnCustomInstruction", true);
+
+    if (stopOnCustomInstruction) {
+        s2e()->getCorePlugin()->onCustomInstruction.connect(
+                sigc::mem_fun(*this, &FastForward::onCustomInstruction));
+    }
+
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &FastForward::onTimer));
+
+    m_startTime = llvm::sys::TimeValue::now().seconds();
+    m_fastForwarding = true;
+    s2e()->getCorePlugin()->setInstrumentationEnabled(false);
+}
+
+void FastForward::stopFastForward(const char *reason)
+{
+    if (!m_fastForwarding) {
+        return;
+    }
+
+    m_fastForwarding = false;
+    s2e()->getCorePlugin()->setInstrumentationEnabled(true);
+
+    //The blocks translated so far do not call any plugin
+    tb_flush(env);
+
+    s2e()->getMessagesStream() << "FastForward: instrumentation enabled " << reason
+            << " after " << (llvm::sys::TimeValue::now().seconds() - m_startTime)
+            << " seconds" << '\n';
+}
+
+void FastForward::onCustomInstruction(S2EExecutionState* state, uint64_t opcode)
+{
+    stopFastForward("at the first custom instruction");
+}
+
+void FastForward::onTimer()
+{
+    if (!m_fastForwarding) {
+        return;
+    }
+
+    if (s2e()->getExecutor()->getStatesCount() > 1) {
+        stopFastForward("at the first fork");
+    } else if (m_maxTime &&
+               llvm::sys::TimeValue::now().seconds() - m_startTime >= m_maxTime) {
+        stopFastForward("at the time limit");
+    }
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,506 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+extern "C" {
+#include <qemu-common.h>
+#include <cpu-all.h>
+#include <exec-all.h>
+}
+
+
+#include <s2e/S2E.h>
+#include <s2e/S2EExecutor.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/s2e_config.h>
+
+#include <klee/Solver.h>
+
+#include <sstream>
+#include <algorithm>
+
+#include "FunctionModels.h"
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(FunctionModels, "Replaces common memory and string routines by their semantics",
+                  "FunctionModels", "Interceptor", "FunctionMonitor", "ModuleExecutionDetector");
+
+using namespace klee;
+
+static const FunctionModels::Model s_models[] = {
+    {"memcpy",        FunctionModels::MEMCPY, 0, true},
+    {"memmove",       FunctionModels::MEMCPY, 0, true},
+    {"memset",        FunctionModels::MEMSET, 0, true},
+    {"strlen",        FunctionModels::STRLEN, 0, false},
+    {"RtlCopyMemory", FunctionModels::MEMCPY, 3, false},
+    {"RtlMoveMemory", FunctionModels::MEMCPY, 3, false},
+    {"RtlFillMemory", FunctionModels::FILL,   3, false},
+    {"RtlZeroMemory", FunctionModels::ZERO,   2, false},
+};
+
+const FunctionModels::Model *FunctionModels::findModel(const std::string &name)
+{
+    unsigned N = sizeof(s_models)/sizeof(s_models[0]);
+    for (unsigned i = 0; i < N; ++i) {
+        if (name == s_models[i].name) {
+            return &s_models[i];
+        }
+    }
+    return NULL;
+}
+
+void FunctionModels::initialize()
+{
+    m_functionMonitor = static_cast<FunctionMonitor*>(s2e()->getPlugin("FunctionMonitor"));
+    m_monitor = static_cast<OSMonitor*>(s2e()->getPlugin("Interceptor"));
+    m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+
+    ConfigFile *cfg = s2e()->getConfig();
+    m_maxLength = cfg->getInt(getConfigKey() + ".maxLength", 4096);
+
+    bool ok = false;
+
+    //Modules whose imported routines are modeled
+    ConfigFile::string_list moduleList =
+            cfg->getStringList(getConfigKey() + ".moduleIds", ConfigFile::string_list(), &ok);
+
+    foreach2(it, moduleList.begin(), moduleList.end()) {
+        if (!m_detector->isModuleConfigured(*it)) {
+            s2e()->getWarningsStream() << "FunctionModels: module " << *it
+                    << " is not configured\n";
+            exit(-1);
+        }
+        m_trackedModules.insert(*it);
+    }
+
+    //Routines linked into a module, e.g., statically linked libc
+    ConfigFile::string_list functions = cfg->getListKeys(getConfigKey() + ".functions");
+    foreach2(it, functions.begin(), functions.end()) {
+        std::stringstream ss;
+        ss << getConfigKey() << ".functions." << *it;
+
+        StaticFunction fcn;
+        fcn.moduleId = cfg->getString(ss.str() + ".module", "", &ok);
+        if (!ok || !m_detector->isModuleConfigured(fcn.moduleId)) {
+            s2e()->getWarningsStream() << "FunctionModels: " << ss.str()
+                    << ".module must be a configured module\n";
+            exit(-1);
+        }
+
+        fcn.address = cfg->getInt(ss.str() + ".address", 0, &ok);
+        if (!ok) {
+            s2e()->getWarningsStream() << "FunctionModels: " << ss.str()
+                    << ".address is missing\n";
+            exit(-1);
+        }
+
+        std::string modelName = cfg->getString(ss.str() + ".model", "", &ok);
+        fcn.model = findModel(modelName);
+        if (!fcn.model) {
+            s2e()->getWarningsStream() << "FunctionModels: " << ss.str()
+                    << ".model " << modelName << " is not supported\n";
+            exit(-1);
+        }
+
+        m_staticFunctions.push_back(fcn);
+    }
+
+    m_detector->onModuleLoad.connect(
+            sigc::mem_fun(*this,
+                    &FunctionModels::onModuleLoad)
+            );
+
+    m_monitor->onModuleUnload.connect(
+            sigc::mem_fun(*this,
+                    &FunctionModels::onModuleUnload)
+            );
+}
+
+void FunctionModels::onModuleLoad(
+        S2EExecutionState* state,
+        const ModuleDescriptor &module
+        )
+{
+    const std::string *moduleId = m_detector->getModuleId(module);
+
+    foreach2(it, m_staticFunctions.begin(), m_staticFunctions.end()) {
+        if (!moduleId || (*it).moduleId != *moduleId) {
+            continue;
+        }
+
+        uint64_t address = module.ToRuntime((*it).address);
+        FunctionMonitor::CallSignal *cs = m_functionMonitor->getCallSignal(state, address, module.Pid);
+        cs->connect(sigc::bind(sigc::mem_fun(*this, &FunctionModels::onFunctionCall), (*it).model));
+    }
+
+    if (!m_trackedModules.empty()) {
+        if (!moduleId || (m_trackedModules.find(*moduleId) == m_trackedModules.end())) {
+            return;
+        }
+    }
+
+    Imports imports;
+    if (!m_monitor->getImports(state, module, imports)) {
+        return;
+    }
+
+    foreach2(it, imports.begin(), imports.end()) {
+        const ImportedFunctions &funcs = (*it).second;
+        foreach2(fit, funcs.begin(), funcs.end()) {
+            const Model *model = findModel((*fit).first);
+            if (!model) {
+                continue;
+            }
+
+            s2e()->getDebugStream() << "FunctionModels: modeling " << (*it).first << "!"
+                    << (*fit).first << " in " << module.Name << '\n';
+
+            FunctionMonitor::CallSignal *cs = m_functionMonitor->getCallSignal(state, (*fit).second, module.Pid);
+            cs->connect(sigc::bind(sigc::mem_fun(*this, &FunctionModels::onFunctionCall), model));
+        }
+    }
+}
+
+void FunctionModels::onModuleUnload(
+        S2EExecutionState* state,
+        const ModuleDescriptor &module
+        )
+{
+    m_functionMonitor->disconnect(state, module);
+}
+
+/* Must be called at the entry of the function, before the stack changes */
+ref<Expr> FunctionModels::readArgument(S2EExecutionState *state, unsigned index)
+{
+#if defined(TARGET_I386)
+#ifdef TARGET_X86_64
+    if (state->readCpuState(CPU_OFFSET(hflags), 32) & HF_CS64_MASK) {
+        //Same convention as S2EExecutionState::bypassFunction
+        static const unsigned argRegs[] = {R_EDI, R_ESI, R_EDX, R_ECX, 8, 9};
+        assert(index < sizeof(argRegs) / sizeof(argRegs[0]));
+        return state->readCpuRegister(CPU_REG_OFFSET(argRegs[index]), CPU_REG_SIZE * 8);
+    }
+#endif
+    ref<Expr> value = state->readMemory(state->getSp() + (index + 1) * sizeof(uint32_t),
+                                        Expr::Int32);
+    if (value.isNull()) {
+        return value;
+    }
+    return ZExtExpr::create(value, CPU_REG_SIZE * 8);
+#elif defined(TARGET_ARM)
+    assert(index < 4);
+    return state->readCpuRegister(CPU_REG_OFFSET(index), CPU_REG_SIZE * 8);
+#else
+    assert(false && "Not implemented for this architecture");
+    return ref<Expr>(0);
+#endif
+}
+
+bool FunctionModels::readConcreteArgument(S2EExecutionState *state,
+                                          unsigned index, uint64_t *value)
+{
+    ref<Expr> expr = readArgument(state, index);
+    if (expr.isNull() || !isa<ConstantExpr>(expr)) {
+        return false;
+    }
+    *value = cast<ConstantExpr>(expr)->getZExtValue();
+    return true;
+}
+
+bool FunctionModels::getLengthRange(S2EExecutionState *state, ref<Expr> length,
+                                    uint64_t *min, uint64_t *max)
+{
+    if (ConstantExpr *ce = dyn_cast<ConstantExpr>(length)) {
+        *min = *max = ce->getZExtValue();
+    } else {
+        Solver *solver = s2e()->getExecutor()->getSolver();
+        std::pair< ref<Expr>, ref<Expr> > range =
+                solver->getRange(Query(state->constraints, length));
+        *min = cast<ConstantExpr>(range.first)->getZExtValue();
+        *max = cast<ConstantExpr>(range.second)->getZExtValue();
+    }
+
+    return *max <= m_maxLength;
+}
+
+/**
+ * Reads or writes a range of guest virtual memory, resolving each RAM
+ * object only once instead of once per byte.
+ */
+static bool readBytes(S2EExecutionState *state, uint64_t address, uint64_t size,
+                      std::vector<ref<Expr> > &bytes)
+{
+    uint64_t i = 0;
+    while (i < size) {
+        uint64_t offset = (address + i) & ~S2E_RAM_OBJECT_MASK;
+        uint64_t chunk = std::min(size - i, S2E_RAM_OBJECT_SIZE - offset);
+
+        uint64_t hostAddress = state->getHostAddress(address + i);
+        if (hostAddress == (uint64_t) -1) {
+            return false;
+        }
+
+        ObjectPair op = state->findRamObject(hostAddress);
+        if (!op.first || !op.first->isUserSpecified) {
+            return false;
+        }
+
+        offset = hostAddress - op.first->address;
+        for (uint64_t j = 0; j < chunk; ++j) {
+            bytes.push_back(op.second->read8(offset + j));
+        }
+        i += chunk;
+    }
+    return true;
+}
+
+static bool writeBytes(S2EExecutionState *state, uint64_t address,
+                       const std::vector<ref<Expr> > &bytes)
+{
+    uint64_t i = 0;
+    uint64_t size = bytes.size();
+    while (i < size) {
+        uint64_t offset = (address + i) & ~S2E_RAM_OBJECT_MASK;
+        uint64_t chunk = std::min(size - i, S2E_RAM_OBJECT_SIZE - offset);
+
+        uint64_t hostAddress = state->getHostAddress(address + i);
+        if (hostAddress == (uint64_t) -1) {
+            return false;
+        }
+
+        ObjectPair op = state->findRamObject(hostAddress);
+        if (!op.first || !op.first->isUserSpecified) {
+            return false;
+        }
+
+        offset = hostAddress - op.first->address;
+        ObjectState *wos = state->addressSpace.getWriteable(op.first, op.second);
+        for (uint64_t j = 0; j < chunk; ++j) {
+            wos->write(offset + j, bytes[i + j]);
+        }
+        i += chunk;
+    }
+    return true;
+}
+
+/**
+ * Builds the new contents of [dest, dest + max) for a write of the given
+ * length. Bytes past the minimum length keep their old value when the
+ * length is smaller than their offset.
+ */
+static bool mergeBytes(S2EExecutionState *state, uint64_t dest,
+                       ref<Expr> length, uint64_t min,
+                       std::vector<ref<Expr> > &bytes)
+{
+    if (bytes.size() == min) {
+        return true;
+    }
+
+    std::vector<ref<Expr> > old;
+    if (!readBytes(state, dest + min, bytes.size() - min, old)) {
+        return false;
+    }
+
+    for (uint64_t i = min; i < bytes.size(); ++i) {
+        ref<Expr> inRange = UltExpr::create(
+                    ConstantExpr::create(i, length->getWidth()), length);
+        bytes[i] = SelectExpr::create(inRange, bytes[i], old[i - min]);
+    }
+    return true;
+}
+
+bool FunctionModels::copyMemory(S2EExecutionState *state, uint64_t dest,
+                                uint64_t src, ref<Expr> length)
+{
+    uint64_t min, max;
+    if (!getLengthRange(state, length, &min, &max)) {
+        return false;
+    }
+
+    //Reading everything first gives memmove semantics
+    std::vector<ref<Expr> > bytes;
+    if (!readBytes(state, src, max, bytes)) {
+        return false;
+    }
+
+    if (!mergeBytes(state, dest, length, min, bytes)) {
+        return false;
+    }
+
+    return writeBytes(state, dest, bytes);
+}
+
+bool FunctionModels::fillMemory(S2EExecutionState *state, uint64_t dest,
+                                ref<Expr> value, ref<Expr> length)
+{
+    uint64_t min, max;
+    if (!getLengthRange(state, length, &min, &max)) {
+        return false;
+    }
+
+    std::vector<ref<Expr> > bytes(max, ExtractExpr::create(value, 0, Expr::Int8));
+    if (!mergeBytes(state, dest, length, min, bytes)) {
+        return false;
+    }
+
+    return writeBytes(state, dest, bytes);
+}
+
+/**
+ * The length is symbolic when some bytes before the first concrete null
+ * byte are symbolic. Strings without a concrete terminator within
+ * maxLength bytes are left to the guest code.
+ */
+bool FunctionModels::stringLength(S2EExecutionState *state, uint64_t str,
+                                  ref<Expr> &result)
+{
+    std::vector<ref<Expr> > bytes;
+    uint64_t end = 0;
+    bool found = false;
+
+    while (!found && bytes.size() < m_maxLength) {
+        uint64_t chunk = S2E_RAM_OBJECT_SIZE - ((str + bytes.size()) & ~S2E_RAM_OBJECT_MASK);
+        if (!readBytes(state, str + bytes.size(), chunk, bytes)) {
+            return false;
+        }
+
+        for (; end < bytes.size(); ++end) {
+            ConstantExpr *ce = dyn_cast<ConstantExpr>(bytes[end]);
+            if (ce && ce->isZero()) {
+                found = true;
+                break;
+            }
+        }
+    }
+
+    if (!found || end > m_maxLength) {
+        return false;
+    }
+
+    Expr::Width width = CPU_REG_SIZE * 8;
+    result = ConstantExpr::create(end, width);
+    for (uint64_t i = end; i > 0; --i) {
+        ref<Expr> byte = bytes[i - 1];
+        if (isa<ConstantExpr>(byte)) {
+            continue;
+        }
+        result = SelectExpr::create(
+                    EqExpr::create(byte, ConstantExpr::create(0, Expr::Int8)),
+                    ConstantExpr::create(i - 1, width), result);
+    }
+
+    return true;
+}
+
+void FunctionModels::onFunctionCall(S2EExecutionState* state,
+                                    FunctionMonitorState *fns,
+                                    const Model *model)
+{
+    uint64_t dest;
+    if (!readConcreteArgument(state, 0, &dest)) {
+        return;
+    }
+
+    bool ok = false;
+    ref<Expr> result;
+
+    switch (model->type) {
+        case MEMCPY: {
+            uint64_t src;
+            ref<Expr> length = readArgument(state, 2);
+            ok = readConcreteArgument(state, 1, &src) && !length.isNull() &&
+                 copyMemory(state, dest, src, length);
+        } break;
+
+        case MEMSET: {
+            ref<Expr> value = readArgument(state, 1);
+            ref<Expr> length = readArgument(state, 2);
+            ok = !value.isNull() && !length.isNull() &&
+                 fillMemory(state, dest, value, length);
+        } break;
+
+        case FILL: {
+            ref<Expr> length = readArgument(state, 1);
+            ref<Expr> value = readArgument(state, 2);
+            ok = !value.isNull() && !length.isNull() &&
+                 fillMemory(state, dest, value, length);
+        } break;
+
+        case ZERO: {
+            ref<Expr> length = readArgument(state, 1);
+            ok = !length.isNull() &&
+                 fillMemory(state, dest, ConstantExpr::create(0, Expr::Int8), length);
+        } break;
+
+        case STRLEN: {
+            ok = stringLength(state, dest, result);
+        } break;
+    }
+
+    if (!ok) {
+        //Let the guest run the function
+        return;
+    }
+
+    if (model->returnsDest) {
+        result = ConstantExpr::create(dest, CPU_REG_SIZE * 8);
+    }
+
+    if (!state->bypassFunction(model->popCount)) {
+        return;
+    }
+
+    if (!result.isNull()) {
+#if defined(TARGET_I386)
+        unsigned offset = CPU_OFFSET(regs[R_EAX]);
+#elif defined(TARGET_ARM)
+        unsigned offset = CPU_OFFSET(regs[0]);
+#endif
+        //Concrete values must also reach the native CPU state
+        if (isa<ConstantExpr>(result)) {
+            state->writeCpuRegister(offset, result);
+        } else {
+            state->writeCpuRegisterSymbolic(offset, result);
+        }
+    }
+
+    throw CpuExitException();
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,142 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_PLUGINS_FUNCTIONMODELS_H
+#define S2E_PLUGINS_FUNCTIONMODELS_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <tr1/unordered_set>
+#include <string>
+#include <vector>
+
+#include "ModuleExecutionDetector.h"
+#include "FunctionMonitor.h"
+#include "OSMonitor.h"
+
+namespace s2e {
+namespace plugins {
+
+/**
+ * Replaces calls to common memory and string routines (memcpy, memset,
+ * strlen, RtlMoveMemory, ...) by a direct update of the guest memory.
+ * Running these routines instruction by instruction on symbolic data
+ * forks on every comparison, while the model builds one expression per
+ * byte and no fork at all.
+ */
+class FunctionModels : public Plugin
+{
+    S2E_PLUGIN
+public:
+    enum ModelType {
+        MEMCPY, MEMSET, STRLEN, FILL, ZERO
+    };
+
+    struct Model {
+        const char *name;
+        ModelType type;
+        /* Number of parameters the callee pops (stdcall), 0 for cdecl */
+        unsigned popCount;
+        /* Whether the function returns its first parameter */
+        bool returnsDest;
+    };
+
+    FunctionModels(S2E* s2e): Plugin(s2e) {}
+
+    void initialize();
+
+    static const Model *findModel(const std::string &name);
+
+private:
+    typedef std::tr1::unordered_set<std::string> StringSet;
+
+    struct StaticFunction {
+        std::string moduleId;
+        uint64_t address;
+        const Model *model;
+    };
+
+    ModuleExecutionDetector *m_detector;
+    OSMonitor *m_monitor;
+    FunctionMonitor *m_functionMonitor;
+
+    /* Modules whose imports are modeled. Empty for all modules. */
+    StringSet m_trackedModules;
+
+    /* Routines linked into the modules, identified by their address */
+    std::vector<StaticFunction> m_staticFunctions;
+
+    /* Largest number of bytes a model processes. Longer or potentially
+       longer operations run in the guest. */
+    uint64_t m_maxLength;
+
+    void onModuleLoad(S2EExecutionState* state,
+                      const ModuleDescriptor &module);
+
+    void onModuleUnload(S2EExecutionState* state,
+                        const ModuleDescriptor &module);
+
+    void onFunctionCall(S2EExecutionState* state,
+                        FunctionMonitorState *fns,
+                        const Model *model);
+
+    klee::ref<klee::Expr> readArgument(S2EExecutionState *state,
+                                       unsigned index);
+
+    bool readConcreteArgument(S2EExecutionState *state,
+                              unsigned index, uint64_t *value);
+
+    bool getLengthRange(S2EExecutionState *state,
+                        klee::ref<klee::Expr> length,
+                        uint64_t *min, uint64_t *max);
+
+    bool copyMemory(S2EExecutionState *state, uint64_t dest,
+                    uint64_t src, klee::ref<klee::Expr> length);
+
+    bool fillMemory(S2EExecutionState *state, uint64_t dest,
+                    klee::ref<klee::Expr> value,
+                    klee::ref<klee::Expr> length);
+
+    bool stringLength(S2EExecutionState *state, uint64_t str,
+                      klee::ref<klee::Expr> &result);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif // S2E_PLUGINS_FUNCTIONMODELS_H
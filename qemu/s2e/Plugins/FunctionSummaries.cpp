@@ -0,0 +1,312 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include <qemu-common.h>
+#include <cpu-all.h>
+#include <exec-all.h>
+}
+
+#include <s2e/S2E.h>
+#include <s2e/S2EExecutor.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <klee/Solver.h>
+
+#include <sstream>
+
+#include "FunctionSummaries.h"
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(FunctionSummaries, "Reuses the paths explored through a function in later calls",
+                  "FunctionSummaries", "Interceptor", "FunctionMonitor", "ModuleExecutionDetector");
+
+using namespace klee;
+
+bool FunctionSummaries::Key::operator<(const Key &k) const
+{
+    if (function != k.function) {
+        return function < k.function;
+    }
+    return arguments < k.arguments;
+}
+
+FunctionSummaries::~FunctionSummaries()
+{
+    s2e()->getMessagesStream() << "FunctionSummaries: " << m_summaries.size()
+            << " summaries, " << m_hits << " calls skipped, "
+            << m_misses << " calls explored\n";
+}
+
+void FunctionSummaries::initialize()
+{
+    m_functionMonitor = static_cast<FunctionMonitor*>(s2e()->getPlugin("FunctionMonitor"));
+    m_monitor = static_cast<OSMonitor*>(s2e()->getPlugin("Interceptor"));
+    m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+
+    m_hits = 0;
+    m_misses = 0;
+
+    ConfigFile *cfg = s2e()->getConfig();
+    m_maxPaths = cfg->getInt(getConfigKey() + ".maxPaths", 64);
+
+    bool ok = false;
+
+    ConfigFile::string_list functions = cfg->getListKeys(getConfigKey() + ".functions");
+    foreach2(it, functions.begin(), functions.end()) {
+        std::stringstream ss;
+        ss << getConfigKey() << ".functions." << *it;
+
+        Function fcn;
+        fcn.name = *it;
+        fcn.moduleId = cfg->getString(ss.str() + ".module", "", &ok);
+        if (!ok || !m_detector->isModuleConfigured(fcn.moduleId)) {
+            s2e()->getWarningsStream() << "FunctionSummaries: " << ss.str()
+                    << ".module must be a configured module\n";
+            exit(-1);
+        }
+
+        fcn.address = cfg->getInt(ss.str() + ".address", 0, &ok);
+        if (!ok) {
+            s2e()->getWarningsStream() << "FunctionSummaries: " << ss.str()
+                    << ".address is missing\n";
+            exit(-1);
+        }
+
+        fcn.argumentCount = cfg->getInt(ss.str() + ".arguments", 0, &ok);
+        if (!ok || fcn.argumentCount == 0) {
+            s2e()->getWarningsStream() << "FunctionSummaries: " << ss.str()
+                    << ".arguments must be the number of parameters of the function\n";
+            exit(-1);
+        }
+
+        bool stdcall = cfg->getBool(ss.str() + ".stdcall", false);
+        fcn.popCount = stdcall ? fcn.argumentCount : 0;
+
+        m_functions.push_back(fcn);
+    }
+
+    if (m_functions.empty()) {
+        s2e()->getWarningsStream() << "FunctionSummaries: no function to summarize\n";
+    }
+
+    m_detector->onModuleLoad.connect(
+            sigc::mem_fun(*this,
+                    &FunctionSummaries::onModuleLoad)
+            );
+
+    m_monitor->onModuleUnload.connect(
+            sigc::mem_fun(*this,
+                    &FunctionSummaries::onModuleUnload)
+            );
+}
+
+void FunctionSummaries::onModuleLoad(
+        S2EExecutionState* state,
+        const ModuleDescriptor &module
+        )
+{
+    const std::string *moduleId = m_detector->getModuleId(module);
+    if (!moduleId) {
+        return;
+    }
+
+    foreach2(it, m_functions.begin(), m_functions.end()) {
+        if ((*it).moduleId != *moduleId) {
+            continue;
+        }
+
+        uint64_t address = module.ToRuntime((*it).address);
+        FunctionMonitor::CallSignal *cs = m_functionMonitor->getCallSignal(state, address, module.Pid);
+        cs->connect(sigc::bind(sigc::mem_fun(*this, &FunctionSummaries::onFunctionCall), &*it));
+    }
+}
+
+void FunctionSummaries::onModuleUnload(
+        S2EExecutionState* state,
+        const ModuleDescriptor &module
+        )
+{
+    m_functionMonitor->disconnect(state, module);
+}
+
+/* Must be called at the entry of the function, before the stack changes */
+ref<Expr> FunctionSummaries::readArgument(S2EExecutionState *state, unsigned index)
+{
+#ifdef TARGET_X86_64
+    if (state->readCpuState(CPU_OFFSET(hflags), 32) & HF_CS64_MASK) {
+        //Same convention as S2EExecutionState::bypassFunction
+        static const unsigned argRegs[] = {R_EDI, R_ESI, R_EDX, R_ECX, 8, 9};
+        if (index >= sizeof(argRegs) / sizeof(argRegs[0])) {
+            return ref<Expr>(0);
+        }
+        return state->readCpuRegister(CPU_REG_OFFSET(argRegs[index]), CPU_REG_SIZE * 8);
+    }
+#endif
+    ref<Expr> value = state->readMemory(state->getSp() + (index + 1) * sizeof(uint32_t),
+                                        Expr::Int32);
+    if (value.isNull()) {
+        return value;
+    }
+    return ZExtExpr::create(value, CPU_REG_SIZE * 8);
+}
+
+/**
+ * The paths of a summary may come from states with different constraints,
+ * so they only cover the inputs those states allowed. The summary is only
+ * used when the path constraints of the caller imply one of the paths.
+ */
+bool FunctionSummaries::applySummary(S2EExecutionState *state,
+                                     const Function *function,
+                                     const Summary &summary)
+{
+    ref<Expr> covered = ConstantExpr::create(0, Expr::Bool);
+    ref<Expr> result = summary.back().result;
+
+    for (unsigned i = summary.size(); i > 0; --i) {
+        const Path &path = summary[i - 1];
+        covered = OrExpr::create(path.condition, covered);
+        if (i < summary.size()) {
+            //The function is deterministic, overlapping paths agree
+            result = SelectExpr::create(path.condition, path.result, result);
+        }
+    }
+
+    bool truth;
+    Solver *solver = s2e()->getExecutor()->getSolver();
+    if (!solver->mustBeTrue(Query(state->constraints, covered), truth) || !truth) {
+        return false;
+    }
+
+    if (!state->bypassFunction(function->popCount)) {
+        return false;
+    }
+
+    unsigned offset = CPU_OFFSET(regs[R_EAX]);
+    //Concrete values must also reach the native CPU state
+    if (isa<ConstantExpr>(result)) {
+        state->writeCpuRegister(offset, result);
+    } else {
+        state->writeCpuRegisterSymbolic(offset, result);
+    }
+
+    return true;
+}
+
+void FunctionSummaries::onFunctionCall(S2EExecutionState* state,
+                                       FunctionMonitorState *fns,
+                                       const Function *function)
+{
+    Key key;
+    key.function = function;
+
+    bool symbolic = false;
+    for (unsigned i = 0; i < function->argumentCount; ++i) {
+        ref<Expr> argument = readArgument(state, i);
+        if (argument.isNull()) {
+            return;
+        }
+        symbolic |= !isa<ConstantExpr>(argument);
+        key.arguments.push_back(argument);
+    }
+
+    //Concrete calls do not fork, there is nothing to save
+    if (!symbolic) {
+        return;
+    }
+
+    Summaries::iterator it = m_summaries.find(key);
+    if (it != m_summaries.end() && !(*it).second.empty()) {
+        if (applySummary(state, function, (*it).second)) {
+            s2e()->getDebugStream() << "FunctionSummaries: reused " << (*it).second.size()
+                    << " paths of " << function->name << '\n';
+            ++m_hits;
+            throw CpuExitException();
+        }
+    }
+
+    ++m_misses;
+
+    if (it == m_summaries.end()) {
+        it = m_summaries.insert(std::make_pair(key, Summary())).first;
+    }
+
+    if ((*it).second.size() >= m_maxPaths) {
+        return;
+    }
+
+    //Forked states inherit the return handler, each of them adds the
+    //constraints that are not in this set to its path.
+    ConstraintSetPtr constraints(new ConstraintSet(state->constraints.begin(),
+                                                   state->constraints.end()));
+
+    FUNCMON_REGISTER_RETURN_A(state, fns, FunctionSummaries::onFunctionReturn,
+                              &(*it).first, constraints);
+}
+
+void FunctionSummaries::onFunctionReturn(S2EExecutionState* state,
+                                         const Key *key, ConstraintSetPtr constraints)
+{
+    Summary &summary = m_summaries[*key];
+    if (summary.size() >= m_maxPaths) {
+        return;
+    }
+
+    Path path;
+    path.condition = ConstantExpr::create(1, Expr::Bool);
+    foreach2(it, state->constraints.begin(), state->constraints.end()) {
+        if (constraints->find(*it) == constraints->end()) {
+            path.condition = AndExpr::create(path.condition, *it);
+        }
+    }
+
+    foreach2(it, summary.begin(), summary.end()) {
+        if ((*it).condition == path.condition) {
+            return;
+        }
+    }
+
+    path.result = state->readCpuRegister(CPU_OFFSET(regs[R_EAX]), CPU_REG_SIZE * 8);
+    summary.push_back(path);
+
+    s2e()->getDebugStream() << "FunctionSummaries: " << key->function->name
+            << " has " << summary.size() << " paths\n";
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,139 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_FUNCTIONSUMMARIES_H
+#define S2E_PLUGINS_FUNCTIONSUMMARIES_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <tr1/memory>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ModuleExecutionDetector.h"
+#include "FunctionMonitor.h"
+#include "OSMonitor.h"
+
+namespace s2e {
+namespace plugins {
+
+/**
+ * Caches the paths explored through a function so that later calls with
+ * the same symbolic arguments skip the function. Each path of a summary
+ * is a pair of the constraints the path added and of the return value.
+ * A call reuses the summary when its path constraints imply that one of
+ * the paths is taken, the return value becomes a select over the paths.
+ *
+ * The functions must only depend on their arguments and only return
+ * a value in eax, e.g., a checksum step or a character classification.
+ */
+class FunctionSummaries : public Plugin
+{
+    S2E_PLUGIN
+public:
+    FunctionSummaries(S2E* s2e): Plugin(s2e) {}
+    ~FunctionSummaries();
+
+    void initialize();
+
+private:
+    struct Function {
+        std::string name;
+        std::string moduleId;
+        uint64_t address;
+        unsigned argumentCount;
+        /* Number of parameters the callee pops (stdcall), 0 for cdecl */
+        unsigned popCount;
+    };
+
+    /* The input footprint of a call */
+    struct Key {
+        const Function *function;
+        std::vector<klee::ref<klee::Expr> > arguments;
+
+        bool operator<(const Key &k) const;
+    };
+
+    struct Path {
+        klee::ref<klee::Expr> condition;
+        klee::ref<klee::Expr> result;
+    };
+
+    typedef std::vector<Path> Summary;
+    typedef std::map<Key, Summary> Summaries;
+    typedef std::set<klee::ref<klee::Expr> > ConstraintSet;
+    typedef std::tr1::shared_ptr<ConstraintSet> ConstraintSetPtr;
+
+    ModuleExecutionDetector *m_detector;
+    OSMonitor *m_monitor;
+    FunctionMonitor *m_functionMonitor;
+
+    std::vector<Function> m_functions;
+    Summaries m_summaries;
+
+    /* Largest number of paths kept per summary */
+    unsigned m_maxPaths;
+
+    uint64_t m_hits;
+    uint64_t m_misses;
+
+    void onModuleLoad(S2EExecutionState* state,
+                      const ModuleDescriptor &module);
+
+    void onModuleUnload(S2EExecutionState* state,
+                        const ModuleDescriptor &module);
+
+    void onFunctionCall(S2EExecutionState* state,
+                        FunctionMonitorState *fns,
+                        const Function *function);
+
+    void onFunctionReturn(S2EExecutionState* state,
+                          const Key *key, ConstraintSetPtr constraints);
+
+    klee::ref<klee::Expr> readArgument(S2EExecutionState *state,
+                                       unsigned index);
+
+    bool applySummary(S2EExecutionState *state, const Function *function,
+                      const Summary &summary);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif // S2E_PLUGINS_FUNCTIONSUMMARIES_H
@@ -0,0 +1,163 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "FuzzerCoverage.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <cstring>
+#include <fstream>
+
+#ifndef CONFIG_WIN32
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(FuzzerCoverage, "Exports the covered edges in an AFL-style shared bitmap",
+                  "FuzzerCoverage",);
+
+void FuzzerCoverage::initialize()
+{
+#ifdef CONFIG_WIN32
+    s2e()->getWarningsStream() << "FuzzerCoverage: shared memory segments are not supported" << '\n';
+    exit(-1);
+#else
+    //Attach to the segment of a fuzzer, or create one that the fuzzer
+    //attaches to. The forked S2E processes inherit the attachment.
+    m_shmId = s2e()->getConfig()->getInt(getConfigKey() + ".shmId", -1);
+
+    bool created = false;
+    if (m_shmId < 0) {
+        m_shmId = shmget(IPC_PRIVATE, MapSize, IPC_CREAT | IPC_EXCL | 0600);
+        created = true;
+    }
+
+    void *bitmap = m_shmId < 0 ? (void*) -1 : shmat(m_shmId, NULL, 0);
+    if (bitmap == (void*) -1) {
+        s2e()->getWarningsStream() << "FuzzerCoverage: could not attach the shared memory segment" << '\n';
+        exit(-1);
+    }
+    m_bitmap = (uint8_t*) bitmap;
+
+    if (created) {
+        memset(m_bitmap, 0, MapSize);
+
+        //Linux keeps the segment until the last process detaches it and
+        //still lets other processes attach it by id.
+        shmctl(m_shmId, IPC_RMID, NULL);
+
+        std::ofstream ofs(s2e()->getOutputFilename("fuzzer-shm-id").c_str());
+        ofs << m_shmId << '\n';
+    }
+
+    s2e()->getMessagesStream() << "FuzzerCoverage: bitmap is in shared memory segment "
+            << m_shmId << '\n';
+
+    s2e()->getCorePlugin()->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &FuzzerCoverage::onTranslateBlockStart));
+#endif
+}
+
+void FuzzerCoverage::onTranslateBlockStart(ExecutionSignal *signal,
+                                           S2EExecutionState *state,
+                                           TranslationBlock *tb,
+                                           uint64_t pc)
+{
+    //The location of the block is hashed once, at translation time.
+    //The signal is raised in both concrete and symbolic mode.
+    uint64_t h = pc * 0x9e3779b97f4a7c15ULL;
+    uint32_t location = (uint32_t) (h >> 32) & (MapSize - 1);
+
+    signal->connect(sigc::bind(sigc::mem_fun(*this, &FuzzerCoverage::onExecuteBlockStart),
+                               location));
+}
+
+void FuzzerCoverage::onExecuteBlockStart(S2EExecutionState *state, uint64_t pc,
+                                         uint32_t location)
+{
+    DECLARE_PLUGINSTATE(FuzzerCoverageState, state);
+
+    uint8_t *entry = &m_bitmap[location ^ plgState->m_prevLocation];
+
+    //Only write new entries, the processes sharing the bitmap
+    //would otherwise keep invalidating each other's cache lines
+    if (!*entry) {
+        *entry = 1;
+        plgState->m_newCoverage = true;
+    }
+
+    plgState->m_prevLocation = location >> 1;
+}
+
+bool FuzzerCoverage::hasNewCoverage(S2EExecutionState *state)
+{
+    DECLARE_PLUGINSTATE(FuzzerCoverageState, state);
+    return plgState->m_newCoverage;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+FuzzerCoverageState::FuzzerCoverageState()
+{
+    m_prevLocation = 0;
+    m_newCoverage = false;
+}
+
+FuzzerCoverageState::~FuzzerCoverageState()
+{
+
+}
+
+FuzzerCoverageState* FuzzerCoverageState::clone() const
+{
+    return new FuzzerCoverageState(*this);
+}
+
+PluginState *FuzzerCoverageState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new FuzzerCoverageState();
+}
+
+} // namespace plugins
+} // namespace s2e
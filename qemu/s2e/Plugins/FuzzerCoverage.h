@@ -0,0 +1,105 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_FUZZERCOVERAGE_H
+#define S2E_PLUGINS_FUZZERCOVERAGE_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+
+namespace s2e {
+namespace plugins {
+
+class FuzzerCoverageState: public PluginState
+{
+private:
+    //Location of the previous translation block, shifted like in AFL
+    uint32_t m_prevLocation;
+
+    //Whether the path set a bitmap entry that was still zero
+    bool m_newCoverage;
+
+public:
+    FuzzerCoverageState();
+    virtual ~FuzzerCoverageState();
+    virtual FuzzerCoverageState* clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class FuzzerCoverage;
+};
+
+/**
+ *  Records the edges between translation blocks in an AFL-style bitmap
+ *  stored in a System V shared memory segment. The bitmap is cumulative:
+ *  an entry is non-zero once any S2E process or any fuzzer attached to the
+ *  segment executed the edge.
+ */
+class FuzzerCoverage : public Plugin
+{
+    S2E_PLUGIN
+public:
+    static const unsigned MapSize = 1 << 16;
+
+    FuzzerCoverage(S2E* s2e): Plugin(s2e) {
+        m_bitmap = NULL;
+        m_shmId = -1;
+    }
+
+    void initialize();
+
+    int getShmId() const { return m_shmId; }
+
+    /** Whether the path of the state set bitmap entries that no process
+        had set before. */
+    bool hasNewCoverage(S2EExecutionState *state);
+
+private:
+    uint8_t *m_bitmap;
+    int m_shmId;
+
+    void onTranslateBlockStart(ExecutionSignal *signal,
+                               S2EExecutionState *state,
+                               TranslationBlock *tb,
+                               uint64_t pc);
+
+    void onExecuteBlockStart(S2EExecutionState *state, uint64_t pc,
+                             uint32_t location);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif // S2E_PLUGINS_FUZZERCOVERAGE_H
@@ -44,8 +44,10 @@ extern "C" {
 #include <s2e/Utils.h>
 #include <s2e/Plugins/Opcodes.h>
 
+#include <algorithm>
 #include <iostream>
 #include <errno.h>
+#include <string.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -79,10 +81,168 @@ void HostFiles::initialize()
         m_baseDirectories.push_back(s2e()->getOutputDirectory());
     }
 
-    s2e()->getCorePlugin()->onCustomInstruction.connect(
+    //In kilobytes, s2eget transfers chunks of up to 1MB
+    m_maxReadSize = s2e()->getConfig()->getInt(getConfigKey() + ".maxReadSize", 16 * 1024) * 1024;
+    m_buffer.resize(m_maxReadSize);
+
+    m_prefetch = s2e()->getConfig()->getBool(getConfigKey() + ".prefetch");
+    if (m_prefetch) {
+        qemu_mutex_init(&m_prefetchLock);
+        qemu_cond_init(&m_prefetchCond);
+        startPrefetcher();
+
+        s2e()->getCorePlugin()->onProcessFork.connect(
+                sigc::mem_fun(*this, &HostFiles::onProcessFork));
+    }
+
+    s2e()->getCorePlugin()->getCustomInstructionSignal(HOSTFILES_OPCODE).connect(
             sigc::mem_fun(*this, &HostFiles::onCustomInstruction));
 }
 
+HostFiles::~HostFiles()
+{
+    stopPrefetcher();
+}
+
+void HostFiles::startPrefetcher()
+{
+    m_prefetchStop = false;
+    m_prefetchPending = false;
+    m_prefetchRunning = true;
+    qemu_thread_create(&m_prefetchThread, prefetchThread, this, QEMU_THREAD_JOINABLE);
+}
+
+void HostFiles::stopPrefetcher()
+{
+    if (!m_prefetchRunning) {
+        return;
+    }
+
+    qemu_mutex_lock(&m_prefetchLock);
+    m_prefetchStop = true;
+    qemu_cond_broadcast(&m_prefetchCond);
+    qemu_mutex_unlock(&m_prefetchLock);
+
+    qemu_thread_join(&m_prefetchThread);
+    m_prefetchRunning = false;
+}
+
+/** Must be called with m_prefetchLock held */
+void HostFiles::waitForPrefetch()
+{
+    while (m_prefetchPending && !m_prefetchStop) {
+        qemu_cond_wait(&m_prefetchCond, &m_prefetchLock);
+    }
+}
+
+void *HostFiles::prefetchThread(void *opaque)
+{
+    static_cast<HostFiles*>(opaque)->prefetchLoop();
+    return NULL;
+}
+
+void HostFiles::prefetchLoop()
+{
+    std::vector<uint8_t> data;
+
+    qemu_mutex_lock(&m_prefetchLock);
+    while (true) {
+        while (!m_prefetchPending && !m_prefetchStop) {
+            qemu_cond_wait(&m_prefetchCond, &m_prefetchLock);
+        }
+
+        if (m_prefetchStop) {
+            break;
+        }
+
+        unsigned guestFd = m_prefetchGuestFd;
+        int fd = m_prefetchFd;
+        data.resize(m_prefetchCount);
+        qemu_mutex_unlock(&m_prefetchLock);
+
+        ssize_t size = ::read(fd, &data[0], data.size());
+
+        qemu_mutex_lock(&m_prefetchLock);
+        PrefetchBuffer &buffer = m_prefetched[guestFd];
+        buffer.data.swap(data);
+        buffer.size = size;
+        buffer.consumed = 0;
+
+        m_prefetchPending = false;
+        qemu_cond_broadcast(&m_prefetchCond);
+    }
+    qemu_mutex_unlock(&m_prefetchLock);
+}
+
+/** The I/O thread does not survive a fork, pending reads are completed first */
+void HostFiles::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
+{
+    if (preFork) {
+        qemu_mutex_lock(&m_prefetchLock);
+        waitForPrefetch();
+        qemu_mutex_unlock(&m_prefetchLock);
+        stopPrefetcher();
+    } else {
+        startPrefetcher();
+    }
+}
+
+/**
+ *  Reads from the host file. With prefetching, the data read ahead by
+ *  the I/O thread is returned first, and the next chunk of the file
+ *  is requested before returning.
+ */
+ssize_t HostFiles::readFile(unsigned guestFd, uint8_t *buf, size_t count)
+{
+    int fd = m_openFiles[guestFd];
+
+    if (!m_prefetch) {
+        return ::read(fd, buf, count);
+    }
+
+    ssize_t ret = -1;
+    bool done = false;
+
+    qemu_mutex_lock(&m_prefetchLock);
+    waitForPrefetch();
+
+    std::map<unsigned, PrefetchBuffer>::iterator it = m_prefetched.find(guestFd);
+    if (it != m_prefetched.end()) {
+        PrefetchBuffer &buffer = (*it).second;
+        if (buffer.size <= 0) {
+            //End of file or read error
+            ret = buffer.size;
+            done = true;
+            m_prefetched.erase(it);
+        } else if (buffer.consumed < (size_t) buffer.size) {
+            ret = std::min(count, (size_t) buffer.size - buffer.consumed);
+            memcpy(buf, &buffer.data[buffer.consumed], ret);
+            buffer.consumed += ret;
+            done = true;
+        }
+    }
+    qemu_mutex_unlock(&m_prefetchLock);
+
+    if (!done) {
+        ret = ::read(fd, buf, count);
+    }
+
+    if (ret > 0) {
+        qemu_mutex_lock(&m_prefetchLock);
+        it = m_prefetched.find(guestFd);
+        if (it == m_prefetched.end() || (*it).second.consumed == (size_t) (*it).second.size) {
+            m_prefetchGuestFd = guestFd;
+            m_prefetchFd = fd;
+            m_prefetchCount = count;
+            m_prefetchPending = true;
+            qemu_cond_broadcast(&m_prefetchCond);
+        }
+        qemu_mutex_unlock(&m_prefetchLock);
+    }
+
+    return ret;
+}
+
 void HostFiles::open(S2EExecutionState *state)
 {
     target_ulong fnamePtr = 0, flags = 0;
@@ -169,25 +329,23 @@ void HostFiles::read(S2EExecutionState *state)
         return;
     }
 
-    if(count > 1024*64) {
+    if(count > m_maxReadSize) {
         s2e()->getWarningsStream(state)
             << "ERROR: count passed to HostFiles is too big" << '\n';
         return;
     }
 
-    if(guestFd > m_openFiles.size() || m_openFiles[guestFd] == -1) {
+    if(guestFd >= m_openFiles.size() || m_openFiles[guestFd] == -1) {
         return;
     }
 
-    int fd = m_openFiles[guestFd];
-    char buf[count];
-
-    read_ret = ::read(fd, buf, count);
+    read_ret = readFile(guestFd, &m_buffer[0], count);
     if(-1 == read_ret)
         return;
     ret = read_ret;
 
-    ok = state->writeMemoryConcrete(bufAddr, buf, ret);
+    //Page by page, straight into the guest RAM objects
+    ok = state->writeMemoryConcrete(bufAddr, &m_buffer[0], ret);
     if(!ok) {
         s2e()->getWarningsStream(state)
             << "ERROR: HostFiles can not write to guest buffer\n";
@@ -216,6 +374,13 @@ void HostFiles::close(S2EExecutionState *state)
     }
 
     if(guestFd < m_openFiles.size() && m_openFiles[guestFd] != -1) {
+        if (m_prefetch) {
+            qemu_mutex_lock(&m_prefetchLock);
+            waitForPrefetch();
+            m_prefetched.erase(guestFd);
+            qemu_mutex_unlock(&m_prefetchLock);
+        }
+
         ret = ::close(m_openFiles[guestFd]);
         m_openFiles[guestFd] = -1;
         state->writeCpuRegisterConcrete(CPU_OFFSET(HOSTFILES_RETURN), &ret,
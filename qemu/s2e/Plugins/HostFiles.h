@@ -39,8 +39,14 @@
 #include <s2e/Plugin.h>
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/S2EExecutionState.h>
+#include <map>
 #include <set>
 #include <string>
+#include <vector>
+
+extern "C" {
+#include <qemu-thread.h>
+}
 
 #ifdef TARGET_I386
 
@@ -71,7 +77,8 @@ class HostFiles : public Plugin
 {
     S2E_PLUGIN
 public:
-    HostFiles(S2E* s2e): Plugin(s2e) {}
+    HostFiles(S2E* s2e): Plugin(s2e), m_prefetch(false), m_prefetchRunning(false) {}
+    ~HostFiles();
 
     void initialize();
 
@@ -80,11 +87,47 @@ private:
     std::vector<std::string> m_baseDirectories;
     std::vector<int> m_openFiles;
 
+    //Largest read served in one call, and the buffer used for it
+    unsigned m_maxReadSize;
+    std::vector<uint8_t> m_buffer;
+
+    /* Read ahead (see the prefetch option) */
+    struct PrefetchBuffer {
+        std::vector<uint8_t> data;
+        ssize_t size;        //Bytes read by the I/O thread, -1 on error
+        size_t consumed;
+    };
+
+    bool m_prefetch;
+    bool m_prefetchRunning;
+    bool m_prefetchStop;
+    QemuThread m_prefetchThread;
+    QemuMutex m_prefetchLock;
+    QemuCond m_prefetchCond;
+
+    //Single request slot, guest/host fds and size of the next read
+    bool m_prefetchPending;
+    unsigned m_prefetchGuestFd;
+    int m_prefetchFd;
+    size_t m_prefetchCount;
+
+    //Prefetched data of each guest fd, protected by m_prefetchLock
+    std::map<unsigned, PrefetchBuffer> m_prefetched;
+
     void open(S2EExecutionState *state);
     void close(S2EExecutionState *state);
     void read(S2EExecutionState *state);
 
+    ssize_t readFile(unsigned guestFd, uint8_t *buf, size_t count);
+
+    void startPrefetcher();
+    void stopPrefetcher();
+    void waitForPrefetch();
+    static void *prefetchThread(void *opaque);
+    void prefetchLoop();
+
     void onCustomInstruction(S2EExecutionState* state, uint64_t opcode);
+    void onProcessFork(bool preFork, bool isChild, unsigned parentProcId);
 };
 
 } // namespace plugins
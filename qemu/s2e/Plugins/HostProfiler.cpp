@@ -0,0 +1,312 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/s2e_qemu.h>
+
+#include <klee/Internal/Support/PerfCounters.h>
+
+#include "ExecutionTracers/TraceEntries.h"
+#include "HostProfiler.h"
+
+#include <string.h>
+
+#ifdef __linux__
+#include <execinfo.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+namespace s2e {
+namespace plugins {
+
+using klee::PerfCounters;
+
+S2E_DEFINE_PLUGIN(HostProfiler, "Samples where S2E spends its time", "",);
+
+HostProfiler *HostProfiler::s_profiler = NULL;
+
+HostProfiler::~HostProfiler()
+{
+    stopTimer();
+    drain();
+    s_profiler = NULL;
+
+    if (m_file) {
+        fclose(m_file);
+    }
+}
+
+void HostProfiler::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    //Samples per second of CPU time
+    m_frequency = cfg->getInt(getConfigKey() + ".frequency", 200);
+
+    m_maxFrames = cfg->getInt(getConfigKey() + ".maxFrames", MaxFrames);
+    if (m_maxFrames > MaxFrames) {
+        m_maxFrames = MaxFrames;
+    }
+
+    m_head = m_tail = 0;
+    m_droppedSamples = 0;
+
+#ifdef __linux__
+    //The first call of backtrace() may allocate memory,
+    //get it done before it runs in the signal handler.
+    void *frames[1];
+    backtrace(frames, 1);
+#endif
+
+    if (!m_frequency || !openProfile()) {
+        return;
+    }
+
+    s_profiler = this;
+
+#ifdef __linux__
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = onSignal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+#endif
+
+    if (!startTimer()) {
+        s2e()->getWarningsStream() << "HostProfiler: could not start the profiling timer" << '\n';
+        return;
+    }
+
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &HostProfiler::onTimer));
+
+    s2e()->getCorePlugin()->onProcessFork.connect(
+            sigc::mem_fun(*this, &HostProfiler::onProcessFork));
+}
+
+bool HostProfiler::openProfile()
+{
+    if (m_file) {
+        fclose(m_file);
+    }
+
+    std::string fileName = s2e()->getOutputFilename("hostprofile.dat");
+    m_file = fopen(fileName.c_str(), "wb");
+    if (!m_file) {
+        s2e()->getWarningsStream() << "HostProfiler: could not open " << fileName << '\n';
+        return false;
+    }
+
+    HostProfileHeader hdr;
+    memcpy(hdr.magic, HOSTPROFILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = 1;
+    hdr.frequency = m_frequency;
+    fwrite(&hdr, sizeof(hdr), 1, m_file);
+
+    writeMaps();
+    return true;
+}
+
+//The offline tool needs the load address of each host binary
+void HostProfiler::writeMaps()
+{
+#ifdef __linux__
+    FILE *in = fopen("/proc/self/maps", "r");
+    if (!in) {
+        return;
+    }
+
+    std::string fileName = s2e()->getOutputFilename("hostprofile.maps");
+    FILE *out = fopen(fileName.c_str(), "w");
+    if (out) {
+        char buffer[512];
+        size_t size;
+        while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+            fwrite(buffer, 1, size, out);
+        }
+        fclose(out);
+    }
+    fclose(in);
+#endif
+}
+
+bool HostProfiler::startTimer()
+{
+#ifdef __linux__
+    //Only count the CPU time of the thread that runs the guest,
+    //and deliver the signal to it.
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &m_timer) < 0) {
+        return false;
+    }
+    m_timerCreated = true;
+
+    struct itimerspec its;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 1000000000 / m_frequency;
+    if (m_frequency == 1) {
+        its.it_interval.tv_sec = 1;
+        its.it_interval.tv_nsec = 0;
+    }
+    its.it_value = its.it_interval;
+
+    return timer_settime(m_timer, 0, &its, NULL) == 0;
+#else
+    return false;
+#endif
+}
+
+void HostProfiler::stopTimer()
+{
+#ifdef __linux__
+    if (m_timerCreated) {
+        timer_delete(m_timer);
+        m_timerCreated = false;
+    }
+#endif
+}
+
+void HostProfiler::onSignal(int signum, siginfo_t *info, void *context)
+{
+#ifdef __linux__
+    HostProfiler *p = s_profiler;
+    if (!p) {
+        return;
+    }
+
+    unsigned head = p->m_head;
+    if (head - p->m_tail >= RingSize) {
+        ++p->m_droppedSamples;
+        return;
+    }
+
+    Sample &s = p->m_ring[head % RingSize];
+    s.mode = PerfCounters::getCurrent();
+
+    //The state is inconsistent in the middle of a switch
+    S2EExecutionState *state = g_s2e_state;
+    if (state && s.mode != PerfCounters::StateSwitch) {
+        s.stateId = state->getID();
+        s.guestPc = state->getPc();
+    } else {
+        s.stateId = (uint32_t) -1;
+        s.guestPc = 0;
+    }
+
+    s.frameCount = backtrace(s.frames, p->m_maxFrames);
+
+    p->m_head = head + 1;
+#endif
+}
+
+void HostProfiler::drain()
+{
+    if (!m_file) {
+        return;
+    }
+
+    uint8_t buffer[sizeof(HostProfileSample) + MaxFrames * sizeof(uint64_t)];
+    HostProfileSample *out = (HostProfileSample*) buffer;
+
+    while (m_tail != m_head) {
+        const Sample &s = m_ring[m_tail % RingSize];
+
+        //Skip the signal handler and the signal trampoline
+        unsigned skip = s.frameCount < 2 ? s.frameCount : 2;
+        unsigned count = s.frameCount - skip;
+
+        out->guestPc = s.guestPc;
+        out->stateId = s.stateId;
+        out->mode = s.mode;
+        out->frameCount = count;
+        out->frames[0] = 0;
+
+        for (unsigned i = 0; i < count; ++i) {
+            out->frames[i] = (uint64_t) (uintptr_t) s.frames[skip + i];
+        }
+
+        fwrite(out, HostProfileSample::getSize(count ? count : 1), 1, m_file);
+        m_tail = m_tail + 1;
+    }
+
+    fflush(m_file);
+}
+
+void HostProfiler::onTimer()
+{
+    drain();
+
+    if (m_droppedSamples) {
+        s2e()->getWarningsStream() << "HostProfiler: dropped " << m_droppedSamples
+                                   << " samples" << '\n';
+        m_droppedSamples = 0;
+    }
+}
+
+void HostProfiler::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
+{
+    if (preFork) {
+        stopTimer();
+        drain();
+        return;
+    }
+
+    //The child has its own output directory and timers are not inherited
+    if (isChild) {
+        m_head = m_tail = 0;
+        if (!openProfile()) {
+            s_profiler = NULL;
+            return;
+        }
+    }
+
+    startTimer();
+}
+
+} // namespace plugins
+} // namespace s2e
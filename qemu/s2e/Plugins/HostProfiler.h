@@ -0,0 +1,110 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_PLUGINS_HOSTPROFILER_H
+#define S2E_PLUGINS_HOSTPROFILER_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Samples the CPU time of the S2E thread with SIGPROF. Each sample
+ *  records the guest pc, the current state, the execution mode and
+ *  the host call stack, which shows the plugin callbacks that were
+ *  running. The hostprof tool turns the profile into a flame graph.
+ */
+class HostProfiler : public Plugin
+{
+    S2E_PLUGIN
+public:
+    static const unsigned MaxFrames = 48;
+    static const unsigned RingSize = 4096;
+
+    HostProfiler(S2E* s2e): Plugin(s2e), m_file(NULL), m_timerCreated(false) {}
+    ~HostProfiler();
+
+    void initialize();
+
+private:
+    struct Sample {
+        uint64_t guestPc;
+        uint32_t stateId;
+        uint8_t mode;
+        uint8_t frameCount;
+        void *frames[MaxFrames];
+    };
+
+    static HostProfiler *s_profiler;
+
+    unsigned m_frequency;
+    unsigned m_maxFrames;
+    FILE *m_file;
+
+#ifdef __linux__
+    timer_t m_timer;
+#endif
+    bool m_timerCreated;
+
+    //Filled by the signal handler, drained by the main loop
+    Sample m_ring[RingSize];
+    volatile unsigned m_head;
+    volatile unsigned m_tail;
+    volatile uint64_t m_droppedSamples;
+
+    static void onSignal(int signum, siginfo_t *info, void *context);
+
+    bool openProfile();
+    void writeMaps();
+    bool startTimer();
+    void stopTimer();
+    void drain();
+
+    void onTimer();
+    void onProcessFork(bool preFork, bool isChild, unsigned parentProcId);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif // S2E_PLUGINS_HOSTPROFILER_H
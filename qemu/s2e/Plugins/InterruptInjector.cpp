@@ -51,11 +51,20 @@ void InterruptInjector::initialize()
 {
     m_libcallMonitor = static_cast<LibraryCallMonitor*>(s2e()->getPlugin("LibraryCallMonitor"));
     m_symbolicHardware = static_cast<SymbolicHardware*>(s2e()->getPlugin("SymbolicHardware"));
+    m_stackMonitor = static_cast<StackMonitor*>(s2e()->getPlugin("StackMonitor"));
 
     m_libcallMonitor->onLibraryCall.connect(
             sigc::mem_fun(*this, &InterruptInjector::onLibraryCall));
 
-    m_hardwareId = s2e()->getConfig()->getString(getConfigKey() + ".hardwareId");
+    ConfigFile *cfg = s2e()->getConfig();
+    m_hardwareId = cfg->getString(getConfigKey() + ".hardwareId");
+
+    m_samplingPeriod = cfg->getInt(getConfigKey() + ".samplingPeriod", 1);
+    if (m_samplingPeriod == 0) {
+        m_samplingPeriod = 1;
+    }
+    m_maxInjectionsPerClass = cfg->getInt(getConfigKey() + ".maxInjectionsPerClass", 0);
+    m_dedupAcrossStates = cfg->getBool(getConfigKey() + ".dedupAcrossStates", false);
 
     m_deviceDescriptor = m_symbolicHardware->findDevice(m_hardwareId);
     if (!m_deviceDescriptor) {
@@ -64,12 +73,76 @@ void InterruptInjector::initialize()
     }
 }
 
+InjectionClass InterruptInjector::getInjectionClass(S2EExecutionState *state,
+                                                   const ModuleDescriptor &mod) const
+{
+    InjectionClass c;
+    c.module = mod.Name;
+    c.stackDepth = 0;
+
+    if (m_stackMonitor) {
+        uint64_t sp = state->getSp();
+        bool onTheStack = false;
+        StackFrameInfo info;
+        if (m_stackMonitor->getFrameInfo(state, sp, onTheStack, info) && onTheStack) {
+            c.stackDepth = (info.StackBase + info.StackSize - sp) >> 8;
+        }
+    }
+
+    return c;
+}
+
 void InterruptInjector::onLibraryCall(S2EExecutionState* state,
                                       FunctionMonitorState* fns,
                                       const ModuleDescriptor& mod)
 {
+    InjectionClass c = getInjectionClass(state, mod);
+
+    DECLARE_PLUGINSTATE(InterruptInjectorState, state);
+    InterruptInjectorState::ClassStats &stats = plgState->m_classes[c];
+
+    unsigned candidate = stats.candidates++;
+    if (candidate % m_samplingPeriod) {
+        return;
+    }
+
+    if (m_maxInjectionsPerClass && stats.injections >= m_maxInjectionsPerClass) {
+        return;
+    }
+
+    if (m_dedupAcrossStates) {
+        //The called function identifies the site within the class
+        InjectionSite site(c, state->getPc());
+        if (!m_injectedSites.insert(site).second) {
+            return;
+        }
+    }
+
+    ++stats.injections;
     m_deviceDescriptor->setInterrupt(true);
 }
 
+/////////////////////////////////////////////////////////////////////
+
+InterruptInjectorState::InterruptInjectorState()
+{
+
+}
+
+InterruptInjectorState::~InterruptInjectorState()
+{
+
+}
+
+InterruptInjectorState* InterruptInjectorState::clone() const
+{
+    return new InterruptInjectorState(*this);
+}
+
+PluginState *InterruptInjectorState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new InterruptInjectorState();
+}
+
 } // namespace plugins
 } // namespace s2e
@@ -42,10 +42,32 @@
 
 #include "LibraryCallMonitor.h"
 #include "SymbolicHardware.h"
+#include "StackMonitor.h"
+
+#include <map>
+#include <set>
 
 namespace s2e {
 namespace plugins {
 
+/**
+ *  Injection points that are likely to lead to equivalent states:
+ *  same module and same stack depth (in buckets of 256 bytes).
+ *  The plugin drives a single interrupt line, so the vector is implied.
+ */
+struct InjectionClass
+{
+    std::string module;
+    uint64_t stackDepth;
+
+    bool operator<(const InjectionClass &c) const {
+        if (stackDepth != c.stackDepth) {
+            return stackDepth < c.stackDepth;
+        }
+        return module < c.module;
+    }
+};
+
 class InterruptInjector : public Plugin
 {
     S2E_PLUGIN
@@ -56,17 +78,53 @@ public:
 
 
 private:
+    typedef std::pair<InjectionClass, uint64_t> InjectionSite;
+
     LibraryCallMonitor *m_libcallMonitor;
     SymbolicHardware *m_symbolicHardware;
+    StackMonitor *m_stackMonitor;
 
     std::string m_hardwareId;
     DeviceDescriptor *m_deviceDescriptor;
 
+    //Inject at the first candidate of a class, then every n-th one
+    unsigned m_samplingPeriod;
+    //Number of injections per class and per path (0 for no limit)
+    unsigned m_maxInjectionsPerClass;
+
+    //Inject at a given site of a class in only one of the states
+    bool m_dedupAcrossStates;
+    std::set<InjectionSite> m_injectedSites;
+
+    InjectionClass getInjectionClass(S2EExecutionState *state,
+                                     const ModuleDescriptor &mod) const;
+
     void onLibraryCall(S2EExecutionState* state,
                        FunctionMonitorState* fns,
                        const ModuleDescriptor& mod);
 };
 
+class InterruptInjectorState : public PluginState
+{
+private:
+    struct ClassStats {
+        unsigned candidates;
+        unsigned injections;
+        ClassStats() : candidates(0), injections(0) {}
+    };
+
+    typedef std::map<InjectionClass, ClassStats> Classes;
+    Classes m_classes;
+
+public:
+    InterruptInjectorState();
+    virtual ~InterruptInjectorState();
+    virtual InterruptInjectorState* clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class InterruptInjector;
+};
+
 } // namespace plugins
 } // namespace s2e
 
@@ -91,6 +91,11 @@ void LibraryCallMonitor::initialize()
             sigc::mem_fun(*this,
                     &LibraryCallMonitor::onModuleUnload)
             );
+
+    m_detector->onModuleTranslateBlockEnd.connect(
+            sigc::mem_fun(*this,
+                    &LibraryCallMonitor::onModuleTranslateBlockEnd)
+            );
 }
 
 
@@ -115,6 +120,8 @@ void LibraryCallMonitor::onModuleLoad(
     }
 
     DECLARE_PLUGINSTATE(LibraryCallMonitorState, state);
+    LibraryCallMonitorState::AddressToFunctionName &functions =
+            plgState->m_functions[std::make_pair(module.Pid, module.LoadBase)];
 
     foreach2(it, imports.begin(), imports.end()) {
         const std::string &libName = (*it).first;
@@ -130,10 +137,7 @@ void LibraryCallMonitor::onModuleLoad(
             insertRes = m_functionNames.insert(composedName);
 
             const char *cstring = (*insertRes.first).c_str();
-            plgState->m_functions[address] = cstring;
-
-            FunctionMonitor::CallSignal *cs = m_functionMonitor->getCallSignal(state, address, module.Pid);
-            cs->connect(sigc::mem_fun(*this, &LibraryCallMonitor::onFunctionCall));
+            functions[address] = cstring;
         }
     }
 }
@@ -143,36 +147,91 @@ void LibraryCallMonitor::onModuleUnload(
         const ModuleDescriptor &module
         )
 {
+    DECLARE_PLUGINSTATE(LibraryCallMonitorState, state);
+    plgState->m_functions.erase(std::make_pair(module.Pid, module.LoadBase));
+
     m_functionMonitor->disconnect(state, module);
     return;
 }
 
-void LibraryCallMonitor::onFunctionCall(S2EExecutionState* state, FunctionMonitorState *fns)
+/**
+ *  Instrument only the calls that may reach an imported function.
+ *  A static target is resolved here, indirect calls (e.g., through the
+ *  import address table) are checked when they execute.
+ */
+void LibraryCallMonitor::onModuleTranslateBlockEnd(
+        ExecutionSignal *signal,
+        S2EExecutionState* state,
+        const ModuleDescriptor &module,
+        TranslationBlock *tb,
+        uint64_t endPc,
+        bool staticTarget,
+        uint64_t targetPc)
+{
+    if (tb->s2e_tb_type != TB_CALL && tb->s2e_tb_type != TB_CALL_IND) {
+        return;
+    }
+
+    DECLARE_PLUGINSTATE_CONST(LibraryCallMonitorState, state);
+    LibraryCallMonitorState::ModuleFunctions::const_iterator mit =
+            plgState->m_functions.find(std::make_pair(module.Pid, module.LoadBase));
+
+    //The module is not tracked
+    if (mit == plgState->m_functions.end()) {
+        return;
+    }
+
+    const char *function = NULL;
+    if (staticTarget) {
+        LibraryCallMonitorState::AddressToFunctionName::const_iterator it =
+                (*mit).second.find(targetPc);
+        if (it == (*mit).second.end()) {
+            return;
+        }
+        function = (*it).second;
+    }
+
+    signal->connect(sigc::bind(sigc::mem_fun(*this, &LibraryCallMonitor::onFunctionCall), function));
+}
+
+void LibraryCallMonitor::onFunctionCall(S2EExecutionState* state, uint64_t callerPc, const char *function)
 {
     //Only track configured modules
-    uint64_t caller = state->getTb()->pcOfLastInstr;
-    const ModuleDescriptor *mod = m_detector->getModule(state, caller);
+    const ModuleDescriptor *mod = m_detector->getModule(state, callerPc);
     if (!mod) {
         return;
     }
 
-    DECLARE_PLUGINSTATE(LibraryCallMonitorState, state);
     uint64_t pc = state->getPc();
 
+    if (!function) {
+        DECLARE_PLUGINSTATE_CONST(LibraryCallMonitorState, state);
+        LibraryCallMonitorState::ModuleFunctions::const_iterator mit =
+                plgState->m_functions.find(std::make_pair(mod->Pid, mod->LoadBase));
+        if (mit == plgState->m_functions.end()) {
+            return;
+        }
+
+        LibraryCallMonitorState::AddressToFunctionName::const_iterator it =
+                (*mit).second.find(pc);
+        if (it == (*mit).second.end()) {
+            return;
+        }
+        function = (*it).second;
+    }
+
     if (m_displayOnce && (m_alreadyCalledFunctions.find(std::make_pair(mod->Pid, pc)) != m_alreadyCalledFunctions.end())) {
         return;
     }
 
-    LibraryCallMonitorState::AddressToFunctionName::iterator it = plgState->m_functions.find(pc);
-    if (it != plgState->m_functions.end()) {
-        const char *str = (*it).second;
-        s2e()->getMessagesStream() << mod->Name << "@" << hexval(mod->ToNativeBase(caller)) << " called function " << str << '\n';
+    s2e()->getMessagesStream() << mod->Name << "@" << hexval(mod->ToNativeBase(callerPc)) << " called function " << function << '\n';
 
-        onLibraryCall.emit(state, fns, *mod);
+    FunctionMonitorState *fns = static_cast<FunctionMonitorState*>(
+            m_functionMonitor->getPluginState(state, &FunctionMonitorState::factory));
+    onLibraryCall.emit(state, fns, *mod);
 
-        if (m_displayOnce) {
-            m_alreadyCalledFunctions.insert(std::make_pair(mod->Pid, pc));
-        }
+    if (m_displayOnce) {
+        m_alreadyCalledFunctions.insert(std::make_pair(mod->Pid, pc));
     }
 }
 
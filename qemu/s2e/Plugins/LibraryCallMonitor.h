@@ -42,6 +42,7 @@
 
 #include <tr1/unordered_map>
 #include <tr1/unordered_set>
+#include <map>
 #include <string>
 
 #include "ModuleExecutionDetector.h"
@@ -90,7 +91,17 @@ private:
             S2EExecutionState* state,
             const ModuleDescriptor &module
             );
-    void onFunctionCall(S2EExecutionState* state, FunctionMonitorState *fns);
+
+    void onModuleTranslateBlockEnd(
+            ExecutionSignal *signal,
+            S2EExecutionState* state,
+            const ModuleDescriptor &module,
+            TranslationBlock *tb,
+            uint64_t endPc,
+            bool staticTarget,
+            uint64_t targetPc);
+
+    void onFunctionCall(S2EExecutionState* state, uint64_t callerPc, const char *function);
 };
 
 class LibraryCallMonitorState : public PluginState
@@ -98,8 +109,11 @@ class LibraryCallMonitorState : public PluginState
 public:
     typedef std::tr1::unordered_map<uint64_t, const char *> AddressToFunctionName;
 
+    /* Imported functions of each tracked module, by (pid, load base) */
+    typedef std::map<std::pair<uint64_t, uint64_t>, AddressToFunctionName> ModuleFunctions;
+
 private:
-    AddressToFunctionName m_functions;
+    ModuleFunctions m_functions;
 
 public:
     LibraryCallMonitorState();
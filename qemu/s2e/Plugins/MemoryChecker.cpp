@@ -47,6 +47,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <vector>
 
 namespace s2e {
 namespace plugins {
@@ -87,6 +88,23 @@ namespace {
     typedef klee::ImmutableMap<MemoryRange, const MemoryRegion*,
                                MemoryRangeLT> MemoryMap;
 
+    //Secondary index of the regions by type, so that revoking
+    //by pattern does not have to scan the whole memory map
+    struct RegionTypeKey {
+        std::string type;
+        uint64_t start;
+    };
+
+    struct RegionTypeKeyLT {
+        bool operator()(const RegionTypeKey& a, const RegionTypeKey& b) const {
+            int res = a.type.compare(b.type);
+            return res < 0 || (res == 0 && a.start < b.start);
+        }
+    };
+
+    typedef klee::ImmutableMap<RegionTypeKey, const MemoryRegion*,
+                               RegionTypeKeyLT> RegionTypeMap;
+
     typedef klee::ImmutableMap<uint64_t, ResourceHandle> ResourceHandleMap;
 
     llvm::raw_ostream& operator <<(llvm::raw_ostream& out, const MemoryRegion& r) {
@@ -122,6 +140,7 @@ class MemoryCheckerState: public PluginState
 {
 public:
     MemoryMap m_memoryMap;
+    RegionTypeMap m_regionTypeMap;
     ResourceHandleMap m_resourceMap;
 
 public:
@@ -141,6 +160,14 @@ public:
         m_memoryMap = memoryMap;
     }
 
+    RegionTypeMap &getRegionTypeMap() {
+        return m_regionTypeMap;
+    }
+
+    void setRegionTypeMap(const RegionTypeMap& regionTypeMap) {
+        m_regionTypeMap = regionTypeMap;
+    }
+
     ResourceHandleMap &getResourceMap() {
         return m_resourceMap;
     }
@@ -494,6 +521,10 @@ void MemoryChecker::grantMemory(S2EExecutionState *state,
 
     plgState->setMemoryMap(memoryMap.replace(std::make_pair(region->range, region)));
 
+    RegionTypeKey typeKey = {region->type, region->range.start};
+    plgState->setRegionTypeMap(plgState->getRegionTypeMap().replace(
+                                   std::make_pair(typeKey, region)));
+
 }
 
 bool MemoryChecker::revokeMemory(S2EExecutionState *state,
@@ -585,6 +616,8 @@ bool MemoryChecker::revokeMemory(S2EExecutionState *state,
 
         //we can not just delete it since it can be used by other states!
         //delete const_cast<MemoryRegion*>(res->second);
+        RegionTypeKey typeKey = {res->second->type, res->first.start};
+        plgState->setRegionTypeMap(plgState->getRegionTypeMap().remove(typeKey));
         plgState->setMemoryMap(memoryMap.remove(region->range));
     } while(false);
 
@@ -606,30 +639,44 @@ bool MemoryChecker::revokeMemory(S2EExecutionState *state,
 {
     DECLARE_PLUGINSTATE(MemoryCheckerState, state);
 
-    MemoryMap &memoryMap = plgState->getMemoryMap();
-
     s2e()->getDebugStream(state) << "MemoryChecker::revokeMemory("
             << "pattern = '" << regionTypePattern << "', "
             << "regionID = " << hexval(regionID) << ")" << '\n';
 
-    bool ret = true;
-    bool changed = true;
-    while(changed) {
-        changed = false;
-        for(MemoryMap::iterator it = memoryMap.begin(), ie = memoryMap.end();
-                                                        it != ie; ++it) {
-            if(it->second->type.size()>0
-                  && matchRegionType(regionTypePattern, it->second->type)
-                  && (regionID == uint64_t(-1) || it->second->id == regionID)) {
-                ret &= revokeMemory(state,
-                             it->first.start, it->first.size,
-                             it->second->perms, it->second->type, it->second->id);
-                changed = true;
-                memoryMap = plgState->getMemoryMap();
-                break;
-            }
+    //Regions whose type matches the pattern are contiguous in the
+    //type index: either all types with the given prefix, or the
+    //exact type if the pattern has no trailing '*'
+    std::string prefix = regionTypePattern;
+    bool isPrefix = prefix.empty() || prefix[prefix.size() - 1] == '*';
+    if (isPrefix && !prefix.empty()) {
+        prefix.resize(prefix.size() - 1);
+    }
+
+    const RegionTypeMap &typeMap = plgState->getRegionTypeMap();
+    RegionTypeKey first = {prefix, 0};
+
+    std::vector<const MemoryRegion*> matching;
+    for (RegionTypeMap::iterator it = typeMap.lower_bound(first),
+                                 ie = typeMap.end(); it != ie; ++it) {
+        const std::string &type = it->first.type;
+        if (isPrefix ? type.compare(0, prefix.size(), prefix) != 0
+                     : type != prefix) {
+            break;
+        }
+
+        if (type.size() > 0
+              && (regionID == uint64_t(-1) || it->second->id == regionID)) {
+            matching.push_back(it->second);
         }
     }
+
+    bool ret = true;
+    foreach2(it, matching.begin(), matching.end()) {
+        const MemoryRegion *r = *it;
+        ret &= revokeMemory(state,
+                     r->range.start, r->range.size,
+                     r->perms, r->type, r->id);
+    }
     return ret;
 }
 
@@ -0,0 +1,224 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "MemoryGovernor.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/S2EExecutor.h>
+#include <s2e/S2EStatsTracker.h>
+
+#include <algorithm>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(MemoryGovernor, "Suspends and kills states under memory pressure",
+                  "MemoryGovernor",);
+
+void MemoryGovernor::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    m_softLimit = cfg->getInt(getConfigKey() + ".softLimit", 0);
+    m_hardLimit = cfg->getInt(getConfigKey() + ".hardLimit", 0);
+    m_resumeLimit = cfg->getInt(getConfigKey() + ".resumeLimit", m_softLimit * 9 / 10);
+    m_resumeBatch = cfg->getInt(getConfigKey() + ".resumeBatch", 10);
+
+    if (!m_softLimit && !m_hardLimit) {
+        s2e()->getWarningsStream() << "MemoryGovernor: set softLimit and/or hardLimit" << '\n';
+        exit(-1);
+    }
+
+    if (m_hardLimit && m_softLimit > m_hardLimit) {
+        s2e()->getWarningsStream() << "MemoryGovernor: softLimit must be lower than hardLimit" << '\n';
+        exit(-1);
+    }
+
+    m_clock = 0;
+
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &MemoryGovernor::onTimer));
+
+    s2e()->getCorePlugin()->onStateFork.connect(
+            sigc::mem_fun(*this, &MemoryGovernor::onStateFork));
+
+    s2e()->getCorePlugin()->onStateSwitch.connect(
+            sigc::mem_fun(*this, &MemoryGovernor::onStateSwitch));
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &MemoryGovernor::onStateKill));
+}
+
+void MemoryGovernor::onStateFork(S2EExecutionState *state,
+                                 const std::vector<S2EExecutionState*>& newStates,
+                                 const std::vector<klee::ref<klee::Expr> >& newConditions)
+{
+    foreach2(it, newStates.begin(), newStates.end()) {
+        m_lastRun[*it] = m_clock;
+    }
+}
+
+void MemoryGovernor::onStateSwitch(S2EExecutionState *currentState,
+                                   S2EExecutionState *nextState)
+{
+    if (nextState) {
+        m_lastRun[nextState] = ++m_clock;
+    }
+}
+
+void MemoryGovernor::onStateKill(S2EExecutionState *state)
+{
+    m_lastRun.erase(state);
+
+    StateList::iterator it = std::find(m_suspended.begin(), m_suspended.end(), state);
+    if (it != m_suspended.end()) {
+        m_suspended.erase(it);
+    }
+}
+
+/** Returns the active states that can be suspended or killed, coldest first */
+void MemoryGovernor::getColdStates(StateList &states)
+{
+    std::vector<std::pair<uint64_t, S2EExecutionState*> > sorted;
+
+    const klee::StateSet &active = s2e()->getExecutor()->getStates();
+    foreach2(it, active.begin(), active.end()) {
+        S2EExecutionState *s = static_cast<S2EExecutionState*>(*it);
+
+        //The current state cannot be suspended from the timer
+        if (s == g_s2e_state || s->isZombie()) {
+            continue;
+        }
+
+        LastRunMap::iterator lit = m_lastRun.find(s);
+        sorted.push_back(std::make_pair(lit == m_lastRun.end() ? 0 : (*lit).second, s));
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+
+    states.clear();
+    foreach2(it, sorted.begin(), sorted.end()) {
+        states.push_back((*it).second);
+    }
+}
+
+void MemoryGovernor::suspendColdStates(uint64_t usage)
+{
+    StateList cold;
+    getColdStates(cold);
+
+    //Scale the number of active states down to the soft limit
+    unsigned count = s2e()->getExecutor()->getStatesCount();
+    unsigned toSuspend = std::max(1U, (unsigned) (count - count * m_softLimit / usage));
+    toSuspend = std::min(toSuspend, (unsigned) cold.size());
+
+    if (toSuspend == 0) {
+        return;
+    }
+
+    s2e()->getWarningsStream() << "MemoryGovernor: using " << usage << "MB, suspending "
+            << toSuspend << " states" << '\n';
+
+    for (unsigned i = 0; i < toSuspend; ++i) {
+        if (s2e()->getExecutor()->suspendState(cold[i])) {
+            m_suspended.push_back(cold[i]);
+        }
+    }
+}
+
+void MemoryGovernor::resumeStates()
+{
+    //The most recently suspended states are the hottest ones
+    unsigned count = 0;
+    while (!m_suspended.empty() && count < m_resumeBatch) {
+        S2EExecutionState *s = m_suspended.back();
+        m_suspended.pop_back();
+        s2e()->getExecutor()->resumeState(s);
+        ++count;
+    }
+
+    s2e()->getDebugStream() << "MemoryGovernor: resumed " << count << " states, "
+            << m_suspended.size() << " still suspended" << '\n';
+}
+
+void MemoryGovernor::killColdStates(uint64_t usage)
+{
+    StateList victims(m_suspended);
+    StateList cold;
+    getColdStates(cold);
+    victims.insert(victims.end(), cold.begin(), cold.end());
+
+    unsigned count = s2e()->getExecutor()->getStatesCount() + m_suspended.size();
+    uint64_t target = m_softLimit ? m_softLimit : m_hardLimit;
+    unsigned toKill = std::max(1U, (unsigned) (count - count * target / usage));
+    toKill = std::min(toKill, (unsigned) victims.size());
+
+    s2e()->getWarningsStream() << "MemoryGovernor: using " << usage << "MB, killing "
+            << toKill << " states" << '\n';
+
+    unsigned suspendedCount = m_suspended.size();
+    for (unsigned i = 0; i < toKill; ++i) {
+        S2EExecutionState *s = victims[i];
+
+        //Suspended states must be known to the executor to be killed
+        if (i < suspendedCount) {
+            s2e()->getExecutor()->resumeState(s);
+        }
+
+        s2e()->getExecutor()->terminateStateEarly(*s, "MemoryGovernor: killed under memory pressure");
+    }
+}
+
+void MemoryGovernor::onTimer()
+{
+    uint64_t usage = S2EStatsTracker::getProcessResidentMemoryUsage() >> 20;
+
+    if (m_hardLimit && usage >= m_hardLimit) {
+        killColdStates(usage);
+    } else if (m_softLimit && usage >= m_softLimit) {
+        suspendColdStates(usage);
+    } else if (usage < m_resumeLimit && !m_suspended.empty()) {
+        resumeStates();
+    }
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,99 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_MEMORYGOVERNOR_H
+#define S2E_PLUGINS_MEMORYGOVERNOR_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <map>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Keeps the resident memory of S2E under control when the number of
+ *  states explodes, instead of letting the host kill the whole run.
+ *
+ *  Above the soft limit, the states that ran least recently are
+ *  suspended: they stop forking and allocating memory. They are resumed
+ *  once the memory usage drops below the resume limit. Above the hard
+ *  limit, the coldest states are killed (with test case generation),
+ *  suspended ones first. All the limits are in megabytes.
+ */
+class MemoryGovernor : public Plugin
+{
+    S2E_PLUGIN
+public:
+    MemoryGovernor(S2E* s2e): Plugin(s2e) {}
+    void initialize();
+
+private:
+    typedef std::map<S2EExecutionState*, uint64_t> LastRunMap;
+    typedef std::vector<S2EExecutionState*> StateList;
+
+    uint64_t m_softLimit;
+    uint64_t m_hardLimit;
+    uint64_t m_resumeLimit;
+    unsigned m_resumeBatch;
+
+    //Logical time of the last schedule of each state
+    LastRunMap m_lastRun;
+    uint64_t m_clock;
+
+    //Suspended states, coldest first
+    StateList m_suspended;
+
+    void getColdStates(StateList &states);
+    void suspendColdStates(uint64_t usage);
+    void resumeStates();
+    void killColdStates(uint64_t usage);
+
+    void onTimer();
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*>& newStates,
+                     const std::vector<klee::ref<klee::Expr> >& newConditions);
+    void onStateSwitch(S2EExecutionState *currentState,
+                       S2EExecutionState *nextState);
+    void onStateKill(S2EExecutionState *state);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
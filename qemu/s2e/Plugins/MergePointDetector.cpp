@@ -0,0 +1,126 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "MergePointDetector.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/S2EExecutor.h>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(MergePointDetector, "Queues states for merging when they return from functions in which they forked",
+                  "MergePointDetector", "FunctionMonitor");
+
+void MergePointDetector::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    m_functionMonitor = static_cast<FunctionMonitor*>(s2e()->getPlugin("FunctionMonitor"));
+    m_functions = cfg->getIntegerList(getConfigKey() + ".functions");
+    m_pid = cfg->getInt(getConfigKey() + ".pid", 0);
+
+    //Call signals are per-state, they can only be registered once there is a state
+    m_tbConnection = s2e()->getCorePlugin()->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &MergePointDetector::onTranslateBlockStart));
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &MergePointDetector::onStateKill));
+}
+
+void MergePointDetector::onTranslateBlockStart(ExecutionSignal *signal,
+                                               S2EExecutionState *state,
+                                               TranslationBlock *tb,
+                                               uint64_t pc)
+{
+    if (m_functions.empty()) {
+        m_functionMonitor->getCallSignal(state, 0, m_pid)->connect(
+                sigc::mem_fun(*this, &MergePointDetector::onFunctionCall));
+    } else {
+        foreach2(it, m_functions.begin(), m_functions.end()) {
+            m_functionMonitor->getCallSignal(state, *it, m_pid)->connect(
+                    sigc::mem_fun(*this, &MergePointDetector::onFunctionCall));
+        }
+    }
+
+    m_tbConnection.disconnect();
+}
+
+void MergePointDetector::onFunctionCall(S2EExecutionState *state, FunctionMonitorState *fns)
+{
+    FUNCMON_REGISTER_RETURN_A(state, fns, MergePointDetector::onFunctionReturn,
+                              state->getForkDepth());
+}
+
+void MergePointDetector::onFunctionReturn(S2EExecutionState *state, unsigned forkDepth)
+{
+    //Nothing to merge with if the state did not fork during the call
+    if (state->getForkDepth() == forkDepth) {
+        return;
+    }
+
+    //Queueing the state interrupts the return, which is executed again
+    //when the state is resumed.
+    uint64_t icount = state->getTotalInstructionCount();
+    std::map<S2EExecutionState*, uint64_t>::iterator it = m_lastRequest.find(state);
+    if (it != m_lastRequest.end() && (*it).second == icount) {
+        return;
+    }
+
+    //Symbolic execution is needed for merging, this restarts the return
+    //symbolically if the state runs concretely.
+    state->jumpToSymbolicCpp();
+
+    m_lastRequest[state] = icount;
+
+    s2e()->getDebugStream(state) << "MergePointDetector: return to " << hexval(state->getPc())
+            << " after " << state->getForkDepth() - forkDepth << " forks" << '\n';
+
+    s2e()->getExecutor()->queueStateForMerge(state);
+}
+
+void MergePointDetector::onStateKill(S2EExecutionState *state)
+{
+    m_lastRequest.erase(state);
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,89 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_MERGEPOINTDETECTOR_H
+#define S2E_PLUGINS_MERGEPOINTDETECTOR_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/Plugins/FunctionMonitor.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <map>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Places merge points automatically at function returns.
+ *  When a state returns from a function inside of which it forked,
+ *  its siblings are likely to return to the same address with the same
+ *  stack pointer. The state is queued for merging at that point, as if
+ *  the guest had issued the merge opcode.
+ *
+ *  Requires the MergingSearcher (-use-merge).
+ */
+class MergePointDetector : public Plugin
+{
+    S2E_PLUGIN
+public:
+    MergePointDetector(S2E* s2e): Plugin(s2e) {}
+    void initialize();
+
+private:
+    FunctionMonitor *m_functionMonitor;
+    sigc::connection m_tbConnection;
+
+    //Function entry points to monitor, empty for all of them
+    ConfigFile::integer_list m_functions;
+    uint64_t m_pid;
+
+    //Instruction count of the last merge request of each state
+    std::map<S2EExecutionState*, uint64_t> m_lastRequest;
+
+    void onTranslateBlockStart(ExecutionSignal *signal,
+                               S2EExecutionState *state,
+                               TranslationBlock *tb,
+                               uint64_t pc);
+
+    void onFunctionCall(S2EExecutionState *state, FunctionMonitorState *fns);
+    void onFunctionReturn(S2EExecutionState *state, unsigned forkDepth);
+    void onStateKill(S2EExecutionState *state);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/S2EExecutor.h>
+#include <s2e/S2EStatsTracker.h>
+#include <s2e/Utils.h>
+
+#include <klee/CoreStats.h>
+
+#include "MetricsServer.h"
+
+#include <sstream>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(MetricsServer, "Serves live statistics of all S2E instances over HTTP", "",);
+
+void MetricsServer::initialize()
+{
+#ifdef _WIN32
+    s2e()->getWarningsStream() << "MetricsServer is not supported on Windows" << '\n';
+#else
+    //tcp:host:port or unix:/path/to/socket
+    m_address = s2e()->getConfig()->getString(getConfigKey() + ".address",
+                                              "unix:" + s2e()->getOutputFilename("metrics.sock"));
+
+    if (!openSocket()) {
+        exit(-1);
+    }
+
+    if (pipe(m_wakeupPipe) < 0) {
+        s2e()->getWarningsStream() << "MetricsServer: could not create pipe" << '\n';
+        exit(-1);
+    }
+
+    publish();
+    startServer();
+
+    s2e()->getMessagesStream() << "MetricsServer: serving statistics on " << m_address << '\n';
+
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &MetricsServer::onTimer));
+
+    s2e()->getCorePlugin()->onProcessFork.connect(
+            sigc::mem_fun(*this, &MetricsServer::onProcessFork));
+#endif
+}
+
+MetricsServer::~MetricsServer()
+{
+#ifndef _WIN32
+    stopServer();
+
+    if (m_socket >= 0) {
+        close(m_socket);
+        close(m_wakeupPipe[0]);
+        close(m_wakeupPipe[1]);
+
+        if (m_address.compare(0, 5, "unix:") == 0) {
+            unlink(m_address.substr(5).c_str());
+        }
+    }
+#endif
+}
+
+#ifndef _WIN32
+
+bool MetricsServer::openSocket()
+{
+    if (m_address.compare(0, 5, "unix:") == 0) {
+        std::string path = m_address.substr(5);
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            s2e()->getWarningsStream() << "MetricsServer: socket path " << path << " is too long" << '\n';
+            return false;
+        }
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(path.c_str());
+
+        m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_socket < 0 || bind(m_socket, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            listen(m_socket, 16) < 0) {
+            s2e()->getWarningsStream() << "MetricsServer: cannot listen on " << path
+                                       << ": " << strerror(errno) << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    if (m_address.compare(0, 4, "tcp:") == 0) {
+        std::string hostPort = m_address.substr(4);
+        size_t colon = hostPort.rfind(':');
+        if (colon == std::string::npos) {
+            s2e()->getWarningsStream() << "MetricsServer: invalid address " << m_address << '\n';
+            return false;
+        }
+
+        std::string host = hostPort.substr(0, colon);
+        std::string port = hostPort.substr(colon + 1);
+
+        struct addrinfo hints, *result, *rp;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &result)) {
+            s2e()->getWarningsStream() << "MetricsServer: cannot resolve " << m_address << '\n';
+            return false;
+        }
+
+        for (rp = result; rp; rp = rp->ai_next) {
+            m_socket = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+            if (m_socket < 0) {
+                continue;
+            }
+
+            int one = 1;
+            setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+            if (bind(m_socket, rp->ai_addr, rp->ai_addrlen) == 0 && listen(m_socket, 16) == 0) {
+                break;
+            }
+
+            close(m_socket);
+            m_socket = -1;
+        }
+        freeaddrinfo(result);
+
+        if (m_socket < 0) {
+            s2e()->getWarningsStream() << "MetricsServer: cannot listen on " << m_address << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    s2e()->getWarningsStream() << "MetricsServer: invalid address " << m_address << '\n';
+    return false;
+}
+
+void MetricsServer::startServer()
+{
+    m_serverRunning = true;
+    qemu_thread_create(&m_serverThread, serverThread, this, QEMU_THREAD_JOINABLE);
+}
+
+void MetricsServer::stopServer()
+{
+    if (!m_serverRunning) {
+        return;
+    }
+
+    char c = 0;
+    if (write(m_wakeupPipe[1], &c, 1) < 0) {
+        //The thread cannot be stopped, do not wait for it
+        m_serverRunning = false;
+        return;
+    }
+
+    qemu_thread_join(&m_serverThread);
+    m_serverRunning = false;
+
+    //Drain the wakeup byte for the next start
+    if (read(m_wakeupPipe[0], &c, 1) < 0) {
+        s2e()->getWarningsStream() << "MetricsServer: could not reset the wakeup pipe" << '\n';
+    }
+}
+
+void *MetricsServer::serverThread(void *opaque)
+{
+    static_cast<MetricsServer*>(opaque)->serverLoop();
+    return NULL;
+}
+
+void MetricsServer::serverLoop()
+{
+    for (;;) {
+        struct pollfd fds[2];
+        fds[0].fd = m_socket;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = m_wakeupPipe[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[1].revents) {
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(m_socket, NULL, NULL);
+            if (fd >= 0) {
+                serveClient(fd);
+                close(fd);
+            }
+        }
+    }
+}
+
+/** Answers one HTTP request, any path but /metrics gets a 404 */
+void MetricsServer::serveClient(int fd)
+{
+    //A stuck client must not block the other ones for long
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string request;
+    char buffer[512];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t ret = ::read(fd, buffer, sizeof(buffer));
+        if (ret <= 0) {
+            break;
+        }
+        request.append(buffer, ret);
+    }
+
+    std::string status, body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        status = "200 OK";
+        body = formatMetrics();
+    } else {
+        status = "404 Not Found";
+        body = "Not found\n";
+    }
+
+    std::stringstream ss;
+    ss << "HTTP/1.0 " << status << "\r\n"
+       << "Content-Type: text/plain; version=0.0.4\r\n"
+       << "Content-Length: " << body.size() << "\r\n"
+       << "Connection: close\r\n\r\n"
+       << body;
+
+    std::string reply = ss.str();
+    const char *data = reply.c_str();
+    size_t left = reply.size();
+    while (left > 0) {
+        ssize_t ret = ::write(fd, data, left);
+        if (ret <= 0) {
+            break;
+        }
+        data += ret;
+        left -= ret;
+    }
+}
+
+namespace {
+
+struct MetricDescriptor {
+    const char *name;
+    const char *type;
+    const char *help;
+    uint64_t S2EProcessMetrics::*field;
+    double scale;
+};
+
+const MetricDescriptor s_metrics[] = {
+    {"s2e_states", "gauge", "Number of states", &S2EProcessMetrics::states, 1},
+    {"s2e_forks_total", "counter", "Number of forks", &S2EProcessMetrics::forks, 1},
+    {"s2e_instructions_total", "counter", "Guest instructions executed", &S2EProcessMetrics::instructions, 1},
+    {"s2e_translation_blocks_total", "counter", "Translation blocks executed", &S2EProcessMetrics::translationBlocks, 1},
+    {"s2e_solver_seconds_total", "counter", "Time spent in the constraint solver", &S2EProcessMetrics::solverTime, 1e-6},
+    {"s2e_resident_memory_bytes", "gauge", "Resident set size", &S2EProcessMetrics::memoryUsage, 1},
+};
+
+}
+
+std::string MetricsServer::formatMetrics()
+{
+    std::map<unsigned, S2EProcessMetrics> metrics;
+    s2e()->getProcessMetrics(metrics);
+
+    std::stringstream ss;
+    ss << "# HELP s2e_instances Number of running S2E instances\n"
+       << "# TYPE s2e_instances gauge\n"
+       << "s2e_instances " << metrics.size() << "\n";
+
+    for (unsigned i = 0; i < sizeof(s_metrics) / sizeof(s_metrics[0]); ++i) {
+        const MetricDescriptor &d = s_metrics[i];
+        ss << "# HELP " << d.name << " " << d.help << "\n"
+           << "# TYPE " << d.name << " " << d.type << "\n";
+
+        foreach2(it, metrics.begin(), metrics.end()) {
+            uint64_t value = (*it).second.*d.field;
+            ss << d.name << "{instance=\"" << (*it).first << "\"} ";
+            if (d.scale == 1) {
+                ss << value;
+            } else {
+                ss << value * d.scale;
+            }
+            ss << "\n";
+        }
+    }
+
+    //A growing age means that the instance is stuck, e.g., in the solver
+    uint64_t now = time(NULL);
+    ss << "# HELP s2e_update_age_seconds Time since the instance last published its counters\n"
+       << "# TYPE s2e_update_age_seconds gauge\n";
+    foreach2(it, metrics.begin(), metrics.end()) {
+        uint64_t updateTime = (*it).second.updateTime;
+        ss << "s2e_update_age_seconds{instance=\"" << (*it).first << "\"} "
+           << (updateTime && now > updateTime ? now - updateTime : 0) << "\n";
+    }
+
+    return ss.str();
+}
+
+void MetricsServer::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
+{
+    if (preFork) {
+        stopServer();
+        return;
+    }
+
+    //Only the first instance serves, the children only publish
+    if (m_socket < 0) {
+        return;
+    }
+
+    if (isChild) {
+        close(m_socket);
+        close(m_wakeupPipe[0]);
+        close(m_wakeupPipe[1]);
+        m_socket = -1;
+        publish();
+        return;
+    }
+
+    startServer();
+}
+
+#endif
+
+void MetricsServer::publish()
+{
+    S2EProcessMetrics m;
+    m.updateTime = time(NULL);
+    m.states = s2e()->getExecutor()->getStatesCount();
+    m.forks = klee::stats::forks;
+    m.instructions = klee::stats::cpuInstructions;
+    m.translationBlocks = klee::stats::translationBlocks;
+    m.solverTime = klee::stats::solverTime;
+    m.memoryUsage = S2EStatsTracker::getProcessResidentMemoryUsage();
+    s2e()->setCurrentProcessMetrics(m);
+}
+
+void MetricsServer::onTimer()
+{
+    publish();
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,95 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_METRICSSERVER_H
+#define S2E_PLUGINS_METRICSSERVER_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2E.h>
+
+#include <string>
+
+extern "C" {
+#include <qemu-thread.h>
+}
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Serves the counters of all the S2E instances of the run over HTTP,
+ *  in the Prometheus text format. Every instance publishes its counters
+ *  in the shared memory block once per second. The server thread
+ *  of the first instance reads them without stopping anybody.
+ */
+class MetricsServer : public Plugin
+{
+    S2E_PLUGIN
+public:
+    MetricsServer(S2E* s2e): Plugin(s2e), m_socket(-1), m_serverRunning(false) {}
+    ~MetricsServer();
+
+    void initialize();
+
+private:
+    std::string m_address;
+    int m_socket;
+
+    //Writing to the pipe wakes up the server thread to stop it
+    int m_wakeupPipe[2];
+
+    QemuThread m_serverThread;
+    bool m_serverRunning;
+
+    bool openSocket();
+    void startServer();
+    void stopServer();
+
+    static void *serverThread(void *opaque);
+    void serverLoop();
+    void serveClient(int fd);
+    std::string formatMetrics();
+
+    void publish();
+
+    void onTimer();
+    void onProcessFork(bool preFork, bool isChild, unsigned parentProcId);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif // S2E_PLUGINS_METRICSSERVER_H
@@ -71,6 +71,7 @@ extern CPUArchState *env;
 
 #include "ModuleExecutionDetector.h"
 #include <assert.h>
+#include <algorithm>
 #include <sstream>
 
 using namespace s2e;
@@ -109,7 +110,7 @@ void ModuleExecutionDetector::initialize()
     s2e()->getCorePlugin()->onException.connect(
         sigc::mem_fun(*this, &ModuleExecutionDetector::exceptionListener));
 
-    s2e()->getCorePlugin()->onCustomInstruction.connect(
+    s2e()->getCorePlugin()->getCustomInstructionSignal(MODULE_EXECUTION_DETECTOR_OPCODE).connect(
         sigc::mem_fun(*this, &ModuleExecutionDetector::onCustomInstruction));
 
     initializeConfiguration();
@@ -360,7 +361,7 @@ bool ModuleExecutionDetector::isModuleConfigured(const std::string &moduleId) co
 
 const ModuleDescriptor *ModuleExecutionDetector::getModule(S2EExecutionState *state, uint64_t pc, bool tracked)
 {
-    DECLARE_PLUGINSTATE(ModuleTransitionState, state);
+    DECLARE_PLUGINSTATE_CONST(ModuleTransitionState, state);
     uint64_t pid = m_Monitor->getPid(state, pc);
 
     const ModuleDescriptor *currentModule =
@@ -386,7 +387,7 @@ void ModuleExecutionDetector::onTranslateBlockStart(
     TranslationBlock *tb,
     uint64_t pc)
 {
-    DECLARE_PLUGINSTATE(ModuleTransitionState, state);
+    DECLARE_PLUGINSTATE_CONST(ModuleTransitionState, state);
 
     uint64_t pid = m_Monitor->getPid(state, pc);
 
@@ -411,7 +412,7 @@ void ModuleExecutionDetector::onTranslateBlockEnd(
         bool staticTarget,
         uint64_t targetPc)
 {
-    DECLARE_PLUGINSTATE(ModuleTransitionState, state);
+    DECLARE_PLUGINSTATE_CONST(ModuleTransitionState, state);
 
     const ModuleDescriptor *currentModule =
             getCurrentDescriptor(state);
@@ -561,17 +562,30 @@ ModuleTransitionState::~ModuleTransitionState()
     }
 }
 
+uint64_t ModuleTransitionState::getMemoryUsage() const
+{
+    //Each state owns a copy of the descriptors, count the set nodes too
+    unsigned descriptors = m_Descriptors.size() + m_NotTrackedDescriptors.size();
+    return sizeof(*this) +
+           descriptors * (sizeof(ModuleDescriptor) + 4 * sizeof(void*)) +
+           (m_Ranges.capacity() + m_NotTrackedRanges.capacity()) * sizeof(ModuleRange);
+}
+
 ModuleTransitionState* ModuleTransitionState::clone() const
 {
     ModuleTransitionState *ret = new ModuleTransitionState();
 
     foreach2(it, m_Descriptors.begin(), m_Descriptors.end()) {
-        ret->m_Descriptors.insert(new ModuleDescriptor(**it));
+        const ModuleDescriptor *md = new ModuleDescriptor(**it);
+        ret->m_Descriptors.insert(md);
+        addRange(ret->m_Ranges, md);
     }
 
     foreach2(it, m_NotTrackedDescriptors.begin(), m_NotTrackedDescriptors.end()) {
         assert(*it != m_CachedModule && *it != m_PreviousModule);
-        ret->m_NotTrackedDescriptors.insert(new ModuleDescriptor(**it));
+        const ModuleDescriptor *md = new ModuleDescriptor(**it);
+        ret->m_NotTrackedDescriptors.insert(md);
+        addRange(ret->m_NotTrackedRanges, md);
     }
 
     if (m_CachedModule) {
@@ -611,37 +625,84 @@ const ModuleDescriptor *ModuleTransitionState::getDescriptor(uint64_t pid, uint6
         }
     }
 
-    ModuleDescriptor d;
-    d.Pid = pid;
-    d.LoadBase = pc;
-    d.Size = 1;
-    DescriptorSet::iterator it = m_Descriptors.find(&d);
-    if (it != m_Descriptors.end()) {
-        m_CachedModule = *it;
-        return *it;
+    const ModuleDescriptor *md = lookupRange(m_Ranges, pid, pc);
+    m_CachedModule = md;
+    if (md) {
+        return md;
     }
 
-    m_CachedModule = NULL;
-
     if (!tracked) {
-        it = m_NotTrackedDescriptors.find(&d);
-        if (it != m_NotTrackedDescriptors.end()) {
+        md = lookupRange(m_NotTrackedRanges, pid, pc);
+        if (md) {
             //XXX: implement proper caching
-            assert(*it != m_CachedModule && *it != m_PreviousModule);
-            return *it;
+            assert(md != m_CachedModule && md != m_PreviousModule);
+            return md;
+        }
+    }
+
+    return NULL;
+}
+
+void ModuleTransitionState::addRange(ModuleRangeTable &table, const ModuleDescriptor *desc)
+{
+    ModuleRange r;
+    r.pid = desc->Pid;
+    r.start = desc->LoadBase;
+    r.end = desc->LoadBase + desc->Size;
+    r.desc = desc;
+
+    table.insert(std::upper_bound(table.begin(), table.end(), r), r);
+}
+
+void ModuleTransitionState::removeRange(ModuleRangeTable &table, const ModuleDescriptor *desc)
+{
+    ModuleRange r;
+    r.pid = desc->Pid;
+    r.start = desc->LoadBase;
+
+    ModuleRangeTable::iterator it = std::lower_bound(table.begin(), table.end(), r);
+    for (; it != table.end() && !(r < *it); ++it) {
+        if ((*it).desc == desc) {
+            table.erase(it);
+            return;
         }
     }
+}
 
+const ModuleDescriptor *ModuleTransitionState::lookupRange(const ModuleRangeTable &table,
+                                                           uint64_t pid, uint64_t pc)
+{
+    ModuleRange r;
+    r.pid = pid;
+    r.start = pc;
+
+    //Find the last module that starts at or before pc
+    ModuleRangeTable::const_iterator it = std::upper_bound(table.begin(), table.end(), r);
+    if (it == table.begin()) {
+        return NULL;
+    }
+    --it;
+
+    if ((*it).pid == pid && pc < (*it).end) {
+        return (*it).desc;
+    }
     return NULL;
 }
 
 bool ModuleTransitionState::loadDescriptor(const ModuleDescriptor &desc, bool track)
 {
     if (track) {
-        m_Descriptors.insert(new ModuleDescriptor(desc));
+        const ModuleDescriptor *md = new ModuleDescriptor(desc);
+        if (m_Descriptors.insert(md).second) {
+            addRange(m_Ranges, md);
+        } else {
+            delete md;
+        }
     }else {
         if (m_NotTrackedDescriptors.find(&desc) == m_NotTrackedDescriptors.end()) {
-            m_NotTrackedDescriptors.insert(new ModuleDescriptor(desc));
+            const ModuleDescriptor *md = new ModuleDescriptor(desc);
+            m_NotTrackedDescriptors.insert(md);
+            addRange(m_NotTrackedRanges, md);
         }
         else {
             return false;
@@ -670,6 +731,7 @@ void ModuleTransitionState::unloadDescriptor(const ModuleDescriptor &desc)
         const ModuleDescriptor *md = *it;
         size_t s = m_Descriptors.erase(*it);
         assert(s == 1);
+        removeRange(m_Ranges, md);
         delete md;
     }
 
@@ -679,6 +741,7 @@ void ModuleTransitionState::unloadDescriptor(const ModuleDescriptor &desc)
         const ModuleDescriptor *md = *it;
         size_t s = m_NotTrackedDescriptors.erase(*it);
         assert(s == 1);
+        removeRange(m_NotTrackedRanges, md);
         delete md;
     }
 }
@@ -704,6 +767,7 @@ void ModuleTransitionState::unloadDescriptorsWithPid(uint64_t pid)
 
             const ModuleDescriptor *md = *it;
             m_Descriptors.erase(*it);
+            removeRange(m_Ranges, md);
             delete md;
 
             it = it1;
@@ -728,6 +792,7 @@ void ModuleTransitionState::unloadDescriptorsWithPid(uint64_t pid)
 
             const ModuleDescriptor *md = *it;
             m_NotTrackedDescriptors.erase(*it);
+            removeRange(m_NotTrackedRanges, md);
             delete md;
 
             it = it1;
@@ -44,6 +44,7 @@
 #include <s2e/Plugins/OSMonitor.h>
 
 #include <inttypes.h>
+#include <vector>
 #include "OSMonitor.h"
 
 #ifdef TARGET_I386
@@ -230,12 +231,37 @@ class ModuleTransitionState:public PluginState
 private:
     typedef std::set<const ModuleDescriptor*, ModuleDescriptor::ModuleByLoadBase> DescriptorSet;
 
+    /**
+     * Flat copy of a descriptor set sorted by (pid, start), used for
+     * lookups on the translation path. Updated on each load/unload.
+     */
+    struct ModuleRange {
+        uint64_t pid;
+        uint64_t start;
+        uint64_t end;
+        const ModuleDescriptor *desc;
+
+        bool operator<(const ModuleRange &r) const {
+            return pid < r.pid || (pid == r.pid && start < r.start);
+        }
+    };
+
+    typedef std::vector<ModuleRange> ModuleRangeTable;
+
     const ModuleDescriptor *m_PreviousModule;
     mutable const ModuleDescriptor *m_CachedModule;
 
     DescriptorSet m_Descriptors;
     DescriptorSet m_NotTrackedDescriptors;
 
+    ModuleRangeTable m_Ranges;
+    ModuleRangeTable m_NotTrackedRanges;
+
+    static void addRange(ModuleRangeTable &table, const ModuleDescriptor *desc);
+    static void removeRange(ModuleRangeTable &table, const ModuleDescriptor *desc);
+    static const ModuleDescriptor *lookupRange(const ModuleRangeTable &table,
+                                               uint64_t pid, uint64_t pc);
+
     const ModuleDescriptor *getDescriptor(uint64_t pid, uint64_t pc, bool tracked=true) const;
     bool loadDescriptor(const ModuleDescriptor &desc, bool track);
     void unloadDescriptor(const ModuleDescriptor &desc);
@@ -254,6 +280,8 @@ public:
     virtual ModuleTransitionState* clone() const;
     static PluginState *factory(Plugin *p, S2EExecutionState *s);
 
+    virtual uint64_t getMemoryUsage() const;
+
     friend class ModuleExecutionDetector;
 };
 
@@ -0,0 +1,314 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+#include "net.h"
+}
+
+#include "NicPacketInjector.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(NicPacketInjector, "Injects packets with symbolic fields through an emulated network card",
+                  "NicPacketInjector",);
+
+//The cards pad shorter frames in a local buffer, which would hide
+//the DMA copies of the template
+static const unsigned MinFrameSize = 60;
+
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool parseHex(const std::string &text, std::vector<uint8_t> &bytes)
+{
+    if (text.size() % 2) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < text.size(); i += 2) {
+        int hi = hexDigit(text[i]), lo = hexDigit(text[i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        bytes.push_back((hi << 4) | lo);
+    }
+    return true;
+}
+
+void NicPacketInjector::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+    bool ok = false;
+
+    m_model = cfg->getString(getConfigKey() + ".model", "");
+    m_injected = 0;
+    m_packet = NULL;
+    m_packetSize = 0;
+
+    ConfigFile::string_list keys = cfg->getListKeys(getConfigKey() + ".packets", &ok);
+    if (!ok || keys.empty()) {
+        s2e()->getWarningsStream() << "NicPacketInjector: no packets configured" << '\n';
+        exit(-1);
+    }
+
+    foreach2(it, keys.begin(), keys.end()) {
+        std::string key = getConfigKey() + ".packets." + *it;
+
+        PacketTemplate packet;
+        packet.name = *it;
+        packet.count = cfg->getInt(key + ".count", 1);
+
+        std::string text = cfg->getString(key + ".template", "", &ok);
+        if (!ok || !parseTemplate(text, packet)) {
+            s2e()->getWarningsStream() << "NicPacketInjector: invalid template for packet " << *it << '\n';
+            exit(-1);
+        }
+
+        m_templates.push_back(packet);
+    }
+}
+
+/**
+ *  A template is a list of tokens separated by spaces. A token is either
+ *  the hexadecimal value of concrete bytes (e.g., 0800), or a symbolic
+ *  field [name:]?size[=example], e.g. port:?2=0035. The example gives
+ *  the concrete value of the field in concolic mode and defaults to zeros.
+ */
+bool NicPacketInjector::parseTemplate(const std::string &text, PacketTemplate &packet)
+{
+    std::istringstream is(text);
+    std::string token;
+
+    while (is >> token) {
+        size_t mark = token.find('?');
+        if (mark == std::string::npos) {
+            if (!parseHex(token, packet.bytes)) {
+                return false;
+            }
+            continue;
+        }
+
+        Field field;
+        field.offset = packet.bytes.size();
+        field.name = token.substr(0, mark);
+        if (!field.name.empty() && field.name[field.name.size() - 1] == ':') {
+            field.name.erase(field.name.size() - 1);
+        }
+
+        std::string size = token.substr(mark + 1);
+        std::string example;
+        size_t eq = size.find('=');
+        if (eq != std::string::npos) {
+            example = size.substr(eq + 1);
+            size.erase(eq);
+        }
+
+        field.size = size.empty() ? 1 : strtoul(size.c_str(), NULL, 0);
+        if (!field.size) {
+            return false;
+        }
+
+        if (example.empty()) {
+            packet.bytes.resize(packet.bytes.size() + field.size, 0);
+        } else if (!parseHex(example, packet.bytes) ||
+                   packet.bytes.size() != field.offset + field.size) {
+            return false;
+        }
+
+        if (field.name.empty()) {
+            std::stringstream ss;
+            ss << "off" << field.offset;
+            field.name = ss.str();
+        }
+        packet.fields.push_back(field);
+    }
+
+    if (packet.bytes.size() < MinFrameSize) {
+        packet.bytes.resize(MinFrameSize, 0);
+    }
+
+    return true;
+}
+
+static void findNicCallback(NICState *nic, void *opaque)
+{
+    std::pair<const std::string*, VLANClientState*> *res =
+            static_cast<std::pair<const std::string*, VLANClientState*>*>(opaque);
+
+    if (res->second) {
+        return;
+    }
+
+    if (res->first->empty() || (nic->nc.model && *res->first == nic->nc.model)) {
+        res->second = &nic->nc;
+    }
+}
+
+VLANClientState *NicPacketInjector::findNic() const
+{
+    std::pair<const std::string*, VLANClientState*> res(&m_model, NULL);
+    qemu_foreach_nic(findNicCallback, &res);
+    return res.second;
+}
+
+void NicPacketInjector::onDmaWrite(S2EExecutionState *state, uint64_t hostAddress,
+                                   const uint8_t *buf, unsigned size)
+{
+    //Writes of descriptors and of the card's own buffers are ignored
+    if (buf < m_packet || buf + size > m_packet + m_packetSize) {
+        return;
+    }
+
+    DmaChunk chunk;
+    chunk.hostAddress = hostAddress;
+    chunk.offset = buf - m_packet;
+    chunk.size = size;
+    m_chunks.push_back(chunk);
+}
+
+bool NicPacketInjector::injectPacket(S2EExecutionState *state, VLANClientState *nic,
+                                     const PacketTemplate &packet)
+{
+    if (nic->link_down || (nic->info->can_receive && !nic->info->can_receive(nic))) {
+        return false;
+    }
+
+    m_packet = &packet.bytes[0];
+    m_packetSize = packet.bytes.size();
+    m_chunks.clear();
+
+    //Only listen to the DMA transfers of this receive call
+    sigc::connection c = s2e()->getCorePlugin()->onDmaWrite.connect(
+            sigc::mem_fun(*this, &NicPacketInjector::onDmaWrite));
+    ssize_t ret = nic->info->receive(nic, m_packet, m_packetSize);
+    c.disconnect();
+
+    m_packet = NULL;
+
+    //Filtered frames are reported as received but are not copied
+    if (ret <= 0 || m_chunks.empty()) {
+        return false;
+    }
+
+    unsigned index = m_injected++;
+
+    //The bytes are already in the guest, only the symbolic fields
+    //have to be written again
+    foreach2(fit, packet.fields.begin(), packet.fields.end()) {
+        const Field &field = *fit;
+
+        foreach2(cit, m_chunks.begin(), m_chunks.end()) {
+            unsigned start = std::max(field.offset, (*cit).offset);
+            unsigned end = std::min(field.offset + field.size, (*cit).offset + (*cit).size);
+            if (start >= end) {
+                continue;
+            }
+
+            std::stringstream name;
+            name << packet.name << "_" << index << "_" << field.name;
+
+            std::vector<unsigned char> example(packet.bytes.begin() + start,
+                                               packet.bytes.begin() + end);
+
+            uint64_t hostAddress = (*cit).hostAddress + (start - (*cit).offset);
+            if (!state->makeSymbolicBulk(hostAddress, end - start, name.str(), example,
+                                         S2EExecutionState::HostAddress)) {
+                s2e()->getWarningsStream(state) << "NicPacketInjector: could not make "
+                                                << name.str() << " symbolic" << '\n';
+            }
+        }
+    }
+
+    return true;
+}
+
+unsigned NicPacketInjector::injectBatch(S2EExecutionState *state, unsigned *dropped)
+{
+    unsigned accepted = 0, rejected = 0;
+
+    VLANClientState *nic = findNic();
+    if (!nic) {
+        s2e()->getWarningsStream(state) << "NicPacketInjector: could not find the network card "
+                                        << m_model << '\n';
+    } else {
+        foreach2(it, m_templates.begin(), m_templates.end()) {
+            for (unsigned i = 0; i < (*it).count; ++i) {
+                if (injectPacket(state, nic, *it)) {
+                    ++accepted;
+                } else {
+                    ++rejected;
+                }
+            }
+        }
+    }
+
+    s2e()->getMessagesStream(state) << "NicPacketInjector: the card accepted " << accepted
+                                    << " packets and dropped " << rejected << '\n';
+
+    if (dropped) {
+        *dropped = rejected;
+    }
+    return accepted;
+}
+
+void NicPacketInjector::handleOpcodeInvocation(S2EExecutionState *state,
+                                               uint64_t guestDataPtr,
+                                               uint64_t guestDataSize)
+{
+    Command cmd;
+    cmd.accepted = injectBatch(state, &cmd.dropped);
+
+    if (guestDataPtr && guestDataSize >= sizeof(cmd)) {
+        state->writeMemoryConcrete(guestDataPtr, &cmd, sizeof(cmd));
+    }
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,126 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_NIC_PACKET_INJECTOR_H
+#define S2E_PLUGINS_NIC_PACKET_INJECTOR_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+
+#include "BaseInstructions.h"
+
+#include <string>
+#include <vector>
+
+struct VLANClientState;
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Passes batches of packets to the receive path of an emulated network
+ *  card (e.g., e1000 or rtl8139), which places them in the RX ring of the
+ *  guest driver like real traffic. The packets come from templates that
+ *  mark some fields as symbolic. The plugin records where the card writes
+ *  each byte by DMA and only makes the symbolic fields of the accepted
+ *  packets symbolic, in place, with one array per field.
+ *
+ *  The guest triggers the injection of a batch with s2e_invoke_plugin.
+ */
+class NicPacketInjector : public Plugin, public BaseInstructionsPluginInvokerInterface
+{
+    S2E_PLUGIN
+public:
+    NicPacketInjector(S2E* s2e): Plugin(s2e) {}
+
+    void initialize();
+
+    /** Written back to the guest buffer of s2e_invoke_plugin, if it is large enough */
+    struct Command {
+        uint32_t accepted;
+        uint32_t dropped;
+    };
+
+    virtual void handleOpcodeInvocation(S2EExecutionState *state,
+                                        uint64_t guestDataPtr,
+                                        uint64_t guestDataSize);
+
+    /** Injects a batch, returns the number of packets the card accepted */
+    unsigned injectBatch(S2EExecutionState *state, unsigned *dropped = NULL);
+
+private:
+    struct Field {
+        std::string name;
+        unsigned offset;
+        unsigned size;
+    };
+
+    struct PacketTemplate {
+        std::string name;
+        //Concrete bytes, with the example values of the symbolic fields
+        std::vector<uint8_t> bytes;
+        std::vector<Field> fields;
+        unsigned count;
+    };
+
+    //A range of the packet that the card copied to the guest
+    struct DmaChunk {
+        uint64_t hostAddress;
+        unsigned offset;
+        unsigned size;
+    };
+
+    std::vector<PacketTemplate> m_templates;
+    std::string m_model;
+    unsigned m_injected;
+
+    const uint8_t *m_packet;
+    unsigned m_packetSize;
+    std::vector<DmaChunk> m_chunks;
+
+    bool parseTemplate(const std::string &text, PacketTemplate &packet);
+    VLANClientState *findNic() const;
+    bool injectPacket(S2EExecutionState *state, VLANClientState *nic,
+                      const PacketTemplate &packet);
+
+    void onDmaWrite(S2EExecutionState *state, uint64_t hostAddress,
+                    const uint8_t *buf, unsigned size);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif // S2E_PLUGINS_NIC_PACKET_INJECTOR_H
@@ -146,7 +146,7 @@ void RawMonitor::initialize()
     m_onTranslateInstruction = s2e()->getCorePlugin()->onTranslateInstructionStart.connect(
         sigc::mem_fun(*this, &RawMonitor::onTranslateInstructionStart));
 
-    s2e()->getCorePlugin()->onCustomInstruction.connect(
+    s2e()->getCorePlugin()->getCustomInstructionSignal(RAW_MONITOR_OPCODE).connect(
             sigc::mem_fun(*this, &RawMonitor::onCustomInstruction));
 
 }
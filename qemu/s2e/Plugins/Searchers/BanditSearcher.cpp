@@ -0,0 +1,254 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "BanditSearcher.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/S2EExecutor.h>
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+namespace s2e {
+namespace plugins {
+
+using namespace llvm;
+
+S2E_DEFINE_PLUGIN(BanditSearcher, "Schedules a set of searchers according to the new blocks they discover",
+                  "BanditSearcher", "ModuleExecutionDetector");
+
+BanditSearcher::~BanditSearcher()
+{
+    foreach2(it, m_arms.begin(), m_arms.end()) {
+        if ((*it).searcher != m_parentSearcher) {
+            delete (*it).searcher;
+        }
+    }
+}
+
+void BanditSearcher::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    m_quantum = cfg->getInt(getConfigKey() + ".quantum", 10);
+    m_decay = cfg->getDouble(getConfigKey() + ".decay", 0.9);
+    m_exploration = cfg->getDouble(getConfigKey() + ".exploration", 1.0);
+    m_minInterval = cfg->getInt(getConfigKey() + ".minStateSwitchInterval", 100);
+    m_maxInterval = cfg->getInt(getConfigKey() + ".maxStateSwitchInterval", 1000);
+    m_intervalPerTb = cfg->getInt(getConfigKey() + ".intervalPerNewTb", 10);
+
+    if (m_quantum == 0 || m_decay <= 0 || m_decay > 1 || m_minInterval > m_maxInterval) {
+        s2e()->getWarningsStream() << "BanditSearcher: invalid configuration" << '\n';
+        exit(-1);
+    }
+
+    ConfigFile::string_list defaultArms;
+    defaultArms.push_back("dfs");
+    defaultArms.push_back("random");
+    defaultArms.push_back("depth");
+
+    ConfigFile::string_list arms = cfg->getStringList(getConfigKey() + ".arms", defaultArms);
+
+    m_parentSearcher = s2e()->getExecutor()->getSearcher();
+
+    foreach2(it, arms.begin(), arms.end()) {
+        Arm arm;
+        arm.name = *it;
+        arm.searcher = createSearcher(*it);
+        arm.reward = 0;
+        arm.pulls = 0;
+
+        if (!arm.searcher) {
+            s2e()->getWarningsStream() << "BanditSearcher: unknown searcher " << *it << '\n';
+            exit(-1);
+        }
+        m_arms.push_back(arm);
+    }
+
+    if (m_arms.empty()) {
+        s2e()->getWarningsStream() << "BanditSearcher: no searcher specified" << '\n';
+        exit(-1);
+    }
+
+    m_currentArm = 0;
+    m_selections = 0;
+    m_quantumTbs = 0;
+    m_selectionTbs = 0;
+
+    ModuleExecutionDetector *detector =
+            static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+
+    detector->onModuleTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &BanditSearcher::onModuleTranslateBlockStart));
+
+    s2e()->getExecutor()->setSearcher(this);
+    s2e()->getExecutor()->setStateSwitchInterval(m_minInterval);
+}
+
+klee::Searcher *BanditSearcher::createSearcher(const std::string &name)
+{
+    klee::Executor &executor = *s2e()->getExecutor();
+
+    if (name == "default") {
+        return m_parentSearcher;
+    } else if (name == "dfs") {
+        return new klee::DFSSearcher();
+    } else if (name == "random") {
+        return new klee::RandomSearcher();
+    } else if (name == "random-path") {
+        return new klee::RandomPathSearcher(executor);
+    } else if (name == "depth") {
+        return new klee::WeightedRandomSearcher(executor, klee::WeightedRandomSearcher::Depth);
+    } else if (name == "query-cost") {
+        return new klee::WeightedRandomSearcher(executor, klee::WeightedRandomSearcher::QueryCost);
+    }
+
+    return NULL;
+}
+
+void BanditSearcher::onModuleTranslateBlockStart(ExecutionSignal *signal,
+                                                 S2EExecutionState *state,
+                                                 const ModuleDescriptor &module,
+                                                 TranslationBlock *tb,
+                                                 uint64_t pc)
+{
+    //Blocks are retranslated when the translation cache is flushed,
+    //only the first translation counts as a discovery.
+    if (m_coveredTbs[module.Name].insert(module.ToNativeBase(pc)).second) {
+        ++m_quantumTbs;
+        ++m_selectionTbs;
+    }
+}
+
+unsigned BanditSearcher::chooseArm() const
+{
+    double totalPulls = 0, maxAverage = 0;
+
+    for (unsigned i = 0; i < m_arms.size(); ++i) {
+        //Play every arm once before trusting the estimates
+        if (m_arms[i].pulls == 0) {
+            return i;
+        }
+        totalPulls += m_arms[i].pulls;
+        maxAverage = std::max(maxAverage, m_arms[i].reward / m_arms[i].pulls);
+    }
+
+    //UCB1 expects rewards in [0, 1], normalize by the best arm
+    unsigned best = 0;
+    double bestScore = -1;
+    for (unsigned i = 0; i < m_arms.size(); ++i) {
+        const Arm &arm = m_arms[i];
+        double average = arm.reward / arm.pulls;
+        double score = maxAverage > 0 ? average / maxAverage : 0;
+        score += m_exploration * std::sqrt(2 * std::log(std::max(totalPulls, 1.0)) / arm.pulls);
+
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+void BanditSearcher::endQuantum()
+{
+    foreach2(it, m_arms.begin(), m_arms.end()) {
+        (*it).reward *= m_decay;
+        (*it).pulls *= m_decay;
+    }
+
+    Arm &arm = m_arms[m_currentArm];
+    arm.reward += m_quantumTbs;
+    arm.pulls += 1;
+
+    unsigned next = chooseArm();
+    if (next != m_currentArm) {
+        s2e()->getDebugStream() << "BanditSearcher: switching from " << arm.name
+                << " (" << m_quantumTbs << " new blocks) to "
+                << m_arms[next].name << '\n';
+    }
+
+    m_currentArm = next;
+    m_selections = 0;
+    m_quantumTbs = 0;
+}
+
+void BanditSearcher::updateStateSwitchInterval()
+{
+    uint64_t interval = m_minInterval + m_selectionTbs * m_intervalPerTb;
+    if (interval > m_maxInterval) {
+        interval = m_maxInterval;
+    }
+
+    s2e()->getExecutor()->setStateSwitchInterval(interval);
+    m_selectionTbs = 0;
+}
+
+klee::ExecutionState& BanditSearcher::selectState()
+{
+    if (++m_selections >= m_quantum) {
+        endQuantum();
+    }
+
+    updateStateSwitchInterval();
+
+    return m_arms[m_currentArm].searcher->selectState();
+}
+
+void BanditSearcher::update(klee::ExecutionState *current,
+                            const std::set<klee::ExecutionState*> &addedStates,
+                            const std::set<klee::ExecutionState*> &removedStates)
+{
+    foreach2(it, m_arms.begin(), m_arms.end()) {
+        (*it).searcher->update(current, addedStates, removedStates);
+    }
+}
+
+bool BanditSearcher::empty()
+{
+    //All the arms track the same states
+    return m_arms[0].searcher->empty();
+}
+
+} // namespace plugins
+} // namespace s2e
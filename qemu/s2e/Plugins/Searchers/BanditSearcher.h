@@ -0,0 +1,132 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_BANDITSEARCHER_H
+#define S2E_PLUGINS_BANDITSEARCHER_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/Plugins/ModuleExecutionDetector.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <klee/Searcher.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Meta-searcher that treats a set of KLEE searchers as the arms of a
+ *  multi-armed bandit. Each arm is given a quantum of state selections,
+ *  the reward of an arm is the number of new translation blocks of the
+ *  configured modules discovered while it was active. Arms are chosen
+ *  with UCB1 over exponentially decayed rewards.
+ *
+ *  All the arms see all the state updates, switching arms is free.
+ *  The state switch interval of the executor grows with the discovery
+ *  rate of the active arm, letting productive states run longer.
+ */
+class BanditSearcher : public Plugin, public klee::Searcher
+{
+    S2E_PLUGIN
+public:
+    struct Arm {
+        std::string name;
+        klee::Searcher *searcher;
+
+        //Decayed sum of the rewards and of the number of quanta
+        double reward;
+        double pulls;
+    };
+
+    typedef std::vector<Arm> Arms;
+    typedef std::map<std::string, std::set<uint64_t> > TbsByModule;
+
+    BanditSearcher(S2E* s2e): Plugin(s2e) {}
+    ~BanditSearcher();
+    void initialize();
+
+    virtual klee::ExecutionState& selectState();
+    virtual void update(klee::ExecutionState *current,
+                        const std::set<klee::ExecutionState*> &addedStates,
+                        const std::set<klee::ExecutionState*> &removedStates);
+
+    virtual bool empty();
+
+private:
+    Arms m_arms;
+    unsigned m_currentArm;
+
+    //Previously installed searcher, owned by the executor
+    klee::Searcher *m_parentSearcher;
+
+    TbsByModule m_coveredTbs;
+
+    //Number of selections per quantum
+    unsigned m_quantum;
+    unsigned m_selections;
+
+    //New blocks in the current quantum and since the last selection
+    uint64_t m_quantumTbs;
+    uint64_t m_selectionTbs;
+
+    double m_decay;
+    double m_exploration;
+
+    //Bounds of the state switch interval in milliseconds
+    unsigned m_minInterval;
+    unsigned m_maxInterval;
+    unsigned m_intervalPerTb;
+
+    klee::Searcher *createSearcher(const std::string &name);
+    void endQuantum();
+    unsigned chooseArm() const;
+    void updateStateSwitchInterval();
+
+    void onModuleTranslateBlockStart(ExecutionSignal *signal,
+                                     S2EExecutionState *state,
+                                     const ModuleDescriptor &module,
+                                     TranslationBlock *tb,
+                                     uint64_t pc);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
@@ -70,6 +70,16 @@ S2E_DEFINE_PLUGIN(ConcolicDFSSearcher, "Depth-first searcher, prioritizing non-s
 void ConcolicDFSSearcher::initialize()
 {
     s2e()->getExecutor()->setSearcher(this);
+
+    //Every checkpointInterval forks, the path is checkpointed and the
+    //speculative states forked in between are dropped
+    m_checkpointInterval = s2e()->getConfig()->getInt(getConfigKey() + ".checkpointInterval", 0);
+    if (m_checkpointInterval >= 2) {
+        s2e()->getCorePlugin()->onStateFork.connect(
+                sigc::mem_fun(*this, &ConcolicDFSSearcher::onStateFork));
+        s2e()->getCorePlugin()->onStateKill.connect(
+                sigc::mem_fun(*this, &ConcolicDFSSearcher::onStateKill));
+    }
 }
 
 
@@ -86,6 +96,236 @@ klee::ExecutionState& ConcolicDFSSearcher::selectState()
     return *state;
 }
 
+void ConcolicDFSSearcher::onStateFork(S2EExecutionState *state,
+                                      const std::vector<S2EExecutionState*> &newStates,
+                                      const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    DECLARE_PLUGINSTATE(ConcolicDFSSearcherState, state);
+    if (plgState->m_replayForks > 0) {
+        replayFork(state, newStates);
+        return;
+    }
+
+    //The other states start their own checkpoints
+    S2EExecutionState *speculative = NULL;
+    foreach2(it, newStates.begin(), newStates.end()) {
+        if (*it == state) {
+            continue;
+        }
+        DECLARE_PLUGINSTATE_N(ConcolicDFSSearcherState, newPlgState, *it);
+        newPlgState->m_checkpoint = NULL;
+        newPlgState->m_forks = 0;
+        if ((*it)->isSpeculative()) {
+            speculative = *it;
+        }
+    }
+
+    if (!speculative) {
+        return;
+    }
+
+    S2EExecutor *executor = s2e()->getExecutor();
+
+    //The concolic values of a rebuilt state only cover the symbolic
+    //values that existed at the checkpoint
+    bool stale = plgState->m_checkpoint &&
+            plgState->m_checkpoint->symbolics != state->symbolics.size();
+
+    if (!plgState->m_checkpoint || stale ||
+            plgState->m_forks + 1 >= m_checkpointInterval) {
+        S2EExecutionState *copy = executor->checkpointForkingState(state);
+        if (copy) {
+            //The copy shares the plugin states until one of them changes
+            plgState = static_cast<ConcolicDFSSearcherState*>(
+                    getPluginState(state, &ConcolicDFSSearcherState::factory));
+
+            //The speculative state has the constraints before the fork
+            Checkpoint *checkpoint = new Checkpoint();
+            checkpoint->state = copy;
+            checkpoint->constraints = speculative->constraints;
+            checkpoint->symbolics = state->symbolics.size();
+            checkpoint->references = 1;
+
+            if (plgState->m_checkpoint) {
+                releaseCheckpoint(plgState->m_checkpoint);
+            }
+            plgState->m_checkpoint = checkpoint;
+            plgState->m_forks = 0;
+            return;
+        }
+    }
+
+    if (!plgState->m_checkpoint || stale) {
+        return;
+    }
+
+    ++plgState->m_forks;
+
+    foreach2(it, newStates.begin(), newStates.end()) {
+        S2EExecutionState *newState = *it;
+        if (newState == state || !newState->isSpeculative()) {
+            continue;
+        }
+
+        PendingBranch branch;
+        branch.checkpoint = plgState->m_checkpoint;
+        branch.forks = plgState->m_forks + 1;
+        branch.pc = state->getPc();
+        branch.constraints = newState->constraints;
+        branch.condition = newState->speculativeCondition;
+
+        ++branch.checkpoint->references;
+        m_pendingBranches.push_back(branch);
+        executor->discardForkedState(newState);
+    }
+}
+
+/**
+ * The state executes again the path from its checkpoint to the branch
+ * it rebuilds. The other states forked on the way already exist.
+ */
+void ConcolicDFSSearcher::replayFork(S2EExecutionState *state,
+                                     const std::vector<S2EExecutionState*> &newStates)
+{
+    S2EExecutor *executor = s2e()->getExecutor();
+    DECLARE_PLUGINSTATE(ConcolicDFSSearcherState, state);
+    Checkpoint *checkpoint = plgState->m_checkpoint;
+
+    if (!checkpoint->state) {
+        //The branch of the checkpoint, copy the state again for the
+        //next pending branches
+        checkpoint->state = executor->checkpointForkingState(state);
+        plgState = static_cast<ConcolicDFSSearcherState*>(
+                getPluginState(state, &ConcolicDFSSearcherState::factory));
+        if (!checkpoint->state) {
+            s2e()->getWarningsStream(state) << "ConcolicDFSSearcher: could not checkpoint pc "
+                    << hexval(state->getPc()) << " again" << '\n';
+            dropPendingBranches(checkpoint);
+        }
+    } else {
+        ++plgState->m_forks;
+    }
+
+    foreach2(it, newStates.begin(), newStates.end()) {
+        if (*it == state) {
+            continue;
+        }
+        DECLARE_PLUGINSTATE_N(ConcolicDFSSearcherState, newPlgState, *it);
+        newPlgState->m_checkpoint = NULL;
+        newPlgState->m_forks = 0;
+        newPlgState->m_replayForks = 0;
+        executor->discardForkedState(*it);
+    }
+
+    if (--plgState->m_replayForks == 0 && state->getPc() != plgState->m_replayPc) {
+        s2e()->getWarningsStream(state) << "ConcolicDFSSearcher: replay ended at pc "
+                << hexval(state->getPc()) << " instead of " << hexval(plgState->m_replayPc)
+                << '\n';
+    }
+}
+
+void ConcolicDFSSearcher::onStateKill(S2EExecutionState *state)
+{
+    DECLARE_PLUGINSTATE(ConcolicDFSSearcherState, state);
+    Checkpoint *checkpoint = plgState->m_checkpoint;
+    if (!checkpoint) {
+        return;
+    }
+
+    plgState->m_checkpoint = NULL;
+
+    if (!checkpoint->state) {
+        //Killed before executing the branch of its checkpoint again
+        dropPendingBranches(checkpoint);
+    }
+
+    releaseCheckpoint(checkpoint);
+}
+
+void ConcolicDFSSearcher::releaseCheckpoint(Checkpoint *checkpoint)
+{
+    assert(checkpoint->references > 0);
+    if (--checkpoint->references) {
+        return;
+    }
+
+    if (checkpoint->state) {
+        s2e()->getExecutor()->deleteSuspendedState(checkpoint->state);
+    }
+    delete checkpoint;
+}
+
+void ConcolicDFSSearcher::dropPendingBranches(Checkpoint *checkpoint)
+{
+    unsigned count = 0;
+    std::vector<PendingBranch>::iterator it = m_pendingBranches.begin();
+    while (it != m_pendingBranches.end()) {
+        if ((*it).checkpoint == checkpoint) {
+            it = m_pendingBranches.erase(it);
+            releaseCheckpoint(checkpoint);
+            ++count;
+        } else {
+            ++it;
+        }
+    }
+
+    if (count) {
+        s2e()->getWarningsStream() << "ConcolicDFSSearcher: lost the checkpoint of "
+                << count << " pending branches" << '\n';
+    }
+}
+
+/**
+ * Restores the constraints and computes the concolic values of the most
+ * recent pending branch in the suspended checkpoint, then resumes it.
+ * The state executes the path again until it reaches the branch.
+ * Returns NULL if all the pending branches are infeasible.
+ */
+S2EExecutionState *ConcolicDFSSearcher::rebuildPendingBranch()
+{
+    S2EExecutor *executor = s2e()->getExecutor();
+
+    while (!m_pendingBranches.empty()) {
+        PendingBranch branch = m_pendingBranches.back();
+        m_pendingBranches.pop_back();
+
+        Checkpoint *checkpoint = branch.checkpoint;
+        S2EExecutionState *state = checkpoint->state;
+        assert(state && "The checkpoint is being replayed");
+
+        state->constraints = branch.constraints;
+        state->speculativeCondition = branch.condition;
+        state->speculative = true;
+        state->concolics.clear();
+
+        if (!executor->resolveSpeculativeState(*state)) {
+            releaseCheckpoint(checkpoint);
+            continue;
+        }
+
+        //Replay with the constraints of the checkpoint, the path
+        //adds the other ones again.
+        state->constraints = checkpoint->constraints;
+        checkpoint->state = NULL;
+
+        //The pending branch passes its checkpoint reference to the state
+        DECLARE_PLUGINSTATE(ConcolicDFSSearcherState, state);
+        plgState->m_checkpoint = checkpoint;
+        plgState->m_forks = 0;
+        plgState->m_replayForks = branch.forks;
+        plgState->m_replayPc = branch.pc;
+
+        s2e()->getMessagesStream(state) << "ConcolicDFSSearcher: replaying "
+                << branch.forks << " forks to rebuild the branch at pc "
+                << hexval(branch.pc) << '\n';
+
+        executor->resumeState(state);
+        return state;
+    }
+
+    return NULL;
+}
+
 
 void ConcolicDFSSearcher::update(klee::ExecutionState *current,
                     const std::set<klee::ExecutionState*> &addedStates,
@@ -131,9 +371,37 @@ void ConcolicDFSSearcher::update(klee::ExecutionState *current,
 
 bool ConcolicDFSSearcher::empty()
 {
+    //The rebuilt state is resumed as a normal one
+    if (m_normalStates.empty() && m_speculativeStates.empty()) {
+        rebuildPendingBranch();
+    }
+
     return m_normalStates.empty() && m_speculativeStates.empty();
 }
 
+ConcolicDFSSearcherState::ConcolicDFSSearcherState()
+{
+    m_checkpoint = NULL;
+    m_forks = 0;
+    m_replayForks = 0;
+    m_replayPc = 0;
+}
+
+ConcolicDFSSearcherState::~ConcolicDFSSearcherState()
+{
+
+}
+
+PluginState *ConcolicDFSSearcherState::clone() const
+{
+    return new ConcolicDFSSearcherState(*this);
+}
+
+PluginState *ConcolicDFSSearcherState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new ConcolicDFSSearcherState();
+}
+
 
 } // namespace plugins
 } // namespace s2e
@@ -42,8 +42,10 @@
 #include <s2e/S2EExecutionState.h>
 
 #include <klee/Searcher.h>
+#include <klee/Constraints.h>
 
 #include <set>
+#include <vector>
 
 namespace s2e {
 namespace plugins {
@@ -65,6 +67,27 @@ class ConcolicDFSSearcher : public Plugin, public klee::Searcher
     typedef std::set<klee::ExecutionState*, SortById> States;
 
 public:
+    /** Suspended copy of a path taken at a branch. The state is NULL
+        while a branch is being rebuilt from it. References come from
+        the pending branches and from the states that follow the path. */
+    struct Checkpoint {
+        S2EExecutionState *state;
+        klee::ConstraintManager constraints;
+        unsigned symbolics;
+        unsigned references;
+    };
+
+    /** Speculative state that was dropped and can be rebuilt by
+        executing the path again from its checkpoint */
+    struct PendingBranch {
+        Checkpoint *checkpoint;
+        /** Number of forks to replay, including the checkpoint one */
+        unsigned forks;
+        uint64_t pc;
+        klee::ConstraintManager constraints;
+        klee::ref<klee::Expr> condition;
+    };
+
     ConcolicDFSSearcher(S2E* s2e): Plugin(s2e) {}
     void initialize();
 
@@ -81,8 +104,44 @@ private:
 
     States m_normalStates;
     States m_speculativeStates;
+
+    unsigned m_checkpointInterval;
+    std::vector<PendingBranch> m_pendingBranches;
+
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+
+    void onStateKill(S2EExecutionState *state);
+
+    void replayFork(S2EExecutionState *state,
+                    const std::vector<S2EExecutionState*> &newStates);
+
+    void releaseCheckpoint(Checkpoint *checkpoint);
+    void dropPendingBranches(Checkpoint *checkpoint);
+    S2EExecutionState *rebuildPendingBranch();
 };
 
+class ConcolicDFSSearcherState : public PluginState
+{
+    /** Checkpoint of the path followed by the state */
+    ConcolicDFSSearcher::Checkpoint *m_checkpoint;
+
+    /** Forks since the checkpoint */
+    unsigned m_forks;
+
+    /** Forks left to replay, the new states they create are discarded */
+    unsigned m_replayForks;
+    uint64_t m_replayPc;
+
+public:
+    ConcolicDFSSearcherState();
+    virtual ~ConcolicDFSSearcherState();
+    virtual PluginState *clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class ConcolicDFSSearcher;
+};
 
 
 } // namespace plugins
@@ -41,6 +41,12 @@
  * This searcher is useful for debugging S2E, becauses it allows
  * to control the sequence of executed states.
  *
+ * The guest can also give priorities to the states. Setting a priority
+ * does not interrupt the current state, the priorities are only used when
+ * the current state terminates, asks for the highest priority state, or at
+ * each scheduling point with the preempt option. Forked states inherit the
+ * priority of their parent.
+ *
  * RESERVES THE CUSTOM OPCODE 0xAB
  */
 
@@ -72,9 +78,32 @@ void CooperativeSearcher::initialize()
 {
     m_searcherInited = false;
     m_currentState = NULL;
+    m_preempt = s2e()->getConfig()->getBool(getConfigKey() + ".preempt");
     initializeSearcher();
 }
 
+void CooperativeSearcher::setPriority(uint32_t id, int64_t priority)
+{
+    Priorities::iterator it = m_priorities.find(id);
+    if (it != m_priorities.end()) {
+        m_queue.erase(std::make_pair(-(*it).second, id));
+    }
+
+    m_priorities[id] = priority;
+    m_queue.insert(std::make_pair(-priority, id));
+}
+
+S2EExecutionState *CooperativeSearcher::getHighest() const
+{
+    if (m_queue.empty()) {
+        return NULL;
+    }
+
+    States::const_iterator it = m_states.find((*m_queue.begin()).second);
+    assert(it != m_states.end());
+    return (*it).second;
+}
+
 void CooperativeSearcher::initializeSearcher()
 {
     if (m_searcherInited) {
@@ -84,7 +113,7 @@ void CooperativeSearcher::initializeSearcher()
     s2e()->getExecutor()->setSearcher(this);
     m_searcherInited = true;
 
-    s2e()->getCorePlugin()->onCustomInstruction.connect(
+    s2e()->getCorePlugin()->getCustomInstructionSignal(COOPSEARCHER_OPCODE).connect(
             sigc::mem_fun(*this, &CooperativeSearcher::onCustomInstruction));
 
 }
@@ -93,12 +122,19 @@ void CooperativeSearcher::initializeSearcher()
 
 klee::ExecutionState& CooperativeSearcher::selectState()
 {
+    if (m_preempt && m_currentState) {
+        S2EExecutionState *highest = getHighest();
+        if (m_priorities[highest->getID()] > m_priorities[m_currentState->getID()]) {
+            m_currentState = highest;
+        }
+    }
+
     if (m_currentState) {
         return *m_currentState;
     }
 
     if (m_states.size() > 0) {
-        return *(*m_states.begin()).second;
+        return *getHighest();
     }
 
     assert(false && "There are no states to select!");
@@ -113,18 +149,32 @@ void CooperativeSearcher::update(klee::ExecutionState *current,
         S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*it);
         m_states.erase(es->getID());
 
+        Priorities::iterator pit = m_priorities.find(es->getID());
+        m_queue.erase(std::make_pair(-(*pit).second, es->getID()));
+        m_priorities.erase(pit);
+
         if (m_currentState == es) {
             m_currentState = NULL;
         }
     }
 
+    //New states start with the priority of the state that forked them
+    int64_t priority = 0;
+    if (current) {
+        Priorities::iterator pit = m_priorities.find(current->getID());
+        if (pit != m_priorities.end()) {
+            priority = (*pit).second;
+        }
+    }
+
     foreach2(it, addedStates.begin(), addedStates.end()) {
         S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*it);
         m_states[es->getID()] = es;
+        setPriority(es->getID(), priority);
     }
 
     if (m_currentState == NULL && m_states.size() > 0) {
-        m_currentState = (*m_states.begin()).second;
+        m_currentState = getHighest();
     }
 }
 
@@ -197,6 +247,66 @@ void CooperativeSearcher::onCustomInstruction(S2EExecutionState* state, uint64_t
             throw CpuExitException();
             break;
         }
+
+        //Set the priority of the current state, keep running it
+        case SetPriority:
+        {
+            target_ulong priority;
+            ok &= state->readCpuRegisterConcrete(CPU_OFFSET(COOPSEARCHER_NEXTSTATE),
+                                                 &priority, sizeof priority);
+            if(!ok) {
+                s2e()->getWarningsStream(state)
+                    << "ERROR: symbolic argument was passed to s2e_op "
+                       "CooperativeSearcher SetPriority" << '\n';
+                break;
+            }
+
+            setPriority(state->getID(), (int32_t) priority);
+            break;
+        }
+
+        //Set the priority of the given state, keep running the current one
+        case SetStatePriority:
+        {
+            target_ulong priority;
+            ok &= state->readCpuRegisterConcrete(CPU_OFFSET(COOPSEARCHER_NEXTSTATE),
+                                                 &nextState, sizeof nextState);
+            ok &= state->readCpuRegisterConcrete(CPU_OFFSET(COOPSEARCHER_PRIORITY),
+                                                 &priority, sizeof priority);
+            if(!ok) {
+                s2e()->getWarningsStream(state)
+                    << "ERROR: symbolic argument was passed to s2e_op "
+                       "CooperativeSearcher SetStatePriority" << '\n';
+                break;
+            }
+
+            if (m_states.find(nextState) == m_states.end()) {
+                s2e()->getWarningsStream(state)
+                    << "ERROR: Invalid state passed to " <<
+                    "CooperativeSearcher SetStatePriority: " << nextState << '\n';
+                break;
+            }
+
+            setPriority(nextState, (int32_t) priority);
+            break;
+        }
+
+        //Run the state with the highest priority, which may be the current one
+        case ScheduleHighest:
+        {
+            S2EExecutionState *highest = getHighest();
+            if (highest == m_currentState ||
+                m_priorities[highest->getID()] == m_priorities[m_currentState->getID()]) {
+                break;
+            }
+
+            m_currentState = highest;
+
+            //Force rescheduling
+            state->setPc(state->getPc() + S2E_OPCODE_SIZE);
+            throw CpuExitException();
+            break;
+        }
     }
 }
 
@@ -43,13 +43,17 @@
 
 #include <klee/Searcher.h>
 
+#include <map>
+#include <set>
 #include <vector>
 
 #define COOPSEARCHER_OPCODE 0xAB
 #if defined(TARGET_I386)
 #define COOPSEARCHER_NEXTSTATE regs[R_EAX]
+#define COOPSEARCHER_PRIORITY regs[R_ECX]
 #elif defined(TARGET_ARM)
 #define COOPSEARCHER_NEXTSTATE regs[0]
+#define COOPSEARCHER_PRIORITY regs[1]
 #endif
 
 namespace s2e {
@@ -62,15 +66,23 @@ public:
     enum CoopSchedulerOpcodes {
         ScheduleNext = 0,
         Yield = 1,
+        SetPriority = 2,
+        SetStatePriority = 3,
+        ScheduleHighest = 4
     };
 
     typedef std::map<uint32_t, S2EExecutionState*> States;
 
+    //Highest priority first, then lowest state id
+    typedef std::set<std::pair<int64_t, uint32_t> > Queue;
+    typedef std::map<uint32_t, int64_t> Priorities;
+
     CooperativeSearcher(S2E* s2e): Plugin(s2e) {}
     void initialize();
 
     //Selects the last specified state.
-    //If no states specified, schedules the one with the lowest ID.
+    //If no states specified, schedules the one with the highest priority,
+    //then the one with the lowest ID.
     virtual klee::ExecutionState& selectState();
 
 
@@ -86,8 +98,18 @@ private:
     States m_states;
     S2EExecutionState *m_currentState;
 
+    Queue m_queue;
+    Priorities m_priorities;
+
+    //Switch to a state of higher priority at each scheduling point,
+    //instead of waiting for the current state to give up the cpu
+    bool m_preempt;
+
     void initializeSearcher();
 
+    void setPriority(uint32_t id, int64_t priority);
+    S2EExecutionState *getHighest() const;
+
     void onCustomInstruction(S2EExecutionState* state, uint64_t opcode);
 };
 
@@ -45,6 +45,7 @@ extern "C" {
 #include <s2e/S2EExecutor.h>
 
 #include <iostream>
+#include <algorithm>
 
 #include <llvm/Instructions.h>
 #include <llvm/Constants.h>
@@ -65,9 +66,6 @@ void MaxTbSearcher::initialize()
     m_searcherInited = false;
     m_parentSearcher = NULL;
 
-    m_sorter.p = this;
-    m_states = StateSet(m_sorter);
-
     //XXX: Take care of module load/unload
     m_moduleExecutionDetector->onModuleTranslateBlockEnd.connect(
             sigc::mem_fun(*this, &MaxTbSearcher::onModuleTranslateBlockEnd)
@@ -227,12 +225,12 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
     uint64_t tbVa = curModule->ToRelative(state->getTb()->pc);
 
     if (!md) {
-        m_states.erase(state);
         m_coveredTbs[*curModule][tbVa]++;
         DECLARE_PLUGINSTATE(MaxTbSearcherState, state);
         plgState->m_metric = m_coveredTbs[*curModule][tbVa];
         plgState->m_metric *= state->queryCost < 1 ? 1 : state->queryCost;
-        m_states.insert(state);
+        plgState->m_metric *= 1 + state->queryTimeouts;
+        m_dirtyStates.push_back(state);
         return;
     }
 
@@ -249,8 +247,6 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
     bool NextTbIsNew = NewTbIt == tbm.end();
     bool CurTbIsNew = CurTbIt == tbm.end();
 
-    m_states.erase(state);
-
     /**
      * Update the frequency of the current and next
      * translation blocks
@@ -280,14 +276,134 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
 #endif
 
     plgState->m_metric *= state->queryCost < 1 ? 1 : state->queryCost;
+    plgState->m_metric *= 1 + state->queryTimeouts;
+
+    if (m_dirtyStates.empty() || m_dirtyStates.back() != state) {
+        m_dirtyStates.push_back(state);
+    }
+}
+
+MaxTbSearcherState *MaxTbSearcher::getHeapState(S2EExecutionState *s)
+{
+    DECLARE_PLUGINSTATE(MaxTbSearcherState, s);
+    return plgState;
+}
+
+bool MaxTbSearcher::isInHeap(S2EExecutionState *s, MaxTbSearcherState *plgState) const
+{
+    return plgState->m_heapIndex < m_states.size() &&
+           m_states[plgState->m_heapIndex].state == s;
+}
+
+void MaxTbSearcher::setHeapEntry(unsigned index, const HeapEntry &entry)
+{
+    m_states[index] = entry;
+    getHeapState(entry.state)->m_heapIndex = index;
+}
 
-    m_states.insert(state);
+void MaxTbSearcher::siftUp(unsigned index)
+{
+    HeapEntry entry = m_states[index];
+    while (index > 0) {
+        unsigned parent = (index - 1) / HeapArity;
+        if (m_states[parent].metric <= entry.metric) {
+            break;
+        }
+        setHeapEntry(index, m_states[parent]);
+        index = parent;
+    }
+    setHeapEntry(index, entry);
+}
+
+void MaxTbSearcher::siftDown(unsigned index)
+{
+    HeapEntry entry = m_states[index];
+    unsigned size = m_states.size();
+
+    while (true) {
+        unsigned first = index * HeapArity + 1;
+        if (first >= size) {
+            break;
+        }
+
+        unsigned last = std::min(first + HeapArity, size);
+        unsigned smallest = first;
+        for (unsigned i = first + 1; i < last; ++i) {
+            if (m_states[i].metric < m_states[smallest].metric) {
+                smallest = i;
+            }
+        }
+
+        if (entry.metric <= m_states[smallest].metric) {
+            break;
+        }
+        setHeapEntry(index, m_states[smallest]);
+        index = smallest;
+    }
+    setHeapEntry(index, entry);
+}
+
+//Inserts the state or moves it according to its new metric
+void MaxTbSearcher::updateHeap(S2EExecutionState *s)
+{
+    MaxTbSearcherState *plgState = getHeapState(s);
+
+    if (!isInHeap(s, plgState)) {
+        HeapEntry entry;
+        entry.metric = plgState->m_metric;
+        entry.state = s;
+        m_states.push_back(entry);
+        siftUp(m_states.size() - 1);
+        return;
+    }
+
+    unsigned index = plgState->m_heapIndex;
+    uint64_t oldMetric = m_states[index].metric;
+    m_states[index].metric = plgState->m_metric;
+    if (plgState->m_metric < oldMetric) {
+        siftUp(index);
+    } else if (plgState->m_metric > oldMetric) {
+        siftDown(index);
+    }
+}
+
+void MaxTbSearcher::removeFromHeap(S2EExecutionState *s)
+{
+    MaxTbSearcherState *plgState = getHeapState(s);
+    if (!isInHeap(s, plgState)) {
+        return;
+    }
+
+    unsigned index = plgState->m_heapIndex;
+    HeapEntry last = m_states.back();
+    m_states.pop_back();
+
+    if (index == m_states.size()) {
+        return;
+    }
+
+    uint64_t oldMetric = m_states[index].metric;
+    setHeapEntry(index, last);
+    if (last.metric < oldMetric) {
+        siftUp(index);
+    } else {
+        siftDown(index);
+    }
+}
+
+void MaxTbSearcher::flushDirtyStates()
+{
+    foreach2(it, m_dirtyStates.begin(), m_dirtyStates.end()) {
+        updateHeap(*it);
+    }
+    m_dirtyStates.clear();
 }
 
 klee::ExecutionState& MaxTbSearcher::selectState()
 {
+    flushDirtyStates();
+
     //If there are no prioritized states, revert to the parent searcher
-    StateSet::iterator it;
 
 #if 0
     uint64_t absNextPc = 0;
@@ -308,10 +424,8 @@ klee::ExecutionState& MaxTbSearcher::selectState()
 #endif
 
     if (m_states.size() > 0) {
-        S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*m_states.begin());
-        DECLARE_PLUGINSTATE(MaxTbSearcherState, es);
-        if (plgState->m_metric < 2) {
-            return *es;
+        if (m_states[0].metric < 2) {
+            return *m_states[0].state;
         }
 
     }
@@ -345,7 +459,7 @@ bool MaxTbSearcher::updatePc(S2EExecutionState *es)
             << '\n';
 #endif
 
-    m_states.insert(es);
+    updateHeap(es);
     return true;
 }
 
@@ -355,9 +469,11 @@ void MaxTbSearcher::update(klee::ExecutionState *current,
 {
     m_parentSearcher->update(current, addedStates, removedStates);
 
+    flushDirtyStates();
+
     foreach2(it, removedStates.begin(), removedStates.end()) {
         S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*it);
-        m_states.erase(es);
+        removeFromHeap(es);
     }
 
     foreach2(it, addedStates.begin(), addedStates.end()) {
@@ -368,6 +484,8 @@ void MaxTbSearcher::update(klee::ExecutionState *current,
 
 bool MaxTbSearcher::empty()
 {
+    flushDirtyStates();
+
     if (!m_states.empty()) {
         return false;
     }
@@ -378,7 +496,7 @@ bool MaxTbSearcher::empty()
 
 MaxTbSearcherState::MaxTbSearcherState()
 {
-
+    m_heapIndex = (unsigned) -1;
 }
 
 MaxTbSearcherState::MaxTbSearcherState(S2EExecutionState *s, Plugin *p)
@@ -386,6 +504,7 @@ MaxTbSearcherState::MaxTbSearcherState(S2EExecutionState *s, Plugin *p)
     m_metric = 0;
     m_plugin = static_cast<MaxTbSearcher*>(p);
     m_state = s;
+    m_heapIndex = (unsigned) -1;
 }
 
 MaxTbSearcherState::~MaxTbSearcherState()
@@ -56,6 +56,11 @@ private:
     uint64_t m_metric;
     MaxTbSearcher *m_plugin;
     S2EExecutionState *m_state;
+
+    //Position of the state in the searcher's heap. Only valid if the heap
+    //entry at that position refers to the state, forked states inherit
+    //the position of their parent.
+    unsigned m_heapIndex;
 public:
 
     MaxTbSearcherState();
@@ -72,25 +77,16 @@ class MaxTbSearcher : public Plugin, public klee::Searcher
 {
     S2E_PLUGIN
 public:
-    struct MaxTbSorter{
-        Plugin *p;
-
-        MaxTbSorter() {
-            p = NULL;
-        }
-
-        bool operator()(const S2EExecutionState *s1, const S2EExecutionState *s2) const{
-            const MaxTbSearcherState *p1 = static_cast<MaxTbSearcherState*>(p->getPluginState(const_cast<S2EExecutionState*>(s1), &MaxTbSearcherState::factory));
-            const MaxTbSearcherState *p2 = static_cast<MaxTbSearcherState*>(p->getPluginState(const_cast<S2EExecutionState*>(s2), &MaxTbSearcherState::factory));
-
-            if (p1->m_metric == p2->m_metric) {
-                return p1 < p2;
-            }
-            return p1->m_metric < p2->m_metric;
-        }
+    //Indexed min-heap of the prioritized states ordered by metric
+    struct HeapEntry {
+        uint64_t metric;
+        S2EExecutionState *state;
     };
 
-    typedef std::set<S2EExecutionState*, MaxTbSorter> StateSet;
+    typedef std::vector<HeapEntry> StateHeap;
+
+    //Arity of the heap
+    static const unsigned HeapArity = 4;
 
     //Maps a translation block address to the number of times it was executed
     typedef std::map<uint64_t, uint64_t> TbMap;
@@ -114,8 +110,21 @@ private:
     klee::Searcher *m_parentSearcher;
     TbsByModule m_coveredTbs;
 
-    MaxTbSorter m_sorter;
-    StateSet m_states;
+    StateHeap m_states;
+
+    //States whose metric changed since the heap was last updated.
+    //The running state changes its metric on every translation block,
+    //the heap is only updated when the scheduler needs it.
+    std::vector<S2EExecutionState*> m_dirtyStates;
+
+    MaxTbSearcherState *getHeapState(S2EExecutionState *s);
+    bool isInHeap(S2EExecutionState *s, MaxTbSearcherState *plgState) const;
+    void setHeapEntry(unsigned index, const HeapEntry &entry);
+    void siftUp(unsigned index);
+    void siftDown(unsigned index);
+    void updateHeap(S2EExecutionState *s);
+    void removeFromHeap(S2EExecutionState *s);
+    void flushDirtyStates();
 
 
     void addTb(S2EExecutionState *s, uint64_t absTargetPc);
@@ -45,6 +45,8 @@ extern "C" {
 #include <s2e/s2e_qemu.h>
 
 #include <iostream>
+#include <algorithm>
+#include <tr1/memory>
 
 // TODO: this may still contains X86-specific assumptions
 
@@ -108,9 +110,24 @@ public:
         friend llvm::raw_ostream& operator<<(llvm::raw_ostream &os, const StackFrame &frame);
     };
 
-    //The frames are sorted by decreasing stack pointer
-    typedef std::vector<StackFrame> StackFrames;
+    /**
+     * Frames below the top one never change, so they are kept in a
+     * persistent list (newest first) shared by all the states forked
+     * from the same parent. Only the top frame is stored by value.
+     */
+    struct FrameNode;
+    typedef std::tr1::shared_ptr<const FrameNode> FrameList;
 
+    struct FrameNode {
+        StackFrame frame;
+        FrameList next;
+
+        FrameNode(const StackFrame &f, const FrameList &n): frame(f), next(n) {}
+    };
+
+    //Frames below the top one, sorted by increasing top address
+    typedef std::vector<StackFrame> FrameIndex;
+    typedef std::tr1::shared_ptr<const FrameIndex> FrameIndexPtr;
 
     class Stack {
         uint64_t m_stackBase;
@@ -119,7 +136,50 @@ public:
         //XXX: remove it?
         uint64_t m_lastStackPointer;
 
-        StackFrames m_frames;
+        StackFrame m_top;
+        FrameList m_frames;
+        unsigned m_depth;
+
+        //Built on the first lookup after a call or a return
+        mutable FrameIndexPtr m_index;
+
+        void pushFrame(const StackFrame &frame) {
+            if (m_depth > 0) {
+                m_frames = FrameList(new FrameNode(m_top, m_frames));
+            }
+            m_top = frame;
+            ++m_depth;
+            m_index.reset();
+        }
+
+        void popFrame() {
+            assert(m_depth > 0);
+            if (m_frames) {
+                m_top = m_frames->frame;
+                m_frames = m_frames->next;
+            }
+            --m_depth;
+            m_index.reset();
+        }
+
+        const FrameIndex &getIndex() const {
+            if (!m_index) {
+                FrameIndex *index = new FrameIndex();
+                for (const FrameNode *n = m_frames.get(); n; n = n->next.get()) {
+                    index->push_back(n->frame);
+                }
+                m_index = FrameIndexPtr(index);
+            }
+            return *m_index;
+        }
+
+        static bool frameTopLess(const StackFrame &frame, uint64_t sp) {
+            return frame.top < sp;
+        }
+
+        static bool contains(const StackFrame &frame, uint64_t sp) {
+            return sp <= frame.top && sp >= frame.top - frame.size;
+        }
 
     public:
         Stack(S2EExecutionState *state,
@@ -130,6 +190,7 @@ public:
             m_stackBase = base;
             m_stackSize = size;
             m_lastStackPointer = state->getSp();
+            m_depth = 0;
 
             const ModuleDescriptor *module = plgState->m_detector->getModule(state, pc);
             assert(module && "BUG: StackMonitor should only track configured modules");
@@ -142,7 +203,7 @@ public:
             sf.size = 4; //XXX: Fix constant
             sf.pc = pc;
 
-            m_frames.push_back(sf);
+            pushFrame(sf);
         }
 
         uint64_t getStackBase() const {
@@ -155,48 +216,45 @@ public:
 
         /** Used for call instructions */
         void newFrame(S2EExecutionState *state, unsigned currentModuleId, uint64_t pc, uint64_t stackPointer) {
-            const StackFrame &last = m_frames.back();
-            assert(stackPointer < last.top + last.size);
+            assert(m_depth > 0);
+            assert(stackPointer < m_top.top + m_top.size);
 
             StackFrame frame;
             frame.pc = pc;
             frame.moduleId = currentModuleId;
             frame.top = stackPointer;
             frame.size = 4;
-            m_frames.push_back(frame);
+            pushFrame(frame);
 
             m_lastStackPointer = stackPointer;
         }
 
         void update(S2EExecutionState *state, unsigned currentModuleId, uint64_t stackPointer) {
-            assert(!m_frames.empty());
+            assert(m_depth > 0);
             assert(stackPointer >= m_stackBase && stackPointer < (m_stackBase + m_stackSize));
-            StackFrame &last = m_frames.back();
 
             //The current stack pointer is above the bottom of the stack
             //We need to unwind the frames
-            do {
-                if (last.top >= stackPointer) {
-                    last.size = last.top - stackPointer + 4;
-                } else {
-                    m_frames.pop_back();
-                }
+            while (m_top.top < stackPointer) {
+                popFrame();
 
-                if (m_frames.empty()) {
-                    break;
+                // The stack may become empty when the last frame is popped,
+                // e.g., when the top-level function returns.
+                if (m_depth == 0) {
+                    return;
                 }
+            }
 
-                last = m_frames.back();
-            } while (stackPointer > last.top);
-
-            // The stack may become empty when the last frame is popped,
-            // e.g., when the top-level function returns.
+            m_top.size = m_top.top - stackPointer + 4;
         }
 
         /** Check whether there is a frame that belongs to the module. */
         bool hasModule(unsigned moduleId) {
-            foreach2(it, m_frames.begin(), m_frames.end()) {
-                if ((*it).moduleId == moduleId) {
+            if (m_depth > 0 && m_top.moduleId == moduleId) {
+                return true;
+            }
+            for (const FrameNode *n = m_frames.get(); n; n = n->next.get()) {
+                if (n->frame.moduleId == moduleId) {
                     return true;
                 }
             }
@@ -204,21 +262,33 @@ public:
         }
 
         bool removeAllFrames(unsigned moduleId) {
-            StackFrames::iterator it = m_frames.begin();
-
-            unsigned i=0;
-            while (i < m_frames.size()) {
-                if (m_frames[i].moduleId == moduleId) {
-                    m_frames.erase(it + i);
-                } else {
-                    ++i;
+            if (!hasModule(moduleId)) {
+                return empty();
+            }
+
+            std::vector<StackFrame> kept;
+            if (m_depth > 0) {
+                kept.push_back(m_top);
+            }
+            for (const FrameNode *n = m_frames.get(); n; n = n->next.get()) {
+                kept.push_back(n->frame);
+            }
+
+            m_frames.reset();
+            m_depth = 0;
+            m_index.reset();
+
+            //Rebuild the list from the oldest frame
+            for (unsigned i = kept.size(); i > 0; --i) {
+                if (kept[i - 1].moduleId != moduleId) {
+                    pushFrame(kept[i - 1]);
                 }
             }
-            return m_frames.empty();
+            return empty();
         }
 
         bool empty() const {
-            return m_frames.empty();
+            return m_depth == 0;
         }
 
         bool getFrame(uint64_t sp, bool &frameValid, StackFrame &frameInfo) const {
@@ -227,26 +297,38 @@ public:
             }
 
             frameValid = false;
+            if (m_depth == 0) {
+                return true;
+            }
 
-            //Look for the right frame
-            //XXX: Use binary search?
-            foreach2(it, m_frames.begin(), m_frames.end()) {
-                const StackFrame &frame= *it;
-                if (sp > frame.top || (sp < frame.top - frame.size)) {
-                    continue;
-                }
+            if (contains(m_top, sp)) {
+                frameValid = true;
+                frameInfo = m_top;
+                return true;
+            }
 
+            //The first frame whose top is not below sp is the only candidate
+            const FrameIndex &index = getIndex();
+            FrameIndex::const_iterator it = std::lower_bound(index.begin(), index.end(),
+                                                             sp, frameTopLess);
+            if (it != index.end() && contains(*it, sp)) {
                 frameValid = true;
-                frameInfo = frame;
-                break;
+                frameInfo = *it;
             }
 
             return true;
         }
 
         void getCallStack(CallStack &cs) const {
-            foreach2(it, m_frames.begin(), m_frames.end()) {
-                cs.push_back((*it).pc);
+            if (m_depth == 0) {
+                return;
+            }
+
+            cs.resize(m_depth);
+            unsigned i = m_depth;
+            cs[--i] = m_top.pc;
+            for (const FrameNode *n = m_frames.get(); n; n = n->next.get()) {
+                cs[--i] = n->frame.pc;
             }
         }
 
@@ -296,8 +378,11 @@ llvm::raw_ostream& operator<<(llvm::raw_ostream &os, const StackMonitorState::St
 llvm::raw_ostream& operator<<(llvm::raw_ostream &os, const StackMonitorState::Stack &stack)
 {
     os << "Stack " << hexval(stack.m_stackBase) << " size=" << hexval(stack.m_stackSize) << "\n";
-    foreach2(it, stack.m_frames.begin(), stack.m_frames.end()) {
-        os << *it << "\n";
+    if (stack.m_depth > 0) {
+        os << stack.m_top << "\n";
+    }
+    for (const StackMonitorState::FrameNode *n = stack.m_frames.get(); n; n = n->next.get()) {
+        os << n->frame << "\n";
     }
 
     return os;
@@ -0,0 +1,111 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "StateDeduplicator.h"
+#include <s2e/S2E.h>
+#include <s2e/S2EExecutor.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <sstream>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(StateDeduplicator, "Kills states that are equivalent to an earlier one at check points", "",);
+
+void StateDeduplicator::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    ConfigFile::integer_list checkPoints = cfg->getIntegerList(getConfigKey() + ".checkPoints");
+    m_checkPoints.insert(checkPoints.begin(), checkPoints.end());
+    if (m_checkPoints.empty()) {
+        s2e()->getWarningsStream() << "StateDeduplicator: no checkPoints specified" << '\n';
+        exit(-1);
+    }
+
+    //Device snapshots include timer counters, which rarely match
+    m_compareDevices = cfg->getBool(getConfigKey() + ".compareDevices", true);
+    m_prunedStates = 0;
+
+    s2e()->getCorePlugin()->onTranslateInstructionStart.connect(
+            sigc::mem_fun(*this, &StateDeduplicator::onTranslateInstructionStart));
+}
+
+/** Order-independent, the constraints of equivalent paths may come in any order */
+uint64_t StateDeduplicator::hashConstraints(const S2EExecutionState *state)
+{
+    uint64_t hash = 0;
+
+    foreach2(it, state->constraints.begin(), state->constraints.end()) {
+        uint64_t h = (*it)->hash();
+        h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        hash += h;
+    }
+
+    return hash;
+}
+
+void StateDeduplicator::onTranslateInstructionStart(ExecutionSignal *signal,
+                                                    S2EExecutionState* state,
+                                                    TranslationBlock *tb,
+                                                    uint64_t pc)
+{
+    if (m_checkPoints.count(pc)) {
+        signal->connect(sigc::mem_fun(*this, &StateDeduplicator::onCheckPoint));
+    }
+}
+
+void StateDeduplicator::onCheckPoint(S2EExecutionState* state, uint64_t pc)
+{
+    uint64_t machine = s2e()->getExecutor()->computeStateFingerprint(state, m_compareDevices);
+    Fingerprint fp((machine ^ pc) * 0x100000001b3ULL, hashConstraints(state));
+
+    if (m_fingerprints.insert(fp).second) {
+        return;
+    }
+
+    ++m_prunedStates;
+
+    std::stringstream ss;
+    ss << "StateDeduplicator: state is equivalent to an earlier state at pc "
+       << hexval(pc) << " (" << m_prunedStates << " states pruned)";
+    s2e()->getExecutor()->terminateStateEarly(*state, ss.str());
+}
+
+} // namespace plugins
+} // namespace s2e
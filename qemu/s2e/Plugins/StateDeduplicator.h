@@ -0,0 +1,84 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_PLUGINS_STATEDEDUPLICATOR_H
+#define S2E_PLUGINS_STATEDEDUPLICATOR_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <set>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Kills the states that reach a check point in the same condition as
+ *  a state that reached it before: same registers, memory and devices,
+ *  and same path constraints. Exploring them again would only repeat
+ *  the paths of the first state.
+ */
+class StateDeduplicator : public Plugin
+{
+    S2E_PLUGIN
+public:
+    StateDeduplicator(S2E* s2e): Plugin(s2e) {}
+
+    void initialize();
+
+private:
+    /** Hashes of the machine state (with the pc) and of the constraints */
+    typedef std::pair<uint64_t, uint64_t> Fingerprint;
+
+    std::set<uint64_t> m_checkPoints;
+    std::set<Fingerprint> m_fingerprints;
+    bool m_compareDevices;
+    uint64_t m_prunedStates;
+
+    static uint64_t hashConstraints(const S2EExecutionState *state);
+
+    void onTranslateInstructionStart(ExecutionSignal *signal,
+                                     S2EExecutionState* state,
+                                     TranslationBlock *tb,
+                                     uint64_t pc);
+
+    void onCheckPoint(S2EExecutionState* state, uint64_t pc);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif // S2E_PLUGINS_STATEDEDUPLICATOR_H
@@ -43,6 +43,7 @@ extern "C" {
 #include <s2e/ConfigFile.h>
 #include <s2e/Utils.h>
 #include <s2e/s2e_qemu.h>
+#include <s2e/Coordinator.h>
 
 #include "StateManager.h"
 #include <klee/Searcher.h>
@@ -199,6 +200,12 @@ void StateManager::sendKillToAllInstances(bool keepOneSuccessful, unsigned procI
             s->commands[i].write(cmd);
         }
     }
+
+    //Instances on other hosts kill everything, the successful
+    //state (if any) is always kept by one of the local instances.
+    if (s2e()->getCoordinator()) {
+        s2e()->getCoordinator()->broadcastCommand("KILL");
+    }
 }
 
 bool StateManager::processCommands()
@@ -206,6 +213,16 @@ bool StateManager::processCommands()
     StateManagerShared *s = m_shared.get();
 
 
+    std::string remoteCmd;
+    S2ECoordinator *coordinator = s2e()->getCoordinator();
+    if (coordinator && coordinator->pollCommand(remoteCmd) && remoteCmd == "KILL") {
+        s2e()->getDebugStream() << "StateManager: received kill command from coordinator" << '\n';
+        StateSet toKeep;
+        resumeSucceeded();
+        killAllExcept(toKeep, true);
+        return true;
+    }
+
     StateManagerShared::Command cmd = s->commands[s2e()->getCurrentProcessId()].read();
 
     if (cmd.command == StateManagerShared::KILL) {
@@ -305,6 +322,17 @@ void StateManager::initialize()
     m_timeout = cfg->getInt(getConfigKey() + ".timeout");
     resetTimeout();
 
+    //States that find few new blocks for the time they run
+    //are culled every cullInterval seconds
+    m_cullInterval = cfg->getInt(getConfigKey() + ".cullInterval", 0);
+    m_cullMinYield = cfg->getDouble(getConfigKey() + ".cullMinYield", 0.1);
+    m_cullMinTime = cfg->getDouble(getConfigKey() + ".cullMinTime", 10);
+    m_cullForkWeight = cfg->getDouble(getConfigKey() + ".cullForkWeight", 0);
+    m_cullMinStates = cfg->getInt(getConfigKey() + ".cullMinStates", 1);
+    m_cullSuspend = cfg->getBool(getConfigKey() + ".cullSuspend", false);
+    m_lastCullTime = m_currentTime;
+    m_sliceStart = getTimeUsec();
+
     m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
 
     m_detector->onModuleTranslateBlockStart.connect(
@@ -317,12 +345,26 @@ void StateManager::initialize()
                     &StateManager::onProcessFork)
             );
 
-    s2e()->getCorePlugin()->onCustomInstruction.connect(
+    s2e()->getCorePlugin()->getCustomInstructionSignal(STATE_MANAGER_OPCODE).connect(
             sigc::mem_fun(*this, &StateManager::onCustomInstruction));
 
     s2e()->getCorePlugin()->onTimer.connect(
             sigc::mem_fun(*this, &StateManager::onTimer));
 
+    if (m_cullInterval) {
+        s2e()->getCorePlugin()->onStateFork.connect(
+                sigc::mem_fun(*this, &StateManager::onStateFork));
+
+        s2e()->getCorePlugin()->onStateSwitch.connect(
+                sigc::mem_fun(*this, &StateManager::onStateSwitch));
+
+        s2e()->getCorePlugin()->onSolverQuery.connect(
+                sigc::mem_fun(*this, &StateManager::onSolverQuery));
+    }
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &StateManager::onStateKill));
+
     m_executor = s2e()->getExecutor();
     //m_executor->setStateManagerCb(sm_callback);
 }
@@ -332,6 +374,118 @@ void StateManager::onTimer()
     //Calling this is very expensive and should be done as rarely as possible.
     llvm::sys::TimeValue curTime = llvm::sys::TimeValue::now();
     m_currentTime = curTime.seconds();
+
+    if (m_cullInterval && m_currentTime - m_lastCullTime >= m_cullInterval) {
+        m_lastCullTime = m_currentTime;
+        cullStates();
+    }
+}
+
+uint64_t StateManager::getTimeUsec()
+{
+    llvm::sys::TimeValue curTime = llvm::sys::TimeValue::now();
+    return curTime.seconds() * 1000000 + curTime.microseconds();
+}
+
+void StateManager::chargeCurrentSlice()
+{
+    uint64_t now = getTimeUsec();
+    if (g_s2e_state) {
+        m_yields[g_s2e_state].cpuTime += (now - m_sliceStart) / 1000000.0;
+    }
+    m_sliceStart = now;
+}
+
+void StateManager::onStateFork(S2EExecutionState *state,
+                               const std::vector<S2EExecutionState*>& newStates,
+                               const std::vector<klee::ref<klee::Expr> >& newConditions)
+{
+    m_yields[state].forks += newStates.size() - 1;
+}
+
+void StateManager::onStateSwitch(S2EExecutionState *current, S2EExecutionState *next)
+{
+    chargeCurrentSlice();
+}
+
+void StateManager::onSolverQuery(S2EExecutionState *state, uint64_t usec)
+{
+    m_yields[state].solverTime += usec / 1000000.0;
+}
+
+void StateManager::onStateKill(S2EExecutionState *state)
+{
+    m_yields.erase(state);
+    m_culled.erase(state);
+
+    //Give the culled states another chance rather than ending the run.
+    //The dying state is still in the state set.
+    if (!m_culled.empty() && m_executor->getStatesCount() <= 1) {
+        s2e()->getDebugStream() << "StateManager: resuming "
+                << m_culled.size() << " culled states" << '\n';
+        foreach2(it, m_culled.begin(), m_culled.end()) {
+            m_executor->resumeState(*it);
+        }
+        m_culled.clear();
+    }
+}
+
+/**
+ *  Kill or suspend the states whose number of new blocks per second of
+ *  execution stayed below cullMinYield. The solver time is part of the
+ *  execution time of a state, so states that spend their time in the
+ *  solver have a low yield. A fork counts as cullForkWeight new blocks.
+ */
+void StateManager::cullStates()
+{
+    chargeCurrentSlice();
+
+    std::vector<S2EExecutionState*> unproductive;
+    const klee::StateSet &states = m_executor->getStates();
+    foreach2(it, states.begin(), states.end()) {
+        S2EExecutionState *state = static_cast<S2EExecutionState*>(*it);
+        StateYield &y = m_yields[state];
+
+        //Killing the current state would throw out of the timer
+        if (state == g_s2e_state || state->isZombie() || y.cpuTime < m_cullMinTime) {
+            continue;
+        }
+
+        double yield = (y.newBlocks + m_cullForkWeight * y.forks) / y.cpuTime;
+        if (yield < m_cullMinYield) {
+            s2e()->getDebugStream() << "StateManager: state " << state->getID()
+                    << " found " << y.newBlocks << " blocks and forked " << y.forks
+                    << " times in " << y.cpuTime << "s (" << y.solverTime
+                    << "s in the solver)" << '\n';
+            unproductive.push_back(state);
+        }
+    }
+
+    unsigned active = states.size();
+    foreach2(it, unproductive.begin(), unproductive.end()) {
+        if (active <= m_cullMinStates) {
+            break;
+        }
+        --active;
+
+        S2EExecutionState *state = *it;
+        if (m_cullSuspend) {
+            m_executor->suspendState(state);
+            m_culled.insert(state);
+        } else {
+            //Dropping the state frees its memory
+            m_executor->terminateStateEarly(*state, "StateManager: low yield");
+        }
+    }
+
+    //Only the recent behavior of the states matters
+    foreach2(it, m_yields.begin(), m_yields.end()) {
+        StateYield &y = (*it).second;
+        y.newBlocks /= 2;
+        y.forks /= 2;
+        y.cpuTime /= 2;
+        y.solverTime /= 2;
+    }
 }
 
 void StateManager::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
@@ -370,6 +524,10 @@ void StateManager::onNewBlockCovered(
 {
     s2e()->getDebugStream() << "New block " << hexval(pc) << " discovered" << '\n';
     resetTimeout();
+
+    if (m_cullInterval) {
+        m_yields[state].newBlocks += 1;
+    }
 }
 
 bool StateManager::killOnTimeOut()
@@ -403,9 +561,15 @@ bool StateManager::killAllExcept(StateSet &toKeep, bool ungrab)
     }
     os << '\n';
 
+    //The culled states are killed like the others
+    foreach2(it, m_culled.begin(), m_culled.end()) {
+        m_executor->resumeState(*it);
+    }
+    m_culled.clear();
+
     bool killCurrent = false;
-    const std::set<klee::ExecutionState*> &states = s2e()->getExecutor()->getStates();
-    std::set<klee::ExecutionState*>::const_iterator it = states.begin();
+    const klee::StateSet &states = s2e()->getExecutor()->getStates();
+    klee::StateSet::const_iterator it = states.begin();
 
     while(it != states.end()) {
         S2EExecutionState *curState = static_cast<S2EExecutionState*>(*it);
@@ -45,6 +45,7 @@
 #include <s2e/S2EExecutionState.h>
 #include <s2e/S2E.h>
 #include <s2e/S2EExecutor.h>
+#include <map>
 #include <set>
 
 namespace s2e {
@@ -116,6 +117,33 @@ private:
 
     ModuleExecutionDetector *m_detector;
 
+    /** Recent activity of a state, halved at each culling round */
+    struct StateYield {
+        double newBlocks;
+        double forks;
+        double cpuTime; //seconds
+        double solverTime; //seconds
+
+        StateYield() : newBlocks(0), forks(0), cpuTime(0), solverTime(0) {}
+    };
+
+    typedef std::map<S2EExecutionState*, StateYield> StateYields;
+    StateYields m_yields;
+
+    //States suspended for their low yield
+    StateSet m_culled;
+
+    unsigned m_cullInterval;
+    double m_cullMinYield;
+    double m_cullMinTime;
+    double m_cullForkWeight;
+    unsigned m_cullMinStates;
+    bool m_cullSuspend;
+    uint64_t m_lastCullTime;
+
+    //Start of the time slice of the current state, in microseconds
+    uint64_t m_sliceStart;
+
     static StateManager *s_stateManager;
 
     S2ESynchronizedObject<StateManagerShared> m_shared;
@@ -130,6 +158,17 @@ private:
     void onProcessFork(bool preFork, bool isChild, unsigned parentProcId);
     void onTimer();
 
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*>& newStates,
+                     const std::vector<klee::ref<klee::Expr> >& newConditions);
+    void onStateSwitch(S2EExecutionState *current, S2EExecutionState *next);
+    void onStateKill(S2EExecutionState *state);
+    void onSolverQuery(S2EExecutionState *state, uint64_t usec);
+
+    static uint64_t getTimeUsec();
+    void chargeCurrentSlice();
+    void cullStates();
+
     bool processCommands();
 
 
@@ -53,6 +53,7 @@ extern "C"
 
 #include "llvm/Support/CommandLine.h"
 
+#include <algorithm>
 #include <sstream>
 
 extern struct CPUX86State *env;
@@ -99,6 +100,13 @@ extern "C" {
                       uint64_t data, unsigned size);
 }
 
+static klee::ref<klee::Expr> symbhw_read_value(S2EExecutionState *state, bool isMmio,
+                                               uint64_t address, unsigned size,
+                                               const std::string &name, void *opaque);
+static void symbhw_write_value(S2EExecutionState *state, bool isMmio,
+                               uint64_t address, unsigned size,
+                               const klee::ref<klee::Expr> &value, void *opaque);
+
 
 S2E_DEFINE_PLUGIN(SymbolicHardware, "Symbolic hardware plugin for PCI/ISA devices", "SymbolicHardware",);
 
@@ -118,6 +126,10 @@ void SymbolicHardware::initialize()
     }
 
     foreach2(it, keys.begin(), keys.end()) {
+        if (*it == "valueModels") {
+            continue;
+        }
+
         std::stringstream ss;
         ss << getConfigKey() << "." << *it;
         DeviceDescriptor *dd = DeviceDescriptor::create(this, cfg, ss.str());
@@ -145,10 +157,19 @@ void SymbolicHardware::initialize()
     //Reset all symbolic bits for now
     memset(m_portMap, 0, sizeof(m_portMap));
 
+    if (!initializeValueModels()) {
+        exit(-1);
+    }
+
     if (EnableSymbHw) {
         s2e()->getCorePlugin()->setPortCallback(symbhw_is_symbolic, this);
         s2e()->getCorePlugin()->setMmioCallback(symbhw_is_mmio_symbolic, this);
         s2e()->getCorePlugin()->enableMmioCallbacks(true);
+
+        if (!m_valueModels.empty()) {
+            s2e()->getCorePlugin()->setSymbolicHardwareCallbacks(symbhw_read_value,
+                                                                 symbhw_write_value, this);
+        }
     }else {
         s2e()->getCorePlugin()->setPortCallback(symbhw_is_symbolic_none, this);
         s2e()->getCorePlugin()->setMmioCallback(symbhw_is_mmio_symbolic_none, this);
@@ -156,6 +177,172 @@ void SymbolicHardware::initialize()
     }
 }
 
+bool SymbolicHardware::initializeValueModels()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+    llvm::raw_ostream &ws = s2e()->getWarningsStream();
+    bool ok;
+
+    std::string key = getConfigKey() + ".valueModels";
+    ConfigFile::string_list keys = cfg->getListKeys(key, &ok);
+
+    foreach2(it, keys.begin(), keys.end()) {
+        std::string mkey = key + "." + *it;
+        ValueModel model;
+
+        bool isPort = cfg->hasKey(mkey + ".port");
+        model.isMmio = cfg->hasKey(mkey + ".mmio");
+        if (isPort == model.isMmio) {
+            ws << "The value model " << mkey << " needs either a port or an mmio address" << '\n';
+            return false;
+        }
+
+        model.start = cfg->getInt(mkey + (isPort ? ".port" : ".mmio"));
+        model.size = cfg->getInt(mkey + ".size", 1);
+        if (!model.size || (isPort && model.start + model.size > 0x10000)) {
+            ws << "Invalid range for the value model " << mkey << '\n';
+            return false;
+        }
+
+        std::string type = cfg->getString(mkey + ".model", "sticky");
+        if (type == "sticky") {
+            model.type = ValueModel::STICKY;
+        } else if (type == "bounded") {
+            model.type = ValueModel::BOUNDED;
+        } else if (type == "cycle") {
+            model.type = ValueModel::CYCLE;
+        } else {
+            ws << "Unknown value model " << type << " for " << mkey << '\n';
+            return false;
+        }
+
+        model.freshValues = cfg->getInt(mkey + ".freshValues", 1);
+        model.values = cfg->getIntegerList(mkey + ".values");
+        model.learn = cfg->getBool(mkey + ".learn", false);
+
+        if (model.type == ValueModel::CYCLE && model.values.empty() && !model.learn) {
+            ws << "The value model " << mkey << " has no value to cycle through" << '\n';
+            return false;
+        }
+
+        s2e()->getMessagesStream() << "SymbolicHardware: " << type << " values for "
+                << (model.isMmio ? "MMIO " : "port ") << hexval(model.start)
+                << " size=" << model.size << '\n';
+
+        m_valueModels.push_back(model);
+    }
+
+    return true;
+}
+
+const SymbolicHardware::ValueModel *SymbolicHardware::findValueModel(bool isMmio, uint64_t address) const
+{
+    foreach2(it, m_valueModels.begin(), m_valueModels.end()) {
+        const ValueModel &model = *it;
+        if (model.isMmio == isMmio && address >= model.start && address - model.start < model.size) {
+            return &model;
+        }
+    }
+    return NULL;
+}
+
+/** Returns the bytes of a constant of the model at the given address */
+static klee::ref<klee::Expr> getModelConstant(const SymbolicHardware::ValueModel &model,
+                                              const std::vector<uint64_t> &learned,
+                                              unsigned index, uint64_t address,
+                                              klee::Expr::Width width)
+{
+    uint64_t value = 0;
+    unsigned count = model.values.size() + learned.size();
+    if (count) {
+        index %= count;
+        value = index < model.values.size() ?
+                model.values[index] : learned[index - model.values.size()];
+    }
+
+    uint64_t shift = (address - model.start) * 8;
+    value = shift < 64 ? value >> shift : 0;
+    if (width < 64) {
+        value &= (1ULL << width) - 1;
+    }
+
+    return klee::ConstantExpr::create(value, width);
+}
+
+klee::ref<klee::Expr> SymbolicHardware::getHardwareValue(S2EExecutionState *state, bool isMmio,
+                                                         uint64_t address, unsigned size,
+                                                         const std::string &name)
+{
+    const ValueModel *model = findValueModel(isMmio, address);
+    if (!model) {
+        return klee::ref<klee::Expr>();
+    }
+
+    DECLARE_PLUGINSTATE(SymbolicHardwareState, state);
+    SymbolicHardwareState::RegisterValue &reg =
+            plgState->m_registers[std::make_pair(isMmio, address)];
+    const std::vector<uint64_t> &learned =
+            plgState->m_registers[std::make_pair(isMmio, model->start)].learned;
+
+    klee::Expr::Width width = size * 8;
+    unsigned read = reg.reads++;
+
+    switch (model->type) {
+        case ValueModel::STICKY:
+            if (reg.value.isNull() || reg.value->getWidth() != width) {
+                reg.value = state->createSymbolicValue(name, width);
+            }
+            return reg.value;
+
+        case ValueModel::BOUNDED:
+            if (read < model->freshValues) {
+                return klee::ref<klee::Expr>();
+            }
+            return getModelConstant(*model, learned, read - model->freshValues, address, width);
+
+        case ValueModel::CYCLE:
+            return getModelConstant(*model, learned, read, address, width);
+    }
+
+    return klee::ref<klee::Expr>();
+}
+
+void SymbolicHardware::onHardwareWrite(S2EExecutionState *state, bool isMmio,
+                                       uint64_t address, unsigned size,
+                                       const klee::ref<klee::Expr> &value)
+{
+    const ValueModel *model = findValueModel(isMmio, address);
+    if (!model) {
+        return;
+    }
+
+    DECLARE_PLUGINSTATE(SymbolicHardwareState, state);
+
+    //A write to any part of the register starts over
+    SymbolicHardwareState::RegisterValues::iterator it =
+            plgState->m_registers.lower_bound(std::make_pair(isMmio, model->start));
+    for (; it != plgState->m_registers.end(); ++it) {
+        const SymbolicHardwareState::RegisterKey &key = (*it).first;
+        if (key.first != isMmio || key.second - model->start >= model->size) {
+            break;
+        }
+        (*it).second.value = klee::ref<klee::Expr>();
+        (*it).second.reads = 0;
+    }
+
+    klee::ConstantExpr *ce = llvm::dyn_cast<klee::ConstantExpr>(value);
+    if (model->learn && ce) {
+        uint64_t shift = (address - model->start) * 8;
+        uint64_t learnt = shift < 64 ? ce->getZExtValue() << shift : 0;
+
+        std::vector<uint64_t> &learned =
+                plgState->m_registers[std::make_pair(isMmio, model->start)].learned;
+        if (std::find(learned.begin(), learned.end(), learnt) == learned.end()) {
+            learned.push_back(learnt);
+        }
+    }
+}
+
 //XXX: Do it per-state!
 void SymbolicHardware::setSymbolicPortRange(uint16_t start, unsigned size, bool isSymbolic)
 {
@@ -170,6 +357,10 @@ void SymbolicHardware::setSymbolicPortRange(uint16_t start, unsigned size, bool
             m_portMap[idx] &= ~(1<<mod);
         }
     }
+
+    if (EnableSymbHw) {
+        s2e()->getCorePlugin()->markSymbolicPorts(start, size, isSymbolic);
+    }
 }
 
 bool SymbolicHardware::isSymbolic(uint16_t port) const
@@ -194,6 +385,10 @@ bool SymbolicHardware::setSymbolicMmioRange(S2EExecutionState *state, uint64_t p
     DECLARE_PLUGINSTATE(SymbolicHardwareState, state);
     bool b = plgState->setMmioRange(physaddr, size, true);
     if (b) {
+        if (EnableSymbHw) {
+            s2e()->getCorePlugin()->markSymbolicMmio(physaddr, size);
+        }
+
         //We must flush the TLB, so that the next access can be taken into account
         tlb_flush(state->getConcreteCpuState(), 1);
     }
@@ -238,6 +433,22 @@ static bool symbhw_is_mmio_symbolic_none(uint64_t physaddr, uint64_t size, void
     return false;
 }
 
+static klee::ref<klee::Expr> symbhw_read_value(S2EExecutionState *state, bool isMmio,
+                                               uint64_t address, unsigned size,
+                                               const std::string &name, void *opaque)
+{
+    SymbolicHardware *hw = static_cast<SymbolicHardware*>(opaque);
+    return hw->getHardwareValue(state, isMmio, address, size, name);
+}
+
+static void symbhw_write_value(S2EExecutionState *state, bool isMmio,
+                               uint64_t address, unsigned size,
+                               const klee::ref<klee::Expr> &value, void *opaque)
+{
+    SymbolicHardware *hw = static_cast<SymbolicHardware*>(opaque);
+    hw->onHardwareWrite(state, isMmio, address, size, value);
+}
+
 DeviceDescriptor *SymbolicHardware::findDevice(const std::string &name) const
 {
     DeviceDescriptor dd(name);
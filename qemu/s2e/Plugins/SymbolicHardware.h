@@ -46,6 +46,7 @@
 #include <string>
 #include <set>
 #include <map>
+#include <vector>
 
 namespace s2e {
 namespace plugins {
@@ -211,6 +212,28 @@ public:
 
             typedef std::set<DeviceDescriptor *,DeviceDescriptor::comparator > DeviceDescriptors;
 
+    /** Chooses the values returned by reads of a range of symbolic
+        ports or MMIO addresses, instead of a fresh value per read */
+    struct ValueModel {
+        enum Type {
+            //The same symbolic value until the next write
+            STICKY,
+            //A bounded number of fresh values per write, then constants
+            BOUNDED,
+            //The constants in turn, including the values written so far
+            CYCLE
+        };
+
+        Type type;
+        bool isMmio;
+        uint64_t start;
+        uint64_t size;
+        unsigned freshValues;
+        std::vector<uint64_t> values;
+        bool learn;
+    };
+
+    typedef std::vector<ValueModel> ValueModels;
 
 public:
     SymbolicHardware(S2E* s2e): Plugin(s2e) {}
@@ -225,9 +248,20 @@ public:
     bool isMmioSymbolic(uint64_t physaddress, uint64_t size) const;
     bool setSymbolicMmioRange(S2EExecutionState *state, uint64_t physaddr, uint64_t size);
     bool resetSymbolicMmioRange(S2EExecutionState *state, uint64_t physaddr, uint64_t size);
+
+    klee::ref<klee::Expr> getHardwareValue(S2EExecutionState *state, bool isMmio,
+                                           uint64_t address, unsigned size,
+                                           const std::string &name);
+    void onHardwareWrite(S2EExecutionState *state, bool isMmio,
+                         uint64_t address, unsigned size,
+                         const klee::ref<klee::Expr> &value);
 private:
     uint32_t m_portMap[65536/(sizeof(uint32_t)*8)];
     DeviceDescriptors m_devices;
+    ValueModels m_valueModels;
+
+    bool initializeValueModels();
+    const ValueModel *findValueModel(bool isMmio, uint64_t address) const;
 
     void onDeviceRegistration();
     void onDeviceActivation(int bus_type, void *bus);
@@ -258,9 +292,22 @@ public:
     };
 
     typedef std::map<uint64_t, PageBitmap> MemoryRanges;
+
+    /** What a value model remembers about an address */
+    struct RegisterValue {
+        klee::ref<klee::Expr> value;
+        unsigned reads;
+        std::vector<uint64_t> learned;
+
+        RegisterValue() : reads(0) {}
+    };
+
+    typedef std::pair<bool /* isMmio */, uint64_t /* address */> RegisterKey;
+    typedef std::map<RegisterKey, RegisterValue> RegisterValues;
 private:
 
     MemoryRanges m_MmioMemory;
+    RegisterValues m_registers;
 
 public:
 
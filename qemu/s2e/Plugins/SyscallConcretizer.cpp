@@ -0,0 +1,265 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "SyscallConcretizer.h"
+#include "X86ExceptionInterceptor.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/S2EExecutor.h>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(SyscallConcretizer, "Concretizes the symbolic system call arguments at kernel entry",
+                  "SyscallConcretizer",);
+
+static const struct {
+    const char *name;
+    unsigned index;
+} s_registerNames[] = {
+    {"eax", R_EAX}, {"ecx", R_ECX}, {"edx", R_EDX}, {"ebx", R_EBX},
+    {"esp", R_ESP}, {"ebp", R_EBP}, {"esi", R_ESI}, {"edi", R_EDI}
+};
+
+static int getRegisterIndex(const std::string &name)
+{
+    for (unsigned i = 0; i < sizeof(s_registerNames) / sizeof(s_registerNames[0]); ++i) {
+        if (name == s_registerNames[i].name) {
+            return s_registerNames[i].index;
+        }
+    }
+    return -1;
+}
+
+void SyscallConcretizer::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+    bool ok;
+
+    //int 0x2e (Windows) and int 0x80 (Linux)
+    ConfigFile::integer_list defaultVectors;
+    defaultVectors.push_back(0x2e);
+    defaultVectors.push_back(0x80);
+    m_vectors = cfg->getIntegerList(getConfigKey() + ".vectors", defaultVectors);
+    m_sysenter = cfg->getBool(getConfigKey() + ".sysenter", true);
+
+    std::string policy = cfg->getString(getConfigKey() + ".policy", "concretize");
+    if (policy != "concretize" && policy != "example") {
+        s2e()->getWarningsStream() << "SyscallConcretizer: unknown policy " << policy << '\n';
+        exit(-1);
+    }
+    m_addConstraints = policy == "concretize";
+
+    ConfigFile::string_list registers = cfg->getStringList(getConfigKey() + ".registers",
+                                                           ConfigFile::string_list(), &ok);
+    if (!ok) {
+        for (unsigned i = 0; i < sizeof(s_registerNames) / sizeof(s_registerNames[0]); ++i) {
+            registers.push_back(s_registerNames[i].name);
+        }
+        registers.push_back("flags");
+    }
+
+    foreach2(it, registers.begin(), registers.end()) {
+        if (!addRegister(*it)) {
+            s2e()->getWarningsStream() << "SyscallConcretizer: unknown register " << *it << '\n';
+            exit(-1);
+        }
+    }
+
+    m_argumentsRegister = -1;
+    std::string argumentsRegister = cfg->getString(getConfigKey() + ".argumentsRegister", "");
+    if (!argumentsRegister.empty()) {
+        m_argumentsRegister = getRegisterIndex(argumentsRegister);
+        if (m_argumentsRegister < 0) {
+            s2e()->getWarningsStream() << "SyscallConcretizer: unknown register " << argumentsRegister << '\n';
+            exit(-1);
+        }
+    }
+    m_argumentsSize = cfg->getInt(getConfigKey() + ".argumentsSize", 0);
+
+    m_idtLoaded = false;
+    m_sysenterEip = 0;
+    m_concretizedRegisters = 0;
+    m_concretizedBytes = 0;
+
+    s2e()->getCorePlugin()->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &SyscallConcretizer::onTranslateBlockStart));
+}
+
+bool SyscallConcretizer::addRegister(const std::string &name)
+{
+    Register reg;
+
+    if (name == "flags") {
+        //The lazily computed flags
+        reg.offset = CPU_OFFSET(cc_op);
+        reg.size = sizeof(uint32_t);
+        m_registers.push_back(reg);
+
+        reg.size = sizeof(target_ulong);
+        reg.offset = CPU_OFFSET(cc_src);
+        m_registers.push_back(reg);
+        reg.offset = CPU_OFFSET(cc_dst);
+        m_registers.push_back(reg);
+        reg.offset = CPU_OFFSET(cc_tmp);
+        m_registers.push_back(reg);
+        return true;
+    }
+
+    int index = getRegisterIndex(name);
+    if (index < 0) {
+        return false;
+    }
+
+    reg.offset = CPU_OFFSET(regs[index]);
+    reg.size = sizeof(target_ulong);
+    m_registers.push_back(reg);
+    return true;
+}
+
+/**
+ *  The gates of the system call vectors are read once the guest loaded
+ *  its IDT. The sysenter MSR may be set later, so it is polled until then.
+ */
+void SyscallConcretizer::loadEntryPoints(S2EExecutionState *state)
+{
+    if (!m_idtLoaded) {
+        X86Parser::IDT idt;
+        if (X86Parser::getIdt(state, idt) && !idt.empty()) {
+            foreach2(it, m_vectors.begin(), m_vectors.end()) {
+                if (*it >= idt.size()) {
+                    continue;
+                }
+
+                const X86IDTEntry &entry = idt[*it];
+                if (!entry.u_TrapIntGate.m_Present || entry.getType() == TASK_GATE) {
+                    continue;
+                }
+
+                uint64_t pc = X86Parser::getOffset(entry);
+                m_entryPoints.insert(pc);
+                s2e()->getDebugStream() << "SyscallConcretizer: vector " << hexval(*it)
+                                        << " enters the kernel at " << hexval(pc) << '\n';
+            }
+            m_idtLoaded = true;
+        }
+    }
+
+    if (m_sysenter && !m_sysenterEip) {
+        m_sysenterEip = state->readCpuState(CPU_OFFSET(sysenter_eip), 8 * sizeof(target_ulong));
+        if (m_sysenterEip) {
+            m_entryPoints.insert(m_sysenterEip);
+            s2e()->getDebugStream() << "SyscallConcretizer: sysenter enters the kernel at "
+                                    << hexval(m_sysenterEip) << '\n';
+        }
+    }
+}
+
+void SyscallConcretizer::onTranslateBlockStart(ExecutionSignal *signal,
+                                               S2EExecutionState *state,
+                                               TranslationBlock *tb,
+                                               uint64_t pc)
+{
+    if (!m_idtLoaded || (m_sysenter && !m_sysenterEip)) {
+        loadEntryPoints(state);
+    }
+
+    if (m_entryPoints.find(pc) == m_entryPoints.end()) {
+        return;
+    }
+
+    signal->connect(sigc::mem_fun(*this, &SyscallConcretizer::onKernelEntry));
+}
+
+void SyscallConcretizer::onKernelEntry(S2EExecutionState *state, uint64_t pc)
+{
+    S2EExecutor *executor = s2e()->getExecutor();
+    unsigned registers = 0, bytes = 0;
+
+    //Nothing to do for the common case of concrete registers
+    if (state->getSymbolicRegistersMask()) {
+        foreach2(it, m_registers.begin(), m_registers.end()) {
+            klee::ref<klee::Expr> value = state->readCpuRegister((*it).offset, (*it).size * 8);
+            if (llvm::isa<klee::ConstantExpr>(value)) {
+                continue;
+            }
+
+            if (m_addConstraints) {
+                value = executor->toConstant(*state, value, "system call argument");
+            } else {
+                value = executor->toConstantSilent(*state, value);
+            }
+            state->writeCpuRegister((*it).offset, value);
+            ++registers;
+        }
+    }
+
+    //The arguments that the kernel copies from the user stack
+    if (m_argumentsRegister >= 0 && m_argumentsSize) {
+        target_ulong base;
+        if (state->readCpuRegisterConcrete(CPU_OFFSET(regs[m_argumentsRegister]), &base, sizeof(base))) {
+            for (unsigned i = 0; i < m_argumentsSize; ++i) {
+                klee::ref<klee::Expr> byte = state->readMemory8(base + i);
+                if (byte.isNull() || llvm::isa<klee::ConstantExpr>(byte)) {
+                    continue;
+                }
+
+                if (state->readMemoryConcrete8(base + i, NULL, S2EExecutionState::VirtualAddress,
+                                               m_addConstraints)) {
+                    ++bytes;
+                }
+            }
+        }
+    }
+
+    if (registers || bytes) {
+        m_concretizedRegisters += registers;
+        m_concretizedBytes += bytes;
+
+        s2e()->getDebugStream(state) << "SyscallConcretizer: concretized " << registers
+                << " registers and " << bytes << " argument bytes at " << hexval(pc)
+                << " (total " << m_concretizedRegisters << " registers, "
+                << m_concretizedBytes << " bytes)" << '\n';
+    }
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,270 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "TranslationFilter.h"
+#include "ModuleExecutionDetector.h"
+
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/S2EExecutionState.h>
+
+namespace s2e {
+namespace plugins {
+
+TranslationFilter::TranslationFilter(S2E *s2e)
+{
+    m_s2e = s2e;
+    m_detector = NULL;
+    m_hasPid = false;
+    m_pid = 0;
+    m_mode = ANY_MODE;
+    m_trackedModules = false;
+    m_tb = NULL;
+    m_tbMatches = false;
+}
+
+TranslationFilter::~TranslationFilter()
+{
+    deactivate();
+}
+
+void TranslationFilter::configure(const std::string &key)
+{
+    ConfigFile *cfg = m_s2e->getConfig();
+    bool ok;
+
+    //Pairs of start and end addresses
+    ConfigFile::integer_list ranges = cfg->getIntegerList(key + ".ranges");
+    if (ranges.size() % 2) {
+        m_s2e->getWarningsStream() << key << ".ranges must contain pairs of addresses" << '\n';
+        exit(-1);
+    }
+    for (unsigned i = 0; i < ranges.size(); i += 2) {
+        addRange(ranges[i], ranges[i + 1]);
+    }
+
+    uint64_t pid = cfg->getInt(key + ".pid", 0, &ok);
+    if (ok) {
+        setPid(pid);
+    }
+
+    std::string mode = cfg->getString(key + ".mode", "any");
+    if (mode == "kernel") {
+        setMode(KERNEL_MODE);
+    } else if (mode == "user") {
+        setMode(USER_MODE);
+    } else if (mode != "any") {
+        m_s2e->getWarningsStream() << key << ".mode must be any, kernel or user" << '\n';
+        exit(-1);
+    }
+
+    ConfigFile::string_list modules = cfg->getStringList(key + ".modules");
+    foreach2(it, modules.begin(), modules.end()) {
+        addModule(*it);
+    }
+
+    setTrackedModules(cfg->getBool(key + ".trackedModules", m_trackedModules));
+}
+
+void TranslationFilter::addRange(uint64_t start, uint64_t end)
+{
+    assert(start < end);
+    m_ranges.push_back(Range(start, end));
+}
+
+void TranslationFilter::setPid(uint64_t pid)
+{
+    m_hasPid = true;
+    m_pid = pid;
+}
+
+void TranslationFilter::setMode(Mode mode)
+{
+    m_mode = mode;
+}
+
+void TranslationFilter::addModule(const std::string &moduleId)
+{
+    m_modules.insert(moduleId);
+}
+
+void TranslationFilter::setTrackedModules(bool tracked)
+{
+    m_trackedModules = tracked;
+}
+
+void TranslationFilter::activate()
+{
+    if ((m_trackedModules || !m_modules.empty()) && !getDetector()) {
+        m_s2e->getWarningsStream() << "TranslationFilter: filtering modules requires ModuleExecutionDetector" << '\n';
+        exit(-1);
+    }
+
+    CorePlugin *core = m_s2e->getCorePlugin();
+
+    m_blockStartConnection = core->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &TranslationFilter::slotTranslateBlockStart));
+    m_blockEndConnection = core->onTranslateBlockEnd.connect(
+            sigc::mem_fun(*this, &TranslationFilter::slotTranslateBlockEnd));
+    m_instructionStartConnection = core->onTranslateInstructionStart.connect(
+            sigc::mem_fun(*this, &TranslationFilter::slotTranslateInstructionStart));
+    m_instructionEndConnection = core->onTranslateInstructionEnd.connect(
+            sigc::mem_fun(*this, &TranslationFilter::slotTranslateInstructionEnd));
+}
+
+void TranslationFilter::deactivate()
+{
+    m_blockStartConnection.disconnect();
+    m_blockEndConnection.disconnect();
+    m_instructionStartConnection.disconnect();
+    m_instructionEndConnection.disconnect();
+    m_tb = NULL;
+}
+
+ModuleExecutionDetector *TranslationFilter::getDetector()
+{
+    if (!m_detector) {
+        m_detector = static_cast<ModuleExecutionDetector*>(
+                m_s2e->getPlugin("ModuleExecutionDetector"));
+    }
+    return m_detector;
+}
+
+bool TranslationFilter::matchesContext(S2EExecutionState *state, uint64_t pc)
+{
+    if (m_hasPid && state->getPid() != m_pid) {
+        return false;
+    }
+
+    if (m_mode != ANY_MODE) {
+        target_ulong isUserSpace = 0;
+        state->readCpuRegisterConcrete(CPU_OFFSET(IS_USERSPACE), &isUserSpace,
+                                       sizeof isUserSpace);
+        if ((m_mode == USER_MODE) != (isUserSpace != 0)) {
+            return false;
+        }
+    }
+
+    if (m_trackedModules || !m_modules.empty()) {
+        const ModuleDescriptor *module = m_detector->getModule(state, pc);
+        if (!module) {
+            return false;
+        }
+        if (!m_modules.empty()) {
+            const std::string *id = m_detector->getModuleId(*module);
+            if (!id || !m_modules.count(*id)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool TranslationFilter::inRanges(uint64_t pc) const
+{
+    if (m_ranges.empty()) {
+        return true;
+    }
+
+    foreach2(it, m_ranges.begin(), m_ranges.end()) {
+        if (pc >= (*it).first && pc < (*it).second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TranslationFilter::matchesBlock(S2EExecutionState *state, TranslationBlock *tb, uint64_t pc)
+{
+    if (tb != m_tb) {
+        //Blocks always start with onTranslateBlockStart,
+        //this only happens if the filter was activated mid-block.
+        m_tb = tb;
+        m_tbMatches = matchesContext(state, pc);
+    }
+    return m_tbMatches && inRanges(pc);
+}
+
+bool TranslationFilter::matches(S2EExecutionState *state, uint64_t pc)
+{
+    return matchesContext(state, pc) && inRanges(pc);
+}
+
+void TranslationFilter::slotTranslateBlockStart(ExecutionSignal *signal, S2EExecutionState *state,
+                                                TranslationBlock *tb, uint64_t pc)
+{
+    m_tb = tb;
+    m_tbMatches = matchesContext(state, pc);
+
+    if (m_tbMatches && inRanges(pc)) {
+        onTranslateBlockStart.emit(signal, state, tb, pc);
+    }
+}
+
+void TranslationFilter::slotTranslateBlockEnd(ExecutionSignal *signal, S2EExecutionState *state,
+                                              TranslationBlock *tb, uint64_t endPc,
+                                              bool staticTarget, uint64_t targetPc)
+{
+    if (matchesBlock(state, tb, endPc)) {
+        onTranslateBlockEnd.emit(signal, state, tb, endPc, staticTarget, targetPc);
+    }
+}
+
+void TranslationFilter::slotTranslateInstructionStart(ExecutionSignal *signal, S2EExecutionState *state,
+                                                      TranslationBlock *tb, uint64_t pc)
+{
+    if (matchesBlock(state, tb, pc)) {
+        onTranslateInstructionStart.emit(signal, state, tb, pc);
+    }
+}
+
+void TranslationFilter::slotTranslateInstructionEnd(ExecutionSignal *signal, S2EExecutionState *state,
+                                                    TranslationBlock *tb, uint64_t pc)
+{
+    if (matchesBlock(state, tb, pc)) {
+        onTranslateInstructionEnd.emit(signal, state, tb, pc);
+    }
+}
+
+} // namespace plugins
+} // namespace s2e
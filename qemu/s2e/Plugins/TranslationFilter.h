@@ -0,0 +1,151 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2E_PLUGINS_TRANSLATION_FILTER_H
+#define S2E_PLUGINS_TRANSLATION_FILTER_H
+
+#include <s2e/Plugins/CorePlugin.h>
+
+#include <string>
+#include <set>
+#include <vector>
+
+namespace s2e {
+
+class S2E;
+
+namespace plugins {
+
+class ModuleExecutionDetector;
+
+/**
+ *  Forwards the translation signals of the core plugin for the code
+ *  that matches a set of address ranges, a pid, a privilege mode and
+ *  modules. The filter is evaluated at translation time, once per block
+ *  for the pid, mode and modules. Plugins that connect to the signals
+ *  of the filter do not instrument the rest of the code, which then
+ *  runs without any helper call.
+ */
+class TranslationFilter
+{
+public:
+    enum Mode {
+        ANY_MODE, KERNEL_MODE, USER_MODE
+    };
+
+    typedef sigc::signal<void, ExecutionSignal*,
+            S2EExecutionState*,
+            TranslationBlock*,
+            uint64_t /* pc */> TranslateSignal;
+
+    TranslateSignal onTranslateBlockStart;
+    TranslateSignal onTranslateInstructionStart;
+    TranslateSignal onTranslateInstructionEnd;
+
+    sigc::signal<void, ExecutionSignal*,
+            S2EExecutionState*,
+            TranslationBlock*,
+            uint64_t /* ending instruction pc */,
+            bool /* static target is valid */,
+            uint64_t /* static target pc */>
+            onTranslateBlockEnd;
+
+    TranslationFilter(S2E *s2e);
+    ~TranslationFilter();
+
+    /** Reads ranges, pid, mode, modules and trackedModules under key */
+    void configure(const std::string &key);
+
+    /** Only match [start, end), several ranges may be added */
+    void addRange(uint64_t start, uint64_t end);
+    void setPid(uint64_t pid);
+    void setMode(Mode mode);
+
+    /** Only match the modules with the given ModuleExecutionDetector ids */
+    void addModule(const std::string &moduleId);
+
+    /** Only match the modules tracked by ModuleExecutionDetector */
+    void setTrackedModules(bool tracked);
+
+    /** Connects the filter to the core plugin */
+    void activate();
+    void deactivate();
+
+    bool matches(S2EExecutionState *state, uint64_t pc);
+
+private:
+    typedef std::pair<uint64_t, uint64_t> Range;
+    typedef std::vector<Range> Ranges;
+
+    S2E *m_s2e;
+    ModuleExecutionDetector *m_detector;
+
+    Ranges m_ranges;
+    bool m_hasPid;
+    uint64_t m_pid;
+    Mode m_mode;
+    std::set<std::string> m_modules;
+    bool m_trackedModules;
+
+    //The decision for the context of the block being translated
+    TranslationBlock *m_tb;
+    bool m_tbMatches;
+
+    sigc::connection m_blockStartConnection;
+    sigc::connection m_blockEndConnection;
+    sigc::connection m_instructionStartConnection;
+    sigc::connection m_instructionEndConnection;
+
+    ModuleExecutionDetector *getDetector();
+    bool matchesContext(S2EExecutionState *state, uint64_t pc);
+    bool inRanges(uint64_t pc) const;
+    bool matchesBlock(S2EExecutionState *state, TranslationBlock *tb, uint64_t pc);
+
+    void slotTranslateBlockStart(ExecutionSignal *signal, S2EExecutionState *state,
+                                 TranslationBlock *tb, uint64_t pc);
+    void slotTranslateBlockEnd(ExecutionSignal *signal, S2EExecutionState *state,
+                               TranslationBlock *tb, uint64_t endPc,
+                               bool staticTarget, uint64_t targetPc);
+    void slotTranslateInstructionStart(ExecutionSignal *signal, S2EExecutionState *state,
+                                       TranslationBlock *tb, uint64_t pc);
+    void slotTranslateInstructionEnd(ExecutionSignal *signal, S2EExecutionState *state,
+                                     TranslationBlock *tb, uint64_t pc);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
@@ -85,13 +85,20 @@ void WindowsApi::initialize()
 
 void WindowsApi::registerImports(S2EExecutionState *state, const ModuleDescriptor &module)
 {
-    Imports imports;
-    if (!m_windowsMonitor->getImports(state, module, imports)) {
-        s2e()->getWarningsStream() << "WindowsApi: Could not read imports for module ";
-        module.Print(s2e()->getWarningsStream());
-        return;
+    ImportsCache::key_type key = std::make_pair(module.Name, module.LoadBase);
+    ImportsCache::iterator cit = m_importsCache.find(key);
+    if (cit == m_importsCache.end()) {
+        Imports parsedImports;
+        if (!m_windowsMonitor->getImports(state, module, parsedImports)) {
+            s2e()->getWarningsStream() << "WindowsApi: Could not read imports for module ";
+            module.Print(s2e()->getWarningsStream());
+            return;
+        }
+        cit = m_importsCache.insert(std::make_pair(key, parsedImports)).first;
     }
 
+    const Imports &imports = (*cit).second;
+
     //Scan the imports and notify all handler plugins that we need to intercept functions
     foreach2(it, imports.begin(), imports.end()) {
         const std::string &libraryName = (*it).first;
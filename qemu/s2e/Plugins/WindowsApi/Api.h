@@ -56,6 +56,7 @@
 #include <set>
 #include <sstream>
 #include <stack>
+#include <tr1/unordered_map>
 
 namespace s2e {
 namespace plugins {
@@ -132,6 +133,12 @@ protected:
     //Allows specifying per-function consistency
     ConsistencyMap m_specificConsistency;
 
+    //Parsed imports of the modules loaded so far, by name and load base.
+    //Kernel modules never move, so the import addresses remain valid
+    //when a driver is loaded again.
+    typedef std::map<std::pair<std::string, uint64_t>, Imports> ImportsCache;
+    ImportsCache m_importsCache;
+
     bool m_terminateOnWarnings;
 
 public:
@@ -212,9 +219,20 @@ class WindowsAnnotations: public WindowsApi
 public:
     typedef void (ANNOTATIONS_PLUGIN::*Annotation)(S2EExecutionState* state, FunctionMonitorState *fns);
     typedef const WindowsApiHandler<Annotation> AnnotationsArray;
-    typedef std::map<std::string, Annotation> AnnotationsMap;
     typedef ANNOTATIONS_PLUGIN_STATE AnnotationsState;
 
+    //What the plugin knows about an imported symbol
+    struct ImportInfo {
+        Annotation handler;
+        bool ignored;
+        unsigned variableSize;
+
+        ImportInfo() : handler(NULL), ignored(false), variableSize(0) {}
+    };
+
+    //Resolves an import with a single hash lookup
+    typedef std::tr1::unordered_map<std::string, ImportInfo> ImportTable;
+
     struct AnnotationCb0 {
         typedef void (ANNOTATIONS_PLUGIN::*Callback)(S2EExecutionState* state, FunctionMonitorState *fns);
     };
@@ -223,6 +241,10 @@ public:
         typedef void (ANNOTATIONS_PLUGIN::*Callback)(S2EExecutionState* state, FunctionMonitorState *fns, T1 t1);
     };
 
+private:
+    //Unsupported imports that were already reported
+    StringSet m_reportedImports;
+
 public:
 
     WindowsAnnotations(S2E* s2e): WindowsApi(s2e) {
@@ -272,34 +294,35 @@ public:
         return (cm.find(*mod) != cm.end()) ? mod : NULL;
     }
 
-    //template <typename HANDLING_PLUGIN, typename HANDLER_PTR>
-    static AnnotationsMap initializeHandlerMap() {
-        AnnotationsMap myMap;
+    //Merges the handlers, the ignored functions, and the exported variables
+    //of the plugin into one table.
+    //The ignored functions are imports without annotations that should not be reported.
+    //This prevents cluttering in the log and makes it simpler to find at a glance which new implementations
+    //should be annotated
+    static ImportTable initializeImportTable() {
+        ImportTable table;
 
         unsigned elemCount = sizeof(ANNOTATIONS_PLUGIN::s_handlers) / sizeof(WindowsApiHandler<Annotation>);
         for (unsigned i=0; i<elemCount; ++i) {
-            myMap[ANNOTATIONS_PLUGIN::s_handlers[i].name] = ANNOTATIONS_PLUGIN::s_handlers[i].function;
+            table[ANNOTATIONS_PLUGIN::s_handlers[i].name].handler = ANNOTATIONS_PLUGIN::s_handlers[i].function;
         }
-        return myMap;
-    }
 
-    //Allows to specify which imported functions should be ignored if they don't have any annotation.
-    //This prevents cluttering in the log and makes it simpler to find at a glance which new implementations
-    //should be annotated
-    static StringSet initializeIgnoredFunctionSet() {
-        StringSet ignoredFunctions;
         for (unsigned i=0; ANNOTATIONS_PLUGIN::s_ignoredFunctionsList[i]; ++i) {
-            ignoredFunctions.insert(std::string(ANNOTATIONS_PLUGIN::s_ignoredFunctionsList[i]));
+            table[ANNOTATIONS_PLUGIN::s_ignoredFunctionsList[i]].ignored = true;
         }
-        return ignoredFunctions;
-    }
 
-    static SymbolDescriptors initializeExportedVariables() {
-        SymbolDescriptors exportedVariables;
         for (unsigned i=0; ANNOTATIONS_PLUGIN::s_exportedVariablesList[i].size; ++i) {
-            exportedVariables.insert(ANNOTATIONS_PLUGIN::s_exportedVariablesList[i]);
+            const SymbolDescriptor &desc = ANNOTATIONS_PLUGIN::s_exportedVariablesList[i];
+            table[desc.name].variableSize = desc.size;
         }
-        return exportedVariables;
+
+        return table;
+    }
+
+    static const ImportInfo *getImportInfo(const std::string &name) {
+        const ImportTable &table = ANNOTATIONS_PLUGIN::s_importTable;
+        typename ImportTable::const_iterator it = table.find(name);
+        return it != table.end() ? &(*it).second : NULL;
     }
 
     template <typename T>
@@ -357,12 +380,8 @@ public:
     /////////////////////////////////////////////////////////////////////////////
 
     static Annotation getEntryPoint(const std::string &name) {
-        const AnnotationsMap &myMap = ANNOTATIONS_PLUGIN::s_handlersMap;
-        typename AnnotationsMap::const_iterator it = myMap.find(name);
-        if (it != myMap.end()) {
-            return (*it).second;
-        }
-        return NULL;
+        const ImportInfo *info = getImportInfo(name);
+        return info ? info->handler : NULL;
     }
 
     bool registerEntryPoint(S2EExecutionState *state,
@@ -383,12 +402,18 @@ public:
             const ImportedFunctions &entryPoints)
     {
         foreach2(it, entryPoints.begin(), entryPoints.end()) {
-            if (!registerEntryPoint(state, (*it).first, (uint64_t)(*it).second)) {
-                if (ANNOTATIONS_PLUGIN::s_ignoredFunctions.find((*it).first) == ANNOTATIONS_PLUGIN::s_ignoredFunctions.end()) {
-                    if (!isExportedVariable((*it).first)) {
-                        s2e()->getWarningsStream() << "Import " << (*it).first << " not supported by " << getPluginInfo()->name << '\n';
-                    }
-                }
+            const ImportInfo *info = getImportInfo((*it).first);
+            if (info && info->handler && registerEntryPoint(state, info->handler, (uint64_t)(*it).second)) {
+                continue;
+            }
+
+            if (info && (info->ignored || info->variableSize)) {
+                continue;
+            }
+
+            //Report each unsupported import once, not on every load
+            if (m_reportedImports.insert((*it).first).second) {
+                s2e()->getWarningsStream() << "Import " << (*it).first << " not supported by " << getPluginInfo()->name << '\n';
             }
         }
     }
@@ -405,15 +430,13 @@ public:
     //Checks whether the given name is an exported variable.
     //Useful for granting access rights to such variables.
     static bool isExportedVariable(const std::string &name, unsigned *size = NULL) {
-        SymbolDescriptor desc = {name, 0};
-        SymbolDescriptors::const_iterator it = ANNOTATIONS_PLUGIN::s_exportedVariables.find(desc);
-
-        if (it == ANNOTATIONS_PLUGIN::s_exportedVariables.end()) {
+        const ImportInfo *info = getImportInfo(name);
+        if (!info || !info->variableSize) {
             return false;
         }
 
         if (size) {
-            *size = (*it).size;
+            *size = info->variableSize;
         }
         return true;
     }
@@ -75,14 +75,8 @@ const SymbolDescriptor HalHandlers::s_exportedVariablesList[] = {
 };
 
 
-const HalHandlers::HalHandlersMap HalHandlers::s_handlersMap =
-        HalHandlers::initializeHandlerMap();
-
-const HalHandlers::StringSet HalHandlers::s_ignoredFunctions =
-        HalHandlers::initializeIgnoredFunctionSet();
-
-const SymbolDescriptors HalHandlers::s_exportedVariables =
-        HalHandlers::initializeExportedVariables();
+const HalHandlers::ImportTable HalHandlers::s_importTable =
+        HalHandlers::initializeImportTable();
 
 
 void HalHandlers::initialize()
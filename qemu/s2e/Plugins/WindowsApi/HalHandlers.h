@@ -63,20 +63,16 @@ class HalHandlers: public WindowsAnnotations<HalHandlers, WindowsApiState<HalHan
     S2E_PLUGIN
 public:
     typedef void (HalHandlers::*EntryPoint)(S2EExecutionState* state, FunctionMonitorState *fns);
-    typedef std::map<std::string, HalHandlers::EntryPoint> HalHandlersMap;
 
     HalHandlers(S2E* s2e): WindowsAnnotations<HalHandlers, WindowsApiState<HalHandlers> >(s2e) {}
 
     void initialize();
 
     static const WindowsApiHandler<EntryPoint> s_handlers[];
-    static const HalHandlersMap s_handlersMap;
-
     static const char *s_ignoredFunctionsList[];
-    static const StringSet s_ignoredFunctions;
-
     static const SymbolDescriptor s_exportedVariablesList[];
-    static const SymbolDescriptors s_exportedVariables;
+
+    static const ImportTable s_importTable;
 
 private:
     bool m_loaded;
@@ -137,14 +137,8 @@ const SymbolDescriptor NdisHandlers::s_exportedVariablesList[] = {
     {"", 0}
 };
 
-const NdisHandlers::AnnotationsMap NdisHandlers::s_handlersMap =
-        NdisHandlers::initializeHandlerMap();
-
-const NdisHandlers::StringSet NdisHandlers::s_ignoredFunctions =
-        NdisHandlers::initializeIgnoredFunctionSet();
-
-const SymbolDescriptors NdisHandlers::s_exportedVariables =
-        NdisHandlers::initializeExportedVariables();
+const NdisHandlers::ImportTable NdisHandlers::s_importTable =
+        NdisHandlers::initializeImportTable();
 
 
 void NdisHandlers::initialize()
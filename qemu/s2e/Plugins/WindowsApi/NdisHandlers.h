@@ -76,13 +76,10 @@ public:
 
 public:
     static const AnnotationsArray s_handlers[];
-    static const AnnotationsMap s_handlersMap;
-
     static const char *s_ignoredFunctionsList[];
-    static const StringSet s_ignoredFunctions;
-
     static const SymbolDescriptor s_exportedVariablesList[];
-    static const SymbolDescriptors s_exportedVariables;
+
+    static const ImportTable s_importTable;
 
 private:
     SymbolicHardware *m_hw;
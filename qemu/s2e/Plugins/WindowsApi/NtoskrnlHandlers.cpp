@@ -132,14 +132,8 @@ const SymbolDescriptor NtoskrnlHandlers::s_exportedVariablesList[] = {
 //Registry:
 //ZwClose, ZwCreateKey, ZwOpenKey, ZwQueryValueKey, ZwSetSecurityObject, ZwSetValueKey
 
-const NtoskrnlHandlers::AnnotationsMap NtoskrnlHandlers::s_handlersMap =
-        NtoskrnlHandlers::initializeHandlerMap();
-
-const NtoskrnlHandlers::StringSet NtoskrnlHandlers::s_ignoredFunctions =
-        NtoskrnlHandlers::initializeIgnoredFunctionSet();
-
-const SymbolDescriptors NtoskrnlHandlers::s_exportedVariables =
-        NtoskrnlHandlers::initializeExportedVariables();
+const NtoskrnlHandlers::ImportTable NtoskrnlHandlers::s_importTable =
+        NtoskrnlHandlers::initializeImportTable();
 
 void NtoskrnlHandlers::initialize()
 {
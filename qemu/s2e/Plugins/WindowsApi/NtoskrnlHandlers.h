@@ -69,13 +69,10 @@ public:
 
 public:
     static const WindowsApiHandler<Annotation> s_handlers[];
-    static const AnnotationsMap s_handlersMap;
-
     static const char *s_ignoredFunctionsList[];
-    static const StringSet s_ignoredFunctions;
-
     static const SymbolDescriptor s_exportedVariablesList[];
-    static const SymbolDescriptors s_exportedVariables;
+
+    static const ImportTable s_importTable;
 
 private:
     bool m_loaded;
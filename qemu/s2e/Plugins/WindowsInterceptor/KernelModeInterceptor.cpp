@@ -90,49 +90,15 @@ void WindowsKmInterceptor::NotifyDriverUnload(S2EExecutionState *State, const Mo
 
 bool WindowsKmInterceptor::ReadModuleList(S2EExecutionState *state)
 {
-    uint32_t pListHead, pItem, pModuleEntry;
-    uint32_t PsLoadedModuleList;
-    s2e::windows::LIST_ENTRY32 ListHead;
-    s2e::windows::MODULE_ENTRY32 ModuleEntry;
-
-    const windows::DBGKD_GET_VERSION64 &VersionBlock = m_Os->getVersionBlock();
-    PsLoadedModuleList = VersionBlock.PsLoadedModuleList;
-
-    pListHead = PsLoadedModuleList;
-    if (!state->readMemoryConcrete(PsLoadedModuleList, &ListHead, sizeof(ListHead))) {
+    ModuleDescriptorList modules;
+    if (!m_Os->getKernelModules(state, modules)) {
         return false;
     }
 
-
-    for (pItem = ListHead.Flink; pItem != pListHead; ) {
-        pModuleEntry = pItem;
-
-        if (state->readMemoryConcrete(pModuleEntry, &ModuleEntry, sizeof(ModuleEntry)) < 0) {
-            std::cout << "Could not load MODULE_ENTRY" << std::endl;
-            return false;
-        }
-
-        ModuleDescriptor desc;
-
-        desc.Pid = 0;
-
-        state->readUnicodeString(ModuleEntry.driver_Name.Buffer, desc.Name, ModuleEntry.driver_Name.Length);
-        std::transform(desc.Name.begin(), desc.Name.end(), desc.Name.begin(), ::tolower);
-
-        //s2e_debug_print("DRIVER_OBJECT Start=%#x Size=%#x DriverName=%s\n", ModuleEntry.base,
-        //    0, desc.Name.c_str());
-
-
-        desc.NativeBase = 0; // Image.GetImageBase();
-        desc.LoadBase = ModuleEntry.base;
-
-
-        NotifyDriverLoad(state, desc);
-
-        pItem = ListHead.Flink;
-        if (!state->readMemoryConcrete(ListHead.Flink, &ListHead, sizeof(ListHead))) {
-            return false;
-        }
+    foreach2(it, modules.begin(), modules.end()) {
+        //s2e_debug_print("DRIVER_OBJECT Start=%#x Size=%#x DriverName=%s\n", (*it).LoadBase,
+        //    0, (*it).Name.c_str());
+        NotifyDriverLoad(state, *it);
     }
 
     return true;
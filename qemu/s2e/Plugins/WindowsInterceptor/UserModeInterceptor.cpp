@@ -103,62 +103,30 @@ bool WindowsUmInterceptor::NotifyLoadedProcesses(S2EExecutionState *state)
 
 bool WindowsUmInterceptor::FindModules(S2EExecutionState *state)
 {
-    s2e::windows::LDR_DATA_TABLE_ENTRY32 LdrEntry;
-    s2e::windows::PEB_LDR_DATA32 LdrData;
-
     if (!WaitForProcessInit(state)) {
         return false;
     }
 
-    if (!state->readMemoryConcrete(m_LdrAddr, &LdrData, sizeof(s2e::windows::PEB_LDR_DATA32))) {
+    ModuleDescriptorList modules;
+    if (!m_Os->getUserModules(state, m_LdrAddr, modules)) {
         return false;
     }
 
-    uint32_t CurLib = CONTAINING_RECORD32(LdrData.InLoadOrderModuleList.Flink,
-        s2e::windows::LDR_DATA_TABLE_ENTRY32, InLoadOrderLinks);
-
-    uint32_t HeadOffset = m_LdrAddr + offsetof(s2e::windows::PEB_LDR_DATA32, InLoadOrderModuleList);
-    if (LdrData.InLoadOrderModuleList.Flink == HeadOffset) {
+    if (modules.empty()) {
         return false;
     }
 
-    do {
-        if (!state->readMemoryConcrete(CurLib, &LdrEntry, sizeof(s2e::windows::LDR_DATA_TABLE_ENTRY32))) {
-            s2e_debug_print("Could not read LDR_DATA_TABLE_ENTRY (%#x)\n", CurLib);
-            return false;
-        }
-
-        std::string s;
-        state->readUnicodeString(LdrEntry.BaseDllName.Buffer, s, LdrEntry.BaseDllName.Length);
-        std::transform(s.begin(), s.end(), s.begin(), ::tolower);
-
-        if (s.length() == 0) {
-            if (LdrEntry.DllBase == 0x7c900000) {
-                //XXX
-                s = "ntdll.dll";
-            }else {
-                s = "<unnamed>";
-            }
-        }
-
-        //if (m_SearchedModules.find(s) != m_SearchedModules.end()) {
-        //Update the information about the library
-        ModuleDescriptor Desc;
-        Desc.Pid = state->getPid();
-        Desc.Name = s;
-        Desc.LoadBase = LdrEntry.DllBase;
-        Desc.Size = LdrEntry.SizeOfImage;
+    foreach2(it, modules.begin(), modules.end()) {
+        const ModuleDescriptor &Desc = *it;
 
         //XXX: this must be state-local
         if (m_LoadedLibraries.find(Desc) == m_LoadedLibraries.end()) {
-            s2e_debug_print("  MODULE %s Base=%#x Size=%#x\n", s.c_str(), LdrEntry.DllBase, LdrEntry.SizeOfImage);
+            s2e_debug_print("  MODULE %s Base=%#x Size=%#x\n", Desc.Name.c_str(),
+                            (uint32_t) Desc.LoadBase, (uint32_t) Desc.Size);
             m_LoadedLibraries.insert(Desc);
             NotifyModuleLoad(state, Desc);
         }
-
-        CurLib = CONTAINING_RECORD32(LdrEntry.InLoadOrderLinks.Flink,
-            s2e::windows::LDR_DATA_TABLE_ENTRY32, InLoadOrderLinks);
-    }while(LdrEntry.InLoadOrderLinks.Flink != HeadOffset);
+    }
 
     return true;
 }
@@ -381,29 +349,18 @@ bool WindowsUmInterceptor::CatchModuleUnload(S2EExecutionState *State)
 
 bool WindowsUmInterceptor::GetPids(S2EExecutionState *State, PidSet &out)
 {
-    windows::LIST_ENTRY32 ListHead;
     uint64_t ActiveProcessList = m_Os->GetPsActiveProcessListPtr();
-    uint64_t pItem;
 
     uint64_t CurrentProcess = m_Os->getCurrentProcess(State);
     g_s2e->getDebugStream() << "CurrentProcess: " << hexval(CurrentProcess) << '\n';
 
-    //Read the head of the list
-    if (!State->readMemoryConcrete(ActiveProcessList, &ListHead, sizeof(ListHead))) {
+    std::vector<uint64_t> links;
+    if (!m_Os->getListEntries(State, ActiveProcessList, links)) {
         return false;
     }
 
-    //Check for empty list
-    if (ListHead.Flink == ActiveProcessList) {
-        return true;
-    }
-
-    for (pItem = ListHead.Flink; pItem != ActiveProcessList; pItem = ListHead.Flink) {
-        if (!State->readMemoryConcrete(pItem, &ListHead, sizeof(ListHead))) {
-            return false;
-        }
-
-        uint32_t pProcessEntry = m_Os->getProcessFromLink(pItem);
+    foreach2(it, links.begin(), links.end()) {
+        uint32_t pProcessEntry = m_Os->getProcessFromLink(*it);
         uint32_t pDirectoryTableBase = m_Os->getDirectoryTableBase(State, pProcessEntry);
 
 //        g_s2e->getDebugStream() << "Found EPROCESS=0x" <<  pProcessEntry << " PgDir=0x" << std::hex << ProcessEntry.Pcb.DirectoryTableBase <<
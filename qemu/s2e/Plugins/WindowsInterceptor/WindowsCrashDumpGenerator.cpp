@@ -48,8 +48,11 @@ extern CPUX86State *env;
 #include <s2e/Utils.h>
 #include <s2e/Plugins/WindowsApi/Api.h>
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <stdio.h>
+#include <zlib.h>
 
 namespace s2e {
 namespace plugins {
@@ -65,6 +68,36 @@ void WindowsCrashDumpGenerator::initialize()
     Lunar<WindowsCrashDumpInvoker>::Register(s2e()->getConfig()->getState());
 
     m_monitor = static_cast<WindowsMonitor*>(s2e()->getPlugin("WindowsMonitor"));
+
+    ConfigFile *cfg = s2e()->getConfig();
+
+    std::string dumpType = cfg->getString(getConfigKey() + ".dumpType", "complete");
+    if (dumpType == "kernel") {
+        m_kernelDump = true;
+    } else if (dumpType == "complete") {
+        m_kernelDump = false;
+    } else {
+        s2e()->getWarningsStream() << "WindowsCrashDumpGenerator: dumpType must be either "
+                                   << "complete or kernel\n";
+        exit(-1);
+    }
+
+    m_compress = cfg->getBool(getConfigKey() + ".compress");
+    m_deduplicate = cfg->getBool(getConfigKey() + ".deduplicate");
+
+    m_asyncWrites = cfg->getBool(getConfigKey() + ".asyncWrites");
+    if (m_asyncWrites) {
+        qemu_mutex_init(&m_writerLock);
+        qemu_cond_init(&m_writerCond);
+        m_writerStop = false;
+        m_writerRunning = true;
+        qemu_thread_create(&m_writerThread, writerThread, this, QEMU_THREAD_JOINABLE);
+    }
+}
+
+WindowsCrashDumpGenerator::~WindowsCrashDumpGenerator()
+{
+    stopWriter();
 }
 
 void WindowsCrashDumpGenerator::generateDump(S2EExecutionState *state, const std::string &prefix)
@@ -168,21 +201,17 @@ void WindowsCrashDumpGenerator::generateCrashDump(S2EExecutionState *state,
 {
     uint32_t KprcbProcessContextOffset;
 
-    uint32_t *blocks;
     uint8_t *rawhdr;
     DUMP_HEADER32 *hdr;
     bool ok;
-    uint8_t ZeroPage[0x1000];
-    uint8_t TempPage[0x1000];
     klee::ref<klee::Expr> OriginalContext[sizeof(CONTEXT32)];
 
     PHYSICAL_MEMORY_DESCRIPTOR *ppmd;
-
-    unsigned PagesWritten, CurrentMemoryRun;
+    CrashDump *dump;
+    bool kernelDump = m_kernelDump;
 
     std::stringstream filename;
-    filename << prefix << state->getID() << ".dump";
-    llvm::raw_ostream &d = *s2e()->openOutputFile(filename.str());
+    filename << prefix << state->getID() << (m_compress ? ".dump.gz" : ".dump");
 
     rawhdr = new uint8_t[0x1000];
     hdr = (DUMP_HEADER32*)rawhdr;
@@ -192,14 +221,11 @@ void WindowsCrashDumpGenerator::generateCrashDump(S2EExecutionState *state,
         *(uint32_t*)(rawhdr + i) = DUMP_HDR_SIGNATURE;
     }
 
-    //Init and write the header
+    //Init the header
     if (!initializeHeader(state, hdr, context, bugdesc)) {
         goto err1;
     }
 
-    d.write((const char*)rawhdr, 0x1000);
-
-
     //Save the original context
     KprcbProcessContextOffset = m_monitor->getKpcrbAddress() + offsetof(KPRCB32, ProcessorState.ContextFrame);
     for (unsigned i=0; i<sizeof(CONTEXT32); ++i) {
@@ -214,18 +240,69 @@ void WindowsCrashDumpGenerator::generateCrashDump(S2EExecutionState *state,
         goto err1;
     }
 
+    //Page tables can only be walked in the active state
+    if (kernelDump && !state->isActive()) {
+        s2e()->getWarningsStream() << "WindowsCrashDumpGenerator: state " << state->getID()
+                                   << " is not active, writing a complete dump" << '\n';
+        kernelDump = false;
+    }
+
+    //Build the dump in memory
+    dump = new CrashDump();
+    dump->fileName = s2e()->getOutputFilename(filename.str());
+    dump->data.insert(dump->data.end(), rawhdr, rawhdr + 0x1000);
+
+    ppmd = (PHYSICAL_MEMORY_DESCRIPTOR*) &((uint32_t*)hdr)[ DH_PHYSICAL_MEMORY_BLOCK ];
+    if (kernelDump) {
+        dumpKernelMemory(state, ppmd, dump->data);
+    } else {
+        dumpCompleteMemory(state, ppmd, dump->data);
+    }
 
-    //Dump the physical memory
-    blocks = (uint32_t*)hdr;
-    ppmd = (PHYSICAL_MEMORY_DESCRIPTOR*) &blocks[ DH_PHYSICAL_MEMORY_BLOCK ];
+    //Restore the original context
+    for (unsigned i=0; i<sizeof(CONTEXT32); ++i) {
+        state->writeMemory(KprcbProcessContextOffset + i, OriginalContext[i]);
+    }
 
-    PagesWritten = 0;
+    submitDump(dump);
 
-    memset( ZeroPage, 0, 0x1000 );
+    err1:
+    delete [] rawhdr;
+}
 
-    CurrentMemoryRun = 0;
+void WindowsCrashDumpGenerator::readPhysicalPage(S2EExecutionState *state, uint64_t physAddr, uint8_t *page)
+{
+    //Most pages are concrete and can be copied at once
+    if (state->readMemoryConcrete(physAddr, page, 0x1000, S2EExecutionState::PhysicalAddress)) {
+        return;
+    }
+
+    memset(page, 0xDA, 0x1000);
+    for (uint32_t i=0; i<0x1000; ++i) {
+        klee::ref<klee::Expr> v = state->readMemory(physAddr+i, klee::Expr::Int8, S2EExecutionState::PhysicalAddress);
+        if (v.isNull()) {
+            continue;
+        }
+
+        if (!isa<klee::ConstantExpr>(v)) {
+            //Make it concrete
+            page[i] = s2e()->getExecutor()->toConstant(*state, v,
+                                    "concretizing memory for crash dump")->getZExtValue(8);
+        }else {
+            page[i] = (uint8_t)cast<klee::ConstantExpr>(v)->getZExtValue(8);
+        }
+    }
+}
+
+/** Appends all the physical memory runs to the dump */
+void WindowsCrashDumpGenerator::dumpCompleteMemory(S2EExecutionState *state,
+                                                   const PHYSICAL_MEMORY_DESCRIPTOR *ppmd,
+                                                   std::vector<uint8_t> &data)
+{
+    unsigned CurrentMemoryRun = 0;
     while( CurrentMemoryRun < ppmd->NumberOfRuns ) {
-        if( ppmd->Run[CurrentMemoryRun].PageCount == DUMP_HDR_SIGNATURE || ppmd->Run[CurrentMemoryRun].BasePage == DUMP_HDR_SIGNATURE )
+        const PHYSICAL_MEMORY_RUN &run = ppmd->Run[CurrentMemoryRun];
+        if( run.PageCount == DUMP_HDR_SIGNATURE || run.BasePage == DUMP_HDR_SIGNATURE )
         {
             s2e()->getDebugStream() << "PHYSICAL_MEMORY_DESCRIPTOR corrupted." << '\n';
             break;
@@ -233,41 +310,221 @@ void WindowsCrashDumpGenerator::generateCrashDump(S2EExecutionState *state,
 
         s2e()->getDebugStream() << "Processing run " << CurrentMemoryRun << '\n';
 
+        size_t offset = data.size();
+        data.resize(offset + (size_t) run.PageCount * 0x1000);
 
-        uint32_t ProcessedPagesInCurrentRun = 0;
-        while( ProcessedPagesInCurrentRun < ppmd->Run[CurrentMemoryRun].PageCount ) {
-            uint32_t physAddr = (ppmd->Run[CurrentMemoryRun].BasePage + ProcessedPagesInCurrentRun) * 0x1000;
+        for (uint32_t i = 0; i < run.PageCount; ++i) {
+            uint64_t physAddr = (uint64_t) (run.BasePage + i) * 0x1000;
+            readPhysicalPage(state, physAddr, &data[offset + (size_t) i * 0x1000]);
+        }
+        CurrentMemoryRun ++;
+    }
+}
 
-            //s2e()->getDebugStream() << "Processing page " << std::dec << ProcessedPagesInCurrentRun
-            //        << "(addr=0x" << std::hex << physAddr << '\n';
+/**
+ *  Appends a summary dump of the physical pages mapped in the kernel
+ *  address space. WinDbg opens it as a kernel memory dump.
+ */
+void WindowsCrashDumpGenerator::dumpKernelMemory(S2EExecutionState *state,
+                                                 const PHYSICAL_MEMORY_DESCRIPTOR *ppmd,
+                                                 std::vector<uint8_t> &data)
+{
+    enum { NOT_RAM = 0, RAM, MAPPED };
 
-            memset(TempPage, 0xDA, sizeof(TempPage));
-            for (uint32_t i=0; i<0x1000; ++i) {
-                klee::ref<klee::Expr> v = state->readMemory(physAddr+i, klee::Expr::Int8, S2EExecutionState::PhysicalAddress);
-                if (v.isNull() || !isa<klee::ConstantExpr>(v)) {
-                    //Make it concrete
-                    TempPage[i] = s2e()->getExecutor()->toConstant(*state, v,
-                                            "concretizing memory for crash dump")->getZExtValue(8);                    
-                }else {
-                    TempPage[i] = (uint8_t)cast<klee::ConstantExpr>(v)->getZExtValue(8);
-                }
-            }
+    //Find the pages that are backed by RAM
+    std::vector<uint8_t> pfns;
+    for (unsigned r = 0; r < ppmd->NumberOfRuns; ++r) {
+        const PHYSICAL_MEMORY_RUN &run = ppmd->Run[r];
+        if (run.PageCount == DUMP_HDR_SIGNATURE || run.BasePage == DUMP_HDR_SIGNATURE) {
+            s2e()->getDebugStream() << "PHYSICAL_MEMORY_DESCRIPTOR corrupted." << '\n';
+            break;
+        }
 
-            d.write((const char*)TempPage, 0x1000);
+        if (pfns.size() < run.BasePage + run.PageCount) {
+            pfns.resize(run.BasePage + run.PageCount, NOT_RAM);
+        }
+        std::fill(pfns.begin() + run.BasePage, pfns.begin() + run.BasePage + run.PageCount, RAM);
+    }
 
-            PagesWritten ++;
-            ProcessedPagesInCurrentRun ++;
+    //Select the ones that are mapped in the kernel
+    uint32_t pageCount = 0;
+    for (uint64_t va = m_monitor->GetKernelStart(); va < 0x100000000ULL; va += 0x1000) {
+        uint64_t pa = state->getPhysicalAddress(va);
+        if (pa == (uint64_t) -1) {
+            continue;
+        }
+
+        uint64_t pfn = pa >> 12;
+        if (pfn < pfns.size() && pfns[pfn] == RAM) {
+            pfns[pfn] = MAPPED;
+            ++pageCount;
         }
-        CurrentMemoryRun ++;
     }
 
-    //Restore the original context
-    for (unsigned i=0; i<sizeof(CONTEXT32); ++i) {
-        state->writeMemory(KprcbProcessContextOffset + i, OriginalContext[i]);
+    uint32_t bitmapSize = pfns.size();
+    uint32_t bitmapBytes = ((bitmapSize + 31) / 32) * sizeof(uint32_t);
+    uint32_t summaryOffset = DH_SUMMARY_DUMP_RECORD * sizeof(uint32_t);
+    uint32_t headerSize = (summaryOffset + sizeof(SUMMARY_DUMP_HEADER) + bitmapBytes + 0xFFF) & ~0xFFF;
+
+    assert(data.size() == summaryOffset);
+    data.resize(headerSize + (size_t) pageCount * 0x1000);
+
+    SUMMARY_DUMP_HEADER *summary = (SUMMARY_DUMP_HEADER*) &data[summaryOffset];
+    summary->Unknown1 = DUMP_SUMMARY_SIGNATURE;
+    summary->ValidDump = DUMP_HDR_DUMPSIGNATURE;
+    summary->HeaderSize = headerSize;
+    summary->BitmapSize = bitmapSize;
+    summary->Pages = pageCount;
+
+    uint32_t *bitmap = (uint32_t*) &data[summaryOffset + sizeof(SUMMARY_DUMP_HEADER)];
+    size_t offset = headerSize;
+    for (uint32_t pfn = 0; pfn < bitmapSize; ++pfn) {
+        if (pfns[pfn] != MAPPED) {
+            continue;
+        }
+        bitmap[pfn / 32] |= 1 << (pfn % 32);
+        readPhysicalPage(state, (uint64_t) pfn * 0x1000, &data[offset]);
+        offset += 0x1000;
     }
 
-    err1:
-    delete [] rawhdr;
+    uint32_t *blocks = (uint32_t*) &data[0];
+    blocks[ DH_DUMP_TYPE ] = DUMP_TYPE_SUMMARY;
+    *((uint64_t*)&blocks[DH_REQUIRED_DUMP_SPACE]) = data.size();
+
+    s2e()->getDebugStream() << "Saved " << pageCount << " kernel pages out of " << bitmapSize << '\n';
+}
+
+/** FNV-1a, one 64-bit word at a time */
+uint64_t WindowsCrashDumpGenerator::hashDump(const std::vector<uint8_t> &data)
+{
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+
+    for (; i < data.size(); ++i) {
+        hash = (hash ^ data[i]) * prime;
+    }
+
+    return (hash ^ data.size()) * prime;
+}
+
+/** Takes ownership of the dump */
+void WindowsCrashDumpGenerator::submitDump(CrashDump *dump)
+{
+    if (m_deduplicate) {
+        uint64_t hash = hashDump(dump->data);
+        std::map<uint64_t, std::string>::iterator it = m_dumpHashes.find(hash);
+        if (it != m_dumpHashes.end()) {
+            s2e()->getMessagesStream() << "Crash dump " << dump->fileName
+                                       << " is identical to " << (*it).second << ", not writing it\n";
+            delete dump;
+            return;
+        }
+        m_dumpHashes[hash] = dump->fileName;
+    }
+
+    if (!m_asyncWrites) {
+        writeDump(*dump);
+        delete dump;
+        return;
+    }
+
+    qemu_mutex_lock(&m_writerLock);
+    while (m_pendingDumps.size() >= MAX_PENDING_DUMPS) {
+        qemu_cond_wait(&m_writerCond, &m_writerLock);
+    }
+    m_pendingDumps.push_back(dump);
+    qemu_cond_broadcast(&m_writerCond);
+    qemu_mutex_unlock(&m_writerLock);
+}
+
+/** Runs in the writer thread when asyncWrites is enabled */
+void WindowsCrashDumpGenerator::writeDump(const CrashDump &dump)
+{
+    const size_t chunkSize = 1024 * 1024;
+    bool ok = true;
+
+    if (m_compress) {
+        gzFile f = gzopen(dump.fileName.c_str(), "wb");
+        ok = f != NULL;
+        for (size_t i = 0; ok && i < dump.data.size(); i += chunkSize) {
+            unsigned size = std::min(chunkSize, dump.data.size() - i);
+            ok = gzwrite(f, &dump.data[i], size) == (int) size;
+        }
+        if (f && gzclose(f) != Z_OK) {
+            ok = false;
+        }
+    } else {
+        FILE *f = fopen(dump.fileName.c_str(), "wb");
+        ok = f != NULL;
+        for (size_t i = 0; ok && i < dump.data.size(); i += chunkSize) {
+            size_t size = std::min(chunkSize, dump.data.size() - i);
+            ok = fwrite(&dump.data[i], size, 1, f) == 1;
+        }
+        if (f && fclose(f)) {
+            ok = false;
+        }
+    }
+
+    if (!ok) {
+        //The logging streams are not thread-safe
+        std::cerr << "WindowsCrashDumpGenerator: could not write " << dump.fileName << '\n';
+    }
+}
+
+/** Writes out the pending dumps and terminates the writer */
+void WindowsCrashDumpGenerator::stopWriter()
+{
+    if (!m_writerRunning) {
+        return;
+    }
+
+    qemu_mutex_lock(&m_writerLock);
+    m_writerStop = true;
+    qemu_cond_broadcast(&m_writerCond);
+    qemu_mutex_unlock(&m_writerLock);
+
+    qemu_thread_join(&m_writerThread);
+    m_writerRunning = false;
+}
+
+void *WindowsCrashDumpGenerator::writerThread(void *opaque)
+{
+    static_cast<WindowsCrashDumpGenerator*>(opaque)->writerLoop();
+    return NULL;
+}
+
+void WindowsCrashDumpGenerator::writerLoop()
+{
+    qemu_mutex_lock(&m_writerLock);
+    while (true) {
+        while (m_pendingDumps.empty() && !m_writerStop) {
+            qemu_cond_wait(&m_writerCond, &m_writerLock);
+        }
+
+        if (m_pendingDumps.empty()) {
+            break;
+        }
+
+        CrashDump *dump = m_pendingDumps.front();
+        m_pendingDumps.pop_front();
+
+        //Wake up the CPU loop if it waits for a free slot
+        qemu_cond_broadcast(&m_writerCond);
+        qemu_mutex_unlock(&m_writerLock);
+
+        writeDump(*dump);
+        delete dump;
+
+        qemu_mutex_lock(&m_writerLock);
+    }
+    qemu_mutex_unlock(&m_writerLock);
 }
 
 bool WindowsCrashDumpGenerator::initializeHeader(S2EExecutionState *state, DUMP_HEADER32 *hdr,
@@ -449,7 +706,7 @@ int WindowsCrashDumpInvoker::generateCrashDump(lua_State *L)
 
         //Fetch the right state
         //XXX: Avoid linear search
-        const std::set<klee::ExecutionState*> &states = g_s2e->getExecutor()->getStates();
+        const klee::StateSet &states = g_s2e->getExecutor()->getStates();
         foreach2(it, states.begin(), states.end()) {
             S2EExecutionState *ss = static_cast<S2EExecutionState*>(*it);
             if (ss->getID() == stateId) {
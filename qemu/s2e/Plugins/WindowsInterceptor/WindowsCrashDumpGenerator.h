@@ -41,6 +41,14 @@
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/S2EExecutionState.h>
 
+#include <deque>
+#include <map>
+#include <vector>
+
+extern "C" {
+#include <qemu-thread.h>
+}
+
 #include "WindowsImage.h"
 #include "WindowsMonitor.h"
 
@@ -52,6 +60,7 @@ namespace windows {
 #define DUMP_HDR_SIGNATURE  0x45474150 //'EGAP'
 #define DUMP_HDR_DUMPSIGNATURE  0x504D5544 //'PMUD'
 #define DUMP_KDBG_SIGNATURE  0x4742444B //'GBDK'
+#define DUMP_SUMMARY_SIGNATURE  0x504D4453 //'PMDS'
 
 struct DUMP_HEADER32 {
 /* 00 */    uint32_t Signature;
@@ -289,7 +298,8 @@ public:
         uint32_t param1, param2, param3, param4;
     };
 
-    WindowsCrashDumpGenerator(S2E* s2e): Plugin(s2e) {}
+    WindowsCrashDumpGenerator(S2E* s2e): Plugin(s2e), m_writerRunning(false) {}
+    ~WindowsCrashDumpGenerator();
 
     void initialize();
 
@@ -297,8 +307,32 @@ public:
     void generateDumpOnBsod(S2EExecutionState *state, const std::string &prefix);
 
 private:
+    struct CrashDump {
+        std::string fileName;
+        std::vector<uint8_t> data;
+    };
+
+    //Maximum number of dumps waiting for the writer thread
+    static const unsigned MAX_PENDING_DUMPS = 4;
+
     WindowsMonitor *m_monitor;
 
+    //Only save the physical pages mapped in the kernel address space
+    bool m_kernelDump;
+    bool m_compress;
+    bool m_deduplicate;
+
+    //Content hash of the dumps written so far, to their file name
+    std::map<uint64_t, std::string> m_dumpHashes;
+
+    bool m_asyncWrites;
+    bool m_writerRunning;
+    bool m_writerStop;
+    QemuThread m_writerThread;
+    QemuMutex m_writerLock;
+    QemuCond m_writerCond;
+    std::deque<CrashDump*> m_pendingDumps;
+
     uint32_t readAndConcretizeRegister(S2EExecutionState *state, unsigned offset);
     bool saveContext(S2EExecutionState *state, s2e::windows::CONTEXT32 &ctx);
     void generateCrashDump(S2EExecutionState *state,
@@ -309,6 +343,22 @@ private:
                                                      const s2e::windows::CONTEXT32 &ctx,
                                                      const BugCheckDesc &bugdesc);
 
+    void readPhysicalPage(S2EExecutionState *state, uint64_t physAddr, uint8_t *page);
+    void dumpCompleteMemory(S2EExecutionState *state,
+                            const s2e::windows::PHYSICAL_MEMORY_DESCRIPTOR *ppmd,
+                            std::vector<uint8_t> &data);
+    void dumpKernelMemory(S2EExecutionState *state,
+                          const s2e::windows::PHYSICAL_MEMORY_DESCRIPTOR *ppmd,
+                          std::vector<uint8_t> &data);
+
+    static uint64_t hashDump(const std::vector<uint8_t> &data);
+    void submitDump(CrashDump *dump);
+    void writeDump(const CrashDump &dump);
+
+    void stopWriter();
+    static void *writerThread(void *opaque);
+    void writerLoop();
+
 };
 
 
@@ -54,6 +54,7 @@ extern "C" {
 #include <string>
 #include <cstring>
 #include <sstream>
+#include <algorithm>
 #include <iostream>
 #include <assert.h>
 
@@ -429,27 +430,18 @@ void WindowsMonitor::slotKmUpdateModuleList(S2EExecutionState *state, uint64_t p
 
 bool WindowsMonitor::getAllProcesses(S2EExecutionState *state, std::vector<uint64_t> &pEProcess)
 {
-    windows::LIST_ENTRY32 ListHead;
-    uint64_t ActiveProcessList = GetPsActiveProcessListPtr();
-    uint64_t pItem;
-
-    //Read the head of the list
-    if (!state->readMemoryConcrete(ActiveProcessList, &ListHead, sizeof(ListHead))) {
+    std::vector<uint64_t> links;
+    if (!getListEntries(state, GetPsActiveProcessListPtr(), links)) {
         return false;
     }
 
     //Check for empty list
-    if (ListHead.Flink == ActiveProcessList) {
+    if (links.empty()) {
         return false;
     }
 
-    for (pItem = ListHead.Flink; pItem != ActiveProcessList; pItem = ListHead.Flink) {
-        if (!state->readMemoryConcrete(pItem, &ListHead, sizeof(ListHead))) {
-            return false;
-        }
-
-        uint32_t pProcessEntry = getProcessFromLink(pItem);
-        pEProcess.push_back(pProcessEntry);
+    foreach2(it, links.begin(), links.end()) {
+        pEProcess.push_back(getProcessFromLink(*it));
     }
     return true;
 }
@@ -461,28 +453,168 @@ bool WindowsMonitor::getAllThreads(S2EExecutionState *state, uint64_t process, s
 
     assert(linkOffset && headOffset && "Not implemented yet\n");
 
-    uint64_t ThreadList = process + headOffset;
-
-    windows::LIST_ENTRY32 ListHead;
-    //Read the head of the list
-    if (!state->readMemoryConcrete(ThreadList, &ListHead, sizeof(ListHead))) {
+    std::vector<uint64_t> links;
+    if (!getListEntries(state, process + headOffset, links)) {
         return false;
     }
 
     //Check for empty list
-    if (ListHead.Flink == ThreadList) {
+    if (links.empty()) {
         return false;
     }
 
-    for (uint32_t pItem = ListHead.Flink; pItem != ThreadList; pItem = ListHead.Flink) {
+    foreach2(it, links.begin(), links.end()) {
+        pEThread.push_back(*it - linkOffset);
+    }
+    return true;
+
+}
+
+WindowsListSnapshot *WindowsMonitor::getListSnapshot(S2EExecutionState *state, uint64_t head)
+{
+    DECLARE_PLUGINSTATE(WindowsMonitorState, state);
+
+    //Kernel lists are the same in all address spaces
+    uint64_t as = isKernelAddress(head) ? 0 : state->getPid();
+    std::pair<uint64_t, uint64_t> key = std::make_pair(as, head);
+
+    WindowsMonitorState::ListSnapshots::iterator it = plgState->m_lists.find(key);
+    if (it != plgState->m_lists.end()) {
+        bool valid = true;
+        foreach2(pit, (*it).second.pages.begin(), (*it).second.pages.end()) {
+            if (state->wasPageWritten(*pit)) {
+                valid = false;
+                break;
+            }
+        }
+
+        if (valid) {
+            return &(*it).second;
+        }
+        plgState->m_lists.erase(it);
+    }
+
+    //Snapshots of exited processes are never looked up again
+    if (plgState->m_lists.size() >= 1024) {
+        plgState->m_lists.clear();
+    }
+
+    //Pages are watched before being read, so that no write is missed
+    WindowsListSnapshot snapshot;
+    windows::LIST_ENTRY32 ListHead;
+    uint64_t pItem = head;
+    do {
+        uint64_t page = state->watchPageWrites(pItem);
+        if (page == (uint64_t) -1) {
+            return NULL;
+        }
+
+        if (std::find(snapshot.pages.begin(), snapshot.pages.end(), page) == snapshot.pages.end()) {
+            snapshot.pages.push_back(page);
+        }
+
         if (!state->readMemoryConcrete(pItem, &ListHead, sizeof(ListHead))) {
-            return false;
+            return NULL;
         }
 
-        pEThread.push_back(pItem - linkOffset);
+        if (pItem != head) {
+            snapshot.entries.push_back(pItem);
+        }
+
+        pItem = ListHead.Flink;
+    } while (pItem != head);
+
+    return &(plgState->m_lists[key] = snapshot);
+}
+
+bool WindowsMonitor::getListEntries(S2EExecutionState *state, uint64_t head, std::vector<uint64_t> &entries)
+{
+    WindowsListSnapshot *snapshot = getListSnapshot(state, head);
+    if (!snapshot) {
+        return false;
     }
+
+    entries = snapshot->entries;
     return true;
+}
+
+bool WindowsMonitor::getKernelModules(S2EExecutionState *state, ModuleDescriptorList &modules)
+{
+    WindowsListSnapshot *snapshot = getListSnapshot(state, m_kdVersion.PsLoadedModuleList);
+    if (!snapshot) {
+        return false;
+    }
+
+    if (!snapshot->hasModules) {
+        foreach2(it, snapshot->entries.begin(), snapshot->entries.end()) {
+            windows::MODULE_ENTRY32 ModuleEntry;
+            if (!state->readMemoryConcrete(*it, &ModuleEntry, sizeof(ModuleEntry))) {
+                s2e()->getWarningsStream(state) << "Could not load MODULE_ENTRY" << '\n';
+                snapshot->modules.clear();
+                return false;
+            }
+
+            ModuleDescriptor desc;
+            desc.Pid = 0;
+
+            state->readUnicodeString(ModuleEntry.driver_Name.Buffer, desc.Name, ModuleEntry.driver_Name.Length);
+            std::transform(desc.Name.begin(), desc.Name.end(), desc.Name.begin(), ::tolower);
+
+            desc.NativeBase = 0; // Image.GetImageBase();
+            desc.LoadBase = ModuleEntry.base;
+            snapshot->modules.push_back(desc);
+        }
+        snapshot->hasModules = true;
+    }
 
+    modules = snapshot->modules;
+    return true;
+}
+
+bool WindowsMonitor::getUserModules(S2EExecutionState *state, uint64_t pLdrData, ModuleDescriptorList &modules)
+{
+    uint64_t head = pLdrData + offsetof(windows::PEB_LDR_DATA32, InLoadOrderModuleList);
+    WindowsListSnapshot *snapshot = getListSnapshot(state, head);
+    if (!snapshot) {
+        return false;
+    }
+
+    if (!snapshot->hasModules) {
+        foreach2(it, snapshot->entries.begin(), snapshot->entries.end()) {
+            windows::LDR_DATA_TABLE_ENTRY32 LdrEntry;
+            uint64_t CurLib = CONTAINING_RECORD32(*it, windows::LDR_DATA_TABLE_ENTRY32, InLoadOrderLinks);
+            if (!state->readMemoryConcrete(CurLib, &LdrEntry, sizeof(LdrEntry))) {
+                s2e()->getWarningsStream(state) << "Could not read LDR_DATA_TABLE_ENTRY "
+                        << hexval(CurLib) << '\n';
+                snapshot->modules.clear();
+                return false;
+            }
+
+            std::string s;
+            state->readUnicodeString(LdrEntry.BaseDllName.Buffer, s, LdrEntry.BaseDllName.Length);
+            std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+
+            if (s.length() == 0) {
+                if (LdrEntry.DllBase == 0x7c900000) {
+                    //XXX
+                    s = "ntdll.dll";
+                }else {
+                    s = "<unnamed>";
+                }
+            }
+
+            ModuleDescriptor desc;
+            desc.Pid = state->getPid();
+            desc.Name = s;
+            desc.LoadBase = LdrEntry.DllBase;
+            desc.Size = LdrEntry.SizeOfImage;
+            snapshot->modules.push_back(desc);
+        }
+        snapshot->hasModules = true;
+    }
+
+    modules = snapshot->modules;
+    return true;
 }
 
 void WindowsMonitor::notifyLoadForAllThreads(S2EExecutionState *state)
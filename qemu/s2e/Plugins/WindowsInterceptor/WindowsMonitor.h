@@ -48,6 +48,7 @@
 #include <inttypes.h>
 #include <set>
 #include <map>
+#include <vector>
 
 
 namespace s2e {
@@ -59,6 +60,23 @@ class WindowsSpy;
 
 typedef std::set<uint64_t> PidSet;
 typedef std::map<std::string, uint64_t> ModuleSizeMap;
+typedef std::vector<ModuleDescriptor> ModuleDescriptorList;
+
+/** Cached walk of a guest linked list */
+struct WindowsListSnapshot
+{
+    /* Addresses of the LIST_ENTRY32 of each entry, head excluded */
+    std::vector<uint64_t> entries;
+
+    /* Host addresses of the pages that hold the links */
+    std::vector<uint64_t> pages;
+
+    /* Decoded entries, for the module lists */
+    bool hasModules;
+    ModuleDescriptorList modules;
+
+    WindowsListSnapshot(): hasModules(false) {}
+};
 
 class WindowsMonitor:public OSMonitor
 {
@@ -167,6 +185,9 @@ private:
     void slotKmThreadExit(S2EExecutionState *state, uint64_t pc);
 
     void notifyLoadForAllThreads(S2EExecutionState *state);
+
+    WindowsListSnapshot *getListSnapshot(S2EExecutionState *state, uint64_t head);
+
 public:
     WindowsMonitor(S2E* s2e): OSMonitor(s2e) {}
     virtual ~WindowsMonitor();
@@ -242,6 +263,19 @@ public:
 
     bool getAllProcesses(S2EExecutionState *state, std::vector<uint64_t> &pEProcess);
     bool getAllThreads(S2EExecutionState *state, uint64_t process, std::vector<uint64_t> &pEThread);
+
+    /**
+     *  Introspection cache. The entries of a guest LIST_ENTRY32 list are
+     *  walked once and reused until the guest writes one of the pages
+     *  that hold the links of the list.
+     */
+    bool getListEntries(S2EExecutionState *state, uint64_t head, std::vector<uint64_t> &entries);
+
+    /** Snapshot of PsLoadedModuleList */
+    bool getKernelModules(S2EExecutionState *state, ModuleDescriptorList &modules);
+
+    /** Snapshot of the InLoadOrderModuleList of the current process */
+    bool getUserModules(S2EExecutionState *state, uint64_t pLdrData, ModuleDescriptorList &modules);
 };
 
 class WindowsMonitorState:public PluginState
@@ -249,6 +283,10 @@ class WindowsMonitorState:public PluginState
 private:
     uint64_t m_CurrentPid;
 
+    /* Snapshots indexed by (address space, list head) */
+    typedef std::map<std::pair<uint64_t, uint64_t>, WindowsListSnapshot> ListSnapshots;
+    ListSnapshots m_lists;
+
 public:
     WindowsMonitorState();
     virtual ~WindowsMonitorState();
@@ -160,6 +160,42 @@ void X86FunctionMonitor::slotTraceRet(S2EExecutionState *state, int f)
 }
 #endif
 
+void X86CallDescriptorTable::grow()
+{
+    std::vector<Entry> old;
+    old.swap(m_entries);
+
+    Entry empty = { 0, 0, false, X86FunctionMonitor::CallSignal() };
+    m_entries.resize(old.empty() ? 16 : old.size() * 2, empty);
+    m_size = 0;
+
+    foreach2(it, old.begin(), old.end()) {
+        if ((*it).used) {
+            *insert((*it).eip, (*it).cr3) = (*it).signal;
+        }
+    }
+}
+
+void X86CallDescriptorTable::disconnect(const ModuleDescriptor &desc)
+{
+    std::vector<Entry> old;
+    old.swap(m_entries);
+
+    Entry empty = { 0, 0, false, X86FunctionMonitor::CallSignal() };
+    m_entries.resize(old.size(), empty);
+    m_size = 0;
+
+    foreach2(it, old.begin(), old.end()) {
+        if (!(*it).used) {
+            continue;
+        }
+        if (desc.Contains((*it).eip) && desc.Pid == (*it).cr3) {
+            continue;
+        }
+        *insert((*it).eip, (*it).cr3) = (*it).signal;
+    }
+}
+
 X86FunctionMonitorState::X86FunctionMonitorState()
 {
 
@@ -185,77 +221,82 @@ PluginState *X86FunctionMonitorState::factory(Plugin *p, S2EExecutionState *s)
     return ret;
 }
 
+/**
+ *  Returns a call descriptor table that is owned only by this state.
+ *  The table is copied the first time a state modifies it after a fork.
+ */
+X86CallDescriptorTable *X86FunctionMonitorState::getWritableCallDescriptors()
+{
+    if (!m_callDescriptors) {
+        m_callDescriptors.reset(new X86CallDescriptorTable());
+    } else if (!m_callDescriptors.unique()) {
+        m_callDescriptors.reset(new X86CallDescriptorTable(*m_callDescriptors));
+    }
+    return m_callDescriptors.get();
+}
+
 X86FunctionMonitor::CallSignal* X86FunctionMonitorState::getCallSignal(
         uint64_t eip, uint64_t cr3)
 {
-    std::pair<CallDescriptorsMap::iterator, CallDescriptorsMap::iterator>
-            range = m_callDescriptors.equal_range(eip);
-
-    for(CallDescriptorsMap::iterator it = range.first; it != range.second; ++it) {
-        if(it->second.cr3 == cr3)
-            return &it->second.signal;
+    /* Signals are shared handles, connecting to an existing one
+       does not require a private copy of the table */
+    if (m_callDescriptors) {
+        X86FunctionMonitor::CallSignal *signal = m_callDescriptors->find(eip, cr3);
+        if (signal) {
+            return signal;
+        }
     }
 
-
-    CallDescriptor descriptor = { cr3, X86FunctionMonitor::CallSignal() };
-    CallDescriptorsMap::iterator it =
-            m_newCallDescriptors.insert(std::make_pair(eip, descriptor));
-
-    return &it->second.signal;
+    return getWritableCallDescriptors()->insert(eip, cr3);
 }
 
 
 void X86FunctionMonitorState::slotCall(S2EExecutionState *state, uint64_t pc)
 {
+    if (!m_callDescriptors || m_callDescriptors->empty()) {
+        return;
+    }
+
     target_ulong cr3 = state->getPid();
     target_ulong eip = state->getPc();
 
-    if (!m_newCallDescriptors.empty()) {
-        m_callDescriptors.insert(m_newCallDescriptors.begin(), m_newCallDescriptors.end());
-        m_newCallDescriptors.clear();
+    if (m_plugin->m_monitor) {
+        cr3 = m_plugin->m_monitor->getPid(state, pc);
     }
 
-    /* Issue signals attached to all calls (eip==-1 means catch-all) */
-    if (!m_callDescriptors.empty()) {
-        std::pair<CallDescriptorsMap::iterator, CallDescriptorsMap::iterator>
-                range = m_callDescriptors.equal_range((uint64_t)-1);
-        for(CallDescriptorsMap::iterator it = range.first; it != range.second; ++it) {
-            CallDescriptor cd = (*it).second;
-            if (m_plugin->m_monitor) {
-                cr3 = m_plugin->m_monitor->getPid(state, pc);
-            }
-            if(it->second.cr3 == (uint64_t)-1 || it->second.cr3 == cr3) {
-                cd.signal.emit(state, this);
-            }
-        }
-        if (!m_newCallDescriptors.empty()) {
-            m_callDescriptors.insert(m_newCallDescriptors.begin(), m_newCallDescriptors.end());
-            m_newCallDescriptors.clear();
+    /* Handlers may register or remove descriptors while we emit,
+       keep the table alive and copy the signals out first. */
+    CallDescriptorTablePtr table = m_callDescriptors;
+    X86FunctionMonitor::CallSignal *found[4] = {
+        /* Signals attached to all calls (eip==-1 means catch-all) */
+        table->find((uint64_t)-1, (uint64_t)-1),
+        table->find((uint64_t)-1, cr3),
+
+        /* Signals attached to specific calls */
+        table->find(eip, (uint64_t)-1),
+        table->find(eip, cr3)
+    };
+
+    X86FunctionMonitor::CallSignal signals[4];
+    unsigned count = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+        /* Avoid emitting twice when cr3 happens to be -1 */
+        if (found[i] && (i % 2 == 0 || found[i] != found[i - 1])) {
+            signals[count++] = *found[i];
         }
     }
 
-    /* Issue signals attached to specific calls */
-    if (!m_callDescriptors.empty()) {
-        std::pair<CallDescriptorsMap::iterator, CallDescriptorsMap::iterator>
-                range;
-
-        range = m_callDescriptors.equal_range(eip);
-        for(CallDescriptorsMap::iterator it = range.first; it != range.second; ++it) {
-            CallDescriptor cd = (*it).second;
-            if (m_plugin->m_monitor) {
-                cr3 = m_plugin->m_monitor->getPid(state, pc);
-            }
-            if(it->second.cr3 == (uint64_t)-1 || it->second.cr3 == cr3) {
-                cd.signal.emit(state, this);
-            }
-        }
-        if (!m_newCallDescriptors.empty()) {
-            m_callDescriptors.insert(m_newCallDescriptors.begin(), m_newCallDescriptors.end());
-            m_newCallDescriptors.clear();
-        }
+    for (unsigned i = 0; i < count; ++i) {
+        signals[i].emit(state, this);
     }
 }
 
+static bool returnDescriptorCompare(uint64_t esp1, uint64_t esp2)
+{
+    /* The stack grows down, the innermost return is at the back */
+    return esp1 > esp2;
+}
+
 /**
  *  A call handler can invoke this function to register a return handler.
  *  XXX: We assume that the passed execution state corresponds to the state in which
@@ -282,8 +323,15 @@ void X86FunctionMonitorState::registerReturnSignal(S2EExecutionState *state, X86
     if (m_plugin->m_monitor) {
         pid = m_plugin->m_monitor->getPid(state, state->getPc());
     }
-    ReturnDescriptor descriptor = {pid, sig };
-    m_returnDescriptors.insert(std::make_pair(esp, descriptor));
+    ReturnDescriptor descriptor = {esp, pid, sig };
+
+    /* Usually a push to the back, keep insertion order for equal esp */
+    ReturnDescriptors::iterator it = m_returnDescriptors.end();
+    while (it != m_returnDescriptors.begin() &&
+           returnDescriptorCompare(esp, (*(it - 1)).esp)) {
+        --it;
+    }
+    m_returnDescriptors.insert(it, descriptor);
 }
 
 /**
@@ -315,24 +363,38 @@ void X86FunctionMonitorState::slotRet(S2EExecutionState *state, uint64_t pc, boo
         return;
     }
 
+    if (m_plugin->m_monitor) {
+        cr3 = m_plugin->m_monitor->getPid(state, pc);
+    }
+
     //m_plugin->s2e()->getDebugStream() << "ESP AT RETURN 0x" << std::hex << esp <<
     //        " plgstate=0x" << this << " EmitSignal=" << emitSignal <<  std::endl;
 
     bool finished = true;
     do {
         finished = true;
-        std::pair<ReturnDescriptorsMap::iterator, ReturnDescriptorsMap::iterator>
-                range = m_returnDescriptors.equal_range(esp);
-        for(ReturnDescriptorsMap::iterator it = range.first; it != range.second; ++it) {
-            if (m_plugin->m_monitor) {
-                cr3 = m_plugin->m_monitor->getPid(state, pc);
+
+        /* Binary search for the first descriptor registered at esp */
+        ReturnDescriptors::iterator lo = m_returnDescriptors.begin();
+        ReturnDescriptors::iterator hi = m_returnDescriptors.end();
+        while (lo < hi) {
+            ReturnDescriptors::iterator mid = lo + (hi - lo) / 2;
+            if (returnDescriptorCompare((*mid).esp, esp)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
             }
+        }
 
-            if(it->second.cr3 == cr3) {
+        for (ReturnDescriptors::iterator it = lo;
+             it != m_returnDescriptors.end() && (*it).esp == esp; ++it) {
+            if ((*it).cr3 == cr3) {
+                /* Erase first, the handler may modify the descriptors */
+                X86FunctionMonitor::ReturnSignal signal = (*it).signal;
+                m_returnDescriptors.erase(it);
                 if (emitSignal) {
-                    it->second.signal.emit(state);
+                    signal.emit(state);
                 }
-                m_returnDescriptors.erase(it);
                 finished = false;
                 break;
             }
@@ -340,29 +402,13 @@ void X86FunctionMonitorState::slotRet(S2EExecutionState *state, uint64_t pc, boo
     } while(!finished);
 }
 
-void X86FunctionMonitorState::disconnect(const ModuleDescriptor &desc, CallDescriptorsMap &descMap)
-{
-    CallDescriptorsMap::iterator it = descMap.begin();
-    while (it != descMap.end()) {
-        uint64_t addr = (*it).first;
-        const CallDescriptor &call = (*it).second;
-        if (desc.Contains(addr) && desc.Pid == call.cr3) {
-            CallDescriptorsMap::iterator it2 = it;
-            ++it;
-            descMap.erase(it2);
-        }else {
-            ++it;
-        }
-    }
-}
-
 //Disconnect all address that belong to desc.
 //This is useful to unregister all handlers when a module is unloaded
 void X86FunctionMonitorState::disconnect(const ModuleDescriptor &desc)
 {
-
-    disconnect(desc, m_callDescriptors);
-    disconnect(desc, m_newCallDescriptors);
+    if (m_callDescriptors) {
+        getWritableCallDescriptors()->disconnect(desc);
+    }
 
     //XXX: we assume there are no more return descriptors active when the module is unloaded
 }
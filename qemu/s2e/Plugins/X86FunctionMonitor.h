@@ -41,7 +41,8 @@
 #include <s2e/S2EExecutionState.h>
 #include <s2e/Plugins/OSMonitor.h>
 
-#include <tr1/unordered_map>
+#include <tr1/memory>
+#include <vector>
 
 namespace s2e {
 namespace plugins {
@@ -90,30 +91,99 @@ protected:
 
 };
 
-class X86FunctionMonitorState : public PluginState
+/**
+ * Open-addressing hash table of call descriptors keyed by (callee pc, pid).
+ * Entries are never removed individually, the table is rebuilt instead
+ * when a module is unloaded.
+ */
+class X86CallDescriptorTable
 {
-
-    struct CallDescriptor {
+public:
+    struct Entry {
+        uint64_t eip;
         uint64_t cr3;
-        // TODO: add sourceModuleID and targetModuleID
+        bool used;
         X86FunctionMonitor::CallSignal signal;
     };
 
+    X86CallDescriptorTable(): m_size(0) {}
+
+    X86FunctionMonitor::CallSignal *find(uint64_t eip, uint64_t cr3) {
+        if (m_entries.empty()) {
+            return NULL;
+        }
+
+        unsigned mask = m_entries.size() - 1;
+        for (unsigned i = hash(eip, cr3) & mask; m_entries[i].used; i = (i + 1) & mask) {
+            if (m_entries[i].eip == eip && m_entries[i].cr3 == cr3) {
+                return &m_entries[i].signal;
+            }
+        }
+        return NULL;
+    }
+
+    X86FunctionMonitor::CallSignal *insert(uint64_t eip, uint64_t cr3) {
+        if ((m_size + 1) * 2 > m_entries.size()) {
+            grow();
+        }
+
+        unsigned mask = m_entries.size() - 1;
+        unsigned i = hash(eip, cr3) & mask;
+        while (m_entries[i].used) {
+            i = (i + 1) & mask;
+        }
+
+        m_entries[i].eip = eip;
+        m_entries[i].cr3 = cr3;
+        m_entries[i].used = true;
+        ++m_size;
+        return &m_entries[i].signal;
+    }
+
+    /** Removes the descriptors of the functions located in the module */
+    void disconnect(const ModuleDescriptor &desc);
+
+    bool empty() const {
+        return m_size == 0;
+    }
+
+private:
+    std::vector<Entry> m_entries;
+    unsigned m_size;
+
+    static unsigned hash(uint64_t eip, uint64_t cr3) {
+        uint64_t h = (eip ^ (cr3 * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+        return (unsigned) (h >> 32);
+    }
+
+    void grow();
+};
+
+class X86FunctionMonitorState : public PluginState
+{
+    /* Return handlers are registered at the stack pointer of the call */
     struct ReturnDescriptor {
-        //S2EExecutionState *state;
+        uint64_t esp;
         uint64_t cr3;
         // TODO: add sourceModuleID and targetModuleID
         X86FunctionMonitor::ReturnSignal signal;
     };
-    typedef std::tr1::unordered_multimap<uint64_t, CallDescriptor> CallDescriptorsMap;
-    typedef std::tr1::unordered_multimap<uint64_t, ReturnDescriptor> ReturnDescriptorsMap;
 
-    CallDescriptorsMap m_callDescriptors;
-    CallDescriptorsMap m_newCallDescriptors;
-    ReturnDescriptorsMap m_returnDescriptors;
+    /* The call descriptors rarely change, forked states share them
+       until one of them registers or removes a descriptor. */
+    typedef std::tr1::shared_ptr<X86CallDescriptorTable> CallDescriptorTablePtr;
+
+    /* Pending returns sorted by decreasing stack pointer. Nested calls
+       push at the back, so this behaves like a stack. */
+    typedef std::vector<ReturnDescriptor> ReturnDescriptors;
+
+    CallDescriptorTablePtr m_callDescriptors;
+    ReturnDescriptors m_returnDescriptors;
 
     X86FunctionMonitor *m_plugin;
 
+    X86CallDescriptorTable *getWritableCallDescriptors();
+
     /* Get a signal that is emitted on function calls. Passing eip = 0 means
        any function, and cr3 = 0 means any cr3 */
     X86FunctionMonitor::CallSignal* getCallSignal(uint64_t eip, uint64_t cr3 = 0);
@@ -121,11 +191,8 @@ class X86FunctionMonitorState : public PluginState
     void slotCall(S2EExecutionState *state, uint64_t pc);
     void slotRet(S2EExecutionState *state, uint64_t pc, bool emitSignal);
 
-    void disconnect(const ModuleDescriptor &desc, CallDescriptorsMap &descMap);
     void disconnect(const ModuleDescriptor &desc);
 
-    bool exists(const CallDescriptorsMap &cdm,
-                uint64_t eip, uint64_t cr3) const;
 public:
     X86FunctionMonitorState();
     virtual ~X86FunctionMonitorState();
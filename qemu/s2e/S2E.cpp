@@ -52,6 +52,8 @@ extern CPUArchState *env;
 #include <s2e/Utils.h>
 #include <s2e/S2EExecutor.h>
 #include <s2e/S2EExecutionState.h>
+#include <s2e/Coordinator.h>
+#include <s2e/AsyncStream.h>
 
 #include <s2e/s2e_qemu.h>
 #include <llvm/Support/FileSystem.h>
@@ -71,6 +73,7 @@ extern CPUArchState *env;
 #include <iostream>
 #include <sstream>
 #include <deque>
+#include <algorithm>
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
@@ -82,6 +85,10 @@ extern CPUArchState *env;
 
 #ifndef _WIN32
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
 #include <unistd.h>
 #endif
 
@@ -214,12 +221,17 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
     m_startTimeSeconds = llvm::sys::TimeValue::now().seconds();
 
     m_forking = false;
+    m_coordinator = NULL;
+
+    m_logLevel = LOG_DEBUG;
+    m_asyncLogging = false;
 
     m_maxProcesses = s2e_max_processes;
     m_currentProcessIndex = 0;
     m_currentProcessId = 0;
     S2EShared *shared = m_sync.acquire();
     shared->currentProcessCount = 1;
+    shared->processLimit = s2e_max_processes;
     shared->lastStateId = 0;
     shared->lastFileId = 1;
     shared->processIds[m_currentProcessId] = m_currentProcessIndex;
@@ -255,6 +267,12 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
     /* Parse configuration file */
     m_configFile = new s2e::ConfigFile(configFileName);
 
+    /* Apply the logging options */
+    initLogging();
+
+    /* Connect to the cluster coordinator, if any */
+    initCoordinator();
+
     /* Initialize KLEE command line options */
     initKleeOptions();
 
@@ -293,10 +311,17 @@ S2E::~S2E()
     assert(shared->processIds[m_currentProcessId] == m_currentProcessIndex);
     shared->processIds[m_currentProcessId] = (unsigned) -1;
     shared->processPids[m_currentProcessId] = (unsigned) -1;
+    shared->processLoads[m_currentProcessId] = 0;
+    memset(&shared->processMetrics[m_currentProcessId], 0, sizeof(S2EProcessMetrics));
     --shared->currentProcessCount;
 
     m_sync.release();
 
+    if (m_coordinator) {
+        m_coordinator->unregisterInstance();
+        delete m_coordinator;
+    }
+
     delete m_pluginsFactory;
     writeBitCodeToFile();
 
@@ -358,6 +383,28 @@ llvm::raw_ostream* S2E::openOutputFile(const std::string &fileName)
     return f;
 }
 
+void S2E::initCoordinator()
+{
+    bool ok;
+    std::string address = m_configFile->getString("s2e.coordinator", "", &ok);
+    if (!ok || address.empty()) {
+        return;
+    }
+
+    m_coordinator = S2ECoordinator::create(address);
+    if (!m_coordinator) {
+        std::cerr << "Invalid coordinator address " << address << '\n';
+        exit(1);
+    }
+
+    if (!m_coordinator->registerInstance(getpid())) {
+        std::cerr << "Could not register with coordinator " << address << '\n';
+        exit(1);
+    }
+
+    std::cout << "S2E: using coordinator " << address << '\n';
+}
+
 void S2E::initOutputDirectory(const string& outputDirectory, int verbose, bool forked)
 {
     if (!forked) {
@@ -446,27 +493,7 @@ void S2E::initOutputDirectory(const string& outputDirectory, int verbose, bool f
     cout.setf(ios_base::unitbuf);
     cerr.setf(ios_base::unitbuf);
 
-    m_infoFileRaw = openOutputFile("info.txt");
-    m_debugFileRaw = openOutputFile("debug.txt");
-    m_messagesFileRaw = openOutputFile("messages.txt");
-    m_warningsFileRaw = openOutputFile("warnings.txt");
-
-    // Messages appear in messages.txt, debug.txt and on stdout
-    raw_tee_ostream *messageStream = new raw_tee_ostream(m_messagesFileRaw);
-    messageStream->addParentBuf(m_debugFileRaw);
-    if (verbose) {
-        messageStream->addParentBuf(&llvm::outs());
-    }
-    m_messageStream = messageStream;
-
-    // Warnings appear in warnings.txt, messages.txt, debug.txt
-    // and on stderr in red color
-    raw_tee_ostream *warningsStream = new raw_tee_ostream(m_warningsFileRaw);
-    warningsStream->addParentBuf(m_debugFileRaw);
-    warningsStream->addParentBuf(m_messagesFileRaw);
-    warningsStream->addParentBuf(new raw_highlight_ostream(&llvm::errs()));
-    m_warningStream = warningsStream;
-
+    initLogStreams(verbose, false);
 
 #if 0
     // Messages appear in messages.txt, debug.txt and on stdout
@@ -491,10 +518,100 @@ void S2E::initOutputDirectory(const string& outputDirectory, int verbose, bool f
     m_warningsFile->setf(ios_base::unitbuf);
 #endif
 
+}
+
+llvm::raw_ostream* S2E::openLogFile(const std::string &fileName, bool append)
+{
+#ifndef CONFIG_WIN32
+    if (m_asyncLogging) {
+        std::string path = getOutputFilename(fileName);
+        std::string error;
+        raw_async_fd_ostream *f = new raw_async_fd_ostream(path.c_str(), append, error);
+
+        if (error.size() > 0) {
+            llvm::errs() << "Error opening " << path << ": " << error << "\n";
+            exit(-1);
+        }
+
+        m_asyncStreams.push_back(f);
+        return f;
+    }
+#endif
+
+    assert(!append && "Synchronous logs are only created once");
+    return openOutputFile(fileName);
+}
+
+void S2E::initLogStreams(int verbose, bool append)
+{
+    m_verbose = verbose;
+
+    //The streams of a parent process, if any, are owned by the parent
+    m_asyncStreams.clear();
+
+    m_infoFileRaw = openLogFile("info.txt", append);
+    m_debugFileRaw = openLogFile("debug.txt", append);
+    m_messagesFileRaw = openLogFile("messages.txt", append);
+    m_warningsFileRaw = openLogFile("warnings.txt", append);
+
+    // Messages appear in messages.txt, debug.txt and on stdout
+    raw_tee_ostream *messageStream = new raw_tee_ostream(m_messagesFileRaw);
+    messageStream->addParentBuf(m_debugFileRaw);
+    if (verbose) {
+        messageStream->addParentBuf(&llvm::outs());
+    }
+    m_messageStream = messageStream;
+
+    // Warnings appear in warnings.txt, messages.txt, debug.txt
+    // and on stderr in red color
+    raw_tee_ostream *warningsStream = new raw_tee_ostream(m_warningsFileRaw);
+    warningsStream->addParentBuf(m_debugFileRaw);
+    warningsStream->addParentBuf(m_messagesFileRaw);
+    warningsStream->addParentBuf(new raw_highlight_ostream(&llvm::errs()));
+    m_warningStream = warningsStream;
+
     klee::klee_message_stream = m_messageStream;
     klee::klee_warning_stream = m_warningStream;
 }
 
+void S2E::initLogging()
+{
+    bool ok;
+    std::string level = m_configFile->getString("s2e.logging.level", "debug", &ok);
+
+    if (level == "debug") {
+        m_logLevel = LOG_DEBUG;
+    } else if (level == "messages") {
+        m_logLevel = LOG_MESSAGES;
+    } else if (level == "warnings") {
+        m_logLevel = LOG_WARNINGS;
+    } else {
+        std::cerr << "Invalid s2e.logging.level " << level
+                  << ", expected debug, messages or warnings" << '\n';
+        exit(-1);
+    }
+
+    //Queued lines are lost if S2E crashes, keep the logs synchronous by default
+    bool async = m_configFile->getBool("s2e.logging.async", false, &ok);
+#ifdef CONFIG_WIN32
+    async = false;
+#endif
+    if (!async) {
+        return;
+    }
+
+    //Reopen the logs created by initOutputDirectory behind writer threads
+    delete m_warningStream;
+    delete m_messageStream;
+    delete m_infoFileRaw;
+    delete m_warningsFileRaw;
+    delete m_messagesFileRaw;
+    delete m_debugFileRaw;
+
+    m_asyncLogging = true;
+    initLogStreams(m_verbose, true);
+}
+
 void S2E::initKleeOptions()
 {
     std::vector<std::string> kleeOptions = getConfig()->getStringList("s2e.kleeArgs");
@@ -577,6 +694,11 @@ void S2E::initPlugins()
         }
     }
 
+    /* Plugin states are stored in an array indexed by plugin */
+    for (unsigned i = 0; i < m_activePluginsList.size(); ++i) {
+        m_activePluginsList[i]->m_pluginIndex = i;
+    }
+
     /* Initialize plugins */
     foreach(Plugin* p, m_activePluginsList) {
         p->initialize();
@@ -593,6 +715,10 @@ void S2E::initExecutor()
 llvm::raw_ostream& S2E::getStream(llvm::raw_ostream &stream,
                              const S2EExecutionState* state) const
 {
+    if (&stream == &llvm::nulls()) {
+        return stream;
+    }
+
     fflush(stdout);
     fflush(stderr);
 
@@ -629,14 +755,14 @@ void S2E::refreshPlugins()
     }
 }
 
-int S2E::fork()
+int S2E::fork(const std::string &outputDirectory, int *childPid)
 {
 #ifdef CONFIG_WIN32
     return -1;
 #else
 
     S2EShared *shared = m_sync.acquire();
-    if (shared->currentProcessCount == m_maxProcesses) {
+    if (shared->currentProcessCount >= shared->processLimit) {
         m_sync.release();
         return -1;
     }
@@ -645,9 +771,25 @@ int S2E::fork()
     ++shared->lastFileId;
     ++shared->currentProcessCount;
 
+    if (m_coordinator) {
+        newProcessIndex = m_coordinator->fetchAndIncrementFileId();
+    }
+
     m_sync.release();
 
+    //The writer threads do not survive the fork
+    foreach2(it, m_asyncStreams.begin(), m_asyncStreams.end()) {
+        (*it)->stop();
+    }
+
     pid_t pid = ::fork();
+
+    if (pid != 0) {
+        foreach2(it, m_asyncStreams.begin(), m_asyncStreams.end()) {
+            (*it)->start();
+        }
+    }
+
     if (pid < 0) {
         //Fork failed
 
@@ -668,6 +810,7 @@ int S2E::fork()
             if (shared->processIds[i] == (unsigned)-1) {
                 shared->processIds[i] = newProcessIndex;
                 shared->processPids[i] = getpid();
+                shared->processLoads[i] = 0;
                 m_currentProcessId = i;
                 break;
             }
@@ -676,7 +819,18 @@ int S2E::fork()
         m_sync.release();
 
         m_currentProcessIndex = newProcessIndex;
+
+        if (m_coordinator) {
+            if (!m_coordinator->reconnect() || !m_coordinator->registerInstance(getpid())) {
+                fprintf(stderr, "Could not register with the coordinator\n");
+                exit(1);
+            }
+        }
+
         //We are the child process, setup the log files again
+        if (!outputDirectory.empty()) {
+            m_outputDirectoryBase = outputDirectory;
+        }
         initOutputDirectory(m_outputDirectoryBase, 0, true);
         //Also recreate new statistics files
         m_s2eExecutor->initializeStatistics();
@@ -705,14 +859,191 @@ int S2E::fork()
         vm_stop(RUN_STATE_SAVE_VM);
 
         m_forking = false;
+    } else if (childPid) {
+        *childPid = pid;
     }
 
     return pid == 0 ? 1 : 0;
 #endif
 }
 
+#ifndef CONFIG_WIN32
+static bool readRequest(int fd, std::string &request)
+{
+    char c;
+    request.clear();
+    while (::read(fd, &c, 1) == 1) {
+        if (c == '\n') {
+            return true;
+        }
+        request += c;
+    }
+    return !request.empty();
+}
+
+static void writeReply(int fd, const std::string &reply)
+{
+    std::string line = reply + '\n';
+    if (::write(fd, line.c_str(), line.size()) < 0) {
+        //The client went away, the job runs anyway
+    }
+}
+#endif
+
+/**
+ *  Server mode. The process keeps the state prepared by the initialization
+ *  (plugins, LLVM helpers, snapshot) and forks one child per job,
+ *  which inherits all of it copy-on-write.
+ *
+ *  Each connection to the Unix socket sends one request line:
+ *      <output directory> [<lua file>]
+ *  The Lua file is run on top of the configuration of the child, before
+ *  the guest resumes. The server replies "started <pid>", then
+ *  "exited <status>" once the job terminates. "quit" stops the server
+ *  when the running jobs are done.
+ *
+ *  The server occupies one of the -s2e-max-processes slots, the requests
+ *  wait until a slot is free. Returns only in the job processes.
+ */
+void S2E::runServer(const std::string &socketPath)
+{
+#ifdef CONFIG_WIN32
+    std::cerr << "S2E server mode is not supported on Windows" << '\n';
+    exit(-1);
+#else
+    if (m_maxProcesses < 2) {
+        std::cerr << "S2E server mode requires -s2e-max-processes of at least 2" << '\n';
+        exit(-1);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(socketPath.c_str());
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        perror("ERROR: Cannot open the S2E server socket");
+        exit(-1);
+    }
+
+    getMessagesStream() << "S2E: serving jobs on " << socketPath << '\n';
+
+    typedef std::map<int, int> RunningJobs;
+    typedef std::deque<std::pair<int, std::string> > PendingJobs;
+    RunningJobs running; //pid to connection
+    PendingJobs pending;
+    bool quit = false;
+
+    while (!quit || !running.empty() || !pending.empty()) {
+        //Report the jobs that terminated
+        int status, pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            RunningJobs::iterator it = running.find(pid);
+            if (it == running.end()) {
+                continue;
+            }
+
+            std::stringstream ss;
+            ss << "exited " << (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            writeReply((*it).second, ss.str());
+            close((*it).second);
+            running.erase(it);
+
+            //Crashed jobs did not release their slot
+            if (!WIFEXITED(status)) {
+                checkDeadProcesses();
+            }
+        }
+
+        //Start the queued jobs while slots are available
+        while (!pending.empty()) {
+            int fd = pending.front().first;
+            std::stringstream request(pending.front().second);
+            std::string outputDirectory, luaFile;
+            request >> outputDirectory >> luaFile;
+
+            int childPid = -1;
+            int ret = fork(outputDirectory, &childPid);
+            if (ret < 0) {
+                break;
+            }
+
+            if (ret == 1) {
+                close(sock);
+                close(fd);
+                foreach2(it, running.begin(), running.end()) {
+                    close((*it).second);
+                }
+                pending.pop_front();
+                foreach2(it, pending.begin(), pending.end()) {
+                    close((*it).first);
+                }
+
+                if (!luaFile.empty()) {
+                    if (!getConfig()->loadFile(luaFile)) {
+                        exit(-1);
+                    }
+
+                    std::ifstream in(luaFile.c_str());
+                    llvm::raw_ostream *out = openOutputFile("s2e.job.lua");
+                    char c;
+                    while (in.get(c)) {
+                        (*out) << c;
+                    }
+                    delete out;
+                }
+                return;
+            }
+
+            std::stringstream ss;
+            ss << "started " << childPid;
+            writeReply(fd, ss.str());
+            running[childPid] = fd;
+            pending.pop_front();
+        }
+
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        if (quit || poll(&pfd, 1, 100) <= 0) {
+            if (quit) {
+                usleep(100000);
+            }
+            continue;
+        }
+
+        int fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+
+        std::string request;
+        if (!readRequest(fd, request) || request.empty()) {
+            close(fd);
+        } else if (request == "quit") {
+            writeReply(fd, "bye");
+            close(fd);
+            quit = true;
+        } else {
+            pending.push_back(std::make_pair(fd, request));
+        }
+    }
+
+    close(sock);
+    unlink(socketPath.c_str());
+    getMessagesStream() << "S2E: server stopped" << '\n';
+    exit(0);
+#endif
+}
+
 unsigned S2E::fetchAndIncrementStateId()
 {
+    if (m_coordinator) {
+        return m_coordinator->fetchAndIncrementStateId();
+    }
+
     S2EShared *shared = m_sync.acquire();
     unsigned ret = shared->lastStateId;
     ++shared->lastStateId;
@@ -721,6 +1052,10 @@ unsigned S2E::fetchAndIncrementStateId()
 }
 unsigned S2E::fetchNextStateId()
 {
+    if (m_coordinator) {
+        return m_coordinator->fetchNextStateId();
+    }
+
     S2EShared *shared = m_sync.acquire();
     unsigned ret = shared->lastStateId;
     m_sync.release();
@@ -735,6 +1070,14 @@ unsigned S2E::getCurrentProcessCount()
     return ret;
 }
 
+unsigned S2E::getClusterProcessCount()
+{
+    if (m_coordinator) {
+        return m_coordinator->getInstanceCount();
+    }
+    return getCurrentProcessCount();
+}
+
 unsigned S2E::getProcessIndexForId(unsigned id)
 {
     assert(id < m_maxProcesses);
@@ -744,6 +1087,25 @@ unsigned S2E::getProcessIndexForId(unsigned id)
     return ret;
 }
 
+unsigned S2E::getProcessLimit()
+{
+    S2EShared *shared = m_sync.acquire();
+    unsigned ret = shared->processLimit;
+    m_sync.release();
+    return ret;
+}
+
+void S2E::setProcessLimit(unsigned limit)
+{
+    //Running instances are not stopped when the limit goes down,
+    //they just cannot be replaced when they exit
+    limit = std::max(1u, std::min(limit, m_maxProcesses));
+
+    S2EShared *shared = m_sync.acquire();
+    shared->processLimit = limit;
+    m_sync.release();
+}
+
 bool S2E::checkDeadProcesses()
 {
     S2EShared *shared = m_sync.acquire();
@@ -761,6 +1123,8 @@ bool S2E::checkDeadProcesses()
             //Process is dead, we have to decrement everything
             shared->processIds[i] = (unsigned) -1;
             shared->processPids[i] = (unsigned) -1;
+            shared->processLoads[i] = 0;
+            memset(&shared->processMetrics[i], 0, sizeof(S2EProcessMetrics));
             --shared->currentProcessCount;
             ret = true;
         }
@@ -770,6 +1134,74 @@ bool S2E::checkDeadProcesses()
     return ret;
 }
 
+void S2E::setCurrentProcessLoad(unsigned load)
+{
+    S2EShared *shared = m_sync.acquire();
+    shared->processLoads[m_currentProcessId] = load;
+    m_sync.release();
+}
+
+bool S2E::isBusiestProcess()
+{
+    S2EShared *shared = m_sync.acquire();
+    unsigned myLoad = shared->processLoads[m_currentProcessId];
+    bool ret = true;
+    for (unsigned i=0; i<m_maxProcesses; ++i) {
+        if (i == m_currentProcessId || shared->processIds[i] == (unsigned)-1) {
+            continue;
+        }
+
+        //Ties are broken in favor of the lowest slot, so that
+        //only one instance forks when a slot becomes free.
+        unsigned load = shared->processLoads[i];
+        if (load > myLoad || (load == myLoad && i < m_currentProcessId)) {
+            ret = false;
+            break;
+        }
+    }
+    m_sync.release();
+    return ret;
+}
+
+void S2E::setCurrentProcessMetrics(const S2EProcessMetrics &metrics)
+{
+    S2EProcessMetrics *m = &m_sync.get()->processMetrics[m_currentProcessId];
+    AtomicFunctions::write(&m->states, metrics.states);
+    AtomicFunctions::write(&m->forks, metrics.forks);
+    AtomicFunctions::write(&m->instructions, metrics.instructions);
+    AtomicFunctions::write(&m->translationBlocks, metrics.translationBlocks);
+    AtomicFunctions::write(&m->solverTime, metrics.solverTime);
+    AtomicFunctions::write(&m->memoryUsage, metrics.memoryUsage);
+
+    //Written last, readers use it to tell a stalled instance
+    AtomicFunctions::write(&m->updateTime, metrics.updateTime);
+}
+
+void S2E::getProcessMetrics(std::map<unsigned, S2EProcessMetrics> &metrics)
+{
+    metrics.clear();
+
+    //Monitoring must not wait for the instances, hence no lock.
+    //An instance that just exited may show up with zero counters.
+    S2EShared *shared = m_sync.get();
+    for (unsigned i=0; i<m_maxProcesses; ++i) {
+        unsigned index = *(volatile unsigned*) &shared->processIds[i];
+        if (index == (unsigned) -1) {
+            continue;
+        }
+
+        S2EProcessMetrics *m = &shared->processMetrics[i];
+        S2EProcessMetrics &out = metrics[index];
+        out.updateTime = AtomicFunctions::read(&m->updateTime);
+        out.states = AtomicFunctions::read(&m->states);
+        out.forks = AtomicFunctions::read(&m->forks);
+        out.instructions = AtomicFunctions::read(&m->instructions);
+        out.translationBlocks = AtomicFunctions::read(&m->translationBlocks);
+        out.solverTime = AtomicFunctions::read(&m->solverTime);
+        out.memoryUsage = AtomicFunctions::read(&m->memoryUsage);
+    }
+}
+
 } // namespace s2e
 
 /******************************/
@@ -799,6 +1231,11 @@ void s2e_close(S2E *s2e)
     tcg_llvm_ctx = NULL;
 }
 
+void s2e_run_server(S2E *s2e, const char *socket_path)
+{
+    s2e->runServer(socket_path);
+}
+
 int s2e_is_forking()
 {
     return g_s2e->isForking();
@@ -43,6 +43,7 @@
 #include <vector>
 //#include <tr1/unordered_map>
 #include <map>
+#include <string.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include "s2e_config.h"
@@ -68,10 +69,27 @@ class S2EExecutor;
 class S2EExecutionState;
 
 class Database;
+class S2ECoordinator;
+class raw_async_fd_ostream;
+
+//Counters that each instance publishes for monitoring.
+//Written and read with AtomicFunctions, without taking the lock.
+struct S2EProcessMetrics {
+    uint64_t updateTime; //seconds since the epoch
+    uint64_t states;
+    uint64_t forks;
+    uint64_t instructions;
+    uint64_t translationBlocks;
+    uint64_t solverTime; //microseconds
+    uint64_t memoryUsage; //resident bytes
+};
 
 //Structure used for synchronization among multiple instances of S2E
 struct S2EShared {
     unsigned currentProcessCount;
+    //Number of instances allowed to run at the same time.
+    //At most -s2e-max-processes, lowered by the autoscaler.
+    unsigned processLimit;
     unsigned lastFileId;
     //We must have unique state ids across all processes
     //otherwise offline tools will be extremely confused when
@@ -83,11 +101,21 @@ struct S2EShared {
     //the instance index.
     unsigned processIds[S2E_MAX_PROCESSES];
     unsigned processPids[S2E_MAX_PROCESSES];
+
+    //Number of pending states in each running instance.
+    //Used by the load balancer to pick the instance that has
+    //to give away work when another instance terminates.
+    unsigned processLoads[S2E_MAX_PROCESSES];
+
+    S2EProcessMetrics processMetrics[S2E_MAX_PROCESSES];
+
     S2EShared() {
         for (unsigned i=0; i<S2E_MAX_PROCESSES; ++i)    {
             processIds[i] = (unsigned)-1;
             processPids[i] = (unsigned)-1;
+            processLoads[i] = 0;
         }
+        memset(processMetrics, 0, sizeof(processMetrics));
     }
 };
 
@@ -95,6 +123,11 @@ class S2E
 {
 protected:
     S2ESynchronizedObject<S2EShared> m_sync;
+
+    /* Optional cluster-wide coordination backend.
+       m_sync is used when it is not set. */
+    S2ECoordinator* m_coordinator;
+
     ConfigFile* m_configFile;
     PluginsFactory* m_pluginsFactory;
 
@@ -114,6 +147,19 @@ protected:
     llvm::raw_ostream*   m_messageStream;
     llvm::raw_ostream*   m_warningStream;
 
+public:
+    /* Lowest priority of the lines that are written to the logs */
+    enum LogLevel {
+        LOG_DEBUG, LOG_MESSAGES, LOG_WARNINGS
+    };
+
+protected:
+    LogLevel m_logLevel;
+    int m_verbose;
+
+    /* The log files are written by background threads */
+    bool m_asyncLogging;
+    std::vector<raw_async_fd_ostream*> m_asyncStreams;
 
     TCGLLVMContext *m_tcgLLVMContext;
 
@@ -139,7 +185,12 @@ protected:
     /* forked indicates whether the current S2E process was forked from a parent S2E process */
     void initOutputDirectory(const std::string& outputDirectory, int verbose, bool forked);
 
+    llvm::raw_ostream* openLogFile(const std::string &fileName, bool append);
+    void initLogStreams(int verbose, bool append);
+    void initLogging();
+
     void initKleeOptions();
+    void initCoordinator();
     void initExecutor();
     void initPlugins();
 
@@ -165,6 +216,9 @@ public:
     /** Get plugin by name of functionName */
     Plugin* getPlugin(const std::string& name) const;
 
+    /** Active plugins, by plugin index */
+    const std::vector<Plugin*> &getActivePlugins() const { return m_activePluginsList; }
+
     /** Get Core plugin */
     inline CorePlugin* getCorePlugin() const { return m_corePlugin; }
 
@@ -175,6 +229,9 @@ public:
     /** Get output directory name */
     const std::string& getOutputDirectory() const { return m_outputDirectory; }
 
+    /** Get the output directory shared by all S2E processes */
+    const std::string& getOutputDirectoryBase() const { return m_outputDirectoryBase; }
+
     /** Get a filename inside an output directory */
     std::string getOutputFilename(const std::string& fileName);
 
@@ -186,13 +243,25 @@ public:
         return getStream(*m_infoFileRaw, state);
     }
 
+    /** Returns false when the lines of the given level are discarded.
+        Lets hot paths skip formatting them. */
+    bool isLogEnabled(LogLevel level) const {
+        return level >= m_logLevel;
+    }
+
     /** Get debug stream (used for non-important debug info) */
     llvm::raw_ostream& getDebugStream(const S2EExecutionState* state = 0) const {
+        if (!isLogEnabled(LOG_DEBUG)) {
+            return llvm::nulls();
+        }
         return getStream(*m_debugFileRaw, state);
     }
 
     /** Get messages stream (used for non-critical information) */
     llvm::raw_ostream& getMessagesStream(const S2EExecutionState* state = 0) const {
+        if (!isLogEnabled(LOG_MESSAGES)) {
+            return llvm::nulls();
+        }
         return getStream(*m_messageStream, state);
     }
 
@@ -213,7 +282,13 @@ public:
 
     void writeBitCodeToFile();
 
-    int fork();
+    /** Returns 1 in the child, 0 in the parent, -1 on failure.
+        The child writes its output in outputDirectory, if specified. */
+    int fork(const std::string &outputDirectory = "", int *childPid = NULL);
+
+    /** Forks a process from the current state for each job request */
+    void runServer(const std::string &socketPath);
+
     bool isForking() const {
         return m_forking;
     }
@@ -233,10 +308,35 @@ public:
 
     unsigned getProcessIndexForId(unsigned id);
 
+    /** Number of local instances allowed to run, at most getMaxProcesses() */
+    unsigned getProcessLimit();
+    void setProcessLimit(unsigned limit);
+
     unsigned getCurrentProcessCount();
 
+    /** Returns NULL if the run is confined to the local host */
+    S2ECoordinator* getCoordinator() const {
+        return m_coordinator;
+    }
+
+    /** Number of instances in the whole run, including other hosts */
+    unsigned getClusterProcessCount();
+
     bool checkDeadProcesses();
 
+    /** Publish the number of pending states of the current instance */
+    void setCurrentProcessLoad(unsigned load);
+
+    /** Returns true if the current instance has the largest number
+        of pending states among all running instances. */
+    bool isBusiestProcess();
+
+    /** Publish the monitoring counters of the current instance */
+    void setCurrentProcessMetrics(const S2EProcessMetrics &metrics);
+
+    /** Counters of the running instances, by instance index */
+    void getProcessMetrics(std::map<unsigned, S2EProcessMetrics> &metrics);
+
     inline uint64_t getStartTime() const {
         return m_startTimeSeconds;
     }
@@ -0,0 +1,297 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "S2ECheckpoint.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace s2e {
+
+static const char s_magic[] = "S2ECKPT1";
+static const unsigned s_magicSize = sizeof(s_magic) - 1;
+
+ForkHistory *ForkHistory::extend(ForkHistory *parent, uint64_t pc, unsigned index)
+{
+    ForkHistory *history = new ForkHistory;
+    history->parent = parent;
+    history->pc = pc;
+    history->index = index;
+    history->refCount = 1;
+    retain(parent);
+    return history;
+}
+
+void ForkHistory::release(ForkHistory *history)
+{
+    //Iterative, paths can be thousands of forks deep
+    while (history && --history->refCount == 0) {
+        ForkHistory *parent = history->parent;
+        delete history;
+        history = parent;
+    }
+}
+
+ExplorationCheckpoint::Node::~Node()
+{
+    for (unsigned i = 0; i < children.size(); ++i) {
+        delete children[i];
+    }
+}
+
+const ExplorationCheckpoint::Node *ExplorationCheckpoint::Node::getChild(
+        uint64_t pc, unsigned index) const
+{
+    for (unsigned i = 0; i < children.size(); ++i) {
+        if (children[i]->pc == pc && children[i]->index == index) {
+            return children[i];
+        }
+    }
+    return NULL;
+}
+
+bool ExplorationCheckpoint::Node::hasFork(uint64_t pc) const
+{
+    for (unsigned i = 0; i < children.size(); ++i) {
+        if (children[i]->pc == pc) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ExplorationCheckpoint::Node *ExplorationCheckpoint::getOrCreateChild(
+        Node *node, uint64_t pc, unsigned index)
+{
+    Node *child = const_cast<Node*>(node->getChild(pc, index));
+    if (!child) {
+        child = new Node();
+        child->pc = pc;
+        child->index = index;
+        node->children.push_back(child);
+    }
+    return child;
+}
+
+/* LEB128 */
+static void putInt(std::string &buffer, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        buffer.push_back((char) (value ? byte | 0x80 : byte));
+    } while (value);
+}
+
+static bool getInt(const std::string &buffer, size_t &pos, uint64_t &value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos >= buffer.size()) {
+            return false;
+        }
+        uint8_t byte = buffer[pos++];
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool getString(const std::string &buffer, size_t &pos, std::string &str)
+{
+    uint64_t size;
+    if (!getInt(buffer, pos, size) || size > buffer.size() - pos) {
+        return false;
+    }
+    str = buffer.substr(pos, size);
+    pos += size;
+    return true;
+}
+
+bool ExplorationCheckpoint::write(const std::string &fileName,
+                                  const std::vector<Path> &paths,
+                                  const CheckpointSections &sections)
+{
+    //Nodes are numbered from 1 in the order they are written, parents first.
+    //The root, i.e., the path of the initial state, is 0.
+    std::map<const ForkHistory*, uint64_t> ids;
+    std::string nodes;
+    uint64_t nodeCount = 0;
+    std::vector<uint64_t> frontier;
+
+    for (unsigned i = 0; i < paths.size(); ++i) {
+        std::vector<const ForkHistory*> chain;
+        for (const ForkHistory *h = paths[i].history; h && !ids.count(h); h = h->parent) {
+            chain.push_back(h);
+        }
+
+        for (unsigned j = chain.size(); j-- > 0; ) {
+            const ForkHistory *h = chain[j];
+            putInt(nodes, h->parent ? ids[h->parent] : 0);
+            putInt(nodes, h->pc);
+            putInt(nodes, h->index);
+            ids[h] = ++nodeCount;
+        }
+
+        uint64_t id = paths[i].history ? ids[paths[i].history] : 0;
+        if (!paths[i].pending) {
+            frontier.push_back(id);
+            continue;
+        }
+
+        //The recorded decisions below the state are still to be replayed
+        std::vector<std::pair<const Node*, uint64_t> > stack;
+        stack.push_back(std::make_pair(paths[i].pending, id));
+        while (!stack.empty()) {
+            const Node *node = stack.back().first;
+            uint64_t nodeId = stack.back().second;
+            stack.pop_back();
+
+            if (node->frontier) {
+                frontier.push_back(nodeId);
+            }
+
+            for (unsigned j = 0; j < node->children.size(); ++j) {
+                const Node *child = node->children[j];
+                putInt(nodes, nodeId);
+                putInt(nodes, child->pc);
+                putInt(nodes, child->index);
+                stack.push_back(std::make_pair(child, ++nodeCount));
+            }
+        }
+    }
+
+    std::string buffer(s_magic, s_magicSize);
+    putInt(buffer, nodeCount);
+    buffer += nodes;
+
+    putInt(buffer, frontier.size());
+    for (unsigned i = 0; i < frontier.size(); ++i) {
+        putInt(buffer, frontier[i]);
+    }
+
+    putInt(buffer, sections.size());
+    for (CheckpointSections::const_iterator it = sections.begin();
+         it != sections.end(); ++it) {
+        putInt(buffer, it->first.size());
+        buffer += it->first;
+        putInt(buffer, it->second.size());
+        buffer += it->second;
+    }
+
+    std::string tmpName = fileName + ".tmp";
+    FILE *fp = fopen(tmpName.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+
+    bool ok = fwrite(buffer.data(), buffer.size(), 1, fp) == 1;
+    ok = !fclose(fp) && ok;
+    ok = ok && !rename(tmpName.c_str(), fileName.c_str());
+    if (!ok) {
+        remove(tmpName.c_str());
+    }
+    return ok;
+}
+
+bool ExplorationCheckpoint::read(const std::string &fileName, CheckpointSections &sections)
+{
+    FILE *fp = fopen(fileName.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    std::string buffer;
+    char chunk[4096];
+    size_t size;
+    while ((size = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        buffer.append(chunk, size);
+    }
+    fclose(fp);
+
+    if (buffer.compare(0, s_magicSize, s_magic) != 0) {
+        return false;
+    }
+
+    size_t pos = s_magicSize;
+    uint64_t count;
+    if (!getInt(buffer, pos, count)) {
+        return false;
+    }
+
+    std::vector<Node*> nodes;
+    nodes.push_back(&m_root);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t parent, pc, index;
+        if (!getInt(buffer, pos, parent) || !getInt(buffer, pos, pc) ||
+            !getInt(buffer, pos, index) || parent >= nodes.size()) {
+            return false;
+        }
+        nodes.push_back(getOrCreateChild(nodes[parent], pc, index));
+    }
+
+    if (!getInt(buffer, pos, count)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t id;
+        if (!getInt(buffer, pos, id) || id >= nodes.size()) {
+            return false;
+        }
+        if (!nodes[id]->frontier) {
+            nodes[id]->frontier = true;
+            ++m_frontierSize;
+        }
+    }
+
+    if (!getInt(buffer, pos, count)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        std::string name, data;
+        if (!getString(buffer, pos, name) || !getString(buffer, pos, data)) {
+            return false;
+        }
+        sections[name] = data;
+    }
+
+    return pos == buffer.size();
+}
+
+}
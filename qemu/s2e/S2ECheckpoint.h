@@ -0,0 +1,133 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef _S2E_CHECKPOINT_H_
+
+#define _S2E_CHECKPOINT_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace s2e {
+
+/**
+ *  Fork decision taken on the path of a state: the pc of the fork and the
+ *  index of the branch. The decisions are reference-counted and shared by
+ *  all the states forked after them, a state only points to its last one.
+ */
+struct ForkHistory {
+    ForkHistory *parent;
+    uint64_t pc;
+    unsigned index;
+    unsigned refCount;
+
+    static ForkHistory *extend(ForkHistory *parent, uint64_t pc, unsigned index);
+
+    static void retain(ForkHistory *history) {
+        if (history) {
+            ++history->refCount;
+        }
+    }
+
+    static void release(ForkHistory *history);
+};
+
+/** Progress of the plugins, indexed by plugin name */
+typedef std::map<std::string, std::string> CheckpointSections;
+
+/**
+ *  Fork decisions of the live states of an exploration, merged in a tree
+ *  rooted at the initial state. A new process started from the same
+ *  snapshot rebuilds the states by following the recorded decisions and
+ *  killing the branches that leave the tree.
+ *
+ *  The file stores each decision once, whatever the number of states
+ *  that share it.
+ */
+class ExplorationCheckpoint {
+public:
+    struct Node {
+        uint64_t pc;
+        unsigned index;
+
+        /* A live state followed the path up to this node */
+        bool frontier;
+
+        std::vector<Node*> children;
+
+        Node() : pc(0), index(0), frontier(false) {}
+        ~Node();
+
+        const Node *getChild(uint64_t pc, unsigned index) const;
+        bool hasFork(uint64_t pc) const;
+    };
+
+    /* Path of a state. A state that is still being rebuilt also carries
+       the recorded decisions it has yet to replay. */
+    struct Path {
+        const ForkHistory *history;
+        const Node *pending;
+
+        Path(const ForkHistory *h, const Node *p) : history(h), pending(p) {}
+    };
+
+private:
+    Node m_root;
+    unsigned m_frontierSize;
+
+    Node *getOrCreateChild(Node *node, uint64_t pc, unsigned index);
+
+public:
+    ExplorationCheckpoint() : m_frontierSize(0) {}
+
+    const Node *getRoot() const { return &m_root; }
+
+    /* Number of states to rebuild */
+    unsigned getFrontierSize() const { return m_frontierSize; }
+
+    /* Merges the paths of a checkpoint file into the tree */
+    bool read(const std::string &fileName, CheckpointSections &sections);
+
+    /* The file is replaced atomically, a crash leaves the previous one */
+    static bool write(const std::string &fileName,
+                      const std::vector<Path> &paths,
+                      const CheckpointSections &sections);
+};
+
+}
+
+#endif
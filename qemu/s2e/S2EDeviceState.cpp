@@ -63,6 +63,16 @@ namespace {
     SharedDevices("s2e-shared-devices",
         llvm::cl::desc("Comma-separated list of devices to be shared between states."),
         llvm::cl::init(""));
+
+    llvm::cl::opt<std::string>
+    DiskSpillFile("s2e-disk-spill-file",
+        llvm::cl::desc("File where the least recently used disk writes are spilled."),
+        llvm::cl::init(""));
+
+    llvm::cl::opt<unsigned>
+    DiskSpillThreshold("s2e-disk-spill-threshold",
+        llvm::cl::desc("Megabytes of disk writes kept in memory before spilling them."),
+        llvm::cl::init(1024));
 }
 
 
@@ -75,8 +85,11 @@ llvm::SmallVector<struct BlockDriverState*, 5> S2EDeviceState::s_blockDevices;
 
 QEMUFile *S2EDeviceState::s_memFile = NULL;
 uint8_t *S2EDeviceState::s_tempStateBuffer = NULL;
+unsigned S2EDeviceState::s_tempStateAllocated = 0;
 unsigned S2EDeviceState::s_tempStateSize = 0;
-unsigned S2EDeviceState::s_finalStateSize = 0;
+
+std::vector<S2EDeviceState::DeviceChunk*> S2EDeviceState::s_loadedChunks;
+S2EDeviceState::DeviceChunk *S2EDeviceState::s_currentChunk = NULL;
 
 bool S2EDeviceState::s_devicesInited=false;
 
@@ -101,31 +114,91 @@ void s2e_init_device_state(S2EExecutionState *s)
 
 
 S2EDeviceState::S2EDeviceState(const S2EDeviceState &state):
-        m_deviceState(state.m_deviceState)
+        m_blockStores(state.m_blockStores)
 {
-    assert( state.m_stateBuffer && s_finalStateSize > 0);
-    m_stateBuffer = (uint8_t*) malloc(s_finalStateSize);
-    memcpy(m_stateBuffer, state.m_stateBuffer, s_finalStateSize);
+    assert(state.m_chunks.size() == s_devices.size());
+
+    //Device snapshots are immutable, share them with the parent
+    m_chunks = state.m_chunks;
+    foreach2(it, m_chunks.begin(), m_chunks.end()) {
+        ++(*it)->refCount;
+    }
     s_memFile = state.s_memFile;
 }
 
-S2EDeviceState::S2EDeviceState(klee::ExecutionState *state):m_deviceState(state)
+S2EDeviceState::S2EDeviceState()
 {
-    m_stateBuffer = NULL;
     s_memFile = NULL;
 }
 
 S2EDeviceState::~S2EDeviceState()
 {
-    if (m_stateBuffer) {
-        free(m_stateBuffer);
+    foreach2(it, m_chunks.begin(), m_chunks.end()) {
+        releaseChunk(*it);
+    }
+}
+
+S2EDeviceState::DeviceChunk *S2EDeviceState::createChunk(const uint8_t *data, unsigned size)
+{
+    DeviceChunk *chunk = new DeviceChunk();
+    chunk->refCount = 1;
+    chunk->size = size;
+    chunk->data = (uint8_t*) malloc(size);
+    if (size && !chunk->data) {
+        llvm::errs() << "S2EDeviceState: could not allocate memory\n";
+        exit(-1);
+    }
+    memcpy(chunk->data, data, size);
+    chunk->hasHash = false;
+    return chunk;
+}
+
+void S2EDeviceState::releaseChunk(DeviceChunk *chunk)
+{
+    assert(chunk->refCount > 0);
+    if (--chunk->refCount == 0) {
+        free(chunk->data);
+        delete chunk;
+    }
+}
+
+bool S2EDeviceState::chunkEquals(const DeviceChunk *chunk, const uint8_t *data, unsigned size)
+{
+    return chunk->size == size && !memcmp(chunk->data, data, size);
+}
+
+uint64_t S2EDeviceState::getHash() const
+{
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (unsigned i = 0; i < m_chunks.size(); ++i) {
+        DeviceChunk *chunk = m_chunks[i];
+        if (!chunk) {
+            continue;
+        }
+
+        //Chunks are shared by the states whose device did not change
+        if (!chunk->hasHash) {
+            uint64_t chunkHash = 0xcbf29ce484222325ULL;
+            for (unsigned b = 0; b < chunk->size; ++b) {
+                chunkHash = (chunkHash ^ chunk->data[b]) * prime;
+            }
+            chunk->hash = chunkHash;
+            chunk->hasHash = true;
+        }
+        hash = (hash ^ chunk->hash) * prime;
     }
+
+    for (unsigned i = 0; i < m_blockStores.size(); ++i) {
+        hash = (hash ^ m_blockStores[i].getHash()) * prime;
+    }
+
+    return hash;
 }
 
 void S2EDeviceState::initDeviceState()
 {
-    m_stateBuffer = NULL;
-    
     assert(!s_devicesInited);
 
     s_memFile = qemu_memfile_open(s2e_qemu_get_buffer, s2e_qemu_put_buffer);
@@ -174,6 +247,11 @@ void S2EDeviceState::initDeviceState()
                 "WARNING!!! All writes to disk will be lost after shutdown." << '\n';
         __hook_bdrv_read = s2e_bdrv_read;
         __hook_bdrv_write = s2e_bdrv_write;
+
+        if (!DiskSpillFile.empty() &&
+            !SectorStore::setSpillFile(DiskSpillFile, (uint64_t) DiskSpillThreshold * 1024 * 1024)) {
+            exit(-1);
+        }
     }else {
         g_s2e->getMessagesStream() <<
                 "WARNING!!! All disk writes will be SHARED across states! BEWARE OF CORRUPTION!" << '\n';
@@ -182,53 +260,70 @@ void S2EDeviceState::initDeviceState()
 
 void S2EDeviceState::saveDeviceState()
 {
-    qemu_make_readable(s_memFile);
+    if (m_chunks.empty()) {
+        m_chunks.resize(s_devices.size(), NULL);
+    }
+    discardLoadedChunks();
+    s_loadedChunks.resize(s_devices.size(), NULL);
 
-    //DPRINTF("Saving device state %p\n", this);
     /* Iterate through all device descritors and call
-    * their snapshot function */
-    for (vector<void*>::iterator it = s_devices.begin(); it != s_devices.end(); it++) {
-        void *se = *it;
-        //DPRINTF("%s ", s2e_qemu_get_se_idstr(se));
+    * their snapshot function. Each device is saved separately,
+    * so that the snapshots of devices that did not change since
+    * the last save can be kept. */
+    for (unsigned i = 0; i < s_devices.size(); ++i) {
+        void *se = s_devices[i];
+
+        s_tempStateSize = 0;
+        qemu_make_readable(s_memFile);
         s2e_qemu_save_state(s_memFile, se);
+        qemu_fflush(s_memFile);
+
+        DeviceChunk *chunk = m_chunks[i];
+        if (!chunk || !chunkEquals(chunk, s_tempStateBuffer, s_tempStateSize)) {
+            if (chunk) {
+                releaseChunk(chunk);
+            }
+            chunk = createChunk(s_tempStateBuffer, s_tempStateSize);
+            m_chunks[i] = chunk;
+        }
+
+        ++chunk->refCount;
+        s_loadedChunks[i] = chunk;
     }
-    //DPRINTF("\n");
-    qemu_fflush(s_memFile);
-    initFirstSnapshot();
 }
 
-void S2EDeviceState::initFirstSnapshot()
+void S2EDeviceState::restoreDeviceState()
 {
-    if (s_finalStateSize) {
-        return;
-    }
+    assert(m_chunks.size() == s_devices.size());
 
-    assert(!m_stateBuffer && s_tempStateBuffer && s_tempStateSize);
-    m_stateBuffer = (uint8_t*) malloc(s_tempStateSize);
-    if (!m_stateBuffer) {
-        llvm::errs() << "S2EDeviceState: could not allocate memory\n";
-        exit(-1);
+    for (unsigned i = 0; i < s_devices.size(); ++i) {
+        DeviceChunk *chunk = m_chunks[i];
+
+        //Skip the devices that are already in the right state
+        if (!s_loadedChunks.empty()) {
+            DeviceChunk *loaded = s_loadedChunks[i];
+            if (loaded == chunk || chunkEquals(loaded, chunk->data, chunk->size)) {
+                continue;
+            }
+        }
+
+        s_currentChunk = chunk;
+        qemu_make_readable(s_memFile);
+        s2e_qemu_load_state(s_memFile, s_devices[i]);
     }
 
-    memcpy(m_stateBuffer, s_tempStateBuffer, s_tempStateSize);
-    s_finalStateSize = s_tempStateSize;
-    free(s_tempStateBuffer);
-    s_tempStateBuffer = NULL;
-    s_tempStateSize = 0;
+    s_currentChunk = NULL;
+
+    //The devices will be modified by the new state
+    discardLoadedChunks();
 }
 
-void S2EDeviceState::restoreDeviceState()
+void S2EDeviceState::discardLoadedChunks()
 {
-    assert(s_finalStateSize && m_stateBuffer);
-
-    qemu_make_readable(s_memFile);
-    //DPRINTF("Restoring device state %p\n", this);
-    for (vector<void*>::iterator it = s_devices.begin(); it != s_devices.end(); it++) {
-        void *se = *it;
-        //DPRINTF("%s ", s2e_qemu_get_se_idstr(se));  
-        s2e_qemu_load_state(s_memFile, se);
+    foreach2(it, s_loadedChunks.begin(), s_loadedChunks.end()) {
+        releaseChunk(*it);
     }
-    //DPRINTF("\n");
+    s_loadedChunks.clear();
 }
 
 
@@ -238,13 +333,13 @@ void S2EDeviceState::restoreDeviceState()
 
 void S2EDeviceState::allocateBuffer(unsigned int Sz)
 {
-    if (Sz < s_tempStateSize) {
+    if (Sz <= s_tempStateAllocated) {
         return;
     }
 
     /* Need to expand the buffer */
-    s_tempStateSize = Sz;
-    s_tempStateBuffer = (uint8_t*) realloc(s_tempStateBuffer, s_tempStateSize);
+    s_tempStateAllocated = Sz * 2;
+    s_tempStateBuffer = (uint8_t*) realloc(s_tempStateBuffer, s_tempStateAllocated);
     if (!s_tempStateBuffer) {
         cerr << "Cannot reallocate memory for device state snapshot" << endl;
         exit(-1);
@@ -253,29 +348,24 @@ void S2EDeviceState::allocateBuffer(unsigned int Sz)
 
 int S2EDeviceState::putBuffer(const uint8_t *buf, int64_t pos, int size)
 {
-    uint8_t *dest;
-
-    if (!m_stateBuffer) {
-        allocateBuffer(pos + size);
-        dest = &s_tempStateBuffer[pos];
-    } else {
-        dest = &m_stateBuffer[pos];
+    allocateBuffer(pos + size);
+    memcpy(&s_tempStateBuffer[pos], buf, size);
+    if (pos + size > s_tempStateSize) {
+        s_tempStateSize = pos + size;
     }
-
-    memcpy(dest, buf, size);
     return size;
 }
 
 int S2EDeviceState::getBuffer(uint8_t *buf, int64_t pos, int size)
 {
-    assert(m_stateBuffer);
-    int toCopy = pos + size <= s_finalStateSize ? size : s_finalStateSize - pos;
-    memcpy(buf, &m_stateBuffer[pos], toCopy);
-    return size;
-
+    assert(s_currentChunk);
+    if (pos >= s_currentChunk->size) {
+        return 0;
+    }
 
-    //memcpy(buf, &m_state[pos], toCopy);
-    //return toCopy;
+    int toCopy = pos + size <= s_currentChunk->size ? size : s_currentChunk->size - pos;
+    memcpy(buf, &s_currentChunk->data[pos], toCopy);
+    return toCopy;
 }
 
 
@@ -296,60 +386,30 @@ unsigned S2EDeviceState::getBlockDeviceId(struct BlockDriverState* dev)
     return i;
 }
 
-uint64_t S2EDeviceState::getBlockDeviceStart(struct BlockDriverState* dev)
-{
-    unsigned id = getBlockDeviceId(dev);
-    return id * BLOCK_DEV_AS;
-}
-
 /* Return 0 upon success */
 int S2EDeviceState::writeSector(struct BlockDriverState *bs, int64_t sector, const uint8_t *buf, int nb_sectors)
 {
-    uint64_t bstart = getBlockDeviceStart(bs);
-
-    while (nb_sectors > 0) {
-        uintptr_t address = (uintptr_t) bstart + sector * SECTOR_SIZE;
-        ObjectPair op = m_deviceState.findObject(address);
-        if (op.first == NULL) {
-            MemoryObject *mo = new MemoryObject(address, SECTOR_SIZE, false, false, false, NULL);
-            ObjectState *os = new ObjectState(mo);
-            m_deviceState.bindObject(mo, os);
-            op.first = mo;
-            op.second = os;
-        }
-
-        ObjectState *os = m_deviceState.getWriteable(op.first, op.second);
-        memcpy(os->getConcreteStore(false), buf, SECTOR_SIZE);
-        buf += SECTOR_SIZE;
-        --nb_sectors;
-        ++sector;
+    unsigned id = getBlockDeviceId(bs);
+    if (id >= m_blockStores.size()) {
+        m_blockStores.resize(id + 1);
     }
 
+    m_blockStores[id].write(sector, buf, nb_sectors);
     return 0;
 }
 
-/* Return the number of sectors that could be read from the local store */
+/**
+ *  Return the number of sectors that could be read from the local store,
+ *  or minus the number of sectors that are not in the store
+ */
 int S2EDeviceState::readSector(struct BlockDriverState *bs, int64_t sector, uint8_t *buf, int nb_sectors)
 {
-    int readCount = 0;
-
-    uint64_t bstart = getBlockDeviceStart(bs);
-
-    while (nb_sectors > 0) {
-        uintptr_t address = (uintptr_t) bstart + sector * SECTOR_SIZE;
-        ObjectPair op = m_deviceState.findObject(address);
-        if (!op.first) {
-            return readCount;
-        }
-
-        memcpy(buf, op.second->getConcreteStore(false), SECTOR_SIZE);
-        buf += SECTOR_SIZE;
-        ++readCount;
-        --nb_sectors;
-        ++sector;
+    unsigned id = getBlockDeviceId(bs);
+    if (id >= m_blockStores.size()) {
+        return -nb_sectors;
     }
 
-    return readCount;
+    return m_blockStores[id].read(sector, buf, nb_sectors);
 }
 
 /*****************************************************************************/
@@ -47,9 +47,8 @@ extern "C" {
 #include <stdint.h>
 #include <llvm/ADT/SmallVector.h>
 
-#include <klee/AddressSpace.h>
-
 #include "s2e_block.h"
+#include "SectorStore.h"
 
 namespace s2e {
 
@@ -57,10 +56,8 @@ class S2EExecutionState;
 
 class S2EDeviceState {
 private:
-    static const unsigned SECTOR_SIZE = 512;
-
-    /* Give 64GB of KLEE address space for each block device */
-    static const uint64_t BLOCK_DEV_AS = (1024 * 1024 * 1024) * 64;
+    friend class StateWriter;
+    friend class StateReader;
 
     static std::vector<void *> s_devices;
     static std::set<std::string> s_customDevices;
@@ -68,35 +65,53 @@ private:
 
     static QEMUFile *s_memFile;
 
-    /* Scratch buffer for the first snapshot */
-    static uint8_t *s_tempStateBuffer;
+    /* Snapshot of a single device, shared by all the states
+       in which the device has the same state */
+    struct DeviceChunk {
+        unsigned refCount;
+        unsigned size;
+        uint8_t *data;
 
-    /* Once determined, the size of the device state is constant */
+        /* Computed on the first getHash() */
+        bool hasHash;
+        uint64_t hash;
+    };
+
+    /* Scratch buffer in which devices are saved before being compared to
+       the chunk of the current state */
+    static uint8_t *s_tempStateBuffer;
+    static unsigned s_tempStateAllocated;
     static unsigned s_tempStateSize;
-    static unsigned s_finalStateSize;
 
-    uint8_t *m_stateBuffer;
+    /* Chunks whose content is currently loaded in the QEMU devices.
+       Only valid between a save and the following restore, empty otherwise. */
+    static std::vector<DeviceChunk*> s_loadedChunks;
+
+    /* Chunk being read by the QEMU loading functions */
+    static DeviceChunk *s_currentChunk;
+
+    /* One chunk per registered device */
+    std::vector<DeviceChunk*> m_chunks;
 
 
     static llvm::SmallVector<struct BlockDriverState*, 5> s_blockDevices;
-    klee::AddressSpace m_deviceState;
+
+    /* Sectors written in this state, one store per block device */
+    std::vector<SectorStore> m_blockStores;
 
     void allocateBuffer(unsigned int Sz);
 
     static unsigned getBlockDeviceId(struct BlockDriverState* dev);
-    static uint64_t getBlockDeviceStart(struct BlockDriverState* dev);
 
-    void initFirstSnapshot();
+    static DeviceChunk *createChunk(const uint8_t *data, unsigned size);
+    static void releaseChunk(DeviceChunk *chunk);
+    static bool chunkEquals(const DeviceChunk *chunk, const uint8_t *data, unsigned size);
 
 public:
-    S2EDeviceState(klee::ExecutionState *state);
+    S2EDeviceState();
     S2EDeviceState(const S2EDeviceState &state);
     ~S2EDeviceState();
 
-    void setExecutionState(klee::ExecutionState *state) {
-        m_deviceState.state = state;
-    }
-
     void initDeviceState();
 
     //From QEMU to KLEE
@@ -105,6 +120,12 @@ public:
     //From KLEE to QEMU
     void restoreDeviceState();
 
+    //Must be called when the devices keep running after a save
+    static void discardLoadedChunks();
+
+    //Hash of the devices as of the last save and of the written sectors
+    uint64_t getHash() const;
+
     int putBuffer(const uint8_t *buf, int64_t pos, int size);
     int getBuffer(uint8_t *buf, int64_t pos, int size);
 
@@ -58,7 +58,9 @@ extern CPUArchState *env;
 #include <s2e/s2e_config.h>
 #include <s2e/S2EDeviceState.h>
 #include <s2e/S2EExecutor.h>
+#include <s2e/S2EStatsTracker.h>
 #include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
 #include <s2e/Utils.h>
 
 #include <klee/Context.h>
@@ -70,8 +72,11 @@ extern CPUArchState *env;
 
 #include <llvm/Support/CommandLine.h>
 
+#include <algorithm>
 #include <iomanip>
+#include <set>
 #include <sstream>
+#include <vector>
 
 //XXX: The idea is to avoid function calls
 //#define small_memcpy(dest, source, count) asm volatile ("cld; rep movsb"::"S"(source), "D"(dest), "c" (count):"flags", "memory")
@@ -90,6 +95,7 @@ extern llvm::cl::opt<bool> PrintForkingStatus;
 extern llvm::cl::opt<bool> ConcolicMode;
 extern llvm::cl::opt<bool> VerboseStateDeletion;
 extern llvm::cl::opt<bool> DebugConstraints;
+extern llvm::cl::opt<bool> LazyPluginStateClone;
 
 namespace s2e {
 
@@ -101,16 +107,28 @@ MemoryObject *S2EExecutionState::m_dirtyMask = NULL;
 
 unsigned S2EExecutionState::s_lastSymbolicId = 0;
 
+/* RAM objects are S2E_RAM_OBJECT_SIZE bytes, or up to one page in
+   shared-concrete regions */
+static inline bool isRamObjectSize(uint64_t size)
+{
+    return size >= S2E_RAM_OBJECT_SIZE && size <= TARGET_PAGE_SIZE &&
+           (size & (S2E_RAM_OBJECT_SIZE - 1)) == 0;
+}
+
 S2EExecutionState::S2EExecutionState(klee::KFunction *kf) :
         klee::ExecutionState(kf), m_stateID(g_s2e->fetchAndIncrementStateId()),
         m_symbexEnabled(true), m_startSymbexAtPC((uint64_t) -1),
         m_active(true), m_zombie(false), m_yielded(false), m_runningConcrete(true),
+        m_dirtyRegisters((uint64_t) -1),
         m_cpuRegistersObject(NULL), m_cpuSystemObject(NULL),
-        m_deviceState(this),
         m_qemuIcount(0),
         m_lastS2ETb(NULL),
         m_lastMergeICount((uint64_t)-1),
-        m_needFinalizeTBExec(false), m_nextSymbVarId(0), m_runningExceptionEmulationCode(false)
+        m_forkPathHash(0), m_forkDepth(0),
+        m_forkHistory(NULL), m_replayNode(NULL),
+        m_needFinalizeTBExec(false), m_nextSymbVarId(0),
+        m_copyOnWriteBytes(0), m_stateSwitchBytes(0),
+        m_tlbGeneration(1), m_runningExceptionEmulationCode(false)
 {
     //XXX: make this a struct, not a pointer...
     m_timersState = new TimersState;
@@ -121,7 +139,7 @@ S2EExecutionState::~S2EExecutionState()
 {
     assert(m_lastS2ETb == NULL);
 
-    PluginStateMap::iterator it;
+    PluginStateArray::iterator it;
 
     if (VerboseStateDeletion) {
         g_s2e->getDebugStream() << "Deleting state " << m_stateID << " " << this << '\n';
@@ -130,7 +148,14 @@ S2EExecutionState::~S2EExecutionState()
     //print_stacktrace();
 
     for(it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        delete it->second;
+        if (!*it) {
+            continue;
+        }
+        if ((*it)->m_sharedCount) {
+            --(*it)->m_sharedCount;
+        } else {
+            delete *it;
+        }
     }
 
     g_s2e->refreshPlugins();
@@ -139,6 +164,8 @@ S2EExecutionState::~S2EExecutionState()
     //delete m_deviceState;
 
     delete m_timersState;
+
+    ForkHistory::release(m_forkHistory);
 }
 
 
@@ -199,12 +226,93 @@ void S2EExecutionState::disableForking()
 }
 
 
+#ifdef S2E_ENABLE_S2E_TLB
+static S2ETLBEntry *getTlbEntry(CPUArchState *cpu, unsigned slot)
+{
+    if (slot < NB_MMU_MODES * CPU_S2E_TLB_SIZE) {
+        return &cpu->s2e_tlb_table[slot / CPU_S2E_TLB_SIZE]
+                                  [slot % CPU_S2E_TLB_SIZE];
+    }
+
+    slot -= NB_MMU_MODES * CPU_S2E_TLB_SIZE;
+    return &cpu->s2e_tlb_v_table[slot / CPU_S2E_VTLB_SIZE]
+                                [slot % CPU_S2E_VTLB_SIZE];
+}
+#endif
+
+void S2EExecutionState::addQueryCost(uint64_t usec) const
+{
+    klee::ExecutionState::addQueryCost(usec);
+
+    //The solver only gets a const reference to the state
+    g_s2e->getCorePlugin()->onSolverQuery.emit(
+            const_cast<S2EExecutionState*>(this), usec);
+}
+
+void S2EExecutionState::getMemoryUsage(MemoryUsage &usage) const
+{
+    usage = MemoryUsage();
+
+    foreach2(it, addressSpace.objects.begin(), addressSpace.objects.end()) {
+        const ObjectState *os = (*it).second;
+        uint64_t bytes = os->getMemoryUsage();
+
+        if (!addressSpace.isOwnedByUs(os)) {
+            usage.sharedBytes += bytes;
+            ++usage.sharedObjects;
+        } else {
+            if (os->isAllConcrete()) {
+                usage.concreteBytes += bytes;
+            } else {
+                usage.symbolicBytes += bytes;
+            }
+            ++usage.ownedObjects;
+        }
+    }
+
+    //Count the distinct nodes of the constraint DAG
+    std::set<const Expr*> visited;
+    std::vector<const Expr*> worklist;
+    foreach2(it, constraints.begin(), constraints.end()) {
+        ++usage.constraints;
+        worklist.push_back((*it).get());
+    }
+
+    while (!worklist.empty()) {
+        const Expr *e = worklist.back();
+        worklist.pop_back();
+        if (isa<ConstantExpr>(e) || !visited.insert(e).second) {
+            continue;
+        }
+        for (unsigned i = 0; i < e->getNumKids(); ++i) {
+            worklist.push_back(e->getKid(i).get());
+        }
+    }
+    usage.constraintNodes = visited.size();
+
+    foreach2(it, m_PluginState.begin(), m_PluginState.end()) {
+        if (*it) {
+            usage.pluginStateBytes += (*it)->getMemoryUsage() / ((*it)->m_sharedCount + 1);
+        }
+    }
+}
+
 void S2EExecutionState::addressSpaceChange(const klee::MemoryObject *mo,
                         const klee::ObjectState *oldState,
                         klee::ObjectState *newState)
 {
+    if (!m_changedObjects.count(mo)) {
+        m_changedObjects = m_changedObjects.insert(mo);
+    }
+
+    //The object was shared with another state and got copied
+    if (oldState && newState && addressSpace.isOwnedByUs(newState)) {
+        m_copyOnWriteBytes += mo->size;
+        stats::copyOnWriteBytes += mo->size;
+    }
+
 #ifdef S2E_ENABLE_S2E_TLB
-    if(mo->size == S2E_RAM_OBJECT_SIZE && oldState) {
+    if(isRamObjectSize(mo->size) && oldState) {
         assert(m_cpuSystemState && m_cpuSystemObject);
 
 
@@ -225,16 +333,13 @@ void S2EExecutionState::addressSpaceChange(const klee::MemoryObject *mo,
         bool found = false;
         if (it != m_tlbMap.end()) {
             found = true;
-            ObjectStateTlbReferences vec = (*it).second;
-            unsigned size = vec.size();
-            assert(size > 0);
-            for (unsigned i = 0; i < size; ++i) {
-                const TlbCoordinates &coords = vec[i];
+            unsigned head = (*it).second;
+            for (unsigned slot = head; slot != TLB_LINK_END;
+                 slot = m_tlbLinks[slot].next) {
 #ifdef S2E_DEBUG_TLBCACHE
-                g_s2e->getDebugStream() << "  mmu_idx=" << coords.first<<
-                                           " index=" << coords.second << "\n";
+                g_s2e->getDebugStream() << "  slot=" << slot << "\n";
 #endif
-                S2ETLBEntry *entry = &cpu->s2e_tlb_table[coords.first][coords.second];
+                S2ETLBEntry *entry = getTlbEntry(cpu, slot);
                 assert(entry->objectState == (void*) oldState);
                 assert(newState);
                 entry->objectState = newState;
@@ -249,19 +354,17 @@ void S2EExecutionState::addressSpaceChange(const klee::MemoryObject *mo,
                 }
             }
 
-            m_tlbMap[newState] = vec;
-            m_tlbMap.erase(const_cast<ObjectState*>(oldState));
+            m_tlbMap.erase(it);
+            m_tlbMap[newState] = head;
         }
 
 #ifdef S2E_DEBUG_TLBCACHE
-        for(unsigned i=0; i<NB_MMU_MODES; ++i) {
-            for(unsigned j=0; j<CPU_S2E_TLB_SIZE; ++j) {
-                if (cpu->s2e_tlb_table[i][j].objectState == oldState) {
-                    assert(found);
-                }
-                assert(cpu->s2e_tlb_table[i][j].objectState != oldState);
+        for(unsigned slot = 0; slot < TLB_SLOT_COUNT; ++slot) {
+            if (isTlbSlotValid(slot)) {
+                assert(getTlbEntry(cpu, slot)->objectState != oldState);
             }
         }
+        (void) found;
 #endif
     }
 #endif
@@ -275,10 +378,16 @@ void S2EExecutionState::addressSpaceChange(const klee::MemoryObject *mo,
     } else if (mo == m_cpuSystemState) {
         m_cpuSystemObject = newState;
     } else {
-        ObjectPair op = m_memcache.get(mo->address);
-        if (op.first) {
-            op.second = newState;
-            m_memcache.put(mo->address, op);
+        /* Objects of shared-concrete regions may span several cache slots */
+        uint64_t end = isRamObjectSize(mo->size) ?
+                    mo->address + mo->size : mo->address + 1;
+        for (uint64_t addr = mo->address; addr < end;
+             addr += S2E_RAM_OBJECT_SIZE) {
+            ObjectPair op = m_memcache.get(addr);
+            if (op.first == mo) {
+                op.second = newState;
+                m_memcache.put(addr, op);
+            }
         }
     }
 }
@@ -290,11 +399,9 @@ void S2EExecutionState::clearTlbOwnership()
                                         - CPU_CONC_LIMIT);
 
     foreach2(it, m_tlbMap.begin(), m_tlbMap.end()) {
-        ObjectStateTlbReferences &vec = (*it).second;
-        unsigned size = vec.size();
-        for (unsigned i = 0; i < size; ++i) {
-            const TlbCoordinates &coords = vec[i];
-            S2ETLBEntry *entry = &cpu->s2e_tlb_table[coords.first][coords.second];
+        for (unsigned slot = (*it).second; slot != TLB_LINK_END;
+             slot = m_tlbLinks[slot].next) {
+            S2ETLBEntry *entry = getTlbEntry(cpu, slot);
             ObjectState* os = static_cast<ObjectState*>(entry->objectState);
             if(os && !os->getObject()->isSharedConcrete) {
                 entry->addend &= ~1;
@@ -312,7 +419,6 @@ ExecutionState* S2EExecutionState::clone()
     clearTlbOwnership();
     S2EExecutionState *ret = new S2EExecutionState(*this);
     ret->addressSpace.state = ret;
-    ret->m_deviceState.setExecutionState(ret);
 
     if(m_lastS2ETb)
         m_lastS2ETb->refCount += 1;
@@ -322,11 +428,29 @@ ExecutionState* S2EExecutionState::clone()
     ret->m_timersState = new TimersState;
     *ret->m_timersState = *m_timersState;
 
-    // Clone the plugins
-    PluginStateMap::iterator it;
-    ret->m_PluginState.clear();
-    for(it = m_PluginState.begin(); it != m_PluginState.end(); ++it) {
-        ret->m_PluginState.insert(std::make_pair((*it).first, (*it).second->clone()));
+    ForkHistory::retain(m_forkHistory);
+
+    // Clone the plugins. With lazy cloning, both states share the plugin
+    // states and each one gets its own copy when it first accesses it.
+    // Forked states that get killed before running never pay for the copy.
+    ret->m_PluginState.assign(m_PluginState.size(), NULL);
+    for(unsigned i = 0; i < m_PluginState.size(); ++i) {
+        PluginState *plgState = m_PluginState[i];
+        if (!plgState) {
+            continue;
+        }
+        if (LazyPluginStateClone) {
+            ++plgState->m_sharedCount;
+            ret->m_PluginState[i] = plgState;
+        } else {
+            ret->m_PluginState[i] = plgState->clone();
+        }
+    }
+
+    // Plugins cache the plugin state of the last accessed execution state.
+    // That pointer may now be shared with the child.
+    if (LazyPluginStateClone) {
+        g_s2e->refreshPlugins();
     }
 
     // This objects are not in TLB and won't cause any changes to it
@@ -376,6 +500,7 @@ void S2EExecutionState::writeCpuRegister(unsigned offset,
 
     if(!m_runningConcrete || !m_cpuRegistersObject->isConcrete(offset, width)) {
         m_cpuRegistersObject->write(offset, value);
+        markRegistersDirty(offset, Expr::getMinBytesForWidth(width));
 
     } else {
         /* XXX: should we check getSymbolicRegisterMask ? */
@@ -398,6 +523,7 @@ void S2EExecutionState::writeCpuRegisterSymbolic(unsigned offset,
     assert(offset + Expr::getMinBytesForWidth(width) <= CPU_CONC_LIMIT);
 
     m_cpuRegistersObject->write(offset, value);
+    markRegistersDirty(offset, Expr::getMinBytesForWidth(width));
 }
 
 bool S2EExecutionState::readCpuRegisterConcrete(unsigned offset,
@@ -530,17 +656,7 @@ void S2EExecutionState::makeSymbolic(std::vector< ref<Expr> > &args,
 
     // address of label and label string itself
     ref<klee::Expr> labelKleeAddress = args[2];
-    std::vector<klee::ref<klee::Expr> > result;
-    kleeReadMemory(labelKleeAddress, 31, &result, true, false, false);
-    char *strBuf = new char[32];
-    assert(result.size() <= 31 && "Expected fewer bytes??  See kleeReadMemory");
-    unsigned i;
-    for (i = 0; i < result.size(); i++) {
-        strBuf[i] = cast<klee::ConstantExpr>(result[i])->getZExtValue(8);
-    }
-    strBuf[i] = 0;
-    std::string labelStr(strBuf);
-    delete [] strBuf;
+    std::string labelStr = readKleeLabel(labelKleeAddress);
 
     // Now insert the symbolic/concolic data for this state
     std::vector<ref<Expr> > existingData;
@@ -560,6 +676,47 @@ void S2EExecutionState::makeSymbolic(std::vector< ref<Expr> > &args,
     kleeWriteMemory(kleeAddress, symb);
 }
 
+std::string S2EExecutionState::readKleeLabel(ref<Expr> kleeAddressExpr)
+{
+    std::vector<klee::ref<klee::Expr> > result;
+    kleeReadMemory(kleeAddressExpr, 31, &result, true, false, false);
+    char *strBuf = new char[32];
+    assert(result.size() <= 31 && "Expected fewer bytes??  See kleeReadMemory");
+    unsigned i;
+    for (i = 0; i < result.size(); i++) {
+        strBuf[i] = cast<klee::ConstantExpr>(result[i])->getZExtValue(8);
+    }
+    strBuf[i] = 0;
+    std::string labelStr(strBuf);
+    delete [] strBuf;
+    return labelStr;
+}
+
+void S2EExecutionState::makeSymbolicIo(std::vector< ref<Expr> > &args)
+{
+    assert(args.size() == 5);
+
+    ref<klee::ConstantExpr> kleeAddress = cast<klee::ConstantExpr>(args[0]);
+    unsigned sizeInBytes = cast<klee::ConstantExpr>(args[1])->getZExtValue();
+    std::string labelStr = readKleeLabel(args[2]);
+
+    ref<Expr> ioAddress = args[3];
+    if (!isa<klee::ConstantExpr>(ioAddress)) {
+        ioAddress = g_s2e->getExecutor()->toConstant(*this, ioAddress, "symbolic I/O address");
+    }
+    bool isMmio = cast<klee::ConstantExpr>(args[4])->getZExtValue();
+
+    ref<Expr> value = g_s2e->getCorePlugin()->createSymbolicHardwareValue(this, isMmio,
+                        cast<klee::ConstantExpr>(ioAddress)->getZExtValue(), sizeInBytes, labelStr);
+
+    std::vector<ref<Expr> > symb;
+    for (unsigned i = 0; i < sizeInBytes; ++i) {
+        symb.push_back(ExtractExpr::create(value, i * 8, Expr::Int8));
+    }
+
+    kleeWriteMemory(kleeAddress, symb);
+}
+
 uint64_t S2EExecutionState::readCpuState(unsigned offset,
                                          unsigned width) const
 {
@@ -619,6 +776,32 @@ bool S2EExecutionState::isRamSharedConcrete(uint64_t hostAddress)
     return op.first->isSharedConcrete;
 }
 
+ObjectPair S2EExecutionState::findRamObject(uint64_t hostAddress) const
+{
+    uint64_t objectAddress = hostAddress & S2E_RAM_OBJECT_MASK;
+
+    ObjectPair op = m_memcache.get(objectAddress);
+    if (op.first) {
+        return op;
+    }
+
+    op = addressSpace.findObject(objectAddress);
+    if (!op.first) {
+        /* The address falls inside a larger shared-concrete object */
+        MemoryObject hack(hostAddress);
+        const MemoryMap::value_type *res =
+                addressSpace.objects.lookup_previous(&hack);
+        if (res && hostAddress - res->first->address < res->first->size) {
+            op = ObjectPair(*res);
+        }
+    }
+
+    if (op.first) {
+        m_memcache.put(objectAddress, op);
+    }
+    return op;
+}
+
 
 //Get the program counter in the current state.
 //Allows plugins to retrieve it in a hardware-independent manner.
@@ -924,37 +1107,162 @@ uint64_t S2EExecutionState::getSymbolicRegistersMask() const
 bool S2EExecutionState::readMemoryConcrete(uint64_t address, void *buf,
                                    uint64_t size, AddressType addressType)
 {
-    uint8_t *d = (uint8_t*)buf;
-    while (size>0) {
-        ref<Expr> v = readMemory(address, Expr::Int8, addressType);
-        if (v.isNull() || !isa<ConstantExpr>(v)) {
-            return false;
+    return readMemoryBulk(address, (uint8_t*) buf, size, NULL, addressType);
+}
+
+bool S2EExecutionState::writeMemoryConcrete(uint64_t address, void *buf,
+                                   uint64_t size, AddressType addressType)
+{
+    return writeMemoryBulk(address, (const uint8_t*) buf, size, addressType);
+}
+
+bool S2EExecutionState::readMemoryBulk(uint64_t address, uint8_t *buf,
+                                uint64_t size,
+                                std::vector<ref<Expr> > *symbolicBytes,
+                                AddressType addressType) const
+{
+    if (symbolicBytes) {
+        symbolicBytes->clear();
+        symbolicBytes->resize(size);
+    }
+
+    uint64_t done = 0;
+    uint64_t hostPage = (uint64_t) -1;
+    uint64_t guestPage = (uint64_t) -1;
+
+    while (done < size) {
+        uint64_t pageOffset = address & ~S2E_RAM_OBJECT_MASK;
+        uint64_t chunk = std::min(size - done,
+                                  (uint64_t) S2E_RAM_OBJECT_SIZE - pageOffset);
+
+        /* Translate once per guest page, RAM objects never span pages */
+        if ((address & TARGET_PAGE_MASK) != guestPage) {
+            guestPage = address & TARGET_PAGE_MASK;
+            hostPage = getHostAddress(guestPage, addressType);
+            if (hostPage == (uint64_t) -1)
+                return false;
         }
-        *d = (uint8_t)cast<ConstantExpr>(v)->getZExtValue(8);
-        size--;
-        d++;
-        address++;
+
+        uint64_t hostAddress = hostPage | (address & ~TARGET_PAGE_MASK);
+
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.first->isUserSpecified);
+
+        uint64_t offset = hostAddress - op.first->address;
+        const ObjectState *os = op.second;
+        if (op.first->isSharedConcrete) {
+            memcpy(buf + done, (uint8_t*) hostAddress, chunk);
+        } else if (os->isAllConcrete()) {
+            memcpy(buf + done, os->getConcreteStore() + offset, chunk);
+        } else {
+            for (uint64_t i = 0; i < chunk; ++i) {
+                if (os->readConcrete8(offset + i, buf + done + i))
+                    continue;
+                if (!symbolicBytes)
+                    return false;
+                (*symbolicBytes)[done + i] = os->read8(offset + i);
+                buf[done + i] = 0;
+            }
+        }
+
+        done += chunk;
+        address += chunk;
     }
     return true;
 }
 
-bool S2EExecutionState::writeMemoryConcrete(uint64_t address, void *buf,
-                                   uint64_t size, AddressType addressType)
+bool S2EExecutionState::writeMemoryBulk(uint64_t address, const uint8_t *buf,
+                                        uint64_t size, AddressType addressType)
 {
-    uint8_t *d = (uint8_t*)buf;
-    while (size>0) {
-        klee::ref<klee::ConstantExpr> val = klee::ConstantExpr::create(*d, klee::Expr::Int8);
-        bool b = writeMemory(address, val,  addressType);
-        if (!b) {
-            return false;
+    uint64_t done = 0;
+    uint64_t hostPage = (uint64_t) -1;
+    uint64_t guestPage = (uint64_t) -1;
+
+    while (done < size) {
+        uint64_t pageOffset = address & ~S2E_RAM_OBJECT_MASK;
+        uint64_t chunk = std::min(size - done,
+                                  (uint64_t) S2E_RAM_OBJECT_SIZE - pageOffset);
+
+        if ((address & TARGET_PAGE_MASK) != guestPage) {
+            guestPage = address & TARGET_PAGE_MASK;
+            hostPage = getHostAddress(guestPage, addressType);
+            if (hostPage == (uint64_t) -1)
+                return false;
         }
-        size--;
-        d++;
-        address++;
+
+        uint64_t hostAddress = hostPage | (address & ~TARGET_PAGE_MASK);
+
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.first->isUserSpecified);
+
+        /* write8 keeps the concrete/flush masks consistent, so we do not
+           memcpy into the concrete store here */
+        uint64_t offset = hostAddress - op.first->address;
+        ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
+        for (uint64_t i = 0; i < chunk; ++i)
+            wos->write8(offset + i, buf[done + i]);
+
+        done += chunk;
+        address += chunk;
     }
     return true;
 }
 
+const Array *S2EExecutionState::makeSymbolicBulk(uint64_t address, unsigned size,
+                                                 const std::string &name,
+                                                 std::vector<unsigned char> &concreteBuffer,
+                                                 AddressType addressType)
+{
+    /* Check the whole range first, so that a failure leaves the memory
+       unchanged */
+    for (uint64_t page = address & TARGET_PAGE_MASK; page < address + size;
+         page += TARGET_PAGE_SIZE) {
+        if (getHostAddress(page, addressType) == (uint64_t) -1)
+            return NULL;
+    }
+
+    //Unconstrained bytes start at zero, as in createSymbolicArray
+    if (concreteBuffer.empty() && ConcolicMode) {
+        concreteBuffer.resize(size, 0);
+    }
+
+    const Array *array = createArray(name, size, concreteBuffer);
+    UpdateList ul(array, 0);
+
+    uint64_t done = 0;
+    uint64_t hostPage = (uint64_t) -1;
+    uint64_t guestPage = (uint64_t) -1;
+
+    while (done < size) {
+        uint64_t pageOffset = address & ~S2E_RAM_OBJECT_MASK;
+        uint64_t chunk = std::min(size - done,
+                                  (uint64_t) S2E_RAM_OBJECT_SIZE - pageOffset);
+
+        if ((address & TARGET_PAGE_MASK) != guestPage) {
+            guestPage = address & TARGET_PAGE_MASK;
+            hostPage = getHostAddress(guestPage, addressType);
+            assert(hostPage != (uint64_t) -1);
+        }
+
+        uint64_t hostAddress = hostPage | (address & ~TARGET_PAGE_MASK);
+
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.first->isUserSpecified);
+
+        uint64_t offset = hostAddress - op.first->address;
+        ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
+        for (uint64_t i = 0; i < chunk; ++i) {
+            wos->write(offset + i, ReadExpr::create(ul,
+                       ConstantExpr::alloc(done + i, Expr::Int32)));
+        }
+
+        done += chunk;
+        address += chunk;
+    }
+
+    return array;
+}
+
 uint64_t S2EExecutionState::getPhysicalAddress(uint64_t virtualAddress) const
 {
     assert(m_active && "Can not use getPhysicalAddress when the state"
@@ -995,18 +1303,32 @@ uint64_t S2EExecutionState::getHostAddress(uint64_t address,
 bool S2EExecutionState::readString(uint64_t address, std::string &s, unsigned maxLen)
 {
     s = "";
-    do {
-        uint8_t c;
-        SREADR(this, address, c);
+    std::vector<ref<Expr> > symbolicBytes;
+    uint8_t buf[TARGET_PAGE_SIZE];
 
-        if (c) {
-            s = s + (char)c;
-        }else {
-            return true;
+    /* Read page by page and only fail on symbolic bytes that precede
+       the terminator, as the byte-wise version did */
+    while (maxLen != 0) {
+        uint64_t chunk = std::min((uint64_t) maxLen,
+                    (uint64_t) TARGET_PAGE_SIZE - (address & ~TARGET_PAGE_MASK));
+
+        if (!readMemoryBulk(address, buf, chunk, &symbolicBytes)) {
+            return false;
         }
-        address++;
-        maxLen--;
-    }while(maxLen != 0);
+
+        for (unsigned i = 0; i < chunk; ++i) {
+            if (!symbolicBytes[i].isNull()) {
+                return false;
+            }
+            if (!buf[i]) {
+                return true;
+            }
+            s += (char) buf[i];
+        }
+
+        address += chunk;
+        maxLen -= chunk;
+    }
     return true;
 }
 
@@ -1042,16 +1364,10 @@ ref<Expr> S2EExecutionState::readMemory(uint64_t address,
         if(hostAddress == (uint64_t) -1)
             return ref<Expr>(0);
 
-        ObjectPair op = m_memcache.get(hostAddress & S2E_RAM_OBJECT_MASK);
-        if (!op.first) {
-            op = addressSpace.findObject(hostAddress & S2E_RAM_OBJECT_MASK);
-            m_memcache.put(hostAddress & S2E_RAM_OBJECT_MASK, op);
-        }
-
-        assert(op.first && op.first->isUserSpecified
-               && op.first->size == S2E_RAM_OBJECT_SIZE);
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.first->isUserSpecified);
 
-        return op.second->read(pageOffset, width);
+        return op.second->read(hostAddress - op.first->address, width);
     } else {
         /* Access spawns multiple MemoryObject's (TODO: could optimize it) */
         ref<Expr> res(0);
@@ -1073,12 +1389,10 @@ ref<Expr> S2EExecutionState::readMemory8(uint64_t address,
     if(hostAddress == (uint64_t) -1)
         return ref<Expr>(0);
 
-    ObjectPair op = addressSpace.findObject(hostAddress & S2E_RAM_OBJECT_MASK);
-
-    assert(op.first && op.first->isUserSpecified
-           && op.first->size == S2E_RAM_OBJECT_SIZE);
+    ObjectPair op = findRamObject(hostAddress);
+    assert(op.first && op.first->isUserSpecified);
 
-    return op.second->read8(hostAddress & ~S2E_RAM_OBJECT_MASK);
+    return op.second->read8(hostAddress - op.first->address);
 }
 
 bool S2EExecutionState::readMemoryConcrete8(uint64_t address,
@@ -1142,13 +1456,11 @@ bool S2EExecutionState::writeMemory(uint64_t address,
         if(hostAddress == (uint64_t) -1)
             return false;
 
-        ObjectPair op = addressSpace.findObject(hostAddress & S2E_RAM_OBJECT_MASK);
-
-        assert(op.first && op.first->isUserSpecified
-               && op.first->size == S2E_RAM_OBJECT_SIZE);
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.first->isUserSpecified);
 
         ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
-        wos->write(hostAddress & ~S2E_RAM_OBJECT_MASK, value);
+        wos->write(hostAddress - op.first->address, value);
     } else {
         // Slowest case (TODO: could optimize it)
         unsigned numBytes = width / 8;
@@ -1173,13 +1485,11 @@ bool S2EExecutionState::writeMemory8(uint64_t address,
     if(hostAddress == (uint64_t) -1)
         return false;
 
-    ObjectPair op = addressSpace.findObject(hostAddress & S2E_RAM_OBJECT_MASK);
-
-    assert(op.first && op.first->isUserSpecified
-           && op.first->size == S2E_RAM_OBJECT_SIZE);
+    ObjectPair op = findRamObject(hostAddress);
+    assert(op.first && op.first->isUserSpecified);
 
     ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
-    wos->write(hostAddress & ~S2E_RAM_OBJECT_MASK, value);
+    wos->write(hostAddress - op.first->address, value);
     return true;
 }
 
@@ -1187,34 +1497,7 @@ bool S2EExecutionState::writeMemory(uint64_t address,
                     uint8_t* buf, Expr::Width width, AddressType addressType)
 {
     assert((width & 7) == 0);
-    uint64_t size = width / 8;
-
-    uint64_t pageOffset = address & ~S2E_RAM_OBJECT_MASK;
-    if(pageOffset + size <= S2E_RAM_OBJECT_SIZE) {
-        /* Fast path: write belongs to one MemoryObject */
-
-        uint64_t hostAddress = getHostAddress(address, addressType);
-        if(hostAddress == (uint64_t) -1)
-            return false;
-
-        ObjectPair op = addressSpace.findObject(hostAddress & S2E_RAM_OBJECT_MASK);
-
-        assert(op.first && op.first->isUserSpecified
-               && op.first->size == S2E_RAM_OBJECT_SIZE);
-
-        ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
-        for(uint64_t i = 0; i < width / 8; ++i)
-            wos->write8(pageOffset + i, buf[i]);
-
-    } else {
-        /* Access spawns multiple MemoryObject's */
-        uint64_t size1 = S2E_RAM_OBJECT_SIZE - pageOffset;
-        if(!writeMemory(address, buf, size1, addressType))
-            return false;
-        if(!writeMemory(address + size1, buf + size1, size - size1, addressType))
-            return false;
-    }
-    return true;
+    return writeMemoryBulk(address, buf, width / 8, addressType);
 }
 
 bool S2EExecutionState::writeMemory8(uint64_t address,
@@ -1249,22 +1532,13 @@ void S2EExecutionState::readRamConcreteCheck(uint64_t hostAddress, uint8_t* buf,
     if(page_offset + size <= S2E_RAM_OBJECT_SIZE) {
         /* Single-object access */
 
-        uint64_t page_addr = hostAddress & S2E_RAM_OBJECT_MASK;
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.first->isUserSpecified);
 
-        //ObjectPair op = addressSpace.findObject(page_addr);
-        ObjectPair op = m_memcache.get(page_addr);
-        if (!op.first) {
-            op = addressSpace.findObject(page_addr);
-            m_memcache.put(page_addr, op);
-        }
-
-
-        assert(op.first && op.first->isUserSpecified &&
-               op.first->address == page_addr &&
-               op.first->size == S2E_RAM_OBJECT_SIZE);
+        uint64_t object_offset = hostAddress - op.first->address;
 
         for(uint64_t i=0; i<size; ++i) {
-            if(!op.second->readConcrete8(page_offset+i, buf+i)) {
+            if(!op.second->readConcrete8(object_offset+i, buf+i)) {
                 if (PrintModeSwitch) {
                     g_s2e->getMessagesStream()
                             << "Switching to KLEE executor at pc = "
@@ -1290,30 +1564,21 @@ void S2EExecutionState::readRamConcrete(uint64_t hostAddress, uint8_t* buf, uint
     if(page_offset + size <= S2E_RAM_OBJECT_SIZE) {
         /* Single-object access */
 
-        uint64_t page_addr = hostAddress & S2E_RAM_OBJECT_MASK;
-
-        //ObjectPair op = addressSpace.findObject(page_addr);
-        ObjectPair op = m_memcache.get(page_addr);
-        if (!op.first) {
-            op = addressSpace.findObject(page_addr);
-            m_memcache.put(page_addr, op);
-        }
-
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.first->isUserSpecified);
 
-        assert(op.first && op.first->isUserSpecified &&
-               op.first->address == page_addr &&
-               op.first->size == S2E_RAM_OBJECT_SIZE);
+        uint64_t object_offset = hostAddress - op.first->address;
 
         ObjectState *wos = NULL;
         for(uint64_t i=0; i<size; ++i) {
-            if(!op.second->readConcrete8(page_offset+i, buf+i)) {
+            if(!op.second->readConcrete8(object_offset+i, buf+i)) {
                 if(!wos) {
                     op.second = wos = addressSpace.getWriteable(
                                                     op.first, op.second);
                 }
-                buf[i] = g_s2e->getExecutor()->toConstant(*this, wos->read8(page_offset+i),
+                buf[i] = g_s2e->getExecutor()->toConstant(*this, wos->read8(object_offset+i),
                        "memory access from concrete code")->getZExtValue(8);
-                wos->write8(page_offset+i, buf[i]);
+                wos->write8(object_offset+i, buf[i]);
             }
         }
     } else {
@@ -1331,24 +1596,15 @@ void S2EExecutionState::writeRamConcrete(uint64_t hostAddress, const uint8_t* bu
     if(page_offset + size <= S2E_RAM_OBJECT_SIZE) {
         /* Single-object access */
 
-        uint64_t page_addr = hostAddress & S2E_RAM_OBJECT_MASK;
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.first->isUserSpecified);
 
-
-        //ObjectPair op = addressSpace.findObject(page_addr);
-        ObjectPair op = m_memcache.get(page_addr);
-        if (!op.first) {
-            op = addressSpace.findObject(page_addr);
-            m_memcache.put(page_addr, op);
-        }
-
-        assert(op.first && op.first->isUserSpecified &&
-               op.first->address == page_addr &&
-               op.first->size == S2E_RAM_OBJECT_SIZE);
+        uint64_t object_offset = hostAddress - op.first->address;
 
         ObjectState* wos =
                 addressSpace.getWriteable(op.first, op.second);
         for(uint64_t i=0; i<size; ++i) {
-            wos->write8(page_offset+i, buf[i]);
+            wos->write8(object_offset+i, buf[i]);
         }
 
     } else {
@@ -1359,6 +1615,30 @@ void S2EExecutionState::writeRamConcrete(uint64_t hostAddress, const uint8_t* bu
     }
 }
 
+/**
+ *  The host pages are shared with the other S2E instances that mapped the
+ *  same snapshot. Forked states copy the objects that they write to.
+ */
+void S2EExecutionState::mapRamConcrete(uint64_t hostAddress, uint64_t size)
+{
+    assert(m_active);
+    assert((hostAddress & ~S2E_RAM_OBJECT_MASK) == 0);
+
+    for (uint64_t addr = hostAddress; addr < hostAddress + size; addr += S2E_RAM_OBJECT_SIZE) {
+        ObjectPair op = findRamObject(addr);
+        assert(op.first && op.first->isUserSpecified);
+
+        //The host memory already is the store of shared objects
+        if (op.first->isSharedConcrete) {
+            continue;
+        }
+
+        ObjectState* wos = addressSpace.getWriteable(op.first, op.second);
+        wos->setExternalConcreteStore((uint8_t*) addr);
+        m_memcache.put(addr, ObjectPair(op.first, wos));
+    }
+}
+
 void S2EExecutionState::readRegisterConcrete(
         CPUArchState *cpuState, unsigned offset, uint8_t* buf, unsigned size)
 {
@@ -1419,6 +1699,7 @@ void S2EExecutionState::readRegisterConcrete(
                 buf[i] = g_s2e->getExecutor()->toConstant(*this, wos->read8(offset+i),
                                     reason.c_str())->getZExtValue(8);
                 wos->write8(offset+i, buf[i]);
+                markRegistersDirty(offset+i, 1);
             }
         }
     } else {
@@ -1446,6 +1727,7 @@ void S2EExecutionState::writeRegisterConcrete(CPUArchState *cpuState,
         ObjectState* wos = m_cpuRegistersObject;
         for(unsigned i = 0; i < size; ++i)
             wos->write8(offset+i, buf[i]);
+        markRegistersDirty(offset, size);
     } else {
         assert(m_cpuRegistersObject->isConcrete(offset, size*8));
         small_memcpy(((uint8_t*)cpuState)+offset, buf, size);
@@ -1461,6 +1743,74 @@ void S2EExecutionState::writeRegisterConcrete(CPUArchState *cpuState,
 }
 
 
+#ifdef TARGET_I386
+static const struct {
+    uint64_t mask;
+    unsigned offset;
+    unsigned size;
+} s_ccRegisters[] = {
+    { _M_CC_OP,  CPU_OFFSET(cc_op),  sizeof(env->cc_op) },
+    { _M_CC_SRC, CPU_OFFSET(cc_src), sizeof(env->cc_src) },
+    { _M_CC_DST, CPU_OFFSET(cc_dst), sizeof(env->cc_dst) },
+    { _M_CC_TMP, CPU_OFFSET(cc_tmp), sizeof(env->cc_tmp) },
+};
+
+static const uint64_t s_trackedRegisters =
+        (((1ULL << CPU_NB_REGS) - 1) << 5) |
+        _M_CC_OP | _M_CC_SRC | _M_CC_DST | _M_CC_TMP;
+#endif
+
+void S2EExecutionState::markRegistersDirty(unsigned offset, unsigned size)
+{
+#ifdef TARGET_I386
+    unsigned end = offset + size;
+    for (unsigned i = 0; i < CPU_NB_REGS; ++i) {
+        unsigned reg = CPU_OFFSET(regs[i]);
+        if (offset < reg + CPU_REG_SIZE && reg < end) {
+            m_dirtyRegisters |= 1ULL << (i + 5);
+        }
+    }
+
+    for (unsigned i = 0; i < sizeof(s_ccRegisters) / sizeof(s_ccRegisters[0]); ++i) {
+        unsigned reg = s_ccRegisters[i].offset;
+        if (offset < reg + s_ccRegisters[i].size && reg < end) {
+            m_dirtyRegisters |= s_ccRegisters[i].mask;
+        }
+    }
+#else
+    m_dirtyRegisters = (uint64_t) -1;
+#endif
+}
+
+void S2EExecutionState::copyDirtyRegisters()
+{
+    uint8_t *cpu = (uint8_t*) m_cpuRegistersState->address;
+    const uint8_t *store = m_cpuRegistersObject->getConcreteStore(true);
+    uint64_t dirty = m_dirtyRegisters;
+    m_dirtyRegisters = 0;
+
+#ifdef TARGET_I386
+    if (!(dirty & ~s_trackedRegisters)) {
+        for (unsigned i = 0; i < CPU_NB_REGS; ++i) {
+            if (dirty & (1ULL << (i + 5))) {
+                unsigned reg = CPU_OFFSET(regs[i]);
+                small_memcpy(cpu + reg, store + reg, CPU_REG_SIZE);
+            }
+        }
+
+        for (unsigned i = 0; i < sizeof(s_ccRegisters) / sizeof(s_ccRegisters[0]); ++i) {
+            if (dirty & s_ccRegisters[i].mask) {
+                unsigned reg = s_ccRegisters[i].offset;
+                small_memcpy(cpu + reg, store + reg, s_ccRegisters[i].size);
+            }
+        }
+        return;
+    }
+#endif
+
+    memcpy(cpu, store, m_cpuRegistersObject->size);
+}
+
 std::string S2EExecutionState::getUniqueVarName(const std::string &name)
 {
     std::stringstream ss;
@@ -1528,26 +1878,14 @@ ref<Expr> S2EExecutionState::createSymbolicValue(
     return createConcolicValue(name, width, concreteValues);
 }
 
-std::vector<ref<Expr> > S2EExecutionState::createConcolicArray(
-            const std::string& name,
-            unsigned size,
-            std::vector<unsigned char> &concreteBuffer)
+const Array *S2EExecutionState::createArray(const std::string &name, unsigned size,
+                                            std::vector<unsigned char> &concreteBuffer)
 {
     assert(concreteBuffer.size() == size || concreteBuffer.size() == 0);
 
     std::string sname = getUniqueVarName(name);
     const Array *array = new Array(sname, size);
 
-    UpdateList ul(array, 0);
-
-    std::vector<ref<Expr> > result;
-    result.reserve(size);
-
-    for(unsigned i = 0; i < size; ++i) {
-        result.push_back(ReadExpr::create(ul,
-                    ConstantExpr::alloc(i,Expr::Int32)));
-    }
-
     //Add it to the set of symbolic expressions, to be able to generate
     //test cases later.
     //Dummy memory object
@@ -1566,6 +1904,26 @@ std::vector<ref<Expr> > S2EExecutionState::createConcolicArray(
         }
     }
 
+    return array;
+}
+
+std::vector<ref<Expr> > S2EExecutionState::createConcolicArray(
+            const std::string& name,
+            unsigned size,
+            std::vector<unsigned char> &concreteBuffer)
+{
+    const Array *array = createArray(name, size, concreteBuffer);
+
+    UpdateList ul(array, 0);
+
+    std::vector<ref<Expr> > result;
+    result.reserve(size);
+
+    for(unsigned i = 0; i < size; ++i) {
+        result.push_back(ReadExpr::create(ul,
+                    ConstantExpr::alloc(i,Expr::Int32)));
+    }
+
     return result;
 }
 
@@ -1765,27 +2123,36 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
     //    s << "B: " << b.addressSpace.objects << "\n";
     //}
 
+    // Only the objects that got rebound since the start of the execution
+    // in either state may differ, the others are shared.
+    std::set<const MemoryObject*> changed;
+    foreach2(it, m_changedObjects.begin(), m_changedObjects.end()) {
+        changed.insert(*it);
+    }
+    foreach2(it, b.m_changedObjects.begin(), b.m_changedObjects.end()) {
+        changed.insert(*it);
+    }
+
     std::set<const MemoryObject*> mutated;
-    MemoryMap::iterator ai = addressSpace.objects.begin();
-    MemoryMap::iterator bi = b.addressSpace.objects.begin();
-    MemoryMap::iterator ae = addressSpace.objects.end();
-    MemoryMap::iterator be = b.addressSpace.objects.end();
-    for(; ai!=ae && bi!=be; ++ai, ++bi) {
-        if (ai->first != bi->first) {
-            if (DebugLogStateMerge) {
-                if (ai->first < bi->first) {
-                    s << "\t\tB misses binding for: " << ai->first->id << "\n";
-                } else {
-                    s << "\t\tA misses binding for: " << bi->first->id << "\n";
+    foreach2(it, changed.begin(), changed.end()) {
+        const MemoryObject *mo = *it;
+        const ObjectState *aos = addressSpace.findObject(mo);
+        const ObjectState *bos = b.addressSpace.findObject(mo);
+
+        if (!aos || !bos) {
+            if (aos != bos) {
+                if (DebugLogStateMerge) {
+                    s << "\t\t" << (aos ? "B" : "A") << " misses binding for: "
+                      << mo->id << "\n";
+                    s << "merge failed: different address maps" << '\n';
                 }
+                return false;
             }
-            if(DebugLogStateMerge)
-                s << "merge failed: different callstacks" << '\n';
-            return false;
+            continue;
         }
-        if(ai->second != bi->second && !ai->first->isValueIgnored &&
-                    ai->first != m_cpuSystemState && ai->first != m_dirtyMask) {
-            const MemoryObject *mo = ai->first;
+
+        if(aos != bos && !mo->isValueIgnored &&
+                    mo != m_cpuSystemState && mo != m_dirtyMask) {
             if(DebugLogStateMerge)
                 s << "\t\tmutated: " << mo->id << " (" << mo->name << ")\n";
             if(mo->isSharedConcrete) {
@@ -1797,11 +2164,6 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
             mutated.insert(mo);
         }
     }
-    if(ai!=ae || bi!=be) {
-        if(DebugLogStateMerge)
-            s << "merge failed: different address maps" << '\n';
-        return false;
-    }
 
     // Create state predicates
     ref<Expr> inA = ConstantExpr::alloc(1, Expr::Bool);
@@ -1874,6 +2236,8 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
 
     constraints.addConstraint(OrExpr::create(inA, inB));
 
+    m_dirtyRegisters = (uint64_t) -1;
+
     // Merge dirty mask by clearing bits that differ. Clearning bits in
     // dirty mask can only affect performance but not correcntess.
     // NOTE: this requires flushing TLB
@@ -1898,9 +2262,10 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
         for (int mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
             for(int i = 0; i < CPU_TLB_SIZE; i++)
                 cpu->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
-            for(int i = 0; i < CPU_S2E_TLB_SIZE; i++)
-                cpu->s2e_tlb_table[mmu_idx][i].objectState = 0;
+            for(int i = 0; i < CPU_VTLB_SIZE; i++)
+                cpu->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
         }
+        flushTlbCache();
 
         memset (cpu->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
     }
@@ -1926,27 +2291,34 @@ void S2EExecutionState::dmaRead(uint64_t hostAddress, uint8_t *buf, unsigned siz
             length = size;
         }
 
-        ObjectPair op = m_memcache.get(hostPage);
-        if (!op.first) {
-            op = addressSpace.findObject(hostPage);
-            m_memcache.put(hostAddress, op);
-        }
-        assert(op.first && op.second && op.first->address == hostPage);
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.second);
         ObjectState *os = const_cast<ObjectState*>(op.second);
         uint8_t *concreteStore;
 
-        unsigned offset = hostAddress & (S2E_RAM_OBJECT_SIZE-1);
+        unsigned offset = hostAddress - op.first->address;
 
         if (op.first->isSharedConcrete) {
             concreteStore = (uint8_t*)op.first->address;
             memcpy(buf, concreteStore + offset, length);
+        } else if (os->isConcrete(offset, length * 8)) {
+            concreteStore = os->getConcreteStore(true);
+            memcpy(buf, concreteStore + offset, length);
         } else {
             concreteStore = os->getConcreteStore(true);
-            for (unsigned i=0; i<length; ++i) {
-                if (_s2e_check_concrete(os, offset+i, 1)) {
-                    buf[i] = concreteStore[offset+i];
-                }else {
+            unsigned i = 0;
+            while (i < length) {
+                /* Copy the concrete bytes up to the next symbolic one */
+                unsigned end = i;
+                while (end < length && _s2e_check_concrete(os, offset + end, 1)) {
+                    ++end;
+                }
+                memcpy(&buf[i], concreteStore + offset + i, end - i);
+                i = end;
+
+                if (i < length) {
                     readRamConcrete(hostAddress+i, &buf[i], sizeof(buf[i]));
+                    ++i;
                 }
             }
         }
@@ -1967,29 +2339,35 @@ void S2EExecutionState::dmaWrite(uint64_t hostAddress, uint8_t *buf, unsigned si
         }
 
 
-        ObjectPair op = m_memcache.get(hostPage);
-        if (!op.first) {
-            op = addressSpace.findObject(hostPage);
-            m_memcache.put(hostAddress, op);
-        }
-
-        assert(op.first && op.second && op.first->address == hostPage);
-        ObjectState *os = addressSpace.getWriteable(op.first, op.second);
+        ObjectPair op = findRamObject(hostAddress);
+        assert(op.first && op.second);
         uint8_t *concreteStore;
 
-        unsigned offset = hostAddress & (S2E_RAM_OBJECT_SIZE-1);
+        unsigned offset = hostAddress - op.first->address;
 
         if (op.first->isSharedConcrete) {
             concreteStore = (uint8_t*)op.first->address;
             memcpy(concreteStore + offset, buf, length);
         } else {
+            ObjectState *os = addressSpace.getWriteable(op.first, op.second);
             concreteStore = os->getConcreteStore(true);
 
-            for (unsigned i=0; i<length; ++i) {
-                if (_s2e_check_concrete(os, offset+i, 1)) {
-                    concreteStore[offset+i] = buf[i];
-                }else {
-                    writeRamConcrete(hostAddress+i, &buf[i], sizeof(buf[i]));
+            if (os->isConcrete(offset, length * 8)) {
+                memcpy(concreteStore + offset, buf, length);
+            } else {
+                unsigned i = 0;
+                while (i < length) {
+                    unsigned end = i;
+                    while (end < length && _s2e_check_concrete(os, offset + end, 1)) {
+                        ++end;
+                    }
+                    memcpy(concreteStore + offset + i, &buf[i], end - i);
+                    i = end;
+
+                    if (i < length) {
+                        writeRamConcrete(hostAddress+i, &buf[i], sizeof(buf[i]));
+                        ++i;
+                    }
                 }
             }
         }
@@ -2006,36 +2384,127 @@ void S2EExecutionState::flushTlbCache()
     g_s2e->getDebugStream(this) << "Flushing TLB cache\n";
 #endif
     m_tlbMap.clear();
+
+    if (++m_tlbGeneration == 0) {
+        //Wrapped around, the stale generations could become valid again
+        for (unsigned i = 0; i < m_tlbLinks.size(); ++i) {
+            m_tlbLinks[i].generation = 0;
+        }
+        m_tlbGeneration = 1;
+    }
 }
 
-void S2EExecutionState::flushTlbCachePage(klee::ObjectState *objectState, int mmu_idx, int index)
+void S2EExecutionState::addTlbReference(klee::ObjectState *objectState, unsigned slot)
 {
-    if (!objectState) {
-        return;
+    if (m_tlbLinks.empty()) {
+        assert(TLB_SLOT_COUNT < TLB_LINK_END);
+        m_tlbLinks.resize(TLB_SLOT_COUNT);
     }
 
-    bool found = false;
-    TlbMap::iterator tlbIt = m_tlbMap.find(objectState);
-    assert(tlbIt != m_tlbMap.end());
+    TlbLink &link = m_tlbLinks[slot];
+    link.prev = TLB_LINK_END;
+    link.next = TLB_LINK_END;
+    link.generation = m_tlbGeneration;
 
-    ObjectStateTlbReferences &vec = (*tlbIt).second;
-    foreach2(vit, vec.begin(), vec.end()) {
-        if ((*vit).first == (unsigned)mmu_idx && (*vit).second == (unsigned)index) {
-            vec.erase(vit);
-            found = true;
-            break;
-        }
+    std::pair<TlbMap::iterator, bool> res =
+            m_tlbMap.insert(std::make_pair(objectState, slot));
+    if (!res.second) {
+        //Push the slot in front of the existing ones
+        link.next = (*res.first).second;
+        m_tlbLinks[link.next].prev = slot;
+        (*res.first).second = slot;
     }
+}
+
+void S2EExecutionState::removeTlbReference(klee::ObjectState *objectState, unsigned slot)
+{
+    TlbLink &link = m_tlbLinks[slot];
 
-    assert(found && "Invalid cache!");
+    if (link.prev != TLB_LINK_END) {
+        m_tlbLinks[link.prev].next = link.next;
+    } else {
+        TlbMap::iterator tlbIt = m_tlbMap.find(objectState);
+        assert(tlbIt != m_tlbMap.end() && (*tlbIt).second == slot && "Invalid cache!");
 
-    if (vec.empty()) {
+        if (link.next == TLB_LINK_END) {
 #ifdef S2E_DEBUG_TLBCACHE
-        g_s2e->getDebugStream(this) << "Erasing cache entry for " <<
-                                       (*tlbIt).first << "\n";
+            g_s2e->getDebugStream(this) << "Erasing cache entry for " <<
+                                           (*tlbIt).first << "\n";
 #endif
-        m_tlbMap.erase(tlbIt);
+            m_tlbMap.erase(tlbIt);
+        } else {
+            (*tlbIt).second = link.next;
+        }
+    }
+
+    if (link.next != TLB_LINK_END) {
+        m_tlbLinks[link.next].prev = link.prev;
+    }
+
+    link.generation = m_tlbGeneration - 1;
+}
+
+void S2EExecutionState::flushTlbCachePage(klee::ObjectState *objectState, int mmu_idx, int index)
+{
+    unsigned slot = mmu_idx * CPU_S2E_TLB_SIZE + index;
+    if (!objectState || !isTlbSlotValid(slot)) {
+        return;
+    }
+
+    removeTlbReference(objectState, slot);
+}
+
+void S2EExecutionState::flushTlbCacheVictimPage(klee::ObjectState *objectState, int mmu_idx, int index)
+{
+    unsigned slot = NB_MMU_MODES * CPU_S2E_TLB_SIZE + mmu_idx * CPU_S2E_VTLB_SIZE + index;
+    if (!objectState || !isTlbSlotValid(slot)) {
+        return;
+    }
+
+    removeTlbReference(objectState, slot);
+}
+
+void S2EExecutionState::swapTlbEntries(CPUArchState* env,
+                          int mmu_idx, int index, int vindex)
+{
+#ifdef S2E_ENABLE_S2E_TLB
+    const unsigned count = CPU_S2E_TLB_SIZE / CPU_TLB_SIZE;
+
+    for (unsigned i = 0; i < count; ++i) {
+        unsigned slot = mmu_idx * CPU_S2E_TLB_SIZE + index * count + i;
+        unsigned vslot = NB_MMU_MODES * CPU_S2E_TLB_SIZE +
+                         mmu_idx * CPU_S2E_VTLB_SIZE + vindex * count + i;
+
+        S2ETLBEntry *entry = getTlbEntry(env, slot);
+        S2ETLBEntry *ventry = getTlbEntry(env, vslot);
+
+        ObjectState *os = isTlbSlotValid(slot) ?
+                    static_cast<ObjectState*>(entry->objectState) : NULL;
+        ObjectState *vos = isTlbSlotValid(vslot) ?
+                    static_cast<ObjectState*>(ventry->objectState) : NULL;
+
+        if (os) {
+            removeTlbReference(os, slot);
+        }
+        if (vos) {
+            removeTlbReference(vos, vslot);
+        }
+
+        std::swap(*entry, *ventry);
+
+        if (vos) {
+            addTlbReference(vos, slot);
+        } else {
+            entry->objectState = NULL;
+        }
+
+        if (os) {
+            addTlbReference(os, vslot);
+        } else {
+            ventry->objectState = NULL;
+        }
     }
+#endif
 }
 
 void S2EExecutionState::updateTlbEntry(CPUArchState* env,
@@ -2050,17 +2519,16 @@ void S2EExecutionState::updateTlbEntry(CPUArchState* env,
     unsigned int index = (virtAddr >> S2E_RAM_OBJECT_BITS) & (CPU_S2E_TLB_SIZE - 1);
     for(int i = 0; i < CPU_S2E_TLB_SIZE / CPU_TLB_SIZE; ++i) {
         S2ETLBEntry* entry = &env->s2e_tlb_table[mmu_idx][index];
-        ObjectState *oldObjectState = static_cast<ObjectState *>(entry->objectState);
+        ObjectState *oldObjectState = isTlbSlotValid(mmu_idx * CPU_S2E_TLB_SIZE + index) ?
+                    static_cast<ObjectState *>(entry->objectState) : NULL;
 
         ObjectPair op;
 
         if (!ops || !(op = ops[i]).first) {
-            op = m_memcache.get(hostAddr);
-            if (!op.first) {
-                op = addressSpace.findObject(hostAddr);
-            }
+            op = findRamObject(hostAddr);
         }
-        assert(op.first && op.second && op.second->getObject() == op.first && op.first->address == hostAddr);
+        assert(op.first && op.second && op.second->getObject() == op.first &&
+               hostAddr - op.first->address < op.first->size);
 
         klee::ObjectState *ros = const_cast<ObjectState*>(op.second);
 
@@ -2071,7 +2539,8 @@ void S2EExecutionState::updateTlbEntry(CPUArchState* env,
             // XXX: for now we always ensure that all pages in TLB are writable
             klee::ObjectState *wos = addressSpace.getWriteable(op.first, op.second);
             entry->objectState = wos;
-            entry->addend = ((uintptr_t) wos->getConcreteStore(true) - virtAddr) | 1;
+            entry->addend = ((uintptr_t) wos->getConcreteStore(true) +
+                             (hostAddr - op.first->address) - virtAddr) | 1;
         }
 
         op = ObjectPair(op.first, (const ObjectState*)entry->objectState);
@@ -2089,7 +2558,8 @@ void S2EExecutionState::updateTlbEntry(CPUArchState* env,
 #endif
         if (oldObjectState != ros) {
             flushTlbCachePage(oldObjectState, mmu_idx, index);
-            m_tlbMap[const_cast<ObjectState *>(op.second)].push_back(TlbCoordinates(mmu_idx, index));
+            addTlbReference(const_cast<ObjectState *>(op.second),
+                            mmu_idx * CPU_S2E_TLB_SIZE + index);
         }
 
         index += 1;
@@ -2114,6 +2584,26 @@ void S2EExecutionState::writeDirtyMask(uint64_t host_address, uint8_t val)
     m_dirtyMaskObject->write8(host_address, val);
 }
 
+uint64_t S2EExecutionState::watchPageWrites(uint64_t address)
+{
+    uint64_t hostAddress = getHostAddress(address);
+    if (hostAddress == (uint64_t) -1) {
+        return (uint64_t) -1;
+    }
+
+    hostAddress &= TARGET_PAGE_MASK;
+    if (s2e_watch_page_writes(hostAddress) < 0) {
+        return (uint64_t) -1;
+    }
+
+    return hostAddress;
+}
+
+bool S2EExecutionState::wasPageWritten(uint64_t hostPage)
+{
+    return s2e_is_page_written(hostPage);
+}
+
 void S2EExecutionState::addConstraint(klee::ref<klee::Expr> e)
 {
     if (DebugConstraints) {
@@ -2199,6 +2689,12 @@ void s2e_write_ram_concrete(S2E *s2e, S2EExecutionState *state,
     state->writeRamConcrete(host_address, buf, size);
 }
 
+void s2e_map_ram_concrete(S2E *s2e, S2EExecutionState *state,
+                          uint64_t host_address, uint64_t size)
+{
+    state->mapRamConcrete(host_address, size);
+}
+
 void s2e_read_register_concrete(S2E* s2e, S2EExecutionState* state,
         CPUArchState* cpuState, unsigned offset, uint8_t* buf, unsigned size)
 {
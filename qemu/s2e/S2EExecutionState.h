@@ -38,11 +38,14 @@
 
 #include <klee/ExecutionState.h>
 #include <klee/Memory.h>
+#include <klee/Internal/ADT/ImmutableSet.h>
 #include <cpu.h>
 #include "S2EDeviceState.h"
+#include "S2ECheckpoint.h"
 #include "S2EStatsTracker.h"
 #include "MemoryCache.h"
 #include "s2e_config.h"
+#include "Plugin.h"
 
 /** S2E_TARGET_CONC_LIMIT defines the border between concrete and symbolic area.
  *  Eg. regs[15] is in concrete-only-area for ARM targets.
@@ -86,8 +89,8 @@ class S2EDeviceState;
 class S2EExecutionState;
 struct S2ETranslationBlock;
 
-//typedef std::tr1::unordered_map<const Plugin*, PluginState*> PluginStateMap;
-typedef std::map<const Plugin*, PluginState*> PluginStateMap;
+//Plugin states indexed by Plugin::getPluginIndex(), NULL if not created yet
+typedef std::vector<PluginState*> PluginStateArray;
 typedef PluginState* (*PluginStateFactory)(Plugin *p, S2EExecutionState *s);
 
 typedef MemoryCachePool<klee::ObjectPair,
@@ -111,13 +114,15 @@ class S2EExecutionState : public klee::ExecutionState
 {
 protected:
     friend class S2EExecutor;
+    friend class StateWriter;
+    friend class StateReader;
 
     static unsigned s_lastSymbolicId;
 
     /** Unique numeric ID for the state */
     int m_stateID;
 
-    PluginStateMap m_PluginState;
+    PluginStateArray m_PluginState;
 
     bool m_symbexEnabled;
 
@@ -145,6 +150,16 @@ protected:
     */
     bool m_runningConcrete;
 
+    /** Registers that may differ between the registers object and the
+        native CPU state while running symbolically, with the bits of the
+        TCG register masks (see getSymbolicRegistersMask). Any other bit
+        stands for the whole object. switchToConcrete() copies only these
+        registers to the native CPU state. */
+    uint64_t m_dirtyRegisters;
+
+    void markRegistersDirty(unsigned offset, unsigned size);
+    void copyDirtyRegisters();
+
     typedef std::set<std::pair<uint64_t,uint64_t> > ToRunSymbolically;
     ToRunSymbolically m_toRunSymbolically;
 
@@ -174,21 +189,76 @@ protected:
 
     uint64_t m_lastMergeICount;
 
+    /** Hash of the fork decisions taken on the path of this state
+        and their number (see -path-partition-count) */
+    uint64_t m_forkPathHash;
+    unsigned m_forkDepth;
+
+    /** Fork decisions of the path, only recorded with -checkpoint-interval */
+    ForkHistory *m_forkHistory;
+
+    /** Recorded decisions left to follow when resuming a checkpoint,
+        NULL once the state reached its position in the checkpoint */
+    const ExplorationCheckpoint::Node *m_replayNode;
+
+    /** Memory objects whose binding changed since the start of the
+        execution. Objects outside the sets of two states are bound to
+        the same ObjectState in both, merge() only compares the others.
+        Immutable so that forking does not copy it. */
+    typedef klee::ImmutableSet<const klee::MemoryObject*, klee::MemoryObjectLT> ChangedObjects;
+    ChangedObjects m_changedObjects;
+
     bool m_needFinalizeTBExec;
 
     unsigned m_nextSymbVarId;
 
     S2EStateStats m_stats;
 
+    /** Bytes of the object states copied on write since the last fork */
+    uint64_t m_copyOnWriteBytes;
+
+    /** Bytes copied by doStateSwitch() the last time it activated the state */
+    uint64_t m_stateSwitchBytes;
+
     /**
-     * The following optimizes tracks the location of every ObjectState
+     * The following tracks the location of every ObjectState
      * in the TLB in order to optimize TLB updates.
+     * m_tlbMap maps an ObjectState to the first TLB slot that refers to it.
+     * The other slots referring to the same ObjectState are chained
+     * through m_tlbLinks, which has one entry per TLB slot
+     * (slot = mmu_idx * CPU_S2E_TLB_SIZE + index in the main TLB, followed
+     * by the slots of the victim TLB).
+     * A slot is only valid if its generation is m_tlbGeneration, which
+     * lets flushTlbCache() drop all the slots at once.
      */
-    typedef std::pair<unsigned int, unsigned int> TlbCoordinates;
-    typedef llvm::SmallVector<TlbCoordinates, 8> ObjectStateTlbReferences;
-    typedef std::tr1::unordered_map<klee::ObjectState *, ObjectStateTlbReferences> TlbMap;
+#if NB_MMU_MODES * (CPU_S2E_TLB_SIZE + CPU_S2E_VTLB_SIZE) < 0xffff
+    typedef uint16_t TlbSlot;
+#else
+    typedef uint32_t TlbSlot;
+#endif
+
+    struct TlbLink {
+        TlbSlot prev, next;
+        uint16_t generation;
+    };
+
+    static const TlbSlot TLB_LINK_END = (TlbSlot) -1;
+    static const unsigned TLB_SLOT_COUNT =
+            NB_MMU_MODES * (CPU_S2E_TLB_SIZE + CPU_S2E_VTLB_SIZE);
+
+    typedef std::tr1::unordered_map<klee::ObjectState *, unsigned> TlbMap;
 
     TlbMap m_tlbMap;
+    std::vector<TlbLink> m_tlbLinks;
+    uint16_t m_tlbGeneration;
+
+    bool isTlbSlotValid(unsigned slot) const {
+        return slot < m_tlbLinks.size() &&
+               m_tlbLinks[slot].generation == m_tlbGeneration;
+    }
+
+    void addTlbReference(klee::ObjectState *objectState, unsigned slot);
+    void removeTlbReference(klee::ObjectState *objectState, unsigned slot);
 
     /** Set when execution enters doInterrupt, reset when it exits. */
     bool m_runningExceptionEmulationCode;
@@ -201,6 +271,9 @@ protected:
     std::string getUniqueVarName(const std::string &name);
 
 public:
+    /** Notifies the plugins of each solver query, see onSolverQuery */
+    void addQueryCost(uint64_t usec) const;
+
     enum AddressType {
         VirtualAddress, PhysicalAddress, HostAddress
     };
@@ -210,6 +283,42 @@ public:
 
     int getID() const { return m_stateID; }
 
+    /** Number of forks on the path of this state */
+    unsigned getForkDepth() const { return m_forkDepth; }
+
+    struct MemoryUsage {
+        /** Object states owned by this state, without and with symbolic bytes */
+        uint64_t concreteBytes;
+        uint64_t symbolicBytes;
+        unsigned ownedObjects;
+
+        /** Object states still shared with other states */
+        uint64_t sharedBytes;
+        unsigned sharedObjects;
+
+        /** Path constraints and the distinct expressions they are made of */
+        unsigned constraints;
+        uint64_t constraintNodes;
+
+        /** Sum of PluginState::getMemoryUsage(), divided among the sharing states */
+        uint64_t pluginStateBytes;
+
+        MemoryUsage() : concreteBytes(0), symbolicBytes(0), ownedObjects(0),
+            sharedBytes(0), sharedObjects(0), constraints(0), constraintNodes(0),
+            pluginStateBytes(0) {}
+    };
+
+    /** Computes the memory used by the state. This walks the address space,
+        the constraints and the plugin states, do not call it on every
+        instruction. */
+    void getMemoryUsage(MemoryUsage &usage) const;
+
+    /** Bytes copied on write since the state was last forked */
+    uint64_t getCopyOnWriteBytes() const { return m_copyOnWriteBytes; }
+
+    /** Bytes copied by the last switch to this state */
+    uint64_t getStateSwitchBytes() const { return m_stateSwitchBytes; }
+
     S2EDeviceState *getDeviceState() {
         return &m_deviceState;
     }
@@ -220,14 +329,57 @@ public:
     /*************************************************/
 
     PluginState* getPluginState(Plugin *plugin, PluginStateFactory factory) {
-        PluginStateMap::iterator it = m_PluginState.find(plugin);
-        if (it == m_PluginState.end()) {
-            PluginState *ret = factory(plugin, this);
+        unsigned index = plugin->getPluginIndex();
+        assert(index != (unsigned) -1 && "Plugin is not active");
+
+        if (index >= m_PluginState.size()) {
+            m_PluginState.resize(index + 1, NULL);
+        }
+
+        PluginState *ret = m_PluginState[index];
+        if (!ret) {
+            ret = factory(plugin, this);
             assert(ret);
-            m_PluginState[plugin] = ret;
+            m_PluginState[index] = ret;
             return ret;
         }
-        return (*it).second;
+
+        if (ret->m_sharedCount) {
+            // Another state still references this copy, get a private one
+            --ret->m_sharedCount;
+            ret = ret->clone();
+            assert(ret);
+            m_PluginState[index] = ret;
+        }
+        return ret;
+    }
+
+    /** Plugin state of the plugin if this state has one, NULL otherwise.
+        A plugin state shared with other execution states is copied. */
+    PluginState* getWritablePluginState(Plugin *plugin) {
+        unsigned index = plugin->getPluginIndex();
+        if (index >= m_PluginState.size() || !m_PluginState[index]) {
+            return NULL;
+        }
+
+        PluginState *ret = m_PluginState[index];
+        if (ret->m_sharedCount) {
+            --ret->m_sharedCount;
+            ret = ret->clone();
+            assert(ret);
+            m_PluginState[index] = ret;
+        }
+        return ret;
+    }
+
+    /** Same as getPluginState(), but a plugin state shared with
+        other execution states is returned without being copied. */
+    const PluginState* getPluginStateConst(Plugin *plugin, PluginStateFactory factory) {
+        unsigned index = plugin->getPluginIndex();
+        if (index >= m_PluginState.size() || !m_PluginState[index]) {
+            return getPluginState(plugin, factory);
+        }
+        return m_PluginState[index];
     }
 
     /** Returns true if this is the active state */
@@ -268,6 +420,10 @@ public:
     /** Handler for tcg_llvm_make_symbolic, tcg_llvm_get_value. */
     void makeSymbolic(std::vector< klee::ref<klee::Expr> > &args,
                       bool makeConcolic);
+    /** Handler for tcg_llvm_make_symbolic_io, the value comes from
+        CorePlugin::createSymbolicHardwareValue */
+    void makeSymbolicIo(std::vector< klee::ref<klee::Expr> > &args);
+    std::string readKleeLabel(klee::ref<klee::Expr> kleeAddressExpr);
     void kleeReadMemory(klee::ref<klee::Expr> kleeAddressExpr,
                         uint64_t sizeInBytes,
                         std::vector<klee::ref<klee::Expr> > *result,
@@ -332,6 +488,11 @@ public:
     /** Return true if hostAddr is registered as a RAM with KLEE */
     bool isRamSharedConcrete(uint64_t hostAddress);
 
+    /** Return the RAM object that contains hostAddress. Objects are
+        S2E_RAM_OBJECT_SIZE bytes, except in shared-concrete regions
+        which may use objects of up to one page (see registerRam) */
+    klee::ObjectPair findRamObject(uint64_t hostAddress) const;
+
 
     /** Read value from memory, returning false if the value is symbolic */
     bool readMemoryConcrete(uint64_t address, void *buf, uint64_t size,
@@ -341,6 +502,30 @@ public:
     bool writeMemoryConcrete(uint64_t address, void *buf,
                              uint64_t size, AddressType addressType=VirtualAddress);
 
+    /** Bulk read of size bytes. Address translation and object lookup
+        are done once per page, fully concrete pages are memcpy'ed.
+        If symbolicBytes is not NULL, it is resized to size and receives
+        the expressions of the symbolic bytes (null refs for concrete
+        ones); otherwise the read fails on the first symbolic byte.
+        Returns false if some address can not be translated. */
+    bool readMemoryBulk(uint64_t address, uint8_t *buf, uint64_t size,
+                  std::vector<klee::ref<klee::Expr> > *symbolicBytes = NULL,
+                  AddressType addressType = VirtualAddress) const;
+
+    /** Bulk write of concrete bytes, one translation and one
+        copy-on-write per page */
+    bool writeMemoryBulk(uint64_t address, const uint8_t *buf, uint64_t size,
+                         AddressType addressType = VirtualAddress);
+
+    /** Makes a guest buffer symbolic, with one translation and one
+        copy-on-write per page. The bytes are reads of a new array,
+        created as by createConcolicArray, or as by createSymbolicArray
+        if concreteBuffer is empty. Returns NULL without
+        modifying the memory if some address can not be translated. */
+    const klee::Array *makeSymbolicBulk(uint64_t address, unsigned size,
+                         const std::string &name,
+                         std::vector<unsigned char> &concreteBuffer,
+                         AddressType addressType = VirtualAddress);
 
 
     /** Read from physical memory, switching to symbex if
@@ -357,6 +542,9 @@ public:
     /** Write concrete data to RAM. Optimized for host addresses */
     void writeRamConcrete(uint64_t hostAddress, const uint8_t* buf, uint64_t size);
 
+    /** Use the host memory as concrete store of the RAM objects in the range */
+    void mapRamConcrete(uint64_t hostAddress, uint64_t size);
+
     /** Read from CPU state. Concretize if necessary */
     void readRegisterConcrete(
             CPUArchState *cpuState, unsigned offset, uint8_t* buf, unsigned size);
@@ -421,6 +609,13 @@ public:
     void writeDirtyMask(uint64_t host_address, uint8_t val);
     void registerDirtyMask(uint64_t host_address, uint64_t size);
 
+    /** Makes the next guest write to the page containing the virtual
+        address visible to wasPageWritten. Returns the host address of the
+        page or -1 if the address is not mapped to RAM. Writes done by
+        plugins through writeMemory are not tracked. */
+    uint64_t watchPageWrites(uint64_t address);
+    bool wasPageWritten(uint64_t hostPage);
+
     CPUArchState *getConcreteCpuState() const;
 
     virtual void addConstraint(klee::ref<klee::Expr> e);
@@ -444,6 +639,12 @@ public:
                 unsigned size,
                 std::vector<unsigned char> &concreteBuffer);
 
+private:
+    const klee::Array *createArray(const std::string &name, unsigned size,
+                                   std::vector<unsigned char> &concreteBuffer);
+
+public:
+
     /** Debug functions **/
     void dumpCpuState(llvm::raw_ostream &os) const;
 
@@ -456,6 +657,10 @@ public:
     void clearTlbOwnership();
 
     void flushTlbCachePage(klee::ObjectState *objectState, int mmu_idx, int index);
+    void flushTlbCacheVictimPage(klee::ObjectState *objectState, int mmu_idx, int index);
+
+    /** Swap the entries of page index with those of victim entry vindex */
+    void swapTlbEntries(CPUArchState* env, int mmu_idx, int index, int vindex);
 };
 
 //Some convenience macros
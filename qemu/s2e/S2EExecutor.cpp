@@ -46,6 +46,7 @@ extern "C" {
 #include <ioport.h>
 #include <sysemu.h>
 #include <cpus.h>
+#include <helper.h>
 
 extern CPUArchState *env;
 void QEMU_NORETURN raise_exception(int exception_index);
@@ -69,6 +70,8 @@ void s2e_do_interrupt_all(int intno, int is_int, int error_code,
 
 uint64_t helper_set_cc_op_eflags(void);
 
+void vga_hw_screen_dump(const char *filename);
+
 }
 
 #ifndef __APPLE__
@@ -83,8 +86,13 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <s2e/Plugins/CorePlugin.h>
 
 #include <s2e/S2EDeviceState.h>
+#include <s2e/S2ECheckpoint.h>
+#include <s2e/S2EStateSerializer.h>
 #include <s2e/SelectRemovalPass.h>
+#include <s2e/CpuStatePromotionPass.h>
 #include <s2e/S2EStatsTracker.h>
+#include <s2e/SlabExprAllocator.h>
+#include <s2e/SlabObjectStateAllocator.h>
 
 //XXX: Remove this from executor
 #include <s2e/Plugins/ModuleExecutionDetector.h>
@@ -103,6 +111,7 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/Process.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #include <klee/PTree.h>
 #include <klee/Memory.h>
@@ -111,11 +120,15 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <klee/UserSearcher.h>
 #include <klee/CoreStats.h>
 #include <klee/TimerStatIncrementer.h>
+#include <klee/Internal/Support/PerfCounters.h>
 #include <klee/Solver.h>
+#include <klee/util/ExprPPrinter.h>
 
 #include <llvm/Support/TimeValue.h>
 
 #include <vector>
+#include <algorithm>
+#include <map>
 
 #include <sstream>
 
@@ -123,6 +136,14 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <windows.h>
 #else
 #include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#endif
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sched.h>
 #endif
 
 #include <tr1/functional>
@@ -158,23 +179,57 @@ namespace {
             cl::desc("Remove Select statements from LLVM code"),
             cl::init(false));
 
+    cl::opt<bool>
+    PromoteCpuState("promote-cpu-state",
+            cl::desc("Forward the CPU state fields of translated blocks within basic blocks and remove their redundant stores"),
+            cl::init(true));
+
     cl::opt<bool>
     StateSharedMemory("state-shared-memory",
             cl::desc("Allow unimportant memory regions (like video RAM) to be shared between states"),
             cl::init(false));
 
 
+    cl::opt<bool>
+    Headless("headless",
+            cl::desc("Do not refresh the display while there are several states, and share video RAM between states like --state-shared-memory"),
+            cl::init(false));
+
+    cl::opt<bool>
+    SkipIdleTime("skip-idle-time",
+            cl::desc("When the guest CPU halts, advance the virtual clock to the next timer instead of waiting for it"),
+            cl::init(false));
+
+    cl::opt<unsigned>
+    StateReclaimBudget("state-reclaim-budget",
+            cl::desc("Maximum time in milliseconds spent freeing killed states at each state switch, the rest is freed at the next ones (0: no limit)"),
+            cl::init(0));
+
     cl::opt<bool>
     FlushTBsOnStateSwitch("flush-tbs-on-state-switch",
             cl::desc("Flush translation blocks when switching states -"
                      " disabling leads to faster but possibly incorrect execution"),
             cl::init(true));
 
+    //Translated blocks only depend on the guest code. When the two states
+    //share the same copy of a page, its blocks can be kept.
+    cl::opt<bool>
+    FlushTBsSelectively("flush-tbs-selectively",
+            cl::desc("On state switches, only invalidate the translation blocks"
+                     " of pages whose content may differ between the two states"),
+            cl::init(false));
+
     cl::opt<bool>
     KeepLLVMFunctions("keep-llvm-functions",
             cl::desc("Never delete generated LLVM functions"),
             cl::init(false));
 
+    cl::opt<bool>
+    PersistentCallHandler("persistent-call-handler",
+            cl::desc("Install the SIGSEGV handler of external calls once,"
+                     " instead of around each call"),
+            cl::init(false));
+
     //The default is true for two reasons:
     //1. Symbolic addresses are very expensive to handle
     //2. There is lazy forking which will eventually enumerate
@@ -186,6 +241,13 @@ namespace {
             cl::desc("Fork on each memory access with symbolic address"),
             cl::init(true));
 
+    //Lets KLEE resolve the offset of symbolic addresses in the page,
+    //see --max-symbolic-read-objects
+    cl::opt<bool>
+    ConcretizePageOnly("concretize-page-only",
+            cl::desc("Only concretize the page of symbolic addresses that hit the TLB, not the object"),
+            cl::init(false));
+
     cl::opt<bool>
     ConcretizeIoAddress("concretize-io-address",
             cl::desc("Concretize symbolic I/O addresses"),
@@ -217,6 +279,30 @@ namespace {
     UseFastHelpers("use-fast-helpers",
                    cl::desc("Replaces LLVM bitcode with fast symbolic-aware equivalent native helpers"),  cl::init(false));
 
+    cl::opt<bool>
+    ConcreteHelpers("concrete-helpers",
+                   cl::desc("Call the native version of helpers that do not access guest memory when their arguments and the CPU registers are concrete"),  cl::init(false));
+
+    cl::opt<bool>
+    ConcreteInterrupts("concrete-interrupts",
+                   cl::desc("Deliver interrupts and exceptions natively when the registers they use are concrete, even if other registers are symbolic"),  cl::init(false));
+
+    cl::opt<unsigned>
+    MaxSymbolicTbChain("max-symbolic-tb-chain",
+                   cl::desc("Maximum number of directly linked translation blocks that run in KLEE without returning to the cpu loop (0: return after each block)"),  cl::init(0));
+
+    cl::opt<unsigned>
+    TbHotThreshold("tb-hot-threshold",
+                   cl::desc("Fully optimize the LLVM code of a translation block once it ran this many times in KLEE. Until then, only the lowering passes are run (0: optimize all blocks right away)"),  cl::init(0));
+
+    cl::opt<unsigned>
+    HotLoopThreshold("hot-loop-threshold",
+                   cl::desc("Run a translation block natively once it ran this many times in KLEE, if it overwrites all the symbolic registers it touches before reading them (0: disabled)"),  cl::init(0));
+
+    cl::opt<std::string>
+    TbCodeCache("tb-code-cache",
+                   cl::desc("File where the optimized LLVM code of translation blocks is cached across runs"),  cl::init(""));
+
     cl::opt<unsigned>
     ClockSlowDown("clock-slow-down",
                    cl::desc("Slow down factor when interpreting LLVM code"),  cl::init(101));
@@ -224,6 +310,127 @@ namespace {
     cl::opt<unsigned>
     ClockSlowDownFastHelpers("clock-slow-down-fast-helpers",
                    cl::desc("Slow down factor when interpreting LLVM code and using fast helpers"),  cl::init(11));
+
+    cl::opt<unsigned>
+    SymbolicClockInsnTime("symbolic-clock-insn-time",
+                   cl::desc("Nanoseconds of guest time per instruction interpreted in KLEE, instead of "
+                            "slowing down the real time (0: use --clock-slow-down)"),  cl::init(0));
+
+    cl::opt<bool>
+    UseExprSlabAllocator("use-expr-slab-allocator",
+                   cl::desc("Allocate expression nodes from slabs that are released when states die"),  cl::init(false));
+
+    cl::opt<bool>
+    UseObjectSlabAllocator("use-object-slab-allocator",
+                   cl::desc("Allocate the concrete stores and masks of memory objects from slabs"),  cl::init(false));
+
+    cl::opt<bool>
+    ExprSlabArenas("expr-slab-arenas",
+                   cl::desc("Take slab pages from aligned 2MB huge-page arenas that are returned to the system when idle"),  cl::init(true));
+
+    cl::opt<bool>
+    LazyStateSwitch("lazy-state-switch",
+                   cl::desc("Copy shared concrete memory on first access after a state switch instead of eagerly"),  cl::init(false));
+
+    //Shared-concrete regions (video RAM, ROMs) never hold symbolic data.
+    //Splitting them in small objects only adds metadata and makes state
+    //switches save and restore them one small object at a time.
+    cl::opt<unsigned>
+    SharedRamObjectBits("shared-ram-object-bits",
+                   cl::desc("Log2 of the object size of shared-concrete RAM regions, up to the page size (0 uses the default object size)"),  cl::init(0));
+
+    cl::opt<bool>
+    IndexRamObjects("index-ram-objects",
+                   cl::desc("Look up the RAM objects in a radix tree instead of the ordered object map"),  cl::init(true));
+
+    //When enabled, instances publish their number of pending states
+    //in the shared memory area. Only the most loaded instance gives
+    //away work when a process slot becomes free, instead of whichever
+    //instance happens to reach the state switch timer first.
+    //Switching states restores the device state and copies the memory
+    //objects that do not live in the address space. When the average cost
+    //of a switch is high, the switch interval is lengthened for states that
+    //make progress so that switches take at most the given share of the
+    //wall time.
+    cl::opt<bool>
+    AutoTuneStateSwitch("auto-tune-state-switch",
+                   cl::desc("Adjust the state switch interval to bound the switching overhead"),  cl::init(false));
+
+    cl::opt<unsigned>
+    StateSwitchMaxOverhead("state-switch-max-overhead",
+                   cl::desc("Maximum percentage of the wall time spent switching states with -auto-tune-state-switch"),  cl::init(10));
+
+    cl::opt<unsigned>
+    StateSwitchMaxInterval("state-switch-max-interval",
+                   cl::desc("Maximum auto-tuned state switch interval in milliseconds"),  cl::init(5000));
+
+    //Independent instances started from the same snapshot explore
+    //disjoint subtrees without any communication. At the given fork depth,
+    //each instance keeps only the paths whose fork history hashes to its
+    //index. Paths that end before that depth are explored by all of them.
+    cl::opt<unsigned>
+    PathPartitionCount("path-partition-count",
+                   cl::desc("Number of instances that share the exploration by partitioning paths"),  cl::init(1));
+
+    cl::opt<unsigned>
+    PathPartitionIndex("path-partition-index",
+                   cl::desc("Index of this instance among -path-partition-count instances"),  cl::init(0));
+
+    cl::opt<unsigned>
+    PathPartitionDepth("path-partition-depth",
+                   cl::desc("Fork depth at which the paths are partitioned among the instances"),  cl::init(8));
+
+    //The fork decisions of the live states are enough to rebuild them
+    //in a new instance started from the same snapshot
+    cl::opt<unsigned>
+    CheckpointInterval("checkpoint-interval",
+                   cl::desc("Seconds between two checkpoints of the exploration, 0 to disable"),  cl::init(0));
+
+    cl::list<std::string>
+    ResumeCheckpoint("resume-checkpoint", cl::CommaSeparated,
+                   cl::desc("Checkpoint files whose states are rebuilt before exploring further"));
+
+    cl::opt<bool>
+    CheckpointStates("checkpoint-states",
+                   cl::desc("Also serialize the inactive states to states.dat at each checkpoint"),  cl::init(false));
+
+    //Copy-on-write only shares the pages that no state wrote to since the
+    //fork, identical copies written separately by several states are merged
+    cl::opt<unsigned>
+    DeduplicateObjectsInterval("deduplicate-objects-interval",
+                   cl::desc("Seconds between two scans for identical RAM objects of the inactive states, 0 to disable"),  cl::init(0));
+
+    cl::opt<bool>
+    LoadBalancingWorkStealing("load-balancing-work-stealing",
+                   cl::desc("Let free process slots steal states from the most loaded instance"),  cl::init(false));
+
+    cl::opt<bool>
+    LoadBalancingLeakStates("load-balancing-leak-states",
+                   cl::desc("Drop the states given away at a process fork without freeing them, "
+                            "to keep their memory shared with the other process"),  cl::init(false));
+
+    //The instances fork whenever a slot is free and they have states
+    //to give away. With autoscaling, the number of slots also depends
+    //on the memory left on the host and on the idle cores.
+    cl::opt<bool>
+    AutoScaleProcesses("autoscale-processes",
+                   cl::desc("Adjust the number of instances, up to -s2e-max-processes, to the free memory and cores of the host"),  cl::init(false));
+
+    cl::opt<unsigned>
+    AutoScaleInterval("autoscale-interval",
+                   cl::desc("Seconds between two updates of the number of instances with -autoscale-processes"),  cl::init(5));
+
+    cl::opt<unsigned>
+    AutoScaleReservedMemory("autoscale-reserved-memory",
+                   cl::desc("Memory in MB that -autoscale-processes leaves free on the host"),  cl::init(1024));
+
+    cl::opt<bool>
+    PinProcesses("pin-processes",
+                   cl::desc("Bind each instance to its own core"),  cl::init(false));
+
+    cl::opt<bool>
+    PerfCounterStats("s2e-perf-counters",
+                   cl::desc("Report hardware performance counters per execution mode in run.stats"),  cl::init(false));
 }
 
 //The logs may be flooded with messages when switching execution mode.
@@ -247,10 +454,20 @@ cl::opt<bool>
 ConcolicMode("use-concolic-execution",
                cl::desc("Concolic execution mode"),  cl::init(true));
 
+cl::opt<bool>
+ConcolicTraceOnly("concolic-trace-only",
+               cl::desc("Follow the concrete path without forking, log the path constraints in concolic-paths.kquery"),
+               cl::init(false));
+
 cl::opt<bool>
 DebugConstraints("debug-constraints",
                cl::desc("Check that added constraints are satisfiable"),  cl::init(false));
 
+cl::opt<bool>
+LazyPluginStateClone("lazy-plugin-state-clone",
+               cl::desc("Share plugin states between forked states until one of them accesses it"),
+               cl::init(true));
+
 
 
 
@@ -258,6 +475,7 @@ extern cl::opt<bool> UseExprSimplifier;
 
 extern "C" {
     int g_s2e_fork_on_symbolic_address = 0;
+    int g_s2e_concretize_page_only = 0;
     int g_s2e_concretize_io_addresses = 1;
     int g_s2e_concretize_io_writes = 1;
 
@@ -273,7 +491,7 @@ namespace s2e {
 /* Global array to hold tb function arguments */
 volatile void* tb_function_args[3];
 
-/* External dispatcher to convert QEMU s2e_longjmp's into C++ exceptions */
+/* External dispatcher to turn QEMU s2e_longjmp's into cpu exit requests */
 class S2EExternalDispatcher: public klee::ExternalDispatcher
 {
 protected:
@@ -283,7 +501,8 @@ public:
     S2EExternalDispatcher(ExecutionEngine* engine):
             ExternalDispatcher(engine) {}
 
-    void removeFunction(llvm::Function *f);
+    /** Removes the dispatchers of the calls made by the functions */
+    void removeFunctions(const std::set<llvm::Function*> &functions);
 };
 
 extern "C" {
@@ -292,14 +511,62 @@ extern "C" {
 static s2e_jmp_buf s2e_escapeCallJmpBuf;
 static s2e_jmp_buf s2e_cpuExitJmpBuf;
 
+/* Where the persistent SIGSEGV handler escapes to.
+   Only set while an external call is running. */
+static DEFINE_TLS(s2e_jmp_buf*, s2e_escapeCallTarget);
+
 #ifdef _WIN32
 static void s2e_ext_sigsegv_handler(int signal)
 {
 }
 #else
 static void s2e_ext_sigsegv_handler(int signal, siginfo_t *info, void *context) {
+  if (g_s2e->getExecutor()->handleLazyPageFault((uintptr_t) info->si_addr)) {
+      return;
+  }
   s2e_longjmp(s2e_escapeCallJmpBuf, 1);
 }
+
+static struct sigaction s2e_old_segv_action;
+static bool s2e_segv_handler_installed = false;
+
+/* Handles lazy state switching and protected external calls, and
+   forwards everything else to the previous handler */
+static void s2e_persistent_sigsegv_handler(int signal, siginfo_t *info, void *context) {
+  if (g_s2e->getExecutor()->handleLazyPageFault((uintptr_t) info->si_addr)) {
+      return;
+  }
+
+  s2e_jmp_buf *target = tls_var(s2e_escapeCallTarget);
+  if (target) {
+      tls_var(s2e_escapeCallTarget) = NULL;
+      s2e_longjmp(*target, 1);
+  }
+
+  if (s2e_old_segv_action.sa_flags & SA_SIGINFO) {
+      s2e_old_segv_action.sa_sigaction(signal, info, context);
+  } else if (s2e_old_segv_action.sa_handler == SIG_DFL ||
+             s2e_old_segv_action.sa_handler == SIG_IGN) {
+      //Let the faulting instruction crash the process
+      sigaction(SIGSEGV, &s2e_old_segv_action, NULL);
+  } else {
+      s2e_old_segv_action.sa_handler(signal);
+  }
+}
+
+static void s2e_install_persistent_segv_handler(void)
+{
+  if (s2e_segv_handler_installed) {
+      return;
+  }
+
+  struct sigaction segvAction;
+  memset(&segvAction, 0, sizeof(segvAction));
+  segvAction.sa_flags = SA_SIGINFO;
+  segvAction.sa_sigaction = s2e_persistent_sigsegv_handler;
+  sigaction(SIGSEGV, &segvAction, &s2e_old_segv_action);
+  s2e_segv_handler_installed = true;
+}
 #endif
 
 }
@@ -319,25 +586,45 @@ bool S2EExternalDispatcher::runProtectedCall(Function *f, uint64_t *args) {
   #ifdef _WIN32
   signal(SIGSEGV, s2e_ext_sigsegv_handler);
   #else
-  segvAction.sa_handler = 0;
-  memset(&segvAction.sa_mask, 0, sizeof(segvAction.sa_mask));
-  segvAction.sa_flags = SA_SIGINFO;
-  segvAction.sa_sigaction = s2e_ext_sigsegv_handler;
-  sigaction(SIGSEGV, &segvAction, &segvActionOld);
+  if (!PersistentCallHandler) {
+    segvAction.sa_handler = 0;
+    memset(&segvAction.sa_mask, 0, sizeof(segvAction.sa_mask));
+    segvAction.sa_flags = SA_SIGINFO;
+    segvAction.sa_sigaction = s2e_ext_sigsegv_handler;
+    sigaction(SIGSEGV, &segvAction, &segvActionOld);
+  }
   #endif
 
   memcpy(s2e_cpuExitJmpBuf, env->jmp_env, sizeof(env->jmp_env));
 
   if(s2e_setjmp(env->jmp_env)) {
+      tls_var(s2e_escapeCallTarget) = NULL;
       memcpy(env->jmp_env, s2e_cpuExitJmpBuf, sizeof(env->jmp_env));
-      throw CpuExitException();
+      #ifndef _WIN32
+      if (!PersistentCallHandler) {
+        sigaction(SIGSEGV, &segvActionOld, 0);
+      }
+      #endif
+      //Do not unwind through the interpreter frames, executeInstructions
+      //leaves the translation block once the call instruction completes.
+      g_s2e->getExecutor()->requestCpuExit();
+      return true;
   } else {
       if (s2e_setjmp(s2e_escapeCallJmpBuf)) {
         res = false;
+        #ifndef _WIN32
+        //The jump out of the handler left SIGSEGV blocked
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGSEGV);
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+        #endif
       } else {
         std::vector<GenericValue> gvArgs;
 
+        tls_var(s2e_escapeCallTarget) = &s2e_escapeCallJmpBuf;
         executionEngine->runFunction(f, gvArgs);
+        tls_var(s2e_escapeCallTarget) = NULL;
         res = true;
       }
   }
@@ -348,7 +635,9 @@ bool S2EExternalDispatcher::runProtectedCall(Function *f, uint64_t *args) {
 #warning Implement more robust signal handling on windows
   signal(SIGSEGV, SIG_IGN);
 #else
-  sigaction(SIGSEGV, &segvActionOld, 0);
+  if (!PersistentCallHandler) {
+    sigaction(SIGSEGV, &segvActionOld, 0);
+  }
 #endif
   return res;
 }
@@ -361,12 +650,15 @@ bool S2EExternalDispatcher::runProtectedCall(Function *f, uint64_t *args) {
  * representation. Failing to do so would leave stale references to
  * machine code in KLEE's external dispatcher.
  */
-void S2EExternalDispatcher::removeFunction(llvm::Function *f) {
+void S2EExternalDispatcher::removeFunctions(
+        const std::set<llvm::Function*> &functions) {
         dispatchers_ty::iterator it, itn;
 
         it = dispatchers.begin();
         while (it != dispatchers.end()) {
-            if ((*it).first->getParent()->getParent() == f) {
+            llvm::Function *f = const_cast<llvm::Function*>(
+                    (*it).first->getParent()->getParent());
+            if (functions.count(f)) {
 
                 llvm::Function *dispatcher = (*it).second;
                 executionEngine->freeMachineCodeForFunction(dispatcher);
@@ -425,7 +717,8 @@ void S2EExecutor::handlerTraceMemoryAccess(Executor* executor,
     assert(dynamic_cast<S2EExecutor*>(executor));
 
     S2EExecutor* s2eExecutor = static_cast<S2EExecutor*>(executor);
-    if(!s2eExecutor->m_s2e->getCorePlugin()->onDataMemoryAccess.empty()) {
+    CorePlugin *core = s2eExecutor->m_s2e->getCorePlugin();
+    if(core->isDataMemoryAccessTraced()) {
         assert(dynamic_cast<S2EExecutionState*>(state));
         S2EExecutionState* s2eState = static_cast<S2EExecutionState*>(state);
 
@@ -437,8 +730,38 @@ void S2EExecutor::handlerTraceMemoryAccess(Executor* executor,
 
         ref<Expr> value = klee::ExtractExpr::create(args[2], 0, width);
 
-        s2eExecutor->m_s2e->getCorePlugin()->onDataMemoryAccess.emit(
-                s2eState, args[0], args[1], value, isWrite, isIO);
+        if (!core->onDataMemoryAccessBatch.empty()) {
+            DataMemoryAccess access;
+            access.pc = s2eState->getPc();
+            access.address = 0;
+            access.hostAddress = 0;
+            access.value = 0;
+            access.size = Expr::getMinBytesForWidth(width);
+            access.flags = (isWrite ? DataMemoryAccess::WRITE : 0) |
+                           (isIO ? DataMemoryAccess::IO : 0);
+
+            if (klee::ConstantExpr *ce = dyn_cast<klee::ConstantExpr>(args[0])) {
+                access.address = ce->getZExtValue(64);
+            } else {
+                access.flags |= DataMemoryAccess::SYMBOLIC_ADDRESS;
+            }
+            if (klee::ConstantExpr *ce = dyn_cast<klee::ConstantExpr>(args[1])) {
+                access.hostAddress = ce->getZExtValue(64);
+            } else {
+                access.flags |= DataMemoryAccess::SYMBOLIC_HOST_ADDRESS;
+            }
+            if (width <= 64 && isa<klee::ConstantExpr>(value)) {
+                access.value = cast<klee::ConstantExpr>(value)->getZExtValue(64);
+            } else {
+                access.flags |= DataMemoryAccess::SYMBOLIC_VALUE;
+            }
+
+            core->recordDataMemoryAccess(s2eState, access);
+        }
+
+        if (!core->onDataMemoryAccess.empty()) {
+            core->onDataMemoryAccess.emit(s2eState, args[0], args[1], value, isWrite, isIO);
+        }
     }
 }
 
@@ -515,6 +838,38 @@ void S2EExecutor::handlerTracePortAccess(Executor* executor,
         s2eExecutor->m_s2e->getCorePlugin()->onPortAccess.emit(
                 s2eState, args[0], value, isWrite);
     }
+
+    if (cast<klee::ConstantExpr>(args[3])->getZExtValue() && isa<klee::ConstantExpr>(args[0])) {
+        CorePlugin *core = s2eExecutor->m_s2e->getCorePlugin();
+        uint64_t port = cast<klee::ConstantExpr>(args[0])->getZExtValue();
+
+        //Writes to symbolic ports do not reach the device
+        if (core->isPortSymbolic(port)) {
+            Expr::Width width = cast<klee::ConstantExpr>(args[2])->getZExtValue();
+            core->notifySymbolicHardwareWrite(static_cast<S2EExecutionState*>(state), false, port,
+                                              width / 8, klee::ExtractExpr::create(args[1], 0, width));
+        }
+    }
+}
+
+void S2EExecutor::handlerTraceMmioWrite(Executor* executor,
+                                        ExecutionState* state,
+                                        klee::KInstruction* target,
+                                        std::vector<klee::ref<klee::Expr> > &args)
+{
+    assert(args.size() == 3);
+    S2EExecutor* s2eExecutor = static_cast<S2EExecutor*>(executor);
+    S2EExecutionState* s2eState = static_cast<S2EExecutionState*>(state);
+
+    ref<Expr> address = args[0];
+    if (!isa<klee::ConstantExpr>(address)) {
+        address = s2eExecutor->toConstant(*state, address, "symbolic MMIO address");
+    }
+
+    Expr::Width width = cast<klee::ConstantExpr>(args[2])->getZExtValue();
+    s2eExecutor->m_s2e->getCorePlugin()->notifySymbolicHardwareWrite(
+            s2eState, true, cast<klee::ConstantExpr>(address)->getZExtValue(),
+            width / 8, klee::ExtractExpr::create(args[1], 0, width));
 }
 
 void S2EExecutor::handleForkAndConcretize(Executor* executor,
@@ -545,10 +900,10 @@ void S2EExecutor::handleForkAndConcretize(Executor* executor,
         assert(dyn_cast<klee::ConstantExpr>(concreteAddress) && "Could not evaluate address");
     } else {
         //Not in concolic mode, will have to invoke the constraint solver
-        //to compute a concrete value
+        //to compute a concrete value. The timing solver skips the query
+        //when the address does not depend on the path constraints.
         klee::ref<klee::ConstantExpr> value;
-        bool success = s2eExecutor->getSolver()->getValue(
-                Query(state->constraints, address), value);
+        bool success = s2eExecutor->getValue(*state, address, value);
 
         if (!success) {
             s2eExecutor->terminateStateEarly(*state, "Could not compute a concrete value for a symbolic address");
@@ -591,6 +946,15 @@ void S2EExecutor::handleMakeSymbolic(Executor* executor,
     s2eState->makeSymbolic(args, false);
 }
 
+void S2EExecutor::handleMakeSymbolicIo(Executor* executor,
+                                       ExecutionState* state,
+                                       klee::KInstruction* target,
+                                       std::vector< ref<Expr> > &args)
+{
+    S2EExecutionState* s2eState = static_cast<S2EExecutionState*>(state);
+    s2eState->makeSymbolicIo(args);
+}
+
 void S2EExecutor::handleGetValue(klee::Executor* executor,
                                  klee::ExecutionState* state,
                                  klee::KInstruction* target,
@@ -619,13 +983,38 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
                             InterpreterHandler *ie)
         : Executor(opts, ie, tcgLLVMContext->getExecutionEngine()),
           m_s2e(s2e), m_tcgLLVMContext(tcgLLVMContext),
+          m_lazyObjectsPerPage(0), m_lazyPageSize(0), m_lazyState(NULL),
+          m_tbState(NULL), m_exprAllocator(NULL), m_objectStateAllocator(NULL),
           m_executeAlwaysKlee(false), m_forkProcTerminateCurrentState(false),
-          m_inLoadBalancing(false), yieldedState(NULL)
+          m_cpuExitPending(false), m_inLoadBalancing(false),
+          m_lastProcessLimitUpdate(0), m_stateSwitchInterval(100),
+          m_stateSwitchCost(0), m_sliceState(NULL), m_sliceInstructions(0),
+          m_concolicPathLog(NULL), yieldedState(NULL),
+          m_resumedCheckpoint(NULL), m_lastCheckpointTime(0),
+          m_lastDeduplicationTime(0)
 {
+    memset(m_stateSwitchCosts, 0, sizeof(m_stateSwitchCosts));
+
     delete externalDispatcher;
     externalDispatcher = new S2EExternalDispatcher(
             tcgLLVMContext->getExecutionEngine());
 
+    //Never deleted, expressions may outlive the executor
+    if (UseExprSlabAllocator) {
+        m_exprAllocator = new SlabExprAllocator(ExprSlabArenas);
+        klee::Expr::setAllocator(m_exprAllocator);
+    }
+
+    if (UseObjectSlabAllocator) {
+        m_objectStateAllocator = new SlabObjectStateAllocator(ExprSlabArenas);
+        klee::ObjectState::setAllocator(m_objectStateAllocator);
+    }
+
+    //Must be set before the first object is bound
+    if (IndexRamObjects) {
+        AddressSpace::setFixedObjectBits(S2E_RAM_OBJECT_BITS);
+    }
+
     LLVMContext& ctx = m_tcgLLVMContext->getLLVMContext();
 
     // XXX: this will not work without creating JIT
@@ -647,6 +1036,7 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
     __DEFINE_EXT_VARIABLE(g_s2e_concretize_io_addresses)
     __DEFINE_EXT_VARIABLE(g_s2e_concretize_io_writes)
     __DEFINE_EXT_VARIABLE(g_s2e_fork_on_symbolic_address)
+    __DEFINE_EXT_VARIABLE(g_s2e_concretize_page_only)
 
     __DEFINE_EXT_VARIABLE(g_s2e_enable_mmio_checks)
 
@@ -702,6 +1092,7 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
 
     __DEFINE_EXT_FUNCTION(tlb_flush_page)
     __DEFINE_EXT_FUNCTION(tlb_flush)
+    __DEFINE_EXT_FUNCTION(tlb_victim_hit)
 
     __DEFINE_EXT_FUNCTION(io_readb_mmu)
     __DEFINE_EXT_FUNCTION(io_readw_mmu)
@@ -758,8 +1149,15 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
     }
 #endif
 
+    if(PromoteCpuState) {
+        m_tcgLLVMContext->getFunctionPassManager()->add(new CpuStatePromotionPass());
+    }
+
     if(UseSelectCleaner) {
         m_tcgLLVMContext->getFunctionPassManager()->add(new SelectRemovalPass());
+    }
+
+    if(PromoteCpuState || UseSelectCleaner) {
         m_tcgLLVMContext->getFunctionPassManager()->doInitialization();
     }
 
@@ -774,6 +1172,7 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
      * while testing the LLVM backend.
      * Symolic execution IS NOT SUPPORTED when running in LLVM mode!
      */
+    uint64_t helpersVersion = 0;
     if (!execute_llvm) {
         char* filename =  qemu_find_file(QEMU_FILE_TYPE_LIB, "op_helper.bc");
         assert(filename);
@@ -781,6 +1180,12 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
                 /* Optimize= */ true, /* CheckDivZero= */ false,
                 m_tcgLLVMContext->getFunctionPassManager());
 
+        /* Cached code is only valid for the helpers it was built with */
+        struct stat st;
+        if (stat(filename, &st) == 0) {
+            helpersVersion = ((uint64_t) st.st_mtime << 32) ^ st.st_size;
+        }
+
         g_free(filename);
     }
 
@@ -799,6 +1204,14 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
         disableConcreteLLVMHelpers();
     }
 
+    if (!execute_llvm && !TbCodeCache.empty()) {
+        if (!m_tcgLLVMContext->enableCodeCache(TbCodeCache.c_str(),
+                                               helpersVersion)) {
+            s2e->getWarningsStream() << "Could not open the code cache "
+                    << TbCodeCache << '\n';
+        }
+    }
+
     /* Add dummy TB function declaration */
     PointerType* tbFunctionArgTy =
             PointerType::get(IntegerType::get(ctx, 64), 0);
@@ -856,6 +1269,14 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
         function = kmodule->module->getFunction("tcg_llvm_make_symbolic");
         assert(function);
         addSpecialFunctionHandler(function, handleMakeSymbolic);
+
+        function = kmodule->module->getFunction("tcg_llvm_make_symbolic_io");
+        assert(function);
+        addSpecialFunctionHandler(function, handleMakeSymbolicIo);
+
+        function = kmodule->module->getFunction("tcg_llvm_trace_mmio_write");
+        assert(function);
+        addSpecialFunctionHandler(function, handlerTraceMmioWrite);
 #endif
 
         function = kmodule->module->getFunction("tcg_llvm_get_value");
@@ -872,6 +1293,10 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
             replaceExternalFunctionsWithSpecialHandlers();
         }
 
+        if (ConcreteHelpers) {
+            initializeConcreteHelpers();
+        }
+
         m_tcgLLVMContext->initializeHelpers();
     }
 
@@ -883,6 +1308,7 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
     m_forceConcretizations = false;
 
     g_s2e_fork_on_symbolic_address = ForkOnSymbolicAddress;
+    g_s2e_concretize_page_only = ConcretizePageOnly;
     g_s2e_concretize_io_addresses = ConcretizeIoAddress;
     g_s2e_concretize_io_writes = ConcretizeIoWrites;
 
@@ -897,10 +1323,25 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
         }
     }
 
+    if (PathPartitionCount == 0 || PathPartitionIndex >= PathPartitionCount) {
+        s2e->getWarningsStream()
+                << PathPartitionIndex.ArgStr << " must be lower than "
+                << PathPartitionCount.ArgStr << "\n";
+        exit(-1);
+    }
+
+    if (PinProcesses) {
+        pinCurrentProcess();
+    }
 }
 
 void S2EExecutor::initializeStatistics()
 {
+    //Counters are per thread, forked processes must open their own
+    if (PerfCounterStats && !PerfCounters::open()) {
+        m_s2e->getWarningsStream() << "Hardware performance counters are not available\n";
+    }
+
     if(StatsTracker::useStatistics()) {
         statsTracker =
                 new S2EStatsTracker(*this,
@@ -913,12 +1354,26 @@ void S2EExecutor::initializeStatistics()
 
 void S2EExecutor::flushTb() {
     tb_flush(env); // release references to TB functions
+    reclaimDeadFunctions();
 }
 
 S2EExecutor::~S2EExecutor()
 {
+    if (m_concolicPathLog) {
+        //Killed states were logged when they terminated
+        foreach2(it, states.begin(), states.end()) {
+            S2EExecutionState *state = static_cast<S2EExecutionState*>(*it);
+            if (!state->isZombie()) {
+                logConcolicPath(state);
+            }
+        }
+        delete m_concolicPathLog;
+    }
+
     if(statsTracker)
         statsTracker->done();
+
+    delete m_resumedCheckpoint;
 }
 
 S2EExecutionState* S2EExecutor::createInitialState()
@@ -941,7 +1396,9 @@ S2EExecutionState* S2EExecutor::createInitialState()
         statsTracker->framePushed(*state, 0);
 
     states.insert(state);
-    searcher->update(0, states, std::set<ExecutionState*>());
+    m_tbState = state;
+    searcher->update(0, std::set<ExecutionState*>(states.begin(), states.end()),
+                     std::set<ExecutionState*>());
 
     processTree = new PTree(state);
     state->ptreeNode = processTree->root;
@@ -1016,91 +1473,342 @@ void S2EExecutor::initializeExecution(S2EExecutionState* state,
 
     initTimers();
     initializeStateSwitchTimer();
-}
-
-void S2EExecutor::registerCpu(S2EExecutionState *initialState,
-                              CPUArchState *cpuEnv)
-{
-    std::cout << std::hex
-            << "Adding CPU (addr = " << std::hex << cpuEnv
-              << ", size = 0x" << sizeof(*cpuEnv) << ")"
-              << std::dec << '\n';
+    initializeLazyStateSwitch();
 
-    /* Add registers and eflags area as a true symbolic area */
+#ifndef _WIN32
+    if (PersistentCallHandler) {
+        s2e_install_persistent_segv_handler();
+    }
+#endif
 
-    initialState->m_cpuRegistersState =
-        addExternalObject(*initialState, cpuEnv, CPU_CONC_LIMIT,
-                      /* isReadOnly = */ false,
-                      /* isUserSpecified = */ false,
-                      /* isSharedConcrete = */ false);
+    //All the states descend from this one, changes are tracked from here
+    state->m_changedObjects = S2EExecutionState::ChangedObjects();
 
+    if (!ResumeCheckpoint.empty()) {
+        loadCheckpoints(state);
+    }
 
-    initialState->m_cpuRegistersState->setName("CpuRegistersState");
+    if (CheckpointInterval) {
+        m_lastCheckpointTime = llvm::sys::TimeValue::now().seconds();
+        m_s2e->getCorePlugin()->onTimer.connect(
+                sigc::mem_fun(*this, &S2EExecutor::onCheckpointTimer));
+    }
 
-    /* Add the rest of the structure as concrete-only area */
-    initialState->m_cpuSystemState =
-        addExternalObject(*initialState,
-                      ((uint8_t*)cpuEnv) + CPU_CONC_LIMIT,
-                      sizeof(CPUArchState) - CPU_CONC_LIMIT,
-                      /* isReadOnly = */ false,
-                      /* isUserSpecified = */ true,
-                      /* isSharedConcrete = */ true);
+    if (DeduplicateObjectsInterval) {
+        m_lastDeduplicationTime = llvm::sys::TimeValue::now().seconds();
+        m_s2e->getCorePlugin()->onTimer.connect(
+                sigc::mem_fun(*this, &S2EExecutor::onDeduplicationTimer));
+    }
+}
 
-    initialState->m_cpuSystemState->setName("CpuSystemState");
+/**
+ * The plugins restore their progress first, then the initial state
+ * follows the recorded fork decisions (see replayForkedStates).
+ */
+void S2EExecutor::loadCheckpoints(S2EExecutionState *initialState)
+{
+    m_resumedCheckpoint = new ExplorationCheckpoint();
 
-    m_saveOnContextSwitch.push_back(initialState->m_cpuSystemState);
+    foreach2(it, ResumeCheckpoint.begin(), ResumeCheckpoint.end()) {
+        CheckpointSections sections;
+        if (!m_resumedCheckpoint->read(*it, sections)) {
+            m_s2e->getWarningsStream() << "Could not read checkpoint " << *it << '\n';
+            exit(-1);
+        }
+        m_s2e->getCorePlugin()->onCheckpointRestore.emit(sections);
+    }
 
-    const ObjectState *cpuSystemObject = initialState->addressSpace
-                                .findObject(initialState->m_cpuSystemState);
-    const ObjectState *cpuRegistersObject = initialState->addressSpace
-                                .findObject(initialState->m_cpuRegistersState);
+    m_s2e->getMessagesStream() << "Rebuilding " << m_resumedCheckpoint->getFrontierSize()
+            << " checkpointed states" << '\n';
 
-    initialState->m_cpuRegistersObject = initialState->addressSpace
-        .getWriteable(initialState->m_cpuRegistersState, cpuRegistersObject);
-    initialState->m_cpuSystemObject = initialState->addressSpace
-        .getWriteable(initialState->m_cpuSystemState, cpuSystemObject);
+    if (!m_resumedCheckpoint->getRoot()->children.empty()) {
+        initialState->m_replayNode = m_resumedCheckpoint->getRoot();
+    }
 }
 
+void S2EExecutor::onCheckpointTimer()
+{
+    uint64_t now = llvm::sys::TimeValue::now().seconds();
+    if (now - m_lastCheckpointTime < CheckpointInterval) {
+        return;
+    }
+
+    m_lastCheckpointTime = now;
+    writeCheckpoint();
+}
 
-void S2EExecutor::registerRam(S2EExecutionState *initialState,
-                        uint64_t startAddress, uint64_t size,
-                        uint64_t hostAddress, bool isSharedConcrete,
-                        bool saveOnContextSwitch, const char *name)
+void S2EExecutor::onDeduplicationTimer()
 {
-    assert(isSharedConcrete || !saveOnContextSwitch);
-    assert(startAddress == (uint64_t) -1 ||
-           (startAddress & ~TARGET_PAGE_MASK) == 0);
-    assert((size & ~TARGET_PAGE_MASK) == 0);
-    assert((hostAddress & ~TARGET_PAGE_MASK) == 0);
+    uint64_t now = llvm::sys::TimeValue::now().seconds();
+    if (now - m_lastDeduplicationTime < DeduplicateObjectsInterval) {
+        return;
+    }
 
-    m_s2e->getDebugStream()
-              << "Adding memory block (startAddr = " << hexval(startAddress)
-              << ", size = " << hexval(size) << ", hostAddr = " << hexval(hostAddress)
-              << ", isSharedConcrete=" << isSharedConcrete << ", name=" << name << ")\n";
+    m_lastDeduplicationTime = now;
+    deduplicateObjects();
+}
 
-#ifdef DEBUG_TLB
-    qemu_log("ALLOCATE RAM of size=%"PRIu64"\n",size);
-    qemu_log("\t start address: %"PRIx64".\n", startAddress);
-    qemu_log("\t host_address: %"PRIx64".\n", hostAddress);
-#endif
+static bool canDeduplicate(const ObjectState *os)
+{
+    return !os->readOnly && !os->hasExternalConcreteStore() &&
+           !os->getObject()->isSharedConcrete && os->isAllConcrete();
+}
 
-    for(uint64_t addr = hostAddress; addr < hostAddress+size;
-                 addr += S2E_RAM_OBJECT_SIZE) {
-        std::stringstream ss;
+/**
+ *  Merges the identical concrete copies of each RAM object among the
+ *  inactive states. The states then share one copy that none of them
+ *  owns, the next write to it copies it again. The active state is left
+ *  alone, QEMU may hold pointers to its objects.
+ */
+void S2EExecutor::deduplicateObjects()
+{
+    typedef std::pair<const ObjectState*, S2EExecutionState*> Copy;
+    typedef std::map<uint64_t, Copy> Copies;
 
-        ss << name << "_" << std::hex << (addr-hostAddress);
+    uint64_t merged = 0;
+    uint64_t reclaimed = 0;
 
-        MemoryObject *mo = addExternalObject(
-                *initialState, (void*) addr, S2E_RAM_OBJECT_SIZE, false,
-                /* isUserSpecified = */ true, isSharedConcrete,
-                isSharedConcrete && !saveOnContextSwitch && StateSharedMemory);
+    foreach2(it, m_perStateRam.begin(), m_perStateRam.end()) {
+        const MemoryObject *mo = *it;
+        if (mo == S2EExecutionState::m_dirtyMask) {
+            continue;
+        }
 
-#ifdef DEBUG_TLB
-        qemu_log("\t mo address: %"PRIx64".\n", mo);
+        //The first copy of each content seen among the states
+        Copies copies;
 
-        //get concrete store just for debugging
-        ObjectPair op = initialState->addressSpace.findObject(addr);
-        ObjectState* wos =
+        foreach2(sit, states.begin(), states.end()) {
+            S2EExecutionState *state = static_cast<S2EExecutionState*>(*sit);
+            if (state->m_active || state->isZombie()) {
+                continue;
+            }
+
+            const ObjectState *os = state->addressSpace.findObject(mo);
+            if (!os || !canDeduplicate(os)) {
+                continue;
+            }
+
+            uint64_t hash = state->addressSpace.getObjectHash(os);
+            Copies::iterator cit = copies.find(hash);
+            if (cit == copies.end()) {
+                copies[hash] = Copy(os, state);
+                continue;
+            }
+
+            const ObjectState *canonical = (*cit).second.first;
+            if (canonical == os ||
+                memcmp(canonical->getConcreteStore(), os->getConcreteStore(), mo->size)) {
+                continue;
+            }
+
+            S2EExecutionState *owner = (*cit).second.second;
+            if (owner->addressSpace.isOwnedByUs(canonical)) {
+                owner->addressSpace.disownObject(mo, canonical);
+            }
+
+            //The address space holds the last reference to its copy
+            if (os->getRefCount() == 1) {
+                reclaimed += os->getMemoryUsage();
+            }
+
+            state->addressSpace.shareObject(mo, canonical);
+            ++merged;
+        }
+    }
+
+    stats::deduplicatedObjects += merged;
+    stats::deduplicatedBytes += reclaimed;
+
+    if (merged) {
+        m_s2e->getDebugStream() << "Merged " << merged << " identical objects, "
+                << "reclaimed " << reclaimed << " bytes\n";
+    }
+}
+
+void S2EExecutor::writeCheckpoint()
+{
+    CheckpointSections sections;
+    m_s2e->getCorePlugin()->onCheckpointSave.emit(sections);
+
+    //Zombie states are not part of the exploration anymore
+    std::vector<ExplorationCheckpoint::Path> paths;
+    foreach2(it, states.begin(), states.end()) {
+        S2EExecutionState *state = static_cast<S2EExecutionState*>(*it);
+        if (!state->isZombie()) {
+            paths.push_back(ExplorationCheckpoint::Path(state->m_forkHistory,
+                                                        state->m_replayNode));
+        }
+    }
+
+    std::string fileName = m_s2e->getOutputFilename("checkpoint.dat");
+    if (!ExplorationCheckpoint::write(fileName, paths, sections)) {
+        m_s2e->getWarningsStream() << "Could not write checkpoint " << fileName << '\n';
+        return;
+    }
+
+    m_s2e->getMessagesStream() << "Checkpointed " << paths.size() << " states" << '\n';
+
+    if (CheckpointStates) {
+        writeStateSnapshot();
+    }
+}
+
+/**
+ *  Serializes the inactive states. The objects shared by several states
+ *  and the common subexpressions of their constraints are written once.
+ *  The active state is left out, as its registers and memory live in the
+ *  CPU structure and in the QEMU RAM.
+ */
+void S2EExecutor::writeStateSnapshot()
+{
+    std::string fileName = m_s2e->getOutputFilename("states.dat");
+    std::string tmpName = fileName + ".tmp";
+    FILE *fp = fopen(tmpName.c_str(), "wb");
+    if (!fp) {
+        m_s2e->getWarningsStream() << "Could not write states to " << fileName << '\n';
+        return;
+    }
+
+    llvm::sys::TimeValue start = llvm::sys::TimeValue::now();
+
+    bool ok;
+    uint64_t count, bytes;
+    {
+        StateWriter writer(fp);
+        foreach2(it, states.begin(), states.end()) {
+            S2EExecutionState *state = static_cast<S2EExecutionState*>(*it);
+            if (!state->isActive() && !state->isZombie()) {
+                writer.write(state);
+            }
+        }
+        ok = writer.isOk();
+        count = writer.getStateCount();
+        bytes = writer.getBytesWritten();
+    }
+
+    llvm::sys::TimeValue elapsed = llvm::sys::TimeValue::now() - start;
+
+    ok = !fclose(fp) && ok;
+    ok = ok && !rename(tmpName.c_str(), fileName.c_str());
+    if (!ok) {
+        remove(tmpName.c_str());
+        m_s2e->getWarningsStream() << "Could not write states to " << fileName << '\n';
+        return;
+    }
+
+    double seconds = elapsed.seconds() + elapsed.usec() / 1000000.0;
+    m_s2e->getMessagesStream() << "Serialized " << count << " states in " << bytes << " bytes ("
+            << (count ? bytes / count : 0) << " bytes/state, "
+            << (seconds > 0 ? count / seconds : 0) << " states/s)" << '\n';
+}
+
+void S2EExecutor::registerCpu(S2EExecutionState *initialState,
+                              CPUArchState *cpuEnv)
+{
+    std::cout << std::hex
+            << "Adding CPU (addr = " << std::hex << cpuEnv
+              << ", size = 0x" << sizeof(*cpuEnv) << ")"
+              << std::dec << '\n';
+
+    /* Add registers and eflags area as a true symbolic area */
+
+    initialState->m_cpuRegistersState =
+        addExternalObject(*initialState, cpuEnv, CPU_CONC_LIMIT,
+                      /* isReadOnly = */ false,
+                      /* isUserSpecified = */ false,
+                      /* isSharedConcrete = */ false);
+
+
+    initialState->m_cpuRegistersState->setName("CpuRegistersState");
+
+    /* Add the rest of the structure as concrete-only area */
+    initialState->m_cpuSystemState =
+        addExternalObject(*initialState,
+                      ((uint8_t*)cpuEnv) + CPU_CONC_LIMIT,
+                      sizeof(CPUArchState) - CPU_CONC_LIMIT,
+                      /* isReadOnly = */ false,
+                      /* isUserSpecified = */ true,
+                      /* isSharedConcrete = */ true);
+
+    initialState->m_cpuSystemState->setName("CpuSystemState");
+
+    m_saveOnContextSwitch.push_back(initialState->m_cpuSystemState);
+
+    const ObjectState *cpuSystemObject = initialState->addressSpace
+                                .findObject(initialState->m_cpuSystemState);
+    const ObjectState *cpuRegistersObject = initialState->addressSpace
+                                .findObject(initialState->m_cpuRegistersState);
+
+    initialState->m_cpuRegistersObject = initialState->addressSpace
+        .getWriteable(initialState->m_cpuRegistersState, cpuRegistersObject);
+    initialState->m_cpuSystemObject = initialState->addressSpace
+        .getWriteable(initialState->m_cpuSystemState, cpuSystemObject);
+}
+
+
+void S2EExecutor::registerRam(S2EExecutionState *initialState,
+                        uint64_t startAddress, uint64_t size,
+                        uint64_t hostAddress, bool isSharedConcrete,
+                        bool saveOnContextSwitch, const char *name)
+{
+    assert(isSharedConcrete || !saveOnContextSwitch);
+    assert(startAddress == (uint64_t) -1 ||
+           (startAddress & ~TARGET_PAGE_MASK) == 0);
+    assert((size & ~TARGET_PAGE_MASK) == 0);
+    assert((hostAddress & ~TARGET_PAGE_MASK) == 0);
+
+    m_s2e->getDebugStream()
+              << "Adding memory block (startAddr = " << hexval(startAddress)
+              << ", size = " << hexval(size) << ", hostAddr = " << hexval(hostAddress)
+              << ", isSharedConcrete=" << isSharedConcrete << ", name=" << name << ")\n";
+
+#ifdef DEBUG_TLB
+    qemu_log("ALLOCATE RAM of size=%"PRIu64"\n",size);
+    qemu_log("\t start address: %"PRIx64".\n", startAddress);
+    qemu_log("\t host_address: %"PRIx64".\n", hostAddress);
+#endif
+
+    //Nobody looks at the screen of a headless run
+    bool sharedMemory = StateSharedMemory || Headless;
+
+    //Lazy copying works at the granularity of host pages
+    bool lazy = false;
+    unsigned firstLazyObject = m_lazyObjects.size();
+#ifndef _WIN32
+    if (LazyStateSwitch && isSharedConcrete && (saveOnContextSwitch || !sharedMemory)) {
+        m_lazyPageSize = getpagesize();
+        m_lazyObjectsPerPage = m_lazyPageSize / S2E_RAM_OBJECT_SIZE;
+        lazy = m_lazyObjectsPerPage > 0 &&
+               (hostAddress & (m_lazyPageSize - 1)) == 0 &&
+               (size & (m_lazyPageSize - 1)) == 0;
+    }
+#endif
+
+    //Shared-concrete regions may use larger objects, the lazily switched
+    //ones keep the default size because lazy pages assume it
+    uint64_t objectSize = S2E_RAM_OBJECT_SIZE;
+    if (isSharedConcrete && !lazy && SharedRamObjectBits > S2E_RAM_OBJECT_BITS) {
+        objectSize = 1 << std::min((unsigned) SharedRamObjectBits,
+                                   (unsigned) TARGET_PAGE_BITS);
+    }
+
+    for(uint64_t addr = hostAddress; addr < hostAddress+size;
+                 addr += objectSize) {
+        std::stringstream ss;
+
+        ss << name << "_" << std::hex << (addr-hostAddress);
+
+        MemoryObject *mo = addExternalObject(
+                *initialState, (void*) addr, objectSize, false,
+                /* isUserSpecified = */ true, isSharedConcrete,
+                isSharedConcrete && !saveOnContextSwitch && sharedMemory);
+
+#ifdef DEBUG_TLB
+        qemu_log("\t mo address: %"PRIx64".\n", mo);
+
+        //get concrete store just for debugging
+        ObjectPair op = initialState->addressSpace.findObject(addr);
+        ObjectState* wos =
                 initialState->addressSpace.getWriteable(op.first, op.second);
 
         qemu_log("\t wos->concreteStore  address: %"PRIx64".\n", wos->getConcreteStore());
@@ -1108,8 +1816,28 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
 
         mo->setName(ss.str());
 
-        if (isSharedConcrete && (saveOnContextSwitch || !StateSharedMemory)) {
-            m_saveOnContextSwitch.push_back(mo);
+        if (!isSharedConcrete || saveOnContextSwitch || !sharedMemory) {
+            m_perStateRam.push_back(mo);
+        }
+
+        if (isSharedConcrete && (saveOnContextSwitch || !sharedMemory)) {
+            if (lazy) {
+                m_lazyObjects.push_back(mo);
+            } else {
+                m_saveOnContextSwitch.push_back(mo);
+            }
+        }
+    }
+
+    if (lazy) {
+        assert(m_lazyObjectsPerPage > 0);
+        for (uint64_t page = 0; page < size; page += m_lazyPageSize) {
+            LazyPage lp;
+            lp.hostAddress = hostAddress + page;
+            lp.firstObject = firstLazyObject + page / S2E_RAM_OBJECT_SIZE;
+            //The host memory holds the content of the only state
+            lp.status = LAZY_PAGE_DIRTY;
+            m_lazyPages.push_back(lp);
         }
     }
 
@@ -1133,7 +1861,9 @@ void S2EExecutor::registerRam(S2EExecutionState *initialState,
 
 void S2EExecutor::registerDirtyMask(S2EExecutionState *initial_state, uint64_t host_address, uint64_t size)
 {
-    //Assume that dirty mask is small enough, so no need to split it in small pages
+    //Assume that dirty mask is small enough, so no need to split it in small pages.
+    //The mask is shared concrete: QEMU accesses the host array of the active state
+    //directly, the per-state copies are synced on state switches and forks.
     assert(!initial_state->m_dirtyMask);
     initial_state->m_dirtyMask = g_s2e->getExecutor()->addExternalObject(
             *initial_state, (void*) host_address, size, false,
@@ -1151,6 +1881,12 @@ void S2EExecutor::registerDirtyMask(S2EExecutionState *initial_state, uint64_t h
 }
 
 
+void S2EExecutor::saveScreenshot(const std::string &fileName)
+{
+    //The video RAM and the device state in QEMU are those of the active state
+    vga_hw_screen_dump(fileName.c_str());
+}
+
 void S2EExecutor::switchToConcrete(S2EExecutionState *state)
 {
     assert(!state->m_runningConcrete);
@@ -1178,13 +1914,15 @@ void S2EExecutor::switchToConcrete(S2EExecutionState *state)
                         wos->write8(i, ch);
                     }
                 }
+                state->m_dirtyRegisters = (uint64_t) -1;
             }
         }
     }
 
     //assert(os->isAllConcrete());
-    memcpy((void*) state->m_cpuRegistersState->address,
-           wos->getConcreteStore(true), wos->size);
+    /* The native copy is up to date except for the registers
+       written since switchToSymbolic */
+    state->copyDirtyRegisters();
     static_cast<S2EExecutionState*>(state)->m_runningConcrete = true;
 
     if (PrintModeSwitch) {
@@ -1207,6 +1945,7 @@ void S2EExecutor::switchToSymbolic(S2EExecutionState *state)
     ObjectState *wos = state->m_cpuRegistersObject;
     memcpy(wos->getConcreteStore(true),
            (void*) state->m_cpuRegistersState->address, wos->size);
+    state->m_dirtyRegisters = 0;
     state->m_runningConcrete = false;
 
     if (PrintModeSwitch) {
@@ -1228,14 +1967,50 @@ bool S2EExecutor::copyInConcretes(klee::ExecutionState &state)
     return true;
 }
 
+bool S2EExecutor::mayCallNatively(klee::ExecutionState &state, llvm::Function *f,
+                                  const std::vector< klee::ref<klee::Expr> > &arguments)
+{
+    const MemoryObject *systemState = S2EExecutionState::m_cpuSystemState;
+    llvm::Function::arg_iterator ait = f->arg_begin();
+
+    for (unsigned i = 0; i < arguments.size(); ++i, ++ait) {
+        klee::ConstantExpr *ce = dyn_cast<klee::ConstantExpr>(arguments[i]);
+        if (!ce) {
+            return false;
+        }
+
+        /* Native code writes through pointers directly, which is only
+           coherent with KLEE for the shared concrete part of the CPU state
+           (e.g., XMM and FPU registers). */
+        if (ait->getType()->isPointerTy()) {
+            uint64_t address = ce->getZExtValue();
+            if (address < systemState->address ||
+                    address >= systemState->address + systemState->size) {
+                return false;
+            }
+        }
+    }
+
+    S2EExecutionState *s2eState = static_cast<S2EExecutionState*>(&state);
+    return s2eState->m_cpuRegistersObject->isAllConcrete();
+}
+
 void S2EExecutor::doLoadBalancing()
 {
+    if (LoadBalancingWorkStealing) {
+        m_s2e->setCurrentProcessLoad(states.size());
+    }
+
     if (states.size() < 2) {
         return;
     }
 
+    if (AutoScaleProcesses) {
+        updateProcessLimit();
+    }
+
     //Don't bother copying stuff if it's obvious that it'll very likely fail
-    if (m_s2e->getCurrentProcessCount() == m_s2e->getMaxProcesses()) {
+    if (m_s2e->getCurrentProcessCount() >= m_s2e->getProcessLimit()) {
         return;
     }
 
@@ -1252,6 +2027,14 @@ void S2EExecutor::doLoadBalancing()
         return;
     }
 
+    if (LoadBalancingWorkStealing) {
+        //Zombie states cannot be given away, do not count them
+        m_s2e->setCurrentProcessLoad(allStates.size());
+        if (!m_s2e->isBusiestProcess()) {
+            return;
+        }
+    }
+
     g_s2e->getDebugStream() << "LoadBalancing: starting\n";
 
     m_inLoadBalancing = true;
@@ -1276,11 +2059,27 @@ void S2EExecutor::doLoadBalancing()
 
     m_s2e->getCorePlugin()->onProcessFork.emit(false, child, parentId);
 
+    if (child && PinProcesses) {
+        pinCurrentProcess();
+    }
+
     g_s2e->getDebugStream() << "LoadBalancing: terminating states\n";
 
     for (unsigned i=lower; i<upper; ++i) {
         S2EExecutionState *s2estate = static_cast<S2EExecutionState*>(allStates[i]);
-        terminateStateAtFork(*s2estate);
+        /* Freeing a state writes to the reference counts of all the
+           expressions and memory pages it shares with the states of the
+           other process, which unshares these pages in both processes.
+           The current state must still go through the normal path. */
+        if (LoadBalancingLeakStates && s2estate != g_s2e_state) {
+            suspendState(s2estate);
+        } else {
+            terminateStateAtFork(*s2estate);
+        }
+    }
+
+    if (LoadBalancingWorkStealing) {
+        m_s2e->setCurrentProcessLoad(child ? size - n : n);
     }
 
     m_s2e->getCorePlugin()->onProcessForkComplete.emit(child);
@@ -1289,11 +2088,131 @@ void S2EExecutor::doLoadBalancing()
     vm_start();
 }
 
+void S2EExecutor::updateProcessLimit()
+{
+    uint64_t now = llvm::sys::TimeValue::now().seconds();
+    if (now - m_lastProcessLimitUpdate < AutoScaleInterval) {
+        return;
+    }
+    m_lastProcessLimitUpdate = now;
+
+    unsigned count = m_s2e->getCurrentProcessCount();
+    unsigned limit = m_s2e->getMaxProcesses();
+
+    //A new instance starts with the memory of its parent and only
+    //shares it until either of them writes to it. Assume it will grow
+    //as large as the largest instance.
+    uint64_t rss = S2EStatsTracker::getProcessResidentMemoryUsage();
+    std::map<unsigned, S2EProcessMetrics> metrics;
+    m_s2e->getProcessMetrics(metrics);
+    foreach2(it, metrics.begin(), metrics.end()) {
+        rss = std::max(rss, (*it).second.memoryUsage);
+    }
+
+    uint64_t available = S2EStatsTracker::getHostAvailableMemory();
+    uint64_t reserved = (uint64_t) AutoScaleReservedMemory * 1024 * 1024;
+    if (available && rss) {
+        if (available < reserved) {
+            limit = std::min(limit, count > 1 ? count - 1 : 1);
+        } else {
+            uint64_t more = (available - reserved) / rss;
+            limit = std::min<uint64_t>(limit, count + more);
+        }
+    }
+
+#ifndef CONFIG_WIN32
+    //The load includes the forked solver processes. When the cores are
+    //already busy solving, more instances only slow the others down.
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    double load;
+    if (cores > 0 && getloadavg(&load, 1) == 1) {
+        unsigned idle = load < cores ? (unsigned) (cores - load) : 0;
+        limit = std::min(limit, count + idle);
+    }
+#endif
+
+    limit = std::max(1u, limit);
+    if (limit != m_s2e->getProcessLimit()) {
+        m_s2e->getDebugStream() << "Autoscaling: " << count << " instances, "
+                << "limit set to " << limit << ", "
+                << (available >> 20) << " MB free, "
+                << (rss >> 20) << " MB per instance\n";
+        m_s2e->setProcessLimit(limit);
+    }
+}
+
+void S2EExecutor::pinCurrentProcess()
+{
+#ifdef __linux__
+    //Consecutive slots get consecutive cores, which the kernel numbers
+    //node by node. Memory is allocated on the node of the core that
+    //first touches it, so the new pages of an instance stay local.
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores <= 0) {
+        return;
+    }
+
+    unsigned core = m_s2e->getCurrentProcessId() % cores;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        m_s2e->getWarningsStream() << "Could not bind the instance to core " << core << '\n';
+        return;
+    }
+
+    m_s2e->getDebugStream() << "Bound the instance to core " << core << '\n';
+#endif
+}
+
+void S2EExecutor::recordStateSwitchCost(uint64_t usecs)
+{
+    ++stats::stateSwitches;
+
+    unsigned bucket = 0;
+    while (bucket < StateSwitchCostBuckets - 1 &&
+           usecs >= getStateSwitchCostBound(bucket)) {
+        ++bucket;
+    }
+    ++m_stateSwitchCosts[bucket];
+
+    if (m_stateSwitchCost == 0) {
+        m_stateSwitchCost = usecs;
+    } else {
+        m_stateSwitchCost = m_stateSwitchCost * 0.875 + usecs * 0.125;
+    }
+}
+
+unsigned S2EExecutor::getStateSwitchDelay(bool idle) const
+{
+    //Idle states do not lose anything by being switched out early
+    if (!AutoTuneStateSwitch || idle || StateSwitchMaxOverhead == 0 ||
+        StateSwitchMaxOverhead >= 100) {
+        return m_stateSwitchInterval;
+    }
+
+    //A switch of cost c every d ms takes c / (c + d) of the wall time
+    double overhead = StateSwitchMaxOverhead / 100.0;
+    double delay = m_stateSwitchCost / 1000.0 * (1 - overhead) / overhead;
+
+    if (delay > StateSwitchMaxInterval) {
+        delay = StateSwitchMaxInterval;
+    }
+
+    return std::max(m_stateSwitchInterval, (unsigned) delay);
+}
+
 void S2EExecutor::stateSwitchTimerCallback(void *opaque)
 {
     S2EExecutor *c = (S2EExecutor*)opaque;
+    bool idle = false;
 
     if (g_s2e_state) {
+        //The state did not run any instruction since the last tick
+        uint64_t icount = g_s2e_state->getTotalInstructionCount();
+        idle = g_s2e_state == c->m_sliceState && icount == c->m_sliceInstructions;
+
         c->doLoadBalancing();
         S2EExecutionState *nextState = c->selectNextState(g_s2e_state);
         if (nextState) {
@@ -1302,15 +2221,176 @@ void S2EExecutor::stateSwitchTimerCallback(void *opaque)
             //Do not reschedule the timer anymore
             return;
         }
+
+        c->m_sliceState = g_s2e_state;
+        c->m_sliceInstructions = g_s2e_state->getTotalInstructionCount();
     }
 
-    qemu_mod_timer(c->m_stateSwitchTimer, qemu_get_clock_ms(host_clock) + 100);
+    qemu_mod_timer(c->m_stateSwitchTimer,
+                   qemu_get_clock_ms(host_clock) + c->getStateSwitchDelay(idle));
 }
 
 void S2EExecutor::initializeStateSwitchTimer()
 {
     m_stateSwitchTimer = qemu_new_timer_ms(host_clock, &stateSwitchTimerCallback, this);
-    qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(host_clock) + 100);
+    qemu_mod_timer(m_stateSwitchTimer,
+                   qemu_get_clock_ms(host_clock) + m_stateSwitchInterval);
+}
+
+bool S2EExecutor::lazyPageLess(const LazyPage &page, uintptr_t address)
+{
+    return page.hostAddress < address;
+}
+
+bool S2EExecutor::lazyPageAddressLess(const LazyPage &a, const LazyPage &b)
+{
+    return a.hostAddress < b.hostAddress;
+}
+
+void S2EExecutor::initializeLazyStateSwitch()
+{
+#ifndef _WIN32
+    if (m_lazyPages.empty()) {
+        return;
+    }
+
+    std::sort(m_lazyPages.begin(), m_lazyPages.end(), lazyPageAddressLess);
+
+    s2e_install_persistent_segv_handler();
+
+    m_s2e->getDebugStream() << "Lazy state switching enabled for "
+                            << m_lazyPages.size() << " pages\n";
+#endif
+}
+
+/** Copies the pages that were modified by the state back into its objects */
+void S2EExecutor::saveLazyObjects(S2EExecutionState *state)
+{
+    foreach2(it, m_lazyPages.begin(), m_lazyPages.end()) {
+        const LazyPage &page = *it;
+        if (page.status != LAZY_PAGE_DIRTY) {
+            //The objects of the state are up to date
+            continue;
+        }
+
+        for (unsigned i = 0; i < m_lazyObjectsPerPage; ++i) {
+            MemoryObject *mo = m_lazyObjects[page.firstObject + i];
+            const ObjectState *os = state->addressSpace.findObject(mo);
+            ObjectState *wos = state->addressSpace.getWriteable(mo, os);
+            uint8_t *store = wos->getConcreteStore();
+            assert(store);
+            memcpy(store, (uint8_t*) mo->address, mo->size);
+        }
+    }
+}
+
+/** Unmaps all the pages, they will be loaded from the state on first access */
+void S2EExecutor::protectLazyObjects(S2EExecutionState *state)
+{
+#ifndef _WIN32
+    m_lazyState = state;
+
+    uintptr_t start = 0, end = 0;
+    foreach2(it, m_lazyPages.begin(), m_lazyPages.end()) {
+        LazyPage &page = *it;
+        page.status = LAZY_PAGE_NOT_LOADED;
+
+        //Coalesce contiguous pages into one mprotect call
+        if (page.hostAddress != end) {
+            if (end > start) {
+                mprotect((void*) start, end - start, PROT_NONE);
+            }
+            start = page.hostAddress;
+        }
+        end = page.hostAddress + m_lazyPageSize;
+    }
+
+    if (end > start) {
+        mprotect((void*) start, end - start, PROT_NONE);
+    }
+#endif
+}
+
+bool S2EExecutor::handleLazyPageFault(uintptr_t address)
+{
+#ifdef _WIN32
+    return false;
+#else
+    if (m_lazyPages.empty()) {
+        return false;
+    }
+
+    uintptr_t pageAddress = address & ~(m_lazyPageSize - 1);
+    std::vector<LazyPage>::iterator it =
+            std::lower_bound(m_lazyPages.begin(), m_lazyPages.end(), pageAddress, lazyPageLess);
+
+    if (it == m_lazyPages.end() || (*it).hostAddress != pageAddress) {
+        return false;
+    }
+
+    LazyPage &page = *it;
+
+    switch (page.status) {
+        case LAZY_PAGE_NOT_LOADED:
+            assert(m_lazyState);
+            mprotect((void*) pageAddress, m_lazyPageSize, PROT_READ | PROT_WRITE);
+            for (unsigned i = 0; i < m_lazyObjectsPerPage; ++i) {
+                MemoryObject *mo = m_lazyObjects[page.firstObject + i];
+                const ObjectState *os = m_lazyState->addressSpace.findObject(mo);
+                const uint8_t *store = os->getConcreteStore();
+                assert(store);
+                memcpy((uint8_t*) mo->address, store, mo->size);
+            }
+
+            //Writes will fault again and mark the page dirty
+            mprotect((void*) pageAddress, m_lazyPageSize, PROT_READ);
+            page.status = LAZY_PAGE_CLEAN;
+            return true;
+
+        case LAZY_PAGE_CLEAN:
+            mprotect((void*) pageAddress, m_lazyPageSize, PROT_READ | PROT_WRITE);
+            page.status = LAZY_PAGE_DIRTY;
+            return true;
+
+        default:
+            return false;
+    }
+#endif
+}
+
+/**
+ *  Invalidates the translation blocks of the RAM pages whose copy
+ *  in newState is not the one the blocks were translated from.
+ *  States that share an ObjectState have the same page content.
+ */
+void S2EExecutor::invalidateChangedTbs(S2EExecutionState *tbState,
+                                       S2EExecutionState *newState)
+{
+    unsigned invalidated = 0;
+
+    foreach2(it, m_perStateRam.begin(), m_perStateRam.end()) {
+        const MemoryObject *mo = *it;
+        if (tbState->addressSpace.findObject(mo) ==
+            newState->addressSpace.findObject(mo)) {
+            continue;
+        }
+
+        ram_addr_t ramAddr;
+        if (qemu_ram_addr_from_host((void*) mo->address, &ramAddr)) {
+            //Not guest RAM, cannot contain translated code
+            continue;
+        }
+
+        tb_invalidate_phys_page_range(ramAddr, ramAddr + mo->size, 0);
+        ++invalidated;
+    }
+
+    //The jump cache of the restored CPU state may point to freed blocks
+    memset(env->tb_jmp_cache, 0, sizeof(env->tb_jmp_cache));
+
+    if (VerboseStateSwitching) {
+        s2e_debug_print("Invalidated translation blocks of %d objects\n", invalidated);
+    }
 }
 
 void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
@@ -1341,6 +2421,9 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
     const MemoryObject* cpuMo = oldState ? oldState->m_cpuSystemState :
                                             newState->m_cpuSystemState;
 
+    //Bytes saved into the ObjectStates of the old state
+    uint64_t savedBytes = 0;
+
     if(oldState) {
         if(oldState->m_runningConcrete)
             switchToSymbolic(oldState);
@@ -1361,8 +2444,11 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
             uint8_t *oldStore = oldWOS->getConcreteStore();
             assert(oldStore);
             memcpy(oldStore, (uint8_t*) mo->address, mo->size);
+            savedBytes += mo->size;
         }
 
+        saveLazyObjects(oldState);
+
         //copyInConcretes(*oldState);
         oldState->getDeviceState()->saveDeviceState();
         //oldState->m_qemuIcount = qemu_icount;
@@ -1370,6 +2456,7 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
 
         uint8_t *oldStore = oldState->m_cpuSystemObject->getConcreteStore();
         memcpy(oldStore, (uint8_t*) cpuMo->address, cpuMo->size);
+        savedBytes += cpuMo->size;
 
         oldState->m_active = false;
     }
@@ -1402,6 +2489,13 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
             objectsCopied++;
         }
 
+        protectLazyObjects(newState);
+
+        newState->m_stateSwitchBytes = savedBytes + totalCopied + cpuMo->size;
+        stats::stateSwitchBytes += newState->m_stateSwitchBytes;
+
+        /* The native registers belong to the previous state */
+        newState->m_dirtyRegisters = (uint64_t) -1;
         newState->m_active = true;
 
         //Devices may need to write to memory, which can be done
@@ -1418,8 +2512,19 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
         s2e_debug_print("Copied %d (count=%d)\n", totalCopied, objectsCopied);
     }
 
-    if(FlushTBsOnStateSwitch)
-        tb_flush(env);
+    if(FlushTBsOnStateSwitch) {
+        S2EExecutionState *tbState = oldState ? oldState : m_tbState;
+        if (FlushTBsSelectively && tbState && newState) {
+            invalidateChangedTbs(tbState, newState);
+        } else {
+            tb_flush(env);
+        }
+    }
+
+    m_tbState = newState;
+
+    //Queries logged with --use-query-pc-log are tagged with the issuing state
+    setPCLoggingStateId(newState ? newState->getID() : -1);
 
     g_s2e_disable_tlb_flush = 0;
 
@@ -1462,6 +2567,9 @@ ExecutionState* S2EExecutor::selectNonSpeculativeState(S2EExecutionState *state)
             if (s != g_s2e_state) {
                 unrefS2ETb(s->m_lastS2ETb);
                 s->m_lastS2ETb = NULL;
+                if (s == m_tbState) {
+                    m_tbState = NULL;
+                }
                 delete s;
             }
         }
@@ -1510,48 +2618,129 @@ S2EExecutionState* S2EExecutor::selectNextState(S2EExecutionState *state)
     restoreYieldedState();
 
     if(newState != state) {
+        TimerStatIncrementer t(stats::stateSwitchTime);
+        PerfCounterRegion perfRegion(PerfCounters::StateSwitch);
+        if (state) {
+            g_s2e->getCorePlugin()->flushDataMemoryAccesses(state);
+        }
         g_s2e->getCorePlugin()->onStateSwitch.emit(state, newState);
         vm_stop(RUN_STATE_SAVE_VM);
         doStateSwitch(state, newState);
         vm_start();
+        recordStateSwitchCost(t.check());
     }
 
     //We can't free the state immediately if it is the current state.
     //Do it now.
-    foreach(S2EExecutionState* s, m_deletedStates) {
-        assert(s != newState);
+    reclaimDeletedStates(newState);
+
+    return newState;
+}
+
+/**
+ * Frees the states killed since the last call. Killing thousands of states
+ * at once would stall the guest while their memory is freed, so with
+ * --state-reclaim-budget the work is spread over several time slices.
+ * Expressions are reference counted without atomics, this must run on
+ * the cpu thread.
+ */
+void S2EExecutor::reclaimDeletedStates(S2EExecutionState *activeState)
+{
+    if (m_deletedStates.empty()) {
+        return;
+    }
+
+    llvm::sys::TimeValue start = llvm::sys::TimeValue::now();
+    unsigned deleted = 0;
+
+    while (!m_deletedStates.empty()) {
+        if (StateReclaimBudget && deleted > 0) {
+            llvm::sys::TimeValue elapsed = llvm::sys::TimeValue::now() - start;
+            if (elapsed.seconds() * 1000 + elapsed.msec() >= StateReclaimBudget) {
+                break;
+            }
+        }
+
+        S2EExecutionState *s = m_deletedStates.back();
+        m_deletedStates.pop_back();
+
+        assert(s != activeState);
         unrefS2ETb(s->m_lastS2ETb);
         s->m_lastS2ETb = NULL;
+        if (s == m_tbState) {
+            m_tbState = NULL;
+        }
         delete s;
+        ++deleted;
     }
-    m_deletedStates.clear();
 
-    return newState;
+    //Expressions that were only referenced by the deleted states are gone
+    if (m_exprAllocator) {
+        m_exprAllocator->reclaim();
+    }
+    if (m_objectStateAllocator) {
+        m_objectStateAllocator->reclaim();
+    }
+}
+
+/** Collect the functions that a constant refers to */
+static void collectFunctions(const Constant *c, std::set<Function*> &functions)
+{
+    if (const Function *f = dyn_cast<Function>(c)) {
+        functions.insert(const_cast<Function*>(f));
+        return;
+    }
+
+    if (isa<GlobalValue>(c)) {
+        return;
+    }
+
+    for (unsigned i = 0; i < c->getNumOperands(); ++i) {
+        collectFunctions(cast<Constant>(c->getOperand(i)), functions);
+    }
 }
 
 /** Simulate start of function execution, creating KLEE structs of required */
 void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
                             llvm::Function *function,
-                            const std::vector<klee::ref<klee::Expr> > &args)
+                            const std::vector<klee::ref<klee::Expr> > &args,
+                            bool optimize)
 {
     KFunction *kf;
     typeof(kmodule->functionMap.begin()) it =
             kmodule->functionMap.find(function);
     if(it != kmodule->functionMap.end()) {
         kf = it->second;
+    } else if (kmodule->isDeferredFunction(function)) {
+        /* Helper that was not prepared at startup */
+        kf = getKFunction(function);
     } else {
 
         unsigned cIndex = kmodule->constants.size();
-        kf = kmodule->updateModuleWithFunction(function);
+        if (m_tcgLLVMContext->isCachedFunction(function)) {
+            kf = kmodule->updateModuleWithFunction(function, KModule::NoPasses);
+        } else if (!optimize) {
+            kf = kmodule->updateModuleWithFunction(function, KModule::LoweringPasses);
+        } else {
+            kf = kmodule->updateModuleWithFunction(function);
+            m_tcgLLVMContext->storeFunction(function);
+        }
 
         for(unsigned i = 0; i < kf->numInstructions; ++i)
             bindInstructionConstants(kf->instructions[i]);
 
         /* Update global functions (new functions can be added
-           while creating added function) */
-        for (Module::iterator i = kmodule->module->begin(),
-                              ie = kmodule->module->end(); i != ie; ++i) {
-            Function *f = i;
+           while creating added function). Only the new constants
+           may refer to functions that have no address yet, which
+           avoids going through the whole module for each block. */
+        std::set<Function*> newFunctions;
+        newFunctions.insert(function);
+        for (unsigned i = cIndex; i < kmodule->constants.size(); ++i) {
+            collectFunctions(kmodule->constants[i], newFunctions);
+        }
+
+        foreach2(it, newFunctions.begin(), newFunctions.end()) {
+            Function *f = *it;
             ref<klee::ConstantExpr> addr(0);
 
             // If the symbol has external weak linkage then it is implicitly
@@ -1608,7 +2797,19 @@ inline bool S2EExecutor::executeInstructions(S2EExecutionState *state, unsigned
             stepInstruction(*state);
             executeInstruction(*state, ki);
 
-            updateStates(state);
+            //A helper called by the instruction exited the cpu loop
+            if (m_cpuExitPending) {
+                m_cpuExitPending = false;
+                assert(addedStates.empty());
+                updateStates(state);
+                return true;
+            }
+
+            //The next state is only selected between translation blocks.
+            //Notify the searcher once per block unless states were added or removed.
+            if (!addedStates.empty() || !removedStates.empty()) {
+                updateStates(state);
+            }
 
             //S2E doesn't know if the current state can be run
             //if concolic fork marks it as speculative.
@@ -1628,9 +2829,12 @@ inline bool S2EExecutor::executeInstructions(S2EExecutionState *state, unsigned
         }
     } catch (CpuExitException &) {
         assert(addedStates.empty());
+        updateStates(state);
         return true;
     }
 
+    updateStates(state);
+
     //The TB finished executing normally
     if (callerStackSize == 1) {
         state->prevPC = 0;
@@ -1723,6 +2927,8 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
 
     ++state->m_stats.m_statTranslationBlockSymbolic;
 
+    reclaimDeadFunctions();
+
     /* Generate LLVM code if necessary */
     if(!tb->llvm_function) {
         cpu_gen_llvm(env, tb);
@@ -1735,10 +2941,26 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
         state->m_lastS2ETb->refCount += 1;
     }
 
+    /* Most blocks run only a few times in KLEE, optimizing them would
+       cost more than interpreting the unoptimized code */
+    bool optimize = true;
+    unsigned count = ++tb->s2e_tb->executionCount;
+    if (TbHotThreshold && !m_tcgLLVMContext->isCachedFunction(tb->llvm_function)) {
+        if (count < TbHotThreshold) {
+            optimize = false;
+        } else if (count == TbHotThreshold && count > 1) {
+            optimizeHotTranslationBlock(tb);
+        }
+    }
+
+    /* The block (and the helpers it calls) can only write these registers */
+    state->m_dirtyRegisters |= tb->reg_wmask;
+
     /* Prepare function execution */
     prepareFunctionExecution(state,
             tb->llvm_function, std::vector<ref<Expr> >(1,
-                Expr::createPointer((uint64_t) tb_function_args)));
+                Expr::createPointer((uint64_t) tb_function_args)),
+            optimize);
 
     if (executeInstructions(state)) {
         throw CpuExitException();
@@ -1752,6 +2974,32 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
     return cast<klee::ConstantExpr>(resExpr)->getZExtValue();
 }
 
+/**
+ * Replaces the cold version of the block by a fully optimized copy.
+ * Other states may be in the middle of the cold version, which is
+ * therefore only deleted with the block.
+ */
+void S2EExecutor::optimizeHotTranslationBlock(TranslationBlock *tb)
+{
+    S2ETranslationBlock *s2e_tb = tb->s2e_tb;
+    Function *cold = tb->llvm_function;
+    assert(!s2e_tb->llvm_cold_function);
+
+    ValueToValueMapTy vmap;
+    Function *hot = CloneFunction(cold, vmap, false);
+    hot->setName(cold->getName() + "-hot");
+    cold->getParent()->getFunctionList().push_back(hot);
+
+    /* The passes of the translator, including -use-select-cleaner.
+       KLEE runs its own passes when the function is first executed. */
+    m_tcgLLVMContext->getFunctionPassManager()->run(*hot);
+    m_tcgLLVMContext->replaceFunction(cold, hot);
+
+    s2e_tb->llvm_cold_function = cold;
+    s2e_tb->llvm_function = hot;
+    tb->llvm_function = hot;
+}
+
 uintptr_t S2EExecutor::executeTranslationBlockConcrete(S2EExecutionState *state,
                                                        TranslationBlock *tb)
 {
@@ -1777,77 +3025,118 @@ uintptr_t S2EExecutor::executeTranslationBlockConcrete(S2EExecutionState *state,
     return ret;
 }
 
-static inline void s2e_tb_reset_jump(TranslationBlock *tb, unsigned int n)
+/**
+ *  Points the native jump n of tb back to its exit stub, so that the
+ *  successor goes through the cpu loop, which decides whether it runs in
+ *  KLEE. The link stays in the jump lists and in s2e_tb_next, and the
+ *  native jump is restored without looking up the successor again once it
+ *  can run natively (see s2e_tb_add_jump).
+ */
+static inline void s2e_tb_detach_jump(TranslationBlock *tb, unsigned int n)
+{
+    tb_set_jmp_target(tb, n, (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[n]));
+    tb->s2e_tb_detached |= 1 << n;
+}
+
+
+static inline bool s2e_tb_touches_smask(TranslationBlock *tb, uint64_t smask)
+{
+    return (smask & tb->reg_rmask) || (smask & tb->reg_wmask)
+            || (tb->helper_accesses_mem & 4);
+}
+
+/**
+ *  Hot loops often keep running in KLEE only because a register still
+ *  holds a symbolic value from an earlier iteration, which the block
+ *  overwrites before anything can read it. Such values are dead: replace
+ *  them with a concrete placeholder, so that the block can run natively.
+ *  Returns the remaining symbolic register mask.
+ */
+uint64_t S2EExecutor::killDeadSymbolicRegisters(S2EExecutionState *state,
+                                                TranslationBlock *tb,
+                                                uint64_t smask)
+{
+    if (!HotLoopThreshold || tb->s2e_tb->executionCount < HotLoopThreshold) {
+        return smask;
+    }
+
+    uint64_t touched = smask & (tb->reg_rmask | tb->reg_wmask);
+    if ((touched & ~tb->reg_kmask) || (tb->helper_accesses_mem & 4)) {
+        return smask;
+    }
+
+    for (int i = 0; i < tcg_ctx.nb_globals && i < 64; ++i) {
+        if (!(touched & (1ULL << i))) {
+            continue;
+        }
+
+        const TCGTemp *ts = &tcg_ctx.temps[i];
+        unsigned size = ts->base_type == TCG_TYPE_I64 ? 8 : 4;
+        if (ts->fixed_reg || ts->mem_offset < 0 ||
+                (uint64_t) ts->mem_offset + size > CPU_CONC_LIMIT) {
+            return smask;
+        }
+    }
+
+    for (int i = 0; i < tcg_ctx.nb_globals && i < 64; ++i) {
+        if (touched & (1ULL << i)) {
+            const TCGTemp *ts = &tcg_ctx.temps[i];
+            uint64_t zero = 0;
+            state->writeCpuRegisterConcrete(ts->mem_offset, &zero,
+                        ts->base_type == TCG_TYPE_I64 ? 8 : 4);
+        }
+    }
+
+    return state->getSymbolicRegistersMask();
+}
+
+/**
+ *  Checks whether s2e_tb_detach_jump_smask() would detach anything.
+ *  This only reads the chains, blocking signals is not necessary
+ *  and saves two system calls per block in the common case.
+ *  Jumps that are already detached stay so until the symbolic
+ *  registers change.
+ */
+static bool s2e_tb_needs_detach_jump_smask(TranslationBlock* tb, unsigned int n,
+                                           uint64_t smask, int depth = 0)
 {
-    TranslationBlock *tb1, *tb_next, **ptb;
-    unsigned int n1;
+    TranslationBlock *tb1 = tb->s2e_tb_next[n];
+    if (!tb1 || (tb->s2e_tb_detached & (1 << n))) {
+        return false;
+    }
 
-    tb1 = tb->jmp_next[n];
-    if (tb1 != NULL) {
-        /* find head of list */
-        for(;;) {
-            n1 = (intptr_t)tb1 & 3;
-            tb1 = (TranslationBlock *)((intptr_t)tb1 & ~3);
-            if (n1 == 2)
-                break;
-            tb1 = tb1->jmp_next[n1];
-        }
-        /* we are now sure now that tb jumps to tb1 */
-        tb_next = tb1;
-
-        /* remove tb from the jmp_first list */
-        ptb = &tb_next->jmp_first;
-        for(;;) {
-            tb1 = *ptb;
-            n1 = (intptr_t)tb1 & 3;
-            tb1 = (TranslationBlock *)((intptr_t)tb1 & ~3);
-            if (n1 == n && tb1 == tb)
-                break;
-            ptb = &tb1->jmp_next[n1];
-        }
-        *ptb = tb->jmp_next[n];
-        tb->jmp_next[n] = NULL;
+    if (depth > 2 || s2e_tb_touches_smask(tb1, smask)) {
+        return true;
+    }
 
-        /* suppress the jump to next tb in generated code */
-        tb_set_jmp_target(tb, n, (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[n]));
-        tb->s2e_tb_next[n] = NULL;
+    if (tb1 == tb) {
+        return false;
     }
-}
 
+    return s2e_tb_needs_detach_jump_smask(tb1, 0, smask, depth + 1) ||
+           s2e_tb_needs_detach_jump_smask(tb1, 1, smask, depth + 1);
+}
 
 //XXX: inline causes compiler internal errors
-static void s2e_tb_reset_jump_smask(TranslationBlock* tb, unsigned int n,
-                                           uint64_t smask, int depth = 0)
+static void s2e_tb_detach_jump_smask(TranslationBlock* tb, unsigned int n,
+                                     uint64_t smask, int depth = 0)
 {
     TranslationBlock *tb1 = tb->s2e_tb_next[n];
-    sigset_t oldset;
-    if (depth == 0) {
-        s2e_disable_signals(&oldset);
-    }
 
-    if(tb1) {
-        if(depth > 2 || (smask & tb1->reg_rmask) || (smask & tb1->reg_wmask)
-                             || (tb1->helper_accesses_mem & 4)) {
-            s2e_tb_reset_jump(tb, n);
+    if(tb1 && !(tb->s2e_tb_detached & (1 << n))) {
+        if(depth > 2 || s2e_tb_touches_smask(tb1, smask)) {
+            s2e_tb_detach_jump(tb, n);
         } else if(tb1 != tb) {
-            s2e_tb_reset_jump_smask(tb1, 0, smask, depth + 1);
-            s2e_tb_reset_jump_smask(tb1, 1, smask, depth + 1);
+            s2e_tb_detach_jump_smask(tb1, 0, smask, depth + 1);
+            s2e_tb_detach_jump_smask(tb1, 1, smask, depth + 1);
         }
     }
-
-    if (depth == 0) {
-        s2e_enable_signals(&oldset);
-    }
 }
 
-uintptr_t S2EExecutor::executeTranslationBlock(
+bool S2EExecutor::needsSymbolicExecution(
         S2EExecutionState* state,
         TranslationBlock* tb)
 {
-    //Avoid incrementing stats every time, very expensive.
-    static unsigned doStatsIncrementCount= 0;
-    assert(state->isActive());
-
     bool executeKlee = m_executeAlwaysKlee;
 
     /* Think how can we optimize if symbex is disabled */
@@ -1872,15 +3161,31 @@ uintptr_t S2EExecutor::executeTranslationBlock(
 #if 1
             /* We can not execute TB natively if it reads any symbolic regs */
             uint64_t smask = state->getSymbolicRegistersMask();
+            if (smask && s2e_tb_touches_smask(tb, smask)) {
+                smask = killDeadSymbolicRegisters(state, tb, smask);
+            }
             if(smask || (tb->helper_accesses_mem & 4)) {
-                if((smask & tb->reg_rmask) || (smask & tb->reg_wmask)
-                         || (tb->helper_accesses_mem & 4)) {
+                if(s2e_tb_touches_smask(tb, smask)) {
                     /* TB reads symbolic variables */
                     executeKlee = true;
 
                 } else {
-                    s2e_tb_reset_jump_smask(tb, 0, smask);
-                    s2e_tb_reset_jump_smask(tb, 1, smask);
+                    /* The block does not touch the symbolic registers, but
+                       the blocks chained to it may */
+                    bool detach0 = s2e_tb_needs_detach_jump_smask(tb, 0, smask);
+                    bool detach1 = s2e_tb_needs_detach_jump_smask(tb, 1, smask);
+                    if (detach0 || detach1) {
+                        /* Signals are masked once for the whole block */
+                        sigset_t oldset;
+                        s2e_disable_signals(&oldset);
+                        if (detach0) {
+                            s2e_tb_detach_jump_smask(tb, 0, smask);
+                        }
+                        if (detach1) {
+                            s2e_tb_detach_jump_smask(tb, 1, smask);
+                        }
+                        s2e_enable_signals(&oldset);
+                    }
 
                     /* XXX: check whether we really have to unlink the block */
                     /*
@@ -1905,6 +3210,70 @@ uintptr_t S2EExecutor::executeTranslationBlock(
         }
     }
 
+    return executeKlee;
+}
+
+/**
+ * Keeps running in KLEE the blocks that are directly linked to the one
+ * that just returned, as long as they need symbolic execution. This
+ * saves the round trip through the cpu loop, which would pick the same
+ * blocks. The chain stops where the loop would do anything else.
+ */
+uintptr_t S2EExecutor::executeTranslationBlockChain(
+        S2EExecutionState* state,
+        TranslationBlock* tb, uintptr_t next_tb)
+{
+    for (unsigned i = 0; i < MaxSymbolicTbChain; ++i) {
+        /* Direct jumps return the block and the index of the jump */
+        unsigned n = next_tb & 3;
+        if (n >= 2 || (TranslationBlock*) (next_tb & ~3) != tb) {
+            break;
+        }
+
+        TranslationBlock *next = tb->s2e_tb_next[n];
+        if (!next || tb_invalidated_flag) {
+            break;
+        }
+
+        if (env->exit_request || env->interrupt_request ||
+            g_s2e_state != state || !state->m_active ||
+            state->m_runningConcrete) {
+            break;
+        }
+
+        target_ulong pc, cs_base;
+        int flags;
+        cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+        if (next->pc != pc || next->cs_base != cs_base ||
+            next->flags != (uint64_t) flags) {
+            break;
+        }
+
+        if (!needsSymbolicExecution(state, next)) {
+            break;
+        }
+
+        m_s2e->getCorePlugin()->flushDataMemoryAccesses(state);
+
+        tb = next;
+        env->current_tb = tb;
+        env->s2e_current_tb = tb;
+        next_tb = executeTranslationBlockKlee(state, tb);
+    }
+
+    return next_tb;
+}
+
+uintptr_t S2EExecutor::executeTranslationBlock(
+        S2EExecutionState* state,
+        TranslationBlock* tb)
+{
+    //Avoid incrementing stats every time, very expensive.
+    static unsigned doStatsIncrementCount= 0;
+    assert(state->isActive());
+
+    bool executeKlee = needsSymbolicExecution(state, tb);
+
     if(executeKlee) {
         if(state->m_runningConcrete) {
             TimerStatIncrementer t(stats::concreteModeTime);
@@ -1912,12 +3281,24 @@ uintptr_t S2EExecutor::executeTranslationBlock(
         }
 
         TimerStatIncrementer t(stats::symbolicModeTime);
+        PerfCounterRegion perfRegion(PerfCounters::Symbolic);
 
-        //XXX: adapt scaling dynamically.
-        int slowdown = UseFastHelpers ? ClockSlowDownFastHelpers : ClockSlowDown;
-        cpu_enable_scaling(slowdown);
+        if (SymbolicClockInsnTime) {
+            /* The clock only advances with the instructions of the block,
+               however long KLEE takes to interpret them */
+            cpu_enable_scaling(INT32_MAX);
+            cpu_advance_scaled_clock((int64_t) tb->icount * SymbolicClockInsnTime);
+        } else {
+            //XXX: adapt scaling dynamically.
+            int slowdown = UseFastHelpers ? ClockSlowDownFastHelpers : ClockSlowDown;
+            cpu_enable_scaling(slowdown);
+        }
 
-        return executeTranslationBlockKlee(state, tb);
+        uintptr_t next_tb = executeTranslationBlockKlee(state, tb);
+        if (MaxSymbolicTbChain) {
+            next_tb = executeTranslationBlockChain(state, tb, next_tb);
+        }
+        return next_tb;
 
     } else {
         //g_s2e_exec_ret_addr = 0;
@@ -1928,7 +3309,9 @@ uintptr_t S2EExecutor::executeTranslationBlock(
             TimerStatIncrementer t(stats::concreteModeTime);
         }
 
-        int new_scaling = timers_state.clock_scale / 2;
+        /* The symbolic blocks did not leave a backlog of time behind
+           when they counted instructions, go back to the real time */
+        int new_scaling = SymbolicClockInsnTime ? 1 : timers_state.clock_scale / 2;
         if (new_scaling == 0) {
             new_scaling = 1;
         }
@@ -2021,6 +3404,9 @@ void S2EExecutor::doStateFork(S2EExecutionState *originalState,
 {
     assert(originalState->m_active && !originalState->m_runningConcrete);
 
+    //The accesses so far belong to the common history of the new states
+    m_s2e->getCorePlugin()->flushDataMemoryAccesses(originalState);
+
     llvm::raw_ostream& out = m_s2e->getMessagesStream(originalState);
     out << "Forking state " << originalState->getID()
             << " at pc = " << hexval(originalState->getPc()) << '\n';
@@ -2028,7 +3414,7 @@ void S2EExecutor::doStateFork(S2EExecutionState *originalState,
     for(unsigned i = 0; i < newStates.size(); ++i) {
         S2EExecutionState* newState = newStates[i];
 
-        if (VerboseFork) {
+        if (VerboseFork && m_s2e->isLogEnabled(S2E::LOG_MESSAGES)) {
             out << "    state " << newState->getID() << " with condition "
             << newConditions[i] << '\n';
         }
@@ -2039,7 +3425,7 @@ void S2EExecutor::doStateFork(S2EExecutionState *originalState,
         }
     }
 
-    if (VerboseFork) {
+    if (VerboseFork && m_s2e->isLogEnabled(S2E::LOG_DEBUG)) {
         m_s2e->getDebugStream() << "Stack frame at fork:" << '\n';
         foreach(const StackFrame& fr, originalState->stack) {
             m_s2e->getDebugStream() << fr.kf->function->getName().str() << '\n';
@@ -2050,6 +3436,188 @@ void S2EExecutor::doStateFork(S2EExecutionState *originalState,
                                              newStates, newConditions);
 }
 
+static inline uint64_t hashForkDecision(uint64_t hash, uint64_t pc, unsigned index)
+{
+    uint64_t h = hash ^ (pc + 0x9e3779b97f4a7c15ULL * (index + 1));
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/**
+ * Extends the fork history of the new states and kills the ones
+ * that belong to the other instances when partitioning paths.
+ * The decision only depends on the fork history, all the instances
+ * agree on it as long as they execute deterministically.
+ * Killed states other than the original one are set to NULL.
+ */
+void S2EExecutor::partitionForkedStates(S2EExecutionState *originalState,
+                                        vector<S2EExecutionState*>& newStates)
+{
+    uint64_t pc = originalState->getPc();
+
+    for (unsigned i = 0; i < newStates.size(); ++i) {
+        S2EExecutionState *s = newStates[i];
+        s->m_forkPathHash = hashForkDecision(s->m_forkPathHash, pc, i);
+        ++s->m_forkDepth;
+        s->m_copyOnWriteBytes = 0;
+
+        if (CheckpointInterval) {
+            ForkHistory *history = ForkHistory::extend(s->m_forkHistory, pc, i);
+            ForkHistory::release(s->m_forkHistory);
+            s->m_forkHistory = history;
+        }
+    }
+
+    if (PathPartitionCount == 1 || newStates[0]->m_forkDepth != PathPartitionDepth) {
+        return;
+    }
+
+    for (unsigned i = 0; i < newStates.size(); ++i) {
+        S2EExecutionState *s = newStates[i];
+        if (s->m_forkPathHash % PathPartitionCount == PathPartitionIndex) {
+            continue;
+        }
+
+        m_s2e->getMessagesStream(s) << "Path belongs to instance "
+                << s->m_forkPathHash % PathPartitionCount << ", killing state\n";
+        m_s2e->getCorePlugin()->onStateKill.emit(s);
+        terminateStateAtFork(*s);
+
+        //The current state is killed once the instruction completes
+        if (s == originalState) {
+            m_forkProcTerminateCurrentState = true;
+            qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(rt_clock));
+        } else {
+            newStates[i] = NULL;
+        }
+    }
+}
+
+/**
+ * Follows the fork decisions of a resumed checkpoint. The branches that
+ * leave the recorded tree were explored before the checkpoint, they are
+ * killed like the paths of the other partitions. Killed states other than
+ * the original one are set to NULL.
+ */
+void S2EExecutor::replayForkedStates(S2EExecutionState *originalState,
+                                     vector<S2EExecutionState*>& newStates)
+{
+    //All the new states are copies of the original one
+    const ExplorationCheckpoint::Node *node = originalState->m_replayNode;
+    if (!node) {
+        return;
+    }
+
+    uint64_t pc = originalState->getPc();
+
+    if (!node->hasFork(pc)) {
+        m_s2e->getWarningsStream(originalState) << "Path diverged from the checkpoint at pc "
+                << hexval(pc) << ", exploring it again" << '\n';
+        for (unsigned i = 0; i < newStates.size(); ++i) {
+            if (newStates[i]) {
+                newStates[i]->m_replayNode = NULL;
+            }
+        }
+        return;
+    }
+
+    for (unsigned i = 0; i < newStates.size(); ++i) {
+        S2EExecutionState *s = newStates[i];
+        if (!s || (s == originalState && m_forkProcTerminateCurrentState)) {
+            continue;
+        }
+
+        const ExplorationCheckpoint::Node *child = node->getChild(pc, i);
+        if (child) {
+            s->m_replayNode = child->children.empty() ? NULL : child;
+            if (!s->m_replayNode) {
+                m_s2e->getMessagesStream(s) << "State reached its checkpointed path" << '\n';
+            }
+            continue;
+        }
+
+        m_s2e->getMessagesStream(s) << "Path was explored before the checkpoint, killing state\n";
+        m_s2e->getCorePlugin()->onStateKill.emit(s);
+        terminateStateAtFork(*s);
+
+        if (s == originalState) {
+            m_forkProcTerminateCurrentState = true;
+            qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(rt_clock));
+        } else {
+            newStates[i] = NULL;
+        }
+    }
+}
+
+void S2EExecutor::discardForkedState(S2EExecutionState *state)
+{
+    m_discardedForkedStates.insert(state);
+}
+
+/**
+ * Kills the new states that onStateFork handlers discarded.
+ * Killed states are set to NULL.
+ */
+void S2EExecutor::discardForkedStates(S2EExecutionState *originalState,
+                                      vector<S2EExecutionState*>& newStates)
+{
+    if (m_discardedForkedStates.empty()) {
+        return;
+    }
+
+    for (unsigned i = 0; i < newStates.size(); ++i) {
+        S2EExecutionState *s = newStates[i];
+        if (!s || !m_discardedForkedStates.count(s)) {
+            continue;
+        }
+
+        assert(s != originalState && "The forking state cannot be discarded");
+        m_s2e->getCorePlugin()->onStateKill.emit(s);
+        terminateStateAtFork(*s);
+        newStates[i] = NULL;
+    }
+
+    m_discardedForkedStates.clear();
+}
+
+/**
+ * Must be called while the state forks on a branch instruction.
+ * The devices were saved by notifyBranch() and nothing ran since then.
+ */
+S2EExecutionState *S2EExecutor::checkpointForkingState(S2EExecutionState *state)
+{
+    assert(state->m_active && !state->m_runningConcrete);
+
+    if (!state->prevPC || !isa<BranchInst>(state->prevPC->inst)) {
+        return NULL;
+    }
+
+    S2EExecutionState *checkpoint = static_cast<S2EExecutionState*>(state->branch());
+
+    //Execute the branch again, the operands are still in the stack frame
+    checkpoint->pc = checkpoint->prevPC;
+    checkpoint->m_needFinalizeTBExec = true;
+    checkpoint->m_active = false;
+
+    state->ptreeNode->data = 0;
+    std::pair<PTree::Node*, PTree::Node*> res =
+        processTree->split(state->ptreeNode, checkpoint, state);
+    checkpoint->ptreeNode = res.first;
+    state->ptreeNode = res.second;
+    processTree->deactivate(checkpoint->ptreeNode);
+
+    return checkpoint;
+}
+
+void S2EExecutor::deleteSuspendedState(S2EExecutionState *state)
+{
+    assert(!state->m_active);
+    assert(states.find(state) == states.end());
+    processTree->remove(state->ptreeNode);
+    m_deletedStates.push_back(state);
+}
+
 S2EExecutor::StatePair S2EExecutor::fork(ExecutionState &current,
                             ref<Expr> condition, bool isInternal)
 {
@@ -2058,7 +3626,14 @@ S2EExecutor::StatePair S2EExecutor::fork(ExecutionState &current,
 
     StatePair res;
 
-    if (ConcolicMode) {
+    if (ConcolicMode && ConcolicTraceOnly) {
+        //Keep the condition of the concrete outcome, kleaver negates
+        //the branches offline (see logConcolicPath)
+        bool forkDisabled = current.forkDisabled;
+        current.forkDisabled = true;
+        res = Executor::concolicFork(current, condition, isInternal);
+        current.forkDisabled = forkDisabled;
+    } else if (ConcolicMode) {
         res = Executor::concolicFork(current, condition, isInternal);
     } else {
         res = Executor::fork(current, condition, isInternal);
@@ -2080,6 +3655,14 @@ S2EExecutor::StatePair S2EExecutor::fork(ExecutionState &current,
 
         doStateFork(static_cast<S2EExecutionState*>(&current),
                        newStates, newConditions);
+        partitionForkedStates(static_cast<S2EExecutionState*>(&current),
+                              newStates);
+        replayForkedStates(static_cast<S2EExecutionState*>(&current),
+                           newStates);
+        discardForkedStates(static_cast<S2EExecutionState*>(&current),
+                            newStates);
+        res.first = newStates[0];
+        res.second = newStates[1];
     }
     return res;
 }
@@ -2093,6 +3676,17 @@ void S2EExecutor::notifyBranch(ExecutionState &state)
     S2EExecutionState *s2eState = dynamic_cast<S2EExecutionState*>(&state);
 
     /* Checkpoint the device state before branching */
+    saveActiveState(s2eState);
+}
+
+/**
+ * Copies the parts of the active state that live in QEMU
+ * (devices, CPU, device memory) to the state itself.
+ */
+void S2EExecutor::saveActiveState(S2EExecutionState *s2eState)
+{
+    assert(s2eState->isActive());
+
     qemu_aio_flush();
     bdrv_flush_all();
     s2eState->clearTlbOwnership();
@@ -2109,6 +3703,8 @@ void S2EExecutor::notifyBranch(ExecutionState &state)
         memcpy(store, (uint8_t*) mo->address, mo->size);
     }
 
+    saveLazyObjects(s2eState);
+
     /* Save CPU state */
     const MemoryObject* cpuMo = s2eState->m_cpuSystemState;
     uint8_t *cpuStore = s2eState->m_cpuSystemObject->getConcreteStore();
@@ -2116,11 +3712,73 @@ void S2EExecutor::notifyBranch(ExecutionState &state)
 
     cpu_disable_ticks();
     s2eState->getDeviceState()->saveDeviceState();
+    //The current state keeps using the devices
+    S2EDeviceState::discardLoadedChunks();
     *s2eState->m_timersState = timers_state;
     cpu_enable_ticks();
 
 }
 
+/**
+ * Hash of the guest-visible contents of the active state: registers,
+ * architectural CPU state, per-state RAM and, optionally, devices.
+ * The TLB, the translation caches, instruction counts and timers differ
+ * between otherwise equivalent states and are left out.
+ * Objects shared with other states keep their hash between calls, so
+ * the cost is mostly that of the memory written since the last fork.
+ */
+uint64_t S2EExecutor::computeStateFingerprint(S2EExecutionState *state, bool withDevices)
+{
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    saveActiveState(state);
+
+    /* The native registers are up to date in concrete mode */
+    const ObjectState *regs = state->m_cpuRegistersObject;
+    if (state->m_runningConcrete) {
+        const uint8_t *native = (const uint8_t*) state->m_cpuRegistersState->address;
+        for (unsigned i = 0; i < regs->size; ++i) {
+            if (regs->isConcrete(i, 8)) {
+                hash = (hash ^ native[i]) * prime;
+            } else {
+                hash = (hash ^ 0x100) * prime;
+                hash = (hash ^ regs->read8(i)->hash()) * prime;
+            }
+        }
+    } else {
+        hash = (hash ^ state->addressSpace.getObjectHash(regs)) * prime;
+    }
+
+    /* Architectural state, up to the QEMU bookkeeping fields */
+    const ObjectState *cpu = state->m_cpuSystemObject;
+    hash = (hash ^ cpu->computeHash(0, CPU_OFFSET(current_tb) - CPU_CONC_LIMIT)) * prime;
+    hash = (hash ^ cpu->computeHash(CPU_OFFSET(halted) - CPU_CONC_LIMIT, sizeof(env->halted))) * prime;
+    hash = (hash ^ cpu->computeHash(CPU_OFFSET(interrupt_request) - CPU_CONC_LIMIT,
+                                    sizeof(env->interrupt_request))) * prime;
+
+    foreach2(it, m_perStateRam.begin(), m_perStateRam.end()) {
+        const MemoryObject *mo = *it;
+        if (mo == state->m_dirtyMask) {
+            continue;
+        }
+
+        const ObjectState *os = state->addressSpace.findObject(mo);
+        if (!os) {
+            continue;
+        }
+
+        hash = (hash ^ mo->address) * prime;
+        hash = (hash ^ state->addressSpace.getObjectHash(os)) * prime;
+    }
+
+    if (withDevices) {
+        hash = (hash ^ state->getDeviceState()->getHash()) * prime;
+    }
+
+    return hash;
+}
+
 void S2EExecutor::branch(klee::ExecutionState &state,
           const vector<ref<Expr> > &conditions,
           vector<ExecutionState*> &result)
@@ -2149,6 +3807,18 @@ void S2EExecutor::branch(klee::ExecutionState &state,
     if(newStates.size() > 1) {
         doStateFork(static_cast<S2EExecutionState*>(&state),
                        newStates, newConditions);
+        partitionForkedStates(static_cast<S2EExecutionState*>(&state),
+                              newStates);
+        replayForkedStates(static_cast<S2EExecutionState*>(&state),
+                           newStates);
+        discardForkedStates(static_cast<S2EExecutionState*>(&state),
+                            newStates);
+
+        for(unsigned i = 0, j = 0; i < n; ++i) {
+            if(result[i]) {
+                result[i] = newStates[j++];
+            }
+        }
     }
 }
 
@@ -2187,8 +3857,15 @@ void S2EExecutor::terminateStateEarly(klee::ExecutionState &state, const llvm::T
 void S2EExecutor::terminateState(ExecutionState &s)
 {
     S2EExecutionState& state = static_cast<S2EExecutionState&>(s);
+    if (&state == g_s2e_state) {
+        m_s2e->getCorePlugin()->flushDataMemoryAccesses(&state);
+    }
     m_s2e->getCorePlugin()->onStateKill.emit(&state);
 
+    if (ConcolicMode && ConcolicTraceOnly) {
+        logConcolicPath(&state);
+    }
+
     terminateStateAtFork(state);
     state.zombify();
 
@@ -2247,6 +3924,33 @@ void S2EExecutor::yieldState(ExecutionState &s)
     throw CpuExitException();
 }
 
+/**
+ * Appends the path constraints of the state to concolic-paths.kquery,
+ * as a query for the values of its symbolic arrays. The constraints are
+ * in the order of the branches, kleaver -negate-branches solves each
+ * prefix with the last constraint negated to get the inputs of the
+ * paths that were not explored.
+ */
+void S2EExecutor::logConcolicPath(S2EExecutionState *state)
+{
+    if (!m_concolicPathLog) {
+        m_concolicPathLog = m_s2e->openOutputFile("concolic-paths.kquery");
+    }
+
+    std::vector<const Array*> arrays;
+    for (unsigned i = 0; i < state->symbolics.size(); ++i) {
+        arrays.push_back(state->symbolics[i].second);
+    }
+
+    *m_concolicPathLog << "# State " << state->getID() << ", "
+                       << state->constraints.size() << " constraints\n";
+    ExprPPrinter::printQuery(*m_concolicPathLog, state->constraints,
+                             ConstantExpr::alloc(0, Expr::Bool), 0, 0,
+                             arrays.empty() ? 0 : &arrays[0],
+                             arrays.empty() ? 0 : &arrays[0] + arrays.size());
+    m_concolicPathLog->flush();
+}
+
 void S2EExecutor::terminateStateAtFork(S2EExecutionState &state)
 {
     Executor::terminateState(state);
@@ -2267,6 +3971,11 @@ inline void S2EExecutor::setCCOpEflags(S2EExecutionState *state)
                 if(state->m_runningConcrete)
                     switchToSymbolic(state);
                 TimerStatIncrementer t(stats::symbolicModeTime);
+                PerfCounterRegion perfRegion(PerfCounters::Symbolic);
+                /* The helper only writes cc_src and cc_op, switching
+                   back to concrete mode does not need a full copy */
+                state->markRegistersDirty(CPU_OFFSET(cc_src), sizeof(env->cc_src));
+                state->markRegistersDirty(CPU_OFFSET(cc_op), sizeof(env->cc_op));
                 executeFunction(state, "helper_set_cc_op_eflags");
             } catch(s2e::CpuExitException&) {
                 updateStates(state);
@@ -2306,8 +4015,10 @@ inline void S2EExecutor::doInterrupt(S2EExecutionState *state)
         if(state->m_runningConcrete)
             switchToSymbolic(state);
         std::vector<klee::ref<klee::Expr> > args(0);
+        state->m_dirtyRegisters = (uint64_t) -1;
         try {
             TimerStatIncrementer t(stats::symbolicModeTime);
+            PerfCounterRegion perfRegion(PerfCounters::Symbolic);
             executeFunction(state, "s2e_do_interrupt", args);
         } catch(s2e::CpuExitException&) {
             updateStates(state);
@@ -2317,11 +4028,44 @@ inline void S2EExecutor::doInterrupt(S2EExecutionState *state)
 
 }
 #elif defined(TARGET_I386)
+/**
+ *  Interrupt delivery only reads ESP and the flags, so the native
+ *  handler can run when those are concrete, leaving the other symbolic
+ *  registers untouched. Task gates save all the registers in the TSS,
+ *  they must go through KLEE to keep the symbolic ones.
+ */
+bool S2EExecutor::canDeliverInterruptConcretely(S2EExecutionState *state, int intno)
+{
+    if (state->getSymbolicRegistersMask() & (_M_CC | _M_ESP)) {
+        return false;
+    }
+
+    if ((env->cr[0] & CR0_PE_MASK) && !(env->hflags & HF_LMA_MASK)) {
+        uint32_t e2;
+        if ((intno * 8 + 7) > env->idt.limit) {
+            //General protection fault, let the emulation code raise it
+            return false;
+        }
+
+        if (!state->readMemoryConcrete(env->idt.base + intno * 8 + 4, &e2, sizeof(e2))) {
+            return false;
+        }
+
+        if (((e2 >> DESC_TYPE_SHIFT) & 0x1f) == 5) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 inline void S2EExecutor::doInterrupt(S2EExecutionState *state, int intno,
                                      int is_int, int error_code,
                                      uint64_t next_eip, int is_hw)
 {
-    if(state->m_cpuRegistersObject->isAllConcrete() && !m_executeAlwaysKlee) {
+    if(!m_executeAlwaysKlee &&
+       (state->m_cpuRegistersObject->isAllConcrete() ||
+        (ConcreteInterrupts && canDeliverInterruptConcretely(state, intno)))) {
         if(!state->m_runningConcrete)
             switchToConcrete(state);
         //TimerStatIncrementer t(stats::concreteModeTime);
@@ -2335,8 +4079,10 @@ inline void S2EExecutor::doInterrupt(S2EExecutionState *state, int intno,
         args[2] = klee::ConstantExpr::create(error_code, sizeof(int)*8);
         args[3] = klee::ConstantExpr::create(next_eip, sizeof(target_ulong)*8);
         args[4] = klee::ConstantExpr::create(is_hw, sizeof(int)*8);
+        state->m_dirtyRegisters = (uint64_t) -1;
         try {
             TimerStatIncrementer t(stats::symbolicModeTime);
+            PerfCounterRegion perfRegion(PerfCounters::Symbolic);
             executeFunction(state, "s2e_do_interrupt_all", args);
         } catch(s2e::CpuExitException&) {
             updateStates(state);
@@ -2394,14 +4140,52 @@ void S2EExecutor::unrefS2ETb(S2ETranslationBlock* s2e_tb)
 {
     if(s2e_tb && 0 == --s2e_tb->refCount) {
         if(s2e_tb->llvm_function && !KeepLLVMFunctions) {
-            S2EExternalDispatcher *s2eDispatcher = static_cast<S2EExternalDispatcher*>(externalDispatcher);
-            s2eDispatcher->removeFunction(s2e_tb->llvm_function);
-            kmodule->removeFunction(s2e_tb->llvm_function);
+            m_deadFunctions.insert(s2e_tb->llvm_function);
+            if (s2e_tb->llvm_cold_function) {
+                m_deadFunctions.insert(s2e_tb->llvm_cold_function);
+            }
         }
         foreach(void* s, s2e_tb->executionSignals) {
             delete static_cast<ExecutionSignal*>(s);
         }
+        delete s2e_tb;
+    }
+}
+
+/**
+ * Frees everything that was built for the functions of the dead blocks.
+ * No state references these blocks anymore, and this is only called
+ * outside of KLEE execution, so none of them can be on a stack.
+ */
+void S2EExecutor::reclaimDeadFunctions()
+{
+    if (m_deadFunctions.empty()) {
+        return;
+    }
+
+    S2EExternalDispatcher *s2eDispatcher =
+            static_cast<S2EExternalDispatcher*>(externalDispatcher);
+    s2eDispatcher->removeFunctions(m_deadFunctions);
+
+    ExecutionEngine *engine = m_tcgLLVMContext->getExecutionEngine();
+
+    foreach(Function *f, m_deadFunctions) {
+        m_tcgLLVMContext->forgetFunction(f);
+        globalAddresses.erase(f);
+        legalFunctions.erase((uint64_t) (uintptr_t) (void*) f);
+
+        if (engine) {
+            engine->freeMachineCodeForFunction(f);
+        }
+
+        if (kmodule->functionMap.count(f)) {
+            kmodule->removeFunction(f);
+        } else {
+            f->eraseFromParent();
+        }
     }
+
+    m_deadFunctions.clear();
 }
 
 void S2EExecutor::queueStateForMerge(S2EExecutionState *state)
@@ -2464,6 +4248,9 @@ void s2e_initialize_execution(S2E *s2e, S2EExecutionState *initial_state,
     s2e->getExecutor()->initializeExecution(initial_state, execute_always_klee);
     //XXX: move it to better place (signal handler for this?)
     tcg_register_helper((void*)&s2e_tcg_execution_handler, "s2e_tcg_execution_handler");
+#ifdef S2E_USE_FAST_SIGNALS
+    tcg_register_helper((void*)&s2e_tcg_execution_slot_handler, "s2e_tcg_execution_slot_handler");
+#endif
     tcg_register_helper((void*)&s2e_tcg_custom_instruction_handler, "s2e_tcg_custom_instruction_handler");
 }
 
@@ -2498,15 +4285,56 @@ uintptr_t s2e_qemu_tb_exec(CPUArchState* env1, struct TranslationBlock* tb)
     env = env1;
     g_s2e_state->setRunningExceptionEmulationCode(false);
 
+    //A longjmp out of a counted region skips the end of the region
+    if (PerfCounters::getCurrent() != PerfCounters::Concrete) {
+        PerfCounters::enter(PerfCounters::Concrete);
+    }
+
+    g_s2e->getCorePlugin()->updateFastMemoryAccess();
+
     try {
         uintptr_t ret = g_s2e->getExecutor()->executeTranslationBlock(g_s2e_state, tb);
+        g_s2e->getCorePlugin()->flushDataMemoryAccesses(g_s2e_state);
         return ret;
     } catch(s2e::CpuExitException&) {
+        //A subscriber may kill the state as well, the exit is already under way
+        try {
+            g_s2e->getCorePlugin()->flushDataMemoryAccesses(g_s2e_state);
+        } catch(s2e::CpuExitException&) {
+        }
         g_s2e->getExecutor()->updateStates(g_s2e_state);
         s2e_longjmp(env->jmp_env, 1);
     }
 }
 
+/**
+ *  A detached jump keeps its successor, it only needs the native jump
+ *  target again, once the successor no longer touches the symbolic
+ *  registers. This is a cheap mask compare, done only when the jump
+ *  exits through its stub.
+ */
+void s2e_tb_add_jump(TranslationBlock *tb, int n, TranslationBlock *tb_next)
+{
+    //Unlinked since it was detached, e.g., by cpu_unlink_tb
+    if (!tb->jmp_next[n]) {
+        tb->s2e_tb_detached &= ~(1 << n);
+        tb_add_jump(tb, n, tb_next);
+        return;
+    }
+
+    if (!(tb->s2e_tb_detached & (1 << n)) || tb->s2e_tb_next[n] != tb_next) {
+        return;
+    }
+
+    uint64_t smask = g_s2e_state ? g_s2e_state->getSymbolicRegistersMask() : 0;
+    if (s2e_tb_touches_smask(tb_next, smask)) {
+        return;
+    }
+
+    tb_set_jmp_target(tb, n, (uintptr_t) tb_next->tc_ptr);
+    tb->s2e_tb_detached &= ~(1 << n);
+}
+
 int s2e_qemu_finalize_tb_exec(S2E *s2e, S2EExecutionState* state)
 {
     return s2e->getExecutor()->finalizeTranslationBlockExec(state);
@@ -2577,6 +4405,14 @@ void s2e_update_tlb_entry(S2EExecutionState* state, CPUArchState* env,
 #endif
 }
 
+void s2e_swap_tlb_entries(S2EExecutionState* state, CPUArchState* env,
+                          int mmu_idx, int index, int vindex)
+{
+#ifdef S2E_ENABLE_S2E_TLB
+    state->swapTlbEntries(env, mmu_idx, index, vindex);
+#endif
+}
+
 void s2e_dma_read(uint64_t hostAddress, uint8_t *buf, unsigned size)
 {
     return g_s2e_state->dmaRead(hostAddress, buf, size);
@@ -2584,13 +4420,20 @@ void s2e_dma_read(uint64_t hostAddress, uint8_t *buf, unsigned size)
 
 void s2e_dma_write(uint64_t hostAddress, uint8_t *buf, unsigned size)
 {
-    return g_s2e_state->dmaWrite(hostAddress, buf, size);
+    g_s2e_state->dmaWrite(hostAddress, buf, size);
+
+    CorePlugin *core = g_s2e->getCorePlugin();
+    if (!core->onDmaWrite.empty()) {
+        core->onDmaWrite.emit(g_s2e_state, hostAddress, buf, size);
+    }
 }
 
 void s2e_tb_alloc(S2E*, TranslationBlock *tb)
 {
     tb->s2e_tb = new S2ETranslationBlock;
     tb->s2e_tb->llvm_function = NULL;
+    tb->s2e_tb->llvm_cold_function = NULL;
+    tb->s2e_tb->executionCount = 0;
     tb->s2e_tb->refCount = 1;
 
     /* Push one copy of a signal to use it as a cache */
@@ -2629,11 +4472,26 @@ void s2e_flush_tlb_cache_page(void *objectState, int mmu_idx, int index)
     g_s2e_state->flushTlbCachePage(static_cast<klee::ObjectState*>(objectState), mmu_idx, index);
 }
 
+void s2e_flush_tlb_cache_victim_page(void *objectState, int mmu_idx, int index)
+{
+    g_s2e_state->flushTlbCacheVictimPage(static_cast<klee::ObjectState*>(objectState), mmu_idx, index);
+}
+
 int s2e_is_load_balancing()
 {
     return g_s2e->getExecutor()->isLoadBalancing();
 }
 
+int s2e_skip_idle_time()
+{
+    return SkipIdleTime && g_s2e_state && !g_s2e_state->getSymbolicRegistersMask();
+}
+
+int s2e_is_display_suspended()
+{
+    return Headless && g_s2e && g_s2e->getExecutor()->getStatesCount() > 1;
+}
+
 void helper_register_symbol(const char *name, void *address)
 {
     llvm::sys::DynamicLibrary::AddSymbol(name, address);
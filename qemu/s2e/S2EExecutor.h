@@ -54,6 +54,9 @@ namespace s2e {
 class S2E;
 class S2EExecutionState;
 struct S2ETranslationBlock;
+class SlabExprAllocator;
+class SlabObjectStateAllocator;
+class ExplorationCheckpoint;
 
 class CpuExitException
 {
@@ -87,6 +90,10 @@ typedef void (*StateManagerCb)(S2EExecutionState *s, bool killingState);
 
 class S2EExecutor : public klee::Executor
 {
+public:
+    /** Number of buckets of the state switch cost histogram */
+    static const unsigned StateSwitchCostBuckets = 8;
+
 protected:
     S2E* m_s2e;
     TCGLLVMContext* m_tcgLLVMContext;
@@ -100,24 +107,116 @@ protected:
 
     std::vector<klee::MemoryObject*> m_saveOnContextSwitch;
 
+    /* Host pages of the memory objects that are copied lazily
+       on state switches (see -lazy-state-switch) */
+    enum LazyPageStatus {
+        LAZY_PAGE_NOT_LOADED, LAZY_PAGE_CLEAN, LAZY_PAGE_DIRTY
+    };
+
+    struct LazyPage {
+        uintptr_t hostAddress;
+        unsigned firstObject;
+        unsigned status;
+    };
+
+    /* Sorted by host address, objectsPerPage objects per page */
+    std::vector<LazyPage> m_lazyPages;
+    std::vector<klee::MemoryObject*> m_lazyObjects;
+    unsigned m_lazyObjectsPerPage;
+    uintptr_t m_lazyPageSize;
+
+    /* State from which the lazy pages are loaded */
+    S2EExecutionState *m_lazyState;
+
+    void initializeLazyStateSwitch();
+    void saveLazyObjects(S2EExecutionState *state);
+    void protectLazyObjects(S2EExecutionState *state);
+    static bool lazyPageLess(const LazyPage &page, uintptr_t address);
+    static bool lazyPageAddressLess(const LazyPage &a, const LazyPage &b);
+
+    /* Killed states, freed by reclaimDeletedStates() */
     std::vector<S2EExecutionState*> m_deletedStates;
 
+    /* Functions of the blocks that no state references anymore,
+       freed at the next safe point by reclaimDeadFunctions() */
+    std::set<llvm::Function*> m_deadFunctions;
+
+    /* RAM objects whose content may differ between states, and the state
+       whose memory the translated blocks currently reflect
+       (see -flush-tbs-selectively) */
+    std::vector<klee::MemoryObject*> m_perStateRam;
+    S2EExecutionState *m_tbState;
+
+    void invalidateChangedTbs(S2EExecutionState *tbState, S2EExecutionState *newState);
+
+    /* Slab storage for expression nodes (see -use-expr-slab-allocator) */
+    SlabExprAllocator *m_exprAllocator;
+
+    /* Slab storage for object states (see -use-object-slab-allocator) */
+    SlabObjectStateAllocator *m_objectStateAllocator;
+
     bool m_executeAlwaysKlee;
 
     bool m_forceConcretizations;
 
     bool m_forkProcTerminateCurrentState;
 
+    /* Set when an external call was left through the cpu exit longjmp.
+       Checked by executeInstructions after each instruction. */
+    bool m_cpuExitPending;
+
+    /* New states that onStateFork handlers asked to kill */
+    std::set<S2EExecutionState*> m_discardedForkedStates;
+
     bool m_inLoadBalancing;
 
+    /** Time in seconds of the last update of the process limit */
+    uint64_t m_lastProcessLimitUpdate;
+
     struct QEMUTimer *m_stateSwitchTimer;
 
+    /** Delay in milliseconds between two state switch timer ticks */
+    unsigned m_stateSwitchInterval;
+
+    /** Number of state switches per cost bucket */
+    uint64_t m_stateSwitchCosts[StateSwitchCostBuckets];
+
+    /** Moving average of the state switch cost in microseconds */
+    double m_stateSwitchCost;
+
+    /** State scheduled at the last timer tick and its instruction count */
+    S2EExecutionState *m_sliceState;
+    uint64_t m_sliceInstructions;
+
+    void recordStateSwitchCost(uint64_t usecs);
+    unsigned getStateSwitchDelay(bool idle) const;
+
+    /** Path constraints of the states, in --concolic-trace-only mode */
+    llvm::raw_ostream *m_concolicPathLog;
+
+    void logConcolicPath(S2EExecutionState *state);
+
     /** Holds the yielded state, if any */
     S2EExecutionState* yieldedState;
 
     /** Moves yielded state back into list of schedulable states */
     void restoreYieldedState(void);
 
+    /** Tree of the paths to rebuild, with -resume-checkpoint */
+    ExplorationCheckpoint *m_resumedCheckpoint;
+
+    /** Time in seconds of the last checkpoint */
+    uint64_t m_lastCheckpointTime;
+
+    void loadCheckpoints(S2EExecutionState *initialState);
+    void onCheckpointTimer();
+
+    /** Time in seconds of the last scan for identical objects */
+    uint64_t m_lastDeduplicationTime;
+
+    void onDeduplicationTimer();
+    void deduplicateObjects();
+
 public:
     S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLVMContext,
                 const InterpreterOptions &opts,
@@ -126,6 +225,16 @@ public:
 
     void flushTb();
 
+    /** RAM objects that each state has its own copy of */
+    const std::vector<klee::MemoryObject*> &getPerStateRam() const {
+        return m_perStateRam;
+    }
+
+    /** Returns NULL unless -use-object-slab-allocator is set */
+    const SlabObjectStateAllocator *getObjectStateAllocator() const {
+        return m_objectStateAllocator;
+    }
+
     /** Create initial execution state */
     S2EExecutionState* createInitialState();
 
@@ -182,6 +291,7 @@ public:
 #ifdef TARGET_ARM
     void doInterrupt(S2EExecutionState *state);
 #elif defined(TARGET_I386)
+    bool canDeliverInterruptConcretely(S2EExecutionState *state, int intno);
     void doInterrupt(S2EExecutionState *state, int intno,
                                          int is_int, int error_code,
                                          uint64_t next_eip, int is_hw);
@@ -193,6 +303,18 @@ public:
     /** Puts back the previously suspended state in the queue */
     bool resumeState(S2EExecutionState *state, bool onlyAddToPtree = false);
 
+    /** Copies the forking state from an onStateFork handler. The copy is
+        suspended and executes the branch again once resumed.
+        Returns NULL if the fork does not come from a branch instruction. */
+    S2EExecutionState *checkpointForkingState(S2EExecutionState *state);
+
+    /** Kills one of the new states from an onStateFork handler,
+        as soon as the fork completes */
+    void discardForkedState(S2EExecutionState *state);
+
+    /** Deletes a suspended state that will never be resumed */
+    void deleteSuspendedState(S2EExecutionState *state);
+
     klee::Searcher *getSearcher() const {
         return searcher;
     }
@@ -201,6 +323,27 @@ public:
         searcher = s;
     }
 
+    unsigned getStateSwitchInterval() const {
+        return m_stateSwitchInterval;
+    }
+
+    /** Sets the delay before the next state switch timer tick.
+        Searchers may call this from selectState(). */
+    void setStateSwitchInterval(unsigned ms) {
+        m_stateSwitchInterval = ms;
+    }
+
+    /** Histogram of the state switch costs. Bucket i counts the switches
+        that took less than getStateSwitchCostBound(i) microseconds,
+        the last bucket counts the remaining ones. */
+    static uint64_t getStateSwitchCostBound(unsigned bucket) {
+        return 125 << bucket;
+    }
+
+    uint64_t getStateSwitchCostCount(unsigned bucket) const {
+        return m_stateSwitchCosts[bucket];
+    }
+
     /** Called on fork, used to trace forks */
     StatePair fork(klee::ExecutionState &current,
                    klee::ref<klee::Expr> condition, bool isInternal);
@@ -212,6 +355,8 @@ public:
     }
 
     void unrefS2ETb(S2ETranslationBlock* s2e_tb);
+    void reclaimDeletedStates(S2EExecutionState *activeState);
+    void reclaimDeadFunctions();
 
     void queueStateForMerge(S2EExecutionState *state);
 
@@ -219,10 +364,35 @@ public:
 
     void updateStats(S2EExecutionState *state);
 
+    /** Loads the accessed page of a lazily switched memory object.
+        Returns false if the address is not part of such an object. */
+    bool handleLazyPageFault(uintptr_t address);
+
+    /** Asks executeInstructions to leave the translation block
+        once the current instruction completes */
+    void requestCpuExit() {
+        m_cpuExitPending = true;
+    }
+
     bool isLoadBalancing() const {
         return m_inLoadBalancing;
     }
 
+    /** Writes the screen of the active state to a PPM file.
+        Also works when --headless suspends the display refresh. */
+    void saveScreenshot(const std::string &fileName);
+
+    /** Hash of the guest-visible contents of the active state.
+        Only the registers and memory are included unless withDevices is set. */
+    uint64_t computeStateFingerprint(S2EExecutionState *state, bool withDevices);
+
+    /** Writes the fork decisions of all the live states and the progress
+        of the plugins to checkpoint.dat (see -checkpoint-interval) */
+    void writeCheckpoint();
+
+    /** Serializes the inactive states to states.dat (see -checkpoint-states) */
+    void writeStateSnapshot();
+
     /** Kill the state with test case generation */
     virtual void terminateStateEarly(klee::ExecutionState &state, const llvm::Twine &message);
 
@@ -264,19 +434,40 @@ protected:
                                    klee::KInstruction* target,
                                    std::vector<klee::ref<klee::Expr> > &args);
 
+    static void handleMakeSymbolicIo(klee::Executor* executor,
+                                     klee::ExecutionState* state,
+                                     klee::KInstruction* target,
+                                     std::vector<klee::ref<klee::Expr> > &args);
+
+    static void handlerTraceMmioWrite(klee::Executor* executor,
+                                      klee::ExecutionState* state,
+                                      klee::KInstruction* target,
+                                      std::vector<klee::ref<klee::Expr> > &args);
+
     static void handleGetValue(klee::Executor* executor,
                                klee::ExecutionState* state,
                                klee::KInstruction* target,
                                std::vector<klee::ref<klee::Expr> > &args);
     
+    /* optimize is false for the cold version of translation blocks */
     void prepareFunctionExecution(S2EExecutionState *state,
                            llvm::Function* function,
-                           const std::vector<klee::ref<klee::Expr> >& args);
+                           const std::vector<klee::ref<klee::Expr> >& args,
+                           bool optimize = true);
+    void optimizeHotTranslationBlock(TranslationBlock *tb);
     bool executeInstructions(S2EExecutionState *state, unsigned callerStackSize = 1);
 
     uintptr_t executeTranslationBlockKlee(S2EExecutionState *state,
                                           TranslationBlock *tb);
 
+    bool needsSymbolicExecution(S2EExecutionState *state,
+                                TranslationBlock *tb);
+    uint64_t killDeadSymbolicRegisters(S2EExecutionState *state,
+                                       TranslationBlock *tb, uint64_t smask);
+    uintptr_t executeTranslationBlockChain(S2EExecutionState *state,
+                                           TranslationBlock *tb,
+                                           uintptr_t next_tb);
+
     uintptr_t executeTranslationBlockConcrete(S2EExecutionState *state,
                                               TranslationBlock *tb);
 
@@ -291,6 +482,12 @@ protected:
 
     void doLoadBalancing();
 
+    /** Adjust the number of instances to the free memory and cores */
+    void updateProcessLimit();
+
+    /** Bind the current instance to a core, according to its slot */
+    void pinCurrentProcess();
+
     /** Copy concrete values to their proper location, concretizing
         if necessary (most importantly it will concretize CPU registers.
         Note: this is required only to execute generated code,
@@ -311,6 +508,10 @@ protected:
         through wrappers. */
     bool copyInConcretes(klee::ExecutionState &state);
 
+    /** Lets KLEE call the native version of a helper when its arguments
+        and the CPU registers are concrete (see initializeConcreteHelpers) */
+    bool mayCallNatively(klee::ExecutionState &state, llvm::Function *f,
+                         const std::vector< klee::ref<klee::Expr> > &arguments);
 
 
     /** Called on branches, used to trace forks */
@@ -319,6 +520,16 @@ protected:
               std::vector<klee::ExecutionState*> &result);
 
     void notifyBranch(klee::ExecutionState &state);
+    void saveActiveState(S2EExecutionState *state);
+
+    void partitionForkedStates(S2EExecutionState *originalState,
+                               std::vector<S2EExecutionState*>& newStates);
+
+    void discardForkedStates(S2EExecutionState *originalState,
+                             std::vector<S2EExecutionState*>& newStates);
+
+    void replayForkedStates(S2EExecutionState *originalState,
+                            std::vector<S2EExecutionState*>& newStates);
 
     /** Kills the specified state and raises an exception to exit the cpu loop */
     virtual void terminateState(klee::ExecutionState &state);
@@ -415,6 +626,9 @@ protected:
 
     void replaceExternalFunctionsWithSpecialHandlers();
     void disableConcreteLLVMHelpers();
+    void initializeConcreteHelpers();
+    bool isNativeSafeFunction(llvm::Function *f,
+                              std::vector<llvm::Function*> &callees);
 
     struct HandlerInfo {
       const char *name;
@@ -435,6 +649,14 @@ struct S2ETranslationBlock
         even after TranslationBlock is destroyed */
     llvm::Function* llvm_function;
 
+    /** The version of llvm_function that only went through the lowering
+        passes, kept for the states that may still be executing it.
+        NULL until the block becomes hot. */
+    llvm::Function* llvm_cold_function;
+
+    /** Number of times the block ran in KLEE */
+    unsigned executionCount;
+
     /** A list of all instruction execution signals associated with
         this basic block. All signals in the list will be deleted
         when this translation block will be flushed.
@@ -0,0 +1,634 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+extern "C" {
+#include <qemu-common.h>
+#include <cpu-all.h>
+}
+
+#include "S2EStateSerializer.h"
+
+#include <s2e/S2E.h>
+#include <s2e/S2EExecutor.h>
+#include <s2e/S2EExecutionState.h>
+#include <s2e/S2EDeviceState.h>
+#include <s2e/Plugin.h>
+#include <s2e/Utils.h>
+
+#include <klee/Memory.h>
+
+#include <cstring>
+
+namespace s2e {
+
+using namespace klee;
+
+static const char s_magic[] = "S2ESTAT1";
+static const unsigned s_magicSize = sizeof(s_magic) - 1;
+
+/* Incremented whenever the layout of the records changes */
+static const unsigned s_version = 1;
+
+/* How a RAM object of a state is written */
+enum ObjectTag {
+    OBJECT_REF,
+    OBJECT_SHARED,
+    OBJECT_OWNED
+};
+
+enum ChunkTag {
+    CHUNK_NONE,
+    CHUNK_REF,
+    CHUNK_DATA
+};
+
+/* LEB128, same as the integers of ExprWriter */
+static void putInt(std::vector<unsigned char> &buffer, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        buffer.push_back(value ? byte | 0x80 : byte);
+    } while (value);
+}
+
+static bool getInt(FILE *fp, uint64_t &value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(fp);
+        if (byte == EOF) {
+            return false;
+        }
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************/
+
+StateWriter::StateWriter(FILE *fp, S2EExecutionState *base) :
+        m_fp(fp), m_ok(true), m_base(base), m_writer(m_buffer),
+        m_stateCount(0), m_bytesWritten(0)
+{
+    writeHeader();
+}
+
+StateWriter::~StateWriter()
+{
+    foreach2(it, m_deviceChunks.begin(), m_deviceChunks.end()) {
+        S2EDeviceState::releaseChunk(
+                static_cast<S2EDeviceState::DeviceChunk*>(const_cast<void*>((*it).first)));
+    }
+}
+
+void StateWriter::writeHeader()
+{
+    m_ok = fwrite(s_magic, s_magicSize, 1, m_fp) == 1;
+    m_bytesWritten += s_magicSize;
+
+    m_writer.writeInt(s_version);
+    m_writer.writeInt(g_s2e->getExecutor()->getPerStateRam().size());
+    flush();
+}
+
+/* Records are prefixed by their size, the reader loads one at a time */
+void StateWriter::flush()
+{
+    std::vector<unsigned char> size;
+    putInt(size, m_buffer.size());
+
+    m_ok = m_ok && fwrite(&size[0], size.size(), 1, m_fp) == 1;
+    if (!m_buffer.empty()) {
+        m_ok = m_ok && fwrite(&m_buffer[0], m_buffer.size(), 1, m_fp) == 1;
+    }
+
+    m_bytesWritten += size.size() + m_buffer.size();
+    m_buffer.clear();
+}
+
+void StateWriter::writeObjectContents(const ObjectState *os)
+{
+    m_writer.writeBytes(os->getConcreteStore(true), os->size);
+
+    std::vector<unsigned> symbolic;
+    if (!os->isAllConcrete()) {
+        for (unsigned i = 0; i < os->size; ++i) {
+            if (!os->isConcrete(i, Expr::Int8)) {
+                symbolic.push_back(i);
+            }
+        }
+    }
+
+    m_writer.writeInt(symbolic.size());
+    foreach2(it, symbolic.begin(), symbolic.end()) {
+        ref<Expr> value = os->read8(*it);
+        m_writer.writeInt(*it);
+        m_writer.writeExpr(value);
+        m_exprRefs.push_back(value);
+    }
+}
+
+void StateWriter::writeObjects(S2EExecutionState *state)
+{
+    //The CPU objects are always owned by their state
+    writeObjectContents(state->m_cpuRegistersObject);
+    writeObjectContents(state->m_cpuSystemObject);
+
+    const std::vector<MemoryObject*> &ram = g_s2e->getExecutor()->getPerStateRam();
+    std::vector<std::pair<unsigned, const ObjectState*> > objects;
+
+    for (unsigned i = 0; i < ram.size(); ++i) {
+        const MemoryObject *mo = ram[i];
+        if (mo == S2EExecutionState::m_dirtyMask) {
+            continue;
+        }
+
+        const ObjectState *os = state->addressSpace.findObject(mo);
+        if (!os || (m_base && m_base->addressSpace.findObject(mo) == os)) {
+            continue;
+        }
+        objects.push_back(std::make_pair(i, os));
+    }
+
+    m_writer.writeInt(objects.size());
+    foreach2(it, objects.begin(), objects.end()) {
+        const ObjectState *os = (*it).second;
+        m_writer.writeInt((*it).first);
+
+        std::map<const ObjectState*, uint64_t>::iterator oit = m_objects.find(os);
+        if (oit != m_objects.end()) {
+            m_writer.writeInt(OBJECT_REF);
+            m_writer.writeInt((*oit).second);
+            continue;
+        }
+
+        //Objects owned by the state cannot be shared with another one
+        bool owned = state->addressSpace.isOwnedByUs(os);
+        m_writer.writeInt(owned ? OBJECT_OWNED : OBJECT_SHARED);
+        writeObjectContents(os);
+
+        if (!owned) {
+            uint64_t id = m_objects.size();
+            m_objects[os] = id;
+            m_objectRefs.push_back(ObjectHolder(const_cast<ObjectState*>(os)));
+        }
+    }
+}
+
+void StateWriter::writeConstraints(S2EExecutionState *state)
+{
+    m_writer.writeInt(state->constraints.size());
+    foreach2(it, state->constraints.begin(), state->constraints.end()) {
+        m_writer.writeExpr(*it);
+        m_exprRefs.push_back(*it);
+    }
+
+    m_writer.writeInt(state->symbolics.size());
+    foreach2(it, state->symbolics.begin(), state->symbolics.end()) {
+        m_writer.writeArray((*it).second);
+    }
+
+    const Assignment::bindings_ty &bindings = state->concolics.bindings;
+    m_writer.writeInt(bindings.size());
+    foreach2(it, bindings.begin(), bindings.end()) {
+        const std::vector<unsigned char> &values = (*it).second;
+        m_writer.writeArray((*it).first);
+        m_writer.writeBytes(values.empty() ? NULL : &values[0], values.size());
+    }
+}
+
+static void writeSector(void *opaque, uint64_t sector, const uint8_t *data)
+{
+    std::pair<ExprWriter*, uint64_t> *sink = static_cast<std::pair<ExprWriter*, uint64_t>*>(opaque);
+    sink->first->writeInt(sector);
+    sink->first->writeBytes(data, SectorStore::SECTOR_SIZE);
+    ++sink->second;
+}
+
+void StateWriter::writeDevices(S2EExecutionState *state)
+{
+    S2EDeviceState *devices = state->getDeviceState();
+
+    m_writer.writeInt(devices->m_chunks.size());
+    foreach2(it, devices->m_chunks.begin(), devices->m_chunks.end()) {
+        S2EDeviceState::DeviceChunk *chunk = *it;
+        if (!chunk) {
+            m_writer.writeInt(CHUNK_NONE);
+            continue;
+        }
+
+        std::map<const void*, uint64_t>::iterator cit = m_deviceChunks.find(chunk);
+        if (cit != m_deviceChunks.end()) {
+            m_writer.writeInt(CHUNK_REF);
+            m_writer.writeInt((*cit).second);
+            continue;
+        }
+
+        m_writer.writeInt(CHUNK_DATA);
+        m_writer.writeBytes(chunk->data, chunk->size);
+
+        uint64_t id = m_deviceChunks.size();
+        m_deviceChunks[chunk] = id;
+        ++chunk->refCount;
+    }
+
+    //The sector count comes first, the sectors are collected separately
+    m_writer.writeInt(devices->m_blockStores.size());
+    foreach2(it, devices->m_blockStores.begin(), devices->m_blockStores.end()) {
+        std::vector<unsigned char> sectors;
+        ExprWriter writer(sectors);
+        std::pair<ExprWriter*, uint64_t> sink(&writer, 0);
+        (*it).forEachSector(writeSector, &sink);
+
+        m_writer.writeInt(sink.second);
+        m_buffer.insert(m_buffer.end(), sectors.begin(), sectors.end());
+    }
+}
+
+void StateWriter::writePlugins(S2EExecutionState *state)
+{
+    const std::vector<Plugin*> &plugins = g_s2e->getActivePlugins();
+    std::vector<std::pair<std::string, std::string> > states;
+
+    for (unsigned i = 0; i < state->m_PluginState.size() && i < plugins.size(); ++i) {
+        const PluginState *plgState = state->m_PluginState[i];
+        std::string data;
+        if (plgState && plgState->serialize(data)) {
+            states.push_back(std::make_pair(plugins[i]->getPluginInfo()->name, data));
+        }
+    }
+
+    m_writer.writeInt(states.size());
+    foreach2(it, states.begin(), states.end()) {
+        m_writer.writeBytes((*it).first.data(), (*it).first.size());
+        m_writer.writeBytes((*it).second.data(), (*it).second.size());
+    }
+}
+
+bool StateWriter::write(S2EExecutionState *state)
+{
+    assert(!state->m_active && "The state must be saved first");
+
+    m_writer.writeInt(state->getID());
+    writeObjects(state);
+    writeConstraints(state);
+    writeDevices(state);
+    writePlugins(state);
+    flush();
+
+    ++m_stateCount;
+    return m_ok;
+}
+
+/******************************************************/
+
+StateReader::StateReader(FILE *fp) :
+        m_fp(fp), m_valid(false), m_reader(NULL, 0, &m_arrays), m_stateCount(0)
+{
+    m_valid = readHeader();
+}
+
+StateReader::~StateReader()
+{
+    foreach2(it, m_deviceChunks.begin(), m_deviceChunks.end()) {
+        S2EDeviceState::releaseChunk(static_cast<S2EDeviceState::DeviceChunk*>(*it));
+    }
+}
+
+bool StateReader::readRecord()
+{
+    uint64_t size;
+    if (!getInt(m_fp, size)) {
+        return false;
+    }
+
+    m_record.resize(size);
+    if (size && fread(&m_record[0], size, 1, m_fp) != 1) {
+        return false;
+    }
+
+    m_reader.setData(size ? &m_record[0] : NULL, size);
+    return true;
+}
+
+bool StateReader::readHeader()
+{
+    char magic[s_magicSize];
+    if (fread(magic, s_magicSize, 1, m_fp) != 1 || memcmp(magic, s_magic, s_magicSize)) {
+        return false;
+    }
+
+    uint64_t version, objectCount;
+    if (!readRecord() || !m_reader.readInt(version) || !m_reader.readInt(objectCount)) {
+        return false;
+    }
+
+    //The RAM objects are referred to by their index
+    return version == s_version &&
+           objectCount == g_s2e->getExecutor()->getPerStateRam().size();
+}
+
+bool StateReader::readObjectContents(S2EExecutionState *state, const MemoryObject *mo,
+                                     ObjectState *&os)
+{
+    const unsigned char *data;
+    uint64_t size;
+    if (!m_reader.readBytes(data, size) || size != mo->size) {
+        return false;
+    }
+
+    ObjectState *wos = state->addressSpace.getWriteable(mo, os);
+    if (wos->isAllConcrete()) {
+        memcpy(wos->getConcreteStore(), data, size);
+    } else {
+        for (unsigned i = 0; i < size; ++i) {
+            wos->write8(i, data[i]);
+        }
+    }
+    os = wos;
+
+    uint64_t count;
+    if (!m_reader.readInt(count)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t offset;
+        ref<Expr> value;
+        if (!m_reader.readInt(offset) || offset >= size ||
+            !m_reader.readExpr(value) || value->getWidth() != Expr::Int8) {
+            return false;
+        }
+        wos->write(offset, value);
+    }
+
+    return true;
+}
+
+bool StateReader::readObjects(S2EExecutionState *state)
+{
+    //getWriteable updates the CPU object pointers of the state
+    ObjectState *os = state->m_cpuRegistersObject;
+    if (!readObjectContents(state, state->m_cpuRegistersState, os)) {
+        return false;
+    }
+
+    os = state->m_cpuSystemObject;
+    if (!readObjectContents(state, state->m_cpuSystemState, os)) {
+        return false;
+    }
+
+    const std::vector<MemoryObject*> &ram = g_s2e->getExecutor()->getPerStateRam();
+    uint64_t count;
+    if (!m_reader.readInt(count)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t index, tag;
+        if (!m_reader.readInt(index) || index >= ram.size() || !m_reader.readInt(tag)) {
+            return false;
+        }
+
+        const MemoryObject *mo = ram[index];
+        const ObjectState *current = state->addressSpace.findObject(mo);
+        if (!current) {
+            return false;
+        }
+
+        if (tag == OBJECT_REF) {
+            uint64_t id;
+            if (!m_reader.readInt(id) || id >= m_objects.size()) {
+                return false;
+            }
+
+            const ObjectState *shared = m_objects[id];
+            if (shared->getObject() != mo) {
+                return false;
+            }
+            if (shared != current) {
+                state->addressSpace.shareObject(mo, shared);
+            }
+            continue;
+        }
+
+        if (tag != OBJECT_SHARED && tag != OBJECT_OWNED) {
+            return false;
+        }
+
+        ObjectState *wos = const_cast<ObjectState*>(current);
+        if (!readObjectContents(state, mo, wos)) {
+            return false;
+        }
+
+        if (tag == OBJECT_SHARED) {
+            state->addressSpace.disownObject(mo, wos);
+            m_objects.push_back(ObjectHolder(wos));
+        }
+    }
+
+    return true;
+}
+
+bool StateReader::readConstraints(S2EExecutionState *state)
+{
+    uint64_t count;
+    if (!m_reader.readInt(count)) {
+        return false;
+    }
+
+    std::vector<ref<Expr> > constraints;
+    for (uint64_t i = 0; i < count; ++i) {
+        ref<Expr> constraint;
+        if (!m_reader.readExpr(constraint)) {
+            return false;
+        }
+        constraints.push_back(constraint);
+    }
+    state->constraints = ConstraintManager(constraints);
+
+    if (!m_reader.readInt(count)) {
+        return false;
+    }
+
+    //Same dummy objects as S2EExecutionState::createArray
+    state->symbolics.clear();
+    for (uint64_t i = 0; i < count; ++i) {
+        const Array *array;
+        if (!m_reader.readArray(array)) {
+            return false;
+        }
+
+        MemoryObject *mo = new MemoryObject(0, array->size, false, false, false, NULL);
+        mo->setName(array->name);
+        state->symbolics.push_back(std::make_pair(mo, array));
+    }
+
+    if (!m_reader.readInt(count)) {
+        return false;
+    }
+
+    state->concolics.bindings.clear();
+    for (uint64_t i = 0; i < count; ++i) {
+        const Array *array;
+        const unsigned char *data;
+        uint64_t size;
+        if (!m_reader.readArray(array) || !m_reader.readBytes(data, size)) {
+            return false;
+        }
+        state->concolics.bindings[array] = std::vector<unsigned char>(data, data + size);
+    }
+
+    return true;
+}
+
+bool StateReader::readDevices(S2EExecutionState *state)
+{
+    S2EDeviceState *devices = state->getDeviceState();
+
+    uint64_t count;
+    if (!m_reader.readInt(count) || count != devices->m_chunks.size()) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t tag;
+        if (!m_reader.readInt(tag)) {
+            return false;
+        }
+
+        S2EDeviceState::DeviceChunk *chunk = NULL;
+        if (tag == CHUNK_REF) {
+            uint64_t id;
+            if (!m_reader.readInt(id) || id >= m_deviceChunks.size()) {
+                return false;
+            }
+            chunk = static_cast<S2EDeviceState::DeviceChunk*>(m_deviceChunks[id]);
+        } else if (tag == CHUNK_DATA) {
+            const unsigned char *data;
+            uint64_t size;
+            if (!m_reader.readBytes(data, size)) {
+                return false;
+            }
+            //The reader keeps the first reference
+            chunk = S2EDeviceState::createChunk(data, size);
+            m_deviceChunks.push_back(chunk);
+        } else if (tag != CHUNK_NONE) {
+            return false;
+        }
+
+        if (chunk) {
+            ++chunk->refCount;
+        }
+        if (devices->m_chunks[i]) {
+            S2EDeviceState::releaseChunk(devices->m_chunks[i]);
+        }
+        devices->m_chunks[i] = chunk;
+    }
+
+    if (!m_reader.readInt(count) || count != devices->m_blockStores.size()) {
+        return false;
+    }
+
+    foreach2(it, devices->m_blockStores.begin(), devices->m_blockStores.end()) {
+        uint64_t sectors;
+        if (!m_reader.readInt(sectors)) {
+            return false;
+        }
+
+        (*it).clear();
+        for (uint64_t i = 0; i < sectors; ++i) {
+            uint64_t sector, size;
+            const unsigned char *data;
+            if (!m_reader.readInt(sector) || !m_reader.readBytes(data, size) ||
+                size != SectorStore::SECTOR_SIZE) {
+                return false;
+            }
+            (*it).write(sector, data, 1);
+        }
+    }
+
+    return true;
+}
+
+bool StateReader::readPlugins(S2EExecutionState *state)
+{
+    uint64_t count;
+    if (!m_reader.readInt(count)) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        const unsigned char *name, *data;
+        uint64_t nameSize, dataSize;
+        if (!m_reader.readBytes(name, nameSize) || !m_reader.readBytes(data, dataSize)) {
+            return false;
+        }
+
+        std::string pluginName((const char*) name, nameSize);
+        Plugin *plugin = g_s2e->getPlugin(pluginName);
+        PluginState *plgState = plugin ? state->getWritablePluginState(plugin) : NULL;
+        if (!plgState || !plgState->deserialize(std::string((const char*) data, dataSize))) {
+            g_s2e->getWarningsStream(state) << "Could not restore the state of plugin "
+                    << pluginName << '\n';
+        }
+    }
+
+    return true;
+}
+
+bool StateReader::read(S2EExecutionState *state)
+{
+    assert(!state->m_active && "The state must be inactive");
+
+    uint64_t id;
+    if (!m_valid || !readRecord() || !m_reader.readInt(id)) {
+        return false;
+    }
+
+    if (!readObjects(state) || !readConstraints(state) ||
+        !readDevices(state) || !readPlugins(state) || !m_reader.atEnd()) {
+        return false;
+    }
+
+    ++m_stateCount;
+    return true;
+}
+
+}
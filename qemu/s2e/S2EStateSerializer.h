@@ -0,0 +1,160 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef _S2E_STATE_SERIALIZER_H_
+
+#define _S2E_STATE_SERIALIZER_H_
+
+#include <klee/util/ExprSerializer.h>
+#include <klee/ObjectHolder.h>
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace klee {
+class MemoryObject;
+class ObjectState;
+}
+
+namespace s2e {
+
+class S2EExecutionState;
+
+/**
+ *  Writes execution states to a stream, e.g., to move them to another
+ *  process or to suspend them to disk. Each state is a record of:
+ *
+ *  - the CPU objects, in full,
+ *  - the RAM objects that differ from those of the base state. An object
+ *    shared by several states is written once, the following states refer
+ *    to it by its number,
+ *  - the path constraints, the symbolic arrays and their concolic values.
+ *    Expressions are written once for the whole stream, shared
+ *    subexpressions included,
+ *  - the device snapshots, written once like the objects, and the sectors
+ *    written to the block devices,
+ *  - the plugin states that implement PluginState::serialize().
+ *
+ *  The states must be inactive. The writer keeps the objects and
+ *  expressions it wrote alive, so that their numbers remain valid.
+ */
+class StateWriter {
+public:
+    StateWriter(FILE *fp, S2EExecutionState *base = NULL);
+    ~StateWriter();
+
+    bool write(S2EExecutionState *state);
+
+    /* False once a write to the file failed */
+    bool isOk() const { return m_ok; }
+
+    unsigned getStateCount() const { return m_stateCount; }
+    uint64_t getBytesWritten() const { return m_bytesWritten; }
+
+private:
+    FILE *m_fp;
+    bool m_ok;
+    S2EExecutionState *m_base;
+
+    std::vector<unsigned char> m_buffer;
+    klee::ExprWriter m_writer;
+
+    std::map<const klee::ObjectState*, uint64_t> m_objects;
+    std::vector<klee::ObjectHolder> m_objectRefs;
+    std::vector<klee::ref<klee::Expr> > m_exprRefs;
+
+    std::map<const void*, uint64_t> m_deviceChunks;
+
+    unsigned m_stateCount;
+    uint64_t m_bytesWritten;
+
+    void writeHeader();
+    void writeObjectContents(const klee::ObjectState *os);
+    void writeObjects(S2EExecutionState *state);
+    void writeConstraints(S2EExecutionState *state);
+    void writeDevices(S2EExecutionState *state);
+    void writePlugins(S2EExecutionState *state);
+    void flush();
+};
+
+/**
+ *  Reads back the states of a StateWriter stream, in the same order.
+ *  Each record is loaded into an inactive state that has the objects of
+ *  the base of the writer, e.g., a copy of the base state in this process.
+ *  The states read from the stream share the objects that the written
+ *  states shared.
+ */
+class StateReader {
+public:
+    StateReader(FILE *fp);
+    ~StateReader();
+
+    /* False if the stream is not a state stream of this version */
+    bool isValid() const { return m_valid; }
+
+    /* Returns false at the end of the stream or if a record is malformed */
+    bool read(S2EExecutionState *state);
+
+    unsigned getStateCount() const { return m_stateCount; }
+
+private:
+    FILE *m_fp;
+    bool m_valid;
+
+    std::vector<unsigned char> m_record;
+    klee::ExprReader::ArrayTable m_arrays;
+    klee::ExprReader m_reader;
+
+    std::vector<klee::ObjectHolder> m_objects;
+    std::vector<void*> m_deviceChunks;
+
+    unsigned m_stateCount;
+
+    bool readHeader();
+    bool readRecord();
+    bool readObjectContents(S2EExecutionState *state, const klee::MemoryObject *mo,
+                            klee::ObjectState *&os);
+    bool readObjects(S2EExecutionState *state);
+    bool readConstraints(S2EExecutionState *state);
+    bool readDevices(S2EExecutionState *state);
+    bool readPlugins(S2EExecutionState *state);
+};
+
+}
+
+#endif
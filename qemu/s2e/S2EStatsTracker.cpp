@@ -37,10 +37,14 @@
 
 #include <s2e/S2EExecutor.h>
 #include <s2e/S2EExecutionState.h>
+#include <s2e/SlabObjectStateAllocator.h>
+#include <s2e/s2e_qemu.h>
 
 #include <klee/CoreStats.h>
 #include <klee/SolverStats.h>
 #include <klee/Internal/System/Time.h>
+#include <klee/Internal/Support/PerfCounters.h>
+#include <klee/Internal/Support/StatsStream.h>
 
 #include <llvm/Support/Process.h>
 
@@ -55,6 +59,7 @@
 #ifdef CONFIG_DARWIN
 #include <mach/mach.h>
 #include <mach/mach_traps.h>
+#include <sys/resource.h>
 #endif
 
 #ifdef CONFIG_WIN32
@@ -74,6 +79,15 @@ namespace stats {
 
     Statistic concreteModeTime("ConcreteModeTime", "ConcModeTime");
     Statistic symbolicModeTime("SymbolicModeTime", "SymbModeTime");
+
+    Statistic stateSwitches("StateSwitches", "StSw");
+    Statistic stateSwitchTime("StateSwitchTime", "StSwTime");
+    Statistic stateSwitchBytes("StateSwitchBytes", "StSwBytes");
+
+    Statistic copyOnWriteBytes("CopyOnWriteBytes", "CowBytes");
+
+    Statistic deduplicatedObjects("DeduplicatedObjects", "DedupObjs");
+    Statistic deduplicatedBytes("DeduplicatedBytes", "DedupBytes");
 } // namespace stats
 } // namespace klee
 
@@ -138,66 +152,202 @@ uint64_t S2EStatsTracker::getProcessMemoryUsage()
 #endif
 }
 
-void S2EStatsTracker::writeStatsHeader() {
-  *statsFile //<< "('Instructions',"
-             //<< "'FullBranches',"
-             //<< "'PartialBranches',"
-             //<< "'NumBranches',"
-             << "('NumStates',"
-             << "'NumQueries',"
-             << "'NumQueryConstructs',"
-             << "'NumObjects',"
-             //<< "'CoveredInstructions',"
-             //<< "'UncoveredInstructions',"
-             << "'TranslationBlocks',"
-             << "'TranslationBlocksConcrete',"
-             << "'TranslationBlocksKlee',"
-             << "'CpuInstructions',"
-             << "'CpuInstructionsConcrete',"
-             << "'CpuInstructionsKlee',"
-             << "'ConcreteModeTime',"
-             << "'SymbolicModeTime',"
-             << "'UserTime',"
-             << "'WallTime',"
-             << "'QueryTime',"
-             << "'SolverTime',"
-             << "'CexCacheTime',"
-             << "'ForkTime',"
-             << "'ResolveTime',"
-             << "'MemoryUsage',"
-             << ")\n";
-  statsFile->flush();
+uint64_t S2EStatsTracker::getProcessResidentMemoryUsage()
+{
+#if defined(CONFIG_WIN32)
+
+    PROCESS_MEMORY_COUNTERS Memory;
+    HANDLE CurrentProcess = GetCurrentProcess();
+
+    if (!GetProcessMemoryInfo(CurrentProcess, &Memory, sizeof(Memory))) {
+        return 0;
+    }
+
+    return Memory.WorkingSetSize;
+
+#elif defined(CONFIG_DARWIN)
+    //Already the resident size
+    return getProcessMemoryUsage();
+
+#else
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp) {
+        return 0;
+    }
+
+    uint64_t rss = 0;
+
+    char buffer[512];
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        if (sscanf(buffer, "VmRSS: %" PRIu64, &rss)) {
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    return rss * 1024;
+#endif
+}
+
+uint64_t S2EStatsTracker::getProcessPeakResidentMemoryUsage()
+{
+#if defined(CONFIG_WIN32)
+
+    PROCESS_MEMORY_COUNTERS Memory;
+    HANDLE CurrentProcess = GetCurrentProcess();
+
+    if (!GetProcessMemoryInfo(CurrentProcess, &Memory, sizeof(Memory))) {
+        return 0;
+    }
+
+    return Memory.PeakWorkingSetSize;
+
+#elif defined(CONFIG_DARWIN)
+    //ru_maxrss is in bytes on Mac OS X
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;
+
+#else
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp) {
+        return 0;
+    }
+
+    uint64_t hwm = 0;
+
+    char buffer[512];
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        if (sscanf(buffer, "VmHWM: %" PRIu64, &hwm)) {
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    return hwm * 1024;
+#endif
+}
+
+uint64_t S2EStatsTracker::getHostAvailableMemory()
+{
+#if defined(CONFIG_WIN32) || defined(CONFIG_DARWIN)
+    return 0;
+#else
+    FILE *fp = fopen("/proc/meminfo", "r");
+    if (!fp) {
+        return 0;
+    }
+
+    uint64_t available = 0, free = 0, cached = 0, value;
+    bool hasAvailable = false;
+
+    char buffer[512];
+    while(fgets(buffer, sizeof(buffer), fp)) {
+        if (sscanf(buffer, "MemAvailable: %" PRIu64, &value)) {
+            available = value;
+            hasAvailable = true;
+            break;
+        } else if (sscanf(buffer, "MemFree: %" PRIu64, &value)) {
+            free = value;
+        } else if (sscanf(buffer, "Cached: %" PRIu64, &value)) {
+            cached = value;
+        }
+    }
+
+    fclose(fp);
+
+    //Older kernels do not report MemAvailable
+    if (!hasAvailable) {
+        available = free + cached;
+    }
+
+    return available * 1024;
+#endif
 }
 
-void S2EStatsTracker::writeStatsLine() {
-  *statsFile //<< "(" << stats::instructions
-             //<< "," << fullBranches
-             //<< "," << partialBranches
-             //<< "," << numBranches
-             << "(" << executor.getStatesCount()
-             << "," << stats::queries
-             << "," << stats::queryConstructs
-             << "," << 0 // was numObjects
-             //<< "," << stats::coveredInstructions
-             //<< "," << stats::uncoveredInstructions
-             << "," << stats::translationBlocks
-             << "," << stats::translationBlocksConcrete
-             << "," << stats::translationBlocksKlee
-             << "," << stats::cpuInstructions
-             << "," << stats::cpuInstructionsConcrete
-             << "," << stats::cpuInstructionsKlee
-             << "," << stats::concreteModeTime / 1000000.
-             << "," << stats::symbolicModeTime / 1000000.
-             << "," << util::getUserTime()
-             << "," << elapsed()
-             << "," << stats::queryTime / 1000000.
-             << "," << stats::solverTime / 1000000.
-             << "," << stats::cexCacheTime / 1000000.
-             << "," << stats::forkTime / 1000000.
-             << "," << stats::resolveTime / 1000000.
-             << "," << getProcessMemoryUsage() //sys::Process::GetTotalMemoryUsage()
-             << ")\n";
-  statsFile->flush();
+void S2EStatsTracker::getStatsRow(StatsRow &row) {
+  //Instruction and branch coverage are not tracked in S2E
+  row.addGauge("NumStates", executor.getStatesCount());
+  row.addCounter("NumQueries", stats::queries);
+  row.addCounter("NumQueryConstructs", stats::queryConstructs);
+  row.addGauge("NumObjects", 0); // was numObjects
+  row.addCounter("TranslationBlocks", stats::translationBlocks);
+  row.addCounter("TranslationBlocksConcrete", stats::translationBlocksConcrete);
+  row.addCounter("TranslationBlocksKlee", stats::translationBlocksKlee);
+  row.addCounter("CpuInstructions", stats::cpuInstructions);
+  row.addCounter("CpuInstructionsConcrete", stats::cpuInstructionsConcrete);
+  row.addCounter("CpuInstructionsKlee", stats::cpuInstructionsKlee);
+  row.addTime("ConcreteModeTime", stats::concreteModeTime / 1000000.);
+  row.addTime("SymbolicModeTime", stats::symbolicModeTime / 1000000.);
+  row.addTime("UserTime", util::getUserTime());
+  row.addTime("WallTime", elapsed());
+  row.addTime("QueryTime", stats::queryTime / 1000000.);
+  row.addTime("SolverTime", stats::solverTime / 1000000.);
+  row.addTime("CexCacheTime", stats::cexCacheTime / 1000000.);
+  row.addTime("ForkTime", stats::forkTime / 1000000.);
+  row.addTime("ResolveTime", stats::resolveTime / 1000000.);
+  row.addGauge("MemoryUsage", getProcessMemoryUsage()); //sys::Process::GetTotalMemoryUsage()
+
+  //Live object state blocks per slab size class
+  const SlabObjectStateAllocator *osAllocator =
+          static_cast<S2EExecutor&>(executor).getObjectStateAllocator();
+  for (unsigned i = SlabObjectStateAllocator::MinPo2;
+       i <= SlabObjectStateAllocator::MaxPo2; ++i) {
+      std::stringstream name;
+      name << "ObjectSlab" << (1 << i);
+      row.addGauge(name.str(), osAllocator ? osAllocator->getAllocatedBlocksCount(i) : 0);
+  }
+  row.addCounter("ObjectSlabFallbacks", osAllocator ? osAllocator->getFallbacksCount() : 0);
+  row.addCounter("StateSwitches", stats::stateSwitches);
+  row.addTime("StateSwitchTime", stats::stateSwitchTime / 1000000.);
+
+  //State switches per cost bucket
+  const S2EExecutor &s2eExecutor = static_cast<S2EExecutor&>(executor);
+  for (unsigned i = 0; i < S2EExecutor::StateSwitchCostBuckets; ++i) {
+      std::stringstream name;
+      if (i < S2EExecutor::StateSwitchCostBuckets - 1) {
+          name << "StateSwitchLt" << S2EExecutor::getStateSwitchCostBound(i) << "us";
+      } else {
+          name << "StateSwitchGe" << S2EExecutor::getStateSwitchCostBound(i - 1) << "us";
+      }
+      row.addCounter(name.str(), s2eExecutor.getStateSwitchCostCount(i));
+  }
+
+  row.addCounter("Forks", stats::forks);
+  row.addGauge("PeakResidentMemory", getProcessPeakResidentMemoryUsage());
+  row.addCounter("StateSwitchBytes", stats::stateSwitchBytes);
+  row.addCounter("CopyOnWriteBytes", stats::copyOnWriteBytes);
+  row.addCounter("DeduplicatedObjects", stats::deduplicatedObjects);
+  row.addCounter("DeduplicatedBytes", stats::deduplicatedBytes);
+
+  //Memory used by the current state
+  S2EExecutionState::MemoryUsage usage;
+  if (g_s2e_state) {
+      g_s2e_state->getMemoryUsage(usage);
+  }
+  row.addGauge("StateOwnedBytes", usage.concreteBytes + usage.symbolicBytes);
+  row.addGauge("StateSharedBytes", usage.sharedBytes);
+  row.addGauge("StateConstraintNodes", usage.constraintNodes);
+  row.addGauge("StatePluginBytes", usage.pluginStateBytes);
+
+  //Hardware counters per execution mode, only when -s2e-perf-counters works
+  if (PerfCounters::isEnabled()) {
+      PerfCounters::update();
+      for (unsigned r = 0; r < PerfCounters::RegionCount; ++r) {
+          for (unsigned c = 0; c < PerfCounters::CounterCount; ++c) {
+              std::stringstream name;
+              name << "Perf"
+                   << PerfCounters::getCounterName((PerfCounters::Counter) c)
+                   << PerfCounters::getRegionName((PerfCounters::Region) r);
+              row.addCounter(name.str(), PerfCounters::get((PerfCounters::Region) r,
+                                                           (PerfCounters::Counter) c));
+          }
+      }
+  }
 }
 
 S2EStateStats::S2EStateStats():
@@ -51,6 +51,15 @@ namespace stats {
 
     extern klee::Statistic concreteModeTime;
     extern klee::Statistic symbolicModeTime;
+
+    extern klee::Statistic stateSwitches;
+    extern klee::Statistic stateSwitchTime;
+    extern klee::Statistic stateSwitchBytes;
+
+    extern klee::Statistic copyOnWriteBytes;
+
+    extern klee::Statistic deduplicatedObjects;
+    extern klee::Statistic deduplicatedBytes;
 } // namespace stats
 } // namespace klee
 
@@ -64,9 +73,18 @@ public:
         : StatsTracker(_executor, _objectFilename, _updateMinDistToUncovered) {}
 
     static uint64_t getProcessMemoryUsage();
+
+    /** Returns the resident set size of the process in bytes */
+    static uint64_t getProcessResidentMemoryUsage();
+
+    /** Returns the largest resident set size of the process so far */
+    static uint64_t getProcessPeakResidentMemoryUsage();
+
+    /** Returns the memory available to new processes on the host in bytes,
+        or 0 if it is unknown */
+    static uint64_t getHostAvailableMemory();
 protected:
-    void writeStatsHeader();
-    void writeStatsLine();
+    void getStatsRow(klee::StatsRow &row);
 };
 
 class S2EExecutionState;
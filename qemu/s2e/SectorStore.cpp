@@ -0,0 +1,512 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include "SectorStore.h"
+
+namespace s2e {
+
+int SectorStore::s_spillFd = -1;
+uint64_t SectorStore::s_spillThreshold = 0;
+int64_t SectorStore::s_spillEnd = 0;
+std::vector<int64_t> SectorStore::s_freeSpillSlots;
+
+uint64_t SectorStore::s_residentBytes = 0;
+SectorStore::Extent *SectorStore::s_lruHead = NULL;
+SectorStore::Extent *SectorStore::s_lruTail = NULL;
+
+SectorStore::SectorStore(): m_root(NULL)
+{
+
+}
+
+SectorStore::SectorStore(const SectorStore &store): m_root(store.m_root)
+{
+    if (m_root) {
+        ++m_root->refCount;
+    }
+}
+
+SectorStore::~SectorStore()
+{
+    if (m_root) {
+        releaseNode(m_root, 0);
+    }
+}
+
+void SectorStore::clear()
+{
+    if (m_root) {
+        releaseNode(m_root, 0);
+        m_root = NULL;
+    }
+}
+
+bool SectorStore::setSpillFile(const std::string &path, uint64_t threshold)
+{
+    assert(s_spillFd == -1);
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        llvm::errs() << "SectorStore: could not open spill file " << path
+                     << " (errno " << errno << ")\n";
+        return false;
+    }
+
+    s_spillFd = fd;
+    s_spillThreshold = threshold;
+    return true;
+}
+
+/*****************************************************************************/
+
+SectorStore::Node *SectorStore::createNode()
+{
+    Node *node = new Node();
+    node->refCount = 1;
+    memset(node->children, 0, sizeof(node->children));
+    return node;
+}
+
+void SectorStore::releaseNode(Node *node, unsigned level)
+{
+    assert(node->refCount > 0);
+    if (--node->refCount > 0) {
+        return;
+    }
+
+    for (unsigned i = 0; i < FANOUT; ++i) {
+        if (!node->children[i]) {
+            continue;
+        }
+
+        if (level == LEVELS - 1) {
+            releaseExtent(static_cast<Extent*>(node->children[i]));
+        } else {
+            releaseNode(static_cast<Node*>(node->children[i]), level + 1);
+        }
+    }
+
+    delete node;
+}
+
+/* The copy shares all the children of the original node */
+SectorStore::Node *SectorStore::cloneNode(const Node *node, unsigned level)
+{
+    Node *copy = createNode();
+    memcpy(copy->children, node->children, sizeof(copy->children));
+
+    for (unsigned i = 0; i < FANOUT; ++i) {
+        if (!copy->children[i]) {
+            continue;
+        }
+
+        if (level == LEVELS - 1) {
+            ++static_cast<Extent*>(copy->children[i])->refCount;
+        } else {
+            ++static_cast<Node*>(copy->children[i])->refCount;
+        }
+    }
+
+    return copy;
+}
+
+/*****************************************************************************/
+
+SectorStore::Extent *SectorStore::createExtent()
+{
+    Extent *extent = new Extent();
+    extent->refCount = 1;
+    extent->validMask = 0;
+    extent->spillOffset = -1;
+    extent->dirty = true;
+    extent->lruPrev = extent->lruNext = NULL;
+
+    extent->data = (uint8_t*) malloc(EXTENT_SIZE);
+    if (!extent->data) {
+        llvm::errs() << "SectorStore: could not allocate memory\n";
+        exit(-1);
+    }
+
+    s_residentBytes += EXTENT_SIZE;
+    lruInsert(extent);
+    return extent;
+}
+
+void SectorStore::releaseExtent(Extent *extent)
+{
+    assert(extent->refCount > 0);
+    if (--extent->refCount > 0) {
+        return;
+    }
+
+    if (extent->data) {
+        lruRemove(extent);
+        free(extent->data);
+        s_residentBytes -= EXTENT_SIZE;
+    }
+
+    if (extent->spillOffset >= 0) {
+        s_freeSpillSlots.push_back(extent->spillOffset);
+    }
+
+    delete extent;
+}
+
+SectorStore::Extent *SectorStore::cloneExtent(Extent *extent)
+{
+    makeResident(extent);
+
+    Extent *copy = createExtent();
+    copy->validMask = extent->validMask;
+    memcpy(copy->data, extent->data, EXTENT_SIZE);
+    return copy;
+}
+
+/*****************************************************************************/
+
+void SectorStore::lruRemove(Extent *extent)
+{
+    if (extent->lruPrev) {
+        extent->lruPrev->lruNext = extent->lruNext;
+    } else {
+        s_lruHead = extent->lruNext;
+    }
+
+    if (extent->lruNext) {
+        extent->lruNext->lruPrev = extent->lruPrev;
+    } else {
+        s_lruTail = extent->lruPrev;
+    }
+
+    extent->lruPrev = extent->lruNext = NULL;
+}
+
+void SectorStore::lruInsert(Extent *extent)
+{
+    extent->lruPrev = NULL;
+    extent->lruNext = s_lruHead;
+    if (s_lruHead) {
+        s_lruHead->lruPrev = extent;
+    } else {
+        s_lruTail = extent;
+    }
+    s_lruHead = extent;
+}
+
+/* Brings the extent back from the spill file and marks it as recently used */
+void SectorStore::makeResident(Extent *extent)
+{
+    if (extent->data) {
+        if (s_spillFd >= 0 && extent != s_lruHead) {
+            lruRemove(extent);
+            lruInsert(extent);
+        }
+        return;
+    }
+
+    assert(s_spillFd >= 0 && extent->spillOffset >= 0);
+
+    extent->data = (uint8_t*) malloc(EXTENT_SIZE);
+    if (!extent->data) {
+        llvm::errs() << "SectorStore: could not allocate memory\n";
+        exit(-1);
+    }
+
+    if (pread(s_spillFd, extent->data, EXTENT_SIZE, extent->spillOffset) != EXTENT_SIZE) {
+        llvm::errs() << "SectorStore: could not read spill file (errno " << errno << ")\n";
+        exit(-1);
+    }
+
+    extent->dirty = false;
+    s_residentBytes += EXTENT_SIZE;
+    lruInsert(extent);
+
+    evict(extent);
+}
+
+void SectorStore::spill(Extent *extent)
+{
+    assert(extent->data);
+
+    if (extent->dirty) {
+        if (extent->spillOffset < 0) {
+            if (!s_freeSpillSlots.empty()) {
+                extent->spillOffset = s_freeSpillSlots.back();
+                s_freeSpillSlots.pop_back();
+            } else {
+                extent->spillOffset = s_spillEnd;
+                s_spillEnd += EXTENT_SIZE;
+            }
+        }
+
+        if (pwrite(s_spillFd, extent->data, EXTENT_SIZE, extent->spillOffset) != EXTENT_SIZE) {
+            llvm::errs() << "SectorStore: could not write spill file (errno " << errno << ")\n";
+            exit(-1);
+        }
+        extent->dirty = false;
+    }
+
+    lruRemove(extent);
+    free(extent->data);
+    extent->data = NULL;
+    s_residentBytes -= EXTENT_SIZE;
+}
+
+/* Spills the least recently used extents, except the one being accessed */
+void SectorStore::evict(Extent *keep)
+{
+    if (s_spillFd < 0) {
+        return;
+    }
+
+    while (s_residentBytes > s_spillThreshold && s_lruTail && s_lruTail != keep) {
+        spill(s_lruTail);
+    }
+}
+
+/*****************************************************************************/
+
+SectorStore::Extent *SectorStore::findExtent(uint64_t extentIndex) const
+{
+    const Node *node = m_root;
+    for (unsigned level = 0; node && level < LEVELS - 1; ++level) {
+        node = static_cast<const Node*>(node->children[slot(extentIndex, level)]);
+    }
+
+    if (!node) {
+        return NULL;
+    }
+
+    return static_cast<Extent*>(node->children[slot(extentIndex, LEVELS - 1)]);
+}
+
+/* Unshares the path from the root to the extent */
+SectorStore::Extent *SectorStore::getWritableExtent(uint64_t extentIndex)
+{
+    assert(extentIndex >> (LEVELS * LEVEL_BITS) == 0 && "Sector out of range");
+
+    Node **pnode = &m_root;
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        if (!*pnode) {
+            *pnode = createNode();
+        } else if ((*pnode)->refCount > 1) {
+            Node *copy = cloneNode(*pnode, level);
+            releaseNode(*pnode, level);
+            *pnode = copy;
+        }
+
+        void **child = &(*pnode)->children[slot(extentIndex, level)];
+        if (level < LEVELS - 1) {
+            pnode = reinterpret_cast<Node**>(child);
+            continue;
+        }
+
+        Extent *extent = static_cast<Extent*>(*child);
+        if (!extent) {
+            extent = createExtent();
+        } else if (extent->refCount > 1) {
+            Extent *copy = cloneExtent(extent);
+            releaseExtent(extent);
+            extent = copy;
+        } else {
+            makeResident(extent);
+        }
+
+        *child = extent;
+        extent->dirty = true;
+        evict(extent);
+        return extent;
+    }
+
+    assert(false);
+    return NULL;
+}
+
+void SectorStore::write(uint64_t sector, const uint8_t *buf, unsigned count)
+{
+    while (count > 0) {
+        Extent *extent = getWritableExtent(sector / EXTENT_SECTORS);
+
+        unsigned first = sector % EXTENT_SECTORS;
+        unsigned n = EXTENT_SECTORS - first;
+        if (n > count) {
+            n = count;
+        }
+
+        memcpy(&extent->data[first * SECTOR_SIZE], buf, n * SECTOR_SIZE);
+        extent->validMask |= ((1 << n) - 1) << first;
+
+        buf += n * SECTOR_SIZE;
+        sector += n;
+        count -= n;
+    }
+}
+
+int SectorStore::read(uint64_t sector, uint8_t *buf, unsigned count) const
+{
+    int copied = 0, missing = 0;
+
+    while (count > 0) {
+        Extent *extent = findExtent(sector / EXTENT_SECTORS);
+        unsigned first = sector % EXTENT_SECTORS;
+        unsigned n = 0;
+
+        if (extent && (extent->validMask & (1 << first))) {
+            if (missing) {
+                break;
+            }
+
+            makeResident(extent);
+            while (first + n < EXTENT_SECTORS && n < count &&
+                   (extent->validMask & (1 << (first + n)))) {
+                ++n;
+            }
+
+            memcpy(buf, &extent->data[first * SECTOR_SIZE], n * SECTOR_SIZE);
+            buf += n * SECTOR_SIZE;
+            copied += n;
+        } else {
+            if (copied) {
+                break;
+            }
+
+            while (first + n < EXTENT_SECTORS && n < count &&
+                   !(extent && (extent->validMask & (1 << (first + n))))) {
+                ++n;
+            }
+            missing += n;
+        }
+
+        sector += n;
+        count -= n;
+
+        //The run stops inside the extent
+        if (first + n < EXTENT_SECTORS && count > 0) {
+            break;
+        }
+    }
+
+    return copied ? copied : -missing;
+}
+
+/* FNV-1a over the slots and the written sectors of the extents */
+uint64_t SectorStore::hashNode(const Node *node, unsigned level, uint64_t hash)
+{
+    const uint64_t prime = 0x100000001b3ULL;
+
+    for (unsigned i = 0; i < FANOUT; ++i) {
+        if (!node->children[i]) {
+            continue;
+        }
+
+        hash = (hash ^ (level * FANOUT + i)) * prime;
+
+        if (level < LEVELS - 1) {
+            hash = hashNode(static_cast<const Node*>(node->children[i]), level + 1, hash);
+            continue;
+        }
+
+        Extent *extent = static_cast<Extent*>(node->children[i]);
+        makeResident(extent);
+        hash = (hash ^ extent->validMask) * prime;
+
+        for (unsigned sector = 0; sector < EXTENT_SECTORS; ++sector) {
+            if (!(extent->validMask & (1 << sector))) {
+                continue;
+            }
+
+            const uint8_t *data = &extent->data[sector * SECTOR_SIZE];
+            for (unsigned b = 0; b < SECTOR_SIZE; b += sizeof(uint64_t)) {
+                uint64_t word;
+                memcpy(&word, &data[b], sizeof(word));
+                hash = (hash ^ word) * prime;
+            }
+        }
+    }
+
+    return hash;
+}
+
+uint64_t SectorStore::getHash() const
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    return m_root ? hashNode(m_root, 0, hash) : hash;
+}
+
+void SectorStore::visitNode(const Node *node, unsigned level, uint64_t extentIndex,
+                            SectorVisitor visitor, void *opaque)
+{
+    for (unsigned i = 0; i < FANOUT; ++i) {
+        if (!node->children[i]) {
+            continue;
+        }
+
+        uint64_t index = (extentIndex << LEVEL_BITS) | i;
+        if (level < LEVELS - 1) {
+            visitNode(static_cast<const Node*>(node->children[i]), level + 1,
+                      index, visitor, opaque);
+            continue;
+        }
+
+        Extent *extent = static_cast<Extent*>(node->children[i]);
+        makeResident(extent);
+
+        for (unsigned sector = 0; sector < EXTENT_SECTORS; ++sector) {
+            if (extent->validMask & (1 << sector)) {
+                visitor(opaque, index * EXTENT_SECTORS + sector,
+                        &extent->data[sector * SECTOR_SIZE]);
+            }
+        }
+    }
+}
+
+void SectorStore::forEachSector(SectorVisitor visitor, void *opaque) const
+{
+    if (m_root) {
+        visitNode(m_root, 0, 0, visitor, opaque);
+    }
+}
+
+}
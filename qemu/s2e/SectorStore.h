@@ -0,0 +1,161 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef _S2E_SECTOR_STORE_H_
+
+#define _S2E_SECTOR_STORE_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace s2e {
+
+/**
+ *  Per-state copy-on-write store of the sectors written to a block device.
+ *
+ *  Sectors are grouped in 4KB extents, indexed by a radix tree. Extents and
+ *  tree nodes are reference-counted and shared between the copies of a store,
+ *  so forking a state only copies the root pointer. A write duplicates the
+ *  shared nodes on the path to the extent and the extent itself.
+ *
+ *  Optionally, the least recently used extents are spilled to a file once
+ *  their total size exceeds a threshold.
+ */
+class SectorStore {
+public:
+    static const unsigned SECTOR_SIZE = 512;
+    static const unsigned EXTENT_SECTORS = 8;
+    static const unsigned EXTENT_SIZE = SECTOR_SIZE * EXTENT_SECTORS;
+
+    typedef void (*SectorVisitor)(void *opaque, uint64_t sector, const uint8_t *data);
+
+private:
+    /* 4 levels of 256 entries cover 2^32 extents (16TB) */
+    static const unsigned LEVEL_BITS = 8;
+    static const unsigned LEVELS = 4;
+    static const unsigned FANOUT = 1 << LEVEL_BITS;
+
+    struct Extent {
+        unsigned refCount;
+
+        /* Bit i is set if sector i of the extent was written */
+        uint8_t validMask;
+
+        /* Resident data, NULL if spilled */
+        uint8_t *data;
+
+        /* Location in the spill file, -1 if never spilled */
+        int64_t spillOffset;
+        bool dirty;
+
+        /* Resident extents, most recently used first */
+        Extent *lruPrev, *lruNext;
+    };
+
+    struct Node {
+        unsigned refCount;
+        void *children[FANOUT];
+    };
+
+    Node *m_root;
+
+    static int s_spillFd;
+    static uint64_t s_spillThreshold;
+    static int64_t s_spillEnd;
+    static std::vector<int64_t> s_freeSpillSlots;
+
+    static uint64_t s_residentBytes;
+    static Extent *s_lruHead, *s_lruTail;
+
+    static Node *createNode();
+    static void releaseNode(Node *node, unsigned level);
+    static Node *cloneNode(const Node *node, unsigned level);
+
+    static Extent *createExtent();
+    static void releaseExtent(Extent *extent);
+    static Extent *cloneExtent(Extent *extent);
+
+    static void lruRemove(Extent *extent);
+    static void lruInsert(Extent *extent);
+    static void makeResident(Extent *extent);
+    static void spill(Extent *extent);
+    static void evict(Extent *keep);
+
+    static unsigned slot(uint64_t extentIndex, unsigned level) {
+        return (extentIndex >> ((LEVELS - 1 - level) * LEVEL_BITS)) & (FANOUT - 1);
+    }
+
+    static uint64_t hashNode(const Node *node, unsigned level, uint64_t hash);
+
+    static void visitNode(const Node *node, unsigned level, uint64_t extentIndex,
+                          SectorVisitor visitor, void *opaque);
+
+    Extent *findExtent(uint64_t extentIndex) const;
+    Extent *getWritableExtent(uint64_t extentIndex);
+
+    void operator=(const SectorStore &);
+
+public:
+    SectorStore();
+    SectorStore(const SectorStore &store);
+    ~SectorStore();
+
+    void write(uint64_t sector, const uint8_t *buf, unsigned count);
+
+    /** Removes all the sectors */
+    void clear();
+
+    /**
+     *  Copies the longest run of stored sectors that starts at sector.
+     *  Returns the number of sectors copied, or minus the number of
+     *  consecutive sectors that are not in the store.
+     */
+    int read(uint64_t sector, uint8_t *buf, unsigned count) const;
+
+    /** Hash of the stored sectors and of their positions */
+    uint64_t getHash() const;
+
+    /** Calls the visitor on each stored sector, by increasing sector number */
+    void forEachSector(SectorVisitor visitor, void *opaque) const;
+
+    /* Spill extents to file when more than threshold bytes are resident */
+    static bool setSpillFile(const std::string &path, uint64_t threshold);
+};
+
+}
+
+#endif
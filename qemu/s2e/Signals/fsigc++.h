@@ -89,10 +89,20 @@ template <typename RET, typename P1, typename P2, typename P3,
         typename P4, typename P5, typename P6, typename P7>
 class functor_base
 {
+public:
+    //Type-erased pointer to a static RET invoke(functor_base*, P1, ...)
+    typedef void (*invoker_t)();
+
 protected:
     unsigned m_refcount;
+    invoker_t m_invoker;
 public:
-    functor_base():m_refcount(0){}
+    functor_base():m_refcount(0), m_invoker(NULL){}
+
+    //Non-virtual entry point of the functor, NULL if it has none.
+    //Lets translated code call the slot without going through the signal.
+    invoker_t getInvoker() const { return m_invoker; }
+
     void incref() { ++m_refcount; }
     unsigned decref() { assert(this->m_refcount > 0); return --m_refcount; }
     virtual ~functor_base() {assert(m_refcount == 0);}
@@ -578,6 +588,12 @@ public:
 
     functor2_1(functor_t *fb, A1 a1_):m_fb(fb), a1(a1_) {
         m_fb->incref();
+        this->m_invoker = reinterpret_cast<typename functor_base<RET, BE1, BE2, nil, nil, nil, nil, nil>::invoker_t>(&invoke);
+    }
+
+    static RET invoke(functor_base<RET, BE1, BE2, nil, nil, nil, nil, nil> *f, BE1 be1, BE2 be2) {
+        functor2_1 *self = static_cast<functor2_1*>(f);
+        return self->m_fb->operator ()(be1, be2, self->a1);
     }
     virtual ~functor2_1() {
         if (!m_fb->decref()) {
@@ -611,6 +627,12 @@ public:
 
     functor2_2(functor_t *fb, A1 a1_, A2 a2_):m_fb(fb), a1(a1_), a2(a2_) {
         m_fb->incref();
+        this->m_invoker = reinterpret_cast<typename functor_base<RET, BE1, BE2, nil, nil, nil, nil, nil>::invoker_t>(&invoke);
+    }
+
+    static RET invoke(functor_base<RET, BE1, BE2, nil, nil, nil, nil, nil> *f, BE1 be1, BE2 be2) {
+        functor2_2 *self = static_cast<functor2_2*>(f);
+        return self->m_fb->operator ()(be1, be2, self->a1, self->a2);
     }
     virtual ~functor2_2() {
         if (!m_fb->decref()) {
@@ -46,8 +46,14 @@ public:
     FUNCTOR_NAME(T* obj, func_t f) {
         m_obj = obj;
         m_func = f;
+        this->m_invoker = reinterpret_cast<typename functor_base<RET, BASE_CLASS_INST>::invoker_t>(&invoke);
     };
 
+    static RET invoke(functor_base<RET, BASE_CLASS_INST> *f, OPERATOR_PARAM_DECL) {
+        FUNCTOR_NAME *self = static_cast<FUNCTOR_NAME*>(f);
+        return (*self->m_obj.*self->m_func)(CALL_PARAMS);
+    }
+
     virtual ~FUNCTOR_NAME() {}
 
     virtual RET operator()(OPERATOR_PARAM_DECL) {
@@ -79,8 +85,13 @@ protected:
 public:
     glue(FUNCTOR_NAME, _sl)(func_t f) {
         m_func = f;
+        this->m_invoker = reinterpret_cast<typename functor_base<RET, BASE_CLASS_INST>::invoker_t>(&invoke);
     };
 
+    static RET invoke(functor_base<RET, BASE_CLASS_INST> *f, OPERATOR_PARAM_DECL) {
+        return (*static_cast<glue(FUNCTOR_NAME, _sl)*>(f)->m_func)(CALL_PARAMS);
+    }
+
     virtual ~glue(FUNCTOR_NAME, _sl)() {}
 
     virtual RET operator()(OPERATOR_PARAM_DECL) {
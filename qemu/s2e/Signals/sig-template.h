@@ -108,6 +108,16 @@ bool empty() const{
     return m_activeSignals == 0;
 }
 
+//Slots may be NULL after a disconnection
+unsigned getSlotCount() const {
+    return m_size;
+}
+
+func_t getSlot(unsigned i) const {
+    assert(i < m_size);
+    return m_funcs[i];
+}
+
 void emit(OPERATOR_PARAM_DECL) {
     for (unsigned i=0; i<m_size; ++i) {
         if (m_funcs[i]) {
@@ -56,13 +56,28 @@
 namespace s2e
 {
 
-PageAllocator::PageAllocator()
+PageAllocator::PageAllocator(bool useArenas)
 {
-
+#ifdef _WIN32
+    //Arenas rely on mmap/madvise
+    m_useArenas = false;
+#else
+    m_useArenas = useArenas;
+#endif
+    list_init_head(&m_partialArenas);
+    list_init_head(&m_idleArenas);
 }
 
 PageAllocator::~PageAllocator()
 {
+    ArenaMap::iterator ait;
+    for (ait = m_arenas.begin(); ait != m_arenas.end(); ++ait) {
+#ifndef _WIN32
+        munmap((void*)(*ait).first, ARENA_SIZE);
+#endif
+        delete (*ait).second;
+    }
+
     RegionMap::iterator it;
 
     for (it = m_regions.begin(); it != m_regions.end(); ++it) {
@@ -97,8 +112,131 @@ void PageAllocator::osFree(uintptr_t region)
 #endif
 }
 
+uintptr_t PageAllocator::osAllocArena()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    //Over-allocate to get an aligned arena and trim the rest
+    uintptr_t size = 2 * ARENA_SIZE;
+#if defined(__APPLE__)
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+#else
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+#endif
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+
+    uintptr_t start = (uintptr_t) p;
+    uintptr_t arena = (start + ARENA_SIZE - 1) & ~((uintptr_t) ARENA_SIZE - 1);
+    if (arena > start) {
+        munmap((void*) start, arena - start);
+    }
+    if (start + size > arena + ARENA_SIZE) {
+        munmap((void*) (arena + ARENA_SIZE), start + size - (arena + ARENA_SIZE));
+    }
+
+#ifdef MADV_HUGEPAGE
+    madvise((void*) arena, ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+
+    return arena;
+#endif
+}
+
+void PageAllocator::osReleaseArena(uintptr_t arena)
+{
+#ifndef _WIN32
+    //Keep the mapping for later reuse, but drop the physical pages
+    madvise((void*) arena, ARENA_SIZE, MADV_DONTNEED);
+#endif
+}
+
+uintptr_t PageAllocator::allocArenaPage()
+{
+    Arena *arena;
+
+    if (!list_empty(&m_partialArenas)) {
+        arena = containing_record(m_partialArenas.next, Arena, link);
+    } else if (!list_empty(&m_idleArenas)) {
+        arena = containing_record(m_idleArenas.next, Arena, link);
+        list_remove_entry(&arena->link);
+        list_insert_head(&m_partialArenas, &arena->link);
+    } else {
+        uintptr_t base = osAllocArena();
+        if (!base) {
+            return 0;
+        }
+
+#ifdef DEBUG_ALLOC
+        std::cout << "Allocating new arena " << std::hex << base << std::dec << std::endl;
+#endif
+
+        arena = new Arena();
+        arena->base = base;
+        arena->freeCount = getPagesPerArena();
+        memset(arena->mask, (unsigned)-1, sizeof(arena->mask));
+        m_arenas[base] = arena;
+        list_insert_head(&m_partialArenas, &arena->link);
+    }
+
+    unsigned i = 0;
+    while (!arena->mask[i]) {
+        ++i;
+        assert(i < sizeof(arena->mask) / sizeof(arena->mask[0]));
+    }
+
+    uint64_t index;
+    int b = bit_scan_forward_64(&index, arena->mask[i]);
+    assert(b);
+    arena->mask[i] &= ~(1LL << index);
+    index += i * sizeof(arena->mask[0]) * 8;
+
+    if (--arena->freeCount == 0) {
+        list_remove_entry(&arena->link);
+        list_init_head(&arena->link);
+    }
+
+    uintptr_t ret = arena->base + index * getPageSize();
+    memset((void*)ret, 0xAA, getPageSize());
+    return ret;
+}
+
+void PageAllocator::freeArenaPage(uintptr_t page)
+{
+    ArenaMap::iterator it = m_arenas.find(page & ~((uintptr_t) ARENA_SIZE - 1));
+    assert(it != m_arenas.end());
+    Arena *arena = (*it).second;
+
+    memset((void*)page, 0xBB, getPageSize());
+
+    uint64_t index = (page - arena->base) / getPageSize();
+    uint64_t d = index / (sizeof(arena->mask[0]) * 8);
+    uint64_t r = index % (sizeof(arena->mask[0]) * 8);
+    assert(!(arena->mask[d] & (1LL << r)));
+    arena->mask[d] |= 1LL << r;
+
+    if (arena->freeCount++ == 0) {
+        list_insert_head(&m_partialArenas, &arena->link);
+    }
+
+    if (arena->freeCount == getPagesPerArena()) {
+#ifdef DEBUG_ALLOC
+        std::cout << "Releasing idle arena " << std::hex << arena->base << std::dec << std::endl;
+#endif
+        list_remove_entry(&arena->link);
+        list_insert_tail(&m_idleArenas, &arena->link);
+        osReleaseArena(arena->base);
+    }
+}
+
 uintptr_t PageAllocator::allocPage()
 {
+    if (m_useArenas) {
+        return allocArenaPage();
+    }
+
     RegionMap::iterator it = m_regions.begin();
     if (it == m_regions.end()) {
         uintptr_t region = osAlloc();
@@ -138,21 +276,27 @@ uintptr_t PageAllocator::allocPage()
 
 void PageAllocator::freePage(uintptr_t page)
 {
+    if (m_useArenas) {
+        freeArenaPage(page);
+        return;
+    }
+
     memset((void*)page, 0xBB, getPageSize());
 
-    RegionMap::iterator it = m_regions.find(page);
+    uintptr_t region = getRegion(page);
+    assert(region);
+
+    RegionMap::iterator it = m_regions.find(region);
     if (it == m_regions.end()) {
 #ifdef DEBUG_ALLOC
         std::cout << "busy size " << std::dec << m_busyRegions.size() << std::endl;
         std::cout << "freeing " << std::hex << page << std::dec << std::endl;
 #endif
 
-        RegionSet::iterator itr = m_busyRegions.find(page);
-        assert(itr != m_busyRegions.end());
-        uint64_t index = (page - (*itr)) / getPageSize();
+        uint64_t index = (page - region) / getPageSize();
 
-        m_busyRegions.erase(*itr);
-        m_regions[*itr] = (1LL << index);
+        m_busyRegions.erase(region);
+        m_regions[region] = (1LL << index);
         return;
     }
 
@@ -173,30 +317,35 @@ void PageAllocator::freePage(uintptr_t page)
     return;
 }
 
-//XXX: this needs to be seriously optimized
 bool PageAllocator::belongsToUs(uintptr_t addr) const
 {
-    RegionMap::const_iterator it;
-    RegionSet::const_iterator sit;
-    bool inreg = false;
+    if (m_useArenas) {
+        return m_arenas.find(addr & ~((uintptr_t) ARENA_SIZE - 1)) != m_arenas.end();
+    }
 
-    for(it = m_regions.begin(); it != m_regions.end(); ++it) {
-        uintptr_t a = (*it).first;
-        if (addr >= a && addr < a + REGION_SIZE) {
-            inreg = true;
-            break;
+    return getRegion(addr) != 0;
+}
+
+uintptr_t PageAllocator::getRegion(uintptr_t addr) const
+{
+    //Regions do not overlap, the candidate is the last one starting before addr
+    RegionMap::const_iterator it = m_regions.upper_bound(addr);
+    if (it != m_regions.begin()) {
+        --it;
+        if (addr < (*it).first + getRegionSize()) {
+            return (*it).first;
         }
     }
 
-    for(sit = m_busyRegions.begin(); sit != m_busyRegions.end(); ++sit) {
-        uintptr_t a = (*sit);
-        if (addr >= a && addr < a + REGION_SIZE) {
-            inreg = true;
-            break;
+    RegionSet::const_iterator sit = m_busyRegions.upper_bound(addr);
+    if (sit != m_busyRegions.begin()) {
+        --sit;
+        if (addr < (*sit) + getRegionSize()) {
+            return *sit;
         }
     }
 
-    return inreg;
+    return 0;
 }
 
 
@@ -243,13 +392,13 @@ uintptr_t BlockAllocator::expand()
     return newPage;
 }
 
-void BlockAllocator::shrink()
+bool BlockAllocator::shrink()
 {
     list_t *entry;
     BlockAllocatorHdr *page;
 
     if (list_empty(&m_totallyFreeList)) {
-        return;
+        return false;
     }
 
     entry = list_remove_tail(&m_totallyFreeList);
@@ -257,6 +406,7 @@ void BlockAllocator::shrink()
     m_pa->freePage((uintptr_t)page);
     m_freePagesCount--;
     m_freeBlocksCount -= m_blocksPerPage;
+    return true;
 }
 
 uintptr_t BlockAllocator::alloc()
@@ -339,16 +489,16 @@ void BlockAllocator::free(uintptr_t b)
 
 }
 
-SlabAllocator::SlabAllocator(unsigned minPo2, unsigned maxPo2)
+SlabAllocator::SlabAllocator(unsigned minPo2, unsigned maxPo2, bool useArenas)
 {
     assert(minPo2 <= maxPo2);
 
     m_minPo2 = minPo2;
     m_maxPo2 = maxPo2;
 
-    m_pa = new PageAllocator();
+    m_pa = new PageAllocator(useArenas);
 
-    m_bas = new BlockAllocator*[m_maxPo2 - m_minPo2];
+    m_bas = new BlockAllocator*[m_maxPo2 - m_minPo2 + 1];
 
     for (unsigned i=0; i<=(m_maxPo2 - m_minPo2); ++i) {
         m_bas[i] = new BlockAllocator(m_pa, i + m_minPo2, i + m_minPo2);
@@ -357,6 +507,9 @@ SlabAllocator::SlabAllocator(unsigned minPo2, unsigned maxPo2)
 
 SlabAllocator::~SlabAllocator()
 {
+    for (unsigned i=0; i<=(m_maxPo2 - m_minPo2); ++i) {
+        delete m_bas[i];
+    }
     delete [] m_bas;
     delete m_pa;
 }
@@ -429,6 +582,14 @@ bool SlabAllocator::isValid(uintptr_t addr) const
     return getSlab(addr) != NULL;
 }
 
+void SlabAllocator::shrink()
+{
+    for (unsigned i=0; i<=(m_maxPo2 - m_minPo2); ++i) {
+        while (m_bas[i]->shrink())
+            ;
+    }
+}
+
 void SlabAllocator::printStats(std::ostream &os) const
 {
     uint64_t totalSize = 0;
@@ -466,6 +627,9 @@ void slab_init()
 }
 }
 
+//Replacing the global allocator is only done on request,
+//the expression allocator uses its own SlabAllocator instance.
+#ifdef S2E_SLAB_GLOBAL_NEW
 static bool s_inalloc = false;
 
 void* operator new (size_t size)
@@ -511,6 +675,7 @@ void operator delete (void *p)
 
     s_inalloc = false;
 }
+#endif
 
 
 
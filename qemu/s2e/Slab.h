@@ -45,6 +45,7 @@
 #include <map>
 #include <vector>
 #include <set>
+#include <tr1/unordered_map>
 
 #include "machine.h"
 
@@ -117,31 +118,62 @@ static inline list_t* list_remove_tail(list_t* list_head)
 
 //Allocates chunks of 256KB from the system
 #define REGION_SIZE (256*1024)
+
+//Size of the huge-page backed arenas, must be a power of two
+#define ARENA_SIZE (2*1024*1024)
+
 class PageAllocator
 {
 private:
-    struct RegCmp {
-        bool operator() (uintptr_t r1, uintptr_t r2) const {
-            return r1 + REGION_SIZE <= r2;
-        }
-    };
-
     //region offset to bitmap
-    typedef std::map<uintptr_t, uintptr_t, RegCmp> RegionMap;
-    typedef std::set<uintptr_t, RegCmp> RegionSet;
+    typedef std::map<uintptr_t, uintptr_t> RegionMap;
+    typedef std::set<uintptr_t> RegionSet;
     RegionMap m_regions;
     RegionSet m_busyRegions;
 
+    //Arenas are aligned on their size, the arena of any page
+    //is found by masking its address.
+    struct Arena {
+        list_t link;
+        uintptr_t base;
+        uint32_t freeCount;
+        uint64_t mask[ARENA_SIZE / 0x1000 / 64];
+    };
+
+    typedef std::tr1::unordered_map<uintptr_t, Arena*> ArenaMap;
+
+    bool m_useArenas;
+    ArenaMap m_arenas;
+
+    //Arenas that have both free and allocated pages
+    list_t m_partialArenas;
+
+    //Arenas without allocated pages, their memory is returned to the system
+    list_t m_idleArenas;
+
 private:
     inline uintptr_t getRegionSize() const {
         return REGION_SIZE;
     }
 
+    inline uintptr_t getPagesPerArena() const {
+        return ARENA_SIZE / getPageSize();
+    }
+
     uintptr_t osAlloc();
     void osFree(uintptr_t region);
 
+    //Returns the start of the region containing addr, 0 if none
+    uintptr_t getRegion(uintptr_t addr) const;
+
+    uintptr_t osAllocArena();
+    void osReleaseArena(uintptr_t arena);
+
+    uintptr_t allocArenaPage();
+    void freeArenaPage(uintptr_t page);
+
 public:
-    PageAllocator();
+    PageAllocator(bool useArenas = false);
     ~PageAllocator();
 
     uintptr_t allocPage();
@@ -251,7 +283,9 @@ public:
     }
 
     uintptr_t expand();
-    void shrink();
+
+    //Returns false if there was no totally free page to release
+    bool shrink();
 
     uintptr_t alloc();
     void free(uintptr_t b);
@@ -273,15 +307,26 @@ private:
     BlockAllocator *getSlab(uintptr_t addr) const;
     unsigned log(size_t s) const;
 public:
-    SlabAllocator(unsigned minPo2, unsigned maxPo2);
+    SlabAllocator(unsigned minPo2, unsigned maxPo2, bool useArenas = false);
     ~SlabAllocator();
 
     uintptr_t alloc(size_t s);
     bool free(uintptr_t addr);
     bool isValid(uintptr_t addr) const;
 
+    //Returns the totally free pages of all slabs to the page allocator
+    void shrink();
+
     void printStats(std::ostream &os) const;
 
+    //Number of live blocks of 2^po2 bytes
+    uint64_t getAllocatedBlocksCount(unsigned po2) const {
+        if (po2 < m_minPo2 || po2 > m_maxPo2) {
+            return 0;
+        }
+        return m_bas[po2 - m_minPo2]->getAllocatedBlocksCount();
+    }
+
     const PageAllocator *getPageAllocator() const {
         return m_pa;
     }
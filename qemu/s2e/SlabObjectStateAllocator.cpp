@@ -0,0 +1,75 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "SlabObjectStateAllocator.h"
+
+namespace s2e {
+
+SlabObjectStateAllocator::SlabObjectStateAllocator(bool useArenas):
+        m_slab(MinPo2, MaxPo2, useArenas), m_fallbacks(0)
+{
+
+}
+
+void *SlabObjectStateAllocator::allocate(size_t size)
+{
+    uintptr_t ret = m_slab.alloc(size);
+    if (!ret) {
+        //Too large for the slabs or out of memory, use the heap
+        ++m_fallbacks;
+        return NULL;
+    }
+
+    return (void*) ret;
+}
+
+bool SlabObjectStateAllocator::deallocate(void *ptr)
+{
+    //Objects created before the allocator was installed live on the heap
+    if (!m_slab.getPageAllocator()->belongsToUs((uintptr_t) ptr)) {
+        return false;
+    }
+
+    bool ret = m_slab.free((uintptr_t) ptr);
+    assert(ret);
+    return ret;
+}
+
+void SlabObjectStateAllocator::reclaim()
+{
+    m_slab.shrink();
+}
+
+}
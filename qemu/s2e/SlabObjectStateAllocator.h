@@ -0,0 +1,84 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2E_SLABOBJECTSTATEALLOCATOR_H
+#define S2E_SLABOBJECTSTATEALLOCATOR_H
+
+#include <klee/Memory.h>
+#include "Slab.h"
+
+namespace s2e {
+
+/**
+ *  Allocates the concrete stores and byte masks of KLEE object states
+ *  from size-segregated slabs instead of the general purpose heap.
+ *
+ *  Guest RAM is split into small objects (S2E_RAM_OBJECT_SIZE), whose
+ *  storage fits in the slabs. Copy-on-write of these objects during
+ *  forking does not touch the heap. Larger objects use the heap.
+ */
+class SlabObjectStateAllocator: public klee::ObjectStateAllocator
+{
+public:
+    static const unsigned MinPo2 = 3;
+    static const unsigned MaxPo2 = 8;
+
+private:
+    SlabAllocator m_slab;
+
+    uint64_t m_fallbacks;
+
+public:
+    SlabObjectStateAllocator(bool useArenas = false);
+
+    void *allocate(size_t size);
+    bool deallocate(void *ptr);
+
+    /** Release the pages that contain no live block */
+    void reclaim();
+
+    /** Number of live blocks of 2^po2 bytes */
+    uint64_t getAllocatedBlocksCount(unsigned po2) const {
+        return m_slab.getAllocatedBlocksCount(po2);
+    }
+
+    uint64_t getFallbacksCount() const {
+        return m_fallbacks;
+    }
+};
+
+}
+
+#endif
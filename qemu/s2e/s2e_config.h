@@ -44,6 +44,13 @@
 /** Enables S2E TLB to speed-up concrete memory accesses */
 #define S2E_ENABLE_S2E_TLB
 
+/** Log2 of the number of pages in the TLB of each MMU mode (vanilla QEMU uses 8).
+    Guests that touch many pages miss less with a larger TLB, but the TLB is
+    part of the CPU state that is saved and restored on each state switch. */
+#ifndef S2E_TLB_BITS
+#define S2E_TLB_BITS 8
+#endif
+
 /** This defines the size of each MemoryObject that represents physical RAM.
     Larger values save some memory, smaller (exponentially) decrease solving
     time for constraints with symbolic addresses */
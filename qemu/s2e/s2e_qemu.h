@@ -97,6 +97,7 @@ void s2e_print_apic(CPUArchState *env);
 /* Functions from CorePlugin.cpp */
 
 void s2e_tcg_execution_handler(void* signal, uint64_t pc);
+void s2e_tcg_execution_slot_handler(void* slot, void* invoker, uint64_t pc);
 void s2e_tcg_custom_instruction_handler(uint64_t arg);
 
 /** Called by the translator when a custom instruction is detected */
@@ -149,6 +150,10 @@ void s2e_trace_memory_access(
 
 extern unsigned g_s2e_enable_mmio_checks;
 
+/** Nonzero when the generated code may access concrete memory without
+    calling the memory helpers, i.e., when no plugin traces data accesses */
+extern unsigned g_s2e_fast_memory_access;
+
 /** Called on port access from helper code */
 void s2e_trace_port_access(
         struct S2E *s2e, struct S2EExecutionState* state,
@@ -169,6 +174,10 @@ void s2e_on_tlb_miss(struct S2E *s2e, struct S2EExecutionState* state, uint64_t
     symbolic memory addresses */
 extern int g_s2e_fork_on_symbolic_address;
 
+/** Global variable that determines whether to only concretize
+    the page of symbolic memory addresses */
+extern int g_s2e_concretize_page_only;
+
 /** Global variable that determines whether to make
     symbolic I/O memory addresses concrete */
 extern int g_s2e_concretize_io_addresses;
@@ -203,6 +212,10 @@ void s2e_register_ram(struct S2E* s2e,
 
 uintptr_t s2e_get_host_address(target_phys_addr_t paddr);
 
+/** Guest write tracking for RAM pages */
+int s2e_watch_page_writes(uintptr_t host_address);
+int s2e_is_page_written(uintptr_t host_address);
+
 int s2e_is_ram_registered(struct S2E* s2e,
                           struct S2EExecutionState *state,
                           uint64_t host_address);
@@ -219,6 +232,11 @@ void s2e_write_ram_concrete(struct S2E* s2e,
         struct S2EExecutionState* state,
         uint64_t host_address, const uint8_t* buf, uint64_t size);
 
+/* The RAM at host_address was remapped, e.g., from a snapshot file */
+void s2e_map_ram_concrete(struct S2E* s2e,
+        struct S2EExecutionState* state,
+        uint64_t host_address, uint64_t size);
+
 void s2e_read_register_concrete(struct S2E* s2e,
         struct S2EExecutionState* state, CPUArchState* cpuState,
         unsigned offset, uint8_t* buf, unsigned size);
@@ -259,9 +277,13 @@ void s2e_set_tb_function(struct S2E* s2e, struct TranslationBlock *tb);
 void s2e_flush_tb_cache(void);
 void s2e_flush_tlb_cache(void);
 void s2e_flush_tlb_cache_page(void *objectState, int mmu_idx, int index);
+void s2e_flush_tlb_cache_victim_page(void *objectState, int mmu_idx, int index);
 
 uintptr_t s2e_qemu_tb_exec(CPUArchState* env1, struct TranslationBlock* tb);
 
+/* Chains jump n of tb to tb_next, or attaches it again if S2E detached it */
+void s2e_tb_add_jump(struct TranslationBlock *tb, int n, struct TranslationBlock *tb_next);
+
 /* Called by QEMU when execution is aborted using longjmp */
 void s2e_qemu_cleanup_tb_exec();
 
@@ -306,10 +328,59 @@ int s2e_is_mmio_symbolic_w(uint64_t address);
 int s2e_is_mmio_symbolic_l(uint64_t address);
 int s2e_is_mmio_symbolic_q(uint64_t address);
 
+/* Flat maps of the ports and 4KB physical pages that may be symbolic.
+   Lookups of clear bits do not reach the symbolic hardware plugin. */
+#define S2E_SYMBHW_PAGE_BITS 12
+#define S2E_SYMBHW_L2_BITS   15
+#define S2E_SYMBHW_PHYS_BITS 40
+#define S2E_SYMBHW_L1_SIZE   (1 << (S2E_SYMBHW_PHYS_BITS - S2E_SYMBHW_PAGE_BITS - S2E_SYMBHW_L2_BITS))
+
+extern uint32_t g_s2e_symbolic_ports[65536 / 32];
+extern uint32_t *g_s2e_symbolic_pages[S2E_SYMBHW_L1_SIZE];
+
+#ifndef S2E_LLVM_LIB
+static inline int s2e_port_may_be_symbolic(uint64_t port)
+{
+    port &= 0xffff;
+    return (g_s2e_symbolic_ports[port >> 5] >> (port & 31)) & 1;
+}
+
+static inline int s2e_mmio_may_be_symbolic(uint64_t address, uint64_t size)
+{
+    uint64_t page = address >> S2E_SYMBHW_PAGE_BITS;
+    uint64_t last = (address + size - 1) >> S2E_SYMBHW_PAGE_BITS;
+
+    for (; page <= last; ++page) {
+        uint64_t l1 = page >> S2E_SYMBHW_L2_BITS;
+        uint64_t l2 = page & ((1 << S2E_SYMBHW_L2_BITS) - 1);
+        const uint32_t *map;
+
+        if (l1 >= S2E_SYMBHW_L1_SIZE) {
+            return 1;
+        }
+
+        map = g_s2e_symbolic_pages[l1];
+        if (map && ((map[l2 >> 5] >> (l2 & 31)) & 1)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+#else
+/* Code run in KLEE calls the native functions, which check the maps first */
+#define s2e_port_may_be_symbolic(port) 1
+#define s2e_mmio_may_be_symbolic(address, size) 1
+#endif
+
 void s2e_update_tlb_entry(struct S2EExecutionState* state,
                           CPUArchState* env,
                           int mmu_idx, uint64_t virtAddr, uint64_t hostAddr);
 
+/** Swap the S2E TLB entries of a page with those of a victim TLB entry */
+void s2e_swap_tlb_entries(struct S2EExecutionState* state,
+                          CPUArchState* env,
+                          int mmu_idx, int index, int vindex);
+
 
 //Check that no asyc request are pending
 int qemu_bh_empty(void);
@@ -331,8 +402,13 @@ void s2e_on_initialization_complete(void);
 void s2e_on_monitor_event(struct QDict *ret);
 
 int s2e_is_load_balancing(void);
+int s2e_is_display_suspended(void);
+int s2e_skip_idle_time(void);
 int s2e_is_forking(void);
 
+/* Returns in the processes forked for each job */
+void s2e_run_server(struct S2E *s2e, const char *socket_path);
+
 /******************************************************/
 /* Prototypes for special functions used in LLVM code */
 /* NOTE: this functions should never be defined. They */
@@ -348,6 +424,9 @@ void tcg_llvm_trace_memory_access(uint64_t vaddr, uint64_t haddr,
 void tcg_llvm_trace_port_access(uint64_t port, uint64_t value,
                                 unsigned bits, int isWrite);
 void tcg_llvm_make_symbolic(void *addr, unsigned nbytes, const char *name);
+void tcg_llvm_make_symbolic_io(void *addr, unsigned nbytes, const char *name,
+                               uint64_t ioaddr, int isMmio);
+void tcg_llvm_trace_mmio_write(uint64_t physaddr, uint64_t value, unsigned bits);
 void tcg_llvm_get_value(void *addr, unsigned nbytes, bool addConstraint);
 //#endif
 
@@ -766,6 +766,26 @@ int64_t qemu_fseek(QEMUFile *f, int64_t pos, int whence)
     return pos;
 }
 
+/* Only vm states saved in block devices can be mapped */
+int qemu_file_can_map(QEMUFile *f)
+{
+    if (f->put_buffer != block_put_buffer && f->get_buffer != block_get_buffer) {
+        return 0;
+    }
+
+    return bdrv_can_map_vmstate(f->opaque);
+}
+
+/* Map size bytes of the file at pos onto host, returns 0 on success */
+int qemu_file_map(QEMUFile *f, void *host, int64_t pos, int64_t size)
+{
+    if (f->is_write || f->get_buffer != block_get_buffer) {
+        return -ENOTSUP;
+    }
+
+    return bdrv_map_vmstate(f->opaque, host, pos, size);
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (f->rate_limit)
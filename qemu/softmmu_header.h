@@ -116,11 +116,25 @@
 
 #define S2E_RAM_OBJECT_DIFF (TARGET_PAGE_BITS - S2E_RAM_OBJECT_BITS)
 
+/* The fast path only needs the page to find the TLB entry. When only the
+   page is concretized, KLEE resolves the symbolic offset inside of it. */
+#ifdef S2E_LLVM_LIB
+#define S2E_CONCRETIZE_OBJECT_INDEX(addr) \
+    (g_s2e_concretize_page_only ? \
+        S2E_FORK_AND_CONCRETIZE((addr) >> TARGET_PAGE_BITS, \
+                                ADDR_MAX >> TARGET_PAGE_BITS) << S2E_RAM_OBJECT_DIFF : \
+        S2E_FORK_AND_CONCRETIZE((addr) >> S2E_RAM_OBJECT_BITS, \
+                                ADDR_MAX >> S2E_RAM_OBJECT_BITS))
+#else
+#define S2E_CONCRETIZE_OBJECT_INDEX(addr) ((addr) >> S2E_RAM_OBJECT_BITS)
+#endif
+
 #else // CONFIG_S2E
 #define S2EINLINE inline
 #define S2E_TRACE_MEMORY(...)
 #define S2E_FORK_AND_CONCRETIZE(val, max) (val)
 #define S2E_FORK_AND_CONCRETIZE_ADDR(val, max) (val)
+#define S2E_CONCRETIZE_OBJECT_INDEX(addr) ((addr) >> S2E_RAM_OBJECT_BITS)
 
 #define S2E_RAM_OBJECT_BITS TARGET_PAGE_BITS
 #define S2E_RAM_OBJECT_DIFF 0
@@ -170,8 +184,7 @@ glue(glue(glue(CPU_PREFIX, ld), USUFFIX), MEMSUFFIX)(ENV_PARAM
     int mmu_idx;
 
     addr = S2E_FORK_AND_CONCRETIZE_ADDR(ptr, ADDR_MAX);
-    object_index = S2E_FORK_AND_CONCRETIZE(addr >> S2E_RAM_OBJECT_BITS,
-                                           ADDR_MAX >> S2E_RAM_OBJECT_BITS);
+    object_index = S2E_CONCRETIZE_OBJECT_INDEX(addr);
     page_index = (object_index >> S2E_RAM_OBJECT_DIFF) & (CPU_TLB_SIZE - 1);
 
     mmu_idx = CPU_MMU_INDEX;
@@ -212,8 +225,7 @@ glue(glue(glue(CPU_PREFIX, lds), SUFFIX), MEMSUFFIX)(ENV_PARAM
     int mmu_idx;
 
     addr = S2E_FORK_AND_CONCRETIZE_ADDR(ptr, ADDR_MAX);
-    object_index = S2E_FORK_AND_CONCRETIZE(addr >> S2E_RAM_OBJECT_BITS,
-                                           ADDR_MAX >> S2E_RAM_OBJECT_BITS);
+    object_index = S2E_CONCRETIZE_OBJECT_INDEX(addr);
     page_index = (object_index >> S2E_RAM_OBJECT_DIFF) & (CPU_TLB_SIZE - 1);
 
     mmu_idx = CPU_MMU_INDEX;
@@ -252,8 +264,7 @@ glue(glue(glue(CPU_PREFIX, st), SUFFIX), MEMSUFFIX)(ENV_PARAM target_ulong ptr,
     int mmu_idx;
 
     addr = S2E_FORK_AND_CONCRETIZE_ADDR(ptr, ADDR_MAX);
-    object_index = S2E_FORK_AND_CONCRETIZE(addr >> S2E_RAM_OBJECT_BITS,
-                                           ADDR_MAX >> S2E_RAM_OBJECT_BITS);
+    object_index = S2E_CONCRETIZE_OBJECT_INDEX(addr);
     page_index = (object_index >> S2E_RAM_OBJECT_DIFF) & (CPU_TLB_SIZE - 1);
 
     mmu_idx = CPU_MMU_INDEX;
@@ -340,6 +351,7 @@ static S2EINLINE void glue(glue(CPU_PREFIX, stfl), MEMSUFFIX)(ENV_PARAM
 #endif
 #undef S2E_RAM_OBJECT_DIFF
 #undef S2E_FORK_AND_CONCRETIZE
+#undef S2E_CONCRETIZE_OBJECT_INDEX
 #undef S2E_TRACE_MEMORY
 #undef ADDR_MAX
 #undef RES_TYPE
@@ -136,7 +136,8 @@ DATA_TYPE glue(glue(io_read, SUFFIX), MMUSUFFIX)(ENV_PARAM
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
 
 #ifdef CONFIG_S2E
-    if (glue(g_s2e_enable_mmio_checks && s2e_is_mmio_symbolic_, SUFFIX)(physaddr)) {
+    if (g_s2e_enable_mmio_checks && s2e_mmio_may_be_symbolic(physaddr, DATA_SIZE) &&
+        glue(s2e_is_mmio_symbolic_, SUFFIX)(physaddr)) {
         s2e_switch_to_symbolic(g_s2e, g_s2e_state);
     }
 #endif
@@ -174,9 +175,9 @@ inline DATA_TYPE glue(glue(io_read_chk, SUFFIX), MMUSUFFIX)(ENV_PARAM target_phy
 
 #elif defined(S2E_LLVM_LIB) //S2E_LLVM_LIB
 
-inline DATA_TYPE glue(io_make_symbolic, SUFFIX)(const char *name) {
+inline DATA_TYPE glue(io_make_symbolic, SUFFIX)(const char *name, target_ulong physaddr) {
     uint8_t ret;
-    tcg_llvm_make_symbolic(&ret, sizeof(ret), name);
+    tcg_llvm_make_symbolic_io(&ret, sizeof(ret), name, physaddr, 1);
     return ret;
 }
 
@@ -193,7 +194,7 @@ inline DATA_TYPE glue(io_read_chk_symb_, SUFFIX)(const char *label, target_ulong
 
     for (i = 0; i<(1<<SHIFT); ++i) {
         if (g_s2e_enable_mmio_checks && s2e_is_mmio_symbolic_b(physaddr + i)) {
-            data.arr[i] = glue(io_make_symbolic, SUFFIX)(label);
+            data.arr[i] = glue(io_make_symbolic, SUFFIX)(label, physaddr + i);
         }
     }
     return data.dt;
@@ -513,6 +514,12 @@ inline void glue(glue(io_write_chk, SUFFIX), MMUSUFFIX)(ENV_PARAM target_phys_ad
 
     env->mem_io_vaddr = addr;
     env->mem_io_pc = (uintptr_t)retaddr;
+
+    //Lets the plugins that model symbolic registers see the writes
+    if (g_s2e_enable_mmio_checks && glue(s2e_is_mmio_symbolic_, SUFFIX)(physaddr)) {
+        tcg_llvm_trace_mmio_write(physaddr, val, DATA_SIZE * 8);
+    }
+
 #if SHIFT <= 2
     if (s2e_ismemfunc(mr, 1)) {
         uintptr_t pa = s2e_notdirty_mem_write(physaddr);
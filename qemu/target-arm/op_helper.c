@@ -129,6 +129,10 @@ void tlb_fill(CPUArchState *env1, target_ulong addr, target_ulong page_addr,
 
 #ifdef CONFIG_S2E
     s2e_on_tlb_miss(g_s2e, g_s2e_state, addr, is_write);
+    if (tlb_victim_hit(env, page_addr, is_write, mmu_idx)) {
+        env = saved_env;
+        return;
+    }
     ret = cpu_arm_handle_mmu_fault(env, page_addr,
                                    is_write, mmu_idx);
 #else
@@ -90,6 +90,9 @@ typedef struct DisasContext {
     target_ulong nextPc; /* pc of the instruction following insPc */
     int enable_jmp_im;
     int done_instr_end; //1 when onTranslateInstructionEnd was called
+    uint16_t *ins_opc; //Pointer to the first opcode of the instruction
+    TCGArg *ins_arg; //Pointer to the first argument of the instruction
+    int done_reg_access_end; //1 when onTranslateRegisterAccessEnd was called
 #endif
     //enum ETranslationBlockType tb_type;
 
@@ -145,6 +148,28 @@ static inline void gen_instr_end(DisasContext *s)
         s->done_instr_end = 1;
     }
 }
+
+/* Computes the registers read and written by the instruction being
+   translated and sends the onTranslateRegisterAccessEnd event.
+   Must be called before the code that ends the block is generated. */
+static inline void s2e_translate_compute_reg_mask_end(DisasContext *dc)
+{
+    uint64_t rmask, wmask, accesses_mem;
+
+    if (dc->done_reg_access_end) {
+        return;
+    }
+
+    tcg_calc_regmask_ex(&tcg_ctx, &rmask, &wmask, &accesses_mem, dc->ins_opc, dc->ins_arg);
+
+    //First global is env, r0-r15 follow
+    rmask >>= 1;
+    wmask >>= 1;
+
+    s2e_on_translate_register_access(dc->tb, dc->insPc, rmask, wmask, (int)accesses_mem);
+
+    dc->done_reg_access_end = 1;
+}
 #endif
 
 /* initialize TCG globals.  */
@@ -3598,6 +3623,7 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
     tb = s->tb;
 
 #ifdef CONFIG_S2E
+    s2e_translate_compute_reg_mask_end(s);
     s2e_on_translate_block_end(g_s2e, g_s2e_state,
                                tb, s->insPc, 1, dest);
     gen_instr_end(s);
@@ -10105,11 +10131,15 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
 #ifdef CONFIG_S2E
         dc->insPc = dc->pc;
         dc->done_instr_end = 0;
+        dc->done_reg_access_end = 0;
 
         s2e_on_translate_instruction_start(g_s2e, g_s2e_state, tb, dc->insPc);
         tb->pcOfLastInstr = pc_start;
         dc->useNextPc = 0;
         dc->nextPc = -1;
+
+        dc->ins_opc = gen_opc_ptr;
+        dc->ins_arg = gen_opparam_ptr;
 #endif
 
         if (dc->thumb) {
@@ -10127,6 +10157,9 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
         }
 
 #ifdef CONFIG_S2E
+        //Compute the register mask and send the onRegisterAccess event
+        s2e_translate_compute_reg_mask_end(dc);
+
         if (!dc->is_jmp) {
             dc->nextPc = dc->pc;
             dc->useNextPc = 1;
@@ -10210,6 +10243,7 @@ static inline void gen_intermediate_code_internal(CPUARMState *env,
             /* indicate that the hash table must be used to find the next TB */
 
 #ifdef CONFIG_S2E
+            s2e_translate_compute_reg_mask_end(dc);
             s2e_on_translate_block_end(g_s2e, g_s2e_state,
                                tb, dc->insPc, 0, 0);
             gen_instr_end(dc);
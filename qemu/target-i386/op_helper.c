@@ -161,12 +161,12 @@ static inline uint32_t compute_eflags(void)
 }
 
 #if defined(CONFIG_S2E) && !defined(S2E_LLVM_LIB)
-static inline void s2e_load_eflags(void *mgr, void *eflags, int update_mask)
+static inline void s2e_load_eflags(S2EExprMgr *mgr, S2EExprBox *eflags, int update_mask)
 {
-    void *symb_flags = s2e_expr_and(mgr, eflags, CFLAGS_MASK);
+    S2EExprBox *symb_flags = s2e_expr_and(mgr, eflags, CFLAGS_MASK);
     s2e_expr_write_cpu(symb_flags, offsetof(CPUX86State, cc_src), sizeof(env->cc_src));
 
-    void *symb_df = s2e_expr_and(mgr, eflags, DF_MASK);
+    S2EExprBox *symb_df = s2e_expr_and(mgr, eflags, DF_MASK);
     uint64_t concrete_df = s2e_expr_to_constant(symb_df);
     DF_W(concrete_df ? -1 : 1);
 
@@ -784,7 +784,7 @@ target_ulong helper_inb(uint32_t port)
         char label[64];
         uint8_t res;
         trace_port(label, "inb", port, env->eip);
-        tcg_llvm_make_symbolic(&res, sizeof (uint8_t), label);
+        tcg_llvm_make_symbolic_io(&res, sizeof (uint8_t), label, port, 0);
         tcg_llvm_trace_port_access(port, res, 8, 0);
         return res;
     }
@@ -821,7 +821,7 @@ target_ulong helper_inw(uint32_t port)
         char label[64];
         uint16_t res;
         trace_port(label, "inw", port, env->eip);
-        tcg_llvm_make_symbolic(&res, sizeof (uint16_t), label);
+        tcg_llvm_make_symbolic_io(&res, sizeof (uint16_t), label, port, 0);
         tcg_llvm_trace_port_access(port, res, 16, 0);
         return res;
     }
@@ -857,7 +857,7 @@ target_ulong helper_inl(uint32_t port)
         char label[64];
         uint32_t res;
         trace_port(label, "inl", port, env->eip);
-        tcg_llvm_make_symbolic(&res, sizeof (uint32_t), label);
+        tcg_llvm_make_symbolic_io(&res, sizeof (uint32_t), label, port, 0);
         tcg_llvm_trace_port_access(port, res, 32, 0);
         return res;
     }
@@ -3034,8 +3034,8 @@ static inline void validate_seg(int seg_reg, int cpl)
 static inline void helper_ret_protected(int shift, int is_iret, int addend)
 {
 #if defined(CONFIG_S2E) && !defined(S2E_LLVM_LIB)
-    void *mgr = NULL;
-    void *symb_new_eflags = NULL;
+    S2EExprMgr mgr;
+    S2EExprBox *symb_new_eflags = NULL;
 #endif
     uint32_t new_cs, new_eflags, new_ss;
     uint32_t new_es, new_ds, new_fs, new_gs;
@@ -3069,9 +3069,9 @@ static inline void helper_ret_protected(int shift, int is_iret, int addend)
         new_cs &= 0xffff;
         if (is_iret) {
             #if defined(CONFIG_S2E) && !defined(S2E_LLVM_LIB)
-            mgr = s2e_expr_mgr();
-            POPL_T_S(mgr, ssp, sp, sp_mask, symb_new_eflags);
-            if (s2e_expr_to_constant(s2e_expr_and(mgr, symb_new_eflags, VM_MASK)))
+            s2e_expr_mgr_init(&mgr);
+            POPL_T_S(&mgr, ssp, sp, sp_mask, symb_new_eflags);
+            if (s2e_expr_to_constant(s2e_expr_and(&mgr, symb_new_eflags, VM_MASK)))
                 goto return_to_vm86;
             #else
             POPL_T(ssp, sp, sp_mask, new_eflags);
@@ -3216,8 +3216,8 @@ static inline void helper_ret_protected(int shift, int is_iret, int addend)
         if (symb_new_eflags == NULL) { //16-bit case no one cares about, let it be concrete
             load_eflags(new_eflags, eflags_mask);
         } else {
-            s2e_load_eflags(mgr, symb_new_eflags, eflags_mask);
-            s2e_expr_clear(mgr);
+            s2e_load_eflags(&mgr, symb_new_eflags, eflags_mask);
+            s2e_expr_clear(&mgr);
         }
         #else
         load_eflags(new_eflags, eflags_mask);
@@ -3236,10 +3236,10 @@ static inline void helper_ret_protected(int shift, int is_iret, int addend)
 
     /* modify processor state */
     #if defined(CONFIG_S2E) && !defined(S2E_LLVM_LIB)
-    s2e_load_eflags(mgr, symb_new_eflags, TF_MASK | AC_MASK | ID_MASK |
+    s2e_load_eflags(&mgr, symb_new_eflags, TF_MASK | AC_MASK | ID_MASK |
                     IF_MASK | IOPL_MASK | VM_MASK | NT_MASK | VIF_MASK | VIP_MASK);
 
-    s2e_expr_clear(mgr);
+    s2e_expr_clear(&mgr);
     #else
     load_eflags(new_eflags, TF_MASK | AC_MASK | ID_MASK |
                 IF_MASK | IOPL_MASK | VM_MASK | NT_MASK | VIF_MASK | VIP_MASK);
@@ -5376,6 +5376,9 @@ void tlb_fill(CPUX86State *env1, target_ulong addr, target_ulong page_addr,
 
 #ifdef CONFIG_S2E
     s2e_on_tlb_miss(g_s2e, g_s2e_state, addr, is_write);
+    if (tlb_victim_hit(env, page_addr, is_write, mmu_idx)) {
+        return;
+    }
     ret = cpu_x86_handle_mmu_fault(env, page_addr,
                                    is_write, mmu_idx);
 #else
@@ -279,6 +279,7 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_TESTL	(0x85)
 #define OPC_XCHG_ax_r32	(0x90)
 
+#define OPC_GRP3_Eb	(0xf6)
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
 
@@ -301,6 +302,7 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define SHIFT_SAR 7
 
 /* Group 3 opcode extensions for 0xf6, 0xf7.  To be used with OPC_GRP3.  */
+#define EXT3_TESTi 0
 #define EXT3_NOT   2
 #define EXT3_NEG   3
 #define EXT3_MUL   4
@@ -960,6 +962,15 @@ static void tcg_out_jmp(TCGContext *s, tcg_target_long dest)
 
 #include "../../softmmu_defs.h"
 
+#if defined(CONFIG_S2E) && defined(S2E_ENABLE_S2E_TLB) && TCG_TARGET_REG_BITS == 64
+/* Concrete accesses that hit both the QEMU and the S2E TLB are done
+   inline, the memory helpers only handle the other cases */
+#define S2E_INLINE_TLB
+
+/* Log2 of sizeof(S2ETLBEntry) */
+#define S2E_TLB_ENTRY_BITS 4
+#endif
+
 #ifdef CONFIG_S2E
 #ifdef CONFIG_TCG_PASS_AREG0
 /* helper signature: helper_ld_mmu(CPUState *env, target_ulong addr,
@@ -1114,9 +1125,97 @@ static inline void tcg_out_tlb_load(TCGContext *s, int addrlo_idx,
     tcg_out_modrm_offset(s, OPC_ADD_GvEv + P_REXW, r0, r1,
                          offsetof(CPUTLBEntry, addend) - which);
 }
+
+#ifdef S2E_INLINE_TLB
+/* Perform the TLB lookup of the S2E memory helpers and check that
+   the access may be done natively. This is the case when the access
+   hits the QEMU TLB, when the object in the S2E TLB has no symbolic
+   byte, when the current state owns it (for stores), and when no
+   plugin traces data memory accesses.
+
+   LABEL_PTRS is filled with the positions of the displacements of the
+   forward jumps to the helper call, the number of jumps is returned.
+
+   On the fast path, the first argument register holds the host
+   address of the data. Both argument registers are clobbered.  */
+
+static int tcg_out_s2e_tlb_load(TCGContext *s, int addrlo_idx,
+                                int mem_index, int s_bits,
+                                const TCGArg *args,
+                                uint8_t **label_ptr, int which)
+{
+    const int addrlo = args[addrlo_idx];
+    const int r0 = tcg_target_call_iarg_regs[0];
+    const int r1 = tcg_target_call_iarg_regs[1];
+    TCGType type = TCG_TYPE_I32;
+    int rexw = 0;
+    int count = 0;
+
+    QEMU_BUILD_BUG_ON(sizeof(S2ETLBEntry) != (1 << S2E_TLB_ENTRY_BITS));
+
+    if (TARGET_LONG_BITS == 64) {
+        type = TCG_TYPE_I64;
+        rexw = P_REXW;
+    }
+
+    tcg_out_tlb_load(s, addrlo_idx, mem_index, s_bits, args,
+                     &label_ptr[count++], which);
+
+    /* r1 = &env->s2e_tlb_table[mem_index][object index] */
+    tcg_out_mov(s, type, r1, addrlo);
+    tcg_out_shifti(s, SHIFT_SHR + rexw, r1,
+                   S2E_RAM_OBJECT_BITS - S2E_TLB_ENTRY_BITS);
+    tgen_arithi(s, ARITH_AND + rexw, r1,
+                (CPU_S2E_TLB_SIZE - 1) << S2E_TLB_ENTRY_BITS, 0);
+    tcg_out_modrm_sib_offset(s, OPC_LEA + P_REXW, r1, TCG_AREG0, r1, 0,
+                             offsetof(CPUArchState, s2e_tlb_table[mem_index][0]));
+
+    /* cmpl $0, symbolicCount(objectState(r1)) */
+    tcg_out_ld(s, TCG_TYPE_PTR, r0, r1, offsetof(S2ETLBEntry, objectState));
+    tcg_out_modrm_offset(s, OPC_ARITH_EvIb, ARITH_CMP, r0,
+                         S2E_OBJECT_STATE_SYMBOLIC_COUNT_OFFSET);
+    tcg_out8(s, 0);
+
+    /* jne label1 */
+    tcg_out8(s, OPC_JCC_short + JCC_JNE);
+    label_ptr[count++] = s->code_ptr;
+    s->code_ptr++;
+
+    if (which == offsetof(CPUTLBEntry, addr_write)) {
+        /* testb $1, addend(r1) */
+        tcg_out_modrm_offset(s, OPC_GRP3_Eb, EXT3_TESTi, r1,
+                             offsetof(S2ETLBEntry, addend));
+        tcg_out8(s, 1);
+
+        /* je label1 */
+        tcg_out8(s, OPC_JCC_short + JCC_JE);
+        label_ptr[count++] = s->code_ptr;
+        s->code_ptr++;
+    }
+
+    /* cmpl $0, g_s2e_fast_memory_access */
+    tcg_out_movi(s, TCG_TYPE_PTR, r0,
+                 (tcg_target_long) &g_s2e_fast_memory_access);
+    tcg_out_modrm_offset(s, OPC_ARITH_EvIb, ARITH_CMP, r0, 0);
+    tcg_out8(s, 0);
+
+    /* je label1 */
+    tcg_out8(s, OPC_JCC_short + JCC_JE);
+    label_ptr[count++] = s->code_ptr;
+    s->code_ptr++;
+
+    /* r0 = addrlo + (addend(r1) & ~1) */
+    tcg_out_ld(s, TCG_TYPE_PTR, r1, r1, offsetof(S2ETLBEntry, addend));
+    tgen_arithi(s, ARITH_AND + P_REXW, r1, ~1, 0);
+    tcg_out_mov(s, type, r0, addrlo);
+    tgen_arithr(s, ARITH_ADD + P_REXW, r0, r1);
+
+    return count;
+}
+#endif
 #endif
 
-#if !defined(CONFIG_S2E)
+#if !defined(CONFIG_S2E) || defined(S2E_INLINE_TLB)
 static void tcg_out_qemu_ld_direct(TCGContext *s, int datalo, int datahi,
                                    int base, tcg_target_long ofs, int sizeop)
 {
@@ -1212,6 +1311,9 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
 #endif
 #if !defined(CONFIG_S2E)
     uint8_t *label_ptr[3];
+#elif defined(S2E_INLINE_TLB)
+    uint8_t *label_ptr[4], *label_done;
+    int i, label_count;
 #endif
 #endif
 
@@ -1247,6 +1349,25 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
         *label_ptr[1] = s->code_ptr - label_ptr[1] - 1;
     }
 #else
+#ifdef S2E_INLINE_TLB
+    label_count = tcg_out_s2e_tlb_load(s, addrlo_idx, mem_index, s_bits, args,
+                                       label_ptr, offsetof(CPUTLBEntry, addr_read));
+
+    /* Concrete data */
+    tcg_out_qemu_ld_direct(s, data_reg, data_reg2,
+                           tcg_target_call_iarg_regs[0], 0, opc);
+
+    /* jmp label2 */
+    tcg_out8(s, OPC_JMP_short);
+    label_done = s->code_ptr;
+    s->code_ptr++;
+
+    /* label1: */
+    for (i = 0; i < label_count; ++i) {
+        *label_ptr[i] = s->code_ptr - label_ptr[i] - 1;
+    }
+#endif
+
     const int addrlo = args[addrlo_idx];
     const int r0 = tcg_target_call_iarg_regs[0];
     const int r1 = tcg_target_call_iarg_regs[1];
@@ -1346,6 +1467,9 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
 #if !defined(CONFIG_S2E)
     /* label2: */
     *label_ptr[2] = s->code_ptr - label_ptr[2] - 1;
+#elif defined(S2E_INLINE_TLB)
+    /* label2: */
+    *label_done = s->code_ptr - label_done - 1;
 #endif
 #else
     {
@@ -1372,7 +1496,7 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args,
 }
 
 
-#if !defined(CONFIG_S2E)
+#if !defined(CONFIG_S2E) || defined(S2E_INLINE_TLB)
 static void tcg_out_qemu_st_direct(TCGContext *s, int datalo, int datahi,
                                    int base, tcg_target_long ofs, int sizeop)
 {
@@ -1443,6 +1567,9 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
     int stack_adjust;
 #if !defined(CONFIG_S2E)
     uint8_t *label_ptr[3];
+#elif defined(S2E_INLINE_TLB)
+    uint8_t *label_ptr[4], *label_done;
+    int i, label_count;
 #endif
 #endif
 
@@ -1478,6 +1605,25 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
         *label_ptr[1] = s->code_ptr - label_ptr[1] - 1;
     }
 #else
+#ifdef S2E_INLINE_TLB
+    label_count = tcg_out_s2e_tlb_load(s, addrlo_idx, mem_index, s_bits, args,
+                                       label_ptr, offsetof(CPUTLBEntry, addr_write));
+
+    /* Concrete data owned by the current state */
+    tcg_out_qemu_st_direct(s, data_reg, data_reg2,
+                           tcg_target_call_iarg_regs[0], 0, opc);
+
+    /* jmp label2 */
+    tcg_out8(s, OPC_JMP_short);
+    label_done = s->code_ptr;
+    s->code_ptr++;
+
+    /* label1: */
+    for (i = 0; i < label_count; ++i) {
+        *label_ptr[i] = s->code_ptr - label_ptr[i] - 1;
+    }
+#endif
+
     const int addrlo = args[addrlo_idx];
     const int r0 = tcg_target_call_iarg_regs[0];
     const int r1 = tcg_target_call_iarg_regs[1];
@@ -1545,6 +1691,9 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
 #if !defined(CONFIG_S2E)
     /* label2: */
     *label_ptr[2] = s->code_ptr - label_ptr[2] - 1;
+#elif defined(S2E_INLINE_TLB)
+    /* label2: */
+    *label_done = s->code_ptr - label_done - 1;
 #endif
 #else
     {
@@ -0,0 +1,320 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include "tcg-llvm-cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sstream>
+
+static const char CACHE_MAGIC[8] = {'S', '2', 'E', 'T', 'B', 'C', '0', '1'};
+
+static inline uint64_t alignRecord(uint64_t size)
+{
+    return (size + 7) & ~(uint64_t) 7;
+}
+
+TCGLLVMCodeCache::TCGLLVMCodeCache()
+    : m_version(0), m_fd(-1), m_pid(0), m_map(NULL), m_mapSize(0),
+      m_indexed(sizeof(Header)), m_hits(0), m_misses(0), m_stores(0)
+{
+}
+
+TCGLLVMCodeCache::~TCGLLVMCodeCache()
+{
+    if (m_map) {
+        munmap((void*) m_map, m_mapSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+uint64_t TCGLLVMCodeCache::hash(const uint8_t *data, unsigned size,
+                                uint64_t seed)
+{
+    /* FNV-1a */
+    uint64_t h = seed;
+    for (unsigned i = 0; i < size; ++i) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Replaces the store by an empty one. A temporary file is renamed over the
+   old one, so that other processes can keep using the old mapping. */
+bool TCGLLVMCodeCache::create()
+{
+    std::stringstream ss;
+    ss << m_path << ".tmp" << getpid();
+    std::string tmpPath = ss.str();
+
+    int fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    Header hdr;
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = m_version;
+
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        rename(tmpPath.c_str(), m_path.c_str()) < 0) {
+        close(fd);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    flock(fd, LOCK_EX);
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = fd;
+    return true;
+}
+
+bool TCGLLVMCodeCache::open(const std::string &path, uint64_t version)
+{
+    m_path = path;
+    m_version = version;
+    m_pid = getpid();
+
+    /* Another process may replace the file while we wait for the lock */
+    for (;;) {
+        m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (m_fd < 0) {
+            return false;
+        }
+
+        flock(m_fd, LOCK_EX);
+
+        struct stat opened, current;
+        if (fstat(m_fd, &opened) == 0 && stat(path.c_str(), &current) == 0 &&
+            opened.st_ino == current.st_ino && opened.st_dev == current.st_dev) {
+            break;
+        }
+        close(m_fd);
+    }
+
+    Header hdr;
+    if (pread(m_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) ||
+        hdr.version != version) {
+        if (!create()) {
+            flock(m_fd, LOCK_UN);
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+    }
+
+    struct stat st;
+    bool ok = fstat(m_fd, &st) == 0 && remap(st.st_size);
+    if (ok) {
+        scan();
+    }
+
+    flock(m_fd, LOCK_UN);
+    return ok;
+}
+
+bool TCGLLVMCodeCache::checkOwner()
+{
+    if (m_fd < 0) {
+        return false;
+    }
+
+    if (m_pid == getpid()) {
+        return true;
+    }
+
+    /* The file may have been replaced since, start from scratch */
+    close(m_fd);
+    if (m_map) {
+        munmap((void*) m_map, m_mapSize);
+        m_map = NULL;
+        m_mapSize = 0;
+    }
+    m_fd = -1;
+    m_indexed = sizeof(Header);
+    m_index.clear();
+
+    return open(m_path, m_version);
+}
+
+bool TCGLLVMCodeCache::remap(uint64_t size)
+{
+    if (m_map) {
+        munmap((void*) m_map, m_mapSize);
+        m_map = NULL;
+        m_mapSize = 0;
+    }
+
+    void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+
+    m_map = (const uint8_t*) p;
+    m_mapSize = size;
+    return true;
+}
+
+/* Indexes the complete records that follow the last indexed one.
+   A record torn by a writer that crashed is ignored and later overwritten. */
+void TCGLLVMCodeCache::scan()
+{
+    uint64_t offset = m_indexed;
+    while (offset + sizeof(Record) <= m_mapSize) {
+        const Record *rec = (const Record*) (m_map + offset);
+        uint64_t end = offset + sizeof(Record) +
+                       alignRecord((uint64_t) rec->keySize + rec->dataSize);
+        if (end > m_mapSize) {
+            break;
+        }
+
+        m_index.insert(std::make_pair(rec->hash, offset));
+        offset = end;
+    }
+    m_indexed = offset;
+}
+
+const TCGLLVMCodeCache::Record *TCGLLVMCodeCache::find(uint64_t hash,
+                                                       const Blob &key) const
+{
+    std::pair<Index::const_iterator, Index::const_iterator> range =
+            m_index.equal_range(hash);
+
+    for (Index::const_iterator it = range.first; it != range.second; ++it) {
+        const Record *rec = (const Record*) (m_map + it->second);
+        if (rec->keySize == key.size() &&
+            !memcmp(rec + 1, &key[0], key.size())) {
+            return rec;
+        }
+    }
+    return NULL;
+}
+
+const uint8_t *TCGLLVMCodeCache::lookup(const Blob &key, unsigned *size)
+{
+    if (key.empty() || !checkOwner()) {
+        return NULL;
+    }
+
+    uint64_t h = hash(&key[0], key.size());
+    const Record *rec = find(h, key);
+
+    if (!rec) {
+        /* Pick up the records appended by other processes */
+        struct stat st;
+        flock(m_fd, LOCK_SH);
+        if (fstat(m_fd, &st) == 0 && (uint64_t) st.st_size > m_mapSize &&
+            remap(st.st_size)) {
+            scan();
+            rec = find(h, key);
+        }
+        flock(m_fd, LOCK_UN);
+    }
+
+    if (!rec) {
+        ++m_misses;
+        return NULL;
+    }
+
+    ++m_hits;
+    *size = rec->dataSize;
+    return (const uint8_t*) (rec + 1) + rec->keySize;
+}
+
+void TCGLLVMCodeCache::insert(const Blob &key, const Blob &data)
+{
+    if (key.empty() || data.empty() || !checkOwner()) {
+        return;
+    }
+
+    uint64_t h = hash(&key[0], key.size());
+
+    flock(m_fd, LOCK_EX);
+
+    struct stat st;
+    if (fstat(m_fd, &st) < 0) {
+        flock(m_fd, LOCK_UN);
+        return;
+    }
+
+    if ((uint64_t) st.st_size != m_mapSize) {
+        if (!remap(st.st_size)) {
+            flock(m_fd, LOCK_UN);
+            return;
+        }
+        scan();
+    }
+
+    if (find(h, key)) {
+        /* Another process stored the same block */
+        flock(m_fd, LOCK_UN);
+        return;
+    }
+
+    Record rec;
+    rec.hash = h;
+    rec.keySize = key.size();
+    rec.dataSize = data.size();
+
+    uint64_t payload = alignRecord((uint64_t) key.size() + data.size());
+    Blob buffer(sizeof(rec) + payload, 0);
+    memcpy(&buffer[0], &rec, sizeof(rec));
+    memcpy(&buffer[sizeof(rec)], &key[0], key.size());
+    memcpy(&buffer[sizeof(rec) + key.size()], &data[0], data.size());
+
+    /* Overwrite any torn record at the end of the file */
+    uint64_t offset = m_indexed;
+    if (pwrite(m_fd, &buffer[0], buffer.size(), offset) == (ssize_t) buffer.size()) {
+        if (ftruncate(m_fd, offset + buffer.size()) == 0) {
+            ++m_stores;
+        }
+    }
+
+    flock(m_fd, LOCK_UN);
+}
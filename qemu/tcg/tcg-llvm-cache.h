@@ -0,0 +1,119 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef TCG_LLVM_CACHE_H
+#define TCG_LLVM_CACHE_H
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ *  Persistent store of LLVM bitcode for translation blocks.
+ *
+ *  The store is a file made of a header and of a sequence of records,
+ *  each holding a key and the bitcode generated for it. Records are only
+ *  appended, under an exclusive lock, so several processes can use the same
+ *  file concurrently. Readers map the file and index the records they have
+ *  not seen yet when a lookup misses.
+ */
+class TCGLLVMCodeCache
+{
+public:
+    typedef std::vector<uint8_t> Blob;
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t version;
+    };
+
+    struct Record {
+        uint64_t hash;
+        uint32_t keySize;
+        uint32_t dataSize;
+    };
+
+    std::string m_path;
+    uint64_t m_version;
+    int m_fd;
+
+    /* flock() locks are shared with forked children, which must
+       therefore open the file again */
+    pid_t m_pid;
+
+    const uint8_t *m_map;
+    uint64_t m_mapSize;
+
+    /* End of the last record that was indexed */
+    uint64_t m_indexed;
+
+    /* Hash of the key -> offset of the record */
+    typedef std::multimap<uint64_t, uint64_t> Index;
+    Index m_index;
+
+    unsigned m_hits, m_misses, m_stores;
+
+    bool create();
+    bool checkOwner();
+    bool remap(uint64_t size);
+    void scan();
+    const Record *find(uint64_t hash, const Blob &key) const;
+
+public:
+    TCGLLVMCodeCache();
+    ~TCGLLVMCodeCache();
+
+    /** Opens the store, discarding it if its version does not match */
+    bool open(const std::string &path, uint64_t version);
+
+    /** Returns the bitcode stored for the key, or NULL if there is none.
+        The pointer is valid until the next call to lookup() or insert(). */
+    const uint8_t *lookup(const Blob &key, unsigned *size);
+
+    void insert(const Blob &key, const Blob &data);
+
+    static uint64_t hash(const uint8_t *data, unsigned size,
+                         uint64_t seed = 0xcbf29ce484222325ULL);
+
+    unsigned getHits() const { return m_hits; }
+    unsigned getMisses() const { return m_misses; }
+    unsigned getStores() const { return m_stores; }
+};
+
+#endif
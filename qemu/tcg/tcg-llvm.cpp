@@ -86,9 +86,17 @@ static void *qemu_st_helpers[5] = {
 
 #include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <map>
+#include <set>
+
+#include "tcg-llvm-cache.h"
 
 
 //#undef NDEBUG
@@ -141,6 +149,28 @@ struct TCGLLVMContextPrivate {
     /* Count of generated translation blocks */
     int m_tbCount;
 
+    /* Persistent cache of optimized blocks, NULL if disabled */
+    TCGLLVMCodeCache *m_codeCache;
+
+    /* Host pointers noted while translating the current block */
+    std::set<uint64_t> m_hostPointers;
+
+    struct CodeCacheEntry {
+        /* Functions are identified by their name, which is unique,
+           because the address of a deleted function may be reused */
+        std::string name;
+        TCGLLVMCodeCache::Blob key;
+
+        /* Host pointers of the block, in the order of the key */
+        std::vector<uint64_t> pointers;
+    };
+
+    /* Blocks that will be stored once KLEE has optimized them */
+    std::map<Function*, CodeCacheEntry> m_pendingFunctions;
+
+    /* Blocks that were loaded from the cache */
+    std::map<Function*, std::string> m_cachedFunctions;
+
     /* XXX: The following members are "local" to generateCode method */
 
     /* TCGContext for current translation block */
@@ -261,7 +291,21 @@ public:
     void generateTraceCall(uintptr_t pc);
     int generateOperation(int opc, const TCGArg *args);
 
+    void generateFunction(TranslationBlock *tb, const std::string &name);
     void generateCode(TCGContext *s, TranslationBlock *tb);
+
+    /* Code cache */
+    void buildCacheKey(TranslationBlock *tb, CodeCacheEntry &entry);
+    Function* loadCachedFunction(const uint8_t *data, unsigned size,
+                                 const CodeCacheEntry &entry);
+
+    bool enableCodeCache(const std::string &path, uint64_t version);
+    bool isCachedFunction(Function *f) const;
+    void storeFunction(Function *f);
+    void replaceFunction(Function *from, Function *to);
+    void forgetFunction(Function *f);
+    void noteHostPointer(uint64_t ptr);
+    void clearHostPointers() { m_hostPointers.clear(); }
 };
 
 /* Custom JITMemoryManager in order to capture the size of
@@ -353,7 +397,7 @@ public:
 
 TCGLLVMContextPrivate::TCGLLVMContextPrivate()
     : m_context(getGlobalContext()), m_builder(m_context), m_tbCount(0),
-      m_tcgContext(NULL), m_tbFunction(NULL)
+      m_codeCache(NULL), m_tcgContext(NULL), m_tbFunction(NULL)
 {
     std::memset(m_values, 0, sizeof(m_values));
     std::memset(m_memValuesPtr, 0, sizeof(m_memValuesPtr));
@@ -394,6 +438,7 @@ TCGLLVMContextPrivate::TCGLLVMContextPrivate()
 TCGLLVMContextPrivate::~TCGLLVMContextPrivate()
 {
     delete m_functionPassManager;
+    delete m_codeCache;
 
     // the following line will also delete
     // m_moduleProvider, m_module and all its functions
@@ -1323,29 +1368,18 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
     return nb_args;
 }
 
-void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
+void TCGLLVMContextPrivate::generateFunction(TranslationBlock *tb,
+                                             const std::string &name)
 {
-    /* Create new function for current translation block */
-    /* TODO: compute the checksum of the tb to see if we can reuse some code */
-    std::ostringstream fName;
-    fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
-
-    /*
-    if(m_tbFunction)
-        m_tbFunction->eraseFromParent();
-    */
-
     FunctionType *tbFunctionType = FunctionType::get(
             wordType(),
             std::vector<llvm::Type*>(1, intPtrType(64)), false);
     m_tbFunction = Function::Create(tbFunctionType,
-            Function::PrivateLinkage, fName.str(), m_module);
+            Function::PrivateLinkage, name, m_module);
     BasicBlock *basicBlock = BasicBlock::Create(m_context,
             "entry", m_tbFunction);
     m_builder.SetInsertPoint(basicBlock);
 
-    m_tcgContext = s;
-
     /* Prepare globals and temps information */
     initGlobalsAndLocalTemps();
 
@@ -1402,6 +1436,46 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
 
     //KLEE will optimize the function later
     //m_functionPassManager->run(*m_tbFunction);
+}
+
+void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
+{
+    /* Create new function for current translation block */
+    std::ostringstream fName;
+    fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
+
+    m_tcgContext = s;
+    m_tbFunction = NULL;
+
+    CodeCacheEntry entry;
+    if (m_codeCache) {
+        entry.name = fName.str();
+        buildCacheKey(tb, entry);
+
+        unsigned size;
+        const uint8_t *data = m_codeCache->lookup(entry.key, &size);
+        if (data) {
+            m_tbFunction = loadCachedFunction(data, size, entry);
+        }
+    }
+
+    bool cached = m_tbFunction != NULL;
+    if (!cached) {
+        generateFunction(tb, fName.str());
+    }
+
+    if (m_codeCache) {
+        /* The address may have belonged to a deleted function */
+        m_pendingFunctions.erase(m_tbFunction);
+        m_cachedFunctions.erase(m_tbFunction);
+
+        if (cached) {
+            m_cachedFunctions[m_tbFunction] = entry.name;
+        } else {
+            m_pendingFunctions[m_tbFunction] = entry;
+        }
+        m_hostPointers.clear();
+    }
 
     tb->llvm_function = m_tbFunction;
 
@@ -1434,6 +1508,329 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
     }
 }
 
+/***********************************/
+/* Persistent code cache */
+
+static inline void appendWord(TCGLLVMCodeCache::Blob &b, uint64_t w)
+{
+    const uint8_t *p = (const uint8_t*) &w;
+    b.insert(b.end(), p, p + sizeof(w));
+}
+
+/* Number of parameters of a TCG operation, as in generateOperation */
+static int tcgOperationArgs(int opc, const TCGArg *args)
+{
+    const TCGOpDef &def = tcg_op_defs[opc];
+    if (opc == INDEX_op_nopn) {
+        return args[0];
+    } else if (opc == INDEX_op_call) {
+        return (args[0] >> 16) + (args[0] & 0xffff) + def.nb_cargs + 1;
+    }
+    return def.nb_args;
+}
+
+bool TCGLLVMContextPrivate::enableCodeCache(const std::string &path,
+                                            uint64_t version)
+{
+    if (!m_codeCache) {
+        m_codeCache = new TCGLLVMCodeCache;
+    }
+
+    if (!m_codeCache->open(path, version)) {
+        delete m_codeCache;
+        m_codeCache = NULL;
+        return false;
+    }
+    return true;
+}
+
+void TCGLLVMContextPrivate::noteHostPointer(uint64_t ptr)
+{
+    if (m_codeCache) {
+        m_hostPointers.insert(ptr);
+    }
+}
+
+/**
+ * The key is made of the TCG operations of the block, which depend on the
+ * guest code, on the cpu flags of the block and on the instrumentation added
+ * by plugins. Noted host pointers (and small offsets from them, for exit_tb)
+ * are replaced by their index, so that the key does not depend on where
+ * the objects are allocated. Any other value that changes from run to run
+ * only causes cache misses.
+ */
+void TCGLLVMContextPrivate::buildCacheKey(TranslationBlock *tb,
+                                          CodeCacheEntry &entry)
+{
+    TCGContext *s = m_tcgContext;
+    TCGLLVMCodeCache::Blob &key = entry.key;
+
+    m_hostPointers.insert((uintptr_t) tb);
+
+    /* Absolute addresses of QEMU's own data are embedded in the code */
+    appendWord(key, (uintptr_t) &tcg_llvm_runtime);
+    appendWord(key, execute_llvm);
+    appendWord(key, tb->pc);
+    appendWord(key, tb->cs_base);
+    appendWord(key, tb->flags);
+
+    appendWord(key, s->nb_globals);
+    appendWord(key, s->nb_temps);
+    for (int i = s->nb_globals; i < s->nb_temps; ++i) {
+        appendWord(key, s->temps[i].type | (s->temps[i].temp_local << 8));
+    }
+
+    const TCGArg *args = gen_opparam_buf;
+    for (int opc_index = 0; ; ++opc_index) {
+        int opc = gen_opc_buf[opc_index];
+        appendWord(key, opc);
+        if (opc == INDEX_op_end) {
+            break;
+        }
+
+        int nb_args = tcgOperationArgs(opc, args);
+        for (int i = 0; i < nb_args; ++i) {
+            uint64_t arg = args[i];
+
+            std::set<uint64_t>::iterator it = m_hostPointers.upper_bound(arg);
+            if (it != m_hostPointers.begin() && arg - *(--it) < 4) {
+                uint64_t base = *it;
+                unsigned index = std::find(entry.pointers.begin(),
+                                           entry.pointers.end(), base) -
+                                 entry.pointers.begin();
+                if (index == entry.pointers.size()) {
+                    entry.pointers.push_back(base);
+                }
+
+                key.push_back(1);
+                appendWord(key, index);
+                appendWord(key, arg - base);
+            } else {
+                key.push_back(0);
+                appendWord(key, arg);
+            }
+        }
+        args += nb_args;
+    }
+}
+
+/**
+ * The data of an entry is the list of host pointers of the block that was
+ * stored, followed by the bitcode of a module that contains the function
+ * and the declarations of the globals it uses.
+ */
+Function* TCGLLVMContextPrivate::loadCachedFunction(const uint8_t *data,
+                                                    unsigned size,
+                                                    const CodeCacheEntry &entry)
+{
+    uint64_t count = 0;
+    if (size < sizeof(count)) {
+        return NULL;
+    }
+    memcpy(&count, data, sizeof(count));
+
+    uint64_t header = sizeof(count) * (count + 1);
+    if (count != entry.pointers.size() || size <= header) {
+        return NULL;
+    }
+
+    const uint64_t *oldPointers = (const uint64_t*) (data + sizeof(count));
+
+    MemoryBuffer *buffer = MemoryBuffer::getMemBufferCopy(
+            StringRef((const char*) data + header, size - header), entry.name);
+    std::string error;
+    Module *cached = ParseBitcodeFile(buffer, m_context, &error);
+    delete buffer;
+
+    if (!cached) {
+        return NULL;
+    }
+
+    Function *cachedFunction = cached->getFunction("tb");
+    if (!cachedFunction || cachedFunction->isDeclaration()) {
+        delete cached;
+        return NULL;
+    }
+
+    /* Map the declarations to the globals of the main module */
+    ValueToValueMapTy vmap;
+    for (Module::iterator it = cached->begin(); it != cached->end(); ++it) {
+        if (&*it == cachedFunction) {
+            continue;
+        }
+        GlobalValue *gv;
+        if (it->isIntrinsic()) {
+            gv = dyn_cast<GlobalValue>(m_module->getOrInsertFunction(
+                    it->getName(), it->getFunctionType()));
+        } else {
+            gv = m_module->getNamedValue(it->getName());
+        }
+        if (!gv || gv->getType() != it->getType()) {
+            delete cached;
+            return NULL;
+        }
+        vmap[&*it] = gv;
+    }
+
+    for (Module::global_iterator it = cached->global_begin();
+         it != cached->global_end(); ++it) {
+        GlobalValue *gv = m_module->getNamedValue(it->getName());
+        if (!gv || gv->getType() != it->getType()) {
+            delete cached;
+            return NULL;
+        }
+        vmap[&*it] = gv;
+    }
+
+    /* Relocate the host pointers */
+    for (unsigned i = 0; i < count; ++i) {
+        for (uint64_t offset = 0; offset < 4; ++offset) {
+            Value *from = ConstantInt::get(wordType(), oldPointers[i] + offset);
+            Value *to = ConstantInt::get(wordType(),
+                                         entry.pointers[i] + offset);
+
+            ValueToValueMapTy::iterator vit = vmap.find(from);
+            if (vit != vmap.end() && vit->second != to) {
+                delete cached;
+                return NULL;
+            }
+            vmap[from] = to;
+        }
+    }
+
+    Function *f = Function::Create(cachedFunction->getFunctionType(),
+            Function::PrivateLinkage, entry.name, m_module);
+
+    Function::arg_iterator dest = f->arg_begin();
+    for (Function::const_arg_iterator it = cachedFunction->arg_begin();
+         it != cachedFunction->arg_end(); ++it, ++dest) {
+        vmap[it] = dest;
+    }
+
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(f, cachedFunction, vmap, true, returns);
+
+    delete cached;
+    return f;
+}
+
+bool TCGLLVMContextPrivate::isCachedFunction(Function *f) const
+{
+    std::map<Function*, std::string>::const_iterator it =
+            m_cachedFunctions.find(f);
+    return it != m_cachedFunctions.end() && f->getName() == it->second;
+}
+
+static void collectGlobals(Value *v, std::set<GlobalValue*> &globals)
+{
+    if (GlobalValue *gv = dyn_cast<GlobalValue>(v)) {
+        globals.insert(gv);
+    } else if (Constant *c = dyn_cast<Constant>(v)) {
+        for (unsigned i = 0; i < c->getNumOperands(); ++i) {
+            collectGlobals(c->getOperand(i), globals);
+        }
+    }
+}
+
+void TCGLLVMContextPrivate::storeFunction(Function *f)
+{
+    std::map<Function*, CodeCacheEntry>::iterator pit =
+            m_pendingFunctions.find(f);
+    if (pit == m_pendingFunctions.end()) {
+        return;
+    }
+
+    CodeCacheEntry entry = pit->second;
+    m_pendingFunctions.erase(pit);
+    if (f->getName() != entry.name) {
+        return;
+    }
+
+    std::set<GlobalValue*> globals;
+    for (Function::iterator bb = f->begin(); bb != f->end(); ++bb) {
+        for (BasicBlock::iterator i = bb->begin(); i != bb->end(); ++i) {
+            for (unsigned op = 0; op < i->getNumOperands(); ++op) {
+                collectGlobals(i->getOperand(op), globals);
+            }
+        }
+    }
+
+    if (globals.count(f)) {
+        return;
+    }
+
+    Module *module = new Module("tcg-llvm-cache", m_context);
+    module->setDataLayout(m_module->getDataLayout());
+    module->setTargetTriple(m_module->getTargetTriple());
+
+    ValueToValueMapTy vmap;
+    for (std::set<GlobalValue*>::iterator it = globals.begin();
+         it != globals.end(); ++it) {
+        GlobalValue *decl;
+        if (Function *gf = dyn_cast<Function>(*it)) {
+            decl = Function::Create(gf->getFunctionType(),
+                    Function::ExternalLinkage, gf->getName(), module);
+        } else if (GlobalVariable *gv = dyn_cast<GlobalVariable>(*it)) {
+            decl = new GlobalVariable(*module,
+                    gv->getType()->getElementType(), gv->isConstant(),
+                    GlobalValue::ExternalLinkage, NULL, gv->getName());
+        } else {
+            delete module;
+            return;
+        }
+        vmap[*it] = decl;
+    }
+
+    Function *cachedFunction = Function::Create(f->getFunctionType(),
+            Function::ExternalLinkage, "tb", module);
+
+    Function::arg_iterator dest = cachedFunction->arg_begin();
+    for (Function::const_arg_iterator it = f->arg_begin();
+         it != f->arg_end(); ++it, ++dest) {
+        vmap[it] = dest;
+    }
+
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(cachedFunction, f, vmap, true, returns);
+
+    std::string bitcode;
+    raw_string_ostream os(bitcode);
+    WriteBitcodeToFile(module, os);
+    os.flush();
+    delete module;
+
+    TCGLLVMCodeCache::Blob data;
+    appendWord(data, entry.pointers.size());
+    for (unsigned i = 0; i < entry.pointers.size(); ++i) {
+        appendWord(data, entry.pointers[i]);
+    }
+    data.insert(data.end(), bitcode.begin(), bitcode.end());
+
+    m_codeCache->insert(entry.key, data);
+}
+
+void TCGLLVMContextPrivate::replaceFunction(Function *from, Function *to)
+{
+    std::map<Function*, CodeCacheEntry>::iterator it =
+            m_pendingFunctions.find(from);
+    if (it == m_pendingFunctions.end()) {
+        return;
+    }
+
+    CodeCacheEntry entry = it->second;
+    m_pendingFunctions.erase(it);
+    if (from->getName() == entry.name) {
+        entry.name = to->getName();
+        m_pendingFunctions[to] = entry;
+    }
+}
+
+void TCGLLVMContextPrivate::forgetFunction(Function *f)
+{
+    m_pendingFunctions.erase(f);
+    m_cachedFunctions.erase(f);
+}
+
 /***********************************/
 /* External interface for C++ code */
 
@@ -1488,6 +1885,41 @@ void TCGLLVMContext::generateCode(TCGContext *s, TranslationBlock *tb)
     m_private->generateCode(s, tb);
 }
 
+bool TCGLLVMContext::enableCodeCache(const char *path, uint64_t version)
+{
+    return m_private->enableCodeCache(path, version);
+}
+
+bool TCGLLVMContext::isCachedFunction(Function *f) const
+{
+    return m_private->isCachedFunction(f);
+}
+
+void TCGLLVMContext::storeFunction(Function *f)
+{
+    m_private->storeFunction(f);
+}
+
+void TCGLLVMContext::replaceFunction(Function *from, Function *to)
+{
+    m_private->replaceFunction(from, to);
+}
+
+void TCGLLVMContext::forgetFunction(Function *f)
+{
+    m_private->forgetFunction(f);
+}
+
+void TCGLLVMContext::noteHostPointer(uintptr_t ptr)
+{
+    m_private->noteHostPointer(ptr);
+}
+
+void TCGLLVMContext::clearHostPointers()
+{
+    m_private->clearHostPointers();
+}
+
 /*****************************/
 /* Functions for QEMU c code */
 
@@ -1519,10 +1951,27 @@ void tcg_llvm_tb_alloc(TranslationBlock *tb)
 void tcg_llvm_tb_free(TranslationBlock *tb)
 {
     if(tb->llvm_function) {
+        if (tb->tcg_llvm_context) {
+            tb->tcg_llvm_context->forgetFunction(tb->llvm_function);
+        }
         tb->llvm_function->eraseFromParent();
     }
 }
 
+void tcg_llvm_note_host_pointer(uintptr_t ptr)
+{
+    if (tcg_llvm_ctx) {
+        tcg_llvm_ctx->noteHostPointer(ptr);
+    }
+}
+
+void tcg_llvm_clear_host_pointers(void)
+{
+    if (tcg_llvm_ctx) {
+        tcg_llvm_ctx->clearHostPointers();
+    }
+}
+
 #ifndef CONFIG_S2E
 int tcg_llvm_search_last_pc(TranslationBlock *tb, uintptr_t searched_pc)
 {
@@ -85,6 +85,12 @@ const char* tcg_llvm_get_func_name(struct TranslationBlock *tb);
 
 uintptr_t tcg_llvm_qemu_tb_exec(void *env, TranslationBlock *tb);
 
+/* Host addresses that the translator embeds in the code of a block
+   (e.g., TranslationBlock or signal pointers). The code cache relocates
+   them when reusing the block in another run. */
+void tcg_llvm_note_host_pointer(uintptr_t ptr);
+void tcg_llvm_clear_host_pointers(void);
+
 #ifndef CONFIG_S2E
 int tcg_llvm_search_last_pc(struct TranslationBlock *tb, uintptr_t searched_pc);
 #endif
@@ -134,6 +140,23 @@ public:
 
     void generateCode(struct TCGContext *s,
                       struct TranslationBlock *tb);
+
+    /** Persistently caches the optimized code of translation blocks in the
+        given file. The version identifies the helper module. */
+    bool enableCodeCache(const char *path, uint64_t version);
+
+    /** Whether the function comes already optimized from the cache */
+    bool isCachedFunction(llvm::Function *f) const;
+
+    /** Stores the function in the cache once it has been optimized */
+    void storeFunction(llvm::Function *f);
+
+    /** The cache entry of a function follows its optimized copy */
+    void replaceFunction(llvm::Function *from, llvm::Function *to);
+
+    void forgetFunction(llvm::Function *f);
+    void noteHostPointer(uintptr_t ptr);
+    void clearHostPointers();
 };
 
 #endif
@@ -1141,15 +1141,68 @@ void tcg_calc_regmask_ex(TCGContext *s, uint64_t *rmask, uint64_t *wmask,
         for(i = 0; i < nb_iargs; i++) {
             TCGArg idx = args[nb_oargs + i];
             if (idx < s->nb_globals) {
-                if ((*wmask & (1<<idx)) == 0)
-                    *rmask |= (1<<idx);
+                if ((*wmask & (1ULL<<idx)) == 0)
+                    *rmask |= (1ULL<<idx);
             }
         }
 
         for(i = 0; i < nb_oargs; i++) {
             TCGArg idx = args[i];
             if (idx < s->nb_globals) {
-                *wmask |= (1<<idx);
+                *wmask |= (1ULL<<idx);
+            }
+        }
+
+        args += nb_iargs + nb_oargs + nb_cargs;
+    }
+}
+
+/* Computes the globals that the block overwrites before reading them,
+   and before any operation that could leave the block (branches, labels,
+   helper calls and guest memory accesses). Their value on entry to the
+   block is therefore dead. */
+void tcg_calc_regkmask(TCGContext *s, uint64_t *kmask)
+{
+    const uint16_t *opc_ptr;
+    const TCGArg *args;
+    int c, i, nb_oargs, nb_iargs, nb_cargs;
+    const TCGOpDef *def;
+    uint64_t rmask = 0;
+
+    *kmask = 0;
+
+    opc_ptr = gen_opc_buf;
+    args = gen_opparam_buf;
+    while (opc_ptr < gen_opc_ptr) {
+        c = *opc_ptr++;
+        def = &tcg_op_defs[c];
+
+        if (c == INDEX_op_call || c == INDEX_op_set_label ||
+            (def->flags & (TCG_OPF_BB_END | TCG_OPF_CALL_CLOBBER))) {
+            break;
+        }
+
+        if (c == INDEX_op_nopn) {
+            nb_cargs = *args;
+            nb_oargs = 0;
+            nb_iargs = 0;
+        } else {
+            nb_oargs = def->nb_oargs;
+            nb_iargs = def->nb_iargs;
+            nb_cargs = def->nb_cargs;
+        }
+
+        for(i = 0; i < nb_iargs; i++) {
+            TCGArg idx = args[nb_oargs + i];
+            if (idx < s->nb_globals && (*kmask & (1ULL<<idx)) == 0) {
+                rmask |= (1ULL<<idx);
+            }
+        }
+
+        for(i = 0; i < nb_oargs; i++) {
+            TCGArg idx = args[i];
+            if (idx < s->nb_globals && (rmask & (1ULL<<idx)) == 0) {
+                *kmask |= (1ULL<<idx);
             }
         }
 
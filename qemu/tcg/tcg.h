@@ -615,6 +615,8 @@ void tcg_calc_regmask_ex(TCGContext *s, uint64_t *rmask, uint64_t *wmask,
 
 void tcg_calc_regmask(TCGContext *s, uint64_t *rmask, uint64_t *wmask,
                       uint64_t *accesses_mem);
+
+void tcg_calc_regkmask(TCGContext *s, uint64_t *kmask);
 #endif
 
 void tcg_register_jit(void *buf, size_t buf_size);
@@ -88,6 +88,9 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
     ti = profile_getclock();
 #endif
     tcg_func_start(s);
+#if defined(CONFIG_LLVM)
+    tcg_llvm_clear_host_pointers();
+#endif
 
     gen_intermediate_code(env, tb);
 
@@ -115,6 +118,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #ifdef CONFIG_S2E
     tcg_calc_regmask(s, &tb->reg_rmask, &tb->reg_wmask,
                      &tb->helper_accesses_mem);
+    tcg_calc_regkmask(s, &tb->reg_kmask);
 #endif
 
 #if defined(CONFIG_LLVM)
@@ -235,6 +239,7 @@ int cpu_gen_llvm(CPUArchState *env, TranslationBlock *tb)
     assert(tb->llvm_function == NULL);
 
     tcg_func_start(s);
+    tcg_llvm_clear_host_pointers();
     gen_intermediate_code_pc(env, tb);
     tcg_llvm_gen_code(tcg_llvm_ctx, s, tb);
     s2e_set_tb_function(g_s2e, tb);
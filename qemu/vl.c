@@ -265,6 +265,11 @@ uint8_t qemu_extra_params_fw[2];
 
 #if !defined(CONFIG_S2E)
 fake_pci_t g_fake_pci;
+
+/* Guest address that triggers the snapshot for S2E (see -kvm-snapshot-at) */
+static int kvm_snapshot_enabled;
+static target_ulong kvm_snapshot_pc;
+static const char *kvm_snapshot_name = "s2e";
 #endif
 typedef struct FWBootEntry FWBootEntry;
 
@@ -1265,7 +1270,14 @@ static void gui_update(void *opaque)
     DisplayState *ds = opaque;
     DisplayChangeListener *dcl = ds->listeners;
 
+#ifdef CONFIG_S2E
+    /* Refreshing scans the video RAM of the current state */
+    if (!s2e_is_display_suspended()) {
+        dpy_refresh(ds);
+    }
+#else
     dpy_refresh(ds);
+#endif
 
     while (dcl != NULL) {
         if (dcl->gui_timer_interval &&
@@ -1555,11 +1567,84 @@ void qemu_system_vmstop_request(RunState state)
 
 qemu_irq qemu_system_powerdown;
 
+#if !defined(CONFIG_S2E)
+/**
+ * Booting large guests in the DBT engine of S2E takes a long time.
+ * With -kvm-snapshot-at, the guest boots in KVM until it executes the
+ * given address, then QEMU saves a snapshot that S2E resumes with -loadvm.
+ * The address is watched with a hardware breakpoint, which does not
+ * require the page to be mapped when QEMU starts.
+ */
+static int kvm_snapshot_insert_breakpoint(void)
+{
+    int ret;
+
+    if (!kvm_snapshot_enabled) {
+        return 0;
+    }
+
+    if (!kvm_enabled()) {
+        fprintf(stderr, "-kvm-snapshot-at requires -enable-kvm\n");
+        return -1;
+    }
+
+    ret = kvm_insert_breakpoint(first_cpu, kvm_snapshot_pc, 1, GDB_BREAKPOINT_HW);
+    if (ret < 0) {
+        fprintf(stderr, "Could not set the breakpoint at " TARGET_FMT_lx ": %s\n",
+                kvm_snapshot_pc, strerror(-ret));
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns true if the debug stop comes from the -kvm-snapshot-at breakpoint */
+static bool kvm_snapshot_reached(void)
+{
+#if defined(TARGET_I386)
+    CPUArchState *env;
+
+    if (!kvm_snapshot_enabled) {
+        return false;
+    }
+
+    for (env = first_cpu; env != NULL; env = env->next_cpu) {
+        cpu_synchronize_state(env);
+        if (env->eip + env->segs[R_CS].base == kvm_snapshot_pc) {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+static void kvm_snapshot_save(void)
+{
+    QDict *qdict;
+
+    fprintf(stderr, "Guest reached " TARGET_FMT_lx ", saving snapshot %s\n",
+            kvm_snapshot_pc, kvm_snapshot_name);
+
+    /* The breakpoint is not part of the snapshot, the guest resumes normally */
+    kvm_remove_breakpoint(first_cpu, kvm_snapshot_pc, 1, GDB_BREAKPOINT_HW);
+
+    qdict = qdict_new();
+    qdict_put(qdict, "name", qstring_from_str(kvm_snapshot_name));
+    do_savevm(cur_mon, qdict);
+    QDECREF(qdict);
+}
+#endif
+
 static bool main_loop_should_exit(void)
 {
     RunState r;
     if (qemu_debug_requested()) {
         vm_stop(RUN_STATE_DEBUG);
+#if !defined(CONFIG_S2E)
+        if (kvm_snapshot_reached()) {
+            kvm_snapshot_save();
+            return true;
+        }
+#endif
     }
     if (qemu_suspend_requested()) {
         qemu_system_suspend();
@@ -2337,6 +2422,7 @@ int main(int argc, char **argv, char **envp)
     int execute_always_klee = 0;
     int s2e_verbose = 0;
     int s2e_max_processes = 1;
+    const char *s2e_server = NULL;
 #endif
 
     const char *vga_model = NULL;
@@ -2468,6 +2554,9 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_s2e_output_dir:
               s2e_output_dir = optarg;
               break;
+            case QEMU_OPTION_s2e_server:
+              s2e_server = optarg;
+              break;
 #else
             case QEMU_OPTION_fake_pci_name:
               g_fake_pci.name = optarg;
@@ -2532,6 +2621,13 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_fake_pci_cap_pcie: // PCI-E support
               g_fake_pci.cap_pcie = strtol(optarg, NULL, 0);
               break;
+            case QEMU_OPTION_kvm_snapshot_at:
+              kvm_snapshot_enabled = 1;
+              kvm_snapshot_pc = strtoull(optarg, NULL, 0);
+              break;
+            case QEMU_OPTION_kvm_snapshot_name:
+              kvm_snapshot_name = optarg;
+              break;
 #endif
 
             case QEMU_OPTION_hda:
@@ -3846,6 +3942,19 @@ int main(int argc, char **argv, char **envp)
         }
     }
 
+#if !defined(CONFIG_S2E)
+    if (kvm_snapshot_insert_breakpoint() < 0) {
+        exit(1);
+    }
+#endif
+
+#ifdef CONFIG_S2E
+    if (s2e_server) {
+        /* The initial state is ready, only the job processes return */
+        s2e_run_server(g_s2e, s2e_server);
+    }
+#endif
+
     if (incoming) {
         int ret = qemu_start_incoming_migration(incoming);
         if (ret < 0) {
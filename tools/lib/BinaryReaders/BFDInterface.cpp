@@ -35,29 +35,64 @@
 
 #include "BFDInterface.h"
 #include "Binary.h"
+#include "ModuleImage.h"
 
 #include "Pe.h"
 #include "Macho.h"
 
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/system_error.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <cassert>
 
 #include <algorithm>
 #include <iostream>
 #include <vector>
 
+namespace {
+    llvm::cl::opt<bool>
+            SymbolCache("symbol-cache",
+                        llvm::cl::desc("Save resolved addresses to <binary>.symcache and reuse them in later runs"),
+                        llvm::cl::init(false));
+}
 
 namespace s2etools
 {
 
+//Layout of the .symcache file: the header, the entries sorted by
+//address, then the interned strings, each terminated by a null byte.
+//The binary size and modification time detect stale caches.
+struct SymbolCacheHeader {
+    char magic[8];
+    uint64_t binarySize;
+    uint64_t binaryMtime;
+    uint32_t entryCount;
+    uint32_t stringCount;
+};
+
+struct SymbolCacheEntry {
+    uint64_t address;
+    uint64_t line;
+    uint32_t source;
+    uint32_t function;
+    uint32_t valid;
+    uint32_t padding;
+};
+
+static const char s_symbolCacheMagic[8] = {'S', '2', 'E', 'S', 'Y', 'M', '0', '1'};
+
 bool BFDInterface::s_bfdInited = false;
 
 BFDInterface::BFDInterface(const std::string &fileName):ExecutableFile(fileName)
 {
     m_bfd = NULL;
     m_symbolTable = NULL;
+    m_lineCacheDirty = false;
+    m_imageTablesLoaded = false;
     //Fail loading if the image has no symbols
     m_requireSymbols = true;
 
@@ -70,6 +105,8 @@ BFDInterface::BFDInterface(const std::string &fileName, bool requireSymbols):Exe
 {
     m_bfd = NULL;
     m_symbolTable = NULL;
+    m_lineCacheDirty = false;
+    m_imageTablesLoaded = false;
     m_requireSymbols = requireSymbols;
     llvm::MemoryBuffer::getFile(fileName.c_str(), m_file);
     m_binary = NULL;
@@ -77,6 +114,10 @@ BFDInterface::BFDInterface(const std::string &fileName, bool requireSymbols):Exe
 
 BFDInterface::~BFDInterface()
 {
+    if (SymbolCache && m_lineCacheDirty) {
+        saveSymbolCache();
+    }
+
     if (m_binary) {
         delete m_binary;
     }
@@ -101,9 +142,25 @@ void BFDInterface::initSections(bfd *abfd, asection *sect, void *obj)
         if (reloc_size > 0) {
             arelent **relent = (arelent**)malloc (reloc_size);
             long res = bfd_canonicalize_reloc(abfd, sect, relent, bfdptr->m_symbolTable);
-            if (res < 0) {
-                free(relent);
+            for (long i = 0; i < res; ++i) {
+                arelent *rel = relent[i];
+                if (!rel->howto || !rel->sym_ptr_ptr) {
+                    continue;
+                }
+
+                asymbol *sym = *rel->sym_ptr_ptr;
+
+                RelocationEntry re;
+                re.va = sect->vma + rel->address;
+                re.size = bfd_get_reloc_size(rel->howto);
+                re.symbolName = bfd_asymbol_name(sym);
+                re.symbolBase = bfd_asymbol_value(sym);
+                re.symbolIndex = rel->sym_ptr_ptr - bfdptr->m_symbolTable;
+                re.originalValue = rel->addend;
+                re.targetValue = re.symbolBase + rel->addend;
+                bfdptr->m_relocations[re.va] = re;
             }
+            free(relent);
         }
     }
 
@@ -117,18 +174,82 @@ bool BFDInterface::initialize()
 
 bool BFDInterface::initialize(const std::string &format)
 {
-    if (!s_bfdInited) {
-        bfd_init();
-        s_bfdInited = true;
+    if (m_bfd || m_image.get()) {
+        return true;
     }
 
+    m_format = format;
+
+    uint64_t contentHash = 0;
+    bool useImage = ModuleImage::isEnabled() && m_file.get();
+    if (useImage) {
+        contentHash = ModuleImage::hashContents(m_file.get());
+
+        llvm::OwningPtr<ModuleImage> image(new ModuleImage());
+        if (image->open(contentHash) && (!m_requireSymbols || image->hasSymbols())) {
+            m_image.swap(image);
+            m_imageBase = m_image->getImageBase();
+            initModuleName();
+            if (SymbolCache) {
+                loadSymbolCache();
+            }
+            return true;
+        }
+    }
+
+    if (!openBfd()) {
+        return false;
+    }
+
+    if (useImage) {
+        saveModuleImage(contentHash);
+    }
+
+    initModuleName();
+
+    if (SymbolCache) {
+        loadSymbolCache();
+    }
+
+    return true;
+}
+
+//Called by the methods that need the BFD structures when
+//the metadata came from the module cache
+bool BFDInterface::requireBfd() const
+{
     if (m_bfd) {
         return true;
     }
 
+    if (!m_image.get()) {
+        return false;
+    }
+
+    return const_cast<BFDInterface*>(this)->openBfd();
+}
+
+void BFDInterface::initModuleName()
+{
+    //Extract module name
+    size_t pos = m_fileName.find_last_of("\\/");
+    if (pos == std::string::npos) {
+        m_moduleName = m_fileName;
+    }else {
+        m_moduleName = m_fileName.substr(pos);
+    }
+}
+
+bool BFDInterface::openBfd()
+{
+    if (!s_bfdInited) {
+        bfd_init();
+        s_bfdInited = true;
+    }
+
     const char *bfdFormat = NULL;
-    if (format.size() > 0) {
-        bfdFormat = format.c_str();
+    if (m_format.size() > 0) {
+        bfdFormat = m_format.c_str();
     }
 
     m_bfd = bfd_fopen(m_fileName.c_str(), bfdFormat, "rw", -1);
@@ -191,69 +312,293 @@ bool BFDInterface::initialize(const std::string &format)
         m_binary = new MachoReader(this);
     }
 
-    //Extract module name
-    size_t pos = m_fileName.find_last_of("\\/");
-    if (pos == std::string::npos) {
-        m_moduleName = m_fileName;
-    }else {
-        m_moduleName = m_fileName.substr(pos);
+    return true;
+}
+
+void BFDInterface::saveModuleImage(uint64_t contentHash)
+{
+    ModuleImage::Data data;
+    data.imageBase = m_imageBase;
+    data.imageSize = bfd_get_size(m_bfd);
+    data.entryPoint = m_bfd->start_address;
+    data.hasSymbols = m_bfd->flags & HAS_SYMS;
+
+    Sections::const_iterator it;
+    for (it = m_sections.begin(); it != m_sections.end(); ++it) {
+        asection *section = (*it).second;
+        if (!(*it).first.size) {
+            continue;
+        }
+
+        ModuleImage::Data::NamedSection s;
+        s.start = (*it).first.start;
+        s.size = (*it).first.size;
+        s.flags = section->flags;
+        s.name = section->name ? section->name : "";
+        data.sections.push_back(s);
     }
 
-    return true;
+    data.relocations = getRelocations();
+    data.imports = getImports();
+
+    ModuleImage::write(contentHash, data);
 }
 
-bool BFDInterface::getInfo(uint64_t addr, std::string &source, uint64_t &line, std::string &function)
+uint32_t BFDInterface::internString(const char *str)
 {
-    if (!initialize()) {
-        return false;
+    if (!str) {
+        return NoString;
     }
 
+    StringIndex::const_iterator it = m_stringIndex.find(str);
+    if (it != m_stringIndex.end()) {
+        return (*it).second;
+    }
+
+    uint32_t index = m_strings.size();
+    m_strings.push_back(str);
+    m_stringIndex[str] = index;
+    return index;
+}
+
+//Looks up addr in BFD and records the result, valid or not
+BFDInterface::LineCache::iterator BFDInterface::resolve(uint64_t addr, LineCache::iterator hint)
+{
+    LineInfo info;
+    info.line = 0;
+    info.source = NoString;
+    info.function = NoString;
+    info.valid = false;
+
     BFDSection s;
     s.start = addr;
     s.size = 1;
 
+    Sections::const_iterator it;
+    if (!requireBfd()) {
+        std::cerr << "Could not open bfd file " << m_fileName << std::endl;
+    } else if ((it = m_sections.find(s)) == m_sections.end()) {
+        std::cerr << "Could not find section at address 0x"  << std::hex << addr << " in file " << m_fileName << std::endl;
+    } else {
+        asection *section = (*it).second;
+
+        const char *filename;
+        const char *funcname;
+        unsigned int sourceline;
+
+        if (bfd_find_nearest_line(m_bfd, section, m_symbolTable, addr - section->vma,
+            &filename, &funcname, &sourceline)) {
+            info.line = sourceline;
+            info.source = internString(filename);
+            info.function = internString(funcname);
+            info.valid = filename || sourceline || funcname;
+        }
+    }
+
+    m_lineCacheDirty = true;
+    return m_lineCache.insert(hint, std::make_pair(addr, info));
+}
 
-    if (m_invalidAddresses.find(addr) != m_invalidAddresses.end()) {
+void BFDInterface::getLineInfo(const LineInfo &info, std::string &source, uint64_t &line, std::string &function) const
+{
+    source = info.source != NoString ? m_strings[info.source] : "<unknown source>";
+    line = info.line;
+    function = info.function != NoString ? m_strings[info.function] : "<unknown function>";
+}
+
+bool BFDInterface::getInfo(uint64_t addr, std::string &source, uint64_t &line, std::string &function)
+{
+    if (!initialize()) {
         return false;
     }
 
-    Sections::const_iterator it = m_sections.find(s);
-    if (it == m_sections.end()) {
-        std::cerr << "Could not find section at address 0x"  << std::hex << addr << " in file " << m_fileName << std::endl;
-        //Cache the value for speed  up
-        m_invalidAddresses.insert(addr);
+    LineCache::iterator it = m_lineCache.find(addr);
+    if (it == m_lineCache.end()) {
+        it = resolve(addr, it);
+    }
+
+    const LineInfo &info = (*it).second;
+    if (!info.valid) {
         return false;
     }
 
-    asection *section = (*it).second;
-    //std::cout << "Section " << section->name << " " << std::hex << section->vma << " - size=0x"  << section->size <<
-    //        " for address " << addr << std::endl;
+    getLineInfo(info, source, line, function);
+    return true;
+}
+
+void BFDInterface::getInfoSorted(const std::vector<uint64_t> &addresses, SourceInfoList &result)
+{
+    if (!initialize()) {
+        ExecutableFile::getInfoSorted(addresses, result);
+        return;
+    }
 
-    const char *filename;
-    const char *funcname;
-    unsigned int sourceline;
+    result.reserve(result.size() + addresses.size());
 
-    if (bfd_find_nearest_line(m_bfd, section, m_symbolTable, addr - section->vma,
-        &filename, &funcname, &sourceline)) {
+    LineCache::iterator it = m_lineCache.begin();
+    for (unsigned i = 0; i < addresses.size(); ++i) {
+        uint64_t addr = addresses[i];
+        assert((i == 0 || addresses[i - 1] <= addr) && "Addresses must be sorted");
 
-        source = filename ? filename : "<unknown source>" ;
-        line = sourceline;
-        function = funcname ? funcname:"<unknown function>";
+        while (it != m_lineCache.end() && (*it).first < addr) {
+            ++it;
+        }
 
-        if (!filename && !line && !funcname) {
-            return false;
+        if (it == m_lineCache.end() || (*it).first != addr) {
+            it = resolve(addr, it);
         }
-        return true;
 
+        SourceInfo si;
+        si.address = addr;
+        si.line = 0;
+        si.valid = (*it).second.valid;
+        if (si.valid) {
+            getLineInfo((*it).second, si.source, si.line, si.function);
+        }
+        result.push_back(si);
     }
+}
+
+std::string BFDInterface::getSymbolCachePath() const
+{
+    return m_fileName + ".symcache";
+}
 
-    return false;
+bool BFDInterface::getBinaryStamp(uint64_t &size, uint64_t &mtime) const
+{
+    struct stat st;
+    if (stat(m_fileName.c_str(), &st) < 0) {
+        return false;
+    }
+
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
 
+void BFDInterface::loadSymbolCache()
+{
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (llvm::MemoryBuffer::getFile(getSymbolCachePath(), buffer)) {
+        return;
+    }
+
+    const char *data = buffer->getBufferStart();
+    size_t size = buffer->getBufferSize();
+
+    uint64_t binarySize, binaryMtime;
+    if (!getBinaryStamp(binarySize, binaryMtime)) {
+        return;
+    }
+
+    SymbolCacheHeader hdr;
+    if (size < sizeof(hdr)) {
+        return;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+
+    if (memcmp(hdr.magic, s_symbolCacheMagic, sizeof(hdr.magic)) ||
+        hdr.binarySize != binarySize || hdr.binaryMtime != binaryMtime) {
+        std::cerr << "Ignoring stale symbol cache " << getSymbolCachePath() << std::endl;
+        return;
+    }
+
+    size_t stringsOffset = sizeof(hdr) + (size_t) hdr.entryCount * sizeof(SymbolCacheEntry);
+    if (stringsOffset > size) {
+        return;
+    }
+
+    //Read the string table first so that entries can be validated
+    std::vector<std::string> strings;
+    const char *str = data + stringsOffset;
+    const char *end = data + size;
+    for (unsigned i = 0; i < hdr.stringCount; ++i) {
+        const char *term = (const char*) memchr(str, 0, end - str);
+        if (!term) {
+            return;
+        }
+        strings.push_back(std::string(str, term));
+        str = term + 1;
+    }
+
+    LineCache cache;
+    const char *entries = data + sizeof(hdr);
+    for (unsigned i = 0; i < hdr.entryCount; ++i) {
+        SymbolCacheEntry e;
+        memcpy(&e, entries + i * sizeof(e), sizeof(e));
+
+        if ((e.source != NoString && e.source >= strings.size()) ||
+            (e.function != NoString && e.function >= strings.size())) {
+            return;
+        }
+
+        LineInfo info;
+        info.line = e.line;
+        info.source = e.source;
+        info.function = e.function;
+        info.valid = e.valid;
+
+        //Entries are sorted, so appending at the end is constant time
+        cache.insert(cache.end(), std::make_pair(e.address, info));
+    }
+
+    m_strings.swap(strings);
+    m_stringIndex.clear();
+    for (unsigned i = 0; i < m_strings.size(); ++i) {
+        m_stringIndex[m_strings[i]] = i;
+    }
+    m_lineCache.swap(cache);
+    m_lineCacheDirty = false;
+}
+
+void BFDInterface::saveSymbolCache() const
+{
+    SymbolCacheHeader hdr;
+    memcpy(hdr.magic, s_symbolCacheMagic, sizeof(hdr.magic));
+    if (!getBinaryStamp(hdr.binarySize, hdr.binaryMtime)) {
+        return;
+    }
+    hdr.entryCount = m_lineCache.size();
+    hdr.stringCount = m_strings.size();
+
+    //Write to a temporary file first so that a concurrent run
+    //never sees a partial cache
+    std::string path = getSymbolCachePath();
+    std::string tmpPath = path + ".tmp";
+
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (!fp) {
+        std::cerr << "Could not write symbol cache " << path << std::endl;
+        return;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+    LineCache::const_iterator it;
+    for (it = m_lineCache.begin(); ok && it != m_lineCache.end(); ++it) {
+        SymbolCacheEntry e;
+        e.address = (*it).first;
+        e.line = (*it).second.line;
+        e.source = (*it).second.source;
+        e.function = (*it).second.function;
+        e.valid = (*it).second.valid;
+        e.padding = 0;
+        ok = fwrite(&e, sizeof(e), 1, fp) == 1;
+    }
+
+    for (unsigned i = 0; ok && i < m_strings.size(); ++i) {
+        ok = fwrite(m_strings[i].c_str(), m_strings[i].size() + 1, 1, fp) == 1;
+    }
+
+    if (fclose(fp) || !ok || rename(tmpPath.c_str(), path.c_str())) {
+        std::cerr << "Could not write symbol cache " << path << std::endl;
+        remove(tmpPath.c_str());
+    }
 }
 
 bool BFDInterface::getModuleName(std::string &name ) const
 {
-    if (!m_bfd) {
+    if (!inited()) {
         return false;
     }
 
@@ -263,7 +608,7 @@ bool BFDInterface::getModuleName(std::string &name ) const
 
 uint64_t BFDInterface::getImageBase() const
 {
-    if (!m_bfd) {
+    if (!inited()) {
         return false;
     }
 
@@ -272,6 +617,10 @@ uint64_t BFDInterface::getImageBase() const
 
 uint64_t BFDInterface::getImageSize() const
 {
+    if (m_image.get()) {
+        return m_image->getImageSize();
+    }
+
     if (!m_bfd) {
         return false;
     }
@@ -281,6 +630,10 @@ uint64_t BFDInterface::getImageSize() const
 
 uint64_t BFDInterface::getEntryPoint() const
 {
+    if (m_image.get()) {
+        return m_image->getEntryPoint();
+    }
+
     if (!m_bfd) {
         return 0;
     }
@@ -290,7 +643,7 @@ uint64_t BFDInterface::getEntryPoint() const
 
 asection *BFDInterface::getSection(uint64_t va, unsigned size) const
 {
-    if (!m_bfd) {
+    if (!requireBfd()) {
         return NULL;
     }
 
@@ -347,26 +700,21 @@ bool BFDInterface::write(uint64_t va, void *source, unsigned size)
 
 bool BFDInterface::isCode(uint64_t va) const
 {
-    asection *section = getSection(va, 1);
-    if (!section) {
-        return false;
-    }
-
-    return section->flags & SEC_CODE;
+    return getSectionFlags(va) & SEC_CODE;
 }
 
 bool BFDInterface::isData(uint64_t va) const
 {
-    asection *section = getSection(va, 1);
-    if (!section) {
-        return false;
-    }
-
-    return section->flags & SEC_DATA;
+    return getSectionFlags(va) & SEC_DATA;
 }
 
 int BFDInterface::getSectionFlags(uint64_t va) const
 {
+    if (m_image.get() && !m_bfd) {
+        const ModuleImage::Section *section = m_image->findSection(va);
+        return section ? section->flags : 0;
+    }
+
     asection *section = getSection(va, 1);
     if (!section) {
         return false;
@@ -375,8 +723,26 @@ int BFDInterface::getSectionFlags(uint64_t va) const
     return section->flags;
 }
 
+//The tables of the module cache are copied out on first use
+void BFDInterface::loadImageTables() const
+{
+    if (m_imageTablesLoaded) {
+        return;
+    }
+
+    BFDInterface *self = const_cast<BFDInterface*>(this);
+    m_image->getImports(self->m_imports);
+    m_image->getRelocations(self->m_relocations);
+    m_imageTablesLoaded = true;
+}
+
 const Imports &BFDInterface::getImports() const
 {
+    if (m_image.get() && !m_bfd) {
+        loadImageTables();
+        return m_imports;
+    }
+
     if (!m_binary) {
         return m_imports;
     }
@@ -385,6 +751,11 @@ const Imports &BFDInterface::getImports() const
 
 const RelocationEntries & BFDInterface::getRelocations() const
 {
+    if (m_image.get() && !m_bfd) {
+        loadImageTables();
+        return m_relocations;
+    }
+
     if (!m_binary) {
         return m_relocations;
     }
@@ -44,6 +44,7 @@ extern "C" {
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
 #include <inttypes.h>
 
 #include "ExecutableFile.h"
@@ -54,6 +55,7 @@ namespace s2etools
 {
 
 class Binary;
+class ModuleImage;
 
 //Maps an address to a pair of library and function name
 typedef std::map<uint64_t, std::pair<std::string, std::string> > Imports;
@@ -110,16 +112,34 @@ public:
 
 private:
 
-    typedef std::set<uint64_t> AddressSet;
+    //Result of a line lookup, with the strings interned in m_strings
+    struct LineInfo {
+        uint64_t line;
+        uint32_t source;
+        uint32_t function;
+        bool valid;
+    };
+
+    //Every address looked up so far, including the ones that
+    //could not be resolved
+    typedef std::map<uint64_t, LineInfo> LineCache;
+    typedef std::map<std::string, uint32_t> StringIndex;
+
+    static const uint32_t NoString = (uint32_t) -1;
 
     static bool s_bfdInited;
     bfd *m_bfd;
+    std::string m_format;
     asymbol **m_symbolTable;
     long m_symbolCount;
 
     std::string m_moduleName;
     Sections m_sections;
-    AddressSet m_invalidAddresses;
+
+    LineCache m_lineCache;
+    std::vector<std::string> m_strings;
+    StringIndex m_stringIndex;
+    bool m_lineCacheDirty;
 
     uint64_t m_imageBase;
     bool m_requireSymbols;
@@ -132,11 +152,31 @@ private:
     RelocationEntries m_relocations;
     Imports m_imports;
 
+    //Saved metadata of the binary when -module-cache is set.
+    //BFD is only opened if something the image lacks is needed.
+    llvm::OwningPtr<ModuleImage> m_image;
+    mutable bool m_imageTablesLoaded;
+
     static void initSections(bfd *abfd, asection *sect, void *obj);
 
+    bool openBfd();
+    bool requireBfd() const;
+    void initModuleName();
+    void saveModuleImage(uint64_t contentHash);
+    void loadImageTables() const;
+
     bool initPeImports();
     asection *getSection(uint64_t va, unsigned size) const;
 
+    uint32_t internString(const char *str);
+    LineCache::iterator resolve(uint64_t addr, LineCache::iterator hint);
+    void getLineInfo(const LineInfo &info, std::string &source, uint64_t &line, std::string &function) const;
+
+    std::string getSymbolCachePath() const;
+    bool getBinaryStamp(uint64_t &size, uint64_t &mtime) const;
+    void loadSymbolCache();
+    void saveSymbolCache() const;
+
 public:
     BFDInterface(const std::string &fileName);
     BFDInterface(const std::string &fileName, bool requireSymbols);
@@ -149,8 +189,12 @@ public:
     bool initialize(const std::string &format);
 
     bool getInfo(uint64_t addr, std::string &source, uint64_t &line, std::string &function);
+
+    //Walks the sorted addresses and the lookup cache together,
+    //querying BFD only for the addresses seen for the first time
+    virtual void getInfoSorted(const std::vector<uint64_t> &addresses, SourceInfoList &result);
     bool inited() const {
-        return m_bfd != NULL;
+        return m_bfd != NULL || m_image.get() != NULL;
     }
 
     virtual bool getModuleName(std::string &name ) const;
@@ -174,17 +218,25 @@ public:
     int getSectionFlags(uint64_t va) const;
 
     const Sections &getSections() const {
+        requireBfd();
         return m_sections;
     }
 
     asymbol **getSymbols() const {
+        requireBfd();
         return m_symbolTable;
     }
 
     long getSymbolCount() const {
+        requireBfd();
         return m_symbolCount;
     }
 
+    //Relocations found by BFD, for binaries without a specific reader
+    const RelocationEntries &getBfdRelocations() const {
+        return m_relocations;
+    }
+
     llvm::MemoryBuffer *getFile() const {
         return m_file.get();
     }
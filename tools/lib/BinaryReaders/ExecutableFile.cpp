@@ -50,6 +50,18 @@ ExecutableFile::~ExecutableFile()
 
 }
 
+void ExecutableFile::getInfoSorted(const std::vector<uint64_t> &addresses, SourceInfoList &result)
+{
+    result.reserve(result.size() + addresses.size());
+    for (unsigned i = 0; i < addresses.size(); ++i) {
+        SourceInfo info;
+        info.address = addresses[i];
+        info.line = 0;
+        info.valid = getInfo(addresses[i], info.source, info.line, info.function);
+        result.push_back(info);
+    }
+}
+
 ExecutableFile *ExecutableFile::create(const std::string &fileName)
 {
     //Try to see if we can open the binary using BFD
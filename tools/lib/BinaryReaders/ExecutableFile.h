@@ -38,11 +38,23 @@
 
 
 #include <string>
+#include <vector>
 #include <inttypes.h>
 
 namespace s2etools
 {
 
+struct SourceInfo
+{
+    uint64_t address;
+    bool valid;
+    std::string source;
+    uint64_t line;
+    std::string function;
+};
+
+typedef std::vector<SourceInfo> SourceInfoList;
+
 /**
  *  XXX:We should get rid of BFD eventually because it does not handle all we needs
  *  For now the missing functionality is implemented by subclasses of Binary
@@ -58,6 +70,10 @@ public:
 
     virtual bool initialize() = 0;
     virtual bool getInfo(uint64_t addr, std::string &source, uint64_t &line, std::string &function) = 0;
+
+    //Resolves a sorted list of addresses in one pass, appending
+    //one entry per address to result
+    virtual void getInfoSorted(const std::vector<uint64_t> &addresses, SourceInfoList &result);
     virtual bool inited() const = 0;
 
     static ExecutableFile *create(const std::string &fileName);
@@ -0,0 +1,290 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include "ModuleImage.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/system_error.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace {
+    llvm::cl::opt<std::string>
+            ModuleCacheDir("module-cache",
+                           llvm::cl::desc("Directory where to save the parsed binaries and reuse them in later runs"),
+                           llvm::cl::init(""));
+}
+
+namespace s2etools
+{
+
+static const char s_moduleImageMagic[8] = {'S', '2', 'E', 'M', 'O', 'D', '0', '1'};
+
+namespace {
+struct SectionLT {
+    bool operator()(const ModuleImage::Section &s, uint64_t va) const {
+        return s.start + s.size <= va;
+    }
+};
+
+//Lays out the strings of a new image
+class StringTable {
+    std::map<std::string, uint32_t> m_index;
+    std::string m_data;
+
+public:
+    uint32_t add(const std::string &str) {
+        std::map<std::string, uint32_t>::const_iterator it = m_index.find(str);
+        if (it != m_index.end()) {
+            return (*it).second;
+        }
+
+        uint32_t offset = m_data.size();
+        m_data += str;
+        m_data += '\0';
+        m_index[str] = offset;
+        return offset;
+    }
+
+    const std::string &getData() const {
+        return m_data;
+    }
+};
+}
+
+ModuleImage::ModuleImage()
+{
+    memset(&m_header, 0, sizeof(m_header));
+    m_sections = NULL;
+    m_relocations = NULL;
+    m_imports = NULL;
+    m_strings = NULL;
+}
+
+bool ModuleImage::isEnabled()
+{
+    return !ModuleCacheDir.empty();
+}
+
+//FNV-1a, fast enough to hash the binary on every run
+uint64_t ModuleImage::hashContents(const llvm::MemoryBuffer *file)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char *p = (const unsigned char*) file->getBufferStart();
+    const unsigned char *end = (const unsigned char*) file->getBufferEnd();
+    while (p < end) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+std::string ModuleImage::getPath(uint64_t contentHash)
+{
+    std::stringstream ss;
+    ss << ModuleCacheDir << "/" << std::hex << contentHash << ".modcache";
+    return ss.str();
+}
+
+bool ModuleImage::open(uint64_t contentHash)
+{
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (llvm::MemoryBuffer::getFile(getPath(contentHash), buffer)) {
+        return false;
+    }
+
+    const char *data = buffer->getBufferStart();
+    size_t size = buffer->getBufferSize();
+
+    Header hdr;
+    if (size < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+
+    if (memcmp(hdr.magic, s_moduleImageMagic, sizeof(hdr.magic)) ||
+        hdr.contentHash != contentHash) {
+        return false;
+    }
+
+    size_t sectionsOffset = sizeof(hdr);
+    size_t relocationsOffset = sectionsOffset + (size_t) hdr.sectionCount * sizeof(Section);
+    size_t importsOffset = relocationsOffset + (size_t) hdr.relocationCount * sizeof(Relocation);
+    size_t stringsOffset = importsOffset + (size_t) hdr.importCount * sizeof(Import);
+    if (stringsOffset > size || hdr.stringsSize != size - stringsOffset) {
+        return false;
+    }
+
+    //The buffer is pointer aligned and all the records are multiples of 8 bytes.
+    //Nothing is copied, the mapped pages are read when the tables are used.
+    m_sections = (const Section*) (data + sectionsOffset);
+    m_relocations = (const Relocation*) (data + relocationsOffset);
+    m_imports = (const Import*) (data + importsOffset);
+    m_strings = data + stringsOffset;
+    m_header = hdr;
+    m_buffer.swap(buffer);
+    return true;
+}
+
+bool ModuleImage::write(uint64_t contentHash, const Data &data)
+{
+    StringTable strings;
+
+    Header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, s_moduleImageMagic, sizeof(hdr.magic));
+    hdr.contentHash = contentHash;
+    hdr.imageBase = data.imageBase;
+    hdr.imageSize = data.imageSize;
+    hdr.entryPoint = data.entryPoint;
+    hdr.hasSymbols = data.hasSymbols;
+    hdr.sectionCount = data.sections.size();
+    hdr.relocationCount = data.relocations.size();
+    hdr.importCount = data.imports.size();
+
+    std::vector<Section> sections;
+    for (unsigned i = 0; i < data.sections.size(); ++i) {
+        Section s;
+        s.start = data.sections[i].start;
+        s.size = data.sections[i].size;
+        s.flags = data.sections[i].flags;
+        s.name = strings.add(data.sections[i].name);
+        sections.push_back(s);
+    }
+
+    std::vector<Relocation> relocations;
+    RelocationEntries::const_iterator rit;
+    for (rit = data.relocations.begin(); rit != data.relocations.end(); ++rit) {
+        const RelocationEntry &re = (*rit).second;
+        Relocation r;
+        memset(&r, 0, sizeof(r));
+        r.va = (*rit).first;
+        r.originalValue = re.originalValue;
+        r.targetValue = re.targetValue;
+        r.symbolBase = re.symbolBase;
+        r.size = re.size;
+        r.symbolIndex = re.symbolIndex;
+        r.symbolName = strings.add(re.symbolName);
+        relocations.push_back(r);
+    }
+
+    std::vector<Import> imports;
+    Imports::const_iterator iit;
+    for (iit = data.imports.begin(); iit != data.imports.end(); ++iit) {
+        Import imp;
+        memset(&imp, 0, sizeof(imp));
+        imp.address = (*iit).first;
+        imp.library = strings.add((*iit).second.first);
+        imp.function = strings.add((*iit).second.second);
+        imports.push_back(imp);
+    }
+
+    hdr.stringsSize = strings.getData().size();
+
+    std::string image((const char*) &hdr, sizeof(hdr));
+    if (!sections.empty()) {
+        image.append((const char*) &sections[0], sections.size() * sizeof(Section));
+    }
+    if (!relocations.empty()) {
+        image.append((const char*) &relocations[0], relocations.size() * sizeof(Relocation));
+    }
+    if (!imports.empty()) {
+        image.append((const char*) &imports[0], imports.size() * sizeof(Import));
+    }
+    image += strings.getData();
+
+    //Write to a temporary file first so that a concurrent run
+    //never sees a partial image
+    std::string path = getPath(contentHash);
+    std::string tmpPath = path + ".tmp";
+
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    bool ok = fp && fwrite(image.data(), image.size(), 1, fp) == 1;
+    if (fp && fclose(fp)) {
+        ok = false;
+    }
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str())) {
+        std::cerr << "Could not write module cache " << path << std::endl;
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+const ModuleImage::Section *ModuleImage::findSection(uint64_t va) const
+{
+    const Section *end = m_sections + m_header.sectionCount;
+    const Section *it = std::lower_bound(m_sections, end, va, SectionLT());
+    if (it == end || (*it).start > va) {
+        return NULL;
+    }
+    return it;
+}
+
+void ModuleImage::getRelocations(RelocationEntries &relocations) const
+{
+    for (unsigned i = 0; i < m_header.relocationCount; ++i) {
+        const Relocation &r = m_relocations[i];
+        RelocationEntry re;
+        re.va = r.va;
+        re.size = r.size;
+        re.originalValue = r.originalValue;
+        re.targetValue = r.targetValue;
+        re.symbolName = getString(r.symbolName);
+        re.symbolBase = r.symbolBase;
+        re.symbolIndex = r.symbolIndex;
+        relocations.insert(relocations.end(), std::make_pair(r.va, re));
+    }
+}
+
+void ModuleImage::getImports(Imports &imports) const
+{
+    for (unsigned i = 0; i < m_header.importCount; ++i) {
+        const Import &imp = m_imports[i];
+        imports.insert(imports.end(), std::make_pair(imp.address,
+            std::make_pair(std::string(getString(imp.library)),
+                           std::string(getString(imp.function)))));
+    }
+}
+
+}
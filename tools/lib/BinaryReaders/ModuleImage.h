@@ -0,0 +1,162 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_MODULEIMAGE_H
+#define S2ETOOLS_MODULEIMAGE_H
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#include "BFDInterface.h"
+
+namespace s2etools
+{
+
+/**
+ *  Metadata of a binary parsed by BFD, saved in the directory given
+ *  by -module-cache under the hash of the contents of the binary.
+ *  Binaries with the same contents share the file and a modified binary
+ *  gets a new one. Later runs map the file instead of parsing the binary,
+ *  the pages of the tables are only read when they are used.
+ *
+ *  Layout: the header, the sections sorted by start, the relocations
+ *  and the imports sorted by address, then the strings, each terminated
+ *  by a null byte.
+ */
+class ModuleImage
+{
+public:
+    struct Header {
+        char magic[8];
+        uint64_t contentHash;
+        uint64_t imageBase;
+        uint64_t imageSize;
+        uint64_t entryPoint;
+        uint32_t hasSymbols;
+        uint32_t sectionCount;
+        uint32_t relocationCount;
+        uint32_t importCount;
+        uint64_t stringsSize;
+    };
+
+    struct Section {
+        uint64_t start;
+        uint64_t size;
+        uint32_t flags;
+        uint32_t name;
+    };
+
+    struct Relocation {
+        uint64_t va;
+        uint64_t originalValue;
+        uint64_t targetValue;
+        uint64_t symbolBase;
+        uint32_t size;
+        uint32_t symbolIndex;
+        uint32_t symbolName;
+        uint32_t padding;
+    };
+
+    struct Import {
+        uint64_t address;
+        uint32_t library;
+        uint32_t function;
+    };
+
+    //Contents of a new image, see write()
+    struct Data {
+        uint64_t imageBase;
+        uint64_t imageSize;
+        uint64_t entryPoint;
+        bool hasSymbols;
+
+        struct NamedSection {
+            uint64_t start, size;
+            uint32_t flags;
+            std::string name;
+        };
+
+        std::vector<NamedSection> sections;
+        RelocationEntries relocations;
+        Imports imports;
+    };
+
+private:
+    llvm::OwningPtr<llvm::MemoryBuffer> m_buffer;
+    Header m_header;
+
+    const Section *m_sections;
+    const Relocation *m_relocations;
+    const Import *m_imports;
+    const char *m_strings;
+
+    static std::string getPath(uint64_t contentHash);
+
+public:
+    ModuleImage();
+
+    /** Returns true if -module-cache is set */
+    static bool isEnabled();
+
+    static uint64_t hashContents(const llvm::MemoryBuffer *file);
+
+    /** Maps the saved image of the binary with the given hash */
+    bool open(uint64_t contentHash);
+
+    static bool write(uint64_t contentHash, const Data &data);
+
+    uint64_t getImageBase() const { return m_header.imageBase; }
+    uint64_t getImageSize() const { return m_header.imageSize; }
+    uint64_t getEntryPoint() const { return m_header.entryPoint; }
+    bool hasSymbols() const { return m_header.hasSymbols; }
+
+    const char *getString(uint32_t index) const {
+        return index < m_header.stringsSize ? m_strings + index : "";
+    }
+
+    /** Returns the section that contains va, or NULL */
+    const Section *findSection(uint64_t va) const;
+
+    void getRelocations(RelocationEntries &relocations) const;
+    void getImports(Imports &imports) const;
+};
+
+}
+
+#endif
@@ -178,7 +178,7 @@ public:
     }
 
     virtual const RelocationEntries &getRelocations() const {
-        assert(false && "Not implemented");
+        return getBfd()->getBfdRelocations();
     }
 
 };
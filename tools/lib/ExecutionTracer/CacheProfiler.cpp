@@ -98,6 +98,10 @@ void CacheProfiler::onItem(unsigned traceIndex,
         }
         break;
 
+        //Raw accesses are handled by CacheReplay
+        case s2e::plugins::CACHE_ACCESSES:
+        break;
+
         default: {
             assert(false && "Unknown cache trace entry");
         }
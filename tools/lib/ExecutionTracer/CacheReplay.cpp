@@ -0,0 +1,290 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include <sstream>
+#include <cassert>
+#include <stdlib.h>
+#include "CacheReplay.h"
+
+using namespace s2e::plugins;
+
+namespace s2etools {
+
+static bool isPowerOfTwo(uint64_t n)
+{
+    return n && !(n & (n - 1));
+}
+
+static unsigned log2u64(uint64_t n)
+{
+    unsigned pos = 0;
+    while (n >>= 1) {
+        ++pos;
+    }
+    return pos;
+}
+
+//Accepts an optional K or M suffix
+static bool parseSize(const std::string &str, uint64_t &size)
+{
+    char *end;
+    size = strtoull(str.c_str(), &end, 0);
+    if (end == str.c_str()) {
+        return false;
+    }
+
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+        ++end;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+        ++end;
+    }
+    return *end == 0;
+}
+
+static void split(const std::string &str, char sep, std::vector<std::string> &result)
+{
+    std::string item;
+    std::istringstream ss(str);
+    while (std::getline(ss, item, sep)) {
+        result.push_back(item);
+    }
+}
+
+bool CacheHierarchyConfig::parse(const std::string &str, CacheHierarchyConfig &config,
+                                 std::string &error)
+{
+    std::string levels = str;
+    size_t eq = str.find('=');
+    if (eq != std::string::npos) {
+        config.name = str.substr(0, eq);
+        levels = str.substr(eq + 1);
+    } else {
+        config.name = str;
+    }
+
+    std::vector<std::string> levelStrs;
+    split(levels, ',', levelStrs);
+    if (levelStrs.empty()) {
+        error = "no cache level specified";
+        return false;
+    }
+
+    config.levels.clear();
+    for (unsigned i = 0; i < levelStrs.size(); ++i) {
+        std::vector<std::string> params;
+        split(levelStrs[i], ':', params);
+
+        CacheLevelConfig level;
+        if (params.size() != 4 ||
+            !parseSize(params[1], level.size) ||
+            !parseSize(params[2], level.associativity) ||
+            !parseSize(params[3], level.lineSize)) {
+            error = "expected name:size:associativity:lineSize instead of " + levelStrs[i];
+            return false;
+        }
+        level.name = params[0];
+
+        if (!isPowerOfTwo(level.associativity) || !isPowerOfTwo(level.lineSize) ||
+            level.size < level.lineSize * level.associativity ||
+            !isPowerOfTwo(level.size / level.lineSize / level.associativity)) {
+            error = "the number of sets, the associativity and the line size of " +
+                    level.name + " must be powers of two";
+            return false;
+        }
+
+        config.levels.push_back(level);
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////
+SimulatedCache::SimulatedCache(const CacheLevelConfig &config)
+{
+    uint64_t setsCount = (config.size / config.lineSize) / config.associativity;
+    assert(isPowerOfTwo(setsCount));
+
+    m_associativity = config.associativity;
+    m_lineSize = config.lineSize;
+    m_indexShift = log2u64(config.lineSize);
+    m_indexMask = setsCount - 1;
+    m_tagShift = log2u64(setsCount) + m_indexShift;
+    m_lines.resize(setsCount * config.associativity, (uint64_t) -1);
+}
+
+bool SimulatedCache::access(uint64_t address)
+{
+    uint64_t l = ((address >> m_indexShift) & m_indexMask) * m_associativity;
+    uint64_t tag = address >> m_tagShift;
+
+    unsigned i;
+    for (i = 0; i < m_associativity; ++i) {
+        if (m_lines[l + i] == tag) {
+            break;
+        }
+    }
+
+    bool hit = i < m_associativity;
+    if (!hit) {
+        //Evict the LRU line
+        i = m_associativity - 1;
+    }
+
+    //Move the line to MRU
+    for (unsigned j = i; j > 0; --j) {
+        m_lines[l + j] = m_lines[l + j - 1];
+    }
+    m_lines[l] = tag;
+
+    return hit;
+}
+
+///////////////////////////////////////////////////////////
+CacheReplay::CacheReplay(LogEvents *events, const CacheHierarchyConfig &config,
+                         bool includeCode)
+{
+    m_events = events;
+    m_config = config;
+    m_includeCode = includeCode;
+    m_connection = events->onEachItem.connect(
+            sigc::mem_fun(*this, &CacheReplay::onItem));
+}
+
+CacheReplay::~CacheReplay()
+{
+    m_connection.disconnect();
+}
+
+void CacheReplay::onItem(unsigned traceIndex,
+                         const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                         void *item)
+{
+    if (hdr.type != s2e::plugins::TRACE_CACHESIM) {
+        return;
+    }
+
+    ExecutionTraceCache *cacheItem = (ExecutionTraceCache*)item;
+    if (cacheItem->type != s2e::plugins::CACHE_ACCESSES) {
+        return;
+    }
+
+    CacheReplayState *state = static_cast<CacheReplayState*>(
+            m_events->getState(this, &CacheReplayState::factory));
+    if (state->m_caches.empty()) {
+        state->initialize(m_config);
+    }
+
+    state->processAccesses(cacheItem->accesses, m_includeCode);
+}
+
+///////////////////////////////////////////////////////////
+ItemProcessorState *CacheReplayState::factory()
+{
+    return new CacheReplayState();
+}
+
+CacheReplayState::CacheReplayState()
+{
+
+}
+
+CacheReplayState::~CacheReplayState()
+{
+
+}
+
+ItemProcessorState *CacheReplayState::clone() const
+{
+    return new CacheReplayState(*this);
+}
+
+void CacheReplayState::initialize(const CacheHierarchyConfig &config)
+{
+    m_caches.clear();
+    for (unsigned i = 0; i < config.levels.size(); ++i) {
+        m_caches.push_back(SimulatedCache(config.levels[i]));
+    }
+    m_stats.clear();
+    m_stats.resize(config.levels.size());
+}
+
+//Like CacheSim, lines are allocated on writes and misses are passed on
+//to the next level, one line at a time.
+void CacheReplayState::access(unsigned level, uint64_t address, unsigned size, bool isWrite)
+{
+    SimulatedCache &cache = m_caches[level];
+    CacheLevelStatistics &stats = m_stats[level];
+
+    uint64_t lineSize = cache.getLineSize();
+    uint64_t end = address + size;
+
+    for (uint64_t line = address & ~(lineSize - 1); line < end; line += lineSize) {
+        bool hit = cache.access(line);
+
+        if (isWrite) {
+            ++stats.writeCount;
+            stats.writeMissCount += !hit;
+        } else {
+            ++stats.readCount;
+            stats.readMissCount += !hit;
+        }
+
+        if (!hit && level + 1 < m_caches.size()) {
+            uint64_t b = line < address ? address : line;
+            uint64_t e = line + lineSize > end ? end : line + lineSize;
+            access(level + 1, b, e - b, isWrite);
+        }
+    }
+}
+
+void CacheReplayState::processAccesses(const s2e::plugins::ExecutionTraceCacheSimAccesses &a,
+                                       bool includeCode)
+{
+    for (unsigned i = 0; i < a.count; ++i) {
+        const ExecutionTraceCacheSimAccess &e = a.accesses[i];
+        if (!includeCode && (e.flags & CACHESIM_ACCESS_CODE)) {
+            continue;
+        }
+        if (!e.size) {
+            continue;
+        }
+        access(0, e.address, e.size, e.flags & CACHESIM_ACCESS_WRITE);
+    }
+}
+
+}
@@ -0,0 +1,167 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2ETOOLS_CACHEREPLAY_H
+#define S2ETOOLS_CACHEREPLAY_H
+
+#include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
+#include "LogParser.h"
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace s2etools {
+
+/**
+ *  Parameters of one level of a simulated cache hierarchy
+ */
+struct CacheLevelConfig
+{
+    std::string name;
+    uint64_t size;
+    uint64_t associativity;
+    uint64_t lineSize;
+};
+
+/**
+ *  A hierarchy of caches, from the level closest to the CPU to
+ *  the last level cache.
+ */
+struct CacheHierarchyConfig
+{
+    std::string name;
+    std::vector<CacheLevelConfig> levels;
+
+    /**
+     *  Parses name=l1:32768:8:64,l2:262144:8:64,... where each level is
+     *  name:size:associativity:lineSize. Sizes, associativities and
+     *  line sizes must be powers of two.
+     */
+    static bool parse(const std::string &str, CacheHierarchyConfig &config,
+                      std::string &error);
+};
+
+struct CacheLevelStatistics
+{
+    uint64_t readCount, writeCount;
+    uint64_t readMissCount, writeMissCount;
+
+    CacheLevelStatistics() {
+        readCount = writeCount = readMissCount = writeMissCount = 0;
+    }
+};
+
+/* Model of n-way associative write-through LRU cache, as in CacheSim */
+class SimulatedCache
+{
+private:
+    uint64_t m_associativity;
+    uint64_t m_lineSize;
+    uint64_t m_indexShift;
+    uint64_t m_indexMask;
+    uint64_t m_tagShift;
+    std::vector<uint64_t> m_lines;
+
+public:
+    SimulatedCache(const CacheLevelConfig &config);
+
+    uint64_t getLineSize() const {
+        return m_lineSize;
+    }
+
+    /** Accesses a single line, returns true on a hit */
+    bool access(uint64_t address);
+};
+
+class CacheReplay;
+
+class CacheReplayState : public ItemProcessorState
+{
+private:
+    std::vector<SimulatedCache> m_caches;
+    std::vector<CacheLevelStatistics> m_stats;
+
+    void access(unsigned level, uint64_t address, unsigned size, bool isWrite);
+
+public:
+    CacheReplayState();
+    virtual ~CacheReplayState();
+    static ItemProcessorState *factory();
+    virtual ItemProcessorState *clone() const;
+
+    /** Creates empty caches, the factory has no access to the configuration */
+    void initialize(const CacheHierarchyConfig &config);
+
+    const std::vector<CacheLevelStatistics> &getStatistics() const {
+        return m_stats;
+    }
+
+    void processAccesses(const s2e::plugins::ExecutionTraceCacheSimAccesses &a,
+                         bool includeCode);
+
+    friend class CacheReplay;
+};
+
+/**
+ *  Simulates a cache hierarchy over the accesses recorded by
+ *  CacheSim in recordAccesses mode. Each path gets its own copy of
+ *  the caches, forked along with the state.
+ */
+class CacheReplay
+{
+private:
+    sigc::connection m_connection;
+    LogEvents *m_events;
+    CacheHierarchyConfig m_config;
+    bool m_includeCode;
+
+    void onItem(unsigned traceIndex,
+                const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                void *item);
+public:
+    CacheReplay(LogEvents *events, const CacheHierarchyConfig &config,
+                bool includeCode);
+    ~CacheReplay();
+
+    const CacheHierarchyConfig &getConfig() const {
+        return m_config;
+    }
+};
+
+}
+
+#endif
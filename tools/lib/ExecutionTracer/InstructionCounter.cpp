@@ -36,6 +36,7 @@
 #include <iomanip>
 #include <iostream>
 #include <cassert>
+#include <string.h>
 #include "InstructionCounter.h"
 
 using namespace s2e::plugins;
@@ -74,6 +75,55 @@ void InstructionCounter::onItem(unsigned traceIndex,
     state->m_icount = e->count;
 }
 
+ModuleInstructionCounter::ModuleInstructionCounter(LogEvents *events)
+{
+   m_connection = events->onEachItem.connect(
+           sigc::mem_fun(*this, &ModuleInstructionCounter::onItem));
+}
+
+ModuleInstructionCounter::~ModuleInstructionCounter()
+{
+    m_connection.disconnect();
+}
+
+void ModuleInstructionCounter::onItem(unsigned traceIndex,
+        const s2e::plugins::ExecutionTraceItemHeader &hdr,
+        void *item)
+{
+    if (hdr.type == s2e::plugins::TRACE_FORK) {
+        ExecutionTraceFork *f = static_cast<ExecutionTraceFork*>(item);
+        for (unsigned i = 0; i < f->stateCount; ++i) {
+            if (f->children[i] != hdr.stateId) {
+                m_forkedStates.insert(f->children[i]);
+            }
+        }
+        return;
+    }
+
+    if (hdr.type != s2e::plugins::TRACE_ICOUNT_SHARDS) {
+        return;
+    }
+
+    ExecutionTraceICountShards *e = static_cast<ExecutionTraceICountShards*>(item);
+    ModuleCounts &last = m_stateCounts[hdr.stateId];
+
+    //The first report of a forked state repeats what its parent
+    //already accounted for.
+    bool inherited = m_forkedStates.erase(hdr.stateId) > 0;
+
+    for (unsigned i = 0; i < e->count; ++i) {
+        const ExecutionTraceICountShard &shard = e->shards[i];
+        std::string module(shard.module, strnlen(shard.module, sizeof(shard.module)));
+
+        uint64_t &prev = last[module];
+        assert(shard.count >= prev);
+        if (!inherited) {
+            m_counts[module] += shard.count - prev;
+        }
+        prev = shard.count;
+    }
+}
+
 void InstructionCounterState::printCounter(std::ostream &os)
 {
     os << "Instruction count: " << std::dec << m_icount << std::endl;
@@ -39,6 +39,10 @@
 #include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
 #include "LogParser.h"
 
+#include <map>
+#include <set>
+#include <string>
+
 namespace s2etools {
 
 class InstructionCounter
@@ -82,6 +86,39 @@ public:
     friend class InstructionCounter;
 };
 
+/**
+ *  Sums the per-module instruction counts of all the states in a single
+ *  pass over the trace. Connect it to the LogParser directly, it
+ *  does not need the execution tree.
+ */
+class ModuleInstructionCounter
+{
+public:
+    typedef std::map<std::string, uint64_t> ModuleCounts;
+
+private:
+    sigc::connection m_connection;
+
+    //Last counts reported by each state
+    std::map<uint32_t, ModuleCounts> m_stateCounts;
+
+    //Forked states whose first report holds the inherited counts
+    std::set<uint32_t> m_forkedStates;
+
+    ModuleCounts m_counts;
+
+    void onItem(unsigned traceIndex,
+                const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                void *item);
+public:
+    ModuleInstructionCounter(LogEvents *events);
+    ~ModuleInstructionCounter();
+
+    const ModuleCounts &getCounts() const {
+        return m_counts;
+    }
+};
+
 
 }
 #endif
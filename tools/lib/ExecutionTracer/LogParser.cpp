@@ -33,8 +33,12 @@
  * All contributors are listed in the S2E-AUTHORS file.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
 #include "LogParser.h"
 
 #ifdef _WIN32
@@ -45,6 +49,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 
 
@@ -68,12 +73,36 @@ void LogEvents::processItem(unsigned currentItem,
             " type=" << (int) hdr.type << std::endl;
 #endif
 
+    if (hdr.type == TRACE_TSC_CALIBRATION) {
+        memcpy(&m_tscCalibration, data, sizeof(m_tscCalibration));
+        m_hasTscCalibration = true;
+    }
+
+    if (m_hasTscCalibration) {
+        ExecutionTraceItemHeader converted = hdr;
+        converted.timeStamp = toMicroseconds(hdr.timeStamp);
+        onEachItem.emit(currentItem, converted, (void*)data);
+        return;
+    }
+
     onEachItem.emit(currentItem, hdr, (void*)data);
 }
 
-LogEvents::LogEvents()
+uint64_t LogEvents::toMicroseconds(uint64_t timeStamp) const
 {
+    if (!m_hasTscCalibration || !m_tscCalibration.ticksPerSecond) {
+        return timeStamp;
+    }
 
+    //Items may precede the record they are converted with
+    int64_t ticks = timeStamp - m_tscCalibration.tsc;
+    int64_t usec = (double) ticks * 1000000 / m_tscCalibration.ticksPerSecond;
+    return m_tscCalibration.usec + usec;
+}
+
+LogEvents::LogEvents()
+{
+    m_hasTscCalibration = false;
 }
 
 LogEvents::~LogEvents()
@@ -89,6 +118,14 @@ LogParser::LogParser():LogEvents()
 {
     m_cachedProcessor = NULL;
     m_cachedState = NULL;
+    m_typeFilter = ~0ULL;
+
+#ifdef _WIN32
+    m_inflateThreads = 1;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    m_inflateThreads = cpus > 0 ? cpus : 1;
+#endif
 }
 
 LogParser::~LogParser()
@@ -97,6 +134,10 @@ LogParser::~LogParser()
     LogFiles::iterator it;
     for(it=m_files.begin(); it != m_files.end(); ++it) {
         LogFile &file = *it;
+        if (file.m_allocated) {
+            free(file.m_File);
+            continue;
+        }
         #ifdef _WIN32
         UnmapViewOfFile(file.m_File);
         CloseHandle(file.m_hMapping);
@@ -122,10 +163,8 @@ bool LogParser::parse(const std::vector<std::string> fileNames)
 }
 
 
-bool LogParser::parse(const std::string &fileName)
+bool LogParser::mapFile(const std::string &fileName, LogFile &element)
 {
-    LogFile element;
-
 #ifdef _WIN32
     element.m_hFile = CreateFile(fileName.c_str(), GENERIC_READ,
                               FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
@@ -169,7 +208,7 @@ bool LogParser::parse(const std::string &fileName)
     }
 
     element.m_File = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
-    if (!element.m_File) {
+    if (element.m_File == MAP_FAILED) {
         std::cerr << "Could not map the log file in memory" << std::endl;
         close(file);
         return false;
@@ -179,18 +218,342 @@ bool LogParser::parse(const std::string &fileName)
 
 #endif
 
+    return true;
+}
+
+bool LogParser::parse(const std::string &fileName)
+{
+    LogFile element;
+
+    if (!mapFile(fileName, element)) {
+        return false;
+    }
+
+    m_files.push_back(element);
+
+    if (element.m_size >= sizeof(s2e::plugins::ExecutionTraceChunkedHeader) &&
+        !memcmp(element.m_File, EXECTRACE_CHUNKED_MAGIC, 8)) {
+        return parseChunked(element);
+    }
+
+    if (element.m_size >= sizeof(s2e::plugins::ExecutionTraceCompactHeader) &&
+        !memcmp(element.m_File, EXECTRACE_COMPACT_MAGIC, 8)) {
+        return parseCompact(element);
+    }
+
+    //Use the index only if there is something to skip
+    uint64_t parsedUpTo = 0;
+    bool ret = true;
+    if (m_typeFilter != ~0ULL || !m_stateFilter.empty()) {
+        ret = parseIndexed(element, fileName + ".idx", &parsedUpTo);
+    }
 
-    uint64_t currentOffset = 0;
+    if (ret) {
+        ret = parseItems(element, parsedUpTo, element.m_size);
+    }
+
+    //fclose(file);
+    return ret;
+}
+
+/**
+ *  Processes the given byte ranges of the traces, in order.
+ *  The ranges must start and end on item boundaries
+ *  (see PathIndex).
+ */
+bool LogParser::parseRanges(const std::vector<std::string> &fileNames,
+                            const TraceRanges &ranges)
+{
+    std::vector<LogFile> files(fileNames.size());
+    for (unsigned i = 0; i < fileNames.size(); ++i) {
+        if (!mapFile(fileNames[i], files[i])) {
+            return false;
+        }
+        m_files.push_back(files[i]);
+    }
+
+    TraceRanges::const_iterator it;
+    for (it = ranges.begin(); it != ranges.end(); ++it) {
+        const TraceRange &r = *it;
+        if (r.file >= files.size() || r.offset + r.size > files[r.file].m_size) {
+            std::cerr << "LogParser: Range out of the trace" << std::endl;
+            return false;
+        }
+
+        if (!parseItems(files[r.file], r.offset, r.offset + r.size)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ *  Finds the trace file (in the order of the parse() calls) and the offset
+ *  of the given item. Fails for items of compressed or compact traces.
+ */
+bool LogParser::getItemLocation(unsigned index, unsigned &fileIndex, uint64_t &offset) const
+{
+    if (index >= m_ItemAddresses.size()) {
+        return false;
+    }
+
+    uint8_t *address = m_ItemAddresses[index];
+
+    unsigned traceFile = 0;
+    LogFiles::const_iterator it;
+    for (it = m_files.begin(); it != m_files.end(); ++it) {
+        const LogFile &file = *it;
+        uint8_t *start = (uint8_t*) file.m_File;
+
+        if (address >= start && address < start + file.m_size) {
+            if (file.m_allocated) {
+                return false;
+            }
+            fileIndex = traceFile;
+            offset = address - start;
+            return true;
+        }
+
+        if (!file.m_allocated) {
+            ++traceFile;
+        }
+    }
+
+    return false;
+}
+
+bool LogParser::chunkMatches(const s2e::plugins::ExecutionTraceChunkHeader &chunk) const
+{
+    //Calibration records are needed to convert the time stamps
+    if (chunk.typeMask & (1ULL << TRACE_TSC_CALIBRATION)) {
+        return true;
+    }
+
+    if (!(chunk.typeMask & m_typeFilter)) {
+        return false;
+    }
+
+    if (m_stateFilter.empty()) {
+        return true;
+    }
+
+    //Is any of the filtered states in the range of the chunk?
+    PathSet::const_iterator it = m_stateFilter.lower_bound(chunk.minStateId);
+    return it != m_stateFilter.end() && *it <= chunk.maxStateId;
+}
+
+namespace {
+
+struct InflateJob {
+    const uint8_t *compressed;
+    s2e::plugins::ExecutionTraceChunkHeader header;
+    uint8_t *data;
+    bool ok;
+};
+
+struct InflateQueue {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+    std::vector<InflateJob> *jobs;
+    unsigned next;
+};
+
+void inflateChunk(InflateJob &job)
+{
+    job.data = (uint8_t*) malloc(job.header.size);
+    uLongf size = job.header.size;
+    job.ok = job.data &&
+             uncompress(job.data, &size, job.compressed, job.header.compressedSize) == Z_OK &&
+             size == job.header.size;
+}
+
+#ifndef _WIN32
+void *inflateWorker(void *opaque)
+{
+    InflateQueue *queue = (InflateQueue*) opaque;
+
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        unsigned index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (index >= queue->jobs->size()) {
+            break;
+        }
+        inflateChunk((*queue->jobs)[index]);
+    }
+    return NULL;
+}
+#endif
+
+}
+
+/**
+ *  Walks the chunk headers of a compressed trace, inflates the chunks
+ *  that may contain items passing the filters in parallel, and then
+ *  processes their items in trace order.
+ */
+bool LogParser::parseChunked(const LogFile &file)
+{
+    const uint8_t *base = (const uint8_t*) file.m_File;
+    uint64_t offset = sizeof(s2e::plugins::ExecutionTraceChunkedHeader);
+    bool complete = true;
+
+    std::vector<InflateJob> jobs;
+    while (offset < file.m_size) {
+        s2e::plugins::ExecutionTraceChunkHeader header;
+        if (offset + sizeof(header) > file.m_size) {
+            std::cerr << "LogParser: Could not read chunk header " << std::endl;
+            complete = false;
+            break;
+        }
+
+        memcpy(&header, base + offset, sizeof(header));
+        offset += sizeof(header);
+
+        if (offset + header.compressedSize > file.m_size) {
+            std::cerr << "LogParser: Could not read chunk " << std::endl;
+            complete = false;
+            break;
+        }
+
+        if (chunkMatches(header)) {
+            InflateJob job;
+            job.compressed = base + offset;
+            job.header = header;
+            job.data = NULL;
+            job.ok = false;
+            jobs.push_back(job);
+        }
+
+        offset += header.compressedSize;
+    }
+
+    unsigned threadCount = std::min<unsigned>(m_inflateThreads, jobs.size());
+
+#ifndef _WIN32
+    if (threadCount > 1) {
+        InflateQueue queue;
+        pthread_mutex_init(&queue.lock, NULL);
+        queue.jobs = &jobs;
+        queue.next = 0;
+
+        std::vector<pthread_t> threads(threadCount);
+        for (unsigned i = 0; i < threadCount; ++i) {
+            if (pthread_create(&threads[i], NULL, inflateWorker, &queue)) {
+                std::cerr << "LogParser: Could not create inflate thread" << std::endl;
+                exit(-1);
+            }
+        }
+
+        for (unsigned i = 0; i < threadCount; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+
+        pthread_mutex_destroy(&queue.lock);
+    } else
+#endif
+    {
+        for (unsigned i = 0; i < jobs.size(); ++i) {
+            inflateChunk(jobs[i]);
+        }
+    }
+
+    for (unsigned i = 0; i < jobs.size(); ++i) {
+        if (!jobs[i].ok) {
+            //The items that follow may depend on the lost ones
+            std::cerr << "LogParser: Could not inflate chunk " << std::endl;
+            for (unsigned j = i; j < jobs.size(); ++j) {
+                free(jobs[j].data);
+            }
+            complete = false;
+            break;
+        }
+
+        LogFile chunk;
+        chunk.m_File = jobs[i].data;
+        chunk.m_size = jobs[i].header.size;
+        chunk.m_allocated = true;
+        m_files.push_back(chunk);
+
+        if (!parseItems(chunk, 0, chunk.m_size)) {
+            complete = false;
+        }
+    }
+
+    return complete;
+}
+
+/**
+ *  Decodes a compact trace into a buffer of items in the usual format,
+ *  which is then parsed like a regular trace.
+ */
+bool LogParser::parseCompact(const LogFile &file)
+{
+    const uint8_t *base = (const uint8_t*) file.m_File;
+    uint64_t offset = sizeof(s2e::plugins::ExecutionTraceCompactHeader);
+    bool complete = true;
+
+    s2e::plugins::ExecutionTraceCompactCodec codec;
+    std::vector<uint8_t> items;
+
+    while (offset < file.m_size) {
+        unsigned size = codec.decode(base + offset, file.m_size - offset, items);
+        if (!size) {
+            std::cerr << "LogParser: Could not decode item " << std::endl;
+            complete = false;
+            break;
+        }
+        offset += size;
+    }
+
+    if (items.empty()) {
+        return complete;
+    }
+
+    LogFile decoded;
+    decoded.m_File = malloc(items.size());
+    if (!decoded.m_File) {
+        std::cerr << "LogParser: Could not allocate the decoded trace " << std::endl;
+        return false;
+    }
+    memcpy(decoded.m_File, &items[0], items.size());
+    decoded.m_size = items.size();
+    decoded.m_allocated = true;
+    m_files.push_back(decoded);
+
+    return parseItems(decoded, 0, decoded.m_size) && complete;
+}
+
+bool LogParser::isFiltered(const s2e::plugins::ExecutionTraceItemHeader &hdr) const
+{
+    if (hdr.type == TRACE_TSC_CALIBRATION) {
+        return false;
+    }
+
+    if (!(m_typeFilter & (1ULL << hdr.type))) {
+        return true;
+    }
+
+    return !m_stateFilter.empty() && !m_stateFilter.count(hdr.stateId);
+}
+
+/** Processes the items located between the given file offsets */
+bool LogParser::parseItems(const LogFile &file, uint64_t begin, uint64_t end)
+{
+    uint64_t currentOffset = begin;
     unsigned currentItem = m_ItemAddresses.size();
 
-    uint8_t *buffer = (uint8_t*)element.m_File;
+    uint8_t *buffer = (uint8_t*)file.m_File + begin;
 
-    while(currentOffset < element.m_size) {
+    while(currentOffset < end) {
 
         s2e::plugins::ExecutionTraceItemHeader *hdr =
                 (s2e::plugins::ExecutionTraceItemHeader *)(buffer);
 
-        if (currentOffset + sizeof(s2e::plugins::ExecutionTraceItemHeader) > element.m_size) {
+        if (currentOffset + sizeof(s2e::plugins::ExecutionTraceItemHeader) > file.m_size) {
             std::cerr << "LogParser: Could not read header " << std::endl;
             return false;
         }
@@ -198,29 +561,66 @@ bool LogParser::parse(const std::string &fileName)
         buffer += sizeof(*hdr);
 
         if (hdr->size > 0) {
-            if (currentOffset + hdr->size > element.m_size) {
+            if (currentOffset + sizeof(*hdr) + hdr->size > file.m_size) {
                 std::cerr << "LogParser: Could not read payload " << std::endl;
                 return false;
             }
         }
 
 #ifdef DEBUG_PB
-        std::cout << fileName <<  " item=" << currentItem << " buffer="   << (void*)buffer <<
+        std::cout << " item=" << currentItem << " buffer="   << (void*)buffer <<
                      " ts=" << hdr->timeStamp <<  " offset=" << currentOffset << std::endl;
 #endif
-        processItem(currentItem, *hdr, buffer);
+        if (!isFiltered(*hdr)) {
+            processItem(currentItem, *hdr, buffer);
+            m_ItemAddresses.push_back(currentOffset + (uint8_t*)file.m_File);
+            ++currentItem;
+        }
+
         buffer+=hdr->size;
+        currentOffset += sizeof(s2e::plugins::ExecutionTraceItemHeader)  + hdr->size;
+    }
 
-        m_ItemAddresses.push_back(currentOffset + (uint8_t*)element.m_File);
+    return true;
+}
 
-        currentOffset += sizeof(s2e::plugins::ExecutionTraceItemHeader)  + hdr->size;
+/**
+ *  Processes the runs listed in the index that may contain items
+ *  passing the filters. Stops at the first entry that does not
+ *  match the trace file, parsedUpTo is the offset where the linear
+ *  scan has to resume. Returns false if the trace is corrupted.
+ */
+bool LogParser::parseIndexed(const LogFile &file, const std::string &indexName,
+                             uint64_t *parsedUpTo)
+{
+    FILE *fp = fopen(indexName.c_str(), "rb");
+    if (!fp) {
+        return true;
+    }
 
-        ++currentItem;
+    bool ret = true;
+    s2e::plugins::ExecutionTraceIndexEntry entry;
+    while (fread(&entry, sizeof(entry), 1, fp) == 1) {
+        if (entry.offset != *parsedUpTo || entry.offset + entry.size > file.m_size) {
+            break;
+        }
+
+        bool skip = !(entry.typeMask & m_typeFilter) ||
+                    (!m_stateFilter.empty() && !m_stateFilter.count(entry.stateId));
+        if (entry.typeMask & (1ULL << TRACE_TSC_CALIBRATION)) {
+            skip = false;
+        }
+
+        if (!skip && !parseItems(file, entry.offset, entry.offset + entry.size)) {
+            ret = false;
+            break;
+        }
+
+        *parsedUpTo = entry.offset + entry.size;
     }
 
-    m_files.push_back(element);
-    //fclose(file);
-    return true;
+    fclose(fp);
+    return ret;
 }
 
 bool LogParser::getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &hdr, void **data)
@@ -232,6 +632,7 @@ bool LogParser::getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &
 
     uint8_t *buffer = m_ItemAddresses[index];
     hdr = *(s2e::plugins::ExecutionTraceItemHeader*)buffer;
+    hdr.timeStamp = toMicroseconds(hdr.timeStamp);
 
     *data = NULL;
     if (hdr.size > 0) {
@@ -39,6 +39,7 @@
 #include <string>
 #include <lib/Utils/Signals/Signals.h>
 #include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
+#include <s2e/Plugins/ExecutionTracers/TraceCompactCodec.h>
 #include <stdio.h>
 #include <vector>
 #include <map>
@@ -82,7 +83,18 @@ public:
     virtual ItemProcessorState* getState(void *processor, uint32_t pathId) = 0;
     virtual void getPaths(PathSet &s) = 0;
 
+    /**
+     * Converts a time stamp to microseconds since the epoch.
+     * Traces written with the tscTimeStamps option hold counter values,
+     * they are converted with the last calibration record read so far.
+     * Processors see converted time stamps in onEachItem.
+     */
+    uint64_t toMicroseconds(uint64_t timeStamp) const;
+
 protected:
+    bool m_hasTscCalibration;
+    s2e::plugins::ExecutionTraceTscCalibration m_tscCalibration;
+
     virtual void processItem(unsigned itemEntry,
                              const s2e::plugins::ExecutionTraceItemHeader &hdr,
                              void *data);
@@ -94,6 +106,15 @@ protected:
 
 
 
+/** Byte range of a trace file, made of complete items */
+struct TraceRange {
+    uint32_t file;
+    uint64_t offset;
+    uint64_t size;
+}__attribute__((packed));
+
+typedef std::vector<TraceRange> TraceRanges;
+
 class LogParser: public LogEvents
 {
 private:
@@ -106,6 +127,9 @@ private:
         void *m_File;
         uint64_t m_size;
 
+        //Inflated chunk of a compressed trace, freed rather than unmapped
+        bool m_allocated;
+
         LogFile() {
             #ifdef _WIN32
             m_hFile = NULL;
@@ -113,6 +137,7 @@ private:
             #endif
             m_File = NULL;
             m_size = 0;
+            m_allocated = false;
         }
     };
 
@@ -125,6 +150,20 @@ private:
     void *m_cachedProcessor;
     ItemProcessorState* m_cachedState;
 
+    uint64_t m_typeFilter;
+    PathSet m_stateFilter;
+
+    unsigned m_inflateThreads;
+
+    bool mapFile(const std::string &fileName, LogFile &element);
+    bool isFiltered(const s2e::plugins::ExecutionTraceItemHeader &hdr) const;
+    bool parseItems(const LogFile &file, uint64_t begin, uint64_t end);
+    bool parseIndexed(const LogFile &file, const std::string &indexName,
+                      uint64_t *parsedUpTo);
+    bool parseChunked(const LogFile &file);
+    bool parseCompact(const LogFile &file);
+    bool chunkMatches(const s2e::plugins::ExecutionTraceChunkHeader &chunk) const;
+
 protected:
 
 
@@ -134,7 +173,33 @@ public:
 
     bool parse(const std::vector<std::string> fileNames);
     bool parse(const std::string &file);
+    bool parseRanges(const std::vector<std::string> &fileNames, const TraceRanges &ranges);
     bool getItem(unsigned index, s2e::plugins::ExecutionTraceItemHeader &hdr, void **data);
+    bool getItemLocation(unsigned index, unsigned &fileIndex, uint64_t &offset) const;
+
+    /**
+     * Only deliver items whose type bit is set in typeMask (all by default).
+     * Filtered items are not numbered, getItem() only sees delivered ones.
+     * If the trace has an index (ExecutionTracer.dat.idx), runs of items
+     * that cannot match the filters are skipped without being read.
+     */
+    void setTypeFilter(uint64_t typeMask) {
+        m_typeFilter = typeMask;
+    }
+
+    /** Only deliver items of the given states (all if empty) */
+    void setStateFilter(const PathSet &states) {
+        m_stateFilter = states;
+    }
+
+    /**
+     * Number of threads inflating the chunks of compressed traces
+     * (the number of processors by default). Chunks that cannot
+     * match the filters are not inflated.
+     */
+    void setInflateThreads(unsigned count) {
+        m_inflateThreads = count ? count : 1;
+    }
 
     virtual ItemProcessorState* getState(void *processor, ItemProcessorStateFactory f);
     virtual ItemProcessorState* getState(void *processor, uint32_t pathId);
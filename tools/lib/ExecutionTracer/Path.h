@@ -168,6 +168,9 @@ public:
     bool processPath(uint32_t);
     void processTree();
 
+    //Fragments of all the segments of the path, from the root
+    bool getPathFragments(uint32_t pathId, PathFragmentList &fragments) const;
+
     void resetTree();
     virtual ItemProcessorState* getState(void *processor, ItemProcessorStateFactory f);
     virtual ItemProcessorState* getState(void *processor, uint32_t pathId);
@@ -150,6 +150,12 @@ void PathBuilder::onItem(unsigned traceIndex,
     std::cout << "PB: ID=" << (unsigned)hdr.stateId << " T=" << (unsigned)hdr.type << std::endl;
 #endif
 
+    //Calibration records do not belong to any path,
+    //getItem() already returns converted time stamps.
+    if (hdr.type == s2e::plugins::TRACE_TSC_CALIBRATION) {
+        return;
+    }
+
     if (hdr.stateId != m_CurrentSegment->getStateId()) {
         //Lookup the current state
         StateToSegments::iterator it = m_Leaves.find(hdr.stateId);
@@ -358,6 +364,29 @@ bool PathBuilder::processPath(uint32_t pathId)
     return true;
 }
 
+bool PathBuilder::getPathFragments(uint32_t pathId, PathFragmentList &fragments) const
+{
+    StateToSegments::const_iterator it = m_Leaves.find(pathId);
+    if (it == m_Leaves.end()) {
+        return false;
+    }
+
+    std::vector<PathSegment*> segments;
+    PathSegment *seg = (*it).second.back();
+    while(seg) {
+        segments.push_back(seg);
+        seg=seg->getParent();
+    }
+
+    fragments.clear();
+    for (int i=segments.size()-1; i>=0; --i) {
+        const PathFragmentList &f = segments[i]->getFragmentList();
+        fragments.insert(fragments.end(), f.begin(), f.end());
+    }
+
+    return true;
+}
+
 //Discards all segment-local information kept by trace processors.
 void PathBuilder::resetTree()
 {
@@ -0,0 +1,291 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <cassert>
+#include <cstring>
+#include <stdio.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "PathIndex.h"
+
+#define PATHINDEX_MAGIC "S2EPIDX1"
+#define PATHINDEX_VERSION 1
+
+namespace s2etools
+{
+
+namespace {
+
+struct PathIdLess {
+    bool operator()(const PathIndex::Path &p, uint32_t pathId) const {
+        return p.pathId < pathId;
+    }
+};
+
+bool getFileSize(const std::string &fileName, uint64_t &size)
+{
+    struct stat st;
+    if (stat(fileName.c_str(), &st) < 0) {
+        return false;
+    }
+    size = st.st_size;
+    return true;
+}
+
+//Byte ranges of the items of a fragment, merged when contiguous
+bool getFragmentRanges(LogParser &parser, const PathFragment &f, TraceRanges &ranges)
+{
+    for (uint32_t i = f.startIndex; i <= f.endIndex; ++i) {
+        s2e::plugins::ExecutionTraceItemHeader hdr;
+        void *data;
+        unsigned file;
+        uint64_t offset;
+
+        if (!parser.getItemLocation(i, file, offset) || !parser.getItem(i, hdr, &data)) {
+            return false;
+        }
+
+        uint64_t size = sizeof(hdr) + hdr.size;
+        if (!ranges.empty() && ranges.back().file == file &&
+            ranges.back().offset + ranges.back().size == offset) {
+            ranges.back().size += size;
+        } else {
+            TraceRange r;
+            r.file = file;
+            r.offset = offset;
+            r.size = size;
+            ranges.push_back(r);
+        }
+    }
+    return true;
+}
+
+}
+
+PathIndex::PathIndex()
+{
+    m_file = NULL;
+    m_size = 0;
+    m_paths = NULL;
+    m_ranges = NULL;
+    m_pathCount = 0;
+}
+
+PathIndex::~PathIndex()
+{
+    if (m_file) {
+        munmap(m_file, m_size);
+    }
+}
+
+bool PathIndex::build(LogParser &parser, PathBuilder &pb,
+                      const std::vector<std::string> &traceFiles,
+                      const std::string &fileName)
+{
+    PathSet paths;
+    pb.getPaths(paths);
+
+    //Segments are shared by the paths that fork from them
+    typedef std::map<std::pair<uint32_t, uint32_t>, TraceRanges> FragmentRanges;
+    FragmentRanges fragmentRanges;
+
+    std::vector<Path> pathTable;
+    TraceRanges ranges;
+
+    PathSet::const_iterator pit;
+    for (pit = paths.begin(); pit != paths.end(); ++pit) {
+        PathFragmentList fragments;
+        if (!pb.getPathFragments(*pit, fragments)) {
+            continue;
+        }
+
+        Path p;
+        p.pathId = *pit;
+        p.firstRange = ranges.size();
+
+        PathFragmentList::const_iterator fit;
+        for (fit = fragments.begin(); fit != fragments.end(); ++fit) {
+            std::pair<uint32_t, uint32_t> key((*fit).startIndex, (*fit).endIndex);
+            FragmentRanges::iterator rit = fragmentRanges.find(key);
+            if (rit == fragmentRanges.end()) {
+                TraceRanges fr;
+                if (!getFragmentRanges(parser, *fit, fr)) {
+                    std::cerr << "PathIndex: compressed traces cannot be indexed" << std::endl;
+                    return false;
+                }
+                rit = fragmentRanges.insert(std::make_pair(key, fr)).first;
+            }
+
+            const TraceRanges &fr = (*rit).second;
+            TraceRanges::const_iterator it;
+            for (it = fr.begin(); it != fr.end(); ++it) {
+                //Merge with the end of the previous fragment if possible
+                if (ranges.size() > p.firstRange && ranges.back().file == (*it).file &&
+                    ranges.back().offset + ranges.back().size == (*it).offset) {
+                    ranges.back().size += (*it).size;
+                } else {
+                    ranges.push_back(*it);
+                }
+            }
+        }
+
+        p.rangeCount = ranges.size() - p.firstRange;
+        pathTable.push_back(p);
+    }
+
+    Header hdr;
+    memcpy(hdr.magic, PATHINDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = PATHINDEX_VERSION;
+    hdr.traceCount = traceFiles.size();
+    hdr.pathCount = pathTable.size();
+    hdr.rangeCount = ranges.size();
+
+    std::vector<uint64_t> sizes(traceFiles.size());
+    for (unsigned i = 0; i < traceFiles.size(); ++i) {
+        if (!getFileSize(traceFiles[i], sizes[i])) {
+            std::cerr << "PathIndex: could not get the size of " << traceFiles[i] << std::endl;
+            return false;
+        }
+    }
+
+    FILE *fp = fopen(fileName.c_str(), "wb");
+    if (!fp) {
+        std::cerr << "PathIndex: could not create " << fileName << std::endl;
+        return false;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    if (ok && !sizes.empty()) {
+        ok = fwrite(&sizes[0], sizeof(uint64_t), sizes.size(), fp) == sizes.size();
+    }
+    if (ok && !pathTable.empty()) {
+        ok = fwrite(&pathTable[0], sizeof(Path), pathTable.size(), fp) == pathTable.size();
+    }
+    if (ok && !ranges.empty()) {
+        ok = fwrite(&ranges[0], sizeof(TraceRange), ranges.size(), fp) == ranges.size();
+    }
+
+    if (fclose(fp) || !ok) {
+        std::cerr << "PathIndex: could not write " << fileName << std::endl;
+        unlink(fileName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool PathIndex::open(const std::string &fileName, const std::vector<std::string> &traceFiles)
+{
+    assert(!m_file);
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < (off_t) sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+
+    void *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        return false;
+    }
+
+    const uint8_t *bytes = (const uint8_t*) file;
+    const Header *hdr = (const Header*) bytes;
+
+    uint64_t expected = sizeof(Header) + hdr->traceCount * sizeof(uint64_t) +
+                        hdr->pathCount * sizeof(Path) + hdr->rangeCount * sizeof(TraceRange);
+
+    bool ok = !memcmp(hdr->magic, PATHINDEX_MAGIC, sizeof(hdr->magic)) &&
+              hdr->version == PATHINDEX_VERSION &&
+              hdr->traceCount == traceFiles.size() &&
+              expected == (uint64_t) size;
+
+    //The traces must not have changed since the index was built
+    const uint64_t *sizes = (const uint64_t*) (bytes + sizeof(Header));
+    for (unsigned i = 0; ok && i < traceFiles.size(); ++i) {
+        uint64_t traceSize;
+        ok = getFileSize(traceFiles[i], traceSize) && traceSize == sizes[i];
+    }
+
+    if (!ok) {
+        munmap(file, size);
+        return false;
+    }
+
+    m_file = file;
+    m_size = size;
+    m_pathCount = hdr->pathCount;
+    m_paths = (const Path*) (sizes + hdr->traceCount);
+    m_ranges = (const TraceRange*) (m_paths + m_pathCount);
+    return true;
+}
+
+void PathIndex::getPaths(PathSet &paths) const
+{
+    paths.clear();
+    for (unsigned i = 0; i < m_pathCount; ++i) {
+        paths.insert(m_paths[i].pathId);
+    }
+}
+
+bool PathIndex::getRanges(uint32_t pathId, TraceRanges &ranges) const
+{
+    //Paths are sorted by id
+    const Path *end = m_paths + m_pathCount;
+    const Path *p = std::lower_bound(m_paths, end, pathId, PathIdLess());
+    if (p == end || p->pathId != pathId) {
+        return false;
+    }
+
+    ranges.assign(m_ranges + p->firstRange, m_ranges + p->firstRange + p->rangeCount);
+    return true;
+}
+
+}
@@ -0,0 +1,103 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#ifndef S2ETOOLS_EXECTRACER_PATHINDEX_H
+#define S2ETOOLS_EXECTRACER_PATHINDEX_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "LogParser.h"
+#include "Path.h"
+
+namespace s2etools
+{
+
+/**
+ *  Persistent fork tree of a set of traces.
+ *  For each path, the index lists the byte ranges of the traces that
+ *  hold the items of the path, from the root. Once built, tools can
+ *  process one path with LogParser::parseRanges() without rebuilding
+ *  the execution tree, in time proportional to the length of the path.
+ *  Compressed traces cannot be indexed.
+ */
+class PathIndex
+{
+public:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t traceCount;
+        uint32_t pathCount;
+        uint64_t rangeCount;
+        //Followed by traceCount uint64_t trace sizes, pathCount Path,
+        //and rangeCount TraceRange
+    }__attribute__((packed));
+
+    struct Path {
+        uint32_t pathId;
+        uint32_t rangeCount;
+        uint64_t firstRange;
+    }__attribute__((packed));
+
+private:
+    void *m_file;
+    uint64_t m_size;
+
+    const Path *m_paths;
+    const TraceRange *m_ranges;
+    uint32_t m_pathCount;
+
+public:
+    PathIndex();
+    ~PathIndex();
+
+    /** Writes the index of the traces parsed by parser into fileName */
+    static bool build(LogParser &parser, PathBuilder &pb,
+                      const std::vector<std::string> &traceFiles,
+                      const std::string &fileName);
+
+    /** Maps the index, fails if it does not match the traces */
+    bool open(const std::string &fileName, const std::vector<std::string> &traceFiles);
+
+    void getPaths(PathSet &paths) const;
+    bool getRanges(uint32_t pathId, TraceRanges &ranges) const;
+};
+
+}
+
+#endif
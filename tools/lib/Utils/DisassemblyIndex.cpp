@@ -0,0 +1,226 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#define __STDC_FORMAT_MACROS 1
+
+#include "DisassemblyIndex.h"
+
+#include "llvm/Support/system_error.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <vector>
+
+namespace s2etools
+{
+
+static const char s_indexMagic[8] = {'S', '2', 'E', 'L', 'S', 'T', '0', '1'};
+
+namespace {
+struct EntryLT {
+    bool operator()(const DisassemblyIndex::Entry &e, uint64_t pc) const {
+        return e.pc < pc;
+    }
+};
+}
+
+DisassemblyIndex::DisassemblyIndex()
+{
+    m_entries = NULL;
+    m_entryCount = 0;
+    m_text = NULL;
+}
+
+//Lines look like "seg000:00401000  push ebp", the program counter
+//follows the first colon
+bool DisassemblyIndex::build(const std::string &listingFile, uint64_t listingSize,
+                             uint64_t listingMtime, std::string &image)
+{
+    std::map<uint64_t, std::string> lines;
+
+    char line[1024];
+    std::filebuf file;
+    if (!file.open(listingFile.c_str(), std::ios::in)) {
+        return false;
+    }
+
+    std::istream is(&file);
+
+    while(is.getline(line, sizeof(line))) {
+        unsigned i=0;
+        while (line[i] && (line[i]!=':'))
+            ++i;
+        if (line[i] != ':')
+            continue;
+
+        ++i;
+        std::string strpc;
+        while(isxdigit(line[i])) {
+            strpc = strpc + line[i];
+            ++i;
+        }
+
+        uint64_t pc=0;
+        sscanf(strpc.c_str(), "%"PRIx64, &pc);
+        if (pc) {
+            std::string &text = lines[pc];
+            if (!text.empty()) {
+                text += '\n';
+            }
+            text += line;
+        }
+    }
+
+    if (lines.empty()) {
+        return false;
+    }
+
+    Header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, s_indexMagic, sizeof(hdr.magic));
+    hdr.listingSize = listingSize;
+    hdr.listingMtime = listingMtime;
+    hdr.entryCount = lines.size();
+
+    std::vector<Entry> entries;
+    std::string text;
+    std::map<uint64_t, std::string>::const_iterator it;
+    for (it = lines.begin(); it != lines.end(); ++it) {
+        Entry e;
+        e.pc = (*it).first;
+        e.offset = text.size();
+        e.length = (*it).second.size();
+        entries.push_back(e);
+        text += (*it).second;
+    }
+
+    image.assign((const char*) &hdr, sizeof(hdr));
+    image.append((const char*) &entries[0], entries.size() * sizeof(Entry));
+    image += text;
+    return true;
+}
+
+bool DisassemblyIndex::map(llvm::MemoryBuffer *buffer, uint64_t listingSize,
+                           uint64_t listingMtime)
+{
+    m_buffer.reset(buffer);
+
+    const char *data = buffer->getBufferStart();
+    size_t size = buffer->getBufferSize();
+
+    Header hdr;
+    if (size < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+
+    if (memcmp(hdr.magic, s_indexMagic, sizeof(hdr.magic)) ||
+        hdr.listingSize != listingSize || hdr.listingMtime != listingMtime) {
+        return false;
+    }
+
+    size_t textOffset = sizeof(hdr) + (size_t) hdr.entryCount * sizeof(Entry);
+    if (textOffset > size) {
+        return false;
+    }
+
+    //The buffer is pointer aligned and so are the entries
+    m_entries = (const Entry*) (data + sizeof(hdr));
+    m_entryCount = hdr.entryCount;
+    m_text = data + textOffset;
+
+    if (m_entryCount) {
+        const Entry &last = m_entries[m_entryCount - 1];
+        if ((uint64_t) last.offset + last.length > size - textOffset) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool DisassemblyIndex::open(const std::string &listingFile)
+{
+    struct stat st;
+    if (stat(listingFile.c_str(), &st) < 0) {
+        return false;
+    }
+
+    std::string indexFile = listingFile + ".idx";
+
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (!llvm::MemoryBuffer::getFile(indexFile, buffer) &&
+        map(buffer.take(), st.st_size, st.st_mtime)) {
+        return true;
+    }
+
+    std::string image;
+    if (!build(listingFile, st.st_size, st.st_mtime, image)) {
+        return false;
+    }
+
+    //Write to a temporary file first so that a concurrent run
+    //never sees a partial index
+    std::string tmpFile = indexFile + ".tmp";
+    FILE *fp = fopen(tmpFile.c_str(), "wb");
+    bool ok = fp && fwrite(image.data(), image.size(), 1, fp) == 1;
+    if (fp && fclose(fp)) {
+        ok = false;
+    }
+
+    if (!ok || rename(tmpFile.c_str(), indexFile.c_str())) {
+        std::cerr << "Could not write disassembly index " << indexFile << std::endl;
+        remove(tmpFile.c_str());
+    }
+
+    //Works even if the index could not be saved
+    return map(llvm::MemoryBuffer::getMemBufferCopy(image, indexFile),
+               st.st_size, st.st_mtime);
+}
+
+const DisassemblyIndex::Entry *DisassemblyIndex::lowerBound(uint64_t pc) const
+{
+    return std::lower_bound(m_entries, m_entries + m_entryCount, pc, EntryLT());
+}
+
+}
@@ -0,0 +1,105 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_DISASSEMBLYINDEX_H
+#define S2ETOOLS_DISASSEMBLYINDEX_H
+
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <stdint.h>
+#include <string>
+
+namespace s2etools
+{
+
+/**
+ *  Lines of an IDA Pro disassembly listing, indexed by program counter.
+ *  The index is saved next to the listing (<listing>.idx) and mapped
+ *  in memory by later runs, without parsing the listing again.
+ *  The listing size and modification time detect stale indexes.
+ */
+class DisassemblyIndex
+{
+public:
+    struct Header {
+        char magic[8];
+        uint64_t listingSize;
+        uint64_t listingMtime;
+        uint32_t entryCount;
+        uint32_t padding;
+    };
+
+    //Entries are sorted by program counter. The text of an entry is
+    //made of the listing lines of its program counter, separated by \n.
+    struct Entry {
+        uint64_t pc;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+private:
+    llvm::OwningPtr<llvm::MemoryBuffer> m_buffer;
+    const Entry *m_entries;
+    unsigned m_entryCount;
+    const char *m_text;
+
+    bool map(llvm::MemoryBuffer *buffer, uint64_t listingSize, uint64_t listingMtime);
+    static bool build(const std::string &listingFile, uint64_t listingSize,
+                      uint64_t listingMtime, std::string &image);
+
+public:
+    DisassemblyIndex();
+
+    /** Loads the index of the listing, building and saving it
+        if it does not exist or is stale */
+    bool open(const std::string &listingFile);
+
+    /** Returns the first entry whose program counter is at least pc */
+    const Entry *lowerBound(uint64_t pc) const;
+
+    const Entry *end() const {
+        return m_entries + m_entryCount;
+    }
+
+    llvm::StringRef getText(const Entry *e) const {
+        return llvm::StringRef(m_text + e->offset, e->length);
+    }
+};
+
+}
+
+#endif
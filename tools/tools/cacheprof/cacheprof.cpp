@@ -41,6 +41,7 @@
 #include <lib/ExecutionTracer/Path.h>
 #include <lib/ExecutionTracer/TestCase.h>
 #include <lib/ExecutionTracer/CacheProfiler.h>
+#include <lib/ExecutionTracer/CacheReplay.h>
 #include <lib/BinaryReaders/BFDInterface.h>
 #include <lib/BinaryReaders/Library.h>
 
@@ -53,6 +54,7 @@
 #include <sstream>
 #include <inttypes.h>
 #include <iomanip>
+#include <pthread.h>
 //#include "icounter.h"
 
 using namespace llvm;
@@ -71,6 +73,146 @@ cl::opt<std::string>
 cl::list<std::string>
     ModPath("modpath", cl::desc("Path to modules"));
 
+cl::list<std::string>
+    ReplayConfigs("replay", cl::desc("Simulate the accesses recorded by CacheSim (recordAccesses) "
+                                     "in the given hierarchy, name=l1:size:assoc:lineSize,l2:..."));
+
+cl::opt<bool>
+    ReplayCode("replay-code", cl::desc("Send instruction fetches through the replayed hierarchies"),
+               cl::init(false));
+
+cl::opt<unsigned>
+    ReplayJobs("replay-jobs", cl::desc("Number of hierarchies simulated in parallel (0: all)"),
+               cl::init(0));
+
+}
+
+struct ReplayJob {
+    CacheHierarchyConfig config;
+    std::map<uint32_t, std::vector<CacheLevelStatistics> > pathStats;
+};
+
+struct ReplayQueue {
+    pthread_mutex_t lock;
+    std::vector<ReplayJob> *jobs;
+    unsigned next;
+};
+
+//Each job parses the trace on its own, the mapped files are shared
+static void runReplayJob(ReplayJob &job)
+{
+    LogParser parser;
+    parser.setTypeFilter((1ULL << s2e::plugins::TRACE_CACHESIM) |
+                         (1ULL << s2e::plugins::TRACE_FORK));
+
+    PathBuilder pb(&parser);
+    CacheReplay replay(&pb, job.config, ReplayCode);
+
+    parser.parse(TraceFiles);
+    pb.processTree();
+
+    PathSet paths;
+    pb.getPaths(paths);
+
+    PathSet::const_iterator pit;
+    for (pit = paths.begin(); pit != paths.end(); ++pit) {
+        CacheReplayState *state = static_cast<CacheReplayState*>(pb.getState(&replay, *pit));
+        if (state) {
+            job.pathStats[*pit] = state->getStatistics();
+        }
+    }
+}
+
+static void *replayWorker(void *opaque)
+{
+    ReplayQueue *queue = (ReplayQueue*) opaque;
+
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        unsigned index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (index >= queue->jobs->size()) {
+            break;
+        }
+        runReplayJob((*queue->jobs)[index]);
+    }
+    return NULL;
+}
+
+static void printReplayStats(const std::vector<ReplayJob> &jobs)
+{
+    std::string outFileStr = LogDir + "/cachereplay.log";
+    std::ofstream outFile(outFileStr.c_str());
+
+    outFile << "#Cache misses of the replayed hierarchies" << std::endl;
+    outFile << "#Hierarchy PathId Cache Reads ReadMisses Writes WriteMisses" << std::endl;
+
+    for (unsigned j = 0; j < jobs.size(); ++j) {
+        const ReplayJob &job = jobs[j];
+        std::vector<CacheLevelStatistics> total(job.config.levels.size());
+
+        std::map<uint32_t, std::vector<CacheLevelStatistics> >::const_iterator pit;
+        for (pit = job.pathStats.begin(); pit != job.pathStats.end(); ++pit) {
+            const std::vector<CacheLevelStatistics> &stats = (*pit).second;
+            for (unsigned i = 0; i < stats.size(); ++i) {
+                outFile << job.config.name << " " << std::dec << (*pit).first << " "
+                        << job.config.levels[i].name << " "
+                        << stats[i].readCount << " " << stats[i].readMissCount << " "
+                        << stats[i].writeCount << " " << stats[i].writeMissCount << std::endl;
+
+                total[i].readCount += stats[i].readCount;
+                total[i].readMissCount += stats[i].readMissCount;
+                total[i].writeCount += stats[i].writeCount;
+                total[i].writeMissCount += stats[i].writeMissCount;
+            }
+        }
+
+        for (unsigned i = 0; i < total.size(); ++i) {
+            outFile << "#Total " << job.config.name << " " << job.config.levels[i].name << " "
+                    << total[i].readCount << " " << total[i].readMissCount << " "
+                    << total[i].writeCount << " " << total[i].writeMissCount << std::endl;
+        }
+    }
+}
+
+static int replayCaches()
+{
+    std::vector<ReplayJob> jobs(ReplayConfigs.size());
+    for (unsigned i = 0; i < ReplayConfigs.size(); ++i) {
+        std::string error;
+        if (!CacheHierarchyConfig::parse(ReplayConfigs[i], jobs[i].config, error)) {
+            std::cerr << "Invalid cache hierarchy " << ReplayConfigs[i] << ": " << error << std::endl;
+            return -1;
+        }
+    }
+
+    ReplayQueue queue;
+    pthread_mutex_init(&queue.lock, NULL);
+    queue.jobs = &jobs;
+    queue.next = 0;
+
+    unsigned threadCount = ReplayJobs ? ReplayJobs : jobs.size();
+    if (threadCount > jobs.size()) {
+        threadCount = jobs.size();
+    }
+
+    std::vector<pthread_t> threads(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i) {
+        if (pthread_create(&threads[i], NULL, replayWorker, &queue)) {
+            std::cerr << "Could not create replay thread" << std::endl;
+            exit(-1);
+        }
+    }
+
+    for (unsigned i = 0; i < threadCount; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&queue.lock);
+
+    printReplayStats(jobs);
+    return 0;
 }
 
 
@@ -147,6 +289,10 @@ int main(int argc, char **argv)
 {
     cl::ParseCommandLineOptions(argc, (char**) argv, " debugger");
 
+    if (!ReplayConfigs.empty()) {
+        return replayCaches();
+    }
+
     Library library;
     library.setPaths(ModPath);
 
@@ -0,0 +1,332 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+/**
+ *  Coordination server for S2E runs that span several hosts.
+ *  Each S2E instance keeps one connection open and sends one request per line.
+ *
+ *  REGISTER <group> <pid>  -> OK
+ *  UNREGISTER              -> OK
+ *  INSTANCES               -> number of registered instances
+ *  NEXT_STATE_ID           -> globally unique state id
+ *  PEEK_STATE_ID           -> next state id, without allocating it
+ *  NEXT_FILE_ID            -> globally unique output file id
+ *  BROADCAST <command>     -> OK, queues the command for all other groups
+ *  POLL                    -> oldest queued command or NONE
+ */
+
+#include "llvm/Support/CommandLine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include <cassert>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+cl::opt<unsigned>
+    Port("port", cl::desc("TCP port to listen on"), cl::init(0));
+
+cl::opt<std::string>
+    UnixSocket("unix-socket", cl::desc("Path of the unix socket to listen on"), cl::init(""));
+
+cl::opt<unsigned>
+    FirstFileId("first-file-id", cl::desc("First output file id to hand out"), cl::init(1000));
+
+}
+
+namespace s2etools
+{
+
+struct Client {
+    std::string inputBuffer;
+    std::string group;
+    unsigned pid;
+    bool registered;
+    std::deque<std::string> commands;
+
+    Client() : pid(0), registered(false) {}
+};
+
+class Coordinator
+{
+private:
+    typedef std::map<int, Client> Clients;
+
+    int m_listenSocket;
+    Clients m_clients;
+
+    unsigned m_nextStateId;
+    unsigned m_nextFileId;
+    unsigned m_instanceCount;
+
+    std::string processRequest(Client &client, const std::string &request);
+    bool processInput(int fd, Client &client);
+    void removeClient(int fd);
+
+public:
+    Coordinator(int listenSocket);
+    void run();
+};
+
+Coordinator::Coordinator(int listenSocket)
+{
+    m_listenSocket = listenSocket;
+    m_nextStateId = 0;
+    m_nextFileId = FirstFileId;
+    m_instanceCount = 0;
+}
+
+std::string Coordinator::processRequest(Client &client, const std::string &request)
+{
+    std::stringstream in(request);
+    std::stringstream out;
+    std::string command;
+    in >> command;
+
+    if (command == "REGISTER") {
+        in >> client.group >> client.pid;
+        if (!client.registered) {
+            client.registered = true;
+            ++m_instanceCount;
+        }
+        std::cout << "Registered " << client.group << " pid " << client.pid
+                  << " (" << m_instanceCount << " instances)" << std::endl;
+        out << "OK";
+    } else if (command == "UNREGISTER") {
+        if (client.registered) {
+            client.registered = false;
+            --m_instanceCount;
+        }
+        out << "OK";
+    } else if (command == "INSTANCES") {
+        out << m_instanceCount;
+    } else if (command == "NEXT_STATE_ID") {
+        out << m_nextStateId++;
+    } else if (command == "PEEK_STATE_ID") {
+        out << m_nextStateId;
+    } else if (command == "NEXT_FILE_ID") {
+        out << m_nextFileId++;
+    } else if (command == "BROADCAST") {
+        std::string cmd;
+        in >> cmd;
+        for (Clients::iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+            if ((*it).second.registered && (*it).second.group != client.group) {
+                (*it).second.commands.push_back(cmd);
+            }
+        }
+        out << "OK";
+    } else if (command == "POLL") {
+        if (client.commands.empty()) {
+            out << "NONE";
+        } else {
+            out << client.commands.front();
+            client.commands.pop_front();
+        }
+    } else {
+        std::cerr << "Invalid request " << request << std::endl;
+        out << "ERROR";
+    }
+
+    return out.str();
+}
+
+bool Coordinator::processInput(int fd, Client &client)
+{
+    char buffer[512];
+    ssize_t ret = read(fd, buffer, sizeof(buffer));
+    if (ret <= 0) {
+        return false;
+    }
+
+    client.inputBuffer.append(buffer, ret);
+
+    size_t eol;
+    while ((eol = client.inputBuffer.find('\n')) != std::string::npos) {
+        std::string request = client.inputBuffer.substr(0, eol);
+        client.inputBuffer.erase(0, eol + 1);
+
+        std::string reply = processRequest(client, request) + "\n";
+        if (write(fd, reply.c_str(), reply.size()) != (ssize_t) reply.size()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Coordinator::removeClient(int fd)
+{
+    Clients::iterator it = m_clients.find(fd);
+    assert(it != m_clients.end());
+
+    //Instances that crashed do not unregister themselves
+    if ((*it).second.registered) {
+        --m_instanceCount;
+        std::cout << "Lost " << (*it).second.group << " pid " << (*it).second.pid
+                  << " (" << m_instanceCount << " instances)" << std::endl;
+    }
+
+    close(fd);
+    m_clients.erase(it);
+}
+
+void Coordinator::run()
+{
+    while (true) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(m_listenSocket, &fds);
+        int maxFd = m_listenSocket;
+
+        for (Clients::iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+            FD_SET((*it).first, &fds);
+            if ((*it).first > maxFd) {
+                maxFd = (*it).first;
+            }
+        }
+
+        if (select(maxFd + 1, &fds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            exit(-1);
+        }
+
+        if (FD_ISSET(m_listenSocket, &fds)) {
+            int fd = accept(m_listenSocket, NULL, NULL);
+            if (fd >= 0) {
+                m_clients[fd] = Client();
+            }
+        }
+
+        std::vector<int> toRemove;
+        for (Clients::iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+            if (FD_ISSET((*it).first, &fds) && !processInput((*it).first, (*it).second)) {
+                toRemove.push_back((*it).first);
+            }
+        }
+
+        for (unsigned i = 0; i < toRemove.size(); ++i) {
+            removeClient(toRemove[i]);
+        }
+    }
+}
+
+}
+
+static int createListenSocket()
+{
+    int s;
+
+    if (!UnixSocket.empty()) {
+        struct sockaddr_un addr;
+        if (UnixSocket.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Socket path too long" << std::endl;
+            return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, UnixSocket.c_str());
+        unlink(UnixSocket.c_str());
+
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0 || bind(s, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+            perror("bind");
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(Port);
+
+        s = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        if (s < 0 ||
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+            bind(s, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+            perror("bind");
+            return -1;
+        }
+    }
+
+    if (listen(s, 64) < 0) {
+        perror("listen");
+        return -1;
+    }
+
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, (char**) argv, " s2ecoordinator");
+
+    if (!Port && UnixSocket.empty()) {
+        std::cerr << "Specify either -port or -unix-socket" << std::endl;
+        return -1;
+    }
+
+    int s = createListenSocket();
+    if (s < 0) {
+        return -1;
+    }
+
+    s2etools::Coordinator coordinator(s);
+    coordinator.run();
+
+    return 0;
+}
@@ -55,6 +55,8 @@
 #include <sstream>
 #include <inttypes.h>
 #include <iomanip>
+#include <algorithm>
+#include <pthread.h>
 #include "Coverage.h"
 
 using namespace llvm;
@@ -77,6 +79,10 @@ ModDir("moddir", cl::desc("Directory containing binary modules, the basic block
 cl::opt<bool>
     Compact("compact", cl::desc("Do not display non-covered blocks"), cl::init(false));
 
+cl::opt<unsigned>
+    Jobs("jobs", cl::desc("Number of threads processing the traces, each one takes a group of trace files"),
+         cl::init(1));
+
 
 //cl::opt<std::string>
 //    CovType("covtype", cl::desc("Coverage type"), cl::init("basicblock"));
@@ -382,6 +388,14 @@ void BasicBlockCoverage::printBBCov(std::ostream &os) const
     }
 }
 
+void BasicBlockCoverage::merge(const BasicBlockCoverage &other)
+{
+    Blocks::const_iterator it;
+    for (it = other.m_uniqueTbs.begin(); it != other.m_uniqueTbs.end(); ++it) {
+        addTranslationBlock((*it).timeStamp, (*it).start, (*it).end);
+    }
+}
+
 Coverage::Coverage(Library *lib, ModuleCache *cache, LogEvents *events)
 {
     m_events = events;
@@ -502,6 +516,25 @@ void Coverage::outputCoverage(const std::string &path) const
     }
 }
 
+void Coverage::merge(Coverage &other)
+{
+    BbCoverageMap::iterator it;
+    for (it = other.m_bbCov.begin(); it != other.m_bbCov.end(); ++it) {
+        BbCoverageMap::iterator mine = m_bbCov.find((*it).first);
+        if (mine == m_bbCov.end()) {
+            m_bbCov[(*it).first] = (*it).second;
+        } else {
+            (*mine).second->merge(*(*it).second);
+            delete (*it).second;
+        }
+    }
+    other.m_bbCov.clear();
+
+    m_unknownModuleCount += other.m_unknownModuleCount;
+    m_notFoundModuleImages.insert(other.m_notFoundModuleImages.begin(),
+                                  other.m_notFoundModuleImages.end());
+}
+
 void Coverage::printErrors() const
 {
     if (m_unknownModuleCount) {
@@ -545,6 +578,92 @@ void CoverageTool::flatTrace()
     cov.outputCoverage(LogDir);
 }
 
+namespace {
+
+struct CoverageJob {
+    //Trace files [first, last) whose blocks are counted by this job
+    unsigned first, last;
+
+    Library binaries;
+    LogParser *parser;
+    PathBuilder *pb;
+    ModuleCache *mc;
+    Coverage *cov;
+};
+
+//Each job reads all the traces to rebuild the execution tree and
+//the loaded modules. Only the traces of its own group contribute blocks.
+void *coverageWorker(void *opaque)
+{
+    CoverageJob *job = (CoverageJob*) opaque;
+
+    uint64_t treeTypes = (1ULL << s2e::plugins::TRACE_FORK) |
+                         (1ULL << s2e::plugins::TRACE_MOD_LOAD) |
+                         (1ULL << s2e::plugins::TRACE_MOD_UNLOAD) |
+                         (1ULL << s2e::plugins::TRACE_PROC_UNLOAD);
+
+    job->parser = new LogParser();
+    job->pb = new PathBuilder(job->parser);
+    job->mc = new ModuleCache(job->pb);
+    job->cov = new Coverage(&job->binaries, job->mc, job->pb);
+
+    for (unsigned i = 0; i < TraceFiles.size(); ++i) {
+        bool own = i >= job->first && i < job->last;
+        job->parser->setTypeFilter(own ? treeTypes | (1ULL << s2e::plugins::TRACE_TB_START) : treeTypes);
+        if (!job->parser->parse(TraceFiles[i]) && own) {
+            std::cerr << TraceFiles[i] << " is incomplete" << std::endl;
+        }
+    }
+
+    job->pb->processTree();
+    return NULL;
+}
+
+}
+
+void CoverageTool::parallelTrace(unsigned jobCount)
+{
+    if (jobCount > TraceFiles.size()) {
+        jobCount = TraceFiles.size();
+    }
+
+    CoverageJob *jobs = new CoverageJob[jobCount];
+    std::vector<pthread_t> threads(jobCount);
+
+    unsigned perJob = (TraceFiles.size() + jobCount - 1) / jobCount;
+    for (unsigned i = 0; i < jobCount; ++i) {
+        jobs[i].first = std::min<unsigned>(i * perJob, TraceFiles.size());
+        jobs[i].last = std::min<unsigned>((i + 1) * perJob, TraceFiles.size());
+        jobs[i].binaries.setPaths(ModDir);
+
+        if (pthread_create(&threads[i], NULL, coverageWorker, &jobs[i])) {
+            std::cerr << "Could not create coverage thread" << std::endl;
+            exit(-1);
+        }
+    }
+
+    for (unsigned i = 0; i < jobCount; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    //Merge in trace order
+    Coverage *cov = jobs[0].cov;
+    for (unsigned i = 1; i < jobCount; ++i) {
+        cov->merge(*jobs[i].cov);
+    }
+
+    cov->printErrors();
+    cov->outputCoverage(LogDir);
+
+    for (unsigned i = 0; i < jobCount; ++i) {
+        delete jobs[i].cov;
+        delete jobs[i].mc;
+        delete jobs[i].pb;
+        delete jobs[i].parser;
+    }
+    delete [] jobs;
+}
+
 
 }
 
@@ -555,7 +674,11 @@ int main(int argc, char **argv)
 
     s2etools::CoverageTool cov;
 
-    cov.flatTrace();
+    if (Jobs > 1 && TraceFiles.size() > 1) {
+        cov.parallelTrace(Jobs);
+    } else {
+        cov.flatTrace();
+    }
 
     return 0;
 }
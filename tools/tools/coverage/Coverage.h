@@ -141,6 +141,9 @@ public:
     void printReport(std::ostream &os, uint64_t pathCount, bool useIgnoreList = false, bool csv = false) const;
     void printBBCov(std::ostream &os) const;
 
+    //Adds the translation blocks covered by other
+    void merge(const BasicBlockCoverage &other);
+
 
     bool hasIgnoredFunctions() const {
         return m_ignoredFunctions.size() > 0;
@@ -190,6 +193,10 @@ public:
 
     void printErrors() const;
 
+    //Takes over the coverage gathered by other on the items of its traces.
+    //The path count is not summed: every job sees all the forks.
+    void merge(Coverage &other);
+
 };
 
 class CoverageTool
@@ -205,6 +212,9 @@ public:
 
     void process();
     void flatTrace();
+
+    //Processes groups of traces in parallel and merges the results
+    void parallelTrace(unsigned jobCount);
 };
 
 
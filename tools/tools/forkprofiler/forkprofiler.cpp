@@ -45,12 +45,15 @@
 #include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <ostream>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <inttypes.h>
 #include <iomanip>
+#include <algorithm>
+#include <pthread.h>
 #include "forkprofiler.h"
 
 using namespace llvm;
@@ -70,6 +73,18 @@ cl::opt<std::string>
 cl::list<std::string>
     ModDir("moddir", cl::desc("Directory containing the binary modules"));
 
+cl::opt<bool>
+    Stream("stream", cl::desc("Count the forks while reading the traces, without building the execution tree and the state graph"),
+           cl::init(false));
+
+cl::opt<unsigned>
+    Window("window", cl::desc("Also write the fork counts of each period of the given number of seconds to forkprofile-<n>.txt"),
+           cl::init(0));
+
+cl::opt<unsigned>
+    Jobs("jobs", cl::desc("Number of threads, each one counting the forks of a group of trace files (implies -stream)"),
+         cl::init(1));
+
 }
 
 namespace s2etools
@@ -82,6 +97,11 @@ ForkProfiler::ForkProfiler(Library *lib, ModuleCache *cache, LogEvents *events)
             );
     m_cache = cache;
     m_library = lib;
+    m_streaming = false;
+    m_windowLength = 0;
+    m_liveWindows = false;
+    m_hasFirstWindow = false;
+    m_firstWindow = 0;
 }
 
 ForkProfiler::~ForkProfiler()
@@ -89,42 +109,146 @@ ForkProfiler::~ForkProfiler()
     m_connection.disconnect();
 }
 
+//Returns the point of the given pc, looking up the debug information of new points
+ForkProfiler::ForkPoints::iterator ForkProfiler::getPoint(ForkPoints &points,
+        const s2e::plugins::ExecutionTraceItemHeader &hdr,
+        uint64_t pc)
+{
+    ForkPoint fp;
+    fp.pc = pc;
+    fp.pid = hdr.pid;
+
+    ForkPoints::iterator it = points.find(fp);
+    if (it != points.end()) {
+        return it;
+    }
+
+    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
+    const ModuleInstance *mi = mcs->getInstance(hdr.pid, pc);
+
+    fp.count = 0;
+    fp.queryCount = 0;
+    fp.queryTime = 0;
+    fp.line = 0;
+    m_library->getInfo(mi, pc, fp.file, fp.line, fp.function);
+
+    if (mi) {
+        fp.module = mi->Name;
+        fp.loadbase = mi->LoadBase;
+        fp.imagebase = mi->ImageBase;
+    } else {
+        fp.module = "";
+        fp.loadbase = 0;
+        fp.imagebase = 0;
+    }
+
+    return points.insert(fp).first;
+}
+
 void ForkProfiler::doProfile(
         const s2e::plugins::ExecutionTraceItemHeader &hdr,
         const s2e::plugins::ExecutionTraceFork *te)
 {
-    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_cache, &ModuleCacheState::factory));
+    ForkPoints::iterator it = getPoint(m_forkPoints, hdr, te->pc);
+    ++(*it).count;
 
-    const ModuleInstance *mi = mcs->getInstance(hdr.pid, te->pc);
+    if (m_windowLength) {
+        doWindow(hdr, *it);
+    }
+}
 
-    ForkPoint fp;
-    fp.pc = te->pc;
-    fp.pid = hdr.pid;
-    fp.count = 1;
-    fp.line = 0;
+void ForkProfiler::doQueryProfile(
+        const s2e::plugins::ExecutionTraceItemHeader &hdr,
+        const s2e::plugins::ExecutionTraceSolverQuery *te)
+{
+    ForkPoints::iterator it = getPoint(m_queryPoints, hdr, te->pc);
+    (*it).queryCount += te->count;
+    (*it).queryTime += te->usec;
+}
 
-    m_library->getInfo(mi, te->pc, fp.file, fp.line, fp.function);
+void ForkProfiler::doWindow(
+        const s2e::plugins::ExecutionTraceItemHeader &hdr,
+        const ForkPoint &fp)
+{
+    uint64_t window = hdr.timeStamp / m_windowLength;
+
+    if (m_liveWindows) {
+        flushWindows(window);
+    }
 
-    ForkPoints::iterator it = m_forkPoints.find(fp);
-    if (it == m_forkPoints.end()) {
-        if (mi) {
-            fp.module = mi->Name;
-            fp.loadbase = mi->LoadBase;
-            fp.imagebase = mi->ImageBase;
+    if (!m_hasFirstWindow || window < m_firstWindow) {
+        m_firstWindow = window;
+        m_hasFirstWindow = true;
+    }
+
+    ForkPoints &points = m_windows[window];
+    ForkPoints::iterator it = points.find(fp);
+    if (it == points.end()) {
+        ForkPoint wfp = fp;
+        wfp.count = 1;
+        points.insert(wfp);
+    } else {
+        ++(*it).count;
+    }
+}
+
+void ForkProfiler::setWindows(uint64_t lengthUsec, bool live, const std::string &path)
+{
+    m_windowLength = lengthUsec;
+    m_liveWindows = live;
+    m_windowDir = path;
+}
+
+void ForkProfiler::mergePoints(ForkPoints &dest, const ForkPoints &src)
+{
+    ForkPoints::const_iterator it;
+    for (it = src.begin(); it != src.end(); ++it) {
+        ForkPoints::iterator mine = dest.find(*it);
+        if (mine == dest.end()) {
+            dest.insert(*it);
         } else {
-            fp.module = "";
-            fp.loadbase = 0;
-            fp.imagebase = 0;
+            (*mine).count += (*it).count;
+            (*mine).queryCount += (*it).queryCount;
+            (*mine).queryTime += (*it).queryTime;
         }
-        m_forkPoints.insert(fp);
-    }else {
-        fp = *it;
-        m_forkPoints.erase(*it);
-        fp.count++;
-        m_forkPoints.insert(fp);
     }
 }
 
+void ForkProfiler::merge(const ForkProfiler &other)
+{
+    mergePoints(m_forkPoints, other.m_forkPoints);
+    mergePoints(m_queryPoints, other.m_queryPoints);
+
+    Windows::const_iterator it;
+    for (it = other.m_windows.begin(); it != other.m_windows.end(); ++it) {
+        mergePoints(m_windows[(*it).first], (*it).second);
+    }
+
+    if (other.m_hasFirstWindow && (!m_hasFirstWindow || other.m_firstWindow < m_firstWindow)) {
+        m_firstWindow = other.m_firstWindow;
+        m_hasFirstWindow = true;
+    }
+}
+
+//Writes and forgets the windows that precede the given one
+void ForkProfiler::flushWindows(uint64_t before)
+{
+    while (!m_windows.empty() && (*m_windows.begin()).first < before) {
+        Windows::iterator it = m_windows.begin();
+
+        std::stringstream ss;
+        ss << m_windowDir << "/" << "forkprofile-" << ((*it).first - m_firstWindow) << ".txt";
+        writeProfile((*it).second, ss.str());
+
+        m_windows.erase(it);
+    }
+}
+
+void ForkProfiler::outputWindows()
+{
+    flushWindows((uint64_t) -1);
+}
+
 void ForkProfiler::doGraph(
         const s2e::plugins::ExecutionTraceItemHeader &hdr,
         const s2e::plugins::ExecutionTraceFork *te)
@@ -155,6 +279,11 @@ void ForkProfiler::onItem(unsigned traceIndex,
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             void *item)
 {
+    if (hdr.type == s2e::plugins::TRACE_SOLVER_QUERY) {
+        doQueryProfile(hdr, (const s2e::plugins::ExecutionTraceSolverQuery*) item);
+        return;
+    }
+
     if (hdr.type != s2e::plugins::TRACE_FORK) {
         return;
     }
@@ -163,7 +292,9 @@ void ForkProfiler::onItem(unsigned traceIndex,
             (const s2e::plugins::ExecutionTraceFork*) item;
 
     doProfile(hdr, te);
-    doGraph(hdr, te);
+    if (!m_streaming) {
+        doGraph(hdr, te);
+    }
 
 }
 
@@ -232,12 +363,44 @@ void ForkProfiler::outputProfile(const std::string &path) const
 {
     std::stringstream ss;
     ss << path << "/" << "forkprofile.txt";
-    std::ofstream forkProfile(ss.str().c_str());
+    writeProfile(m_forkPoints, ss.str());
+
+    if (!m_queryPoints.empty()) {
+        std::stringstream qs;
+        qs << path << "/" << "solverprofile.txt";
+        writeQueryProfile(qs.str());
+    }
+}
+
+void ForkProfiler::writeQueryProfile(const std::string &fileName) const
+{
+    std::ofstream profile(fileName.c_str());
+
+    std::set<ForkPoint, ForkPointByQueryTime> byTime(m_queryPoints.begin(), m_queryPoints.end());
+
+    profile << "#Pc      \tModule\tQueries\tTimeUsec\tSource\tFunction\tLine" << std::endl;
+
+    std::set<ForkPoint, ForkPointByQueryTime>::const_iterator it;
+    for (it = byTime.begin(); it != byTime.end(); ++it) {
+        const ForkPoint &fp = *it;
+        profile << std::hex << "0x" << std::setw(8) << std::setfill('0') << (fp.pc - fp.loadbase + fp.imagebase) << "\t";
+        profile << std::setfill(' ');
+        profile << (fp.module.size() > 0 ? fp.module : "?") << "\t";
+        profile << std::dec << fp.queryCount << "\t" << fp.queryTime << "\t";
+        profile << (fp.file.size() > 0 ? fp.file : "?") << "\t";
+        profile << (fp.function.size() > 0 ? fp.function : "?") << "\t";
+        profile << std::dec << fp.line << std::endl;
+    }
+}
+
+void ForkProfiler::writeProfile(const ForkPoints &points, const std::string &fileName) const
+{
+    std::ofstream forkProfile(fileName.c_str());
 
     ForkPointsByCount fpCnt;
 
     ForkPoints::const_iterator it;
-    for (it = m_forkPoints.begin(); it != m_forkPoints.end(); ++it) {
+    for (it = points.begin(); it != points.end(); ++it) {
         fpCnt.insert(*it);
     }
 
@@ -276,24 +439,144 @@ void ForkProfiler::outputProfile(const std::string &path) const
 }
 
 
+namespace {
+
+uint64_t windowLength()
+{
+    return (uint64_t) Window * 1000000;
+}
+
+//Item types needed to count forks without the execution tree
+uint64_t streamTypes(bool forks)
+{
+    uint64_t types = (1ULL << s2e::plugins::TRACE_MOD_LOAD) |
+                     (1ULL << s2e::plugins::TRACE_MOD_UNLOAD) |
+                     (1ULL << s2e::plugins::TRACE_PROC_UNLOAD);
+    if (forks) {
+        types |= 1ULL << s2e::plugins::TRACE_FORK;
+        types |= 1ULL << s2e::plugins::TRACE_SOLVER_QUERY;
+    }
+    return types;
+}
+
+struct ProfileJob {
+    //Trace files [first, last) whose forks are counted by this job
+    unsigned first, last;
+
+    Library binaries;
+    LogParser *parser;
+    ModuleCache *mc;
+    ForkProfiler *fp;
+};
+
+//Each job reads the module loads of all the traces, because
+//a trace may fork from modules loaded in an earlier one
+void *profileWorker(void *opaque)
+{
+    ProfileJob *job = (ProfileJob*) opaque;
+
+    job->parser = new LogParser();
+    job->mc = new ModuleCache(job->parser);
+    job->fp = new ForkProfiler(&job->binaries, job->mc, job->parser);
+    job->fp->setStreaming(true);
+    job->fp->setWindows(windowLength(), false, LogDir);
+
+    for (unsigned i = 0; i < TraceFiles.size(); ++i) {
+        bool own = i >= job->first && i < job->last;
+        job->parser->setTypeFilter(streamTypes(own));
+        if (!job->parser->parse(TraceFiles[i]) && own) {
+            std::cerr << TraceFiles[i] << " is incomplete" << std::endl;
+        }
+    }
+
+    return NULL;
+}
+
+void parallelProfile(unsigned jobCount)
+{
+    if (jobCount > TraceFiles.size()) {
+        jobCount = TraceFiles.size();
+    }
+
+    ProfileJob *jobs = new ProfileJob[jobCount];
+    std::vector<pthread_t> threads(jobCount);
+
+    unsigned perJob = (TraceFiles.size() + jobCount - 1) / jobCount;
+    for (unsigned i = 0; i < jobCount; ++i) {
+        jobs[i].first = std::min<unsigned>(i * perJob, TraceFiles.size());
+        jobs[i].last = std::min<unsigned>((i + 1) * perJob, TraceFiles.size());
+        jobs[i].binaries.setPaths(ModDir);
+
+        if (pthread_create(&threads[i], NULL, profileWorker, &jobs[i])) {
+            std::cerr << "Could not create profiling thread" << std::endl;
+            exit(-1);
+        }
+    }
+
+    for (unsigned i = 0; i < jobCount; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ForkProfiler *fp = jobs[0].fp;
+    for (unsigned i = 1; i < jobCount; ++i) {
+        fp->merge(*jobs[i].fp);
+    }
+
+    fp->outputProfile(LogDir);
+    fp->outputWindows();
+
+    for (unsigned i = 0; i < jobCount; ++i) {
+        delete jobs[i].fp;
+        delete jobs[i].mc;
+        delete jobs[i].parser;
+    }
+    delete [] jobs;
+}
+
+}
+
 int main(int argc, char **argv)
 {
     cl::ParseCommandLineOptions(argc, (char**) argv, " debugger");
 
+    if (Jobs > 1 && TraceFiles.size() > 1) {
+        parallelProfile(Jobs);
+        return 0;
+    }
+
     Library library;
     library.setPaths(ModDir);
 
     LogParser parser;
+
+    if (Stream || Jobs > 1) {
+        //Items are processed in the order of the trace, so windows
+        //can be written as they close when there is a single trace
+        parser.setTypeFilter(streamTypes(true));
+        ModuleCache mc(&parser);
+        ForkProfiler fp(&library, &mc, &parser);
+        fp.setStreaming(true);
+        fp.setWindows(windowLength(), TraceFiles.size() == 1, LogDir);
+
+        parser.parse(TraceFiles);
+
+        fp.outputProfile(LogDir);
+        fp.outputWindows();
+        return 0;
+    }
+
     PathBuilder pb(&parser);
     parser.parse(TraceFiles);
 
     ModuleCache mc(&pb);
     ForkProfiler fp(&library, &mc, &pb);
+    fp.setWindows(windowLength(), false, LogDir);
 
     pb.processTree();
 
     fp.outputProfile(LogDir);
     fp.outputGraph(LogDir);
+    fp.outputWindows();
 
     return 0;
 }
@@ -60,7 +60,10 @@ public:
 
     struct ForkPoint {
         uint64_t pc, pid;
-        uint64_t count;
+        //Not part of the ordering, can be updated in place
+        mutable uint64_t count;
+        //Solver queries issued at this point and their time in microseconds
+        mutable uint64_t queryCount, queryTime;
         uint64_t line;
         std::string file, function, module;
         uint64_t loadbase, imagebase;
@@ -88,9 +91,22 @@ public:
         }
     };
 
+    struct ForkPointByQueryTime {
+        bool operator()(const ForkPoint &fp1, const ForkPoint &fp2) const {
+            if (fp1.queryTime == fp2.queryTime) {
+                return ForkPoint()(fp1, fp2);
+            }else {
+                return fp1.queryTime < fp2.queryTime;
+            }
+        }
+    };
+
     typedef std::vector<Fork> ForkList;
     typedef std::set<ForkPoint, ForkPoint> ForkPoints;
     typedef std::set<ForkPoint, ForkPointByCount> ForkPointsByCount;
+
+    //Fork points of each time window, by window number
+    typedef std::map<uint64_t, ForkPoints> Windows;
 private:
     LogEvents *m_events;
     ModuleCache *m_cache;
@@ -100,16 +116,48 @@ private:
     ForkList m_forks;
     ForkPoints m_forkPoints;
 
+    //Program counters that issued solver queries
+    ForkPoints m_queryPoints;
+
+    //Only count the forks, do not record the state graph
+    bool m_streaming;
+
+    //Length of a window in microseconds, 0 if disabled
+    uint64_t m_windowLength;
+
+    //Write each window as soon as a later one starts,
+    //requires chronological items
+    bool m_liveWindows;
+    std::string m_windowDir;
+    Windows m_windows;
+    bool m_hasFirstWindow;
+    uint64_t m_firstWindow;
+
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
                 void *item);
 
+    ForkPoints::iterator getPoint(ForkPoints &points,
+            const s2e::plugins::ExecutionTraceItemHeader &hdr,
+            uint64_t pc);
+
     void doProfile(
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             const s2e::plugins::ExecutionTraceFork *te);
+    void doQueryProfile(
+            const s2e::plugins::ExecutionTraceItemHeader &hdr,
+            const s2e::plugins::ExecutionTraceSolverQuery *te);
     void doGraph(
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             const s2e::plugins::ExecutionTraceFork *te);
+    void doWindow(
+            const s2e::plugins::ExecutionTraceItemHeader &hdr,
+            const ForkPoint &fp);
+
+    static void mergePoints(ForkPoints &dest, const ForkPoints &src);
+    void writeProfile(const ForkPoints &points, const std::string &fileName) const;
+    void writeQueryProfile(const std::string &fileName) const;
+    void flushWindows(uint64_t before);
 
 public:
     ForkProfiler(Library *lib, ModuleCache *cache, LogEvents *events);
@@ -117,8 +165,20 @@ public:
 
     void process();
 
+    void setStreaming(bool streaming) {
+        m_streaming = streaming;
+    }
+
+    //Also count the forks per period of the given length.
+    //Window n goes to path/forkprofile-n.txt, n=0 being the first window with a fork.
+    void setWindows(uint64_t lengthUsec, bool live, const std::string &path);
+
+    //Adds the counts of another profiler (e.g., one of another thread)
+    void merge(const ForkProfiler &other);
+
     void outputProfile(const std::string &path) const;
     void outputGraph(const std::string &path) const;
+    void outputWindows();
 };
 
 }
@@ -0,0 +1,370 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+
+#define __STDC_FORMAT_MACROS 1
+
+#include "llvm/Support/CommandLine.h"
+
+#include <lib/BinaryReaders/BFDInterface.h>
+
+#include <s2e/Plugins/ExecutionTracers/TraceEntries.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cxxabi.h>
+#include <ostream>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <inttypes.h>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+using namespace s2etools;
+using namespace s2e::plugins;
+
+
+namespace {
+
+cl::opt<std::string>
+    ProfileFile("profile", cl::desc("Profile written by the HostProfiler plugin"),
+                cl::init("hostprofile.dat"));
+
+cl::opt<std::string>
+    MapsFile("maps", cl::desc("Host memory map of the profiled process (default: next to the profile)"),
+             cl::init(""));
+
+cl::opt<std::string>
+    LogDir("outputdir", cl::desc("Store the flame graph input into the given folder"), cl::init("."));
+
+cl::list<std::string>
+    GuestModules("guest-module", cl::desc("Symbolize guest pcs with the binary loaded at the given "
+                                          "address, path@0xLoadBase"));
+
+cl::opt<bool>
+    GroupByGuestPc("by-guest-pc", cl::desc("Put the guest function or pc below the host stacks"),
+                   cl::init(false));
+
+cl::opt<bool>
+    GroupByState("by-state", cl::desc("Put the state id below the host stacks"),
+                 cl::init(false));
+
+}
+
+static const char *s_modeNames[] = {
+    "Concrete", "Symbolic", "Solver", "StateSwitch"
+};
+
+struct Mapping {
+    uint64_t start, end, offset;
+    std::string path;
+};
+
+struct GuestModule {
+    uint64_t loadBase;
+    BFDInterface *bfd;
+};
+
+class Symbolizer {
+    std::vector<Mapping> m_mappings;
+    std::map<std::string, BFDInterface*> m_binaries;
+    std::map<uint64_t, std::string> m_hostCache;
+
+    std::vector<GuestModule> m_guestModules;
+    std::map<uint64_t, std::string> m_guestCache;
+
+    //Frame names must not contain the separator of the folded format
+    static std::string sanitize(const std::string &name) {
+        std::string ret = name;
+        std::replace(ret.begin(), ret.end(), ';', ':');
+        return ret;
+    }
+
+    static std::string demangle(const std::string &name) {
+        int status;
+        char *d = abi::__cxa_demangle(name.c_str(), NULL, NULL, &status);
+        if (!d) {
+            return name;
+        }
+        std::string ret(d);
+        free(d);
+        return ret;
+    }
+
+    BFDInterface *getBinary(const std::string &path) {
+        std::map<std::string, BFDInterface*>::iterator it = m_binaries.find(path);
+        if (it != m_binaries.end()) {
+            return (*it).second;
+        }
+
+        BFDInterface *bfd = new BFDInterface(path, false);
+        if (!bfd->initialize()) {
+            delete bfd;
+            bfd = NULL;
+        }
+        m_binaries[path] = bfd;
+        return bfd;
+    }
+
+public:
+    bool loadMaps(const std::string &fileName) {
+        std::ifstream in(fileName.c_str());
+        if (!in) {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(in, line)) {
+            Mapping m;
+            char perms[8], path[1024];
+            unsigned long long start, end, offset;
+            path[0] = 0;
+            if (sscanf(line.c_str(), "%llx-%llx %7s %llx %*s %*s %1023s",
+                       &start, &end, perms, &offset, path) < 4) {
+                continue;
+            }
+
+            if (perms[2] != 'x' || path[0] != '/') {
+                continue;
+            }
+
+            m.start = start;
+            m.end = end;
+            m.offset = offset;
+            m.path = path;
+            m_mappings.push_back(m);
+        }
+        return true;
+    }
+
+    bool addGuestModule(const std::string &spec) {
+        size_t at = spec.rfind('@');
+        if (at == std::string::npos) {
+            return false;
+        }
+
+        GuestModule m;
+        m.loadBase = strtoull(spec.substr(at + 1).c_str(), NULL, 0);
+        m.bfd = getBinary(spec.substr(0, at));
+        if (!m.bfd) {
+            return false;
+        }
+        m_guestModules.push_back(m);
+        return true;
+    }
+
+    //Return addresses point after the call, look up the call itself
+    const std::string &getHostFrame(uint64_t address, bool isReturnAddress) {
+        uint64_t lookup = isReturnAddress ? address - 1 : address;
+
+        std::map<uint64_t, std::string>::iterator it = m_hostCache.find(lookup);
+        if (it != m_hostCache.end()) {
+            return (*it).second;
+        }
+
+        std::stringstream ss;
+        ss << "0x" << std::hex << address;
+
+        for (unsigned i = 0; i < m_mappings.size(); ++i) {
+            const Mapping &m = m_mappings[i];
+            if (lookup < m.start || lookup >= m.end) {
+                continue;
+            }
+
+            BFDInterface *bfd = getBinary(m.path);
+            std::string source, function;
+            uint64_t line;
+
+            if (bfd && bfd->getInfo(lookup - m.start + m.offset + bfd->getImageBase(),
+                                    source, line, function)) {
+                ss.str(demangle(function));
+            } else {
+                size_t slash = m.path.rfind('/');
+                ss.str("");
+                ss << m.path.substr(slash + 1) << "+0x" << std::hex << (lookup - m.start + m.offset);
+            }
+            break;
+        }
+
+        return m_hostCache[lookup] = sanitize(ss.str());
+    }
+
+    const std::string &getGuestFrame(uint64_t pc) {
+        std::map<uint64_t, std::string>::iterator it = m_guestCache.find(pc);
+        if (it != m_guestCache.end()) {
+            return (*it).second;
+        }
+
+        std::stringstream ss;
+        ss << "guest:0x" << std::hex << pc;
+
+        for (unsigned i = 0; i < m_guestModules.size(); ++i) {
+            const GuestModule &m = m_guestModules[i];
+            uint64_t va = pc - m.loadBase + m.bfd->getImageBase();
+            if (pc < m.loadBase || va >= m.bfd->getImageBase() + m.bfd->getImageSize()) {
+                continue;
+            }
+
+            std::string source, function;
+            uint64_t line;
+            if (m.bfd->getInfo(va, source, line, function)) {
+                ss.str("guest:" + demangle(function));
+            }
+            break;
+        }
+
+        return m_guestCache[pc] = sanitize(ss.str());
+    }
+};
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, (char**) argv, " hostprof");
+
+    FILE *fp = fopen(ProfileFile.c_str(), "rb");
+    if (!fp) {
+        std::cerr << "Could not open " << ProfileFile << std::endl;
+        return -1;
+    }
+
+    HostProfileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, HOSTPROFILE_MAGIC, sizeof(hdr.magic)) || hdr.version != 1) {
+        std::cerr << ProfileFile << " is not a host profile" << std::endl;
+        return -1;
+    }
+
+    std::string maps = MapsFile;
+    if (maps.empty()) {
+        size_t slash = ProfileFile.rfind('/');
+        maps = slash == std::string::npos ? std::string("hostprofile.maps") :
+               ProfileFile.substr(0, slash + 1) + "hostprofile.maps";
+    }
+
+    Symbolizer symbolizer;
+    if (!symbolizer.loadMaps(maps)) {
+        std::cerr << "Could not read " << maps << ", host frames are not symbolized" << std::endl;
+    }
+
+    for (unsigned i = 0; i < GuestModules.size(); ++i) {
+        if (!symbolizer.addGuestModule(GuestModules[i])) {
+            std::cerr << "Could not load guest module " << GuestModules[i] << std::endl;
+            return -1;
+        }
+    }
+
+    //Folded stacks, from the root to the leaf
+    std::map<std::string, uint64_t> stacks;
+    std::map<uint64_t, uint64_t> guestPcs;
+    uint64_t modes[4] = {0, 0, 0, 0};
+    uint64_t sampleCount = 0;
+
+    union {
+        HostProfileSample sample;
+        uint8_t buffer[sizeof(HostProfileSample) + 256 * sizeof(uint64_t)];
+    } u;
+
+    while (fread(&u.sample, sizeof(HostProfileSample) - sizeof(uint64_t), 1, fp) == 1) {
+        HostProfileSample &s = u.sample;
+        unsigned frames = s.frameCount ? s.frameCount : 1;
+        if (fread(s.frames, sizeof(uint64_t), frames, fp) != frames) {
+            std::cerr << "Truncated profile" << std::endl;
+            break;
+        }
+
+        ++sampleCount;
+        unsigned mode = s.mode < 4 ? s.mode : 0;
+        ++modes[mode];
+        if (s.stateId != (uint32_t) -1) {
+            ++guestPcs[s.guestPc];
+        }
+
+        std::stringstream ss;
+        ss << s_modeNames[mode];
+
+        if (GroupByState) {
+            ss << ";state" << std::dec << (int) s.stateId;
+        }
+
+        if (GroupByGuestPc && s.stateId != (uint32_t) -1) {
+            ss << ";" << symbolizer.getGuestFrame(s.guestPc);
+        }
+
+        //The first frame is the interrupted instruction, the others return addresses
+        for (unsigned i = s.frameCount; i > 0; --i) {
+            ss << ";" << symbolizer.getHostFrame(s.frames[i - 1], i > 1);
+        }
+
+        ++stacks[ss.str()];
+    }
+    fclose(fp);
+
+    std::string foldedFileStr = LogDir + "/hostprof.folded";
+    std::ofstream folded(foldedFileStr.c_str());
+    std::map<std::string, uint64_t>::const_iterator sit;
+    for (sit = stacks.begin(); sit != stacks.end(); ++sit) {
+        folded << (*sit).first << " " << std::dec << (*sit).second << std::endl;
+    }
+
+    std::string summaryFileStr = LogDir + "/hostprof.log";
+    std::ofstream summary(summaryFileStr.c_str());
+
+    summary << "#Samples: " << sampleCount << " at " << hdr.frequency << " Hz" << std::endl;
+    for (unsigned i = 0; i < 4; ++i) {
+        summary << "#" << s_modeNames[i] << ": " << modes[i] << std::endl;
+    }
+
+    //Hottest guest pcs first
+    std::vector<std::pair<uint64_t, uint64_t> > sortedPcs;
+    std::map<uint64_t, uint64_t>::const_iterator pit;
+    for (pit = guestPcs.begin(); pit != guestPcs.end(); ++pit) {
+        sortedPcs.push_back(std::make_pair((*pit).second, (*pit).first));
+    }
+    std::sort(sortedPcs.rbegin(), sortedPcs.rend());
+
+    summary << "#Samples GuestPc Function" << std::endl;
+    for (unsigned i = 0; i < sortedPcs.size(); ++i) {
+        summary << std::dec << sortedPcs[i].first << " 0x" << std::hex << sortedPcs[i].second
+                << " " << symbolizer.getGuestFrame(sortedPcs[i].second) << std::endl;
+    }
+
+    std::cout << "Wrote " << foldedFileStr << ", render it with flamegraph.pl" << std::endl;
+    return 0;
+}
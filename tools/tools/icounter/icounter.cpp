@@ -71,6 +71,9 @@ cl::opt<std::string>
 cl::list<std::string>
     ModPath("modpath", cl::desc("Path to modules"));
 
+cl::opt<bool>
+    PerModule("per-module", cl::desc("Sum the instructions of all states per module in a single pass"), cl::init(false));
+
 }
 
 
@@ -120,6 +123,28 @@ int main(int argc, char **argv)
     library.setPaths(ModPath);
 
     LogParser parser;
+
+    if (PerModule) {
+        //Streams the trace, the execution tree is not needed
+        ModuleInstructionCounter counter(&parser);
+        parser.parse(TraceFiles);
+
+        std::string outFileStr = LogDir + "/icount-modules.log";
+        std::ofstream outFile(outFileStr.c_str());
+
+        outFile << "#Module ICount" << std::endl;
+
+        const ModuleInstructionCounter::ModuleCounts &counts = counter.getCounts();
+        ModuleInstructionCounter::ModuleCounts::const_iterator it;
+        for (it = counts.begin(); it != counts.end(); ++it) {
+            const std::string &name = (*it).first;
+            outFile << (name.empty() ? "<unknown>" : name) << " "
+                    << std::dec << (*it).second << std::endl;
+        }
+
+        return 0;
+    }
+
     PathBuilder pb(&parser);
     parser.parse(TraceFiles);
 
@@ -105,6 +105,8 @@ void CacheProfiler::onItem(unsigned traceIndex,
 
         CacheProfilerState *state = static_cast<CacheProfilerState*>(m_Events->getState(this, &CacheProfilerState::factory));
         state->processCacheItem(this, hdr.pid, se);
+    }else if (e->type == s2e::plugins::CACHE_ACCESSES) {
+        //Raw accesses are only used by the replay mode of cacheprof
     }else {
         assert(false && "Unknown cache trace entry");
     }
@@ -0,0 +1,157 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "MemoryHeatmap.h"
+
+using namespace s2e::plugins;
+
+namespace s2etools
+{
+
+MemoryHeatmap::MemoryHeatmap(LogEvents *events, ModuleCache *mc)
+{
+    m_events = events;
+    m_mc = mc;
+    m_perState = false;
+    m_pageSize = 0;
+    m_connection = events->onEachItem.connect(
+            sigc::mem_fun(*this, &MemoryHeatmap::onItem));
+}
+
+MemoryHeatmap::~MemoryHeatmap()
+{
+    m_connection.disconnect();
+}
+
+void MemoryHeatmap::onItem(unsigned traceIndex,
+        const s2e::plugins::ExecutionTraceItemHeader &hdr,
+        void *item)
+{
+    if (hdr.type != s2e::plugins::TRACE_MEMORY_HEATMAP) {
+        return;
+    }
+
+    const ExecutionTraceMemoryHeatmap *heatmap = (const ExecutionTraceMemoryHeatmap*) item;
+    const unsigned headerSize = sizeof(ExecutionTraceMemoryHeatmap) - sizeof(ExecutionTraceMemoryHeatmapEntry);
+    if (hdr.size < headerSize || !heatmap->count ||
+        hdr.size < headerSize + (uint64_t) heatmap->count * sizeof(ExecutionTraceMemoryHeatmapEntry)) {
+        std::cerr << "Truncated heatmap item " << traceIndex << std::endl;
+        return;
+    }
+
+    m_pageSize = heatmap->pageSize;
+
+    ModuleCacheState *mcs = static_cast<ModuleCacheState*>(m_events->getState(m_mc, &ModuleCacheState::factory));
+
+    for (unsigned i = 0; i < heatmap->count; ++i) {
+        const ExecutionTraceMemoryHeatmapEntry &e = heatmap->entries[i];
+
+        const ModuleInstance *mi = e.moduleBase ? mcs->getInstance(e.pid, e.moduleBase) : NULL;
+        std::string module = mi ? mi->Name : "<unknown>";
+        if (!m_filteredModule.empty() && module != m_filteredModule) {
+            continue;
+        }
+
+        PageKey key;
+        key.stateId = m_perState ? hdr.stateId : 0;
+        key.pid = e.pid;
+        key.page = e.page;
+        key.module = module;
+
+        Counts &page = m_pages[key];
+        Counts &total = m_modules[module];
+        if (!page.total()) {
+            page.pages = 1;
+            ++total.pages;
+        }
+
+        page.reads += e.reads;
+        page.writes += e.writes;
+        total.reads += e.reads;
+        total.writes += e.writes;
+    }
+}
+
+struct SortByTotal {
+    bool operator()(const MemoryHeatmap::PageCounts::const_iterator &a,
+                    const MemoryHeatmap::PageCounts::const_iterator &b) const {
+        if ((*a).second.total() != (*b).second.total()) {
+            return (*a).second.total() > (*b).second.total();
+        }
+        return (*a).first < (*b).first;
+    }
+};
+
+void MemoryHeatmap::print(std::ostream &os, unsigned limit) const
+{
+    os << "#Page size: " << std::dec << m_pageSize << std::endl;
+    os << "#Module Reads Writes Pages" << std::endl;
+
+    for (ModuleCounts::const_iterator it = m_modules.begin(); it != m_modules.end(); ++it) {
+        os << (*it).first << "\t" << (*it).second.reads << "\t"
+           << (*it).second.writes << "\t" << (*it).second.pages << std::endl;
+    }
+
+    std::vector<PageCounts::const_iterator> pages;
+    for (PageCounts::const_iterator it = m_pages.begin(); it != m_pages.end(); ++it) {
+        pages.push_back(it);
+    }
+    std::sort(pages.begin(), pages.end(), SortByTotal());
+
+    if (limit && pages.size() > limit) {
+        pages.resize(limit);
+    }
+
+    os << std::endl;
+    os << (m_perState ? "#State " : "") << "Pid Page Module Reads Writes" << std::endl;
+
+    for (std::vector<PageCounts::const_iterator>::const_iterator it = pages.begin();
+         it != pages.end(); ++it) {
+        const PageKey &key = (**it).first;
+        const Counts &counts = (**it).second;
+
+        if (m_perState) {
+            os << std::dec << key.stateId << "\t";
+        }
+        os << std::hex << "0x" << key.pid << "\t0x" << key.page << "\t" << key.module << "\t"
+           << std::dec << counts.reads << "\t" << counts.writes << std::endl;
+    }
+}
+
+}
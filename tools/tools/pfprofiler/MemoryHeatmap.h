@@ -0,0 +1,136 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+#ifndef S2ETOOLS_MEMORYHEATMAP_H
+#define S2ETOOLS_MEMORYHEATMAP_H
+
+#include <lib/ExecutionTracer/LogParser.h>
+#include <lib/ExecutionTracer/ModuleParser.h>
+
+#include <ostream>
+#include <string>
+#include <map>
+
+namespace s2etools
+{
+
+/**
+ *  Aggregates the TRACE_MEMORY_HEATMAP items written by MemoryTracer
+ *  in heatmap mode. Each item is counted once, even when it is on the
+ *  common prefix of several paths.
+ */
+class MemoryHeatmap
+{
+public:
+    struct Counts {
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t pages;
+
+        Counts() : reads(0), writes(0), pages(0) {}
+
+        uint64_t total() const {
+            return reads + writes;
+        }
+    };
+
+    struct PageKey {
+        uint32_t stateId;
+        uint64_t pid;
+        uint64_t page;
+        std::string module;
+
+        bool operator<(const PageKey &k) const {
+            if (stateId != k.stateId) {
+                return stateId < k.stateId;
+            }
+            if (pid != k.pid) {
+                return pid < k.pid;
+            }
+            if (page != k.page) {
+                return page < k.page;
+            }
+            return module < k.module;
+        }
+    };
+
+    typedef std::map<PageKey, Counts> PageCounts;
+    typedef std::map<std::string, Counts> ModuleCounts;
+
+private:
+    sigc::connection m_connection;
+    LogEvents *m_events;
+    ModuleCache *m_mc;
+
+    bool m_perState;
+    std::string m_filteredModule;
+    uint32_t m_pageSize;
+
+    PageCounts m_pages;
+    ModuleCounts m_modules;
+
+    void onItem(unsigned traceIndex,
+                const s2e::plugins::ExecutionTraceItemHeader &hdr,
+                void *item);
+
+public:
+    MemoryHeatmap(LogEvents *events, ModuleCache *mc);
+    ~MemoryHeatmap();
+
+    /** Keep the counts of each state apart instead of summing them */
+    void setPerState(bool perState) {
+        m_perState = perState;
+    }
+
+    /** Only count the accesses made by the code of the given module */
+    void setFilteredModule(const std::string &module) {
+        m_filteredModule = module;
+    }
+
+    const PageCounts &getPages() const {
+        return m_pages;
+    }
+
+    const ModuleCounts &getModules() const {
+        return m_modules;
+    }
+
+    /** Prints the modules, then at most limit pages (all if 0), hottest first */
+    void print(std::ostream &os, unsigned limit) const;
+};
+
+}
+
+#endif
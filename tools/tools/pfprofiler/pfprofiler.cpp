@@ -54,6 +54,7 @@
 
 #include "pfprofiler.h"
 #include "CacheProfiler.h"
+#include "MemoryHeatmap.h"
 
 #include <malloc.h>
 
@@ -79,7 +80,7 @@ cl::opt<std::string>
 std::vector<std::string> ModList;
 
 cl::opt<std::string>
-        AnaType("type", cl::desc("Type of analysis (cache/aggregated)"), cl::init("cache"));
+        AnaType("type", cl::desc("Type of analysis (cache/aggregated/heatmap)"), cl::init("cache"));
 
 cl::opt<bool>
         TerminatedPaths("termpath", cl::desc("Show paths that have a test case"), cl::init(true));
@@ -104,6 +105,14 @@ cl::opt<std::string>
         FilterModule("filtermodule", cl::desc("Report data for the specified modules (for tracers that collect system-wide data)"),
                         cl::init(""));
 
+cl::opt<bool>
+        HmPerState("hmperstate", cl::desc("Heatmap: report the pages of each state separately"),
+                        cl::init(false));
+
+cl::opt<unsigned>
+        HmLimit("hmlimit", cl::desc("Heatmap: number of pages to report, hottest first (0 for all)"),
+                        cl::init(100));
+
 cl::opt<std::string>
         CpOutFile("cpoutfile", cl::desc("CacheProfiler: output file"),
                         cl::init("stats.dat"));
@@ -204,6 +213,39 @@ void PfProfiler::extractAggregatedData()
     }
 }
 
+void PfProfiler::extractHeatmap()
+{
+    std::ofstream statsFile;
+    std::string sFile = OutDir + "/heatmap.stats";
+    statsFile.open(sFile.c_str());
+
+    if (FilterModule.size() > 0) {
+        statsFile << "#Accesses made by module " << FilterModule << std::endl;
+    }
+
+    //The heatmap items are small, skip the rest of the trace
+    m_Parser.setTypeFilter((1ULL << s2e::plugins::TRACE_MOD_LOAD) |
+                           (1ULL << s2e::plugins::TRACE_MOD_UNLOAD) |
+                           (1ULL << s2e::plugins::TRACE_PROC_UNLOAD) |
+                           (1ULL << s2e::plugins::TRACE_FORK) |
+                           (1ULL << s2e::plugins::TRACE_MEMORY_HEATMAP));
+
+    PathBuilder pb(&m_Parser);
+    m_Parser.parse(m_FileName);
+
+    ModuleCache mc(&pb);
+    MemoryHeatmap hm(&pb, &mc);
+
+    hm.setPerState(HmPerState);
+    if (FilterModule.size() > 0) {
+        hm.setFilteredModule(FilterModule);
+    }
+
+    pb.processTree();
+
+    hm.print(statsFile, HmLimit);
+}
+
 void PfProfiler::process()
 {
     uint64_t maxMissCount=0, maxMissPath=0;
@@ -338,6 +380,9 @@ int main(int argc, char **argv)
     }else if (AnaType == "aggregated") {
        PfProfiler pf(TraceFile.getValue());
        pf.extractAggregatedData();
+   }else if (AnaType == "heatmap") {
+       PfProfiler pf(TraceFile.getValue());
+       pf.extractHeatmap();
    }else {
        std::cout << "Unknown analysis type " << AnaType << std::endl;
    }
@@ -65,6 +65,7 @@ public:
 
     void process();
     void extractAggregatedData();
+    void extractHeatmap();
 };
 
 }
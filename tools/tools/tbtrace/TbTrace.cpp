@@ -42,9 +42,11 @@
 #include <iomanip>
 #include <fstream>
 #include <sstream>
+#include <pthread.h>
 
 #include <lib/ExecutionTracer/ModuleParser.h>
 #include <lib/ExecutionTracer/Path.h>
+#include <lib/ExecutionTracer/PathIndex.h>
 #include <lib/ExecutionTracer/TestCase.h>
 #include <lib/ExecutionTracer/PageFault.h>
 #include <lib/ExecutionTracer/InstructionCounter.h>
@@ -93,94 +95,64 @@ cl::opt<bool>
 cl::opt<bool>
         PrintMemoryCheckerStack("printMemoryCheckerStack", cl::desc("Print stack grants/revocations. Requires the MemoryChecker plugin."), cl::init(false));
 
+cl::opt<std::string>
+        PathIndexFile("pathIndex", cl::desc("Fork tree index of the traces, built on first use. Avoids rebuilding the execution tree for each run."), cl::init(""));
+
+cl::opt<unsigned>
+        Jobs("jobs", cl::desc("Number of paths rendered at the same time. Uses a path index, in the output directory if -pathIndex is not set."), cl::init(1));
+
 
 }
 
 namespace s2etools
 {
 
-TbTrace::TbTrace(Library *lib, ModuleCache *cache, LogEvents *events, std::ofstream &of)
-    :m_output(of)
+TbTraceModules::TbTraceModules(Library *library)
 {
-    m_events = events;
-    m_connection = events->onEachItem.connect(
-            sigc::mem_fun(*this, &TbTrace::onItem)
-            );
-    m_cache = cache;
-    m_library = lib;
-    m_hasItems = false;
-    m_hasDebugInfo = false;
-    m_hasModuleInfo = false;
+    m_library = library;
+    pthread_mutex_init(&m_lock, NULL);
 }
 
-TbTrace::~TbTrace()
+TbTraceModules::~TbTraceModules()
 {
-    m_connection.disconnect();
-}
-
-bool TbTrace::parseDisassembly(const std::string &listingFile, Disassembly &out)
-{
-    //Get the module name
-    llvm::sys::Path listingFilePath(listingFile);
-    std::string moduleName = llvm::sys::path::stem(listingFilePath.str());
-
-    bool added = false;
-
-    char line[1024];
-    std::filebuf file;
-    if (!file.open(listingFile.c_str(), std::ios::in)) {
-        return false;
+    Disassembly::iterator it;
+    for (it = m_disassembly.begin(); it != m_disassembly.end(); ++it) {
+        delete (*it).second;
     }
-
-    std::istream is(&file);
-
-    while(is.getline(line, sizeof(line))) {
-        std::string ln = line;
-        //Skip the start
-        unsigned i=0;
-        while (line[i] && (line[i]!=':'))
-            ++i;
-        if (line[i] != ':')
-            continue;
-
-        ++i;
-        //Grab the address
-        std::string strpc;
-        while(isxdigit(line[i])) {
-            strpc = strpc + line[i];
-            ++i;
-        }
-
-        uint64_t pc=0;
-        sscanf(strpc.c_str(), "%"PRIx64, &pc);
-        if (pc) {
-            out[moduleName][pc].push_back(ln);
-            added = true;
-        }
-    }
-
-    return added;
+    pthread_mutex_destroy(&m_lock);
 }
 
-void TbTrace::printDisassembly(const std::string &module, uint64_t relPc, unsigned tbSize)
+const DisassemblyIndex *TbTraceModules::getDisassembly(const std::string &module)
 {
+    lock();
+
     Disassembly::iterator it = m_disassembly.find(module);
     if (it == m_disassembly.end()) {
+        DisassemblyIndex *index = NULL;
         llvm::sys::Path disassemblyListing;
         if (!m_library->findDisassemblyListing(module, disassemblyListing)) {
             std::cerr << "Could not find disassembly listing for module "
                          << module << std::endl;
-            return;
+        } else {
+            index = new DisassemblyIndex();
+            if (!index->open(disassemblyListing.str())) {
+                delete index;
+                index = NULL;
+            }
         }
 
-        if (!parseDisassembly(disassemblyListing.str(), m_disassembly)) {
-            return;
-        }
-        it = m_disassembly.find(module);
-        assert(it != m_disassembly.end());
+        //Do not look for a missing listing again
+        it = m_disassembly.insert(std::make_pair(module, index)).first;
     }
 
-    //Fetch the basic blocks for our module
+    unlock();
+    return (*it).second;
+}
+
+const TbTraceModules::TbTraceBbs &TbTraceModules::getBasicBlocks(const std::string &module)
+{
+    lock();
+
     ModuleBasicBlocks::iterator bbit = m_basicBlocks.find(module);
     if (bbit == m_basicBlocks.end()) {
         llvm::sys::Path basicBlockList;
@@ -204,13 +176,56 @@ void TbTrace::printDisassembly(const std::string &module, uint64_t relPc, unsign
         assert(bbit != m_basicBlocks.end());
     }
 
+    unlock();
+    return (*bbit).second;
+}
+
+//BFD is not thread-safe
+bool TbTraceModules::getInfo(const ModuleInstance *mi, uint64_t pc, std::string &file,
+                             uint64_t &line, std::string &function)
+{
+    lock();
+    bool ret = m_library->getInfo(mi, pc, file, line, function);
+    unlock();
+    return ret;
+}
+
+TbTrace::TbTrace(TbTraceModules *modules, TbTrace::DebugInfoCache &debugInfoCache,
+                 ModuleCache *cache, LogEvents *events, std::ofstream &of)
+    :m_debugInfoCache(debugInfoCache), m_output(of)
+{
+    m_events = events;
+    m_connection = events->onEachItem.connect(
+            sigc::mem_fun(*this, &TbTrace::onItem)
+            );
+    m_cache = cache;
+    m_modules = modules;
+    m_hasItems = false;
+    m_hasDebugInfo = false;
+    m_hasModuleInfo = false;
+}
+
+TbTrace::~TbTrace()
+{
+    m_connection.disconnect();
+}
+
+void TbTrace::printDisassembly(std::ostream &os, const std::string &module, uint64_t relPc, unsigned tbSize)
+{
+    const DisassemblyIndex *disassembly = m_modules->getDisassembly(module);
+    if (!disassembly) {
+        return;
+    }
+
+    //Fetch the basic blocks for our module
+    const TbTraceModules::TbTraceBbs &bbs = m_modules->getBasicBlocks(module);
 
     while((int)tbSize > 0) {
         //Fetch the right basic block
         BasicBlock bbToFetch(relPc, 1);
-        TbTraceBbs::iterator mybb = (*bbit).second.find(bbToFetch);
-        if (mybb == (*bbit).second.end()) {
-            m_output << "Could not find basic block 0x" << std::hex << relPc << " in the list" << std::endl;
+        TbTraceModules::TbTraceBbs::const_iterator mybb = bbs.find(bbToFetch);
+        if (mybb == bbs.end()) {
+            os << "Could not find basic block 0x" << std::hex << relPc << " in the list" << std::endl;
             return;
         }
 
@@ -229,20 +244,19 @@ void TbTrace::printDisassembly(const std::string &module, uint64_t relPc, unsign
         assert(relPc >= bb.start && relPc < bb.start + bb.size);
 
 
-        //Grab the vector of strings for the program counter
-        ModuleDisassembly::iterator modIt = (*it).second.find(asmStartPc);
-        if (modIt == (*it).second.end()) {
+        //Grab the lines for the program counter
+        const DisassemblyIndex::Entry *entry = disassembly->lowerBound(asmStartPc);
+        if (entry == disassembly->end() || entry->pc != asmStartPc) {
             return;
         }
 
         //Fetch the range of program counters from the disassembly file
-        ModuleDisassembly::iterator modItEnd = (*it).second.lower_bound(asmEndPc);
-
-        for (ModuleDisassembly::iterator it = modIt; it != modItEnd; ++it) {
-            //Print the vector we've got
-            for(DisassemblyEntry::const_iterator asmIt = (*it).second.begin();
-                asmIt != (*it).second.end(); ++asmIt) {
-                m_output << "\033[1;33m" << *asmIt << "\033[0m" << std::endl;
+        for (; entry != disassembly->end() && entry->pc < asmEndPc; ++entry) {
+            llvm::StringRef text = disassembly->getText(entry);
+            while (!text.empty()) {
+                std::pair<llvm::StringRef, llvm::StringRef> line = text.split('\n');
+                os << "\033[1;33m" << line.first.str() << "\033[0m" << std::endl;
+                text = line.second;
             }
         }
 
@@ -263,31 +277,58 @@ void TbTrace::printDebugInfo(uint64_t pid, uint64_t pc, unsigned tbSize, bool pr
     if (!mi) {
         return;
     }
-    uint64_t relPc = pc - mi->LoadBase + mi->ImageBase;
-    m_output << std::hex << "(" << mi->Name;
-    if (relPc != pc) {
-       m_output << " 0x" << relPc;
-    }
-    m_output << ")";
 
     m_hasModuleInfo = true;
 
-    std::string file = "?", function="?";
-    uint64_t line=0;
-    if (m_library->getInfo(mi, pc, file, line, function)) {
-        size_t pos = file.find_last_of('/');
-	if (pos != std::string::npos) {
-            file = file.substr(pos+1);
+    DebugInfoKey key;
+    key.module = mi->Name;
+    key.loadBase = mi->LoadBase;
+    key.pc = pc;
+    key.tbSize = tbSize;
+    key.printListing = PrintDisassembly && printListing;
+
+    DebugInfoCache::iterator it = m_debugInfoCache.find(key);
+    if (it == m_debugInfoCache.end()) {
+        std::ostringstream os;
+        bool hasDebugInfo = false;
+
+        uint64_t relPc = pc - mi->LoadBase + mi->ImageBase;
+        os << std::hex << "(" << mi->Name;
+        if (relPc != pc) {
+           os << " 0x" << relPc;
         }
+        os << ")";
+
+        std::string file = "?", function="?";
+        uint64_t line=0;
+        if (m_modules->getInfo(mi, pc, file, line, function)) {
+            size_t pos = file.find_last_of('/');
+            if (pos != std::string::npos) {
+                file = file.substr(pos+1);
+            }
 
-        m_output << " " << file << std::dec << ":" << line << " in " << function;
-        m_hasDebugInfo = true;
+            os << " " << file << std::dec << ":" << line << " in " << function;
+            hasDebugInfo = true;
+        }
+
+        if (key.printListing) {
+            os << std::endl;
+            printDisassembly(os, mi->Name, relPc, tbSize);
+        }
+
+        DebugInfoText &text = m_debugInfoCache[key];
+        text.text = os.str();
+        text.hasDebugInfo = hasDebugInfo;
+        it = m_debugInfoCache.find(key);
     }
 
-    if (PrintDisassembly && printListing) {
-        m_output << std::endl;
-        printDisassembly(mi->Name, relPc, tbSize);
+    m_output << (*it).second.text;
+    if ((*it).second.hasDebugInfo) {
+        m_hasDebugInfo = true;
     }
+
+    //The callers expect the base the text was printed with
+    m_output << ((*it).second.hasDebugInfo ? std::dec : std::hex);
 }
 
 void TbTrace::printRegisters(const s2e::plugins::ExecutionTraceTb *te)
@@ -448,7 +489,7 @@ void TbTrace::onItem(unsigned traceIndex,
     }
 }
 
-TbTraceTool::TbTraceTool()
+TbTraceTool::TbTraceTool() : m_modules(&m_binaries)
 {
     m_binaries.setPaths(ModDir);
 }
@@ -458,13 +499,174 @@ TbTraceTool::~TbTraceTool()
 
 }
 
+static void printPathWarnings(std::ofstream &traceFile, const TbTrace &trace,
+                              TestCaseState *tcs, unsigned pathId)
+{
+    traceFile << "----------------------" << std::endl;
+
+    if (trace.hasDebugInfo() == false) {
+        traceFile << "WARNING: No debug information for any module in the path " << std::dec << pathId << std::endl;
+        traceFile << "WARNING: Make sure you have set the module path properly and the binaries contain debug information."
+                << std::endl << std::endl;
+    }
+
+    if (trace.hasModuleInfo() == false) {
+        traceFile << "WARNING: No module information for any module in the path " << std::dec << pathId << std::endl;
+        traceFile << "WARNING: Make sure to use the ModuleTracer plugin before running this tool."
+                << std::endl << std::endl;
+    }
+
+    if (trace.hasItems() == false ) {
+        traceFile << "WARNING: No basic blocks in the path " << std::dec << pathId << std::endl;
+        traceFile << "WARNING: Make sure to use the TranslationBlockTracer plugin before running this tool. "
+                << std::endl << std::endl;
+    }
+
+    if (!tcs) {
+        traceFile << "WARNING: No test case in the path " << std::dec << pathId << std::endl;
+        traceFile << "WARNING: Make sure to use the TestCaseGenerator plugin and terminate the states before running this tool. "
+                << std::endl << std::endl;
+    }else {
+        tcs->printInputs(traceFile);
+    }
+}
+
+struct TbTraceTool::PathQueue {
+    pthread_mutex_t lock;
+    TbTraceTool *tool;
+    const PathIndex *index;
+    unsigned next;
+};
+
+void TbTraceTool::processIndexedPath(const PathIndex &index, unsigned pathId,
+                                     TbTrace::DebugInfoCache &debugInfoCache)
+{
+    TraceRanges ranges;
+    if (!index.getRanges(pathId, ranges)) {
+        std::cerr << "Could not find path with id " << std::dec <<
+                pathId << " in the execution trace." << std::endl;
+        return;
+    }
+
+    std::stringstream ss;
+    ss << LogDir << "/" << pathId << ".txt";
+    std::ofstream traceFile(ss.str().c_str());
+
+    LogParser parser;
+    ModuleCache mc(&parser);
+    TestCase tc(&parser);
+    TbTrace trace(&m_modules, debugInfoCache, &mc, &parser, traceFile);
+
+    if (!parser.parseRanges(TraceFiles, ranges)) {
+        std::cerr << "Could not process path " << std::dec << pathId << std::endl;
+        return;
+    }
+
+    TestCaseState *tcs = static_cast<TestCaseState*>(parser.getState(&tc, (uint32_t) 0));
+    printPathWarnings(traceFile, trace, tcs, pathId);
+}
+
+//Each thread renders whole paths into their own files
+void *TbTraceTool::pathWorker(void *opaque)
+{
+    PathQueue *queue = (PathQueue*) opaque;
+    TbTrace::DebugInfoCache debugInfoCache;
+
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        unsigned index = queue->next++;
+        if (index < PathList.size()) {
+            std::cout << "Processing path " << std::dec << PathList[index] << std::endl;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        if (index >= PathList.size()) {
+            break;
+        }
+        queue->tool->processIndexedPath(*queue->index, PathList[index], debugInfoCache);
+    }
+    return NULL;
+}
+
+bool TbTraceTool::indexedTrace(const std::string &indexFile)
+{
+    PathIndex index;
+
+    if (!index.open(indexFile, TraceFiles)) {
+        std::cout << "Building the path index " << indexFile << std::endl;
+
+        LogParser parser;
+        PathBuilder pb(&parser);
+        parser.parse(TraceFiles);
+
+        if (!PathIndex::build(parser, pb, TraceFiles, indexFile) ||
+            !index.open(indexFile, TraceFiles)) {
+            return false;
+        }
+    }
+
+    PathSet paths;
+    index.getPaths(paths);
+
+    if (PathList.empty()) {
+        PathSet::iterator pit;
+        for (pit = paths.begin(); pit != paths.end(); ++pit) {
+            PathList.push_back(*pit);
+        }
+    }
+
+    //Each path only reads its own items
+    PathQueue queue;
+    pthread_mutex_init(&queue.lock, NULL);
+    queue.tool = this;
+    queue.index = &index;
+    queue.next = 0;
+
+    unsigned threadCount = Jobs ? Jobs : 1;
+    if (threadCount > PathList.size()) {
+        threadCount = PathList.size();
+    }
+
+    if (threadCount <= 1) {
+        pathWorker(&queue);
+    } else {
+        std::vector<pthread_t> threads(threadCount);
+        for (unsigned i = 0; i < threadCount; ++i) {
+            if (pthread_create(&threads[i], NULL, pathWorker, &queue)) {
+                std::cerr << "Could not create path thread" << std::endl;
+                exit(-1);
+            }
+        }
+
+        for (unsigned i = 0; i < threadCount; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    pthread_mutex_destroy(&queue.lock);
+    return true;
+}
+
 void TbTraceTool::flatTrace()
 {
+    std::string indexFile = PathIndexFile;
+    if (indexFile.empty() && Jobs > 1) {
+        indexFile = LogDir + "/tbtrace.pathidx";
+    }
+
+    if (!indexFile.empty()) {
+        if (indexedTrace(indexFile)) {
+            return;
+        }
+        std::cerr << "Could not use the path index, processing the whole trace" << std::endl;
+    }
+
     PathBuilder pb(&m_parser);
     m_parser.parse(TraceFiles);
 
     ModuleCache mc(&pb);
     TestCase tc(&pb);
+    TbTrace::DebugInfoCache debugInfoCache;
 
     PathSet paths;
     pb.getPaths(paths);
@@ -493,41 +695,15 @@ void TbTraceTool::flatTrace()
         ss << LogDir << "/" << *listit << ".txt";
         std::ofstream traceFile(ss.str().c_str());
 
-        TbTrace trace(&m_binaries, &mc, &pb, traceFile);
+        TbTrace trace(&m_modules, debugInfoCache, &mc, &pb, traceFile);
 
         if (!pb.processPath(*listit)) {
             std::cerr << "Could not process path " << std::dec << *listit << std::endl;
             continue;
         }
 
-        traceFile << "----------------------" << std::endl;
-
-        if (trace.hasDebugInfo() == false) {
-            traceFile << "WARNING: No debug information for any module in the path " << std::dec << *listit << std::endl;
-            traceFile << "WARNING: Make sure you have set the module path properly and the binaries contain debug information."
-                    << std::endl << std::endl;
-        }
-
-        if (trace.hasModuleInfo() == false) {
-            traceFile << "WARNING: No module information for any module in the path " << std::dec << *listit << std::endl;
-            traceFile << "WARNING: Make sure to use the ModuleTracer plugin before running this tool."
-                    << std::endl << std::endl;
-        }
-
-        if (trace.hasItems() == false ) {
-            traceFile << "WARNING: No basic blocks in the path " << std::dec << *listit << std::endl;
-            traceFile << "WARNING: Make sure to use the TranslationBlockTracer plugin before running this tool. "
-                    << std::endl << std::endl;
-        }
-
         TestCaseState *tcs = static_cast<TestCaseState*>(pb.getState(&tc, *pit));
-        if (!tcs) {
-            traceFile << "WARNING: No test case in the path " << std::dec << *listit << std::endl;
-            traceFile << "WARNING: Make sure to use the TestCaseGenerator plugin and terminate the states before running this tool. "
-                    << std::endl << std::endl;
-        }else {
-            tcs->printInputs(traceFile);
-        }
+        printPathWarnings(traceFile, trace, tcs, *listit);
     }
 
 }
@@ -38,39 +38,91 @@
 
 #include <lib/ExecutionTracer/LogParser.h>
 #include <lib/ExecutionTracer/ModuleParser.h>
+#include <lib/ExecutionTracer/PathIndex.h>
 
 #include <ostream>
 #include <fstream>
+#include <map>
+#include <pthread.h>
 
 #include <lib/BinaryReaders/Library.h>
 #include <lib/Utils/BasicBlockListParser.h>
+#include <lib/Utils/DisassemblyIndex.h>
 
 namespace s2etools
 {
 
-class TbTrace
+/**
+ *  Binaries, disassembly listings and basic block lists of the modules.
+ *  Shared by the TbTrace instances of all the paths, which may render
+ *  paths in parallel. Loaded listings and block lists are never modified.
+ */
+class TbTraceModules
 {
 public:
-    //One program counter can have multiple lines of assembly code
-    typedef std::vector<std::string> DisassemblyEntry;
-
-    //Collects the entire assembly listing for a module
-    typedef std::map<uint64_t, DisassemblyEntry> ModuleDisassembly;
-
-    typedef std::map<std::string, ModuleDisassembly> Disassembly;
-
     //Convenient definition of basic blocks
     typedef BasicBlockListParser::BasicBlocks TbTraceBbs;
 
+private:
+    typedef std::map<std::string, DisassemblyIndex*> Disassembly;
+
     //Gathers all the basic blocks contained in a module
     typedef std::map<std::string, TbTraceBbs> ModuleBasicBlocks;
 
-private:
-    LogEvents *m_events;
-    ModuleCache *m_cache;
+    pthread_mutex_t m_lock;
     Library *m_library;
     Disassembly m_disassembly;
     ModuleBasicBlocks m_basicBlocks;
+
+public:
+    TbTraceModules(Library *library);
+    ~TbTraceModules();
+
+    //Returns NULL if the module has no listing
+    const DisassemblyIndex *getDisassembly(const std::string &module);
+    const TbTraceBbs &getBasicBlocks(const std::string &module);
+
+    bool getInfo(const ModuleInstance *mi, uint64_t pc, std::string &file,
+                 uint64_t &line, std::string &function);
+
+    void lock() { pthread_mutex_lock(&m_lock); }
+    void unlock() { pthread_mutex_unlock(&m_lock); }
+};
+
+class TbTrace
+{
+public:
+    //Text printed for a program counter by printDebugInfo
+    struct DebugInfoKey {
+        std::string module;
+        uint64_t loadBase;
+        uint64_t pc;
+        unsigned tbSize;
+        bool printListing;
+
+        bool operator<(const DebugInfoKey &k) const {
+            if (pc != k.pc) return pc < k.pc;
+            if (loadBase != k.loadBase) return loadBase < k.loadBase;
+            if (tbSize != k.tbSize) return tbSize < k.tbSize;
+            if (printListing != k.printListing) return printListing < k.printListing;
+            return module < k.module;
+        }
+    };
+
+    struct DebugInfoText {
+        std::string text;
+        bool hasDebugInfo;
+    };
+
+    //Memoizes the text of the blocks that run repeatedly,
+    //can be reused by the TbTrace instances of one thread
+    typedef std::map<DebugInfoKey, DebugInfoText> DebugInfoCache;
+
+private:
+    LogEvents *m_events;
+    ModuleCache *m_cache;
+    TbTraceModules *m_modules;
+    DebugInfoCache &m_debugInfoCache;
     std::ofstream &m_output;
 
     sigc::connection m_connection;
@@ -83,14 +135,14 @@ private:
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
                 void *item);
 
-    bool parseDisassembly(const std::string &listingFile, Disassembly &out);
-    void printDisassembly(const std::string &module, uint64_t relPc, unsigned tbSize);
+    void printDisassembly(std::ostream &os, const std::string &module, uint64_t relPc, unsigned tbSize);
 
     void printDebugInfo(uint64_t pid, uint64_t pc, unsigned tbSize, bool printListing);
     void printRegisters(const s2e::plugins::ExecutionTraceTb *te);
     void printMemoryChecker(const s2e::plugins::ExecutionTraceMemChecker::Serialized *item);
 public:
-    TbTrace(Library *lib, ModuleCache *cache, LogEvents *events, std::ofstream &ofs);
+    TbTrace(TbTraceModules *modules, TbTrace::DebugInfoCache &debugInfoCache,
+            ModuleCache *cache, LogEvents *events, std::ofstream &ofs);
     virtual ~TbTrace();
 
     void outputTraces(const std::string &Path) const;
@@ -114,6 +166,12 @@ private:
     LogParser m_parser;
 
     Library m_binaries;
+    TbTraceModules m_modules;
+
+    struct PathQueue;
+    static void *pathWorker(void *opaque);
+    void processIndexedPath(const PathIndex &index, unsigned pathId,
+                            TbTrace::DebugInfoCache &debugInfoCache);
 
 public:
     TbTraceTool();
@@ -121,6 +179,9 @@ public:
 
     void process();
     void flatTrace();
+
+    //Processes the paths with the help of a PathIndex
+    bool indexedTrace(const std::string &indexFile);
 };
 
 
@@ -0,0 +1,364 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in the S2E-AUTHORS file.
+ */
+
+/**
+ *  Replays test cases in an S2E server started with -s2e-server.
+ *  Each test case runs as a job in its own output folder,
+ *  with BaseInstructions writing its inputs instead of symbolic values.
+ *  At most -jobs test cases are submitted at a time.
+ *  With -seed, the inputs are the initial values of the concolic data
+ *  and each job explores the paths around its test case.
+ *
+ *  The traces of the jobs are listed in traces.rsp, in the output folder.
+ *  Pass @traces.rsp to the coverage tool to merge them.
+ */
+
+#include "llvm/Support/CommandLine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+cl::opt<std::string>
+    Server("server", cl::desc("Unix socket of the S2E server"), cl::init(""));
+
+cl::opt<std::string>
+    OutputDir("outputdir", cl::desc("Folder where the jobs store their results"), cl::init("."));
+
+cl::opt<unsigned>
+    Jobs("jobs", cl::desc("Number of test cases that run at the same time"), cl::init(4));
+
+cl::opt<bool>
+    Seed("seed", cl::desc("Explore concolically from the test cases instead of replaying them"), cl::init(false));
+
+cl::list<std::string>
+    TestCases(cl::Positional, cl::desc("<test cases>"), cl::OneOrMore);
+
+}
+
+namespace s2etools
+{
+
+struct ReplayJob {
+    std::string testCase;
+    std::string outputDir;
+    std::string inputBuffer;
+    int status;
+
+    ReplayJob() : status(-1) {}
+};
+
+class TestReplayer
+{
+private:
+    typedef std::map<int, ReplayJob> RunningJobs;
+
+    std::string m_outputDir;
+    RunningJobs m_running;
+    unsigned m_completed;
+    unsigned m_failed;
+
+    std::ofstream m_results;
+    std::ofstream m_traces;
+
+    bool submit(unsigned index, const std::string &testCase);
+    bool processInput(int fd, ReplayJob &job);
+    void complete(ReplayJob &job);
+    std::string findTrace(const std::string &outputDir);
+
+public:
+    TestReplayer(const std::string &outputDir);
+    bool run();
+};
+
+static std::string getAbsolutePath(const std::string &path)
+{
+    char buffer[PATH_MAX];
+    if (!realpath(path.c_str(), buffer)) {
+        return "";
+    }
+    return buffer;
+}
+
+static std::string getBaseName(const std::string &path)
+{
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    size_t dot = name.rfind('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+static std::string quoteLuaString(const std::string &s)
+{
+    std::string res = "\"";
+    for (unsigned i = 0; i < s.size(); ++i) {
+        if (s[i] == '\\' || s[i] == '"') {
+            res += '\\';
+        }
+        res += s[i];
+    }
+    return res + "\"";
+}
+
+TestReplayer::TestReplayer(const std::string &outputDir)
+{
+    m_outputDir = outputDir;
+    m_completed = 0;
+    m_failed = 0;
+
+    m_results.open((m_outputDir + "/replay.txt").c_str());
+    m_traces.open((m_outputDir + "/traces.rsp").c_str());
+}
+
+bool TestReplayer::submit(unsigned index, const std::string &testCase)
+{
+    ReplayJob job;
+    job.testCase = getAbsolutePath(testCase);
+    if (job.testCase.empty()) {
+        std::cerr << "Could not find " << testCase << std::endl;
+        return false;
+    }
+
+    std::stringstream ss;
+    ss << m_outputDir << "/" << std::setfill('0') << std::setw(6) << index
+       << "-" << getBaseName(testCase);
+    job.outputDir = ss.str();
+
+    if (mkdir(job.outputDir.c_str(), 0755) < 0 && errno != EEXIST) {
+        perror(job.outputDir.c_str());
+        return false;
+    }
+
+    //Plugins read their settings when the server starts,
+    //except for the ones a job can change in its Lua file
+    std::string luaFile = job.outputDir + "/replay.lua";
+    std::ofstream lua(luaFile.c_str());
+    lua << "pluginsConfig.BaseInstructions = pluginsConfig.BaseInstructions or {}\n"
+        << "pluginsConfig.BaseInstructions." << (Seed ? "seedKTest" : "replayKTest")
+        << " = " << quoteLuaString(job.testCase) << "\n";
+    lua.close();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, Server.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror("Could not connect to the S2E server");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    std::string request = job.outputDir + " " + luaFile + "\n";
+    if (write(fd, request.c_str(), request.size()) != (ssize_t) request.size()) {
+        perror("Could not send the job to the S2E server");
+        close(fd);
+        return false;
+    }
+
+    m_running[fd] = job;
+    return true;
+}
+
+/** Returns false once the server reported the end of the job */
+bool TestReplayer::processInput(int fd, ReplayJob &job)
+{
+    char buffer[256];
+    ssize_t ret = read(fd, buffer, sizeof(buffer));
+    if (ret <= 0) {
+        return false;
+    }
+
+    job.inputBuffer.append(buffer, ret);
+
+    size_t eol;
+    while ((eol = job.inputBuffer.find('\n')) != std::string::npos) {
+        std::stringstream reply(job.inputBuffer.substr(0, eol));
+        job.inputBuffer.erase(0, eol + 1);
+
+        std::string what;
+        reply >> what;
+        if (what == "exited") {
+            reply >> job.status;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** The job writes its results in a numbered subfolder */
+std::string TestReplayer::findTrace(const std::string &outputDir)
+{
+    DIR *dir = opendir(outputDir.c_str());
+    if (!dir) {
+        return "";
+    }
+
+    std::string trace;
+    struct dirent *entry;
+    while (trace.empty() && (entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string path = outputDir + "/" + entry->d_name + "/ExecutionTracer.dat";
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            trace = path;
+        }
+    }
+
+    closedir(dir);
+    return trace;
+}
+
+void TestReplayer::complete(ReplayJob &job)
+{
+    std::string trace = findTrace(job.outputDir);
+
+    ++m_completed;
+    if (job.status != 0) {
+        ++m_failed;
+        std::cerr << job.testCase << ": job exited with status " << job.status << std::endl;
+    }
+
+    m_results << job.testCase << " " << job.status << " "
+              << (trace.empty() ? "-" : trace) << std::endl;
+    if (!trace.empty()) {
+        m_traces << "-trace=" << trace << std::endl;
+    }
+}
+
+bool TestReplayer::run()
+{
+    unsigned next = 0;
+
+    while (next < TestCases.size() || !m_running.empty()) {
+        while (next < TestCases.size() && m_running.size() < Jobs) {
+            if (!submit(next, TestCases[next])) {
+                return false;
+            }
+            ++next;
+        }
+
+        std::vector<struct pollfd> fds;
+        for (RunningJobs::iterator it = m_running.begin(); it != m_running.end(); ++it) {
+            struct pollfd pfd;
+            pfd.fd = (*it).first;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            fds.push_back(pfd);
+        }
+
+        if (poll(&fds[0], fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return false;
+        }
+
+        for (unsigned i = 0; i < fds.size(); ++i) {
+            if (!fds[i].revents) {
+                continue;
+            }
+
+            RunningJobs::iterator it = m_running.find(fds[i].fd);
+            if (!processInput(fds[i].fd, (*it).second)) {
+                complete((*it).second);
+                close(fds[i].fd);
+                m_running.erase(it);
+            }
+        }
+    }
+
+    std::cout << "Replayed " << m_completed << " test cases, "
+              << m_failed << " failed" << std::endl;
+    return m_failed == 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, (char**) argv, " s2etestreplay");
+
+    if (Server.empty()) {
+        std::cerr << "Specify the socket of the S2E server with -server" << std::endl;
+        return -1;
+    }
+
+    if (!Jobs) {
+        Jobs = 1;
+    }
+
+    if (mkdir(OutputDir.c_str(), 0755) < 0 && errno != EEXIST) {
+        perror(OutputDir.c_str());
+        return -1;
+    }
+
+    std::string outputDir = s2etools::getAbsolutePath(OutputDir);
+    if (outputDir.empty()) {
+        perror(OutputDir.c_str());
+        return -1;
+    }
+
+    s2etools::TestReplayer replayer(outputDir);
+    return replayer.run() ? 0 : 1;
+}